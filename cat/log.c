@@ -278,30 +278,6 @@ do_log (void)
   return 0;
 }
 
-/* Find the value of the named field from the list of attributes.  If
- * not found, returns NULL (not an error).  If found, returns a
- * pointer to the field, and the length of the field.  NOTE: The field
- * is NOT \0-terminated, so you have to print it using "%.*s".
- *
- * There may be multiple fields with the same name.  In this case, the
- * function returns the first entry.
- */
-static const char *
-get_journal_field (const struct guestfs_xattr_list *xattrs, const char *name,
-                   size_t *len_rtn)
-{
-  uint32_t i;
-
-  for (i = 0; i < xattrs->len; ++i) {
-    if (STREQ (name, xattrs->val[i].attrname)) {
-      *len_rtn = xattrs->val[i].attrval_len;
-      return xattrs->val[i].attrval;
-    }
-  }
-
-  return NULL;                  /* not found */
-}
-
 static const char *const log_level_table[] = {
   [LOG_EMERG] = "emerg",
   [LOG_ALERT] = "alert",
@@ -313,93 +289,279 @@ static const char *const log_level_table[] = {
   [LOG_DEBUG] = "debug"
 };
 
+/* The fields of each journal entry which we display.  The question
+ * is what fields to display.  We should probably make this
+ * configurable, but for now use the "short" format from journalctl.
+ * (XXX)
+ */
+enum {
+  FIELD_PRIORITY,
+  //FIELD_HOSTNAME,
+  FIELD_SYSLOG_IDENTIFIER,
+  FIELD_COMM,
+  FIELD_PID,
+  FIELD_MESSAGE,
+  NR_FIELDS
+};
+
+static const char *journal_fields[NR_FIELDS+1] = {
+  [FIELD_PRIORITY] = "PRIORITY",
+  //[FIELD_HOSTNAME] = "_HOSTNAME",
+  [FIELD_SYSLOG_IDENTIFIER] = "SYSLOG_IDENTIFIER",
+  [FIELD_COMM] = "_COMM",
+  [FIELD_PID] = "_PID",
+  [FIELD_MESSAGE] = "MESSAGE",
+  [NR_FIELDS] = NULL
+};
+
+/* One journal entry.  NOTE: The fields are NOT \0-terminated, so you
+ * have to print them using "%.*s".  If there are multiple fields with
+ * the same name, only the first is kept.
+ */
+struct journal_entry {
+  int64_t ts;                   /* __REALTIME_TIMESTAMP, or -1 */
+  char *fields[NR_FIELDS];      /* NULL if the field is not present */
+  size_t lens[NR_FIELDS];
+};
+
+static void
+free_journal_entry (struct journal_entry *entry)
+{
+  size_t i;
+
+  for (i = 0; i < NR_FIELDS; ++i) {
+    free (entry->fields[i]);
+    entry->fields[i] = NULL;
+  }
+  entry->ts = -1;
+}
+
+static void
+add_journal_field (struct journal_entry *entry,
+                   const char *name, size_t namelen,
+                   char *value, size_t len)
+{
+  size_t i;
+
+  if (namelen == 20 && STREQLEN (name, "__REALTIME_TIMESTAMP", 20)) {
+    if (sscanf (value, "%" SCNi64, &entry->ts) != 1)
+      entry->ts = -1;
+    free (value);
+    return;
+  }
+
+  for (i = 0; i < NR_FIELDS; ++i) {
+    if (entry->fields[i] == NULL &&
+        strlen (journal_fields[i]) == namelen &&
+        STREQLEN (journal_fields[i], name, namelen)) {
+      entry->fields[i] = value;
+      entry->lens[i] = len;
+      return;
+    }
+  }
+  free (value);
+}
+
 static int
-do_log_journal (void)
+print_journal_entry (const struct journal_entry *entry)
 {
-  int r;
+  int priority = LOG_INFO;
+  const char *priority_str = entry->fields[FIELD_PRIORITY];
+
+  /* Timestamp. */
+  if (entry->ts >= 0) {
+    char buf[64];
+    time_t t = entry->ts / 1000000;
+    struct tm tm;
+
+    if (strftime (buf, sizeof buf, "%b %d %H:%M:%S",
+                  localtime_r (&t, &tm)) <= 0) {
+      fprintf (stderr, _("%s: could not format journal entry timestamp\n"),
+               guestfs_int_program_name);
+      return -1;
+    }
+    fputs (buf, stdout);
+  }
+
+  /* Hostname. */
+  /* We don't print this because it is assumed each line from the
+   * guest will have the same hostname.  (XXX)
+   */
+
+  /* Identifier. */
+  if (entry->fields[FIELD_SYSLOG_IDENTIFIER])
+    printf (" %.*s", (int) entry->lens[FIELD_SYSLOG_IDENTIFIER],
+            entry->fields[FIELD_SYSLOG_IDENTIFIER]);
+  else if (entry->fields[FIELD_COMM])
+    printf (" %.*s", (int) entry->lens[FIELD_COMM],
+            entry->fields[FIELD_COMM]);
+
+  /* PID */
+  if (entry->fields[FIELD_PID])
+    printf ("[%.*s]", (int) entry->lens[FIELD_PID], entry->fields[FIELD_PID]);
+
+  /* Log level. */
+  if (priority_str && *priority_str >= '0' && *priority_str <= '7')
+    priority = *priority_str - '0';
+
+  printf (" %s:", log_level_table[priority]);
+
+  /* Message. */
+  if (entry->fields[FIELD_MESSAGE])
+    printf (" %.*s", (int) entry->lens[FIELD_MESSAGE],
+            entry->fields[FIELD_MESSAGE]);
+
+  printf ("\n");
+  return 0;
+}
+
+/* Read the journal export format from 'fd' and print each entry as
+ * soon as it has been read.  This runs in a subprocess, see
+ * do_log_journal.
+ */
+static int
+print_journal_export (int fd)
+{
+  FILE *fp;
+  CLEANUP_FREE char *line = NULL;
+  size_t allocsize = 0;
+  ssize_t len;
+  struct journal_entry entry = { .ts = -1 };
   unsigned errors = 0;
 
-  if (guestfs_journal_open (g, JOURNAL_DIR) == -1)
+  fp = fdopen (fd, "r");
+  if (fp == NULL) {
+    perror ("fdopen");
     return -1;
+  }
 
-  while ((r = guestfs_journal_next (g)) > 0) {
-    CLEANUP_FREE_XATTR_LIST struct guestfs_xattr_list *xattrs = NULL;
-    const char *priority_str, *identifier, *comm, *pid, *message;
-    size_t priority_len, identifier_len, comm_len, pid_len, message_len;
-    int priority = LOG_INFO;
-    int64_t ts;
+  while ((len = getline (&line, &allocsize, fp)) > 0) {
+    char *eq, *value;
+    uint64_t vlen;
 
-    /* The question is what fields to display.  We should probably
-     * make this configurable, but for now use the "short" format from
-     * journalctl.  (XXX)
-     */
+    if (line[len-1] == '\n')
+      line[--len] = '\0';
 
-    xattrs = guestfs_journal_get (g);
-    if (xattrs == NULL)
-      return -1;
-
-    ts = guestfs_journal_get_realtime_usec (g); /* error checked below */
-
-    priority_str = get_journal_field (xattrs, "PRIORITY", &priority_len);
-    //hostname = get_journal_field (xattrs, "_HOSTNAME", &hostname_len);
-    identifier = get_journal_field (xattrs, "SYSLOG_IDENTIFIER",
-                                    &identifier_len);
-    comm = get_journal_field (xattrs, "_COMM", &comm_len);
-    pid = get_journal_field (xattrs, "_PID", &pid_len);
-    message = get_journal_field (xattrs, "MESSAGE", &message_len);
-
-    /* Timestamp. */
-    if (ts >= 0) {
-      char buf[64];
-      time_t t = ts / 1000000;
-      struct tm tm;
-
-      if (strftime (buf, sizeof buf, "%b %d %H:%M:%S",
-                    localtime_r (&t, &tm)) <= 0) {
-        fprintf (stderr, _("%s: could not format journal entry timestamp\n"),
-                 guestfs_int_program_name);
+    /* A blank line ends the entry. */
+    if (len == 0) {
+      if (print_journal_entry (&entry) == -1)
         errors++;
-        continue;
+      free_journal_entry (&entry);
+      continue;
+    }
+
+    eq = memchr (line, '=', len);
+    if (eq) {                   /* FIELD=value */
+      value = strndup (eq+1, len - (eq+1 - line));
+      if (value == NULL)
+        goto error;
+      add_journal_field (&entry, line, eq - line, value, len - (eq+1 - line));
+    }
+    else {
+      /* Binary field: the name is followed by a little-endian 64 bit
+       * length, the data and a newline.
+       */
+      unsigned char lenbuf[8];
+      size_t i;
+
+      if (fread (lenbuf, 1, sizeof lenbuf, fp) != sizeof lenbuf)
+        goto truncated;
+      vlen = 0;
+      for (i = sizeof lenbuf; i > 0; --i)
+        vlen = (vlen << 8) | lenbuf[i-1];
+      if (vlen > 64 * 1024 * 1024)
+        goto truncated;
+      value = malloc (vlen + 1);
+      if (value == NULL)
+        goto error;
+      if (fread (value, 1, vlen, fp) != vlen || getc (fp) != '\n') {
+        free (value);
+        goto truncated;
       }
-      fputs (buf, stdout);
+      value[vlen] = '\0';
+      add_journal_field (&entry, line, len, value, vlen);
     }
+  }
+  if (ferror (fp))
+    goto error;
 
-    /* Hostname. */
-    /* We don't print this because it is assumed each line from the
-     * guest will have the same hostname.  (XXX)
-     */
-    //if (hostname)
-    //  printf (" %.*s", (int) hostname_len, hostname);
+  free_journal_entry (&entry);
+  fclose (fp);
+  if (fflush (stdout) == EOF)
+    return -1;
+  return errors > 0 ? -1 : 0;
+
+ truncated:
+  fprintf (stderr, _("%s: truncated output from guestfs_journal_export\n"),
+           guestfs_int_program_name);
+  free_journal_entry (&entry);
+  fclose (fp);
+  return -1;
+
+ error:
+  perror ("journal export");
+  free_journal_entry (&entry);
+  fclose (fp);
+  return -1;
+}
 
-    /* Identifier. */
-    if (identifier)
-      printf (" %.*s", (int) identifier_len, identifier);
-    else if (comm)
-      printf (" %.*s", (int) comm_len, comm);
+/* The journal is exported over a pipe to a subprocess which prints
+ * the entries as they arrive, so the whole journal never has to be
+ * stored locally and the output starts straight away.
+ */
+static int
+do_log_journal (void)
+{
+  int fd[2];
+  char dev_fd[64];
+  pid_t pid;
+  int r, status;
 
-    /* PID */
-    if (pid)
-      printf ("[%.*s]", (int) pid_len, pid);
+  if (guestfs_journal_open (g, JOURNAL_DIR) == -1)
+    return -1;
 
-    /* Log level. */
-    if (priority_str && *priority_str >= '0' && *priority_str <= '7')
-      priority = *priority_str - '0';
+  if (pipe2 (fd, O_CLOEXEC) == -1) {
+    perror ("pipe2");
+    return -1;
+  }
 
-    printf (" %s:", log_level_table[priority]);
+  fflush (stdout);
+  pid = fork ();
+  if (pid == -1) {
+    perror ("fork");
+    close (fd[0]);
+    close (fd[1]);
+    return -1;
+  }
+  if (pid == 0) {               /* Child. */
+    close (fd[1]);
+    /* Use _exit so the libguestfs handle, which belongs to the
+     * parent, is not closed by the atexit handler.
+     */
+    _exit (print_journal_export (fd[0]) == -1 ? EXIT_FAILURE : EXIT_SUCCESS);
+  }
 
-    /* Message. */
-    if (message)
-      printf (" %.*s", (int) message_len, message);
+  /* Parent. */
+  close (fd[0]);
+  snprintf (dev_fd, sizeof dev_fd, "/dev/fd/%d", fd[1]);
+  r = guestfs_journal_export (g, dev_fd,
+                              GUESTFS_JOURNAL_EXPORT_FIELDS, journal_fields,
+                              -1);
+  close (fd[1]);
 
-    printf ("\n");
+  if (waitpid (pid, &status, 0) == -1) {
+    perror ("waitpid");
+    return -1;
   }
-  if (r == -1)                  /* error from guestfs_journal_next */
+  if (r == -1)
+    return -1;
+  if (!WIFEXITED (status) || WEXITSTATUS (status) != 0)
     return -1;
 
   if (guestfs_journal_close (g) == -1)
     return -1;
 
-  return errors > 0 ? -1 : 0;
+  return 0;
 }
 
 static int
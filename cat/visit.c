@@ -17,9 +17,15 @@
  */
 
 /**
- * This file contains a recursive function for visiting all files and
+ * This file contains a function for visiting all files and
  * directories in a guestfs filesystem.
  *
+ * The metadata of the whole tree is fetched in a single call to
+ * C<guestfs_walk_out>, and the visitor function is then called from
+ * the local copy, in the same order as the original recursive
+ * implementation which used C<guestfs_ls>, C<guestfs_lstatnslist>
+ * and C<guestfs_lxattrlist> on every directory.
+ *
  * Adapted from
  * L<https://rwmj.wordpress.com/2010/12/15/tip-audit-virtual-machine-for-setuid-files/>
  */
@@ -29,16 +35,39 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include <inttypes.h>
 #include <errno.h>
-#include <assert.h>
 #include <libintl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
 
 #include "guestfs.h"
 #include "guestfs-internal-frontend.h"
 
 #include "visit.h"
 
-static int _visit (guestfs_h *g, int depth, const char *dir, visitor_function f, void *opaque);
+/* One file or directory, parsed from the guestfs_walk_out output.
+ * The strings point into the mapped output file.
+ */
+struct visit_entry {
+  const char *path;
+  const char *parent;           /* Not \0-terminated, see parent_len. */
+  size_t parent_len;
+  const char *name;             /* NULL for the top directory. */
+  struct guestfs_statns stat;
+  struct guestfs_xattr_list xattrs;
+};
+
+struct visit_tree {
+  struct visit_entry *entries;  /* Sorted by (parent, name). */
+  size_t nr_entries;
+  struct visit_entry *top;
+};
+
+static int parse_walk_out (const char *data, size_t size, const char *dir, struct visit_tree *tree);
+static int visit_dir (struct visit_tree *tree, const char *dir, const char *path, size_t path_len, visitor_function f, void *opaque);
 
 /**
  * Visit every file and directory in a guestfs filesystem, starting
@@ -66,101 +95,270 @@ static int _visit (guestfs_h *g, int depth, const char *dir, visitor_function f,
 int
 visit (guestfs_h *g, const char *dir, visitor_function f, void *opaque)
 {
-  return _visit (g, 0, dir, f, opaque);
+  CLEANUP_FREE char *tmpdir = guestfs_get_tmpdir (g);
+  CLEANUP_UNLINK_FREE char *localfile = NULL;
+  char dev_fd[64];
+  int fd = -1, r = -1;
+  struct stat statbuf;
+  void *data = MAP_FAILED;
+  struct visit_tree tree = { .entries = NULL, .nr_entries = 0, .top = NULL };
+  size_t i, len;
+
+  if (tmpdir == NULL)
+    return -1;
+  if (asprintf (&localfile, "%s/visitXXXXXX", tmpdir) == -1) {
+    perror ("asprintf");
+    return -1;
+  }
+  fd = mkstemp (localfile);
+  if (fd == -1) {
+    perror ("mkstemp");
+    return -1;
+  }
+
+  snprintf (dev_fd, sizeof dev_fd, "/dev/fd/%d", fd);
+  if (guestfs_walk_out (g, dir, dev_fd, -1) == -1)
+    goto out;
+
+  if (fstat (fd, &statbuf) == -1) {
+    perror (localfile);
+    goto out;
+  }
+  /* The output always contains at least the top directory. */
+  if (statbuf.st_size == 0) {
+    fprintf (stderr, _("%s: %s: empty output from guestfs_walk_out\n"),
+             guestfs_int_program_name, dir);
+    goto out;
+  }
+  data = mmap (NULL, statbuf.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (data == MAP_FAILED) {
+    perror ("mmap");
+    goto out;
+  }
+
+  if (parse_walk_out (data, statbuf.st_size, dir, &tree) == -1)
+    goto out;
+
+  /* Call 'f' with the top directory. */
+  if (f (dir, NULL, &tree.top->stat, &tree.top->xattrs, opaque) == -1)
+    goto out;
+
+  len = strlen (dir);
+  if (len > 1 && dir[len-1] == '/')
+    len--;
+  r = visit_dir (&tree, dir, dir, len, f, opaque);
+
+ out:
+  for (i = 0; i < tree.nr_entries; ++i)
+    free (tree.entries[i].xattrs.val);
+  if (tree.top)
+    free (tree.top->xattrs.val);
+  free (tree.entries);
+  free (tree.top);
+  if (data != MAP_FAILED)
+    munmap (data, statbuf.st_size);
+  close (fd);
+  return r;
+}
+
+/* Return the next \0-terminated field, or NULL if the data is
+ * truncated.
+ */
+static const char *
+next_field (const char **p, const char *end)
+{
+  const char *field = *p;
+  const char *nul = memchr (field, '\0', end - field);
+
+  if (nul == NULL)
+    return NULL;
+  *p = nul + 1;
+  return field;
 }
 
 static int
-_visit (guestfs_h *g, int depth, const char *dir,
-        visitor_function f, void *opaque)
+compare_entries (const void *vp1, const void *vp2)
 {
-  /* Call 'f' with the top directory.  Note that ordinary recursive
-   * visits will not otherwise do this, so we have to have a special
-   * case.
-   */
-  if (depth == 0) {
-    CLEANUP_FREE_STATNS struct guestfs_statns *stat = NULL;
-    CLEANUP_FREE_XATTR_LIST struct guestfs_xattr_list *xattrs = NULL;
-    int r;
+  const struct visit_entry *e1 = vp1;
+  const struct visit_entry *e2 = vp2;
+  size_t len = e1->parent_len < e2->parent_len ?
+    e1->parent_len : e2->parent_len;
+  int r;
 
-    stat = guestfs_lstatns (g, dir);
-    if (stat == NULL)
+  r = memcmp (e1->parent, e2->parent, len);
+  if (r != 0)
+    return r;
+  if (e1->parent_len != e2->parent_len)
+    return e1->parent_len < e2->parent_len ? -1 : 1;
+  return strcmp (e1->name, e2->name);
+}
+
+static int
+parse_walk_out (const char *data, size_t size, const char *dir,
+                struct visit_tree *tree)
+{
+  const char *p = data, *end = data + size;
+  const char *str, *slash;
+  size_t alloc = 0, j, nr_xattrs;
+  struct visit_entry e;
+  uint32_t vlen;
+
+  while (p < end) {
+    memset (&e, 0, sizeof e);
+
+    e.path = next_field (&p, end);
+    str = next_field (&p, end);
+    if (e.path == NULL || str == NULL)
+      goto truncated;
+    if (sscanf (str,
+                "%" SCNi64 " %" SCNi64 " %" SCNi64 " %" SCNi64
+                " %" SCNi64 " %" SCNi64 " %" SCNi64 " %" SCNi64
+                " %" SCNi64 " %" SCNi64 " %" SCNi64 " %" SCNi64
+                " %" SCNi64 " %" SCNi64 " %" SCNi64 " %" SCNi64,
+                &e.stat.st_dev, &e.stat.st_ino,
+                &e.stat.st_mode, &e.stat.st_nlink,
+                &e.stat.st_uid, &e.stat.st_gid,
+                &e.stat.st_rdev, &e.stat.st_size,
+                &e.stat.st_blksize, &e.stat.st_blocks,
+                &e.stat.st_atime_sec, &e.stat.st_atime_nsec,
+                &e.stat.st_mtime_sec, &e.stat.st_mtime_nsec,
+                &e.stat.st_ctime_sec, &e.stat.st_ctime_nsec) != 16) {
+      fprintf (stderr, _("%s: cannot parse stat fields for %s\n"),
+               guestfs_int_program_name, e.path);
       return -1;
+    }
 
-    xattrs = guestfs_lgetxattrs (g, dir);
-    if (xattrs == NULL)
+    /* Link target, which we don't use here. */
+    if (next_field (&p, end) == NULL)
+      goto truncated;
+
+    str = next_field (&p, end);
+    if (str == NULL || sscanf (str, "%zu", &nr_xattrs) != 1)
+      goto truncated;
+    e.xattrs.len = nr_xattrs;
+    e.xattrs.val = calloc (nr_xattrs > 0 ? nr_xattrs : 1,
+                           sizeof (struct guestfs_xattr));
+    if (e.xattrs.val == NULL) {
+      perror ("calloc");
       return -1;
+    }
+    for (j = 0; j < nr_xattrs; ++j) {
+      e.xattrs.val[j].attrname = (char *) next_field (&p, end);
+      str = next_field (&p, end);
+      if (e.xattrs.val[j].attrname == NULL || str == NULL ||
+          sscanf (str, "%" SCNu32, &vlen) != 1 ||
+          (size_t) (end - p) < vlen) {
+        free (e.xattrs.val);
+        goto truncated;
+      }
+      e.xattrs.val[j].attrval_len = vlen;
+      e.xattrs.val[j].attrval = (char *) p;
+      p += vlen;
+    }
 
-    r = f (dir, NULL, stat, xattrs, opaque);
+    /* The first record is always the top directory. */
+    if (tree->top == NULL) {
+      tree->top = malloc (sizeof e);
+      if (tree->top == NULL) {
+        perror ("malloc");
+        free (e.xattrs.val);
+        return -1;
+      }
+      *tree->top = e;
+      continue;
+    }
 
-    if (r == -1)
+    slash = strrchr (e.path, '/');
+    if (slash == NULL) {
+      fprintf (stderr, _("%s: unexpected path from guestfs_walk_out: %s\n"),
+               guestfs_int_program_name, e.path);
+      free (e.xattrs.val);
       return -1;
+    }
+    e.parent = e.path;
+    e.parent_len = slash == e.path ? 1 : slash - e.path;
+    e.name = slash + 1;
+
+    if (tree->nr_entries >= alloc) {
+      struct visit_entry *entries;
+
+      alloc = alloc == 0 ? 1024 : alloc * 2;
+      entries = realloc (tree->entries, alloc * sizeof (struct visit_entry));
+      if (entries == NULL) {
+        perror ("realloc");
+        free (e.xattrs.val);
+        return -1;
+      }
+      tree->entries = entries;
+    }
+    tree->entries[tree->nr_entries++] = e;
   }
 
-  size_t i, xattrp;
-  CLEANUP_FREE_STRING_LIST char **names = NULL;
-  CLEANUP_FREE_STAT_LIST struct guestfs_statns_list *stats = NULL;
-  CLEANUP_FREE_XATTR_LIST struct guestfs_xattr_list *xattrs = NULL;
+  if (tree->top == NULL)
+    goto truncated;
 
-  names = guestfs_ls (g, dir);
-  if (names == NULL)
-    return -1;
+  qsort (tree->entries, tree->nr_entries, sizeof (struct visit_entry),
+         compare_entries);
+  return 0;
 
-  stats = guestfs_lstatnslist (g, dir, names);
-  if (stats == NULL)
-    return -1;
+ truncated:
+  fprintf (stderr, _("%s: %s: truncated output from guestfs_walk_out\n"),
+           guestfs_int_program_name, dir);
+  return -1;
+}
 
-  xattrs = guestfs_lxattrlist (g, dir, names);
-  if (xattrs == NULL)
-    return -1;
+/* Call 'f' on everything in the directory 'path' (of length
+ * 'path_len'), then recurse into the subdirectories.  'dir' is the
+ * name of the directory passed to 'f'.
+ */
+static int
+visit_dir (struct visit_tree *tree, const char *dir,
+           const char *path, size_t path_len,
+           visitor_function f, void *opaque)
+{
+  size_t lo = 0, hi = tree->nr_entries, first, i;
+  struct visit_entry *e;
 
-  /* Call function on everything in this directory. */
-  for (i = 0, xattrp = 0; names[i] != NULL; ++i, ++xattrp) {
-    CLEANUP_FREE char *path = NULL;
-    CLEANUP_FREE char *attrval = NULL;
-    struct guestfs_xattr_list file_xattrs;
-    size_t nr_xattrs;
+  /* Find the first entry whose parent is 'path'. */
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    size_t len;
+    int r;
 
-    assert (stats->len >= i);
-    assert (xattrs->len >= xattrp);
+    e = &tree->entries[mid];
+    len = e->parent_len < path_len ? e->parent_len : path_len;
+    r = memcmp (e->parent, path, len);
+    if (r == 0 && e->parent_len != path_len)
+      r = e->parent_len < path_len ? -1 : 1;
+    if (r < 0)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  first = lo;
 
-    /* Find the list of extended attributes for this file. */
-    assert (strlen (xattrs->val[xattrp].attrname) == 0);
+#define IN_DIR(e) \
+  ((e)->parent_len == path_len && memcmp ((e)->parent, path, path_len) == 0)
 
-    if (xattrs->val[xattrp].attrval_len == 0) {
-      fprintf (stderr, _("%s: error getting extended attrs for %s %s\n"),
-               guestfs_int_program_name, dir, names[i]);
-      return -1;
-    }
-    /* attrval is not \0-terminated. */
-    attrval = malloc (xattrs->val[xattrp].attrval_len + 1);
-    if (attrval == NULL) {
-      perror ("malloc");
-      return -1;
-    }
-    memcpy (attrval, xattrs->val[xattrp].attrval,
-            xattrs->val[xattrp].attrval_len);
-    attrval[xattrs->val[xattrp].attrval_len] = '\0';
-    if (sscanf (attrval, "%zu", &nr_xattrs) != 1) {
-      fprintf (stderr, _("%s: error: cannot parse xattr count for %s %s\n"),
-               guestfs_int_program_name, dir, names[i]);
+  /* Call function on everything in this directory. */
+  for (i = first; i < tree->nr_entries && IN_DIR (&tree->entries[i]); ++i) {
+    e = &tree->entries[i];
+    if (f (dir, e->name, &e->stat, &e->xattrs, opaque) == -1)
       return -1;
-    }
-
-    file_xattrs.len = nr_xattrs;
-    file_xattrs.val = &xattrs->val[xattrp+1];
-    xattrp += nr_xattrs;
+  }
 
-    /* Call the function. */
-    if (f (dir, names[i], &stats->val[i], &file_xattrs, opaque) == -1)
-      return -1;
+  /* Recursively call visit, but only on directories. */
+  for (i = first; i < tree->nr_entries && IN_DIR (&tree->entries[i]); ++i) {
+    e = &tree->entries[i];
+    if (is_dir (e->stat.st_mode)) {
+      CLEANUP_FREE char *subdir = full_path (dir, e->name);
 
-    /* Recursively call visit, but only on directories. */
-    if (is_dir (stats->val[i].st_mode)) {
-      path = full_path (dir, names[i]);
-      if (_visit (g, depth + 1, path, f, opaque) == -1)
+      if (visit_dir (tree, subdir, e->path, strlen (e->path),
+                     f, opaque) == -1)
         return -1;
     }
   }
+#undef IN_DIR
 
   return 0;
 }
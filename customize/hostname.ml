@@ -97,7 +97,7 @@ and read_etc_hostname g =
 and replace_host_in_etc_hosts g oldhost newhost =
   if g#is_file "/etc/hosts" then (
     let expr = "/files/etc/hosts/*[label() != '#comment']/*[label() != 'ipaddr']" in
-    g#aug_init "/" 0;
+    g#aug_init_files "/" 0 [| "Hosts.lns:/etc/hosts" |];
     let matches = Array.to_list (g#aug_match expr) in
     List.iter (
       fun m ->
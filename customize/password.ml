@@ -87,7 +87,7 @@ let rec set_linux_passwords ?password_crypto (g : Guestfs.guestfs) root password
   g#write tempfile "*";
   g#copy_attributes ~all:true "/etc/shadow" tempfile;
 
-  g#aug_init "/" 0;
+  g#aug_init_files "/" 0 [| "Shadow.lns:/etc/shadow" |];
   let users = Array.to_list (g#aug_ls "/files/etc/shadow") in
   List.iter (
     fun userpath ->
@@ -105,7 +105,7 @@ let do_ssh_inject_unix (g : Guestfs.guestfs) user selector =
   let key = if key.[len-1] = '\n' then key else key ^ "\n" in
 
   (* Get user's home directory. *)
-  g#aug_init "/" 0;
+  g#aug_init_files "/" 0 [| "Passwd.lns:/etc/passwd" |];
   let read_user_detail what =
     try
       let expr = sprintf "/files/etc/passwd/%s/%s" user what in
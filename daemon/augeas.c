@@ -22,6 +22,8 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <errno.h>
+#include <sys/stat.h>
 
 #include <augeas.h>
 
@@ -53,6 +55,133 @@ int augeas_version;
  */
 static augeas *aug = NULL;
 
+/* Augeas only notices that a file has changed if its mtime in
+ * seconds is different, so files modified twice within one second
+ * (which is common when libguestfs writes them) are not reparsed by
+ * aug_load.  We keep the full stat of every file as it was loaded,
+ * and before each load mark the files which have changed so that
+ * Augeas reparses those, and only those.
+ */
+struct loaded_file {
+  char *path;                   /* Path relative to aug_root. */
+  struct timespec mtim;
+  off_t size;
+  ino_t ino;
+};
+static char *aug_root = NULL;   /* Root passed to aug_init. */
+static struct loaded_file *loaded_files = NULL;
+static size_t nr_loaded_files = 0;
+
+static void
+free_loaded_files (void)
+{
+  size_t i;
+
+  for (i = 0; i < nr_loaded_files; ++i)
+    free (loaded_files[i].path);
+  free (loaded_files);
+  loaded_files = NULL;
+  nr_loaded_files = 0;
+}
+
+static void
+close_aug (void)
+{
+  if (aug) {
+    aug_close (aug);
+    aug = NULL;
+  }
+  free_loaded_files ();
+  free (aug_root);
+  aug_root = NULL;
+}
+
+/* Record the stat of every file in the tree.  This is called after
+ * each load or save.  It is only an optimization, so errors are
+ * ignored (the files are then simply left to Augeas to check).
+ */
+static void
+record_loaded_files (void)
+{
+  char **matches = NULL;
+  int r, i;
+  size_t n = 0;
+  const size_t prefixlen = strlen ("/augeas/files");
+  const size_t suffixlen = strlen ("/mtime");
+
+  free_loaded_files ();
+
+  r = aug_match (aug, "/augeas/files//mtime", &matches);
+  if (r <= 0)
+    return;
+
+  loaded_files = calloc (r, sizeof (struct loaded_file));
+  if (loaded_files == NULL)
+    goto out;
+
+  for (i = 0; i < r; ++i) {
+    size_t len = strlen (matches[i]);
+    CLEANUP_FREE char *fullpath = NULL;
+    struct stat statbuf;
+    char *path;
+
+    if (len <= prefixlen + suffixlen)
+      continue;
+    path = strndup (matches[i] + prefixlen, len - prefixlen - suffixlen);
+    if (path == NULL)
+      continue;
+    if (asprintf (&fullpath, "%s%s", aug_root, path) == -1 ||
+        stat (fullpath, &statbuf) == -1) {
+      free (path);
+      continue;
+    }
+
+    loaded_files[n].path = path;
+    loaded_files[n].mtim = statbuf.st_mtim;
+    loaded_files[n].size = statbuf.st_size;
+    loaded_files[n].ino = statbuf.st_ino;
+    n++;
+  }
+  nr_loaded_files = n;
+
+ out:
+  for (i = 0; i < r; ++i)
+    free (matches[i]);
+  free (matches);
+}
+
+/* Before calling aug_load, remove the mtime recorded by Augeas for
+ * each file which has changed since it was loaded.  This forces
+ * Augeas to reparse it.  Unchanged files are not reparsed.
+ */
+static void
+mark_changed_files (void)
+{
+  size_t i;
+
+  for (i = 0; i < nr_loaded_files; ++i) {
+    const struct loaded_file *f = &loaded_files[i];
+    CLEANUP_FREE char *fullpath = NULL, *mtimepath = NULL;
+    struct stat statbuf;
+
+    if (asprintf (&fullpath, "%s%s", aug_root, f->path) == -1)
+      continue;
+    if (stat (fullpath, &statbuf) == 0 &&
+        statbuf.st_mtim.tv_sec == f->mtim.tv_sec &&
+        statbuf.st_mtim.tv_nsec == f->mtim.tv_nsec &&
+        statbuf.st_size == f->size &&
+        statbuf.st_ino == f->ino)
+      continue;
+
+    if (verbose)
+      fprintf (stderr, "augeas: %s has changed, it will be reloaded\n",
+               f->path);
+    if (asprintf (&mtimepath, "/augeas/files%s/mtime", f->path) == -1)
+      continue;
+    aug_rm (aug, mtimepath);
+  }
+}
+
 void
 aug_read_version (void)
 {
@@ -101,10 +230,7 @@ void aug_finalize (void) __attribute__((destructor));
 void
 aug_finalize (void)
 {
-  if (aug) {
-    aug_close (aug);
-    aug = NULL;
-  }
+  close_aug ();
 }
 
 #define NEED_AUG(errcode)						\
@@ -116,45 +242,51 @@ aug_finalize (void)
   }									\
   while (0)
 
-/* We need to rewrite the root path so it is based at /sysroot. */
-int
-do_aug_init (const char *root, int flags)
+/* Create the Augeas handle.  We need to rewrite the root path so it
+ * is based at /sysroot.  On error this calls reply_with_* and returns
+ * -1.
+ */
+static int
+open_aug (const char *root, int flags)
 {
-  CLEANUP_FREE char *buf = NULL;
-
-  if (aug) {
-    aug_close (aug);
-    aug = NULL;
-  }
+  close_aug ();
 
-  buf = sysroot_path (root);
-  if (!buf) {
+  aug_root = sysroot_path (root);
+  if (!aug_root) {
     reply_with_perror ("malloc");
     return -1;
   }
 
   /* Pass AUG_NO_ERR_CLOSE so we can display detailed errors. */
-  aug = aug_init (buf, "/usr/share/guestfs/", flags | AUG_NO_ERR_CLOSE);
+  aug = aug_init (aug_root, "/usr/share/guestfs/", flags | AUG_NO_ERR_CLOSE);
 
   if (!aug) {
     reply_with_error ("augeas initialization failed");
+    close_aug ();
     return -1;
   }
 
   if (aug_error (aug) != AUG_NOERROR) {
     AUGEAS_ERROR ("aug_init: %s (flags %d)", root, flags);
-    aug_close (aug);
-    aug = NULL;
+    close_aug ();
     return -1;
   }
 
+  return 0;
+}
+
+int
+do_aug_init (const char *root, int flags)
+{
+  if (open_aug (root, flags) == -1)
+    return -1;
+
   if (!augeas_is_version (1, 2, 1)) {
     int r = aug_transform (aug, "guestfs_shadow", "/etc/shadow",
                            0 /* = included */);
     if (r == -1) {
       AUGEAS_ERROR ("aug_transform");
-      aug_close (aug);
-      aug = NULL;
+      close_aug ();
       return -1;
     }
 
@@ -167,6 +299,75 @@ do_aug_init (const char *root, int flags)
     }
   }
 
+  if ((flags & AUG_NO_LOAD) == 0)
+    record_loaded_files ();
+
+  return 0;
+}
+
+/* Like aug_init, but instead of loading every lens and every file
+ * they match, load only the lenses and files in 'transforms'.  Each
+ * element is "LENS:FILE", eg. "Hosts.lns:/etc/hosts".
+ */
+int
+do_aug_init_files (const char *root, int flags, char *const *transforms)
+{
+  size_t i;
+
+  /* AUG_NO_MODL_AUTOLOAD stops Augeas from loading every module
+   * during aug_init.  The lenses we name are loaded on demand by
+   * aug_load instead.
+   */
+  if (open_aug (root, flags | AUG_NO_MODL_AUTOLOAD | AUG_NO_LOAD) == -1)
+    return -1;
+
+  for (i = 0; transforms[i] != NULL; ++i) {
+    CLEANUP_FREE char *lens = NULL;
+    const char *file;
+    char *p;
+
+    p = strchr (transforms[i], ':');
+    if (p == NULL || p == transforms[i] || p[1] != '/') {
+      reply_with_error ("%s: transform must be \"LENS:/FILE\"",
+                        transforms[i]);
+      close_aug ();
+      return -1;
+    }
+    lens = strndup (transforms[i], p - transforms[i]);
+    if (lens == NULL) {
+      reply_with_perror ("strndup");
+      close_aug ();
+      return -1;
+    }
+    file = p+1;
+
+    /* Augeas < 1.2.1 has no usable Shadow lens, see do_aug_init. */
+    if (!augeas_is_version (1, 2, 1) && STREQ (lens, "Shadow.lns")) {
+      free (lens);
+      lens = strdup ("Guestfs_Shadow.lns");
+      if (lens == NULL) {
+        reply_with_perror ("strdup");
+        close_aug ();
+        return -1;
+      }
+    }
+
+    if (aug_transform (aug, lens, file, 0 /* = included */) == -1) {
+      AUGEAS_ERROR ("aug_transform: %s: %s", lens, file);
+      close_aug ();
+      return -1;
+    }
+  }
+
+  if ((flags & AUG_NO_LOAD) == 0) {
+    if (aug_load (aug) == -1) {
+      AUGEAS_ERROR ("aug_load");
+      close_aug ();
+      return -1;
+    }
+    record_loaded_files ();
+  }
+
   return 0;
 }
 
@@ -175,8 +376,7 @@ do_aug_close (void)
 {
   NEED_AUG(-1);
 
-  aug_close (aug);
-  aug = NULL;
+  close_aug ();
 
   return 0;
 }
@@ -380,6 +580,9 @@ do_aug_save (void)
     return -1;
   }
 
+  /* Saving updates the files, and Augeas' record of their mtimes. */
+  record_loaded_files ();
+
   return 0;
 }
 
@@ -388,11 +591,15 @@ do_aug_load (void)
 {
   NEED_AUG (-1);
 
+  mark_changed_files ();
+
   if (aug_load (aug) == -1) {
     AUGEAS_ERROR ("aug_load");
     return -1;
   }
 
+  record_loaded_files ();
+
   return 0;
 }
 
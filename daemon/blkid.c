@@ -24,12 +24,98 @@
 #include <unistd.h>
 #include <limits.h>
 
+#ifdef HAVE_BLKID
+#include <blkid.h>
+#endif
+
 #include "daemon.h"
 #include "actions.h"
 #include "optgroups.h"
 
 GUESTFSD_EXT_CMD(str_blkid, blkid);
 
+/* Cache of probe results, see do_probe_block_devices.  This is
+ * dropped by blkid_cache_invalidate, which is called (through
+ * invalidate_device_caches) by anything which writes to block
+ * devices.
+ */
+struct probe {
+  char *device;
+  char *type;
+  char *label;
+  char *uuid;
+  char *partuuid;
+  char *usage;
+};
+
+static struct probe *probes = NULL;
+static size_t nr_probes = 0;
+
+static void
+free_probe (struct probe *probe)
+{
+  free (probe->device);
+  free (probe->type);
+  free (probe->label);
+  free (probe->uuid);
+  free (probe->partuuid);
+  free (probe->usage);
+}
+
+void
+blkid_cache_invalidate (void)
+{
+  size_t i;
+
+  for (i = 0; i < nr_probes; ++i)
+    free_probe (&probes[i]);
+  free (probes);
+  probes = NULL;
+  nr_probes = 0;
+}
+
+static struct probe *
+find_probe (const char *device)
+{
+  size_t i;
+
+  for (i = 0; i < nr_probes; ++i)
+    if (STREQ (probes[i].device, device))
+      return &probes[i];
+  return NULL;
+}
+
+static int probe_device (const char *device, struct probe *probe);
+
+/* Return the cached probe for 'device', probing it if it is not in
+ * the cache.  Returns NULL if the device could not be probed.  This
+ * does not call reply_with_*, so callers can fall back to running
+ * the blkid command or skip the device.
+ */
+static struct probe *
+get_probe (const char *device)
+{
+  struct probe *probe;
+  struct probe new_probe;
+
+  probe = find_probe (device);
+  if (probe)
+    return probe;
+
+  if (probe_device (device, &new_probe) == -1)
+    return NULL;
+
+  probe = realloc (probes, (nr_probes+1) * sizeof (struct probe));
+  if (probe == NULL) {
+    perror ("realloc");
+    free_probe (&new_probe);
+    return NULL;
+  }
+  probes = probe;
+  probes[nr_probes] = new_probe;
+  return &probes[nr_probes++];
+}
+
 char *
 get_blkid_tag (const char *device, const char *tag)
 {
@@ -37,6 +123,25 @@ get_blkid_tag (const char *device, const char *tag)
   CLEANUP_FREE char *err = NULL;
   int r;
   size_t len;
+  const char *value = NULL;
+  struct probe *probe;
+
+  /* Try the cache first. */
+  if (STREQ (tag, "TYPE") || STREQ (tag, "LABEL") || STREQ (tag, "UUID")) {
+    probe = get_probe (device);
+    if (probe) {
+      if (STREQ (tag, "TYPE"))
+        value = probe->type;
+      else if (STREQ (tag, "LABEL"))
+        value = probe->label;
+      else
+        value = probe->uuid;
+      out = strdup (value);
+      if (out == NULL)
+        reply_with_perror ("strdup");
+      return out;
+    }
+  }
 
   r = commandr (&out, &err,
                 str_blkid,
@@ -247,3 +352,238 @@ do_blkid (const char *device)
   else
     return blkid_without_p_i_opt (device);
 }
+
+#ifdef HAVE_BLKID
+
+/* Copy a value from the probe, or "" if it is not present. */
+static char *
+probe_value (blkid_probe pr, const char *name)
+{
+  const char *data;
+  char *ret;
+
+  if (blkid_probe_lookup_value (pr, name, &data, NULL) != 0)
+    data = "";
+
+  ret = strdup (data);
+  if (ret == NULL)
+    perror ("strdup");
+  return ret;
+}
+
+/* Probe the device in-process using the low-level libblkid API.
+ * This finds the same superblocks as running 'blkid -p', without
+ * running an external program for each device.
+ */
+static int
+probe_device (const char *device, struct probe *probe)
+{
+  blkid_probe pr;
+  int r;
+
+  memset (probe, 0, sizeof *probe);
+
+  pr = blkid_new_probe_from_filename (device);
+  if (pr == NULL) {
+    perror (device);
+    return -1;
+  }
+
+  blkid_probe_enable_superblocks (pr, 1);
+  blkid_probe_set_superblocks_flags (pr,
+                                     BLKID_SUBLKS_LABEL | BLKID_SUBLKS_UUID |
+                                     BLKID_SUBLKS_TYPE | BLKID_SUBLKS_USAGE);
+  blkid_probe_enable_partitions (pr, 1);
+  blkid_probe_set_partitions_flags (pr, BLKID_PARTS_ENTRY_DETAILS);
+
+  /* 0 = found, 1 = nothing found, -2 = ambivalent result (treated
+   * like nothing found, as the blkid command does), -1 = error.
+   */
+  r = blkid_do_safeprobe (pr);
+  if (r == -1) {
+    fprintf (stderr, "%s: libblkid probe failed\n", device);
+    blkid_free_probe (pr);
+    return -1;
+  }
+
+  probe->device = strdup (device);
+  if (probe->device == NULL) {
+    perror ("strdup");
+    goto error;
+  }
+  if ((probe->type = probe_value (pr, "TYPE")) == NULL ||
+      (probe->label = probe_value (pr, "LABEL")) == NULL ||
+      (probe->uuid = probe_value (pr, "UUID")) == NULL ||
+      (probe->partuuid = probe_value (pr, "PART_ENTRY_UUID")) == NULL ||
+      (probe->usage = probe_value (pr, "USAGE")) == NULL)
+    goto error;
+
+  blkid_free_probe (pr);
+  return 0;
+
+ error:
+  blkid_free_probe (pr);
+  free_probe (probe);
+  return -1;
+}
+
+#else /* !HAVE_BLKID */
+
+/* Without libblkid, fall back to running 'blkid -o export'. */
+static int
+probe_device (const char *device, struct probe *probe)
+{
+  CLEANUP_FREE char *out = NULL, *err = NULL;
+  CLEANUP_FREE_STRING_LIST char **lines = NULL;
+  char **field;
+  size_t i;
+  int r;
+
+  memset (probe, 0, sizeof *probe);
+
+  r = commandr (&out, &err, str_blkid, "-c", "/dev/null",
+                "-o", "export", device, NULL);
+  if (r != 0 && r != 2) {       /* 2 means nothing was found */
+    fprintf (stderr, "%s: %s\n", device, err);
+    return -1;
+  }
+
+  lines = split_lines (out);
+  if (lines == NULL)
+    return -1;
+
+  probe->device = strdup (device);
+  if (probe->device == NULL)
+    goto error;
+
+  for (i = 0; lines[i] != NULL; ++i) {
+    char *eq = strchr (lines[i], '=');
+
+    if (eq == NULL)
+      continue;
+    *eq = '\0';
+
+    if (STREQ (lines[i], "TYPE"))
+      field = &probe->type;
+    else if (STREQ (lines[i], "LABEL"))
+      field = &probe->label;
+    else if (STREQ (lines[i], "UUID"))
+      field = &probe->uuid;
+    else if (STREQ (lines[i], "PARTUUID"))
+      field = &probe->partuuid;
+    else if (STREQ (lines[i], "USAGE"))
+      field = &probe->usage;
+    else
+      continue;
+
+    if (*field == NULL) {
+      *field = strdup (eq+1);
+      if (*field == NULL)
+        goto error;
+    }
+  }
+
+  if ((!probe->type && (probe->type = strdup ("")) == NULL) ||
+      (!probe->label && (probe->label = strdup ("")) == NULL) ||
+      (!probe->uuid && (probe->uuid = strdup ("")) == NULL) ||
+      (!probe->partuuid && (probe->partuuid = strdup ("")) == NULL) ||
+      (!probe->usage && (probe->usage = strdup ("")) == NULL))
+    goto error;
+
+  return 0;
+
+ error:
+  perror ("strdup");
+  free_probe (probe);
+  return -1;
+}
+
+#endif /* !HAVE_BLKID */
+
+/* Add the probe results for each device in 'devices' to 'ret'.
+ * Devices which cannot be probed are skipped.
+ */
+static int
+add_probes (guestfs_int_blkprobe_list *ret, char **devices)
+{
+  size_t i, n;
+  guestfs_int_blkprobe *p;
+
+  if (devices == NULL)
+    return -1;
+
+  n = count_strings (devices);
+  p = realloc (ret->guestfs_int_blkprobe_list_val,
+               (ret->guestfs_int_blkprobe_list_len + n) *
+               sizeof (guestfs_int_blkprobe));
+  if (p == NULL && ret->guestfs_int_blkprobe_list_len + n > 0) {
+    reply_with_perror ("realloc");
+    free_stringslen (devices, n);
+    return -1;
+  }
+  ret->guestfs_int_blkprobe_list_val = p;
+
+  for (i = 0; i < n; ++i) {
+    struct probe *probe;
+    guestfs_int_blkprobe *r;
+
+    /* Don't fail the whole call because one device could not be
+     * probed (eg. an LV which is not active).
+     */
+    probe = get_probe (devices[i]);
+    if (probe == NULL) {
+      fprintf (stderr, "probe_block_devices: %s: ignored\n", devices[i]);
+      continue;
+    }
+
+    r = &ret->guestfs_int_blkprobe_list_val[ret->guestfs_int_blkprobe_list_len];
+    memset (r, 0, sizeof *r);
+    ret->guestfs_int_blkprobe_list_len++;
+    if ((r->blkprobe_device = strdup (probe->device)) == NULL ||
+        (r->blkprobe_type = strdup (probe->type)) == NULL ||
+        (r->blkprobe_label = strdup (probe->label)) == NULL ||
+        (r->blkprobe_uuid = strdup (probe->uuid)) == NULL ||
+        (r->blkprobe_partuuid = strdup (probe->partuuid)) == NULL ||
+        (r->blkprobe_usage = strdup (probe->usage)) == NULL) {
+      reply_with_perror ("strdup");
+      free_stringslen (devices, n);
+      return -1;
+    }
+  }
+
+  free_stringslen (devices, n);
+  return 0;
+}
+
+guestfs_int_blkprobe_list *
+do_probe_block_devices (void)
+{
+  guestfs_int_blkprobe_list *ret;
+
+  ret = calloc (1, sizeof *ret);
+  if (ret == NULL) {
+    reply_with_perror ("calloc");
+    return NULL;
+  }
+
+  if (add_probes (ret, do_list_devices ()) == -1 ||
+      add_probes (ret, do_list_partitions ()) == -1 ||
+      add_probes (ret, do_list_md_devices ()) == -1)
+    goto error;
+
+  if (optgroup_lvm2_available () &&
+      add_probes (ret, do_lvs ()) == -1)
+    goto error;
+
+  if (optgroup_ldm_available () &&
+      (add_probes (ret, do_list_ldm_volumes ()) == -1 ||
+       add_probes (ret, do_list_ldm_partitions ()) == -1))
+    goto error;
+
+  return ret;
+
+ error:
+  xdr_free ((xdrproc_t) xdr_guestfs_int_blkprobe_list, (char *) ret);
+  free (ret);
+  return NULL;
+}
@@ -156,5 +156,7 @@ do_blockdev_flushbufs (const char *device)
 int
 do_blockdev_rereadpt (const char *device)
 {
+  invalidate_device_caches ();
+
   return call_blockdev (device, "--rereadpt", -1, 0);
 }
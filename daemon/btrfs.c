@@ -164,6 +164,8 @@ do_mkfs_btrfs (char *const *devices,
   char nodesize_s[64];
   char sectorsize_s[64];
 
+  invalidate_device_caches ();
+
   if (nr_devices == 0) {
     reply_with_error ("list of devices must be non-empty");
     return -1;
@@ -741,6 +743,8 @@ do_btrfs_device_add (char *const *devices, const char *fs)
   CLEANUP_FREE char *err = NULL;
   int r;
 
+  invalidate_device_caches ();
+
   if (nr_devices == 0)
     return 0;
 
@@ -783,6 +787,8 @@ do_btrfs_device_delete (char *const *devices, const char *fs)
 {
   size_t nr_devices = count_strings (devices);
 
+  invalidate_device_caches ();
+
   if (nr_devices == 0)
     return 0;
 
@@ -2054,6 +2060,8 @@ do_btrfstune_seeding (const char *device, int svalue)
   int r;
   const char *s_value = svalue ? "1" : "0";
 
+  invalidate_device_caches ();
+
   ADD_ARG (argv, i, str_btrfstune);
   ADD_ARG (argv, i, "-S");
   ADD_ARG (argv, i, s_value);
@@ -2080,6 +2088,8 @@ do_btrfstune_enable_extended_inode_refs (const char *device)
   CLEANUP_FREE char *err = NULL;
   int r;
 
+  invalidate_device_caches ();
+
   ADD_ARG (argv, i, str_btrfstune);
   ADD_ARG (argv, i, "-r");
   ADD_ARG (argv, i, device);
@@ -2103,6 +2113,8 @@ do_btrfstune_enable_skinny_metadata_extent_refs (const char *device)
   CLEANUP_FREE char *err = NULL;
   int r;
 
+  invalidate_device_caches ();
+
   ADD_ARG (argv, i, str_btrfstune);
   ADD_ARG (argv, i, "-x");
   ADD_ARG (argv, i, device);
@@ -2178,6 +2190,8 @@ do_btrfs_replace (const char *srcdev, const char *targetdev,
   CLEANUP_FREE char *path_buf = NULL;
   int r;
 
+  invalidate_device_caches ();
+
   path_buf = sysroot_path (mntpoint);
   if (path_buf == NULL) {
     reply_with_perror ("malloc");
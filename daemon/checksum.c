@@ -23,72 +23,210 @@
 #include <string.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <inttypes.h>
+#include <dirent.h>
+#include <pthread.h>
 #include <sys/stat.h>
 
+#include "md5.h"
+#include "sha1.h"
+#include "sha256.h"
+#include "sha512.h"
+
 #include "guestfs_protocol.h"
 #include "daemon.h"
 #include "actions.h"
 
-GUESTFSD_EXT_CMD(str_find, find);
-GUESTFSD_EXT_CMD(str_xargs, xargs);
-GUESTFSD_EXT_CMD(str_cksum, cksum);
-GUESTFSD_EXT_CMD(str_md5sum, md5sum);
-GUESTFSD_EXT_CMD(str_sha1sum, sha1sum);
-GUESTFSD_EXT_CMD(str_sha224sum, sha224sum);
-GUESTFSD_EXT_CMD(str_sha256sum, sha256sum);
-GUESTFSD_EXT_CMD(str_sha384sum, sha384sum);
-GUESTFSD_EXT_CMD(str_sha512sum, sha512sum);
-
-static const char *
-program_of_csum (const char *csumtype)
+/* Checksums are computed in the daemon using the gnulib crypto
+ * modules, rather than by running md5sum etc, so that
+ * checksums_out can checksum files in parallel without forking.
+ * The output is the same as the coreutils programs.
+ */
+enum csum_type {
+  CSUM_CRC, CSUM_MD5, CSUM_SHA1, CSUM_SHA224, CSUM_SHA256, CSUM_SHA384,
+  CSUM_SHA512,
+};
+
+union csum_ctx {
+  uint32_t crc;
+  struct md5_ctx md5;
+  struct sha1_ctx sha1;
+  struct sha256_ctx sha256;
+  struct sha512_ctx sha512;
+};
+
+#define CSUM_BUFSIZ (128 * 1024)
+
+static int
+csum_of_name (const char *csumtype)
 {
   if (STRCASEEQ (csumtype, "crc"))
-    return str_cksum;
+    return CSUM_CRC;
   else if (STRCASEEQ (csumtype, "md5"))
-    return str_md5sum;
+    return CSUM_MD5;
   else if (STRCASEEQ (csumtype, "sha1"))
-    return str_sha1sum;
+    return CSUM_SHA1;
   else if (STRCASEEQ (csumtype, "sha224"))
-    return str_sha224sum;
+    return CSUM_SHA224;
   else if (STRCASEEQ (csumtype, "sha256"))
-    return str_sha256sum;
+    return CSUM_SHA256;
   else if (STRCASEEQ (csumtype, "sha384"))
-    return str_sha384sum;
+    return CSUM_SHA384;
   else if (STRCASEEQ (csumtype, "sha512"))
-    return str_sha512sum;
+    return CSUM_SHA512;
   else {
     reply_with_error ("unknown checksum type, expecting crc|md5|sha1|sha224|sha256|sha384|sha512");
+    return -1;
+  }
+}
+
+/* The CRC used by POSIX cksum(1). */
+static uint32_t crc_table[256];
+
+static void
+init_crc_table (void)
+{
+  static int done = 0;
+  static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+  uint32_t i, j, c;
+
+  pthread_mutex_lock (&lock);
+  if (!done) {
+    for (i = 0; i < 256; ++i) {
+      c = i << 24;
+      for (j = 0; j < 8; ++j)
+        c = c & 0x80000000 ? (c << 1) ^ 0x04C11DB7 : c << 1;
+      crc_table[i] = c;
+    }
+    done = 1;
+  }
+  pthread_mutex_unlock (&lock);
+}
+
+static uint32_t
+crc_update (uint32_t crc, const unsigned char *buf, size_t len)
+{
+  size_t i;
+
+  for (i = 0; i < len; ++i)
+    crc = (crc << 8) ^ crc_table[(crc >> 24) ^ buf[i]];
+  return crc;
+}
+
+static uint32_t
+crc_finish (uint32_t crc, uint64_t len)
+{
+  for (; len > 0; len >>= 8)
+    crc = (crc << 8) ^ crc_table[(crc >> 24) ^ (len & 0xff)];
+  return ~crc;
+}
+
+/* Checksum the contents of 'fd'.  On success, returns the checksum
+ * as a newly allocated string in the format printed by the coreutils
+ * program (so for crc, this is "crc size").  On error, returns NULL
+ * with errno set.  This does not call reply_with_*.
+ */
+static char *
+checksum_fd (int type, int fd)
+{
+  union csum_ctx ctx;
+  CLEANUP_FREE unsigned char *buf = NULL;
+  unsigned char digest[SHA512_DIGEST_SIZE];
+  size_t digest_len, i;
+  uint64_t total = 0;
+  ssize_t r;
+  char *ret;
+
+  buf = malloc (CSUM_BUFSIZ);
+  if (buf == NULL)
     return NULL;
+
+  switch (type) {
+  case CSUM_CRC: init_crc_table (); ctx.crc = 0; break;
+  case CSUM_MD5: md5_init_ctx (&ctx.md5); break;
+  case CSUM_SHA1: sha1_init_ctx (&ctx.sha1); break;
+  case CSUM_SHA224: sha224_init_ctx (&ctx.sha256); break;
+  case CSUM_SHA256: sha256_init_ctx (&ctx.sha256); break;
+  case CSUM_SHA384: sha384_init_ctx (&ctx.sha512); break;
+  case CSUM_SHA512: sha512_init_ctx (&ctx.sha512); break;
+  default: abort ();
   }
+
+  while ((r = read (fd, buf, CSUM_BUFSIZ)) != 0) {
+    if (r == -1) {
+      if (errno == EINTR)
+        continue;
+      return NULL;
+    }
+    total += r;
+
+    switch (type) {
+    case CSUM_CRC: ctx.crc = crc_update (ctx.crc, buf, r); break;
+    case CSUM_MD5: md5_process_bytes (buf, r, &ctx.md5); break;
+    case CSUM_SHA1: sha1_process_bytes (buf, r, &ctx.sha1); break;
+    case CSUM_SHA224:
+    case CSUM_SHA256: sha256_process_bytes (buf, r, &ctx.sha256); break;
+    case CSUM_SHA384:
+    case CSUM_SHA512: sha512_process_bytes (buf, r, &ctx.sha512); break;
+    }
+  }
+
+  switch (type) {
+  case CSUM_CRC:
+    if (asprintf (&ret, "%" PRIu32 " %" PRIu64,
+                  crc_finish (ctx.crc, total), total) == -1)
+      return NULL;
+    return ret;
+  case CSUM_MD5:
+    md5_finish_ctx (&ctx.md5, digest); digest_len = MD5_DIGEST_SIZE; break;
+  case CSUM_SHA1:
+    sha1_finish_ctx (&ctx.sha1, digest); digest_len = SHA1_DIGEST_SIZE; break;
+  case CSUM_SHA224:
+    sha224_finish_ctx (&ctx.sha256, digest); digest_len = SHA224_DIGEST_SIZE;
+    break;
+  case CSUM_SHA256:
+    sha256_finish_ctx (&ctx.sha256, digest); digest_len = SHA256_DIGEST_SIZE;
+    break;
+  case CSUM_SHA384:
+    sha384_finish_ctx (&ctx.sha512, digest); digest_len = SHA384_DIGEST_SIZE;
+    break;
+  case CSUM_SHA512:
+    sha512_finish_ctx (&ctx.sha512, digest); digest_len = SHA512_DIGEST_SIZE;
+    break;
+  default: abort ();
+  }
+
+  ret = malloc (digest_len * 2 + 1);
+  if (ret == NULL)
+    return NULL;
+  for (i = 0; i < digest_len; ++i)
+    snprintf (&ret[i*2], 3, "%02x", digest[i]);
+
+  return ret;
 }
 
+/* 'name' is the file or device being checksummed, for errors. */
 static char *
-checksum (const char *csumtype, int fd)
+checksum (const char *csumtype, const char *name, int fd)
 {
-  const char *program;
+  int type;
   char *out;
-  CLEANUP_FREE char *err = NULL;
-  int flags, r;
-  size_t len;
 
-  program = program_of_csum (csumtype);
-  if (program == NULL)
+  type = csum_of_name (csumtype);
+  if (type == -1)
     return NULL;
 
   pulse_mode_start ();
 
-  flags = COMMAND_FLAG_CHROOT_COPY_FILE_TO_STDIN | fd;
-  r = commandf (&out, &err, flags, program, NULL);
-  if (r == -1) {
+  out = checksum_fd (type, fd);
+  if (out == NULL) {
     pulse_mode_cancel ();
-    reply_with_error ("%s: %s", program, err);
-    free (out);
+    reply_with_perror ("%s checksum of %s", csumtype, name);
     return NULL;
   }
 
-  /* Split it at the first whitespace. */
-  len = strcspn (out, " \t\n");
-  out[len] = '\0';
+  /* For crc, only return the checksum, not the size. */
+  out[strcspn (out, " ")] = '\0';
 
   pulse_mode_end ();
 
@@ -109,7 +247,7 @@ do_checksum (const char *csumtype, const char *path)
     return NULL;
   }
 
-  return checksum (csumtype, fd);
+  return checksum (csumtype, path, fd);
 }
 
 char *
@@ -123,7 +261,81 @@ do_checksum_device (const char *csumtype, const char *device)
     return NULL;
   }
 
-  return checksum (csumtype, fd);
+  return checksum (csumtype, device, fd);
+}
+
+struct checksums_data {
+  int type;
+  pthread_mutex_t lock;         /* Protects the fields below. */
+  struct send_buffer sb;
+  int send_error;               /* send_buffer_write failed. */
+};
+
+static int
+checksums_entry (const struct walk_entry *entry, void *datav)
+{
+  struct checksums_data *data = datav;
+  CLEANUP_FREE char *sum = NULL;
+  CLEANUP_FREE char *line = NULL;
+  size_t i, len;
+  int escape, fd, r;
+
+  /* Only regular files, like 'find -type f'. */
+  if (entry->type != DT_REG)
+    return 0;
+
+  fd = openat (entry->dirfd, entry->name,
+               O_RDONLY|O_NOCTTY|O_NOFOLLOW|O_CLOEXEC);
+  if (fd == -1) {
+    fprintf (stderr, "checksums_out: %s: %m\n", entry->path);
+    return -1;
+  }
+  sum = checksum_fd (data->type, fd);
+  if (sum == NULL) {
+    fprintf (stderr, "checksums_out: %s: %m\n", entry->path);
+    close (fd);
+    return -1;
+  }
+  close (fd);
+
+  /* Format the line the same way as the coreutils programs, with
+   * the path relative to the directory.  md5sum and shaNsum escape
+   * backslash and newline in the filename, and mark such lines with
+   * a leading backslash.  cksum doesn't.
+   */
+  escape = data->type != CSUM_CRC &&
+    strpbrk (entry->path, "\\\n") != NULL;
+  line = malloc (strlen (sum) + 2 * entry->pathlen + 8);
+  if (line == NULL) {
+    perror ("malloc");
+    return -1;
+  }
+  len = 0;
+  if (escape)
+    line[len++] = '\\';
+  len += sprintf (&line[len], "%s%s./", sum,
+                  data->type == CSUM_CRC ? " " : "  ");
+  for (i = 0; i < entry->pathlen; ++i) {
+    if (escape && entry->path[i] == '\\') {
+      line[len++] = '\\';
+      line[len++] = '\\';
+    }
+    else if (escape && entry->path[i] == '\n') {
+      line[len++] = '\\';
+      line[len++] = 'n';
+    }
+    else
+      line[len++] = entry->path[i];
+  }
+  line[len++] = '\n';
+
+  pthread_mutex_lock (&data->lock);
+  r = send_buffer_write (&data->sb, line, len);
+  if (r < 0)
+    data->send_error = 1;
+  pthread_mutex_unlock (&data->lock);
+
+  return r < 0 ? -1 : 0;
 }
 
 /* Has one FileOut parameter. */
@@ -132,20 +344,14 @@ do_checksums_out (const char *csumtype, const char *dir)
 {
   struct stat statbuf;
   int r;
-  const char *program;
-  CLEANUP_FREE char *str = NULL;
   CLEANUP_FREE char *sysrootdir = NULL;
-  CLEANUP_FREE char *cmd = NULL;
-  FILE *fp;
+  struct checksums_data data = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .sb = { .buf = NULL, .len = 0 },
+  };
 
-  str = malloc (GUESTFS_MAX_CHUNK_SIZE);
-  if (str == NULL) {
-    reply_with_perror ("malloc");
-    return -1;
-  }
-
-  program = program_of_csum (csumtype);
-  if (program == NULL)
+  data.type = csum_of_name (csumtype);
+  if (data.type == -1)
     return -1;
 
   sysrootdir = sysroot_path (dir);
@@ -164,45 +370,24 @@ do_checksums_out (const char *csumtype, const char *dir)
     return -1;
   }
 
-  cmd = NULL;
-  if (asprintf_nowarn (&cmd, "cd %Q && %s -type f -print0 | %s -0 %s",
-                       sysrootdir, str_find, str_xargs, program) == -1) {
-    reply_with_perror ("asprintf");
-    return -1;
-  }
-
-  if (verbose)
-    fprintf (stderr, "%s\n", cmd);
-
-  fp = popen (cmd, "r");
-  if (fp == NULL) {
-    reply_with_perror ("%s", cmd);
-    return -1;
-  }
-
   /* Now we must send the reply message, before the file contents.  After
    * this there is no opportunity in the protocol to send any error
    * message back.  Instead we can only cancel the transfer.
    */
   reply (NULL, NULL);
 
-  while ((r = fread (str, 1, GUESTFS_MAX_CHUNK_SIZE, fp)) > 0) {
-    if (send_file_write (str, r) < 0) {
-      pclose (fp);
-      return -1;
+  /* Files are checksummed in parallel, one per thread. */
+  r = walk_tree (sysrootdir, 0, 0, checksums_entry, &data);
+  if (r == 0)
+    r = send_buffer_flush (&data.sb);
+  free_send_buffer (&data.sb);
+  pthread_mutex_destroy (&data.lock);
+
+  if (r < 0) {
+    if (!data.send_error) {
+      fprintf (stderr, "checksums_out: %s: %m\n", dir);
+      send_file_end (1);              /* Cancel. */
     }
-  }
-
-  if (ferror (fp)) {
-    fprintf (stderr, "fread: %s: %m\n", dir);
-    send_file_end (1);                /* Cancel. */
-    pclose (fp);
-    return -1;
-  }
-
-  if (pclose (fp) != 0) {
-    fprintf (stderr, "pclose: %s: %m\n", dir);
-    send_file_end (1);                /* Cancel. */
     return -1;
   }
 
@@ -78,3 +78,12 @@ cleanup_free_stringsbuf (void *ptr)
 {
   free_stringsbuf ((struct stringsbuf *) ptr);
 }
+
+struct send_buffer;
+extern void free_send_buffer (struct send_buffer *sb);
+
+void
+cleanup_free_send_buffer (void *ptr)
+{
+  free_send_buffer ((struct send_buffer *) ptr);
+}
@@ -28,6 +28,7 @@ extern void cleanup_unlink_free (void *ptr);
 extern void cleanup_close (void *ptr);
 extern void cleanup_aug_close (void *ptr);
 extern void cleanup_free_stringsbuf (void *ptr);
+extern void cleanup_free_send_buffer (void *ptr);
 
 #ifdef HAVE_ATTRIBUTE_CLEANUP
 #define CLEANUP_FREE __attribute__((cleanup(cleanup_free)))
@@ -37,6 +38,8 @@ extern void cleanup_free_stringsbuf (void *ptr);
 #define CLEANUP_CLOSE __attribute__((cleanup(cleanup_close)))
 #define CLEANUP_AUG_CLOSE __attribute__((cleanup(cleanup_aug_close)))
 #define CLEANUP_FREE_STRINGSBUF __attribute__((cleanup(cleanup_free_stringsbuf)))
+#define CLEANUP_FREE_SEND_BUFFER \
+    __attribute__((cleanup(cleanup_free_send_buffer)))
 #else
 #define CLEANUP_FREE
 #define CLEANUP_FREE_STRING_LIST
@@ -44,6 +47,7 @@ extern void cleanup_free_stringsbuf (void *ptr);
 #define CLEANUP_CLOSE
 #define CLEANUP_AUG_CLOSE
 #define CLEANUP_FREE_STRINGSBUF
+#define CLEANUP_FREE_SEND_BUFFER
 #endif
 
 #endif /* GUESTFSD_CLEANUPS_H */
@@ -33,6 +33,10 @@
 #include <sys/wait.h>
 #include <error.h>
 #include <errno.h>
+#include <time.h>
+#include <inttypes.h>
+#include <spawn.h>
+#include <pthread.h>
 
 #include "ignore-value.h"
 
@@ -49,6 +53,22 @@ extern size_t sysroot_len;
 #define PIPE_READ 0
 #define PIPE_WRITE 1
 
+/* Size of the buffer used to read the output of commands. */
+#define COMMAND_READ_BUFSIZ 16384
+
+/* Per-program counters, see C<command_stats>. */
+struct command_stat {
+  char *name;                   /* Basename of argv[0]. */
+  uint64_t count;               /* Number of times run. */
+  uint64_t total_ns;            /* Total elapsed time. */
+  uint64_t max_ns;              /* Longest elapsed time. */
+};
+static struct command_stat *command_stats_list = NULL;
+static size_t nr_command_stats = 0;
+static pthread_mutex_t command_stats_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void update_command_stats (const char *prog, const struct timespec *start);
+
 /**
  * Run a command.  Optionally capture stdout and stderr as strings.
  *
@@ -170,9 +190,283 @@ commandvf (char **stdoutput, char **stderror, unsigned flags,
     return -1;
 }
 
+/* Append C<len> bytes to the output buffer C<*bufp>, growing it
+ * geometrically so that commands with a lot of output don't cause a
+ * realloc per read.
+ */
+static int
+append_output (char **bufp, size_t *size, size_t *alloc,
+               const char *data, size_t len)
+{
+  if (*size + len > *alloc) {
+    size_t new_alloc = *alloc == 0 ? COMMAND_READ_BUFSIZ : *alloc * 2;
+    char *p;
+
+    while (new_alloc < *size + len)
+      new_alloc *= 2;
+    p = realloc (*bufp, new_alloc);
+    if (p == NULL) {
+      perror ("realloc");
+      return -1;
+    }
+    *bufp = p;
+    *alloc = new_alloc;
+  }
+  memcpy (*bufp + *size, data, len);
+  *size += len;
+  return 0;
+}
+
+/* Start the command using fork.  This is only needed when the
+ * command has to run chrooted, which posix_spawn cannot do.
+ */
+static pid_t
+fork_command (char const* const *argv, unsigned flags,
+              int so_fd[2], int se_fd[2])
+{
+  unsigned flag_copy_stdin = flags & COMMAND_FLAG_CHROOT_COPY_FILE_TO_STDIN;
+  int flag_copy_fd = (int) (flags & COMMAND_FLAG_FD_MASK);
+  unsigned flag_out_on_err = flags & COMMAND_FLAG_FOLD_STDOUT_ON_STDERR;
+  pid_t pid;
+
+  pid = fork ();
+  if (pid == -1) {
+    error (0, errno, "fork");
+    abort ();
+  }
+
+  if (pid == 0) {		/* Child process running the command. */
+    signal (SIGALRM, SIG_DFL);
+    signal (SIGPIPE, SIG_DFL);
+    close (0);
+    if (flag_copy_stdin) {
+      if (dup2 (flag_copy_fd, STDIN_FILENO) == -1) {
+        perror ("dup2/flag_copy_fd");
+        _exit (EXIT_FAILURE);
+      }
+    } else {
+      /* Set stdin to /dev/null. */
+      if (open ("/dev/null", O_RDONLY) == -1) {
+        perror ("open: /dev/null");
+        _exit (EXIT_FAILURE);
+      }
+    }
+    close (so_fd[PIPE_READ]);
+    close (se_fd[PIPE_READ]);
+    if (!flag_out_on_err) {
+      if (dup2 (so_fd[PIPE_WRITE], STDOUT_FILENO) == -1) {
+        perror ("dup2/so_fd[PIPE_WRITE]");
+        _exit (EXIT_FAILURE);
+      }
+    } else {
+      if (dup2 (se_fd[PIPE_WRITE], STDOUT_FILENO) == -1) {
+        perror ("dup2/se_fd[PIPE_WRITE]");
+        _exit (EXIT_FAILURE);
+      }
+    }
+    if (dup2 (se_fd[PIPE_WRITE], STDERR_FILENO) == -1) {
+      perror ("dup2/se_fd[PIPE_WRITE]");
+      _exit (EXIT_FAILURE);
+    }
+    close (so_fd[PIPE_WRITE]);
+    close (se_fd[PIPE_WRITE]);
+
+    if (flags & COMMAND_FLAG_DO_CHROOT && sysroot_len > 0) {
+      if (chroot (sysroot) == -1) {
+        perror ("chroot in sysroot");
+        _exit (EXIT_FAILURE);
+      }
+    }
+
+    if (chdir ("/") == -1) {
+      perror ("chdir");
+      _exit (EXIT_FAILURE);
+    }
+
+    execvp (argv[0], (void *) argv);
+    perror (argv[0]);
+    _exit (EXIT_FAILURE);
+  }
+  return pid;
+}
+
+/* Start the command using posix_spawn, which in glibc uses
+ * clone(CLONE_VM|CLONE_VFORK) and so avoids copying the page tables
+ * of the daemon for every command.  The pipes are created with
+ * O_CLOEXEC so only the dup'd stdin/stdout/stderr survive the exec.
+ *
+ * If the command cannot be started, the error is written to the
+ * stderr pipe and C<0> is returned, so that the caller sees the
+ * same result as when the old fork/exec code failed in the child.
+ */
+static pid_t
+spawn_command (char const* const *argv, unsigned flags,
+               int so_fd[2], int se_fd[2])
+{
+  unsigned flag_copy_stdin = flags & COMMAND_FLAG_CHROOT_COPY_FILE_TO_STDIN;
+  int flag_copy_fd = (int) (flags & COMMAND_FLAG_FD_MASK);
+  unsigned flag_out_on_err = flags & COMMAND_FLAG_FOLD_STDOUT_ON_STDERR;
+  posix_spawn_file_actions_t actions;
+  posix_spawnattr_t attr;
+  sigset_t sigdefault;
+  short attr_flags = POSIX_SPAWN_SETSIGDEF;
+  pid_t pid;
+  int err;
+
+  /* These return the error code instead of setting errno. */
+  err = posix_spawn_file_actions_init (&actions);
+  if (err != 0) {
+    error (0, err, "posix_spawn_file_actions_init");
+    abort ();
+  }
+  err = posix_spawnattr_init (&attr);
+  if (err != 0) {
+    error (0, err, "posix_spawnattr_init");
+    abort ();
+  }
+
+  if (flag_copy_stdin)
+    posix_spawn_file_actions_adddup2 (&actions, flag_copy_fd, STDIN_FILENO);
+  else
+    /* Set stdin to /dev/null. */
+    posix_spawn_file_actions_addopen (&actions, STDIN_FILENO,
+                                      "/dev/null", O_RDONLY, 0);
+  posix_spawn_file_actions_adddup2 (&actions,
+                                    !flag_out_on_err ?
+                                    so_fd[PIPE_WRITE] : se_fd[PIPE_WRITE],
+                                    STDOUT_FILENO);
+  posix_spawn_file_actions_adddup2 (&actions, se_fd[PIPE_WRITE],
+                                    STDERR_FILENO);
+
+  sigemptyset (&sigdefault);
+  sigaddset (&sigdefault, SIGALRM);
+  sigaddset (&sigdefault, SIGPIPE);
+  posix_spawnattr_setsigdefault (&attr, &sigdefault);
+#ifdef POSIX_SPAWN_USEVFORK
+  attr_flags |= POSIX_SPAWN_USEVFORK;
+#endif
+  posix_spawnattr_setflags (&attr, attr_flags);
+
+  /* The daemon's cwd is always "/" so there is no need to chdir. */
+  err = posix_spawnp (&pid, argv[0], &actions, &attr,
+                      (char **) argv, environ);
+
+  posix_spawn_file_actions_destroy (&actions);
+  posix_spawnattr_destroy (&attr);
+
+  if (err != 0) {
+    CLEANUP_FREE char *msg = NULL;
+
+    if (asprintf (&msg, "%s: %s\n", argv[0], strerror (err)) != -1)
+      ignore_value (write (se_fd[PIPE_WRITE], msg, strlen (msg)));
+    return 0;
+  }
+
+  return pid;
+}
+
+static pid_t
+start_command (char const* const *argv, unsigned flags,
+               int so_fd[2], int se_fd[2])
+{
+  if (flags & COMMAND_FLAG_DO_CHROOT && sysroot_len > 0)
+    return fork_command (argv, flags, so_fd, se_fd);
+  else
+    return spawn_command (argv, flags, so_fd, se_fd);
+}
+
+static void
+update_command_stats (const char *prog, const struct timespec *start)
+{
+  struct timespec end;
+  uint64_t ns;
+  const char *name;
+  size_t i;
+
+  clock_gettime (CLOCK_MONOTONIC, &end);
+  ns = (end.tv_sec - start->tv_sec) * UINT64_C(1000000000) +
+    end.tv_nsec - start->tv_nsec;
+
+  name = strrchr (prog, '/');
+  name = name ? name + 1 : prog;
+
+  pthread_mutex_lock (&command_stats_lock);
+  for (i = 0; i < nr_command_stats; ++i)
+    if (STREQ (command_stats_list[i].name, name))
+      break;
+  if (i == nr_command_stats) {
+    struct command_stat *p;
+    char *n = strdup (name);
+
+    p = realloc (command_stats_list,
+                 (nr_command_stats+1) * sizeof (struct command_stat));
+    if (n == NULL || p == NULL) {
+      /* The counters are only informational, so just skip this one. */
+      free (n);
+      if (p) command_stats_list = p;
+      pthread_mutex_unlock (&command_stats_lock);
+      return;
+    }
+    command_stats_list = p;
+    command_stats_list[i].name = n;
+    command_stats_list[i].count = 0;
+    command_stats_list[i].total_ns = 0;
+    command_stats_list[i].max_ns = 0;
+    nr_command_stats++;
+  }
+  command_stats_list[i].count++;
+  command_stats_list[i].total_ns += ns;
+  if (ns > command_stats_list[i].max_ns)
+    command_stats_list[i].max_ns = ns;
+  pthread_mutex_unlock (&command_stats_lock);
+}
+
+/**
+ * Return a table of the external programs that have been run by the
+ * daemon, with the number of times each was run and the time taken
+ * (from starting the program until it exited).  This is exposed
+ * through C<guestfs_debug (g, "command_stats", ...)>.
+ *
+ * Returns a newly allocated string, or C<NULL> on error (with errno
+ * set).
+ */
+char *
+command_stats (void)
+{
+  char *out = NULL;
+  size_t size, i;
+  FILE *fp;
+
+  fp = open_memstream (&out, &size);
+  if (fp == NULL)
+    return NULL;
+
+  fprintf (fp, "%-24s %8s %12s %12s %12s\n",
+           "program", "count", "total(ms)", "mean(ms)", "max(ms)");
+  pthread_mutex_lock (&command_stats_lock);
+  for (i = 0; i < nr_command_stats; ++i) {
+    const struct command_stat *st = &command_stats_list[i];
+
+    fprintf (fp, "%-24s %8" PRIu64 " %12.3f %12.3f %12.3f\n",
+             st->name, st->count,
+             st->total_ns / 1000000.0,
+             st->total_ns / 1000000.0 / st->count,
+             st->max_ns / 1000000.0);
+  }
+  pthread_mutex_unlock (&command_stats_lock);
+
+  if (fclose (fp) == -1) {
+    free (out);
+    return NULL;
+  }
+
+  return out;
+}
+
 /**
  * This is a more sane version of L<system(3)> for running external
- * commands.  It uses fork/execvp, so we don't need to worry about
+ * commands.  It uses posix_spawn (or fork/execvp when the command
+ * has to run chrooted), so we don't need to worry about
  * quoting of parameters, and it allows us to capture any error
  * messages in a buffer.
  *
@@ -216,6 +510,7 @@ commandrvf (char **stdoutput, char **stderror, unsigned flags,
             char const* const *argv)
 {
   size_t so_size = 0, se_size = 0;
+  size_t so_alloc = 0, se_alloc = 0;
   int so_fd[2], se_fd[2];
   unsigned flag_copy_stdin = flags & COMMAND_FLAG_CHROOT_COPY_FILE_TO_STDIN;
   int flag_copy_fd = (int) (flags & COMMAND_FLAG_FD_MASK);
@@ -223,8 +518,8 @@ commandrvf (char **stdoutput, char **stderror, unsigned flags,
   pid_t pid;
   int r, quit, i;
   fd_set rset, rset2;
-  char buf[256];
-  char *p;
+  CLEANUP_FREE char *buf = NULL;
+  struct timespec start_t;
 
   if (stdoutput) *stdoutput = NULL;
   if (stderror) *stderror = NULL;
@@ -268,74 +563,31 @@ commandrvf (char **stdoutput, char **stderror, unsigned flags,
    * circumstances.
    */
 
-  if (pipe (so_fd) == -1 || pipe (se_fd) == -1) {
+  /* New pipes are created for every command.  They cannot be kept
+   * and reused for the next command, because we rely on the child
+   * closing the write ends to see EOF on its output.  Nor is the read
+   * buffer kept between calls, since several threads may be running
+   * commands at the same time.
+   */
+  if (pipe2 (so_fd, O_CLOEXEC) == -1 || pipe2 (se_fd, O_CLOEXEC) == -1) {
     error (0, errno, "pipe");
     abort ();
   }
 
-  pid = fork ();
-  if (pid == -1) {
-    error (0, errno, "fork");
-    abort ();
-  }
-
-  if (pid == 0) {		/* Child process running the command. */
-    signal (SIGALRM, SIG_DFL);
-    signal (SIGPIPE, SIG_DFL);
-    close (0);
-    if (flag_copy_stdin) {
-      if (dup2 (flag_copy_fd, STDIN_FILENO) == -1) {
-        perror ("dup2/flag_copy_fd");
-        _exit (EXIT_FAILURE);
-      }
-    } else {
-      /* Set stdin to /dev/null. */
-      if (open ("/dev/null", O_RDONLY) == -1) {
-        perror ("open: /dev/null");
-        _exit (EXIT_FAILURE);
-      }
-    }
-    close (so_fd[PIPE_READ]);
-    close (se_fd[PIPE_READ]);
-    if (!flag_out_on_err) {
-      if (dup2 (so_fd[PIPE_WRITE], STDOUT_FILENO) == -1) {
-        perror ("dup2/so_fd[PIPE_WRITE]");
-        _exit (EXIT_FAILURE);
-      }
-    } else {
-      if (dup2 (se_fd[PIPE_WRITE], STDOUT_FILENO) == -1) {
-        perror ("dup2/se_fd[PIPE_WRITE]");
-        _exit (EXIT_FAILURE);
-      }
-    }
-    if (dup2 (se_fd[PIPE_WRITE], STDERR_FILENO) == -1) {
-      perror ("dup2/se_fd[PIPE_WRITE]");
-      _exit (EXIT_FAILURE);
-    }
-    close (so_fd[PIPE_WRITE]);
-    close (se_fd[PIPE_WRITE]);
-
-    if (flags & COMMAND_FLAG_DO_CHROOT && sysroot_len > 0) {
-      if (chroot (sysroot) == -1) {
-        perror ("chroot in sysroot");
-        _exit (EXIT_FAILURE);
-      }
-    }
+  clock_gettime (CLOCK_MONOTONIC, &start_t);
 
-    if (chdir ("/") == -1) {
-      perror ("chdir");
-      _exit (EXIT_FAILURE);
-    }
-
-    execvp (argv[0], (void *) argv);
-    perror (argv[0]);
-    _exit (EXIT_FAILURE);
-  }
+  pid = start_command (argv, flags, so_fd, se_fd);
 
   /* Parent process. */
   close (so_fd[PIPE_WRITE]);
   close (se_fd[PIPE_WRITE]);
 
+  buf = malloc (COMMAND_READ_BUFSIZ);
+  if (buf == NULL) {
+    error (0, errno, "malloc");
+    abort ();
+  }
+
   FD_ZERO (&rset);
   FD_SET (so_fd[PIPE_READ], &rset);
   FD_SET (se_fd[PIPE_READ], &rset);
@@ -369,12 +621,13 @@ commandrvf (char **stdoutput, char **stderror, unsigned flags,
       close (so_fd[PIPE_READ]);
       close (se_fd[PIPE_READ]);
       if (flag_copy_stdin) close (flag_copy_fd);
-      waitpid (pid, NULL, 0);
+      if (pid > 0)
+        waitpid (pid, NULL, 0);
       return -1;
     }
 
     if (FD_ISSET (so_fd[PIPE_READ], &rset2)) { /* something on stdout */
-      r = read (so_fd[PIPE_READ], buf, sizeof buf);
+      r = read (so_fd[PIPE_READ], buf, COMMAND_READ_BUFSIZ);
       if (r == -1) {
         perror ("read");
         goto quit;
@@ -382,19 +635,13 @@ commandrvf (char **stdoutput, char **stderror, unsigned flags,
       if (r == 0) { FD_CLR (so_fd[PIPE_READ], &rset); quit++; }
 
       if (r > 0 && stdoutput) {
-        so_size += r;
-        p = realloc (*stdoutput, so_size);
-        if (p == NULL) {
-          perror ("realloc");
+        if (append_output (stdoutput, &so_size, &so_alloc, buf, r) == -1)
           goto quit;
-        }
-        *stdoutput = p;
-        memcpy (*stdoutput + so_size - r, buf, r);
       }
     }
 
     if (FD_ISSET (se_fd[PIPE_READ], &rset2)) { /* something on stderr */
-      r = read (se_fd[PIPE_READ], buf, sizeof buf);
+      r = read (se_fd[PIPE_READ], buf, COMMAND_READ_BUFSIZ);
       if (r == -1) {
         perror ("read");
         goto quit;
@@ -406,14 +653,8 @@ commandrvf (char **stdoutput, char **stderror, unsigned flags,
           ignore_value (write (STDERR_FILENO, buf, r));
 
         if (stderror) {
-          se_size += r;
-          p = realloc (*stderror, se_size);
-          if (p == NULL) {
-            perror ("realloc");
+          if (append_output (stderror, &se_size, &se_alloc, buf, r) == -1)
             goto quit;
-          }
-          *stderror = p;
-          memcpy (*stderror + se_size - r, buf, r);
         }
       }
     }
@@ -456,12 +697,19 @@ commandrvf (char **stdoutput, char **stderror, unsigned flags,
     return -1;
   }
 
-  /* Get the exit status of the command. */
-  if (waitpid (pid, &r, 0) != pid) {
+  /* Get the exit status of the command.  If pid == 0 then the
+   * command could not be started, and start_command has already
+   * written the error to the stderr pipe.
+   */
+  if (pid == 0)
+    r = EXIT_FAILURE << 8;
+  else if (waitpid (pid, &r, 0) != pid) {
     perror ("waitpid");
     return -1;
   }
 
+  update_command_stats (argv[0], &start_t);
+
   if (WIFEXITED (r)) {
     return WEXITSTATUS (r);
   } else
@@ -38,4 +38,6 @@ extern int commandvf (char **stdoutput, char **stderror, unsigned flags,
 extern int commandrvf (char **stdoutput, char **stderror, unsigned flags,
                        char const* const *argv);
 
+extern char *command_stats (void);
+
 #endif /* GUESTFSD_COMMAND_H */
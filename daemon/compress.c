@@ -22,6 +22,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <fcntl.h>
+#include <unistd.h>
 
 #include "guestfs_protocol.h"
 #include "daemon.h"
@@ -32,6 +33,25 @@ GUESTFSD_EXT_CMD(str_gzip, gzip);
 GUESTFSD_EXT_CMD(str_bzip2, bzip2);
 GUESTFSD_EXT_CMD(str_xz, xz);
 GUESTFSD_EXT_CMD(str_lzop, lzop);
+GUESTFSD_EXT_CMD(str_zstd, zstd);
+GUESTFSD_EXT_CMD(str_zstdmt, zstdmt);
+GUESTFSD_EXT_CMD(str_pigz, pigz);
+GUESTFSD_EXT_CMD(str_pbzip2, pbzip2);
+
+/* Number of threads to use for compression.  This is the number of
+ * vCPUs in the appliance, which is set by guestfs_set_smp.
+ */
+int
+compress_threads (void)
+{
+  long n = sysconf (_SC_NPROCESSORS_ONLN);
+
+  if (n < 1)
+    return 1;
+  if (n > 256)
+    return 256;
+  return (int) n;
+}
 
 /* Has one FileOut parameter. */
 static int
@@ -120,6 +140,9 @@ do_compressX_out (const char *file, const char *filter, int is_device)
 static int
 get_filter (const char *ctype, int level, char *ret, size_t n)
 {
+  const int threads = compress_threads ();
+  size_t len;
+
   if (STREQ (ctype, "compress")) {
     CHECK_SUPPORTED ("compress");
     if (level != -1) {
@@ -130,40 +153,62 @@ get_filter (const char *ctype, int level, char *ret, size_t n)
     return 0;
   }
   else if (STREQ (ctype, "gzip")) {
-    CHECK_SUPPORTED ("gzip");
-    if (level == -1)
-      snprintf (ret, n, "%s -c", str_gzip);
-    else if (level >= 1 && level <= 9)
-      snprintf (ret, n, "%s -c -%d", str_gzip, level);
-    else {
+    if (level != -1 && (level < 1 || level > 9)) {
       reply_with_error ("gzip: incorrect value for level parameter");
       return -1;
     }
-    return 0;
+    /* pigz produces ordinary gzip output using one thread per vCPU. */
+    if (threads > 1 && prog_exists (str_pigz))
+      snprintf (ret, n, "%s -c -p %d", str_pigz, threads);
+    else {
+      CHECK_SUPPORTED ("gzip");
+      snprintf (ret, n, "%s -c", str_gzip);
+    }
+    goto add_level;
   }
   else if (STREQ (ctype, "bzip2")) {
-    CHECK_SUPPORTED ("bzip2");
-    if (level == -1)
-      snprintf (ret, n, "%s -c", str_bzip2);
-    else if (level >= 1 && level <= 9)
-      snprintf (ret, n, "%s -c -%d", str_bzip2, level);
-    else {
+    if (level != -1 && (level < 1 || level > 9)) {
       reply_with_error ("bzip2: incorrect value for level parameter");
       return -1;
     }
-    return 0;
+    /* pbzip2 output is a series of bzip2 streams, which bzip2 -d
+     * decompresses as normal.
+     */
+    if (threads > 1 && prog_exists (str_pbzip2))
+      snprintf (ret, n, "%s -c -p%d", str_pbzip2, threads);
+    else {
+      CHECK_SUPPORTED ("bzip2");
+      snprintf (ret, n, "%s -c", str_bzip2);
+    }
+    goto add_level;
   }
   else if (STREQ (ctype, "xz")) {
     CHECK_SUPPORTED ("xz");
-    if (level == -1)
-      snprintf (ret, n, "%s -c", str_xz);
-    else if (level >= 0 && level <= 9)
-      snprintf (ret, n, "%s -c -%d", str_xz, level);
-    else {
+    if (level != -1 && (level < 0 || level > 9)) {
       reply_with_error ("xz: incorrect value for level parameter");
       return -1;
     }
-    return 0;
+    /* With more than one thread xz splits the output into blocks
+     * which are compressed in parallel.  Old versions of xz accept
+     * and ignore this option.
+     */
+    if (threads > 1)
+      snprintf (ret, n, "%s -c -T %d", str_xz, threads);
+    else
+      snprintf (ret, n, "%s -c", str_xz);
+    goto add_level;
+  }
+  else if (STREQ (ctype, "zstd")) {
+    CHECK_SUPPORTED ("zstd");
+    if (level != -1 && (level < 1 || level > 19)) {
+      reply_with_error ("zstd: incorrect value for level parameter");
+      return -1;
+    }
+    if (threads > 1)
+      snprintf (ret, n, "%s -c -q -T%d", str_zstd, threads);
+    else
+      snprintf (ret, n, "%s -c -q", str_zstd);
+    goto add_level;
   }
   else if (STREQ (ctype, "lzop")) {
     CHECK_SUPPORTED ("lzop");
@@ -180,6 +225,70 @@ get_filter (const char *ctype, int level, char *ret, size_t n)
 
   reply_with_error ("unknown compression type");
   return -1;
+
+ add_level:
+  if (level != -1) {
+    len = strlen (ret);
+    snprintf (ret + len, n - len, " -%d", level);
+  }
+  return 0;
+}
+
+/* Return the tar(1) options needed to compress or decompress the
+ * archive using compression type 'ctype' in 'flags', and any
+ * environment variables which must be set for tar in 'env' (as a
+ * prefix for the shell command, either empty or ending with a space).
+ *
+ * When the appliance has more than one vCPU, a parallel compressor
+ * is used if one is available.  Only the program name can be given
+ * to --use-compress-program (older tar does not split it into
+ * arguments), so we choose compressors which use all CPUs by
+ * default, or pass the thread count to xz through XZ_OPT.  The
+ * output is compatible with the single-threaded program.
+ */
+int
+get_tar_filter (const char *ctype, char *env, size_t env_n,
+                char *flags, size_t flags_n)
+{
+  const int threads = compress_threads ();
+
+  *env = '\0';
+
+  if (STREQ (ctype, "compress"))
+    snprintf (flags, flags_n, " --compress");
+  else if (STREQ (ctype, "gzip")) {
+    if (threads > 1 && prog_exists (str_pigz))
+      snprintf (flags, flags_n, " --use-compress-program=%s", str_pigz);
+    else
+      snprintf (flags, flags_n, " --gzip");
+  }
+  else if (STREQ (ctype, "bzip2")) {
+    if (threads > 1 && prog_exists (str_pbzip2))
+      snprintf (flags, flags_n, " --use-compress-program=%s", str_pbzip2);
+    else
+      snprintf (flags, flags_n, " --bzip2");
+  }
+  else if (STREQ (ctype, "xz")) {
+    if (threads > 1)
+      snprintf (env, env_n, "XZ_OPT=-T%d ", threads);
+    snprintf (flags, flags_n, " --xz");
+  }
+  else if (STREQ (ctype, "lzop"))
+    snprintf (flags, flags_n, " --lzop");
+  else if (STREQ (ctype, "zstd")) {
+    CHECK_SUPPORTED ("zstd");
+    /* zstdmt is zstd -T0, ie. one thread per CPU. */
+    if (threads > 1 && prog_exists (str_zstdmt))
+      snprintf (flags, flags_n, " --use-compress-program=%s", str_zstdmt);
+    else
+      snprintf (flags, flags_n, " --use-compress-program=%s", str_zstd);
+  }
+  else {
+    reply_with_error ("unknown compression type: %s", ctype);
+    return -1;
+  }
+
+  return 0;
 }
 
 /* Has one FileOut parameter. */
@@ -222,6 +222,7 @@ do_copy_device_to_device (const char *src, const char *dest,
     reply_with_error ("the append flag cannot be set for this call");
     return -1;
   }
+  invalidate_device_caches ();
   return copy (src, src, dest, dest, DEST_DEVICE_FLAGS, 0,
                srcoffset, destoffset, size, sparse);
 }
@@ -267,6 +268,7 @@ do_copy_file_to_device (const char *src, const char *dest,
     return -1;
   }
 
+  invalidate_device_caches ();
   return copy (src_buf, src, dest, dest, DEST_DEVICE_FLAGS, 0,
                srcoffset, destoffset, size, sparse);
 }
@@ -0,0 +1,773 @@
+/* libguestfs - the guestfsd daemon
+ * Copyright (C) 2016 Red Hat Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/* Streaming reader for cpio archives and Linux initrds.
+ *
+ * An initrd (initramfs) is a sequence of "segments", each of which
+ * is a cpio archive, optionally compressed, and optionally followed
+ * by zero padding.  Typically there is an uncompressed segment
+ * containing early microcode, followed by a compressed segment
+ * containing the real initramfs.  This reader handles this in the
+ * same way as the kernel (see init/initramfs.c): after the end of
+ * each segment the padding is skipped, and the compression of the
+ * next segment is detected from its magic bytes.
+ *
+ * gzip, xz and zstd segments are decompressed in the daemon if the
+ * libraries were available at compile time.  Other formats (and these
+ * formats when the library is missing) are decompressed by running
+ * the external command on the rest of the file using popen(3), as
+ * other streaming daemon calls do.  The command consumes all of the
+ * remaining input, so this must be the last segment.
+ *
+ * Only the "newc" (070701), "crc" (070702) and "odc" (070707) cpio
+ * formats are supported.  The kernel only supports newc.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+#ifdef HAVE_LIBLZMA
+#include <lzma.h>
+#endif
+
+#ifdef HAVE_LIBZSTD
+#include <zstd.h>
+#endif
+
+#include "daemon.h"
+
+GUESTFSD_EXT_CMD(str_zcat, zcat);
+GUESTFSD_EXT_CMD(str_xzcat, xzcat);
+GUESTFSD_EXT_CMD(str_zstdcat, zstdcat);
+GUESTFSD_EXT_CMD(str_bzcat, bzcat);
+GUESTFSD_EXT_CMD(str_lz4cat, lz4cat);
+GUESTFSD_EXT_CMD(str_tail, tail);
+
+/* Size of the input and output buffers.  Must be larger than the
+ * largest cpio header plus PATH_MAX.
+ */
+#define BUFFER_SIZE (64 * 1024)
+
+#define NEWC_HEADER_LEN 110
+#define ODC_HEADER_LEN  76
+#define TRAILER         "TRAILER!!!"
+
+enum segment_type {
+  SEG_NONE,                     /* not in a segment */
+  SEG_RAW,                      /* uncompressed */
+  SEG_GZIP,
+  SEG_XZ,
+  SEG_ZSTD,
+  SEG_COMMAND,                  /* decompressed by an external command */
+};
+
+struct cpio {
+  char *path;                   /* for error messages */
+  int fd;
+  int in_eof;                   /* no more input from fd */
+
+  /* Raw input which has not been consumed yet is in[in_pos..in_len-1]. */
+  unsigned char in[BUFFER_SIZE];
+  size_t in_pos, in_len;
+
+  enum segment_type seg;
+  int seg_eof;                  /* decompressor reached end of segment */
+  size_t nr_segments;
+
+  /* Decompressed output which has not been consumed yet is
+   * out[out_pos..out_len-1].  Not used for SEG_RAW segments, which
+   * are read directly from in[].
+   */
+  unsigned char out[BUFFER_SIZE];
+  size_t out_pos, out_len;
+
+#ifdef HAVE_ZLIB
+  z_stream zs;
+#endif
+#ifdef HAVE_LIBLZMA
+  lzma_stream xz;
+#endif
+#ifdef HAVE_LIBZSTD
+  ZSTD_DStream *zstd;
+#endif
+  FILE *pipe;                   /* SEG_COMMAND */
+  const char *cmd;
+
+  /* Current entry. */
+  char name[PATH_MAX];
+  uint64_t remaining;           /* data not yet read by cpio_read */
+  size_t data_padding;          /* padding after the data */
+  int trailer;                  /* seen the trailer of this archive */
+};
+
+static void end_segment (struct cpio *c);
+
+struct cpio *
+cpio_open (const char *path)
+{
+  struct cpio *c;
+
+  c = calloc (1, sizeof *c);
+  if (c == NULL) {
+    reply_with_perror ("calloc");
+    return NULL;
+  }
+  c->fd = -1;
+
+  c->path = strdup (path);
+  if (c->path == NULL) {
+    reply_with_perror ("strdup");
+    free (c);
+    return NULL;
+  }
+
+  CHROOT_IN;
+  c->fd = open (path, O_RDONLY|O_CLOEXEC);
+  CHROOT_OUT;
+  if (c->fd == -1) {
+    reply_with_perror ("open: %s", path);
+    free (c->path);
+    free (c);
+    return NULL;
+  }
+
+  return c;
+}
+
+void
+cpio_close (struct cpio *c)
+{
+  if (c == NULL)
+    return;
+
+  end_segment (c);
+  if (c->fd >= 0)
+    close (c->fd);
+  free (c->path);
+  free (c);
+}
+
+/* Make at least 'n' bytes of raw input available, unless the end of
+ * the file is reached first.  Returns the number of bytes available,
+ * or -1 on error.
+ */
+static ssize_t
+fill_input (struct cpio *c, size_t n)
+{
+  ssize_t r;
+
+  if (c->in_pos > 0 && c->in_len - c->in_pos < n) {
+    memmove (c->in, &c->in[c->in_pos], c->in_len - c->in_pos);
+    c->in_len -= c->in_pos;
+    c->in_pos = 0;
+  }
+
+  while (!c->in_eof && c->in_len - c->in_pos < n) {
+    r = read (c->fd, &c->in[c->in_len], BUFFER_SIZE - c->in_len);
+    if (r == -1) {
+      if (errno == EINTR)
+        continue;
+      reply_with_perror ("read: %s", c->path);
+      return -1;
+    }
+    if (r == 0)
+      c->in_eof = 1;
+    c->in_len += r;
+  }
+
+  return c->in_len - c->in_pos;
+}
+
+/* Start decompressing the rest of the input with an external
+ * command.  The input which is already buffered has to be passed to
+ * the command too, so the command reads the file from the current
+ * offset.
+ *
+ * The command is given the file we already have open, rather than
+ * its path.  The command runs outside the chroot, where the path
+ * would name a file in the appliance, and even prefixing the sysroot
+ * would not resolve absolute symlinks in the guest correctly.
+ */
+static int
+start_command (struct cpio *c, const char *cmd)
+{
+  CLEANUP_FREE char *cmdline = NULL;
+  off_t offset;
+  int fd;
+
+  offset = lseek (c->fd, 0, SEEK_CUR);
+  if (offset == -1) {
+    reply_with_perror ("lseek: %s", c->path);
+    return -1;
+  }
+  offset -= c->in_len - c->in_pos;
+
+  /* c->fd is close-on-exec, but the duplicate is not. */
+  fd = dup (c->fd);
+  if (fd == -1) {
+    reply_with_perror ("dup: %s", c->path);
+    return -1;
+  }
+
+  if (asprintf (&cmdline, "%s -c +%" PRIi64 " /proc/self/fd/%d | %s",
+                str_tail, (int64_t) offset + 1, fd, cmd) == -1) {
+    reply_with_perror ("asprintf");
+    close (fd);
+    return -1;
+  }
+
+  if (verbose)
+    fprintf (stderr, "%s\n", cmdline);
+
+  c->pipe = popen (cmdline, "r");
+  close (fd);
+  if (c->pipe == NULL) {
+    reply_with_perror ("popen: %s", cmdline);
+    return -1;
+  }
+  c->cmd = cmd;
+
+  /* The command consumes the rest of the file. */
+  c->in_pos = c->in_len = 0;
+  c->in_eof = 1;
+
+  return 0;
+}
+
+/* Skip zero padding, then detect the type of the next segment and
+ * start it.  Returns 1 if a segment was started, 0 at the end of the
+ * file, or -1 on error.
+ */
+static int
+start_segment (struct cpio *c)
+{
+  const unsigned char *p;
+  ssize_t n;
+  const char *cmd = NULL;
+
+  for (;;) {
+    n = fill_input (c, 6);
+    if (n == -1)
+      return -1;
+    if (n == 0)
+      return 0;
+    if (c->in[c->in_pos] != 0)
+      break;
+    c->in_pos++;
+  }
+
+  if (n < 6) {
+    reply_with_error ("%s: unrecognized data at the end of the file",
+                      c->path);
+    return -1;
+  }
+
+  p = &c->in[c->in_pos];
+  c->out_pos = c->out_len = 0;
+  c->seg_eof = 0;
+  c->trailer = 0;
+
+  if (memcmp (p, "0707", 4) == 0) {
+    c->seg = SEG_RAW;
+  }
+  else if (p[0] == 0x1f && p[1] == 0x8b) {
+#ifdef HAVE_ZLIB
+    memset (&c->zs, 0, sizeof c->zs);
+    if (inflateInit2 (&c->zs, 16 + MAX_WBITS) != Z_OK) {
+      reply_with_error ("%s: inflateInit2 failed", c->path);
+      return -1;
+    }
+    c->seg = SEG_GZIP;
+#else
+    cmd = str_zcat;
+#endif
+  }
+  else if (memcmp (p, "\xfd" "7zXZ\0", 6) == 0) {
+#ifdef HAVE_LIBLZMA
+    lzma_stream init = LZMA_STREAM_INIT;
+
+    c->xz = init;
+    if (lzma_stream_decoder (&c->xz, UINT64_MAX, 0) != LZMA_OK) {
+      reply_with_error ("%s: lzma_stream_decoder failed", c->path);
+      return -1;
+    }
+    c->seg = SEG_XZ;
+#else
+    cmd = str_xzcat;
+#endif
+  }
+  else if (memcmp (p, "\x28\xb5\x2f\xfd", 4) == 0) {
+#ifdef HAVE_LIBZSTD
+    c->zstd = ZSTD_createDStream ();
+    if (c->zstd == NULL || ZSTD_isError (ZSTD_initDStream (c->zstd))) {
+      reply_with_error ("%s: ZSTD_initDStream failed", c->path);
+      if (c->zstd)
+        ZSTD_freeDStream (c->zstd);
+      c->zstd = NULL;
+      return -1;
+    }
+    c->seg = SEG_ZSTD;
+#else
+    cmd = str_zstdcat;
+#endif
+  }
+  else if (p[0] == 0x5d && p[1] == 0 && p[2] == 0)
+    cmd = str_xzcat;            /* legacy lzma, detected by xz */
+  else if (memcmp (p, "BZh", 3) == 0)
+    cmd = str_bzcat;
+  else if (memcmp (p, "\x02\x21\x4c\x18", 4) == 0 ||
+           memcmp (p, "\x04\x22\x4d\x18", 4) == 0)
+    cmd = str_lz4cat;
+  else {
+    reply_with_error ("%s: not a cpio archive or initrd "
+                      "(unknown data at segment %zu)",
+                      c->path, c->nr_segments + 1);
+    return -1;
+  }
+
+  if (cmd) {
+    if (start_command (c, cmd) == -1)
+      return -1;
+    c->seg = SEG_COMMAND;
+  }
+
+  c->nr_segments++;
+  return 1;
+}
+
+static void
+end_segment (struct cpio *c)
+{
+  switch (c->seg) {
+  case SEG_NONE:
+  case SEG_RAW:
+    break;
+  case SEG_GZIP:
+#ifdef HAVE_ZLIB
+    inflateEnd (&c->zs);
+#endif
+    break;
+  case SEG_XZ:
+#ifdef HAVE_LIBLZMA
+    lzma_end (&c->xz);
+#endif
+    break;
+  case SEG_ZSTD:
+#ifdef HAVE_LIBZSTD
+    ZSTD_freeDStream (c->zstd);
+    c->zstd = NULL;
+#endif
+    break;
+  case SEG_COMMAND:
+    /* If we stopped reading early, closing the pipe makes the
+     * command exit with SIGPIPE, so the status is ignored here.
+     */
+    if (c->pipe)
+      pclose (c->pipe);
+    c->pipe = NULL;
+    break;
+  }
+  c->seg = SEG_NONE;
+}
+
+/* Decompress more data into out[].  Sets c->seg_eof at the end of
+ * the segment.  Returns -1 on error.
+ */
+static int
+decompress_more (struct cpio *c)
+{
+  size_t avail_in, avail_out;
+
+  if (c->out_pos > 0) {
+    memmove (c->out, &c->out[c->out_pos], c->out_len - c->out_pos);
+    c->out_len -= c->out_pos;
+    c->out_pos = 0;
+  }
+  avail_out = BUFFER_SIZE - c->out_len;
+
+  if (c->seg == SEG_COMMAND) {
+    int status;
+    size_t n;
+
+    n = fread (&c->out[c->out_len], 1, avail_out, c->pipe);
+    if (n > 0) {
+      c->out_len += n;
+      return 0;
+    }
+    if (ferror (c->pipe)) {
+      reply_with_perror ("read: %s", c->cmd);
+      return -1;
+    }
+
+    c->seg_eof = 1;
+    status = pclose (c->pipe);
+    c->pipe = NULL;
+    if (status == -1) {
+      reply_with_perror ("pclose");
+      return -1;
+    }
+    /* gzip exits with status 2 for warnings such as trailing zeroes. */
+    if (!WIFEXITED (status) ||
+        (WEXITSTATUS (status) != 0 && WEXITSTATUS (status) != 2)) {
+      reply_with_error ("%s: %s failed", c->path, c->cmd);
+      return -1;
+    }
+    return 0;
+  }
+
+  if (fill_input (c, 1) == -1)
+    return -1;
+  avail_in = c->in_len - c->in_pos;
+  if (avail_in == 0) {
+    reply_with_error ("%s: compressed data is truncated", c->path);
+    return -1;
+  }
+
+  switch (c->seg) {
+  case SEG_GZIP:
+#ifdef HAVE_ZLIB
+    {
+      int zr;
+
+      c->zs.next_in = &c->in[c->in_pos];
+      c->zs.avail_in = avail_in;
+      c->zs.next_out = &c->out[c->out_len];
+      c->zs.avail_out = avail_out;
+      zr = inflate (&c->zs, Z_NO_FLUSH);
+      if (zr != Z_OK && zr != Z_STREAM_END && zr != Z_BUF_ERROR) {
+        reply_with_error ("%s: gzip: %s", c->path,
+                          c->zs.msg ? c->zs.msg : "corrupt data");
+        return -1;
+      }
+      c->in_pos += avail_in - c->zs.avail_in;
+      c->out_len += avail_out - c->zs.avail_out;
+      if (zr == Z_STREAM_END)
+        c->seg_eof = 1;
+    }
+#endif
+    break;
+
+  case SEG_XZ:
+#ifdef HAVE_LIBLZMA
+    {
+      lzma_ret xr;
+
+      c->xz.next_in = &c->in[c->in_pos];
+      c->xz.avail_in = avail_in;
+      c->xz.next_out = &c->out[c->out_len];
+      c->xz.avail_out = avail_out;
+      xr = lzma_code (&c->xz, LZMA_RUN);
+      if (xr != LZMA_OK && xr != LZMA_STREAM_END) {
+        reply_with_error ("%s: xz: decompression failed (error %d)",
+                          c->path, (int) xr);
+        return -1;
+      }
+      c->in_pos += avail_in - c->xz.avail_in;
+      c->out_len += avail_out - c->xz.avail_out;
+      if (xr == LZMA_STREAM_END)
+        c->seg_eof = 1;
+    }
+#endif
+    break;
+
+  case SEG_ZSTD:
+#ifdef HAVE_LIBZSTD
+    {
+      ZSTD_inBuffer zin = { &c->in[c->in_pos], avail_in, 0 };
+      ZSTD_outBuffer zout = { &c->out[c->out_len], avail_out, 0 };
+      size_t zr;
+
+      zr = ZSTD_decompressStream (c->zstd, &zout, &zin);
+      if (ZSTD_isError (zr)) {
+        reply_with_error ("%s: zstd: %s", c->path, ZSTD_getErrorName (zr));
+        return -1;
+      }
+      c->in_pos += zin.pos;
+      c->out_len += zout.pos;
+      if (zr == 0)
+        c->seg_eof = 1;
+    }
+#endif
+    break;
+
+  case SEG_NONE:
+  case SEG_RAW:
+  case SEG_COMMAND:
+    abort ();
+  }
+
+  return 0;
+}
+
+/* Make at least 'n' bytes of the current segment available, unless
+ * the segment ends first.  Returns a pointer to the data and sets
+ * *avail to the number of bytes available, or returns NULL on error.
+ */
+static const unsigned char *
+peek (struct cpio *c, size_t n, size_t *avail)
+{
+  ssize_t r;
+
+  if (c->seg == SEG_RAW) {
+    r = fill_input (c, n);
+    if (r == -1)
+      return NULL;
+    *avail = r;
+    return &c->in[c->in_pos];
+  }
+
+  while (c->out_len - c->out_pos < n && !c->seg_eof) {
+    if (decompress_more (c) == -1)
+      return NULL;
+  }
+  *avail = c->out_len - c->out_pos;
+  return &c->out[c->out_pos];
+}
+
+static void
+consume (struct cpio *c, size_t n)
+{
+  if (c->seg == SEG_RAW)
+    c->in_pos += n;
+  else
+    c->out_pos += n;
+}
+
+/* Skip 'n' bytes of the current segment.  Returns -1 on error. */
+static int
+skip (struct cpio *c, uint64_t n)
+{
+  size_t avail;
+
+  while (n > 0) {
+    if (peek (c, 1, &avail) == NULL)
+      return -1;
+    if (avail == 0) {
+      reply_with_error ("%s: unexpected end of cpio archive", c->path);
+      return -1;
+    }
+    if (avail > n)
+      avail = n;
+    consume (c, avail);
+    n -= avail;
+  }
+  return 0;
+}
+
+static int
+parse_number (const unsigned char *p, size_t len, int base, uint64_t *ret)
+{
+  char buf[16];
+  char *end;
+
+  memcpy (buf, p, len);
+  buf[len] = '\0';
+  errno = 0;
+  *ret = strtoull (buf, &end, base);
+  return errno != 0 || *end != '\0' ? -1 : 0;
+}
+
+/* Read the next entry header.  Returns 1 if there is an entry, 0 at
+ * the end of the initrd, or -1 on error.
+ */
+int
+cpio_next (struct cpio *c, struct cpio_entry *entry)
+{
+  const unsigned char *p;
+  size_t avail, header_len, header_padding;
+  uint64_t v[13];
+  uint64_t namesize;
+  int newc;
+  size_t i;
+
+  /* Skip the rest of the previous entry. */
+  if (skip (c, c->remaining + c->data_padding) == -1)
+    return -1;
+  c->remaining = c->data_padding = 0;
+
+ again:
+  if (c->seg == SEG_NONE) {
+    switch (start_segment (c)) {
+    case -1: return -1;
+    case 0: return 0;
+    }
+  }
+
+  /* After the trailer, the segment may continue with padding and
+   * another cpio archive.  For uncompressed segments anything else
+   * is the start of the next segment.
+   */
+  if (c->trailer) {
+    for (;;) {
+      p = peek (c, 1, &avail);
+      if (p == NULL)
+        return -1;
+      if (avail == 0 || *p != 0)
+        break;
+      consume (c, 1);
+    }
+    p = peek (c, 4, &avail);
+    if (p == NULL)
+      return -1;
+    if (avail < 4 || memcmp (p, "0707", 4) != 0) {
+      if (c->seg != SEG_RAW && avail > 0) {
+        reply_with_error ("%s: garbage after cpio archive in segment %zu",
+                          c->path, c->nr_segments);
+        return -1;
+      }
+      end_segment (c);
+      goto again;
+    }
+    c->trailer = 0;
+  }
+
+  p = peek (c, NEWC_HEADER_LEN, &avail);
+  if (p == NULL)
+    return -1;
+  if (avail == 0) {
+    /* A compressed segment which ends without a trailer. */
+    end_segment (c);
+    goto again;
+  }
+
+  if (avail >= NEWC_HEADER_LEN &&
+      (memcmp (p, "070701", 6) == 0 || memcmp (p, "070702", 6) == 0)) {
+    newc = 1;
+    header_len = NEWC_HEADER_LEN;
+    for (i = 0; i < 13; ++i) {
+      if (parse_number (&p[6 + i*8], 8, 16, &v[i]) == -1)
+        goto corrupt;
+    }
+    entry->ino = v[0];
+    entry->mode = v[1];
+    entry->nlink = v[4];
+    entry->size = v[6];
+    entry->devmajor = v[7];
+    entry->devminor = v[8];
+    namesize = v[11];
+  }
+  else if (avail >= ODC_HEADER_LEN && memcmp (p, "070707", 6) == 0) {
+    static const size_t widths[] = { 6, 6, 6, 6, 6, 6, 6, 11, 6, 11 };
+    size_t offset = 6;
+
+    newc = 0;
+    header_len = ODC_HEADER_LEN;
+    for (i = 0; i < 10; ++i) {
+      if (parse_number (&p[offset], widths[i], 8, &v[i]) == -1)
+        goto corrupt;
+      offset += widths[i];
+    }
+    entry->devmajor = v[0];
+    entry->devminor = 0;
+    entry->ino = v[1];
+    entry->mode = v[2];
+    entry->nlink = v[5];
+    namesize = v[8];
+    entry->size = v[9];
+  }
+  else
+    goto corrupt;
+
+  if (namesize == 0 || namesize > sizeof c->name)
+    goto corrupt;
+  consume (c, header_len);
+
+  p = peek (c, namesize, &avail);
+  if (p == NULL)
+    return -1;
+  if (avail < namesize)
+    goto truncated;
+  memcpy (c->name, p, namesize);
+  c->name[namesize-1] = '\0';
+  consume (c, namesize);
+
+  /* newc pads the header + name, and the data, to 4 bytes. */
+  header_padding = newc ? (4 - (header_len + namesize) % 4) % 4 : 0;
+  if (skip (c, header_padding) == -1)
+    return -1;
+
+  c->remaining = entry->size;
+  c->data_padding = newc ? (4 - entry->size % 4) % 4 : 0;
+
+  if (STREQ (c->name, TRAILER)) {
+    if (skip (c, c->remaining + c->data_padding) == -1)
+      return -1;
+    c->remaining = c->data_padding = 0;
+    c->trailer = 1;
+    goto again;
+  }
+
+  entry->name = c->name;
+  return 1;
+
+ truncated:
+  reply_with_error ("%s: unexpected end of cpio archive", c->path);
+  return -1;
+
+ corrupt:
+  reply_with_error ("%s: corrupt or unsupported cpio header in segment %zu",
+                    c->path, c->nr_segments);
+  return -1;
+}
+
+/* Read up to 'len' bytes of data from the current entry.  Returns
+ * the number of bytes read, 0 at the end of the entry, or -1 on
+ * error.
+ */
+ssize_t
+cpio_read (struct cpio *c, void *buf, size_t len)
+{
+  const unsigned char *p;
+  size_t avail;
+
+  if (c->remaining == 0)
+    return 0;
+  if (len > BUFFER_SIZE)
+    len = BUFFER_SIZE;
+  if (len > c->remaining)
+    len = c->remaining;
+
+  p = peek (c, 1, &avail);
+  if (p == NULL)
+    return -1;
+  if (avail == 0) {
+    reply_with_error ("%s: unexpected end of cpio archive", c->path);
+    return -1;
+  }
+  if (len > avail)
+    len = avail;
+  memcpy (buf, p, len);
+  consume (c, len);
+  c->remaining -= len;
+  return len;
+}
@@ -134,6 +134,7 @@ extern int parse_btrfsvol (const char *desc, mountable_t *mountable);
 extern int prog_exists (const char *prog);
 
 extern void udev_settle (void);
+extern void invalidate_device_caches (void);
 
 extern int random_name (char *template);
 
@@ -159,6 +160,12 @@ extern void dispatch_incoming_message (XDR *);
 extern guestfs_int_lvm_pv_list *parse_command_line_pvs (void);
 extern guestfs_int_lvm_vg_list *parse_command_line_vgs (void);
 extern guestfs_int_lvm_lv_list *parse_command_line_lvs (void);
+extern const char *lvm_pv_cols;
+extern const char *lvm_vg_cols;
+extern const char *lvm_lv_cols;
+extern int lvm_tokenize_pv (char *str, guestfs_int_lvm_pv *r);
+extern int lvm_tokenize_vg (char *str, guestfs_int_lvm_vg *r);
+extern int lvm_tokenize_lv (char *str, guestfs_int_lvm_lv *r);
 
 /*-- in optgroups.c (auto-generated) --*/
 struct optgroup {
@@ -183,13 +190,51 @@ extern int64_t ext_minimum_size (const char *device);
 
 /*-- in blkid.c --*/
 extern char *get_blkid_tag (const char *device, const char *tag);
+extern void blkid_cache_invalidate (void);
+
+/*-- in compress.c --*/
+extern int compress_threads (void);
+extern int get_tar_filter (const char *ctype, char *env, size_t env_n, char *flags, size_t flags_n);
+
+/*-- in cpio-reader.c --*/
+struct cpio;
+struct cpio_entry {
+  const char *name;             /* valid until the next cpio_next call */
+  uint32_t mode;
+  uint32_t nlink;
+  uint64_t ino;                 /* ino, devmajor, devminor identify hard links */
+  uint32_t devmajor, devminor;
+  uint64_t size;
+};
+extern struct cpio *cpio_open (const char *path);
+extern int cpio_next (struct cpio *c, struct cpio_entry *entry);
+extern ssize_t cpio_read (struct cpio *c, void *buf, size_t len);
+extern void cpio_close (struct cpio *c);
+
+/*-- in decompress.c --*/
+struct decompress;
+extern int decompress_supported (const char *ctype);
+extern size_t decompress_threads (void);
+extern struct decompress *decompress_new (const char *ctype, int fd, size_t nr_threads);
+extern int decompress_write (void *d, const void *buf, size_t len);
+extern int decompress_finish (struct decompress *d);
+extern const char *decompress_error (struct decompress *d);
+extern void decompress_free (struct decompress *d);
 
 /*-- in lvm.c --*/
 extern int lv_canonical (const char *device, char **ret);
+extern void lvm_cache_invalidate (void);
 
 /*-- in lvm-filter.c --*/
 extern void copy_lvm (void);
 
+/*-- in upload.c --*/
+struct range {
+  uint64_t offset;
+  uint64_t size;
+};
+extern struct range *parse_ranges (char *const *ranges, size_t *nr_ranges_r, const char **bad_range);
+
 /*-- in zero.c --*/
 extern void wipe_device_before_mkfs (const char *device);
 
@@ -215,6 +260,22 @@ extern void journal_finalize (void);
 /*-- in proto.c --*/
 extern void main_loop (int sock) __attribute__((noreturn));
 
+/*-- in walk.c --*/
+struct walk_entry {
+  const char *path;             /* Path relative to the top directory. */
+  size_t pathlen;               /* strlen (path) */
+  const char *name;             /* Last element of path. */
+  int dirfd;                    /* Open fd of the parent directory. */
+  unsigned char type;           /* DT_* constant from <dirent.h>. */
+  size_t depth;                 /* 1 for entries in the top directory. */
+  const struct stat *statbuf;   /* lstat result, or NULL (see walk.c). */
+};
+#define WALK_FLAG_STAT 1        /* Always lstat entries. */
+#define WALK_PRUNE     1        /* Callback: don't descend into this dir. */
+typedef int (*walk_cb) (const struct walk_entry *entry, void *opaque);
+extern int walk_tree (const char *dir, unsigned flags, size_t nr_threads, walk_cb cb, void *opaque);
+extern size_t walk_default_threads (void);
+
 /*-- in xattr.c --*/
 extern int copy_xattrs (const char *src, const char *dest);
 
@@ -281,6 +342,31 @@ extern int cancel_receive (void);
 extern int send_file_write (const void *buf, size_t len);
 extern int send_file_end (int cancel);
 
+/* Callers which produce many small records (eg. one per file) can
+ * use a send_buffer to pack them into full chunks.  Records may be
+ * split across chunks.  The return values are the same as for
+ * send_file_write.  send_buffer_flush must be called before
+ * send_file_end.
+ */
+struct send_buffer {
+  char *buf;                    /* GUESTFS_MAX_CHUNK_SIZE bytes */
+  size_t len;
+};
+#define DECLARE_SEND_BUFFER(v) \
+  struct send_buffer (v) = { .buf = NULL, .len = 0 }
+extern int send_buffer_write (struct send_buffer *sb, const void *data, size_t len);
+extern int send_buffer_flush (struct send_buffer *sb);
+extern void free_send_buffer (struct send_buffer *sb);
+
+/* Long-running daemon functions which don't transfer a file can
+ * call this from time to time to find out if the library has
+ * cancelled the call (see guestfs_user_cancel).  The library only
+ * passes the cancellation on while it is receiving progress
+ * messages, so the function should also call notify_progress.  Only
+ * call this from the main thread.
+ */
+extern int is_cancelled (void);
+
 /* only call this if there is a FileOut parameter */
 extern void reply (xdrproc_t xdrp, char *ret);
 
@@ -37,6 +37,8 @@ do_dd (const char *src, const char *dest)
   CLEANUP_FREE char *err = NULL;
   int r;
 
+  invalidate_device_caches ();
+
   src_is_dev = STRPREFIX (src, "/dev/");
 
   if (src_is_dev)
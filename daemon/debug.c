@@ -63,6 +63,7 @@ struct cmd {
 
 static char *debug_help (const char *subcmd, size_t argc, char *const *const argv);
 static char *debug_binaries (const char *subcmd, size_t argc, char *const *const argv);
+static char *debug_command_stats (const char *subcmd, size_t argc, char *const *const argv);
 static char *debug_core_pattern (const char *subcmd, size_t argc, char *const *const argv);
 static char *debug_device_speed (const char *subcmd, size_t argc, char *const *const argv);
 static char *debug_env (const char *subcmd, size_t argc, char *const *const argv);
@@ -86,6 +87,7 @@ static struct cmd cmds[] = {
   { "bmap", debug_bmap },
   { "bmap_device", debug_bmap_device },
   { "bmap_file", debug_bmap_file },
+  { "command_stats", debug_command_stats },
   { "core_pattern", debug_core_pattern },
   { "device_speed", debug_device_speed },
   { "env", debug_env },
@@ -303,6 +305,23 @@ debug_env (const char *subcmd, size_t argc, char *const *const argv)
   return out;
 }
 
+/* Print the number of times each external program has been run and
+ * the time spent in it.
+ */
+static char *
+debug_command_stats (const char *subcmd, size_t argc, char *const *const argv)
+{
+  char *ret;
+
+  ret = command_stats ();
+  if (ret == NULL) {
+    reply_with_perror ("command_stats");
+    return NULL;
+  }
+
+  return ret;
+}
+
 /* Set an environment variable in the daemon and future subprocesses. */
 static char *
 debug_setenv (const char *subcmd, size_t argc, char *const *const argv)
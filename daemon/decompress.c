@@ -0,0 +1,1082 @@
+/* libguestfs - the guestfsd daemon
+ * Copyright (C) 2016 Red Hat Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/* Parallel decompression of uploaded xz and zstd streams.
+ *
+ * This uses the same idea as pxzcat in virt-builder
+ * (builder/pxzcat-c.c), but works on a stream instead of a file:
+ *
+ * xz files written by multi-threaded xz ('xz -T') record the
+ * compressed and uncompressed size of each block in the block
+ * header, so the blocks can be found without decompressing them.
+ * zstd frames (from pzstd, or several zstd files concatenated) can
+ * be found by walking the block headers of the frame.
+ *
+ * As data arrives (see decompress_write) it is split into these
+ * independent pieces ("units") in the caller's thread.  The units
+ * are decompressed by a pool of threads, and their output is written
+ * to the output file descriptor in order, again in the caller's
+ * thread.
+ *
+ * Pieces which cannot be split like this (blocks written by
+ * single-threaded xz, zstd frames which don't record their size, and
+ * anything larger than MAX_UNIT_SIZE) are decompressed as a stream
+ * in the caller's thread, after the output of all the earlier units
+ * has been written.  So any valid input is decompressed, but only
+ * input written by a parallel compressor is decompressed in parallel.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+
+#ifdef HAVE_LIBLZMA
+#include <lzma.h>
+#endif
+
+#ifdef HAVE_LIBZSTD
+#include <zstd.h>
+#endif
+
+#include "daemon.h"
+
+/* Largest compressed or uncompressed unit which is decompressed by
+ * the thread pool.  Up to (nr_threads + 1) units are held in memory
+ * at once, so this limits the memory used in the appliance.  The
+ * default block size of 'xz -T' is 24 MB (at the default -6 preset).
+ */
+#define MAX_UNIT_SIZE (64 * 1024 * 1024)
+
+/* Size of the output buffer used when decompressing in the caller's
+ * thread.
+ */
+#define BUFFER_SIZE (64 * 1024)
+
+#define XZ_HEADER_MAGIC     "\xfd" "7zXZ\0"
+#define XZ_HEADER_MAGIC_LEN 6
+
+#define ZSTD_FRAME_MAGIC         UINT32_C(0xfd2fb528)
+#define ZSTD_SKIPPABLE_MAGIC     UINT32_C(0x184d2a50)
+#define ZSTD_SKIPPABLE_MASK      UINT32_C(0xfffffff0)
+
+enum unit_state { UNIT_FREE = 0, UNIT_QUEUED, UNIT_RUNNING, UNIT_DONE };
+
+struct unit {
+  enum unit_state state;
+  unsigned char *in;            /* compressed data */
+  size_t in_len;
+  unsigned char *out;           /* decompressed data */
+  size_t out_len;               /* expected size of decompressed data */
+  int check;                    /* xz: integrity check of the stream */
+  int failed;                   /* set by the worker on error */
+};
+
+struct decompress;
+
+struct format {
+  const char *name;
+  /* Split as much of the buffered input as possible, either queueing
+   * units or decompressing it directly.  Returns -1 on error.
+   */
+  int (*split) (struct decompress *d);
+  /* Decompress a unit (called in a worker thread).  Returns -1 on
+   * error, after printing the reason on stderr.
+   */
+  int (*decode_unit) (struct unit *u);
+  /* Called at the end of the input to check it was complete.
+   * Returns -1 on error.
+   */
+  int (*finish) (struct decompress *d);
+  void (*free) (struct decompress *d);
+};
+
+struct decompress {
+  const struct format *fmt;
+  int fd;                       /* output */
+
+  /* Input which has not been consumed yet is buf[pos..len-1]. */
+  unsigned char *buf;
+  size_t pos, len, alloc;
+
+  unsigned char *outbuf;        /* BUFFER_SIZE, for streaming */
+
+  /* Ring buffer of units, oldest first.  Units are written in this
+   * order by the caller's thread.
+   */
+  struct unit *units;
+  size_t nr_units, head, count;
+
+  pthread_t *threads;
+  size_t nr_threads, nr_started;
+  pthread_mutex_t lock;
+  pthread_cond_t queued_cond;   /* signalled when a unit is queued */
+  pthread_cond_t done_cond;     /* signalled when a unit is done */
+  int quit;
+
+  /* Set if the input is corrupt.  Output errors only set errno. */
+  char *error;
+
+  /* State of the splitter for each format. */
+  int state;
+#ifdef HAVE_LIBLZMA
+  lzma_stream strm;
+  lzma_stream_flags xz_flags;
+  lzma_block xz_block;
+  lzma_filter xz_filters[LZMA_FILTERS_MAX + 1];
+  lzma_index *xz_index;
+  lzma_vli xz_index_size;
+  lzma_vli xz_nr_blocks;
+#endif
+#ifdef HAVE_LIBZSTD
+  ZSTD_DStream *zds;
+  size_t zstd_header_size;
+  size_t zstd_scan;             /* offset of next block header from pos */
+  unsigned long long zstd_content_size;
+  int zstd_checksum, zstd_last_block;
+  uint32_t zstd_skip;
+#endif
+};
+
+static void set_error (struct decompress *d, const char *fs, ...)
+  __attribute__((format (printf,2,3)));
+
+static void
+set_error (struct decompress *d, const char *fs, ...)
+{
+  va_list args;
+  char *msg;
+  int r;
+
+  if (d->error)
+    return;
+
+  va_start (args, fs);
+  r = vasprintf (&msg, fs, args);
+  va_end (args);
+  if (r == -1) {
+    perror ("vasprintf");
+    return;
+  }
+  fprintf (stderr, "decompress: %s: %s\n", d->fmt->name, msg);
+  d->error = msg;
+}
+
+static void *
+worker_thread (void *vp)
+{
+  struct decompress *d = vp;
+  struct unit *u;
+  size_t i;
+
+  pthread_mutex_lock (&d->lock);
+  for (;;) {
+    /* Take the oldest queued unit. */
+    u = NULL;
+    for (i = 0; i < d->count; ++i) {
+      struct unit *v = &d->units[(d->head + i) % d->nr_units];
+      if (v->state == UNIT_QUEUED) {
+        u = v;
+        break;
+      }
+    }
+    if (u == NULL) {
+      if (d->quit)
+        break;
+      pthread_cond_wait (&d->queued_cond, &d->lock);
+      continue;
+    }
+
+    u->state = UNIT_RUNNING;
+    pthread_mutex_unlock (&d->lock);
+
+    if (d->fmt->decode_unit (u) == -1)
+      u->failed = 1;
+
+    pthread_mutex_lock (&d->lock);
+    u->state = UNIT_DONE;
+    pthread_cond_broadcast (&d->done_cond);
+  }
+  pthread_mutex_unlock (&d->lock);
+
+  return NULL;
+}
+
+static void
+free_unit (struct unit *u)
+{
+  free (u->in);
+  free (u->out);
+  memset (u, 0, sizeof *u);
+}
+
+/* Wait for the oldest unit to be decompressed, write it out and
+ * remove it from the ring.
+ */
+static int
+write_oldest_unit (struct decompress *d)
+{
+  struct unit *u = &d->units[d->head];
+  int r = 0;
+
+  pthread_mutex_lock (&d->lock);
+  while (u->state != UNIT_DONE)
+    pthread_cond_wait (&d->done_cond, &d->lock);
+  pthread_mutex_unlock (&d->lock);
+
+  if (u->failed) {
+    set_error (d, "corrupt input");
+    r = -1;
+  }
+  else if (u->out_len > 0 && xwrite (d->fd, u->out, u->out_len) == -1)
+    r = -1;
+
+  /* Only the caller's thread changes head and count, but the workers
+   * read them.
+   */
+  pthread_mutex_lock (&d->lock);
+  free_unit (u);
+  d->head = (d->head + 1) % d->nr_units;
+  d->count--;
+  pthread_mutex_unlock (&d->lock);
+
+  return r;
+}
+
+/* Write the oldest units which are already done, without waiting. */
+static int
+write_done_units (struct decompress *d)
+{
+  int done;
+
+  for (;;) {
+    pthread_mutex_lock (&d->lock);
+    done = d->count > 0 && d->units[d->head].state == UNIT_DONE;
+    pthread_mutex_unlock (&d->lock);
+    if (!done)
+      return 0;
+    if (write_oldest_unit (d) == -1)
+      return -1;
+  }
+}
+
+static int
+write_all_units (struct decompress *d)
+{
+  while (d->count > 0) {
+    if (write_oldest_unit (d) == -1)
+      return -1;
+  }
+  return 0;
+}
+
+/* Copy 'len' bytes of compressed input into a new unit and queue it
+ * for the workers.  If the ring is full, this first waits for the
+ * oldest unit and writes it.
+ */
+static int
+queue_unit (struct decompress *d, const unsigned char *in, size_t in_len,
+            size_t out_len, int check)
+{
+  struct unit *u;
+
+  if (d->count == d->nr_units && write_oldest_unit (d) == -1)
+    return -1;
+
+  u = &d->units[(d->head + d->count) % d->nr_units];
+  u->in = malloc (in_len);
+  /* +1 so that an empty unit still gets a buffer. */
+  u->out = malloc (out_len + 1);
+  if (u->in == NULL || u->out == NULL) {
+    perror ("malloc");
+    free_unit (u);
+    return -1;
+  }
+  memcpy (u->in, in, in_len);
+  u->in_len = in_len;
+  u->out_len = out_len;
+  u->check = check;
+
+  pthread_mutex_lock (&d->lock);
+  u->state = UNIT_QUEUED;
+  d->count++;
+  pthread_cond_signal (&d->queued_cond);
+  pthread_mutex_unlock (&d->lock);
+
+  return 0;
+}
+
+/* Write output which was decompressed in the caller's thread.  The
+ * output of all earlier units must be written first.
+ */
+static int
+write_stream_output (struct decompress *d, const void *buf, size_t len)
+{
+  if (len == 0)
+    return 0;
+  if (write_all_units (d) == -1)
+    return -1;
+  return xwrite (d->fd, buf, len);
+}
+
+#ifdef HAVE_LIBLZMA
+
+enum {
+  XZ_STREAM_HEADER = 0,         /* must be 0, the initial state */
+  XZ_BLOCK,
+  XZ_BLOCK_STREAM,
+  XZ_INDEX,
+  XZ_STREAM_FOOTER,
+  XZ_STREAM_PADDING,
+};
+
+static void
+free_filters (lzma_filter *filters)
+{
+  size_t i;
+
+  for (i = 0; filters[i].id != LZMA_VLI_UNKNOWN; ++i) {
+    free (filters[i].options);
+    filters[i].options = NULL;
+  }
+}
+
+/* Run the streaming decoder in d->strm over the buffered input,
+ * writing any output.  Returns 1 at the end of the block or index,
+ * 0 if more input is needed, or -1 on error.
+ */
+static int
+xz_stream_code (struct decompress *d)
+{
+  size_t avail = d->len - d->pos;
+  size_t n;
+  lzma_ret r;
+
+  d->strm.next_in = d->buf + d->pos;
+  d->strm.avail_in = avail;
+
+  do {
+    d->strm.next_out = d->outbuf;
+    d->strm.avail_out = BUFFER_SIZE;
+    r = lzma_code (&d->strm, LZMA_RUN);
+    if (r != LZMA_OK && r != LZMA_STREAM_END) {
+      set_error (d, "corrupt input (error %u)", r);
+      return -1;
+    }
+    n = BUFFER_SIZE - d->strm.avail_out;
+    if (write_stream_output (d, d->outbuf, n) == -1)
+      return -1;
+  } while (r == LZMA_OK &&
+           (d->strm.avail_in > 0 || d->strm.avail_out == 0));
+
+  d->pos += avail - d->strm.avail_in;
+  return r == LZMA_STREAM_END;
+}
+
+static int
+xz_split (struct decompress *d)
+{
+  const unsigned char *p;
+  size_t avail;
+  lzma_stream_flags footer_flags;
+  lzma_ret r;
+  int ret;
+
+  for (;;) {
+    p = d->buf + d->pos;
+    avail = d->len - d->pos;
+
+    switch (d->state) {
+    case XZ_STREAM_HEADER:
+      if (avail < LZMA_STREAM_HEADER_SIZE)
+        return 0;
+      if (memcmp (p, XZ_HEADER_MAGIC, XZ_HEADER_MAGIC_LEN) != 0) {
+        set_error (d, "input is not an xz file");
+        return -1;
+      }
+      r = lzma_stream_header_decode (&d->xz_flags, p);
+      if (r != LZMA_OK) {
+        set_error (d, "invalid stream header (error %u)", r);
+        return -1;
+      }
+      d->pos += LZMA_STREAM_HEADER_SIZE;
+      d->xz_nr_blocks = 0;
+      d->state = XZ_BLOCK;
+      break;
+
+    case XZ_BLOCK:
+      if (avail < 1)
+        return 0;
+
+      /* A zero byte here is the start of the index. */
+      if (p[0] == 0) {
+        r = lzma_index_decoder (&d->strm, &d->xz_index, UINT64_MAX);
+        if (r != LZMA_OK) {
+          set_error (d, "lzma_index_decoder: error %u", r);
+          return -1;
+        }
+        d->state = XZ_INDEX;
+        break;
+      }
+
+      d->xz_block.version = 0;
+      d->xz_block.check = d->xz_flags.check;
+      d->xz_block.filters = d->xz_filters;
+      d->xz_block.header_size = lzma_block_header_size_decode (p[0]);
+      if (avail < d->xz_block.header_size)
+        return 0;
+      r = lzma_block_header_decode (&d->xz_block, NULL, p);
+      if (r != LZMA_OK) {
+        set_error (d, "invalid block header (error %u)", r);
+        return -1;
+      }
+
+      if (d->xz_block.compressed_size != LZMA_VLI_UNKNOWN &&
+          d->xz_block.uncompressed_size != LZMA_VLI_UNKNOWN &&
+          d->xz_block.compressed_size <= MAX_UNIT_SIZE &&
+          d->xz_block.uncompressed_size <= MAX_UNIT_SIZE) {
+        /* The block can be decompressed by a worker once it has all
+         * arrived.  The worker decodes the header again.
+         */
+        lzma_vli total = lzma_block_total_size (&d->xz_block);
+
+        free_filters (d->xz_filters);
+        if (total == 0) {
+          set_error (d, "invalid block size");
+          return -1;
+        }
+        if (avail < total)
+          return 0;
+        if (queue_unit (d, p, total, d->xz_block.uncompressed_size,
+                        d->xz_flags.check) == -1)
+          return -1;
+        d->pos += total;
+      }
+      else {
+        /* Decompress the block as a stream in this thread.  The
+         * decoder copies the filter options.
+         */
+        r = lzma_block_decoder (&d->strm, &d->xz_block);
+        free_filters (d->xz_filters);
+        if (r != LZMA_OK) {
+          set_error (d, "lzma_block_decoder: error %u", r);
+          return -1;
+        }
+        d->pos += d->xz_block.header_size;
+        d->state = XZ_BLOCK_STREAM;
+      }
+      d->xz_nr_blocks++;
+      break;
+
+    case XZ_BLOCK_STREAM:
+      if (avail < 1)
+        return 0;
+      ret = xz_stream_code (d);
+      if (ret <= 0)
+        return ret;
+      d->state = XZ_BLOCK;
+      break;
+
+    case XZ_INDEX:
+      if (avail < 1)
+        return 0;
+      ret = xz_stream_code (d);
+      if (ret <= 0)
+        return ret;
+      if (lzma_index_block_count (d->xz_index) != d->xz_nr_blocks) {
+        set_error (d, "index does not match the number of blocks");
+        return -1;
+      }
+      d->xz_index_size = lzma_index_size (d->xz_index);
+      lzma_index_end (d->xz_index, NULL);
+      d->xz_index = NULL;
+      d->state = XZ_STREAM_FOOTER;
+      break;
+
+    case XZ_STREAM_FOOTER:
+      if (avail < LZMA_STREAM_HEADER_SIZE)
+        return 0;
+      r = lzma_stream_footer_decode (&footer_flags, p);
+      if (r != LZMA_OK) {
+        set_error (d, "invalid stream footer (error %u)", r);
+        return -1;
+      }
+      if (lzma_stream_flags_compare (&d->xz_flags, &footer_flags) != LZMA_OK ||
+          footer_flags.backward_size != d->xz_index_size) {
+        set_error (d, "stream footer does not match the stream");
+        return -1;
+      }
+      d->pos += LZMA_STREAM_HEADER_SIZE;
+      d->state = XZ_STREAM_PADDING;
+      break;
+
+    case XZ_STREAM_PADDING:
+      /* Stream padding (in multiples of 4 bytes), or another stream. */
+      if (avail < 4)
+        return 0;
+      if (p[0] == 0 && p[1] == 0 && p[2] == 0 && p[3] == 0)
+        d->pos += 4;
+      else
+        d->state = XZ_STREAM_HEADER;
+      break;
+
+    default:
+      abort ();
+    }
+  }
+}
+
+static int
+xz_decode_unit (struct unit *u)
+{
+  lzma_block block;
+  lzma_filter filters[LZMA_FILTERS_MAX + 1];
+  lzma_stream strm = LZMA_STREAM_INIT;
+  lzma_ret r;
+
+  block.version = 0;
+  block.check = u->check;
+  block.filters = filters;
+  block.header_size = lzma_block_header_size_decode (u->in[0]);
+  r = lzma_block_header_decode (&block, NULL, u->in);
+  if (r != LZMA_OK) {
+    fprintf (stderr, "decompress: xz: invalid block header (error %u)\n", r);
+    return -1;
+  }
+  r = lzma_block_decoder (&strm, &block);
+  free_filters (filters);
+  if (r != LZMA_OK) {
+    fprintf (stderr, "decompress: xz: lzma_block_decoder: error %u\n", r);
+    return -1;
+  }
+
+  strm.next_in = u->in + block.header_size;
+  strm.avail_in = u->in_len - block.header_size;
+  strm.next_out = u->out;
+  strm.avail_out = u->out_len;
+
+  /* The block decoder checks the sizes against the block header, so
+   * it returns an error if there is too much or too little data.
+   */
+  do {
+    r = lzma_code (&strm, LZMA_FINISH);
+  } while (r == LZMA_OK);
+  lzma_end (&strm);
+
+  if (r != LZMA_STREAM_END) {
+    fprintf (stderr, "decompress: xz: corrupt block (error %u)\n", r);
+    return -1;
+  }
+  return 0;
+}
+
+static int
+xz_finish (struct decompress *d)
+{
+  if (d->state != XZ_STREAM_PADDING || d->pos != d->len) {
+    set_error (d, "unexpected end of input");
+    return -1;
+  }
+  return 0;
+}
+
+static void
+xz_free (struct decompress *d)
+{
+  free_filters (d->xz_filters);
+  if (d->xz_index)
+    lzma_index_end (d->xz_index, NULL);
+  lzma_end (&d->strm);
+}
+
+static const struct format xz_format = {
+  .name = "xz",
+  .split = xz_split,
+  .decode_unit = xz_decode_unit,
+  .finish = xz_finish,
+  .free = xz_free,
+};
+
+#endif /* HAVE_LIBLZMA */
+
+#ifdef HAVE_LIBZSTD
+
+enum {
+  ZSTD_FRAME_START = 0,         /* must be 0, the initial state */
+  ZSTD_FRAME_SCAN,
+  ZSTD_FRAME_STREAM,
+  ZSTD_SKIPPABLE_FRAME,
+};
+
+static uint64_t
+read_le (const unsigned char *p, size_t n)
+{
+  uint64_t r = 0;
+
+  while (n > 0)
+    r = (r << 8) | p[--n];
+  return r;
+}
+
+/* Parse the frame header (see RFC 8878 section 3.1.1.1).  Returns
+ * 1 if it was parsed, 0 if more input is needed, or -1 on error.
+ */
+static int
+zstd_frame_header (struct decompress *d, const unsigned char *p, size_t avail)
+{
+  static const size_t did_sizes[4] = { 0, 1, 2, 4 };
+  static const size_t fcs_sizes[4] = { 0, 2, 4, 8 };
+  unsigned fhd;
+  int single_segment;
+  size_t did_size, fcs_size, fcs_offset;
+
+  if (avail < 5)
+    return 0;
+  fhd = p[4];
+  if (fhd & 0x08) {
+    set_error (d, "reserved bit set in frame header");
+    return -1;
+  }
+  single_segment = (fhd >> 5) & 1;
+  did_size = did_sizes[fhd & 3];
+  fcs_size = fcs_sizes[fhd >> 6];
+  if (fcs_size == 0 && single_segment)
+    fcs_size = 1;
+
+  d->zstd_header_size = 5 + !single_segment + did_size + fcs_size;
+  if (avail < d->zstd_header_size)
+    return 0;
+
+  d->zstd_checksum = (fhd >> 2) & 1;
+  fcs_offset = 5 + !single_segment + did_size;
+  if (fcs_size == 0)
+    d->zstd_content_size = ZSTD_CONTENTSIZE_UNKNOWN;
+  else {
+    d->zstd_content_size = read_le (p + fcs_offset, fcs_size);
+    if (fcs_size == 2)
+      d->zstd_content_size += 256;
+  }
+  return 1;
+}
+
+/* Run the streaming decoder over the buffered input, writing any
+ * output.  Returns 1 at the end of the frame, 0 if more input is
+ * needed, or -1 on error.
+ */
+static int
+zstd_stream_code (struct decompress *d)
+{
+  ZSTD_inBuffer in = { .src = d->buf + d->pos, .size = d->len - d->pos };
+  ZSTD_outBuffer out;
+  size_t r;
+
+  do {
+    out.dst = d->outbuf;
+    out.size = BUFFER_SIZE;
+    out.pos = 0;
+    r = ZSTD_decompressStream (d->zds, &out, &in);
+    if (ZSTD_isError (r)) {
+      set_error (d, "%s", ZSTD_getErrorName (r));
+      return -1;
+    }
+    if (write_stream_output (d, d->outbuf, out.pos) == -1)
+      return -1;
+  } while (r != 0 && (in.pos < in.size || out.pos == out.size));
+
+  d->pos += in.pos;
+  return r == 0;
+}
+
+static int
+zstd_split (struct decompress *d)
+{
+  const unsigned char *p;
+  size_t avail, n;
+  uint32_t magic;
+  unsigned block_header, block_type;
+  size_t block_size;
+  int ret;
+
+  for (;;) {
+    p = d->buf + d->pos;
+    avail = d->len - d->pos;
+
+    switch (d->state) {
+    case ZSTD_FRAME_START:
+      if (avail < 4)
+        return 0;
+      magic = read_le (p, 4);
+      if ((magic & ZSTD_SKIPPABLE_MASK) == ZSTD_SKIPPABLE_MAGIC) {
+        if (avail < 8)
+          return 0;
+        d->zstd_skip = read_le (p + 4, 4);
+        d->pos += 8;
+        d->state = ZSTD_SKIPPABLE_FRAME;
+        break;
+      }
+      if (magic != ZSTD_FRAME_MAGIC) {
+        set_error (d, "input is not a zstd file");
+        return -1;
+      }
+      ret = zstd_frame_header (d, p, avail);
+      if (ret <= 0)
+        return ret;
+
+      if (d->zstd_content_size <= MAX_UNIT_SIZE) {
+        /* Find the end of the frame, then give it to a worker. */
+        d->zstd_scan = d->zstd_header_size;
+        d->zstd_last_block = 0;
+        d->state = ZSTD_FRAME_SCAN;
+      }
+      else {
+        ZSTD_initDStream (d->zds);
+        d->state = ZSTD_FRAME_STREAM;
+      }
+      break;
+
+    case ZSTD_FRAME_SCAN:
+      while (!d->zstd_last_block) {
+        if (avail < d->zstd_scan + 3)
+          return 0;
+        block_header = read_le (p + d->zstd_scan, 3);
+        block_type = (block_header >> 1) & 3;
+        block_size = block_header >> 3;
+        if (block_type == 3) {
+          set_error (d, "reserved block type");
+          return -1;
+        }
+        if (block_type == 1)    /* RLE block has one byte of data */
+          block_size = 1;
+        d->zstd_scan += 3 + block_size;
+        d->zstd_last_block = block_header & 1;
+        if (d->zstd_scan >
+            d->zstd_header_size + ZSTD_compressBound (d->zstd_content_size)) {
+          set_error (d, "frame is larger than its content size");
+          return -1;
+        }
+      }
+      n = d->zstd_scan + (d->zstd_checksum ? 4 : 0);
+      if (avail < n)
+        return 0;
+      if (queue_unit (d, p, n, d->zstd_content_size, 0) == -1)
+        return -1;
+      d->pos += n;
+      d->state = ZSTD_FRAME_START;
+      break;
+
+    case ZSTD_FRAME_STREAM:
+      if (avail < 1)
+        return 0;
+      ret = zstd_stream_code (d);
+      if (ret <= 0)
+        return ret;
+      d->state = ZSTD_FRAME_START;
+      break;
+
+    case ZSTD_SKIPPABLE_FRAME:
+      if (d->zstd_skip == 0) {
+        d->state = ZSTD_FRAME_START;
+        break;
+      }
+      if (avail < 1)
+        return 0;
+      n = avail < d->zstd_skip ? avail : d->zstd_skip;
+      d->pos += n;
+      d->zstd_skip -= n;
+      break;
+
+    default:
+      abort ();
+    }
+  }
+}
+
+static int
+zstd_decode_unit (struct unit *u)
+{
+  size_t r;
+
+  r = ZSTD_decompress (u->out, u->out_len, u->in, u->in_len);
+  if (ZSTD_isError (r)) {
+    fprintf (stderr, "decompress: zstd: %s\n", ZSTD_getErrorName (r));
+    return -1;
+  }
+  if (r != u->out_len) {
+    fprintf (stderr, "decompress: zstd: frame is shorter than its content size\n");
+    return -1;
+  }
+  return 0;
+}
+
+static int
+zstd_finish (struct decompress *d)
+{
+  if (d->state != ZSTD_FRAME_START || d->pos != d->len) {
+    set_error (d, "unexpected end of input");
+    return -1;
+  }
+  return 0;
+}
+
+static void
+zstd_free (struct decompress *d)
+{
+  if (d->zds)
+    ZSTD_freeDStream (d->zds);
+}
+
+static const struct format zstd_format = {
+  .name = "zstd",
+  .split = zstd_split,
+  .decode_unit = zstd_decode_unit,
+  .finish = zstd_finish,
+  .free = zstd_free,
+};
+
+#endif /* HAVE_LIBZSTD */
+
+static const struct format *
+get_format (const char *ctype)
+{
+#ifdef HAVE_LIBLZMA
+  if (STREQ (ctype, "xz"))
+    return &xz_format;
+#endif
+#ifdef HAVE_LIBZSTD
+  if (STREQ (ctype, "zstd"))
+    return &zstd_format;
+#endif
+  return NULL;
+}
+
+/* Returns true if compression type 'ctype' can be decompressed by
+ * this module.
+ */
+int
+decompress_supported (const char *ctype)
+{
+  return get_format (ctype) != NULL;
+}
+
+/* Return the number of worker threads to use for decompressing.
+ * This is the number of vCPUs, but since each of the (nr_threads + 1)
+ * units may hold MAX_UNIT_SIZE bytes of input and the same again of
+ * output, it is limited so that the units cannot use more than half
+ * of the appliance memory.  If there is not enough memory for two
+ * workers this returns 1, meaning don't decompress in the daemon.
+ */
+size_t
+decompress_threads (void)
+{
+  long pages = sysconf (_SC_PHYS_PAGES);
+  long pagesize = sysconf (_SC_PAGESIZE);
+  uint64_t max_units;
+  size_t n = compress_threads ();
+
+  if (pages <= 0 || pagesize <= 0)
+    return 1;
+
+  max_units = (uint64_t) pages * pagesize / 2 / (2 * MAX_UNIT_SIZE);
+  if (max_units < 3)
+    return 1;
+  if (n > max_units - 1)
+    n = max_units - 1;
+  return n;
+}
+
+/* Start decompressing compression type 'ctype' to file descriptor
+ * 'fd', using 'nr_threads' worker threads.  Feed the compressed data
+ * to decompress_write (which can be used as a receive_file callback),
+ * then call decompress_finish and decompress_free.
+ *
+ * This does not call reply_with_*.  It returns NULL with errno set
+ * on error.
+ */
+struct decompress *
+decompress_new (const char *ctype, int fd, size_t nr_threads)
+{
+  struct decompress *d;
+  int err;
+
+  d = calloc (1, sizeof *d);
+  if (d == NULL)
+    return NULL;
+
+  d->fmt = get_format (ctype);
+  if (d->fmt == NULL) {
+    free (d);
+    errno = ENOTSUP;
+    return NULL;
+  }
+  d->fd = fd;
+  pthread_mutex_init (&d->lock, NULL);
+  pthread_cond_init (&d->queued_cond, NULL);
+  pthread_cond_init (&d->done_cond, NULL);
+
+#ifdef HAVE_LIBLZMA
+  {
+    const lzma_stream init = LZMA_STREAM_INIT;
+    d->strm = init;
+    d->xz_filters[0].id = LZMA_VLI_UNKNOWN;
+  }
+#endif
+#ifdef HAVE_LIBZSTD
+  if (d->fmt == &zstd_format) {
+    d->zds = ZSTD_createDStream ();
+    if (d->zds == NULL) {
+      errno = ENOMEM;
+      goto error;
+    }
+  }
+#endif
+
+  if (nr_threads < 1)
+    nr_threads = 1;
+  if (nr_threads > decompress_threads ())
+    nr_threads = decompress_threads ();
+  d->nr_threads = nr_threads;
+  d->nr_units = nr_threads + 1;
+  d->units = calloc (d->nr_units, sizeof (struct unit));
+  d->threads = calloc (nr_threads, sizeof (pthread_t));
+  d->outbuf = malloc (BUFFER_SIZE);
+  if (d->units == NULL || d->threads == NULL || d->outbuf == NULL)
+    goto error;
+
+  for (d->nr_started = 0; d->nr_started < nr_threads; ++d->nr_started) {
+    err = pthread_create (&d->threads[d->nr_started], NULL,
+                          worker_thread, d);
+    if (err != 0) {
+      errno = err;
+      goto error;
+    }
+  }
+
+  return d;
+
+ error:
+  err = errno;
+  decompress_free (d);
+  errno = err;
+  return NULL;
+}
+
+/* Feed more compressed data.  This has the same signature as a
+ * receive_cb.  Returns -1 on error, either because the input is
+ * corrupt (see decompress_error) or because writing the output
+ * failed (errno is set).
+ */
+int
+decompress_write (void *dv, const void *buf, size_t len)
+{
+  struct decompress *d = dv;
+
+  if (d->error)
+    return -1;
+
+  /* Discard the input which has been consumed. */
+  if (d->pos > 0) {
+    memmove (d->buf, d->buf + d->pos, d->len - d->pos);
+    d->len -= d->pos;
+    d->pos = 0;
+  }
+
+  if (d->len + len > d->alloc) {
+    size_t alloc = d->alloc > 0 ? d->alloc : BUFFER_SIZE;
+    unsigned char *p;
+
+    while (alloc < d->len + len)
+      alloc *= 2;
+    p = realloc (d->buf, alloc);
+    if (p == NULL) {
+      perror ("realloc");
+      return -1;
+    }
+    d->buf = p;
+    d->alloc = alloc;
+  }
+  memcpy (d->buf + d->len, buf, len);
+  d->len += len;
+
+  if (d->fmt->split (d) == -1)
+    return -1;
+
+  return write_done_units (d);
+}
+
+/* Call this after all the input has been written.  It checks that
+ * the input was complete and writes the remaining output.
+ */
+int
+decompress_finish (struct decompress *d)
+{
+  if (d->error)
+    return -1;
+  if (write_all_units (d) == -1)
+    return -1;
+  return d->fmt->finish (d);
+}
+
+/* Returns the reason that the input could not be decompressed, or
+ * NULL if there was no problem with the input.
+ */
+const char *
+decompress_error (struct decompress *d)
+{
+  return d->error;
+}
+
+void
+decompress_free (struct decompress *d)
+{
+  size_t i;
+
+  if (d == NULL)
+    return;
+
+  pthread_mutex_lock (&d->lock);
+  d->quit = 1;
+  pthread_cond_broadcast (&d->queued_cond);
+  pthread_mutex_unlock (&d->lock);
+
+  /* The workers finish any queued units before exiting. */
+  for (i = 0; i < d->nr_started; ++i)
+    pthread_join (d->threads[i], NULL);
+
+  if (d->units) {
+    for (i = 0; i < d->nr_units; ++i)
+      free_unit (&d->units[i]);
+  }
+  if (d->fmt->free)
+    d->fmt->free (d);
+
+  pthread_mutex_destroy (&d->lock);
+  pthread_cond_destroy (&d->queued_cond);
+  pthread_cond_destroy (&d->done_cond);
+  free (d->units);
+  free (d->threads);
+  free (d->outbuf);
+  free (d->buf);
+  free (d->error);
+  free (d);
+}
@@ -23,43 +23,139 @@
 #include <string.h>
 #include <unistd.h>
 #include <inttypes.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "hash.h"
 
 #include "guestfs_protocol.h"
 #include "daemon.h"
 #include "actions.h"
 
-GUESTFSD_EXT_CMD(str_du, du);
+/* This used to run 'du -s'.  It is now implemented using the tree
+ * walker in walk.c, but the result is the same: the total of the
+ * blocks allocated to 'path' and everything under it, counting files
+ * with multiple hard links only once, in units of 1K rounded up.
+ */
+struct du_data {
+  pthread_mutex_t lock;         /* Protects the fields below. */
+  uint64_t bytes;               /* Total allocated bytes so far. */
+  Hash_table *seen;             /* (dev, ino) of multiply-linked files. */
+};
+
+struct du_inode {
+  dev_t dev;
+  ino_t ino;
+};
+
+static size_t
+du_inode_hash (void const *x, size_t table_size)
+{
+  const struct du_inode *p = x;
+
+  return (p->ino ^ p->dev) % table_size;
+}
+
+static bool
+du_inode_cmp (void const *x, void const *y)
+{
+  const struct du_inode *a = x;
+  const struct du_inode *b = y;
+
+  return a->ino == b->ino && a->dev == b->dev;
+}
+
+static int
+du_entry (const struct walk_entry *entry, void *datav)
+{
+  struct du_data *data = datav;
+  const struct stat *statbuf = entry->statbuf;
+  struct du_inode *ent;
+  int r = 0;
+
+  pthread_mutex_lock (&data->lock);
+
+  if (statbuf->st_nlink > 1 && !S_ISDIR (statbuf->st_mode)) {
+    ent = malloc (sizeof *ent);
+    if (ent == NULL) {
+      perror ("malloc");
+      r = -1;
+      goto out;
+    }
+    ent->dev = statbuf->st_dev;
+    ent->ino = statbuf->st_ino;
+    switch (hash_insert_if_absent (data->seen, ent, NULL)) {
+    case -1:
+      perror ("hash_insert_if_absent");
+      free (ent);
+      r = -1;
+      goto out;
+    case 0:                     /* Already counted. */
+      free (ent);
+      goto out;
+    }
+  }
+
+  data->bytes += (uint64_t) statbuf->st_blocks * 512;
+
+ out:
+  pthread_mutex_unlock (&data->lock);
+  return r;
+}
 
 int64_t
 do_du (const char *path)
 {
   int r;
-  int64_t rv;
-  CLEANUP_FREE char *out = NULL, *err = NULL, *buf = NULL;
+  struct stat statbuf;
+  CLEANUP_FREE char *buf = NULL;
+  struct du_data data = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+  };
 
   /* Make the path relative to /sysroot. */
   buf = sysroot_path (path);
   if (!buf) {
     reply_with_perror ("malloc");
-    return -1;
+    goto error;
   }
 
-  pulse_mode_start ();
-
-  r = command (&out, &err, str_du, "-s", buf, NULL);
-  if (r == -1) {
-    pulse_mode_cancel ();
-    reply_with_error ("%s: %s", path, err);
-    return -1;
+  if (lstat (buf, &statbuf) == -1) {
+    reply_with_perror ("%s", path);
+    goto error;
   }
+  data.bytes = (uint64_t) statbuf.st_blocks * 512;
+
+  if (S_ISDIR (statbuf.st_mode)) {
+    data.seen = hash_initialize (1024, NULL, du_inode_hash, du_inode_cmp,
+                                 free);
+    if (data.seen == NULL) {
+      reply_with_perror ("hash_initialize");
+      goto error;
+    }
+
+    pulse_mode_start ();
 
-  if (sscanf (out, "%"SCNi64, &rv) != 1) {
-    pulse_mode_cancel ();
-    reply_with_error ("%s: could not read output: %s", path, out);
-    return -1;
+    r = walk_tree (buf, WALK_FLAG_STAT, 0, du_entry, &data);
+    if (r == -1) {
+      int err = errno;
+
+      hash_free (data.seen);
+      pulse_mode_cancel ();
+      reply_with_perror_errno (err, "%s", path);
+      goto error;
+    }
+    hash_free (data.seen);
+
+    pulse_mode_end ();
   }
 
-  pulse_mode_end ();
+  pthread_mutex_destroy (&data.lock);
+
+  return (data.bytes + 1023) / 1024;
 
-  return rv;
+ error:
+  pthread_mutex_destroy (&data.lock);
+  return -1;
 }
@@ -130,6 +130,8 @@ do_set_e2label (const char *device, const char *label)
   int r;
   CLEANUP_FREE char *err = NULL;
 
+  invalidate_device_caches ();
+
   if (strlen (label) > EXT2_LABEL_MAX) {
     reply_with_error ("%s: ext2/3/4 labels are limited to %d bytes",
                       label, EXT2_LABEL_MAX);
@@ -162,6 +164,8 @@ do_set_e2uuid (const char *device, const char *uuid)
   int r;
   CLEANUP_FREE char *err = NULL;
 
+  invalidate_device_caches ();
+
   r = command (NULL, &err, str_tune2fs, "-U", uuid, device, NULL);
   if (r == -1) {
     reply_with_error ("%s", err);
@@ -425,6 +429,8 @@ do_mke2journal (int blocksize, const char *device)
   CLEANUP_FREE char *err = NULL;
   int r;
 
+  invalidate_device_caches ();
+
   char blocksize_s[32];
   snprintf (blocksize_s, sizeof blocksize_s, "%d", blocksize);
 
@@ -447,6 +453,8 @@ do_mke2journal_L (int blocksize, const char *label, const char *device)
   CLEANUP_FREE char *err = NULL;
   int r;
 
+  invalidate_device_caches ();
+
   if (strlen (label) > EXT2_LABEL_MAX) {
     reply_with_error ("%s: ext2/3/4 labels are limited to %d bytes",
                       label, EXT2_LABEL_MAX);
@@ -476,6 +484,8 @@ do_mke2journal_U (int blocksize, const char *uuid, const char *device)
   CLEANUP_FREE char *err = NULL;
   int r;
 
+  invalidate_device_caches ();
+
   char blocksize_s[32];
   snprintf (blocksize_s, sizeof blocksize_s, "%d", blocksize);
 
@@ -502,6 +512,8 @@ do_mke2fs_J (const char *fstype, int blocksize, const char *device,
   CLEANUP_FREE char *jdev = NULL;
   int r;
 
+  invalidate_device_caches ();
+
   if (!fstype_is_extfs (fstype)) {
     reply_with_error ("%s: not a valid extended filesystem type", fstype);
     return -1;
@@ -536,6 +548,8 @@ do_mke2fs_JL (const char *fstype, int blocksize, const char *device,
   CLEANUP_FREE char *jdev = NULL;
   int r;
 
+  invalidate_device_caches ();
+
   if (!fstype_is_extfs (fstype)) {
     reply_with_error ("%s: not a valid extended filesystem type", fstype);
     return -1;
@@ -576,6 +590,8 @@ do_mke2fs_JU (const char *fstype, int blocksize, const char *device,
   CLEANUP_FREE char *jdev = NULL;
   int r;
 
+  invalidate_device_caches ();
+
   if (!fstype_is_extfs (fstype)) {
     reply_with_error ("%s: not a valid extended filesystem type", fstype);
     return -1;
@@ -627,6 +643,8 @@ do_tune2fs (const char *device, /* only required parameter */
   char reservedblockscount_s[64];
   char user_s[64];
 
+  invalidate_device_caches ();
+
   ADD_ARG (argv, i, str_tune2fs);
 
   if (optargs_bitmask & GUESTFS_TUNE2FS_FORCE_BITMASK) {
@@ -985,6 +1003,8 @@ do_mke2fs (const char *device,               /* 0 */
   char maxonlineresize_s[74];
   size_t i = 0;
 
+  invalidate_device_caches ();
+
   ADD_ARG (argv, i, str_mke2fs);
 
   if (optargs_bitmask & GUESTFS_MKE2FS_BLOCKSIZE_BITMASK) {
@@ -0,0 +1,866 @@
+/* libguestfs - the guestfsd daemon
+ * Copyright (C) 2016 Red Hat Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/**
+ * This file implements C<guestfs_file_extents> and
+ * C<guestfs_extents_to_files>, which map files to the extents they
+ * occupy on the underlying disks and back again.
+ *
+ * The extents of a file are read using the C<FS_IOC_FIEMAP> ioctl.
+ * These are byte offsets on the block device containing the
+ * filesystem (found from C<st_dev>), which may be a partition, a
+ * logical volume or an md device.  The offsets are then translated
+ * down through each layer of the block device stack until they
+ * reach a whole disk, using the information in F</sys/dev/block>
+ * and (for device-mapper) the output of C<dmsetup table>.  Only the
+ * layers which map each byte to a single place are supported:
+ * partitions, device-mapper C<linear> targets (ie. ordinary LVM
+ * logical volumes) and md RAID 1.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <limits.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/param.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <sys/sysmacros.h>
+
+#ifdef HAVE_LINUX_FS_H
+#include <linux/fs.h>
+#endif
+#ifdef HAVE_LINUX_FIEMAP_H
+#include <linux/fiemap.h>
+#endif
+
+#include "guestfs_protocol.h"
+#include "daemon.h"
+#include "actions.h"
+
+#if defined(FS_IOC_FIEMAP) && defined(HAVE_LINUX_FIEMAP_H)
+
+GUESTFSD_EXT_CMD(str_dmsetup, dmsetup);
+
+/* Number of extents fetched by each FIEMAP call. */
+#define FIEMAP_BATCH 256
+
+/* Extents with any of these flags don't have a usable physical
+ * location, so they are returned (by file_extents) or ignored (by
+ * extents_to_files) without being translated.
+ */
+#define UNMAPPABLE_FLAGS                                        \
+  (FIEMAP_EXTENT_UNKNOWN | FIEMAP_EXTENT_DELALLOC |             \
+   FIEMAP_EXTENT_ENCODED | FIEMAP_EXTENT_DATA_INLINE |          \
+   FIEMAP_EXTENT_DATA_TAIL)
+
+/* One segment of a device-mapper linear table.  All fields are in
+ * bytes.
+ */
+struct segment {
+  uint64_t start;               /* Start in the dm device. */
+  uint64_t len;
+  dev_t dev;                    /* Underlying device. */
+  uint64_t offset;              /* Offset in the underlying device. */
+};
+
+enum layer_type {
+  LAYER_DISK,                   /* Whole disk: bottom of the stack. */
+  LAYER_OFFSET,                 /* Partition or md RAID 1 member. */
+  LAYER_LINEAR,                 /* device-mapper linear table. */
+};
+
+/* How one block device maps onto the device(s) below it. */
+struct layer {
+  struct layer *next;
+  dev_t dev;
+  enum layer_type type;
+  char *name;                   /* LAYER_DISK: "/dev/sda" etc. */
+  dev_t parent;                 /* LAYER_OFFSET */
+  uint64_t offset;              /* LAYER_OFFSET: byte offset in parent. */
+  struct segment *segs;         /* LAYER_LINEAR */
+  size_t nr_segs;
+};
+
+/* Shared by all the threads walking the tree in extents_to_files. */
+struct extents_ctx {
+  pthread_mutex_t lock;         /* Protects all the fields below. */
+  struct layer *layers;         /* Cache of layers seen so far. */
+  char *error;                  /* First error message. */
+  int saved_errno;
+
+  dev_t stop;                   /* Stop translating at this device ... */
+  const char *stop_name;        /* ... and report it with this name. */
+
+  /* extents_to_files only. */
+  const char *dir;              /* Directory being searched. */
+  const struct range *ranges;
+  size_t nr_ranges;
+  dev_t *skipped;               /* Filesystems which can't be mapped. */
+  size_t nr_skipped;
+
+  guestfs_int_extent *extents;  /* Results. */
+  size_t nr_extents, alloc_extents;
+};
+
+static void
+free_ctx (struct extents_ctx *ctx)
+{
+  struct layer *l, *next;
+  size_t i;
+
+  for (l = ctx->layers; l != NULL; l = next) {
+    next = l->next;
+    free (l->name);
+    free (l->segs);
+    free (l);
+  }
+  free (ctx->error);
+  free (ctx->skipped);
+  for (i = 0; i < ctx->nr_extents; ++i) {
+    free (ctx->extents[i].ext_path);
+    free (ctx->extents[i].ext_device);
+  }
+  free (ctx->extents);
+  pthread_mutex_destroy (&ctx->lock);
+}
+
+/* Save the first error.  The lock must be held. */
+static void set_error (struct extents_ctx *ctx, int err, const char *fs, ...)
+  __attribute__((format (printf,3,4)));
+
+static void
+set_error (struct extents_ctx *ctx, int err, const char *fs, ...)
+{
+  va_list args;
+
+  if (ctx->error == NULL) {
+    va_start (args, fs);
+    if (vasprintf (&ctx->error, fs, args) == -1)
+      ctx->error = NULL;
+    va_end (args);
+    ctx->saved_errno = err;
+  }
+  errno = err;
+}
+
+/* Reply with the saved error. */
+static void
+reply_with_ctx_error (struct extents_ctx *ctx, const char *what)
+{
+  if (ctx->error)
+    reply_with_error_errno (ctx->saved_errno, "%s: %s", what, ctx->error);
+  else
+    reply_with_perror ("%s", what);
+}
+
+/* Read the first line of a sysfs file, without the trailing newline. */
+static char *
+read_sysfs (const char *dir, const char *file)
+{
+  CLEANUP_FREE char *path = NULL;
+  char *line = NULL;
+  size_t allocsize = 0;
+  ssize_t len;
+  FILE *fp;
+
+  if (asprintf (&path, "%s/%s", dir, file) == -1)
+    return NULL;
+  fp = fopen (path, "re");
+  if (fp == NULL)
+    return NULL;
+  len = getline (&line, &allocsize, fp);
+  fclose (fp);
+  if (len == -1) {
+    free (line);
+    errno = EINVAL;
+    return NULL;
+  }
+  if (len > 0 && line[len-1] == '\n')
+    line[len-1] = '\0';
+  return line;
+}
+
+static int
+read_sysfs_u64 (const char *dir, const char *file, uint64_t *ret)
+{
+  CLEANUP_FREE char *str = read_sysfs (dir, file);
+
+  if (str == NULL || sscanf (str, "%" SCNu64, ret) != 1)
+    return -1;
+  return 0;
+}
+
+static int
+read_sysfs_dev (const char *dir, const char *file, dev_t *ret)
+{
+  CLEANUP_FREE char *str = read_sysfs (dir, file);
+  unsigned maj, min;
+
+  if (str == NULL || sscanf (str, "%u:%u", &maj, &min) != 2)
+    return -1;
+  *ret = makedev (maj, min);
+  return 0;
+}
+
+/* Parse the output of 'dmsetup table' for a device. */
+static int
+parse_dm_table (struct extents_ctx *ctx, struct layer *layer)
+{
+  CLEANUP_FREE char *out = NULL, *err = NULL;
+  CLEANUP_FREE_STRING_LIST char **lines = NULL;
+  char majstr[16], minstr[16];
+  size_t i;
+
+  snprintf (majstr, sizeof majstr, "%u", major (layer->dev));
+  snprintf (minstr, sizeof minstr, "%u", minor (layer->dev));
+
+  if (command (&out, &err, str_dmsetup, "table",
+               "-j", majstr, "-m", minstr, NULL) == -1) {
+    set_error (ctx, EINVAL, "dmsetup table: %s", err);
+    return -1;
+  }
+
+  lines = split_lines (out);
+  if (lines == NULL) {
+    set_error (ctx, errno, "malloc");
+    return -1;
+  }
+
+  layer->segs = calloc (count_strings (lines) + 1, sizeof (struct segment));
+  if (layer->segs == NULL) {
+    set_error (ctx, errno, "calloc");
+    return -1;
+  }
+
+  for (i = 0; lines[i] != NULL; ++i) {
+    uint64_t start, len, offset;
+    unsigned maj, min;
+    char target[32];
+    struct segment *seg;
+
+    if (STREQ (lines[i], ""))
+      continue;
+    if (sscanf (lines[i], "%" SCNu64 " %" SCNu64 " %31s",
+                &start, &len, target) != 3) {
+      set_error (ctx, EINVAL, "could not parse dmsetup table: %s", lines[i]);
+      return -1;
+    }
+    if (STRNEQ (target, "linear")) {
+      set_error (ctx, ENOTSUP,
+                 "device %u:%u: device-mapper target '%s' is not supported",
+                 major (layer->dev), minor (layer->dev), target);
+      return -1;
+    }
+    if (sscanf (lines[i], "%*u %*u %*s %u:%u %" SCNu64,
+                &maj, &min, &offset) != 3) {
+      set_error (ctx, EINVAL, "could not parse dmsetup table: %s", lines[i]);
+      return -1;
+    }
+
+    seg = &layer->segs[layer->nr_segs++];
+    seg->start = start * 512;
+    seg->len = len * 512;
+    seg->dev = makedev (maj, min);
+    seg->offset = offset * 512;
+  }
+
+  return 0;
+}
+
+/* Find the first in-sync member of an md RAID 1 array. */
+static int
+find_mirror_member (struct extents_ctx *ctx, const char *sysdir,
+                    struct layer *layer)
+{
+  CLEANUP_FREE char *mddir = NULL;
+  DIR *dir;
+  struct dirent *d;
+  int found = 0;
+
+  if (asprintf (&mddir, "%s/md", sysdir) == -1) {
+    set_error (ctx, errno, "asprintf");
+    return -1;
+  }
+  dir = opendir (mddir);
+  if (dir == NULL) {
+    set_error (ctx, errno, "opendir: %s", mddir);
+    return -1;
+  }
+
+  while (!found && (d = readdir (dir)) != NULL) {
+    CLEANUP_FREE char *memberdir = NULL, *state = NULL;
+    uint64_t offset;
+    dev_t dev;
+
+    if (!STRPREFIX (d->d_name, "dev-"))
+      continue;
+    if (asprintf (&memberdir, "%s/%s", mddir, d->d_name) == -1)
+      break;
+    state = read_sysfs (memberdir, "state");
+    if (state == NULL || strstr (state, "in_sync") == NULL)
+      continue;
+    if (read_sysfs_u64 (memberdir, "offset", &offset) == -1 ||
+        read_sysfs_dev (memberdir, "block/dev", &dev) == -1)
+      continue;
+
+    layer->type = LAYER_OFFSET;
+    layer->parent = dev;
+    layer->offset = offset * 512;
+    found = 1;
+  }
+  closedir (dir);
+
+  if (!found) {
+    set_error (ctx, ENOENT, "%s: no in-sync member found", sysdir);
+    return -1;
+  }
+  return 0;
+}
+
+/* Work out how the device 'dev' maps onto the devices below it. */
+static struct layer *
+make_layer (struct extents_ctx *ctx, dev_t dev)
+{
+  char sysdir[64];
+  CLEANUP_FREE char *realdir = NULL, *level = NULL;
+  CLEANUP_FREE char *partition = NULL, *dm = NULL, *md = NULL;
+  struct layer *layer;
+  const char *p;
+
+  snprintf (sysdir, sizeof sysdir, "/sys/dev/block/%u:%u",
+            major (dev), minor (dev));
+  realdir = realpath (sysdir, NULL);
+  if (realdir == NULL) {
+    /* For example btrfs, which uses an anonymous device number. */
+    set_error (ctx, ENOTSUP, "device %u:%u is not a block device",
+               major (dev), minor (dev));
+    return NULL;
+  }
+
+  layer = calloc (1, sizeof *layer);
+  if (layer == NULL) {
+    set_error (ctx, errno, "calloc");
+    return NULL;
+  }
+  layer->dev = dev;
+
+  if (asprintf (&partition, "%s/partition", realdir) == -1 ||
+      asprintf (&dm, "%s/dm", realdir) == -1 ||
+      asprintf (&md, "%s/md", realdir) == -1) {
+    set_error (ctx, errno, "asprintf");
+    goto error;
+  }
+
+  if (access (partition, F_OK) == 0) {
+    CLEANUP_FREE char *parentdir = NULL;
+
+    if (read_sysfs_u64 (realdir, "start", &layer->offset) == -1 ||
+        asprintf (&parentdir, "%s/..", realdir) == -1 ||
+        read_sysfs_dev (parentdir, "dev", &layer->parent) == -1) {
+      set_error (ctx, errno, "%s: could not read partition start", realdir);
+      goto error;
+    }
+    layer->type = LAYER_OFFSET;
+    layer->offset *= 512;
+  }
+  else if (access (dm, F_OK) == 0) {
+    layer->type = LAYER_LINEAR;
+    if (parse_dm_table (ctx, layer) == -1)
+      goto error;
+  }
+  else if (access (md, F_OK) == 0) {
+    level = read_sysfs (realdir, "md/level");
+    if (level == NULL || STRNEQ (level, "raid1")) {
+      set_error (ctx, ENOTSUP, "%s: md level '%s' is not supported",
+                 realdir, level ? level : "unknown");
+      goto error;
+    }
+    if (find_mirror_member (ctx, realdir, layer) == -1)
+      goto error;
+  }
+  else {
+    p = strrchr (realdir, '/');
+    layer->type = LAYER_DISK;
+    if (asprintf (&layer->name, "/dev/%s", p ? p+1 : realdir) == -1) {
+      set_error (ctx, errno, "asprintf");
+      goto error;
+    }
+  }
+
+  return layer;
+
+ error:
+  free (layer->name);
+  free (layer->segs);
+  free (layer);
+  return NULL;
+}
+
+/* Look up a layer in the cache, adding it if necessary.  Layers are
+ * never freed until the end of the call, so the pointer returned can
+ * be used without holding the lock.
+ */
+static struct layer *
+get_layer (struct extents_ctx *ctx, dev_t dev)
+{
+  struct layer *layer;
+
+  pthread_mutex_lock (&ctx->lock);
+  for (layer = ctx->layers; layer != NULL; layer = layer->next)
+    if (layer->dev == dev)
+      break;
+  if (layer == NULL) {
+    layer = make_layer (ctx, dev);
+    if (layer) {
+      layer->next = ctx->layers;
+      ctx->layers = layer;
+    }
+  }
+  pthread_mutex_unlock (&ctx->lock);
+
+  return layer;
+}
+
+/* Add one extent to the results.  The lock must be held. */
+static int
+add_extent (struct extents_ctx *ctx, const char *path, const char *device,
+            uint64_t file_offset, int64_t device_offset, uint64_t size,
+            uint32_t flags)
+{
+  guestfs_int_extent *ext;
+
+  if (ctx->nr_extents == ctx->alloc_extents) {
+    size_t n = ctx->alloc_extents ? 2 * ctx->alloc_extents : 64;
+    guestfs_int_extent *p;
+
+    p = realloc (ctx->extents, n * sizeof (guestfs_int_extent));
+    if (p == NULL) {
+      set_error (ctx, errno, "realloc");
+      return -1;
+    }
+    ctx->extents = p;
+    ctx->alloc_extents = n;
+  }
+
+  ext = &ctx->extents[ctx->nr_extents];
+  ext->ext_path = strdup (path);
+  ext->ext_device = strdup (device);
+  if (ext->ext_path == NULL || ext->ext_device == NULL) {
+    set_error (ctx, errno, "strdup");
+    free (ext->ext_path);
+    free (ext->ext_device);
+    return -1;
+  }
+  ext->ext_file_offset = file_offset;
+  ext->ext_device_offset = device_offset;
+  ext->ext_size = size;
+  ext->ext_flags = flags;
+  ctx->nr_extents++;
+  return 0;
+}
+
+/* Called for each translated piece of a file extent. */
+static int
+emit_piece (struct extents_ctx *ctx, const char *path, const char *device,
+            uint64_t logical, uint64_t physical, uint64_t len, uint32_t flags)
+{
+  size_t i;
+  int r = 0;
+
+  pthread_mutex_lock (&ctx->lock);
+
+  if (ctx->ranges == NULL)      /* file_extents */
+    r = add_extent (ctx, path, device, logical, physical, len, flags);
+  else {                        /* extents_to_files */
+    for (i = 0; r == 0 && i < ctx->nr_ranges; ++i) {
+      uint64_t start = MAX (physical, ctx->ranges[i].offset);
+      uint64_t end = MIN (physical + len,
+                          ctx->ranges[i].offset + ctx->ranges[i].size);
+
+      if (start < end)
+        r = add_extent (ctx, path, device, logical + (start - physical),
+                        start, end - start, flags);
+    }
+  }
+
+  pthread_mutex_unlock (&ctx->lock);
+  return r;
+}
+
+/* Translate the range 'offset'/'len' of device 'dev' down the block
+ * device stack, calling emit_piece for each piece.  Pieces which
+ * don't pass through ctx->stop (if set) are dropped.
+ */
+static int
+map_range (struct extents_ctx *ctx, const char *path, dev_t dev,
+           uint64_t logical, uint64_t offset, uint64_t len, uint32_t flags)
+{
+  const struct layer *layer;
+  size_t i;
+
+  for (;;) {
+    if (ctx->stop != 0 && dev == ctx->stop)
+      return emit_piece (ctx, path, ctx->stop_name,
+                         logical, offset, len, flags);
+
+    layer = get_layer (ctx, dev);
+    if (layer == NULL)
+      return -1;
+
+    switch (layer->type) {
+    case LAYER_DISK:
+      if (ctx->stop != 0)
+        return 0;
+      return emit_piece (ctx, path, layer->name, logical, offset, len, flags);
+
+    case LAYER_OFFSET:
+      dev = layer->parent;
+      offset += layer->offset;
+      continue;
+
+    case LAYER_LINEAR:
+      for (i = 0; i < layer->nr_segs; ++i) {
+        const struct segment *seg = &layer->segs[i];
+        uint64_t start = MAX (offset, seg->start);
+        uint64_t end = MIN (offset + len, seg->start + seg->len);
+
+        if (start < end &&
+            map_range (ctx, path, seg->dev,
+                       logical + (start - offset),
+                       seg->offset + (start - seg->start),
+                       end - start, flags) == -1)
+          return -1;
+      }
+      return 0;
+    }
+    abort ();
+  }
+}
+
+/* extents_to_files skips filesystems which don't support FIEMAP or
+ * don't sit on a block device, such as /proc or tmpfs mounted below
+ * the directory.  These functions remember which ones have been seen.
+ */
+static int
+is_skipped (struct extents_ctx *ctx, dev_t dev)
+{
+  size_t i;
+  int r = 0;
+
+  pthread_mutex_lock (&ctx->lock);
+  for (i = 0; i < ctx->nr_skipped; ++i) {
+    if (ctx->skipped[i] == dev) {
+      r = 1;
+      break;
+    }
+  }
+  pthread_mutex_unlock (&ctx->lock);
+  return r;
+}
+
+static void
+skip_filesystem (struct extents_ctx *ctx, dev_t dev)
+{
+  dev_t *p;
+
+  pthread_mutex_lock (&ctx->lock);
+  p = realloc (ctx->skipped, (ctx->nr_skipped + 1) * sizeof (dev_t));
+  /* If this fails the filesystem is checked again for each file. */
+  if (p != NULL) {
+    ctx->skipped = p;
+    ctx->skipped[ctx->nr_skipped++] = dev;
+  }
+  pthread_mutex_unlock (&ctx->lock);
+}
+
+static int
+is_block_device (dev_t dev)
+{
+  char sysdir[64];
+
+  snprintf (sysdir, sizeof sysdir, "/sys/dev/block/%u:%u",
+            major (dev), minor (dev));
+  return access (sysdir, F_OK) == 0;
+}
+
+/* Read the extents of an open file and translate each one.  'path'
+ * is the name reported in the results.
+ */
+static int
+map_file (struct extents_ctx *ctx, const char *path, int fd)
+{
+  struct stat statbuf;
+  CLEANUP_FREE struct fiemap *fm = NULL;
+  uint64_t start = 0;
+  uint32_t i;
+  int last = 0;
+
+  if (fstat (fd, &statbuf) == -1) {
+    pthread_mutex_lock (&ctx->lock);
+    set_error (ctx, errno, "stat: %s", path);
+    pthread_mutex_unlock (&ctx->lock);
+    return -1;
+  }
+
+  if (ctx->ranges != NULL) {
+    if (is_skipped (ctx, statbuf.st_dev))
+      return 0;
+    if (!is_block_device (statbuf.st_dev)) {
+      skip_filesystem (ctx, statbuf.st_dev);
+      return 0;
+    }
+  }
+
+  fm = malloc (sizeof *fm + FIEMAP_BATCH * sizeof (struct fiemap_extent));
+  if (fm == NULL) {
+    pthread_mutex_lock (&ctx->lock);
+    set_error (ctx, errno, "malloc");
+    pthread_mutex_unlock (&ctx->lock);
+    return -1;
+  }
+
+  while (!last) {
+    memset (fm, 0, sizeof *fm);
+    fm->fm_start = start;
+    fm->fm_length = FIEMAP_MAX_OFFSET - start;
+    fm->fm_flags = FIEMAP_FLAG_SYNC;
+    fm->fm_extent_count = FIEMAP_BATCH;
+
+    if (ioctl (fd, FS_IOC_FIEMAP, fm) == -1) {
+      if (ctx->ranges != NULL && start == 0 &&
+          (errno == EOPNOTSUPP || errno == ENOTTY)) {
+        skip_filesystem (ctx, statbuf.st_dev);
+        return 0;
+      }
+      pthread_mutex_lock (&ctx->lock);
+      set_error (ctx, errno, "FIEMAP: %s", path);
+      pthread_mutex_unlock (&ctx->lock);
+      return -1;
+    }
+    if (fm->fm_mapped_extents == 0)
+      break;
+
+    for (i = 0; i < fm->fm_mapped_extents; ++i) {
+      const struct fiemap_extent *fe = &fm->fm_extents[i];
+
+      if (fe->fe_flags & UNMAPPABLE_FLAGS) {
+        /* Only file_extents reports these. */
+        if (ctx->ranges == NULL &&
+            emit_piece (ctx, path, "", fe->fe_logical, -1,
+                        fe->fe_length, fe->fe_flags) == -1)
+          return -1;
+      }
+      else if (map_range (ctx, path, statbuf.st_dev,
+                          fe->fe_logical, fe->fe_physical,
+                          fe->fe_length, fe->fe_flags) == -1)
+        return -1;
+
+      if (fe->fe_flags & FIEMAP_EXTENT_LAST)
+        last = 1;
+      start = fe->fe_logical + fe->fe_length;
+    }
+  }
+
+  return 0;
+}
+
+static int
+compare_extents (const void *av, const void *bv)
+{
+  const guestfs_int_extent *a = av;
+  const guestfs_int_extent *b = bv;
+  int r;
+
+  r = strcmp (a->ext_device, b->ext_device);
+  if (r != 0)
+    return r;
+  if (a->ext_device_offset != b->ext_device_offset)
+    return a->ext_device_offset < b->ext_device_offset ? -1 : 1;
+  return strcmp (a->ext_path, b->ext_path);
+}
+
+/* Hand the results over to the caller. */
+static guestfs_int_extent_list *
+take_results (struct extents_ctx *ctx)
+{
+  guestfs_int_extent_list *ret;
+
+  ret = malloc (sizeof *ret);
+  if (ret == NULL) {
+    reply_with_perror ("malloc");
+    return NULL;
+  }
+  ret->guestfs_int_extent_list_len = ctx->nr_extents;
+  ret->guestfs_int_extent_list_val = ctx->extents;
+  ctx->extents = NULL;
+  ctx->nr_extents = ctx->alloc_extents = 0;
+  return ret;
+}
+
+guestfs_int_extent_list *
+do_file_extents (const char *path)
+{
+  struct extents_ctx ctx = { .lock = PTHREAD_MUTEX_INITIALIZER };
+  guestfs_int_extent_list *ret;
+  int fd, r;
+
+  CHROOT_IN;
+  fd = open (path, O_RDONLY|O_CLOEXEC|O_NOCTTY);
+  CHROOT_OUT;
+  if (fd == -1) {
+    reply_with_perror ("%s", path);
+    goto error;
+  }
+
+  r = map_file (&ctx, path, fd);
+  close (fd);
+  if (r == -1) {
+    reply_with_ctx_error (&ctx, path);
+    goto error;
+  }
+
+  /* Extents are returned in file order, which is the order FIEMAP
+   * returns them in (except where LVM splits them).
+   */
+  ret = take_results (&ctx);
+  free_ctx (&ctx);
+  return ret;
+
+ error:
+  free_ctx (&ctx);
+  return NULL;
+}
+
+static int
+extents_to_files_entry (const struct walk_entry *entry, void *ctxv)
+{
+  struct extents_ctx *ctx = ctxv;
+  CLEANUP_FREE char *path = NULL;
+  int fd, r;
+
+  if (entry->type != DT_REG)
+    return 0;
+
+  if (asprintf (&path, "%s%s%s", ctx->dir,
+                STREQ (ctx->dir, "/") ? "" : "/", entry->path) == -1) {
+    pthread_mutex_lock (&ctx->lock);
+    set_error (ctx, errno, "asprintf");
+    pthread_mutex_unlock (&ctx->lock);
+    return -1;
+  }
+
+  fd = openat (entry->dirfd, entry->name,
+               O_RDONLY|O_NOFOLLOW|O_CLOEXEC|O_NOCTTY);
+  if (fd == -1) {
+    pthread_mutex_lock (&ctx->lock);
+    set_error (ctx, errno, "open: %s", path);
+    pthread_mutex_unlock (&ctx->lock);
+    return -1;
+  }
+
+  r = map_file (ctx, path, fd);
+  close (fd);
+  return r;
+}
+
+guestfs_int_extent_list *
+do_extents_to_files (const char *dir, const char *device,
+                     char *const *ranges)
+{
+  struct extents_ctx ctx = { .lock = PTHREAD_MUTEX_INITIALIZER };
+  CLEANUP_FREE struct range *rs = NULL;
+  CLEANUP_FREE char *sysrootdir = NULL;
+  guestfs_int_extent_list *ret;
+  const char *bad_range;
+  struct stat statbuf;
+
+  rs = parse_ranges (ranges, &ctx.nr_ranges, &bad_range);
+  if (rs == NULL) {
+    if (bad_range)
+      reply_with_error ("invalid range: %s", bad_range);
+    else
+      reply_with_perror ("malloc");
+    goto error;
+  }
+  ctx.ranges = rs;
+
+  if (stat (device, &statbuf) == -1) {
+    reply_with_perror ("%s", device);
+    goto error;
+  }
+  if (!S_ISBLK (statbuf.st_mode)) {
+    reply_with_error ("%s: not a block device", device);
+    goto error;
+  }
+  ctx.stop = statbuf.st_rdev;
+  ctx.stop_name = device;
+
+  sysrootdir = sysroot_path (dir);
+  if (!sysrootdir) {
+    reply_with_perror ("malloc");
+    goto error;
+  }
+  ctx.dir = dir;
+
+  if (walk_tree (sysrootdir, 0, 0, extents_to_files_entry, &ctx) == -1) {
+    reply_with_ctx_error (&ctx, dir);
+    goto error;
+  }
+
+  /* The walk visits files in an unspecified order. */
+  if (ctx.nr_extents > 0)
+    qsort (ctx.extents, ctx.nr_extents, sizeof (guestfs_int_extent),
+           compare_extents);
+
+  ret = take_results (&ctx);
+  free_ctx (&ctx);
+  return ret;
+
+ error:
+  free_ctx (&ctx);
+  return NULL;
+}
+
+#else /* !FS_IOC_FIEMAP */
+
+guestfs_int_extent_list *
+do_file_extents (const char *path)
+{
+  NOT_SUPPORTED (NULL, "FIEMAP is not supported by this appliance");
+}
+
+guestfs_int_extent_list *
+do_extents_to_files (const char *dir, const char *device,
+                     char *const *ranges)
+{
+  NOT_SUPPORTED (NULL, "FIEMAP is not supported by this appliance");
+}
+
+#endif /* !FS_IOC_FIEMAP */
@@ -440,6 +440,8 @@ do_pwrite_device (const char *device, const char *content, size_t size,
     return -1;
   }
 
+  invalidate_device_caches ();
+
   int fd = open (device, O_WRONLY|O_CLOEXEC);
   if (fd == -1) {
     reply_with_perror ("open: %s", device);
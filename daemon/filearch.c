@@ -0,0 +1,172 @@
+/* libguestfs - the guestfsd daemon
+ * Copyright (C) 2016 Red Hat Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/* Find the architecture of ELF and PE binaries from their headers.
+ * See src/filearch.c for the other file types which
+ * guestfs_file_architecture supports.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "guestfs_protocol.h"
+#include "daemon.h"
+#include "actions.h"
+
+/* These are from <elf.h>, but we don't want to depend on the
+ * daemon's C library knowing about every architecture.
+ */
+#define ELFDATA2LSB    1
+#define ELFDATA2MSB    2
+#define EM_SPARC       2
+#define EM_386         3
+#define EM_486         6
+#define EM_SPARC32PLUS 18
+#define EM_PPC         20
+#define EM_PPC64       21
+#define EM_ARM         40
+#define EM_SPARCV9     43
+#define EM_IA_64       50
+#define EM_X86_64      62
+#define EM_AARCH64     183
+
+#define IMAGE_FILE_MACHINE_I386  0x14c
+#define IMAGE_FILE_MACHINE_AMD64 0x8664
+
+static uint16_t
+get16 (const unsigned char *p, int msb)
+{
+  return msb ? (p[0] << 8) | p[1] : (p[1] << 8) | p[0];
+}
+
+static uint32_t
+get32le (const unsigned char *p)
+{
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+/* Return the canonical architecture (as documented for
+ * guestfs_file_architecture) of an ELF header, or "" if the machine
+ * is not one we know about.
+ */
+static const char *
+elf_arch (const unsigned char *hdr)
+{
+  int msb = hdr[5] == ELFDATA2MSB;
+
+  if (hdr[5] != ELFDATA2LSB && hdr[5] != ELFDATA2MSB)
+    return "";
+
+  switch (get16 (&hdr[18], msb)) {
+  case EM_386:         return "i386";
+  case EM_486:         return "i486";
+  case EM_X86_64:      return "x86_64";
+  case EM_SPARC:
+  case EM_SPARC32PLUS: return "sparc";
+  case EM_SPARCV9:     return "sparc64";
+  case EM_IA_64:       return "ia64";
+  case EM_PPC:         return "ppc";
+  case EM_PPC64:       return msb ? "ppc64" : "ppc64le";
+  case EM_ARM:         return "arm";
+  case EM_AARCH64:     return "aarch64";
+  default:             return "";
+  }
+}
+
+/* Same for a PE (Windows) binary, where 'fd' is open on the file and
+ * 'hdr' contains the MS-DOS header.
+ */
+static const char *
+pe_arch (int fd, const unsigned char *hdr)
+{
+  unsigned char pe[6];
+  off_t offset = get32le (&hdr[0x3c]);
+
+  if (pread (fd, pe, sizeof pe, offset) != sizeof pe ||
+      memcmp (pe, "PE\0\0", 4) != 0)
+    return "";
+
+  switch (get16 (&pe[4], 0)) {
+  case IMAGE_FILE_MACHINE_I386:  return "i386";
+  case IMAGE_FILE_MACHINE_AMD64: return "x86_64";
+  default:                       return "";
+  }
+}
+
+char *
+do_internal_file_architecture (const char *path)
+{
+  int fd;
+  struct stat statbuf;
+  unsigned char hdr[64];
+  ssize_t r;
+  const char *arch = "";
+  char *ret;
+
+  CHROOT_IN;
+  fd = open (path, O_RDONLY|O_CLOEXEC|O_NOCTTY|O_NONBLOCK);
+  CHROOT_OUT;
+
+  if (fd == -1) {
+    reply_with_perror ("open: %s", path);
+    return NULL;
+  }
+
+  if (fstat (fd, &statbuf) == -1) {
+    reply_with_perror ("fstat: %s", path);
+    close (fd);
+    return NULL;
+  }
+
+  /* Don't try to read devices, FIFOs etc., which may hang. */
+  if (S_ISREG (statbuf.st_mode)) {
+    r = pread (fd, hdr, sizeof hdr, 0);
+    if (r == -1) {
+      reply_with_perror ("read: %s", path);
+      close (fd);
+      return NULL;
+    }
+    if (r == sizeof hdr) {
+      if (memcmp (hdr, "\177ELF", 4) == 0)
+        arch = elf_arch (hdr);
+      else if (memcmp (hdr, "MZ", 2) == 0)
+        arch = pe_arch (fd, hdr);
+    }
+  }
+
+  if (close (fd) == -1) {
+    reply_with_perror ("close: %s", path);
+    return NULL;
+  }
+
+  ret = strdup (arch);
+  if (ret == NULL) {
+    reply_with_perror ("strdup");
+    return NULL;
+  }
+  return ret;
+}
@@ -24,31 +24,36 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <limits.h>
+#include <pthread.h>
 #include <sys/stat.h>
 
 #include "guestfs_protocol.h"
 #include "daemon.h"
 #include "actions.h"
 
-GUESTFSD_EXT_CMD(str_find, find);
+struct find0_data {
+  pthread_mutex_t lock;         /* Protects the send buffer. */
+  struct send_buffer sb;
+  int prefix_slash;             /* Prefix each entry with '/'. */
+  int send_error;               /* send_buffer_write failed. */
+};
 
 static int
-input_to_nul (FILE *fp, char *buf, size_t maxlen)
+find0_entry (const struct walk_entry *entry, void *datav)
 {
-  size_t i = 0;
-  int c;
-
-  while (i < maxlen) {
-    c = fgetc (fp);
-    if (c == EOF)
-      return 0;
-    buf[i++] = c;
-    if (c == '\0')
-      return i;
-  }
-
-  reply_with_error ("input_to_nul: input string too long");
-  return -1;
+  struct find0_data *data = datav;
+  int r = 0;
+
+  pthread_mutex_lock (&data->lock);
+  if (data->prefix_slash)
+    r = send_buffer_write (&data->sb, "/", 1);
+  if (r == 0)
+    r = send_buffer_write (&data->sb, entry->path, entry->pathlen + 1);
+  if (r < 0)
+    data->send_error = 1;
+  pthread_mutex_unlock (&data->lock);
+
+  return r < 0 ? -1 : 0;
 }
 
 /* Has one FileOut parameter. */
@@ -56,18 +61,13 @@ int
 do_find0 (const char *dir)
 {
   struct stat statbuf;
-  int r;
-  FILE *fp;
-  CLEANUP_FREE char *cmd = NULL;
+  int r, is_link;
   CLEANUP_FREE char *sysrootdir = NULL;
   size_t sysrootdirlen;
-  CLEANUP_FREE char *str = NULL;
-
-  str = malloc (GUESTFS_MAX_CHUNK_SIZE);
-  if (str == NULL) {
-    reply_with_perror ("malloc");
-    return -1;
-  }
+  struct find0_data data = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .sb = { .buf = NULL, .len = 0 },
+  };
 
   sysrootdir = sysroot_path (dir);
   if (!sysrootdir) {
@@ -85,21 +85,23 @@ do_find0 (const char *dir)
     return -1;
   }
 
-  sysrootdirlen = strlen (sysrootdir);
-
-  if (asprintf_nowarn (&cmd, "%s %Q -print0", str_find, sysrootdir) == -1) {
-    reply_with_perror ("asprintf");
+  /* Like 'find', don't descend into 'dir' if it is a symbolic link
+   * to a directory.  The result is empty.
+   */
+  r = lstat (sysrootdir, &statbuf);
+  if (r == -1) {
+    reply_with_perror ("%s", dir);
     return -1;
   }
+  is_link = S_ISLNK (statbuf.st_mode);
 
-  if (verbose)
-    fprintf (stderr, "%s\n", cmd);
-
-  fp = popen (cmd, "r");
-  if (fp == NULL) {
-    reply_with_perror ("%s", cmd);
-    return -1;
-  }
+  /* For compatibility with the output of the old 'find -print0'
+   * implementation, entries are the full path with the directory
+   * part removed, which leaves a leading '/' unless 'dir' ended
+   * with one.
+   */
+  sysrootdirlen = strlen (sysrootdir);
+  data.prefix_slash = sysrootdir[sysrootdirlen-1] != '/';
 
   /* Now we must send the reply message, before the file contents.  After
    * this there is no opportunity in the protocol to send any error
@@ -107,33 +109,17 @@ do_find0 (const char *dir)
    */
   reply (NULL, NULL);
 
-  /* The code below assumes each path returned can fit into a protocol
-   * chunk (if not you'll get a runtime protocol error).  If this
-   * turns out not to be a problem at some point in the future then
-   * we'll need to modify the code to handle it.  XXX
-   */
-  while ((r = input_to_nul (fp, str, GUESTFS_MAX_CHUNK_SIZE)) > 0) {
-    size_t len = strlen (str);
-    if (len <= sysrootdirlen)
-      continue;
-
-    /* Remove the directory part of the path before sending it. */
-    if (send_file_write (str + sysrootdirlen, r - sysrootdirlen) < 0) {
-      pclose (fp);
-      return -1;
-    }
-  }
+  r = is_link ? 0 : walk_tree (sysrootdir, 0, 0, find0_entry, &data);
+  if (r == 0)
+    r = send_buffer_flush (&data.sb);
+  free_send_buffer (&data.sb);
+  pthread_mutex_destroy (&data.lock);
 
-  if (ferror (fp)) {
-    fprintf (stderr, "fgetc: %s: %m\n", dir);
-    send_file_end (1);                /* Cancel. */
-    pclose (fp);
-    return -1;
-  }
-
-  if (pclose (fp) != 0) {
-    fprintf (stderr, "pclose: %s: %m\n", dir);
-    send_file_end (1);                /* Cancel. */
+  if (r < 0) {
+    if (!data.send_error) {
+      fprintf (stderr, "find0: %s: %m\n", dir);
+      send_file_end (1);              /* Cancel. */
+    }
     return -1;
   }
 
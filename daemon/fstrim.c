@@ -20,8 +20,22 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdarg.h>
 #include <string.h>
 #include <inttypes.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+#include <sys/param.h>
+#include <sys/statvfs.h>
+
+#ifdef HAVE_LINUX_FS_H
+#include <linux/fs.h>
+#endif
 
 #include "guestfs_protocol.h"
 #include "daemon.h"
@@ -31,6 +45,8 @@
 #define MAX_ARGS 64
 
 GUESTFSD_EXT_CMD(str_fstrim, fstrim);
+GUESTFSD_EXT_CMD(str_mount, mount);
+GUESTFSD_EXT_CMD(str_umount, umount);
 
 int
 optgroup_fstrim_available (void)
@@ -114,3 +130,526 @@ do_fstrim (const char *path,
 
   return 0;
 }
+
+/* Upper limit on the number of filesystems processed at once. */
+#define MAX_TRIM_THREADS 8
+
+/* Size of each FITRIM request, so that we can report progress and
+ * notice cancellation on large filesystems.
+ */
+#define TRIM_STEP (UINT64_C(1024) * 1024 * 1024)
+
+/* Largest fallocate request, and size of each write when zeroing. */
+#define ALLOCATE_STEP (UINT64_C(256) * 1024 * 1024)
+#define ZERO_WRITE_SIZE (4 * 1024 * 1024)
+
+struct trim_fs {
+  const char *mountable;        /* As passed by the caller. */
+  char *error;                  /* Error message, or NULL if it worked. */
+  uint64_t done, total;         /* Progress in bytes. */
+};
+
+struct trim_state {
+  pthread_mutex_t lock;         /* Protects all the fields below. */
+  pthread_cond_t cond;
+  struct trim_fs *fses;
+  size_t nr_fses;
+  size_t next;                  /* Next filesystem to process. */
+  size_t running;               /* Number of threads still running. */
+  int zero;                     /* Zero instead of trimming. */
+  int cancelled;                /* The library cancelled the call. */
+};
+
+static void fs_error (struct trim_fs *fs, const char *fmt, ...)
+  __attribute__((format (printf,2,3)));
+
+/* Record an error for one filesystem, keeping the first one. */
+static void
+fs_error (struct trim_fs *fs, const char *fmt, ...)
+{
+  va_list args;
+
+  if (fs->error != NULL)
+    return;
+  va_start (args, fmt);
+  if (vasprintf (&fs->error, fmt, args) == -1)
+    fs->error = NULL;
+  va_end (args);
+  if (fs->error == NULL)
+    fs->error = strdup ("error");
+}
+
+static int
+trim_cancelled (struct trim_state *state)
+{
+  int r;
+
+  pthread_mutex_lock (&state->lock);
+  r = state->cancelled;
+  pthread_mutex_unlock (&state->lock);
+  return r;
+}
+
+static void
+set_progress (struct trim_state *state, struct trim_fs *fs,
+              uint64_t done, uint64_t total)
+{
+  pthread_mutex_lock (&state->lock);
+  fs->done = done;
+  fs->total = total;
+  pthread_mutex_unlock (&state->lock);
+}
+
+/* Fill the free space of the filesystem mounted on 'mp' with zeroes
+ * using large writes, like zero_free_space.
+ */
+static int
+zero_mounted_fs (struct trim_state *state, struct trim_fs *fs,
+                 const char *mp)
+{
+  CLEANUP_FREE char *filename = NULL, *buf = NULL;
+  struct statvfs statbuf;
+  uint64_t total, done = 0;
+  ssize_t r;
+  int fd;
+
+  if (asprintf (&filename, "%s/XXXXXXXX.XXX", mp) == -1 ||
+      random_name (filename) == -1) {
+    fs_error (fs, "random_name: %m");
+    return -1;
+  }
+  buf = calloc (1, ZERO_WRITE_SIZE);
+  if (buf == NULL) {
+    fs_error (fs, "calloc: %m");
+    return -1;
+  }
+
+  fd = open (filename, O_WRONLY|O_CREAT|O_EXCL|O_NOCTTY|O_CLOEXEC, 0600);
+  if (fd == -1) {
+    fs_error (fs, "open: %m");
+    return -1;
+  }
+  if (fstatvfs (fd, &statbuf) == -1) {
+    fs_error (fs, "fstatvfs: %m");
+    goto error;
+  }
+  total = (uint64_t) statbuf.f_bavail * statbuf.f_frsize;
+  set_progress (state, fs, 0, total);
+
+  for (;;) {
+    if (trim_cancelled (state))
+      goto error;
+    r = write (fd, buf, ZERO_WRITE_SIZE);
+    if (r == -1) {
+      if (errno == ENOSPC)      /* expected error */
+        break;
+      fs_error (fs, "write: %m");
+      goto error;
+    }
+    done += r;
+    set_progress (state, fs, MIN (done, total), total);
+  }
+
+  /* Make sure the zeroes reach the disk before the file is deleted. */
+  if (fdatasync (fd) == -1 && errno != ENOSPC) {
+    fs_error (fs, "fdatasync: %m");
+    goto error;
+  }
+  close (fd);
+  if (unlink (filename) == -1) {
+    fs_error (fs, "unlink: %m");
+    return -1;
+  }
+  set_progress (state, fs, total, total);
+  return 0;
+
+ error:
+  close (fd);
+  unlink (filename);
+  return -1;
+}
+
+#if defined(FALLOC_FL_PUNCH_HOLE) && defined(FALLOC_FL_KEEP_SIZE)
+
+/* For filesystems which don't support FITRIM: allocate all the free
+ * space to a file, then punch it out again.  The filesystem is
+ * mounted with '-o discard', so freeing the blocks discards them.
+ * Returns -2 if fallocate is not supported.
+ */
+static int
+punch_mounted_fs (struct trim_state *state, struct trim_fs *fs,
+                  const char *mp)
+{
+  CLEANUP_FREE char *filename = NULL;
+  struct statvfs statbuf;
+  uint64_t total, size = 0, step = ALLOCATE_STEP;
+  int fd;
+
+  if (asprintf (&filename, "%s/XXXXXXXX.XXX", mp) == -1 ||
+      random_name (filename) == -1) {
+    fs_error (fs, "random_name: %m");
+    return -1;
+  }
+
+  fd = open (filename, O_WRONLY|O_CREAT|O_EXCL|O_NOCTTY|O_CLOEXEC, 0600);
+  if (fd == -1) {
+    fs_error (fs, "open: %m");
+    return -1;
+  }
+  if (fstatvfs (fd, &statbuf) == -1) {
+    fs_error (fs, "fstatvfs: %m");
+    goto error;
+  }
+  total = (uint64_t) statbuf.f_bavail * statbuf.f_frsize;
+  set_progress (state, fs, 0, total);
+
+  while (step >= statbuf.f_frsize && step > 0) {
+    if (trim_cancelled (state))
+      goto error;
+    if (fallocate (fd, 0, size, step) == -1) {
+      if (errno == ENOSPC) {
+        step /= 2;
+        continue;
+      }
+      if (size == 0 && (errno == EOPNOTSUPP || errno == ENOSYS)) {
+        close (fd);
+        unlink (filename);
+        return -2;
+      }
+      fs_error (fs, "fallocate: %m");
+      goto error;
+    }
+    size += step;
+    set_progress (state, fs, MIN (size, total), total);
+  }
+
+  if (size > 0 &&
+      fallocate (fd, FALLOC_FL_PUNCH_HOLE|FALLOC_FL_KEEP_SIZE,
+                 0, size) == -1) {
+    fs_error (fs, "fallocate: punch hole: %m");
+    goto error;
+  }
+  close (fd);
+  if (unlink (filename) == -1) {
+    fs_error (fs, "unlink: %m");
+    return -1;
+  }
+  set_progress (state, fs, total, total);
+  return 0;
+
+ error:
+  close (fd);
+  unlink (filename);
+  return -1;
+}
+
+#else
+
+static int
+punch_mounted_fs (struct trim_state *state, struct trim_fs *fs,
+                  const char *mp)
+{
+  return -2;
+}
+
+#endif
+
+/* Trim the filesystem mounted on 'mp', in steps of TRIM_STEP.
+ * 'discard' is true if it was mounted with '-o discard'.
+ */
+static int
+trim_mounted_fs (struct trim_state *state, struct trim_fs *fs,
+                 const char *mp, int discard)
+{
+  int r;
+#ifdef FITRIM
+  struct statvfs statbuf;
+  struct fstrim_range range;
+  uint64_t size, start;
+  int fd;
+
+  fd = open (mp, O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+  if (fd == -1) {
+    fs_error (fs, "open: %m");
+    return -1;
+  }
+  if (fstatvfs (fd, &statbuf) == -1) {
+    fs_error (fs, "fstatvfs: %m");
+    close (fd);
+    return -1;
+  }
+  size = (uint64_t) statbuf.f_blocks * statbuf.f_frsize;
+  set_progress (state, fs, 0, size);
+
+  for (start = 0; start < size; start += TRIM_STEP) {
+    if (trim_cancelled (state)) {
+      close (fd);
+      return -1;
+    }
+
+    range.start = start;
+    range.len = TRIM_STEP;
+    range.minlen = 0;
+    if (ioctl (fd, FITRIM, &range) == -1) {
+      if (start == 0 && (errno == ENOTTY || errno == EOPNOTSUPP))
+        break;                  /* Not supported, try the fallbacks. */
+      fs_error (fs, "FITRIM: %m");
+      close (fd);
+      return -1;
+    }
+    set_progress (state, fs, MIN (start + TRIM_STEP, size), size);
+  }
+  close (fd);
+
+  if (start > 0)
+    return 0;
+#endif
+
+  /* FITRIM is not supported, so punch holes.  Freeing the blocks
+   * only discards them if the filesystem is mounted with '-o
+   * discard'.  Writing zeroes would not trim anything, so don't
+   * fall back to that here.
+   */
+  if (!discard) {
+    fs_error (fs, "FITRIM is not supported and the filesystem could not be mounted with -o discard");
+    return -1;
+  }
+  r = punch_mounted_fs (state, fs, mp);
+  if (r == -2) {
+    fs_error (fs, "FITRIM and fallocate are not supported");
+    return -1;
+  }
+  return r;
+}
+
+/* Mount one filesystem on a temporary mountpoint outside the
+ * sysroot, trim or zero it, and unmount it.
+ */
+static void
+trim_one (struct trim_state *state, struct trim_fs *fs)
+{
+  char mp[] = "/tmp/trimXXXXXX";
+  mountable_t mountable = { .type = MOUNTABLE_DEVICE };
+  CLEANUP_FREE char *device = NULL, *options = NULL, *err = NULL;
+  CLEANUP_FREE char *err2 = NULL;
+  int r, discard = 0;
+
+  if (STRPREFIX (fs->mountable, "btrfsvol:")) {
+    if (parse_btrfsvol (fs->mountable + strlen ("btrfsvol:"),
+                        &mountable) == -1) {
+      fs_error (fs, "cannot parse btrfs subvolume");
+      return;
+    }
+    device = mountable.device;
+    if (asprintf (&options, "subvol=%s", mountable.volume) == -1) {
+      fs_error (fs, "asprintf: %m");
+      free (mountable.volume);
+      return;
+    }
+    free (mountable.volume);
+  }
+  else {
+    device = device_name_translation (fs->mountable);
+    if (device == NULL) {
+      fs_error (fs, "%s: %m", fs->mountable);
+      return;
+    }
+    options = strdup ("");
+    if (options == NULL) {
+      fs_error (fs, "strdup: %m");
+      return;
+    }
+  }
+
+  if (mkdtemp (mp) == NULL) {
+    fs_error (fs, "mkdtemp: %m");
+    return;
+  }
+
+  /* Use '-o discard' when trimming, so that freeing blocks discards
+   * them if we have to use the fallbacks, but not every filesystem
+   * understands it.
+   */
+  r = -1;
+  if (!state->zero) {
+    CLEANUP_FREE char *discard_options = NULL;
+
+    if (asprintf (&discard_options, "%s%sdiscard",
+                  options, STREQ (options, "") ? "" : ",") == -1) {
+      fs_error (fs, "asprintf: %m");
+      goto out;
+    }
+    r = command (NULL, &err2, str_mount, "-o", discard_options,
+                 device, mp, NULL);
+    discard = r != -1;
+  }
+  if (r == -1)
+    r = command (NULL, &err, str_mount, "-o", options, device, mp, NULL);
+  if (r == -1) {
+    fs_error (fs, "mount: %s", err);
+    goto out;
+  }
+
+  if (state->zero)
+    zero_mounted_fs (state, fs, mp);
+  else
+    trim_mounted_fs (state, fs, mp, discard);
+
+  free (err);
+  err = NULL;
+  if (command (NULL, &err, str_umount, mp, NULL) == -1)
+    fs_error (fs, "umount: %s", err);
+
+ out:
+  rmdir (mp);
+}
+
+static void *
+trim_worker (void *statev)
+{
+  struct trim_state *state = statev;
+  size_t i;
+
+  for (;;) {
+    pthread_mutex_lock (&state->lock);
+    if (state->cancelled || state->next >= state->nr_fses) {
+      state->running--;
+      pthread_cond_broadcast (&state->cond);
+      pthread_mutex_unlock (&state->lock);
+      return NULL;
+    }
+    i = state->next++;
+    pthread_mutex_unlock (&state->lock);
+
+    trim_one (state, &state->fses[i]);
+  }
+}
+
+char **
+do_trim_filesystems (char *const *mountables, int zero)
+{
+  struct trim_state state = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .cond = PTHREAD_COND_INITIALIZER,
+  };
+  DECLARE_STRINGSBUF (ret);
+  pthread_t threads[MAX_TRIM_THREADS];
+  size_t i, nr_threads, nr_started = 0;
+  sigset_t mask, oldmask;
+  int err;
+
+  state.nr_fses = count_strings (mountables);
+  state.zero = (optargs_bitmask & GUESTFS_TRIM_FILESYSTEMS_ZERO_BITMASK)
+    && zero;
+
+  if (state.nr_fses == 0)
+    return empty_list ();
+
+  state.fses = calloc (state.nr_fses, sizeof (struct trim_fs));
+  if (state.fses == NULL) {
+    reply_with_perror ("calloc");
+    return NULL;
+  }
+  for (i = 0; i < state.nr_fses; ++i)
+    state.fses[i].mountable = mountables[i];
+
+  /* Suggested by Paolo Bonzini to fix fstrim problem.
+   * https://lists.gnu.org/archive/html/qemu-devel/2014-03/msg02978.html
+   */
+  if (!state.zero)
+    sync_disks ();
+
+  nr_threads = MIN (state.nr_fses, MAX_TRIM_THREADS);
+
+  /* The worker threads must not receive signals meant for the main
+   * thread, such as the SIGALRM used by pulse mode.
+   */
+  sigfillset (&mask);
+  pthread_sigmask (SIG_SETMASK, &mask, &oldmask);
+  pthread_mutex_lock (&state.lock);
+  for (i = 0; i < nr_threads; ++i) {
+    err = pthread_create (&threads[nr_started], NULL, trim_worker, &state);
+    if (err != 0) {
+      fprintf (stderr, "trim_filesystems: pthread_create: %s\n",
+               strerror (err));
+      break;
+    }
+    nr_started++;
+  }
+  state.running = nr_started;
+  pthread_mutex_unlock (&state.lock);
+  pthread_sigmask (SIG_SETMASK, &oldmask, NULL);
+
+  if (nr_started == 0) {
+    reply_with_error ("could not start any threads");
+    free (state.fses);
+    return NULL;
+  }
+
+  /* The main thread sends progress messages for all the filesystems
+   * together, and watches for cancellation by the library.
+   */
+  pthread_mutex_lock (&state.lock);
+  while (state.running > 0) {
+    struct timespec ts;
+    uint64_t done = 0, total = 0;
+    int cancel;
+
+    clock_gettime (CLOCK_REALTIME, &ts);
+    ts.tv_nsec += 200000000;
+    if (ts.tv_nsec >= 1000000000) {
+      ts.tv_sec++;
+      ts.tv_nsec -= 1000000000;
+    }
+    pthread_cond_timedwait (&state.cond, &state.lock, &ts);
+
+    for (i = 0; i < state.nr_fses; ++i) {
+      done += state.fses[i].done;
+      total += state.fses[i].total;
+    }
+    pthread_mutex_unlock (&state.lock);
+
+    if (total > 0 && done < total)
+      notify_progress (done, total);
+    cancel = is_cancelled ();
+
+    pthread_mutex_lock (&state.lock);
+    if (cancel)
+      state.cancelled = 1;
+  }
+  pthread_mutex_unlock (&state.lock);
+
+  for (i = 0; i < nr_started; ++i)
+    pthread_join (threads[i], NULL);
+  pthread_mutex_destroy (&state.lock);
+  pthread_cond_destroy (&state.cond);
+
+  if (state.cancelled) {
+    reply_with_error_errno (EINTR, "operation cancelled by user");
+    goto error;
+  }
+
+  /* Filesystems which could not be trimmed or zeroed are not an
+   * error for the whole call (often they are not mountable), but
+   * the reason is returned to the caller.
+   */
+  for (i = 0; i < state.nr_fses; ++i) {
+    if (add_string (&ret, state.fses[i].mountable) == -1 ||
+        add_string (&ret, state.fses[i].error ? state.fses[i].error : "")
+        == -1)
+      goto error;
+  }
+  if (end_stringsbuf (&ret) == -1)
+    goto error;
+
+  for (i = 0; i < state.nr_fses; ++i)
+    free (state.fses[i].error);
+  free (state.fses);
+  return take_stringsbuf (&ret);
+
+ error:
+  for (i = 0; i < state.nr_fses; ++i)
+    free (state.fses[i].error);
+  free (state.fses);
+  return NULL;
+}
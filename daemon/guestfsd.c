@@ -1235,6 +1235,21 @@ udev_settle (void)
     fprintf (stderr, "warning: udevadm command failed\n");
 }
 
+/**
+ * Drop the daemon's cached information about block devices (the LVM
+ * snapshot in F<daemon/lvm.c> and the probe results in
+ * F<daemon/blkid.c>).
+ *
+ * This must be called by anything which might change partitions,
+ * filesystem signatures, labels or UUIDs, or LVM metadata.
+ */
+void
+invalidate_device_caches (void)
+{
+  lvm_cache_invalidate ();
+  blkid_cache_invalidate ();
+}
+
 char *
 get_random_uuid (void)
 {
@@ -20,9 +20,13 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
 #include <string.h>
 #include <limits.h>
+#include <errno.h>
 #include <unistd.h>
+#include <endian.h>
 #include <fcntl.h>
 #include <sys/stat.h>
 
@@ -413,6 +417,706 @@ do_hivex_node_set_value (int64_t nodeh,
   return 0;
 }
 
+/* Find the node 'path' below 'node'.  'path' is a list of key names
+ * separated by backslashes (which cannot appear in key names).  An
+ * empty path refers to 'node' itself.  If 'create' is true, missing
+ * keys are created.  On error this returns 0 and sets errno (to
+ * ENOENT if a key was not found).
+ */
+static hive_node_h
+lookup_path (hive_node_h node, const char *path, int create)
+{
+  CLEANUP_FREE char *copy = strdup (path);
+  char *p, *name, *saveptr = NULL;
+  hive_node_h child;
+
+  if (copy == NULL)
+    return 0;
+
+  for (p = copy; (name = strtok_r (p, "\\", &saveptr)) != NULL; p = NULL) {
+    errno = 0;
+    child = hivex_node_get_child (h, node, name);
+    if (child == 0) {
+      if (errno != 0)
+        return 0;
+      if (!create) {
+        errno = ENOENT;
+        return 0;
+      }
+      child = hivex_node_add_child (h, node, name);
+      if (child == 0)
+        return 0;
+    }
+    node = child;
+  }
+
+  return node;
+}
+
+static int
+send_string (struct send_buffer *sb, const char *str)
+{
+  return send_buffer_write (sb, str, strlen (str) + 1);
+}
+
+static int
+send_number (struct send_buffer *sb, uint64_t n)
+{
+  char str[32];
+
+  snprintf (str, sizeof str, "%" PRIu64, n);
+  return send_string (sb, str);
+}
+
+struct hivex_dump_data {
+  int maxdepth;                 /* -1 = unlimited */
+  char *const *keys;            /* NULL = all values */
+  struct send_buffer sb;
+  int send_error;
+};
+
+static int
+hivex_dump_key_wanted (const struct hivex_dump_data *data, const char *key)
+{
+  size_t i;
+
+  if (data->keys == NULL)
+    return 1;
+
+  /* Value names are case insensitive, like key names. */
+  for (i = 0; data->keys[i] != NULL; ++i)
+    if (STRCASEEQ (data->keys[i], key))
+      return 1;
+  return 0;
+}
+
+/* Send the record for 'node', then recurse into its children.
+ * Returns -1 on error.  If the error was while sending, then
+ * data->send_error is set and the transfer must not be cancelled.
+ */
+static int
+hivex_dump_node (struct hivex_dump_data *data, hive_node_h node,
+                 const char *path, int depth)
+{
+  CLEANUP_FREE hive_value_h *values = NULL;
+  CLEANUP_FREE hive_node_h *children = NULL;
+  CLEANUP_FREE char **keys = NULL;
+  size_t i, j, nr_values;
+
+  values = hivex_node_values (h, node);
+  if (values == NULL)
+    return -1;
+
+  for (nr_values = 0; values[nr_values] != 0; ++nr_values)
+    ;
+  keys = calloc (nr_values + 1, sizeof (char *));
+  if (keys == NULL)
+    return -1;
+
+  /* Filter the values first, because the count comes before them. */
+  for (i = j = 0; i < nr_values; ++i) {
+    char *key = hivex_value_key (h, values[i]);
+    if (key == NULL)
+      goto error;
+    if (hivex_dump_key_wanted (data, key)) {
+      values[j] = values[i];
+      keys[j++] = key;
+    }
+    else
+      free (key);
+  }
+  nr_values = j;
+
+  if (send_string (&data->sb, path) == -1 ||
+      send_number (&data->sb, node) == -1 ||
+      send_number (&data->sb, nr_values) == -1)
+    goto send_error;
+
+  for (i = 0; i < nr_values; ++i) {
+    CLEANUP_FREE char *value = NULL;
+    hive_type t;
+    size_t len;
+
+    value = hivex_value_value (h, values[i], &t, &len);
+    if (value == NULL)
+      goto error;
+
+    if (send_string (&data->sb, keys[i]) == -1 ||
+        send_number (&data->sb, t) == -1 ||
+        send_number (&data->sb, len) == -1 ||
+        send_buffer_write (&data->sb, value, len) == -1)
+      goto send_error;
+  }
+
+  for (i = 0; i < nr_values; ++i)
+    free (keys[i]);
+
+  if (data->maxdepth >= 0 && depth >= data->maxdepth)
+    return 0;
+
+  children = hivex_node_children (h, node);
+  if (children == NULL)
+    return -1;
+
+  for (i = 0; children[i] != 0; ++i) {
+    CLEANUP_FREE char *name = NULL, *childpath = NULL;
+
+    name = hivex_node_name (h, children[i]);
+    if (name == NULL)
+      return -1;
+    if (asprintf (&childpath, "%s%s%s",
+                  path, path[0] ? "\\" : "", name) == -1)
+      return -1;
+    if (hivex_dump_node (data, children[i], childpath, depth+1) == -1)
+      return -1;
+  }
+
+  return 0;
+
+ send_error:
+  data->send_error = 1;
+ error:
+  for (i = 0; i < nr_values; ++i)
+    free (keys[i]);
+  return -1;
+}
+
+/* Takes optional arguments, consult optargs_bitmask.
+ * Has one FileOut parameter.
+ */
+int
+do_hivex_dump (int64_t nodeh, const char *path, int maxdepth,
+               char *const *keys)
+{
+  struct hivex_dump_data data = {
+    .maxdepth = -1, .keys = NULL,
+    .sb = { .buf = NULL, .len = 0 },
+  };
+  hive_node_h node;
+  int r;
+
+  NEED_HANDLE (-1);
+
+  if (optargs_bitmask & GUESTFS_HIVEX_DUMP_MAXDEPTH_BITMASK) {
+    if (maxdepth < 0) {
+      reply_with_error ("maxdepth cannot be negative");
+      return -1;
+    }
+    data.maxdepth = maxdepth;
+  }
+  if (optargs_bitmask & GUESTFS_HIVEX_DUMP_KEYS_BITMASK)
+    data.keys = keys;
+  if (!(optargs_bitmask & GUESTFS_HIVEX_DUMP_PATH_BITMASK))
+    path = "";
+
+  if (nodeh == 0) {
+    nodeh = hivex_root (h);
+    if (nodeh == 0) {
+      reply_with_perror ("hivex_root");
+      return -1;
+    }
+  }
+
+  node = lookup_path (nodeh, path, 0);
+  if (node == 0) {
+    if (errno == ENOENT)
+      reply_with_error_errno (ENOENT, "%s: key not found", path);
+    else
+      reply_with_perror ("%s", path);
+    return -1;
+  }
+
+  /* Now we must send the reply message, before the file contents.  After
+   * this there is no opportunity in the protocol to send any error
+   * message back.  Instead we can only cancel the transfer.
+   */
+  reply (NULL, NULL);
+
+  r = hivex_dump_node (&data, node, "", 0);
+  if (r == 0)
+    r = send_buffer_flush (&data.sb);
+  else if (!data.send_error)
+    fprintf (stderr, "hivex_dump: %s: %m\n", path);
+  free_send_buffer (&data.sb);
+
+  if (r < 0) {
+    if (!data.send_error)
+      send_file_end (1);        /* Cancel. */
+    return -1;
+  }
+
+  if (send_file_end (0))        /* Normal end of file. */
+    return -1;
+
+  return 0;
+}
+
+/* The edits passed to hivex_apply are collected in memory before
+ * any of them is applied, so that if the upload is cancelled or
+ * fails no edits are made.  Registry edits are small, but put a
+ * limit on it anyway.
+ */
+#define HIVEX_APPLY_MAX (64 * 1024 * 1024)
+
+struct hivex_apply_buffer {
+  char *data;
+  size_t len, alloc;
+};
+
+static int
+hivex_apply_cb (void *opaque, const void *buf, size_t len)
+{
+  struct hivex_apply_buffer *b = opaque;
+
+  if (b->len + len > HIVEX_APPLY_MAX) {
+    errno = EFBIG;
+    return -1;
+  }
+  if (b->len + len > b->alloc) {
+    size_t alloc = b->alloc ? b->alloc * 2 : 65536;
+    char *data;
+
+    while (alloc < b->len + len)
+      alloc *= 2;
+    data = realloc (b->data, alloc);
+    if (data == NULL)
+      return -1;
+    b->data = data;
+    b->alloc = alloc;
+  }
+  memcpy (b->data + b->len, buf, len);
+  b->len += len;
+  return 0;
+}
+
+/* Return the next '\0'-terminated field, or NULL if the data ends
+ * without a terminator.
+ */
+static const char *
+next_field (const struct hivex_apply_buffer *b, size_t *pos)
+{
+  const char *field = b->data + *pos;
+  const char *end = memchr (field, '\0', b->len - *pos);
+
+  if (end == NULL)
+    return NULL;
+  *pos = end - b->data + 1;
+  return field;
+}
+
+static int
+parse_number (const char *str, uint64_t *r)
+{
+  int n;
+
+  if (sscanf (str, "%" SCNu64 "%n", r, &n) != 1 || str[n] != '\0')
+    return -1;
+  return 0;
+}
+
+/* Apply the edits in 'b'.  On error this calls reply_with_*. */
+static int
+hivex_apply_edits (hive_node_h nodeh, const struct hivex_apply_buffer *b)
+{
+  size_t pos = 0, nr = 0;
+
+  while (pos < b->len) {
+    const char *op, *path;
+    hive_node_h node;
+
+    nr++;
+    op = next_field (b, &pos);
+    path = op ? next_field (b, &pos) : NULL;
+    if (path == NULL)
+      goto truncated;
+
+    if (STREQ (op, "add") || STREQ (op, "set")) {
+      node = lookup_path (nodeh, path, 1);
+      if (node == 0) {
+        reply_with_perror ("edit %zu: %s", nr, path);
+        return -1;
+      }
+
+      if (STREQ (op, "set")) {
+        const char *key, *type, *len;
+        uint64_t t, size;
+        hive_set_value v;
+
+        key = next_field (b, &pos);
+        type = key ? next_field (b, &pos) : NULL;
+        len = type ? next_field (b, &pos) : NULL;
+        if (len == NULL)
+          goto truncated;
+        if (parse_number (type, &t) == -1 || parse_number (len, &size) == -1) {
+          reply_with_error ("edit %zu: %s: invalid type or length", nr, path);
+          return -1;
+        }
+        if (size > b->len - pos)
+          goto truncated;
+
+        v.key = (char *) key;
+        v.t = t;
+        v.len = size;
+        v.value = b->data + pos;
+        pos += size;
+
+        if (hivex_node_set_value (h, node, &v, 0) == -1) {
+          reply_with_perror ("edit %zu: %s: %s", nr, path, key);
+          return -1;
+        }
+      }
+    }
+    else if (STREQ (op, "delete")) {
+      node = lookup_path (nodeh, path, 0);
+      if (node == 0) {
+        if (errno == ENOENT)
+          reply_with_error_errno (ENOENT, "edit %zu: %s: key not found",
+                                  nr, path);
+        else
+          reply_with_perror ("edit %zu: %s", nr, path);
+        return -1;
+      }
+      if (hivex_node_delete_child (h, node) == -1) {
+        reply_with_perror ("edit %zu: %s", nr, path);
+        return -1;
+      }
+    }
+    else {
+      reply_with_error ("edit %zu: unknown operation '%s'", nr, op);
+      return -1;
+    }
+  }
+
+  return 0;
+
+ truncated:
+  reply_with_error ("edit %zu: truncated record", nr);
+  return -1;
+}
+
+/* Has one FileIn parameter. */
+int
+do_hivex_apply (int64_t nodeh)
+{
+  struct hivex_apply_buffer b = { .data = NULL, .len = 0, .alloc = 0 };
+  int err, r;
+
+  if (!h) {
+    cancel_receive ();
+    reply_with_error ("%s: you must call 'hivex-open' first to initialize the hivex handle", __func__);
+    return -1;
+  }
+
+  r = receive_file (hivex_apply_cb, &b);
+  if (r == -1) {		/* write error */
+    err = errno;
+    cancel_receive ();
+    errno = err;
+    reply_with_perror ("receive edits");
+    free (b.data);
+    return -1;
+  }
+  if (r == -2) {		/* cancellation from library */
+    /* This error is ignored by the library since it initiated the
+     * cancel.  Nevertheless we must send an error reply here.
+     */
+    reply_with_error ("file upload cancelled");
+    free (b.data);
+    return -1;
+  }
+
+  if (nodeh == 0) {
+    nodeh = hivex_root (h);
+    if (nodeh == 0) {
+      reply_with_perror ("hivex_root");
+      free (b.data);
+      return -1;
+    }
+  }
+
+  r = hivex_apply_edits (nodeh, &b);
+  free (b.data);
+  return r;
+}
+
+/* State of an internal_hivex_query call.  This uses its own hive
+ * handle, not 'h'.
+ */
+struct hivex_query {
+  hive_h *h;
+  char *const *names;           /* names wanted, NULL = all values */
+  guestfs_int_internal_hivex_value_list *ret;
+  size_t alloc;
+  size_t size;                  /* approximate size of the reply */
+};
+
+static int
+hivex_query_name_wanted (const struct hivex_query *q, const char *key)
+{
+  size_t i;
+
+  if (q->names == NULL)
+    return 1;
+  for (i = 0; q->names[i] != NULL; ++i)
+    if (STRCASEEQ (q->names[i], key))
+      return 1;
+  return 0;
+}
+
+/* Add the wanted values of 'node' to the result.  On error this
+ * calls reply_with_*.
+ */
+static int
+hivex_query_values (struct hivex_query *q, hive_node_h node, const char *path)
+{
+  CLEANUP_FREE hive_value_h *values = NULL;
+  size_t i;
+
+  values = hivex_node_values (q->h, node);
+  if (values == NULL) {
+    reply_with_perror ("hivex_node_values: %s", path);
+    return -1;
+  }
+
+  for (i = 0; values[i] != 0; ++i) {
+    CLEANUP_FREE char *key = NULL;
+    guestfs_int_internal_hivex_value *v;
+    hive_type t;
+    size_t len;
+    char *value;
+
+    key = hivex_value_key (q->h, values[i]);
+    if (key == NULL) {
+      reply_with_perror ("hivex_value_key: %s", path);
+      return -1;
+    }
+    if (!hivex_query_name_wanted (q, key))
+      continue;
+
+    value = hivex_value_value (q->h, values[i], &t, &len);
+    if (value == NULL) {
+      reply_with_perror ("hivex_value_value: %s: %s", path, key);
+      return -1;
+    }
+
+    /* The reply must fit in a single message. */
+    q->size += strlen (path) + strlen (key) + len + 32;
+    if (q->size > GUESTFS_MESSAGE_MAX - 4096) {
+      free (value);
+      reply_with_error_errno (E2BIG, "too much data to return");
+      return -1;
+    }
+
+    if (q->ret->guestfs_int_internal_hivex_value_list_len >= q->alloc) {
+      size_t alloc = q->alloc ? q->alloc * 2 : 16;
+      guestfs_int_internal_hivex_value *p;
+
+      p = realloc (q->ret->guestfs_int_internal_hivex_value_list_val,
+                   alloc * sizeof (guestfs_int_internal_hivex_value));
+      if (p == NULL) {
+        free (value);
+        reply_with_perror ("realloc");
+        return -1;
+      }
+      q->ret->guestfs_int_internal_hivex_value_list_val = p;
+      q->alloc = alloc;
+    }
+
+    v = &q->ret->guestfs_int_internal_hivex_value_list_val[q->ret->guestfs_int_internal_hivex_value_list_len];
+    memset (v, 0, sizeof *v);
+    q->ret->guestfs_int_internal_hivex_value_list_len++;
+    v->hv_type = t;
+    v->hv_value.hv_value_val = value;
+    v->hv_value.hv_value_len = len;
+    v->hv_path = strdup (path);
+    v->hv_key = key;
+    key = NULL;
+    if (v->hv_path == NULL) {
+      reply_with_perror ("strdup");
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+/* Find the control set which Windows would call CurrentControlSet.
+ * Returns 0 if there isn't one.
+ *
+ * Select\Current is not always stored as a REG_DWORD, so like the
+ * library we accept any 4 byte value here.
+ */
+static hive_node_h
+hivex_query_current_control_set (hive_h *hq, hive_node_h root)
+{
+  hive_node_h node;
+  hive_value_h value;
+  CLEANUP_FREE char *buf = NULL;
+  hive_type t;
+  size_t len;
+  char name[32];
+  uint32_t current;
+
+  node = hivex_node_get_child (hq, root, "Select");
+  if (node == 0)
+    return 0;
+  value = hivex_node_get_value (hq, node, "Current");
+  if (value == 0)
+    return 0;
+  buf = hivex_value_value (hq, value, &t, &len);
+  if (buf == NULL || len != 4)
+    return 0;
+  memcpy (&current, buf, 4);
+  current = le32toh (current);
+
+  snprintf (name, sizeof name, "ControlSet%03" PRIu32, current);
+  return hivex_node_get_child (hq, root, name);
+}
+
+/* Visit the keys matching the remaining 'query' below 'node', whose
+ * real path is 'path'.  On error this calls reply_with_*.
+ */
+static int
+hivex_query_node (struct hivex_query *q, hive_node_h node,
+                  const char *path, const char *query)
+{
+  CLEANUP_FREE hive_node_h *children = NULL;
+  CLEANUP_FREE char *elem = NULL;
+  size_t i, n;
+
+  while (*query == '\\')
+    query++;
+  if (*query == '\0')
+    return hivex_query_values (q, node, path);
+
+  n = strcspn (query, "\\");
+  elem = strndup (query, n);
+  if (elem == NULL) {
+    reply_with_perror ("strndup");
+    return -1;
+  }
+  query += n;
+
+  if (STREQ (elem, "*")) {
+    children = hivex_node_children (q->h, node);
+    if (children == NULL) {
+      reply_with_perror ("hivex_node_children: %s", path);
+      return -1;
+    }
+  }
+  else {
+    children = calloc (2, sizeof (hive_node_h));
+    if (children == NULL) {
+      reply_with_perror ("calloc");
+      return -1;
+    }
+    errno = 0;
+    children[0] = hivex_node_get_child (q->h, node, elem);
+    if (children[0] == 0 && errno != 0) {
+      reply_with_perror ("hivex_node_get_child: %s: %s", path, elem);
+      return -1;
+    }
+    if (children[0] == 0 && path[0] == '\0' &&
+        STRCASEEQ (elem, "CurrentControlSet"))
+      children[0] = hivex_query_current_control_set (q->h, node);
+  }
+
+  for (i = 0; children[i] != 0; ++i) {
+    CLEANUP_FREE char *name = NULL, *childpath = NULL;
+
+    name = hivex_node_name (q->h, children[i]);
+    if (name == NULL) {
+      reply_with_perror ("hivex_node_name: %s", path);
+      return -1;
+    }
+    if (asprintf (&childpath, "%s%s%s",
+                  path, path[0] ? "\\" : "", name) == -1) {
+      reply_with_perror ("asprintf");
+      return -1;
+    }
+    if (hivex_query_node (q, children[i], childpath, query) == -1)
+      return -1;
+  }
+
+  return 0;
+}
+
+guestfs_int_internal_hivex_value_list *
+do_internal_hivex_query (const char *hivefile, char *const *queries)
+{
+  CLEANUP_FREE char *buf = NULL;
+  struct hivex_query q = { .h = NULL };
+  size_t i, j, k, n;
+  int r = -1;
+
+  n = count_strings (queries);
+  if (n % 2 != 0) {
+    reply_with_error ("queries must be a list of pairs of strings");
+    return NULL;
+  }
+
+  buf = sysroot_path (hivefile);
+  if (!buf) {
+    reply_with_perror ("malloc");
+    return NULL;
+  }
+
+  q.ret = calloc (1, sizeof *q.ret);
+  if (q.ret == NULL) {
+    reply_with_perror ("calloc");
+    return NULL;
+  }
+
+  q.h = hivex_open (buf, verbose ? HIVEX_OPEN_VERBOSE : 0);
+  if (q.h == NULL) {
+    reply_with_perror ("hivex failed to open %s", hivefile);
+    goto out;
+  }
+
+  for (i = 0; i < n; i += 2) {
+    CLEANUP_FREE char **names = NULL;
+    int all = 0;
+
+    /* Skip paths already done by an earlier pair. */
+    for (j = 0; j < i; j += 2)
+      if (STREQ (queries[j], queries[i]))
+        break;
+    if (j < i)
+      continue;
+
+    /* Collect the value names wanted for this path. */
+    names = calloc (n/2 + 1, sizeof (char *));
+    if (names == NULL) {
+      reply_with_perror ("calloc");
+      goto out;
+    }
+    for (j = i, k = 0; j < n; j += 2) {
+      if (STREQ (queries[j], queries[i])) {
+        if (queries[j+1][0] == '\0')
+          all = 1;
+        names[k++] = queries[j+1];
+      }
+    }
+    q.names = all ? NULL : names;
+
+    if (hivex_query_node (&q, hivex_root (q.h), "", queries[i]) == -1)
+      goto out;
+  }
+
+  r = 0;
+
+ out:
+  if (q.h)
+    hivex_close (q.h);
+  if (r == -1) {
+    xdr_free ((xdrproc_t) xdr_guestfs_int_internal_hivex_value_list,
+              (char *) q.ret);
+    free (q.ret);
+    return NULL;
+  }
+  return q.ret;
+}
+
 #else /* !HAVE_HIVEX */
 
 OPTGROUP_HIVEX_NOT_AVAILABLE
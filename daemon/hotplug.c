@@ -52,6 +52,8 @@ do_internal_hot_add_drive (const char *label)
   time_t start_t, now_t;
   int r;
 
+  invalidate_device_caches ();
+
   if (asprintf (&path, "/dev/disk/guestfs/%s", label) == -1) {
     reply_with_perror ("asprintf");
     return -1;
@@ -132,6 +134,8 @@ do_internal_hot_remove_drive (const char *label)
   time_t start_t, now_t;
   int r;
 
+  invalidate_device_caches ();
+
   if (asprintf (&path, "/dev/disk/guestfs/%s", label) == -1) {
     reply_with_perror ("asprintf");
     return -1;
@@ -21,197 +21,351 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <limits.h>
-#include <unistd.h>
-#include <fcntl.h>
+#include <errno.h>
 #include <sys/stat.h>
-#include <sys/wait.h>
 
 #include "guestfs_protocol.h"
 #include "daemon.h"
 #include "actions.h"
 
-GUESTFSD_EXT_CMD(str_zcat, zcat);
-GUESTFSD_EXT_CMD(str_cpio, cpio);
+/* Names in the archive may be stored with a leading "./" or "/". */
+static const char *
+skip_prefix (const char *name)
+{
+  for (;;) {
+    if (name[0] == '.' && name[1] == '/')
+      name += 2;
+    else if (name[0] == '/')
+      name++;
+    else
+      return name;
+  }
+}
 
-char **
-do_initrd_list (const char *path)
+static int
+is_wanted (char *const *names, const char *name)
 {
-  FILE *fp;
-  CLEANUP_FREE char *cmd = NULL;
-  DECLARE_STRINGSBUF (filenames);
-  CLEANUP_FREE char *filename = NULL;
-  size_t allocsize;
-  ssize_t len;
-  int ret;
-
-  /* "zcat /sysroot/<path> | cpio --quiet -it", but path must be quoted. */
-  if (asprintf_nowarn (&cmd, "%s %R | %s --quiet -it", str_zcat, path, str_cpio) == -1) {
-    reply_with_perror ("asprintf");
-    return NULL;
+  size_t i;
+
+  name = skip_prefix (name);
+  for (i = 0; names[i] != NULL; ++i)
+    if (STREQ (skip_prefix (names[i]), name))
+      return 1;
+  return 0;
+}
+
+/* Find the first regular file in the archive called one of 'names'.
+ * Returns 1 if found, leaving the reader positioned at the start of
+ * the file data, 0 if not found, or -1 on error.
+ */
+static int
+find_file (struct cpio *c, char *const *names, struct cpio_entry *entry)
+{
+  int r, pending = 0;
+  uint64_t ino = 0;
+  uint32_t devmajor = 0, devminor = 0;
+
+  while ((r = cpio_next (c, entry)) == 1) {
+    if (!S_ISREG (entry->mode))
+      continue;
+
+    /* In newc archives the data of a hard-linked file is stored
+     * with the last link, and earlier links have size 0.
+     */
+    if (pending && entry->size > 0 && entry->ino == ino &&
+        entry->devmajor == devmajor && entry->devminor == devminor)
+      return 1;
+
+    if (pending || !is_wanted (names, entry->name))
+      continue;
+
+    if (entry->size == 0 && entry->nlink > 1) {
+      pending = 1;
+      ino = entry->ino;
+      devmajor = entry->devmajor;
+      devminor = entry->devminor;
+      continue;
+    }
+    return 1;
   }
 
-  if (verbose)
-    fprintf (stderr, "%s\n", cmd);
+  if (r == 0 && pending) {
+    /* The file really is empty. */
+    entry->size = 0;
+    return 1;
+  }
+  return r;
+}
 
-  fp = popen (cmd, "r");
-  if (fp == NULL) {
-    reply_with_perror ("popen: %s", cmd);
+/* Read the first file called one of 'names' from the initrd.  If
+ * 'truncate' is set, only the first 'maxsize' bytes are read,
+ * otherwise it is an error if the file is larger than this.
+ */
+static char *
+read_file (const char *path, char *const *names, const char *what,
+           size_t maxsize, int truncate, size_t *size_r)
+{
+  struct cpio *c;
+  struct cpio_entry entry;
+  char *ret = NULL;
+  size_t size, n = 0;
+  ssize_t r;
+
+  c = cpio_open (path);
+  if (c == NULL)
     return NULL;
+
+  switch (find_file (c, names, &entry)) {
+  case -1:
+    goto out;
+  case 0:
+    reply_with_error_errno (ENOENT, "%s:%s: file not found in initrd",
+                            path, what);
+    goto out;
   }
 
-  allocsize = 0;
-  while ((len = getline (&filename, &allocsize, fp)) != -1) {
-    if (len > 0 && filename[len-1] == '\n')
-      filename[len-1] = '\0';
-    if (add_string (&filenames, filename) == -1) {
-      pclose (fp);
-      return NULL;
+  size = entry.size;
+  if (size != entry.size || size > maxsize) {
+    if (!truncate) {
+      reply_with_error ("%s:%s: file is too large for the protocol",
+                        path, what);
+      goto out;
     }
+    size = maxsize;
   }
 
-  if (end_stringsbuf (&filenames) == -1) {
-    pclose (fp);
-    return NULL;
+  /* malloc (0) may return NULL, which would look like an error. */
+  ret = malloc (size > 0 ? size : 1);
+  if (ret == NULL) {
+    reply_with_perror ("malloc");
+    goto out;
   }
 
-  ret = pclose (fp);
-  if (ret != 0) {
-    if (ret == -1)
-      reply_with_perror ("pclose");
-    else {
-      if (WEXITSTATUS (ret) != 0)
-        ret = WEXITSTATUS (ret);
-      reply_with_error ("pclose: command failed with return code %d", ret);
+  while (n < size) {
+    r = cpio_read (c, ret + n, size - n);
+    if (r == -1) {
+      free (ret);
+      ret = NULL;
+      goto out;
     }
-    free_stringslen (filenames.argv, filenames.size);
-    return NULL;
+    n += r;
   }
 
-  return filenames.argv;
+  /* Mustn't touch *size_r until we are sure that we won't return any
+   * error (RHBZ#589039).
+   */
+  *size_r = size;
+
+ out:
+  cpio_close (c);
+  return ret;
 }
 
-char *
-do_initrd_cat (const char *path, const char *filename, size_t *size_r)
+char **
+do_initrd_list (const char *path)
 {
-  char tmpdir[] = "/tmp/initrd-cat-XXXXXX";
-  CLEANUP_FREE char *cmd = NULL;
-  struct stat statbuf;
-  int fd, r;
-  char *ret = NULL;
-  CLEANUP_FREE char *fullpath = NULL;
+  struct cpio *c;
+  struct cpio_entry entry;
+  DECLARE_STRINGSBUF (filenames);
+  int r;
 
-  if (mkdtemp (tmpdir) == NULL) {
-    reply_with_perror ("mkdtemp");
+  c = cpio_open (path);
+  if (c == NULL)
     return NULL;
-  }
 
-  /* Extract file into temporary directory.  This may create subdirs.
-   * It's also possible that this doesn't create anything at all
-   * (eg. if the named file does not exist in the cpio archive) --
-   * cpio is silent in this case.
-   */
-  /* "zcat /sysroot/<path> | cpio --quiet -id file", but paths must be quoted */
-  if (asprintf_nowarn (&cmd, "cd %Q && zcat %R | cpio --quiet -id %Q",
-                       tmpdir, path, filename) == -1) {
-    reply_with_perror ("asprintf");
-    rmdir (tmpdir);
-    return NULL;
+  while ((r = cpio_next (c, &entry)) == 1) {
+    if (add_string (&filenames, entry.name) == -1) {
+      cpio_close (c);
+      return NULL;
+    }
   }
+  cpio_close (c);
 
-  r = system (cmd);
   if (r == -1) {
-    reply_with_perror ("command failed: %s", cmd);
-    rmdir (tmpdir);
+    if (filenames.argv)
+      free_stringslen (filenames.argv, filenames.size);
     return NULL;
   }
-  if (WEXITSTATUS (r) != 0) {
-    reply_with_perror ("command failed with return code %d",
-                       WEXITSTATUS (r));
-    rmdir (tmpdir);
+
+  if (end_stringsbuf (&filenames) == -1)
     return NULL;
+
+  return filenames.argv;
+}
+
+char *
+do_initrd_cat (const char *path, const char *filename, size_t *size_r)
+{
+  char *const names[] = { (char *) filename, NULL };
+
+  /* The actual limit on messages is smaller than this.  This check
+   * just limits the amount of memory we'll try and allocate here.
+   * If the message is larger than the real limit, that will be
+   * caught later when we try to serialize the message.
+   */
+  return read_file (path, names, filename, GUESTFS_MESSAGE_MAX - 1, 0,
+                    size_r);
+}
+
+/* A wanted file seen with size 0 in internal_initrd_head, whose data
+ * may be stored with a later hard link.
+ */
+struct pending_link {
+  char *name;
+  uint64_t ino;
+  uint32_t devmajor, devminor;
+};
+
+/* Write one record of the internal_initrd_head result. */
+static int
+write_head (FILE *fp, const char *name, const char *data, size_t len)
+{
+  if (fprintf (fp, "%s%c%zu%c", skip_prefix (name), 0, len, 0) < 0 ||
+      fwrite (data, 1, len, fp) != len) {
+    reply_with_perror ("write");
+    return -1;
   }
+  return 0;
+}
 
-  /* Construct the expected name of the extracted file. */
-  if (asprintf (&fullpath, "%s/%s", tmpdir, filename) == -1) {
-    reply_with_perror ("asprintf");
-    rmdir (tmpdir);
+char *
+do_internal_initrd_head (const char *path, char *const *filenames,
+                         int size, size_t *size_r)
+{
+  struct cpio *c;
+  struct cpio_entry entry;
+  CLEANUP_FREE char *buf = NULL;
+  CLEANUP_FREE struct pending_link *pending = NULL;
+  char *ret = NULL;
+  size_t ret_size = 0, nr_names, nr_pending = 0, found = 0, i, j, n;
+  FILE *fp = NULL;
+  ssize_t r = 0;
+
+  if (size < 0 || size > GUESTFS_MESSAGE_MAX / 2) {
+    reply_with_error ("size out of range: %d", size);
     return NULL;
   }
 
-  /* See if we got a file. */
-  fd = open (fullpath, O_RDONLY|O_CLOEXEC);
-  if (fd == -1) {
-    reply_with_perror ("open: %s:%s", path, filename);
-    rmdir (tmpdir);
+  nr_names = count_strings (filenames);
+  buf = malloc (size > 0 ? size : 1);
+  pending = calloc (nr_names + 1, sizeof (struct pending_link));
+  if (buf == NULL || pending == NULL) {
+    reply_with_perror ("malloc");
     return NULL;
   }
 
-  /* From this point, we know the file exists, so we require full
-   * cleanup.
-   */
-  if (fstat (fd, &statbuf) == -1) {
-    reply_with_perror ("fstat: %s:%s", path, filename);
-    goto cleanup;
-  }
+  c = cpio_open (path);
+  if (c == NULL)
+    return NULL;
 
-  /* The actual limit on messages is smaller than this.  This
-   * check just limits the amount of memory we'll try and allocate
-   * here.  If the message is larger than the real limit, that will
-   * be caught later when we try to serialize the message.
-   */
-  if (statbuf.st_size >= GUESTFS_MESSAGE_MAX) {
-    reply_with_error ("%s:%s: file is too large for the protocol",
-                      path, filename);
-    goto cleanup;
+  fp = open_memstream (&ret, &ret_size);
+  if (fp == NULL) {
+    reply_with_perror ("open_memstream");
+    goto error;
   }
 
-  ret = malloc (statbuf.st_size);
-  if (ret == NULL) {
-    reply_with_perror ("malloc");
-    goto cleanup;
+  while (found < nr_names && (r = cpio_next (c, &entry)) == 1) {
+    int wanted, links = 0;
+
+    if (!S_ISREG (entry.mode))
+      continue;
+    wanted = is_wanted (filenames, entry.name);
+
+    /* In newc archives the data of a hard-linked file is stored
+     * with the last link, and earlier links have size 0.
+     */
+    if (entry.size > 0) {
+      for (i = 0; i < nr_pending; ++i)
+        if (pending[i].ino == entry.ino &&
+            pending[i].devmajor == entry.devmajor &&
+            pending[i].devminor == entry.devminor)
+          links++;
+    }
+    if (wanted && entry.size == 0 && entry.nlink > 1 &&
+        nr_pending < nr_names) {
+      pending[nr_pending].name = strdup (entry.name);
+      if (pending[nr_pending].name == NULL) {
+        reply_with_perror ("strdup");
+        goto error;
+      }
+      pending[nr_pending].ino = entry.ino;
+      pending[nr_pending].devmajor = entry.devmajor;
+      pending[nr_pending].devminor = entry.devminor;
+      nr_pending++;
+      continue;
+    }
+    if (!wanted && links == 0)
+      continue;
+
+    /* Read the start of the file. */
+    n = 0;
+    while (n < (size_t) size && n < entry.size) {
+      r = cpio_read (c, buf + n, MIN ((size_t) size, entry.size) - n);
+      if (r == -1)
+        goto error;
+      n += r;
+    }
+
+    if (wanted) {
+      if (write_head (fp, entry.name, buf, n) == -1)
+        goto error;
+      found++;
+    }
+    if (links == 0)
+      continue;
+    for (i = 0; i < nr_pending; ++i) {
+      if (pending[i].ino == entry.ino &&
+          pending[i].devmajor == entry.devmajor &&
+          pending[i].devminor == entry.devminor &&
+          write_head (fp, pending[i].name, buf, n) == -1)
+        goto error;
+    }
+    for (i = j = 0; i < nr_pending; ++i) {
+      if (pending[i].ino == entry.ino &&
+          pending[i].devmajor == entry.devmajor &&
+          pending[i].devminor == entry.devminor) {
+        free (pending[i].name);
+        found++;
+      }
+      else
+        pending[j++] = pending[i];
+    }
+    nr_pending = j;
   }
+  if (r == -1)
+    goto error;
 
-  if (xread (fd, ret, statbuf.st_size) == -1) {
-    reply_with_perror ("read: %s:%s", path, filename);
-    free (ret);
-    ret = NULL;
-    goto cleanup;
+  /* Any links still pending really are empty files. */
+  for (i = 0; i < nr_pending; ++i) {
+    if (write_head (fp, pending[i].name, buf, 0) == -1)
+      goto error;
   }
 
-  if (close (fd) == -1) {
-    reply_with_perror ("close: %s:%s", path, filename);
-    free (ret);
-    ret = NULL;
-    goto cleanup;
+  if (fclose (fp) == -1) {
+    fp = NULL;
+    reply_with_perror ("fclose");
+    goto error;
   }
-  fd = -1;
+  fp = NULL;
 
-  /* Mustn't touch *size_r until we are sure that we won't return any
-   * error (RHBZ#589039).
-   */
-  *size_r = statbuf.st_size;
-
- cleanup:
-  if (fd >= 0)
-    close (fd);
-
-  /* Remove the file. */
-  if (unlink (fullpath) == -1) {
-    fprintf (stderr, "unlink: %s: %m\n", fullpath);
-    /* non-fatal */
-  }
-
-  /* Remove the directories up to and including the temp directory. */
-  do {
-    char *p = strrchr (fullpath, '/');
-    if (!p) break;
-    *p = '\0';
-    if (rmdir (fullpath) == -1) {
-      fprintf (stderr, "rmdir: %s: %m\n", fullpath);
-      /* non-fatal */
-    }
-  } while (STRNEQ (fullpath, tmpdir));
+  if (ret_size == 0) {
+    reply_with_error_errno (ENOENT, "%s:(binaries): file not found in initrd",
+                            path);
+    goto error;
+  }
 
+  for (i = 0; i < nr_pending; ++i)
+    free (pending[i].name);
+  cpio_close (c);
+  *size_r = ret_size;
   return ret;
+
+ error:
+  for (i = 0; i < nr_pending; ++i)
+    free (pending[i].name);
+  if (fp)
+    fclose (fp);
+  free (ret);
+  cpio_close (c);
+  return NULL;
 }
@@ -0,0 +1,283 @@
+/* libguestfs - the guestfsd daemon
+ * Copyright (C) 2016 Red Hat Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/* Gather the facts about a mounted filesystem which inspection
+ * needs (see src/inspect-fs.c) in a single call.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <dirent.h>
+#include <limits.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "cloexec.h"
+
+#include "guestfs_protocol.h"
+#include "daemon.h"
+#include "actions.h"
+
+/* Same as the 'ftyp' field of guestfs_readdir. */
+static char
+file_type (mode_t mode)
+{
+  if (S_ISREG (mode)) return 'r';
+  if (S_ISDIR (mode)) return 'd';
+  if (S_ISLNK (mode)) return 'l';
+  if (S_ISCHR (mode)) return 'c';
+  if (S_ISBLK (mode)) return 'b';
+  if (S_ISFIFO (mode)) return 'f';
+  if (S_ISSOCK (mode)) return 's';
+  return 'u';
+}
+
+/* Find 'path' ignoring the case of each element, in the same way
+ * as guestfs_case_sensitive_path: if the final element does not
+ * exist it is returned as given.  Returns NULL where that function
+ * would fail.  Must be called inside the chroot.
+ */
+static char *
+find_nocase (const char *path)
+{
+  char ret[PATH_MAX];
+  size_t next = 0;
+  int fd, fd2;
+
+  fd = open ("/", O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+  if (fd == -1)
+    return NULL;
+
+  while (*path) {
+    size_t i, len;
+    DIR *dir;
+    struct dirent *d;
+    char name[NAME_MAX+1];
+
+    i = strcspn (path, "/");
+    if (i == 0) {
+      path++;
+      continue;
+    }
+    if (i > NAME_MAX)
+      goto notfound;
+    memcpy (name, path, i);
+    name[i] = '\0';
+    path += i;
+
+    fd2 = dup_cloexec (fd);
+    if (fd2 == -1)
+      goto notfound;
+    dir = fdopendir (fd2);
+    if (dir == NULL) {
+      close (fd2);
+      goto notfound;
+    }
+    while ((d = readdir (dir)) != NULL) {
+      if (STRCASEEQ (d->d_name, name))
+        break;
+    }
+    if (d != NULL)
+      strcpy (name, d->d_name);
+    closedir (dir);
+    if (d == NULL && *path)
+      goto notfound;
+
+    len = strlen (name);
+    if (next + len + 2 > sizeof ret)
+      goto notfound;
+    ret[next++] = '/';
+    memcpy (&ret[next], name, len + 1);
+    next += len;
+
+    if (*path) {
+      fd2 = openat (fd, &ret[next-len], O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+      close (fd);
+      fd = fd2;
+      if (fd == -1)
+        return NULL;
+    }
+  }
+
+  close (fd);
+  if (next == 0)
+    return strdup ("/");
+  return strdup (ret);
+
+ notfound:
+  close (fd);
+  return NULL;
+}
+
+/* Read the whole of a small regular file.  Must be called inside
+ * the chroot.
+ */
+static char *
+read_small_file (const char *path, size_t size, size_t *size_r)
+{
+  int fd;
+  char *buf;
+  ssize_t r;
+  size_t n = 0;
+
+  fd = open (path, O_RDONLY|O_CLOEXEC|O_NOCTTY|O_NONBLOCK);
+  if (fd == -1)
+    return NULL;
+
+  /* malloc (0) may return NULL. */
+  buf = malloc (size + 1);
+  if (buf == NULL) {
+    close (fd);
+    return NULL;
+  }
+
+  while (n < size) {
+    r = read (fd, buf + n, size - n);
+    if (r == -1) {
+      if (errno == EINTR)
+        continue;
+      free (buf);
+      close (fd);
+      return NULL;
+    }
+    if (r == 0)                 /* File shrank. */
+      break;
+    n += r;
+  }
+  close (fd);
+
+  *size_r = n;
+  return buf;
+}
+
+static void
+probe_path (const char *path, int maxsize, guestfs_int_internal_probe_fact *f)
+{
+  struct stat statbuf;
+  char link[PATH_MAX];
+  ssize_t r;
+  size_t size;
+
+  f->pf_ltype = '-';
+  f->pf_type = '-';
+  f->pf_size = -1;
+  f->pf_nocase_type = '-';
+
+  f->pf_nocase_path = find_nocase (path);
+  if (f->pf_nocase_path && lstat (f->pf_nocase_path, &statbuf) == 0)
+    f->pf_nocase_type = file_type (statbuf.st_mode);
+
+  if (lstat (path, &statbuf) == 0) {
+    f->pf_ltype = file_type (statbuf.st_mode);
+    if (S_ISLNK (statbuf.st_mode)) {
+      r = readlink (path, link, sizeof link - 1);
+      if (r >= 0) {
+        link[r] = '\0';
+        f->pf_link = strdup (link);
+      }
+      if (stat (path, &statbuf) == 0) {
+        f->pf_type = file_type (statbuf.st_mode);
+        f->pf_size = statbuf.st_size;
+      }
+    }
+    else {
+      f->pf_type = f->pf_ltype;
+      f->pf_size = statbuf.st_size;
+    }
+  }
+
+  if (f->pf_type == 'r' && f->pf_size <= maxsize) {
+    f->pf_content.pf_content_val =
+      read_small_file (path, f->pf_size, &size);
+    if (f->pf_content.pf_content_val)
+      f->pf_content.pf_content_len = size;
+  }
+}
+
+guestfs_int_internal_probe_fact_list *
+do_internal_inspect_probe (char *const *paths, int maxsize)
+{
+  guestfs_int_internal_probe_fact_list *ret;
+  size_t i, n;
+
+  if (maxsize < 0 || maxsize > GUESTFS_MESSAGE_MAX / 64) {
+    reply_with_error ("maxsize out of range: %d", maxsize);
+    return NULL;
+  }
+
+  n = count_strings (paths);
+  for (i = 0; i < n; ++i) {
+    if (paths[i][0] != '/') {
+      reply_with_error ("%s: path must start with a / character", paths[i]);
+      return NULL;
+    }
+  }
+
+  ret = calloc (1, sizeof *ret);
+  if (ret == NULL) {
+    reply_with_perror ("calloc");
+    return NULL;
+  }
+  ret->guestfs_int_internal_probe_fact_list_val =
+    calloc (n, sizeof (guestfs_int_internal_probe_fact));
+  if (n > 0 && ret->guestfs_int_internal_probe_fact_list_val == NULL) {
+    reply_with_perror ("calloc");
+    free (ret);
+    return NULL;
+  }
+  ret->guestfs_int_internal_probe_fact_list_len = n;
+
+  /* Symbolic links are followed inside the guest filesystem. */
+  CHROOT_IN;
+  for (i = 0; i < n; ++i) {
+    guestfs_int_internal_probe_fact *f =
+      &ret->guestfs_int_internal_probe_fact_list_val[i];
+
+    f->pf_path = strdup (paths[i]);
+    probe_path (paths[i], maxsize, f);
+  }
+  CHROOT_OUT;
+
+  /* XDR cannot send NULL strings. */
+  for (i = 0; i < n; ++i) {
+    guestfs_int_internal_probe_fact *f =
+      &ret->guestfs_int_internal_probe_fact_list_val[i];
+
+    if (f->pf_path == NULL)
+      f->pf_path = strdup (paths[i]);
+    if (f->pf_link == NULL)
+      f->pf_link = strdup ("");
+    if (f->pf_nocase_path == NULL)
+      f->pf_nocase_path = strdup ("");
+    if (f->pf_path == NULL || f->pf_link == NULL || f->pf_nocase_path == NULL) {
+      reply_with_perror ("strdup");
+      xdr_free ((xdrproc_t) xdr_guestfs_int_internal_probe_fact_list,
+                (char *) ret);
+      free (ret);
+      return NULL;
+    }
+  }
+
+  return ret;
+}
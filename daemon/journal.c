@@ -236,6 +236,264 @@ do_journal_get_realtime_usec (void)
   return (int64_t) usec;
 }
 
+/* Send one field in the journal export format.  Fields containing
+ * control characters (eg. newlines) are sent in the binary form,
+ * which is the field name, a newline, the little-endian 64 bit
+ * length, then the data.
+ */
+static int
+export_field (struct send_buffer *sb, const char *data, size_t len)
+{
+  const char *eq = memchr (data, '=', len);
+  size_t i, namelen;
+  uint64_t len_le;
+  int binary = 0;
+
+  if (eq == NULL)               /* Should not happen. */
+    return 0;
+  namelen = eq - data;
+
+  for (i = namelen+1; i < len; ++i) {
+    unsigned char c = data[i];
+    if ((c < ' ' && c != '\t') || c == 127) {
+      binary = 1;
+      break;
+    }
+  }
+
+  if (!binary) {
+    if (send_buffer_write (sb, data, len) < 0 ||
+        send_buffer_write (sb, "\n", 1) < 0)
+      return -1;
+  }
+  else {
+    len_le = htole64 ((uint64_t) (len - namelen - 1));
+    if (send_buffer_write (sb, data, namelen) < 0 ||
+        send_buffer_write (sb, "\n", 1) < 0 ||
+        send_buffer_write (sb, &len_le, sizeof len_le) < 0 ||
+        send_buffer_write (sb, eq+1, len - namelen - 1) < 0 ||
+        send_buffer_write (sb, "\n", 1) < 0)
+      return -1;
+  }
+
+  return 0;
+}
+
+static int
+export_field_wanted (char *const *fields, const char *data, size_t len)
+{
+  size_t i, namelen;
+  const char *eq;
+
+  if (fields == NULL)
+    return 1;
+
+  eq = memchr (data, '=', len);
+  if (eq == NULL)
+    return 0;
+  namelen = eq - data;
+
+  for (i = 0; fields[i] != NULL; ++i)
+    if (strlen (fields[i]) == namelen && STREQLEN (fields[i], data, namelen))
+      return 1;
+  return 0;
+}
+
+/* Send the current entry.  On error this returns -1.  If the error
+ * was while sending then *send_error is set, otherwise errno is set.
+ */
+static int
+export_entry (struct send_buffer *sb, char *const *fields, int *send_error)
+{
+  CLEANUP_FREE char *cursor = NULL;
+  char str[128];
+  char boot_id[33];
+  uint64_t realtime, monotonic;
+  sd_id128_t boot;
+  const void *data;
+  size_t len;
+  int r;
+
+  r = sd_journal_get_cursor (j, &cursor);
+  if (r < 0)
+    goto journal_error;
+  r = sd_journal_get_realtime_usec (j, &realtime);
+  if (r < 0)
+    goto journal_error;
+  r = sd_journal_get_monotonic_usec (j, &monotonic, &boot);
+  if (r < 0)
+    goto journal_error;
+  sd_id128_to_string (boot, boot_id);
+
+  if (send_buffer_write (sb, "__CURSOR=", 9) < 0 ||
+      send_buffer_write (sb, cursor, strlen (cursor)) < 0)
+    goto send_failed;
+  snprintf (str, sizeof str,
+            "\n__REALTIME_TIMESTAMP=%" PRIu64
+            "\n__MONOTONIC_TIMESTAMP=%" PRIu64
+            "\n_BOOT_ID=%s\n",
+            realtime, monotonic, boot_id);
+  if (send_buffer_write (sb, str, strlen (str)) < 0)
+    goto send_failed;
+
+  sd_journal_restart_data (j);
+  while ((r = sd_journal_enumerate_data (j, &data, &len)) > 0) {
+    /* _BOOT_ID was already sent above. */
+    if (len >= 9 && STREQLEN (data, "_BOOT_ID=", 9))
+      continue;
+    if (!export_field_wanted (fields, data, len))
+      continue;
+    if (export_field (sb, data, len) == -1)
+      goto send_failed;
+  }
+  if (r < 0)
+    goto journal_error;
+
+  /* Entries are separated by a blank line. */
+  if (send_buffer_write (sb, "\n", 1) < 0)
+    goto send_failed;
+
+  return 0;
+
+ send_failed:
+  *send_error = 1;
+  return -1;
+
+ journal_error:
+  errno = -r;
+  return -1;
+}
+
+/* Add the match expressions to the journal handle.  "+" separates
+ * groups of matches which are ORed together, as in journalctl(1).
+ */
+static int
+add_matches (char *const *matches)
+{
+  size_t i;
+  int r;
+
+  for (i = 0; matches[i] != NULL; ++i) {
+    if (STREQ (matches[i], "+"))
+      r = sd_journal_add_disjunction (j);
+    else if (strchr (matches[i], '=') == NULL) {
+      reply_with_error ("match '%s' must be \"FIELD=VALUE\" or \"+\"",
+                        matches[i]);
+      return -1;
+    }
+    else
+      r = sd_journal_add_match (j, matches[i], 0);
+    if (r < 0) {
+      reply_with_perror_errno (-r, "sd_journal_add_match: %s", matches[i]);
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+/* Takes optional arguments, consult optargs_bitmask.
+ * Has one FileOut parameter.
+ */
+int
+do_journal_export (const char *cursor, int64_t since,
+                   char *const *fields, char *const *matches,
+                   int64_t maxentries)
+{
+  DECLARE_SEND_BUFFER (sb);
+  char *const *wanted = NULL;
+  int64_t count = 0;
+  int r = 0, send_error = 0;
+
+  NEED_HANDLE (-1);
+
+  if ((optargs_bitmask & GUESTFS_JOURNAL_EXPORT_CURSOR_BITMASK) &&
+      (optargs_bitmask & GUESTFS_JOURNAL_EXPORT_SINCE_BITMASK)) {
+    reply_with_error ("cursor and since cannot be used together");
+    return -1;
+  }
+  if (!(optargs_bitmask & GUESTFS_JOURNAL_EXPORT_MAXENTRIES_BITMASK))
+    maxentries = 0;
+  else if (maxentries < 0) {
+    reply_with_error ("maxentries cannot be negative");
+    return -1;
+  }
+  if (optargs_bitmask & GUESTFS_JOURNAL_EXPORT_FIELDS_BITMASK)
+    wanted = fields;
+
+  sd_journal_flush_matches (j);
+  if (optargs_bitmask & GUESTFS_JOURNAL_EXPORT_MATCHES_BITMASK) {
+    if (add_matches (matches) == -1) {
+      sd_journal_flush_matches (j);
+      return -1;
+    }
+  }
+
+  /* Position the handle so that the next call to sd_journal_next
+   * returns the first entry to export.
+   */
+  if (optargs_bitmask & GUESTFS_JOURNAL_EXPORT_CURSOR_BITMASK) {
+    r = sd_journal_seek_cursor (j, cursor);
+    if (r < 0) {
+      reply_with_perror_errno (-r, "sd_journal_seek_cursor: %s", cursor);
+      sd_journal_flush_matches (j);
+      return -1;
+    }
+    /* Skip the entry at the cursor itself, if it still exists. */
+    r = sd_journal_next (j);
+    if (r > 0 && sd_journal_test_cursor (j, cursor) <= 0)
+      sd_journal_previous (j);
+  }
+  else if (optargs_bitmask & GUESTFS_JOURNAL_EXPORT_SINCE_BITMASK) {
+    r = sd_journal_seek_realtime_usec (j, (uint64_t) since);
+    if (r < 0) {
+      reply_with_perror_errno (-r, "sd_journal_seek_realtime_usec");
+      sd_journal_flush_matches (j);
+      return -1;
+    }
+  }
+
+  /* Now we must send the reply message, before the file contents.  After
+   * this there is no opportunity in the protocol to send any error
+   * message back.  Instead we can only cancel the transfer.
+   */
+  reply (NULL, NULL);
+
+  while (maxentries == 0 || count < maxentries) {
+    r = sd_journal_next (j);
+    if (r < 0) {
+      errno = -r;
+      r = -1;
+      break;
+    }
+    if (r == 0)
+      break;
+    r = export_entry (&sb, wanted, &send_error);
+    if (r == -1)
+      break;
+    count++;
+  }
+  if (r >= 0 && send_buffer_flush (&sb) < 0) {
+    send_error = 1;
+    r = -1;
+  }
+  free_send_buffer (&sb);
+  sd_journal_flush_matches (j);
+
+  if (r == -1) {
+    if (!send_error) {          /* Error reading the journal. */
+      perror ("journal_export");
+      send_file_end (1);        /* Cancel. */
+    }
+    return -1;
+  }
+
+  if (send_file_end (0))        /* Normal end of file. */
+    return -1;
+
+  return 0;
+}
+
 #else /* !HAVE_SD_JOURNAL */
 
 OPTGROUP_JOURNAL_NOT_AVAILABLE
@@ -63,6 +63,8 @@ do_set_label (const mountable_t *mountable, const char *label)
 {
   int r;
 
+  invalidate_device_caches ();
+
   /* How we set the label depends on the filesystem type. */
   CLEANUP_FREE char *vfs_type = do_vfs_type (mountable);
   if (vfs_type == NULL)
@@ -134,18 +134,24 @@ luks_open (const char *device, const char *key, const char *mapname,
 int
 do_luks_open (const char *device, const char *key, const char *mapname)
 {
+  invalidate_device_caches ();
+
   return luks_open (device, key, mapname, 0);
 }
 
 int
 do_luks_open_ro (const char *device, const char *key, const char *mapname)
 {
+  invalidate_device_caches ();
+
   return luks_open (device, key, mapname, 1);
 }
 
 int
 do_luks_close (const char *device)
 {
+  invalidate_device_caches ();
+
   /* Must be /dev/mapper/... */
   if (! STRPREFIX (device, "/dev/mapper/")) {
     reply_with_error ("luks_close: you must call this on the /dev/mapper device created by luks_open");
@@ -209,6 +215,8 @@ luks_format (const char *device, const char *key, int keyslot,
 int
 do_luks_format (const char *device, const char *key, int keyslot)
 {
+  invalidate_device_caches ();
+
   return luks_format (device, key, keyslot, NULL);
 }
 
@@ -216,6 +224,8 @@ int
 do_luks_format_cipher (const char *device, const char *key, int keyslot,
                        const char *cipher)
 {
+  invalidate_device_caches ();
+
   return luks_format (device, key, keyslot, cipher);
 }
 
@@ -27,6 +27,8 @@
 #include <sys/stat.h>
 #include <dirent.h>
 
+#include <yajl/yajl_tree.h>
+
 #include "daemon.h"
 #include "c-ctype.h"
 #include "actions.h"
@@ -44,6 +46,481 @@ optgroup_lvm2_available (void)
  * of writing it hasn't progressed very far.
  */
 
+/* LVM metadata snapshot.
+ *
+ * Inspection and virt-filesystems call pvs, vgs, lvs, the _full
+ * variants and the uuid getters many times, and each call used to
+ * run a separate lvm command which rescans every block device.  If
+ * lvm supports it, we instead run a single
+ * 'lvm fullreport --reportformat json' and answer all those queries
+ * from the parsed result until something invalidates it.
+ *
+ * Anything which might change LVM metadata or the set of PVs must
+ * drop the snapshot by calling invalidate_device_caches (in
+ * guestfsd.c).  That includes all the mutating LVM calls in this
+ * file and in lvm-filter.c, partitioning, LUKS and MD calls, and
+ * calls which write over raw devices.
+ */
+struct lvm_snapshot {
+  yajl_val tree;                /* Parsed JSON, owns the objects below. */
+  yajl_val *pvs;                /* Array of "pv" objects. */
+  size_t nr_pvs;
+  yajl_val *vgs;                /* Array of "vg" objects. */
+  size_t nr_vgs;
+  yajl_val *lvs;                /* Array of "lv" objects. */
+  size_t nr_lvs;
+};
+
+static struct lvm_snapshot *snapshot = NULL;
+
+static void
+free_snapshot (struct lvm_snapshot *snap)
+{
+  if (snap) {
+    yajl_tree_free (snap->tree);
+    free (snap->pvs);
+    free (snap->vgs);
+    free (snap->lvs);
+    free (snap);
+  }
+}
+
+void
+lvm_cache_invalidate (void)
+{
+  free_snapshot (snapshot);
+  snapshot = NULL;
+}
+
+/* Check whether lvm has 'fullreport' and JSON output.
+ * They are available only in lvm2 >= 2.02.158.
+ */
+static int
+test_lvm_has_fullreport (void)
+{
+  static int result = -1;
+  if (result != -1)
+    return result;
+
+  CLEANUP_FREE char *out = NULL;
+  CLEANUP_FREE char *err = NULL;
+
+  int r = command (&out, &err, str_lvm, "fullreport", "--help", NULL);
+  if (r == -1 || strstr (out, "--reportformat") == NULL)
+    result = 0;
+  else
+    result = 1;
+
+  return result;
+}
+
+/* Append the objects of the subreport 'name' ("pv", "vg" or "lv")
+ * of one element of the fullreport "report" array.
+ */
+static int
+add_subreport (yajl_val report, const char *name,
+               yajl_val **objs, size_t *nr_objs)
+{
+  const char *path[] = { name, NULL };
+  yajl_val arr;
+  yajl_val *p;
+  size_t i, len;
+
+  arr = yajl_tree_get (report, path, yajl_t_array);
+  if (arr == NULL)
+    return 0;
+
+  len = YAJL_GET_ARRAY (arr)->len;
+  p = realloc (*objs, (*nr_objs + len) * sizeof (yajl_val));
+  if (p == NULL && *nr_objs + len > 0)
+    return -1;
+  *objs = p;
+  for (i = 0; i < len; ++i) {
+    yajl_val obj = YAJL_GET_ARRAY (arr)->values[i];
+    if (YAJL_IS_OBJECT (obj))
+      (*objs)[(*nr_objs)++] = obj;
+  }
+  return 0;
+}
+
+/* Return the current snapshot, creating it if necessary.
+ *
+ * This returns NULL (without calling reply_with_*) if lvm doesn't
+ * support fullreport or if the fullreport command failed for any
+ * reason.  Callers should then fall back to running the individual
+ * lvm commands, which will report any errors in the usual way.
+ */
+static struct lvm_snapshot *
+get_snapshot (void)
+{
+  CLEANUP_FREE char *out = NULL, *err = NULL;
+  CLEANUP_FREE char *pv_cols = NULL, *vg_cols = NULL, *lv_cols = NULL;
+  struct lvm_snapshot *snap;
+  const char *path[] = { "report", NULL };
+  yajl_val reports;
+  char parse_error[1024];
+  size_t i;
+  int r;
+
+  if (snapshot)
+    return snapshot;
+
+  if (test_lvm_has_fullreport () <= 0)
+    return NULL;
+
+  /* As well as the columns needed by the _full calls, request the
+   * extra columns used by the other queries.
+   */
+  if (asprintf (&pv_cols, "%s,vg_name", lvm_pv_cols) == -1 ||
+      asprintf (&vg_cols, "%s", lvm_vg_cols) == -1 ||
+      asprintf (&lv_cols, "%s,vg_name,lv_role,lv_active", lvm_lv_cols) == -1) {
+    perror ("asprintf");
+    return NULL;
+  }
+
+  r = command (&out, &err,
+               str_lvm, "fullreport", "--reportformat", "json",
+               "--unbuffered", "--nosuffix", "--units", "b",
+               "--configreport", "pv", "-o", pv_cols,
+               "--configreport", "vg", "-o", vg_cols,
+               "--configreport", "lv", "-o", lv_cols,
+               "--configreport", "pvseg", "-o", "pvseg_start",
+               "--configreport", "seg", "-o", "seg_start",
+               NULL);
+  if (r == -1) {
+    if (verbose)
+      fprintf (stderr, "lvm fullreport failed: %s\n", err);
+    return NULL;
+  }
+
+  snap = calloc (1, sizeof *snap);
+  if (snap == NULL) {
+    perror ("calloc");
+    return NULL;
+  }
+
+  snap->tree = yajl_tree_parse (out, parse_error, sizeof parse_error);
+  if (snap->tree == NULL) {
+    fprintf (stderr, "lvm fullreport: JSON parse error: %s\n",
+             strlen (parse_error) ? parse_error : "unknown error");
+    free (snap);
+    return NULL;
+  }
+
+  reports = yajl_tree_get (snap->tree, path, yajl_t_array);
+  if (reports == NULL) {
+    fprintf (stderr, "lvm fullreport: no \"report\" array in output\n");
+    free_snapshot (snap);
+    return NULL;
+  }
+
+  for (i = 0; i < YAJL_GET_ARRAY (reports)->len; ++i) {
+    yajl_val report = YAJL_GET_ARRAY (reports)->values[i];
+
+    if (add_subreport (report, "pv", &snap->pvs, &snap->nr_pvs) == -1 ||
+        add_subreport (report, "vg", &snap->vgs, &snap->nr_vgs) == -1 ||
+        add_subreport (report, "lv", &snap->lvs, &snap->nr_lvs) == -1) {
+      perror ("realloc");
+      free_snapshot (snap);
+      return NULL;
+    }
+  }
+
+  snapshot = snap;
+  return snapshot;
+}
+
+/* Get a string field from a report object.  lvm may report the
+ * canonical field name, which for some old names ("modules") has a
+ * prefix ("lv_modules"), so try that too.  Returns NULL if the field
+ * is not present.
+ */
+static const char *
+get_field (yajl_val obj, const char *prefix, const char *field)
+{
+  size_t i, len = YAJL_GET_OBJECT (obj)->len, plen = strlen (prefix);
+
+  for (i = 0; i < len; ++i) {
+    const char *key = YAJL_GET_OBJECT (obj)->keys[i];
+
+    if (STREQ (key, field) ||
+        (STREQLEN (key, prefix, plen) && STREQ (key + plen, field)))
+      return YAJL_GET_STRING (YAJL_GET_OBJECT (obj)->values[i]);
+  }
+
+  return NULL;
+}
+
+/* Build a colon-separated line from the columns 'cols' of 'obj', in
+ * the same format that 'lvm pvs --separator :' etc would print, so
+ * that it can be passed to the generated lvm_tokenize_* functions.
+ * If a column is missing, returns NULL and sets '*missing'.
+ */
+static char *
+get_fields_line (yajl_val obj, const char *prefix, const char *cols,
+                 int *missing)
+{
+  CLEANUP_FREE char *cols_copy = strdup (cols);
+  char *line = NULL;
+  size_t size;
+  FILE *fp;
+  char *col, *saveptr;
+  int first = 1;
+
+  if (cols_copy == NULL) {
+    reply_with_perror ("strdup");
+    return NULL;
+  }
+
+  fp = open_memstream (&line, &size);
+  if (fp == NULL) {
+    reply_with_perror ("open_memstream");
+    return NULL;
+  }
+
+  for (col = strtok_r (cols_copy, ",", &saveptr); col != NULL;
+       col = strtok_r (NULL, ",", &saveptr)) {
+    const char *value = get_field (obj, prefix, col);
+
+    if (value == NULL) {
+      fclose (fp);
+      free (line);
+      *missing = 1;
+      return NULL;
+    }
+    if (!first)
+      fputc (':', fp);
+    fputs (value, fp);
+    first = 0;
+  }
+
+  if (fclose (fp) == -1) {
+    reply_with_perror ("fclose");
+    free (line);
+    return NULL;
+  }
+
+  return line;
+}
+
+/* Return the sorted names of the PVs or VGs in the snapshot. */
+static char **
+snapshot_names (yajl_val *objs, size_t nr_objs, const char *field)
+{
+  DECLARE_STRINGSBUF (ret);
+  size_t i;
+
+  for (i = 0; i < nr_objs; ++i) {
+    const char *name = get_field (objs[i], "", field);
+
+    /* Skip orphan VGs and ignore "unknown device" (RHBZ#1054761). */
+    if (name == NULL || STREQ (name, "") || STREQ (name, "unknown device"))
+      continue;
+    if (add_string (&ret, name) == -1)
+      return NULL;
+  }
+
+  if (ret.size > 0)
+    sort_strings (ret.argv, ret.size);
+
+  if (end_stringsbuf (&ret) == -1)
+    return NULL;
+
+  return ret.argv;
+}
+
+/* Test whether a comma-separated lvm string list contains 'item'. */
+static int
+list_contains (const char *list, const char *item)
+{
+  size_t len = strlen (item);
+
+  while (list && *list) {
+    if (STREQLEN (list, item, len) && (list[len] == ',' || list[len] == '\0'))
+      return 1;
+    list = strchr (list, ',');
+    if (list)
+      list++;
+  }
+  return 0;
+}
+
+/* Equivalent of 'lvs -S "lv_role=public && lv_active=active"'. */
+static char **
+snapshot_lvs (struct lvm_snapshot *snap)
+{
+  DECLARE_STRINGSBUF (ret);
+  size_t i;
+
+  for (i = 0; i < snap->nr_lvs; ++i) {
+    const char *vg_name = get_field (snap->lvs[i], "", "vg_name");
+    const char *lv_name = get_field (snap->lvs[i], "", "lv_name");
+    const char *lv_role = get_field (snap->lvs[i], "", "lv_role");
+    const char *lv_active = get_field (snap->lvs[i], "", "lv_active");
+    CLEANUP_FREE char *dev = NULL;
+
+    if (!vg_name || !lv_name || !lv_role || !lv_active)
+      continue;
+    if (!list_contains (lv_role, "public") || STRNEQ (lv_active, "active"))
+      continue;
+
+    if (asprintf (&dev, "/dev/%s/%s", vg_name, lv_name) == -1) {
+      reply_with_perror ("asprintf");
+      free_stringslen (ret.argv, ret.size);
+      return NULL;
+    }
+    if (add_string (&ret, dev) == -1)
+      return NULL;
+  }
+
+  if (ret.size > 0)
+    sort_strings (ret.argv, ret.size);
+
+  if (end_stringsbuf (&ret) == -1)
+    return NULL;
+
+  return ret.argv;
+}
+
+/* Build the _full lists from the snapshot using the generated
+ * tokenizers.  Returns 1 if a column is missing from the report, in
+ * which case the caller falls back to the old lvm command.
+ */
+#define SNAPSHOT_FULL(typ)                                              \
+static int                                                              \
+snapshot_##typ##s_full (struct lvm_snapshot *snap,                      \
+                        guestfs_int_lvm_##typ##_list **ret_r)           \
+{                                                                       \
+  guestfs_int_lvm_##typ##_list *ret;                                    \
+  size_t i;                                                             \
+  int missing = 0;                                                      \
+                                                                        \
+  ret = malloc (sizeof *ret);                                           \
+  if (ret == NULL) {                                                    \
+    reply_with_perror ("malloc");                                       \
+    return -1;                                                          \
+  }                                                                     \
+  ret->guestfs_int_lvm_##typ##_list_len = 0;                            \
+  ret->guestfs_int_lvm_##typ##_list_val =                               \
+    calloc (snap->nr_##typ##s, sizeof (guestfs_int_lvm_##typ));         \
+  if (ret->guestfs_int_lvm_##typ##_list_val == NULL &&                  \
+      snap->nr_##typ##s > 0) {                                          \
+    reply_with_perror ("calloc");                                       \
+    free (ret);                                                         \
+    return -1;                                                          \
+  }                                                                     \
+                                                                        \
+  for (i = 0; i < snap->nr_##typ##s; ++i) {                             \
+    CLEANUP_FREE char *line =                                           \
+      get_fields_line (snap->typ##s[i], #typ "_", lvm_##typ##_cols,     \
+                       &missing);                                       \
+    guestfs_int_lvm_##typ *r =                                          \
+      &ret->guestfs_int_lvm_##typ##_list_val[i];                        \
+                                                                        \
+    if (line == NULL) {                                                 \
+      xdr_free ((xdrproc_t) xdr_guestfs_int_lvm_##typ##_list,           \
+                (char *) ret);                                          \
+      free (ret);                                                       \
+      return missing ? 1 : -1;                                          \
+    }                                                                   \
+    ret->guestfs_int_lvm_##typ##_list_len++;                            \
+    if (lvm_tokenize_##typ (line, r) == -1) {                           \
+      reply_with_error ("failed to parse output of 'lvm fullreport'");  \
+      xdr_free ((xdrproc_t) xdr_guestfs_int_lvm_##typ##_list,           \
+                (char *) ret);                                          \
+      free (ret);                                                       \
+      return -1;                                                        \
+    }                                                                   \
+  }                                                                     \
+                                                                        \
+  *ret_r = ret;                                                         \
+  return 0;                                                             \
+}
+SNAPSHOT_FULL(pv)
+SNAPSHOT_FULL(vg)
+SNAPSHOT_FULL(lv)
+
+/* Find the PV or LV in the snapshot which is the same block device
+ * as 'device'.  The names that lvm reports may differ from the ones
+ * we are passed (eg. /dev/mapper/VG-LV for /dev/VG/LV), so compare
+ * the device numbers.
+ */
+static yajl_val
+snapshot_find_device (yajl_val *objs, size_t nr_objs, int is_lv,
+                      const char *device)
+{
+  struct stat statbuf1, statbuf2;
+  size_t i;
+
+  if (stat (device, &statbuf1) == -1 || !S_ISBLK (statbuf1.st_mode))
+    return NULL;
+
+  for (i = 0; i < nr_objs; ++i) {
+    CLEANUP_FREE char *dev = NULL;
+    const char *name;
+
+    if (is_lv) {
+      const char *vg_name = get_field (objs[i], "", "vg_name");
+      const char *lv_name = get_field (objs[i], "", "lv_name");
+
+      if (!vg_name || !lv_name ||
+          asprintf (&dev, "/dev/%s/%s", vg_name, lv_name) == -1)
+        continue;
+      name = dev;
+    }
+    else {
+      name = get_field (objs[i], "", "pv_name");
+      if (!name)
+        continue;
+    }
+
+    if (stat (name, &statbuf2) == 0 && statbuf1.st_rdev == statbuf2.st_rdev)
+      return objs[i];
+  }
+
+  return NULL;
+}
+
+static yajl_val
+snapshot_find_vg (struct lvm_snapshot *snap, const char *vgname)
+{
+  size_t i;
+
+  for (i = 0; i < snap->nr_vgs; ++i) {
+    const char *name = get_field (snap->vgs[i], "", "vg_name");
+    if (name && STREQ (name, vgname))
+      return snap->vgs[i];
+  }
+
+  return NULL;
+}
+
+/* Return the uuids of the PVs or LVs in a VG, in the same format
+ * as 'lvm vgs -o pv_uuid'.
+ */
+static char **
+snapshot_vg_uuids (yajl_val *objs, size_t nr_objs, const char *field,
+                   const char *vgname)
+{
+  DECLARE_STRINGSBUF (ret);
+  size_t i;
+
+  for (i = 0; i < nr_objs; ++i) {
+    const char *vg_name = get_field (objs[i], "", "vg_name");
+    const char *uuid = get_field (objs[i], "", field);
+
+    if (vg_name && uuid && STREQ (vg_name, vgname)) {
+      if (add_string (&ret, uuid) == -1)
+        return NULL;
+    }
+  }
+
+  if (end_stringsbuf (&ret) == -1)
+    return NULL;
+
+  return ret.argv;
+}
+
 static char **
 convert_lvm_output (char *out, const char *prefix)
 {
@@ -192,6 +669,10 @@ do_pvs (void)
   char *out;
   CLEANUP_FREE char *err = NULL;
   int r;
+  struct lvm_snapshot *snap = get_snapshot ();
+
+  if (snap)
+    return snapshot_names (snap->pvs, snap->nr_pvs, "pv_name");
 
   r = command (&out, &err,
                str_lvm, "pvs", "-o", "pv_name", "--noheadings", NULL);
@@ -210,6 +691,10 @@ do_vgs (void)
   char *out;
   CLEANUP_FREE char *err = NULL;
   int r;
+  struct lvm_snapshot *snap = get_snapshot ();
+
+  if (snap)
+    return snapshot_names (snap->vgs, snap->nr_vgs, "vg_name");
 
   r = command (&out, &err,
                str_lvm, "vgs", "-o", "vg_name", "--noheadings", NULL);
@@ -255,8 +740,13 @@ do_lvs (void)
   char *out;
   CLEANUP_FREE char *err = NULL;
   int r;
-  int has_S = test_lvs_has_S_opt ();
+  int has_S;
+  struct lvm_snapshot *snap = get_snapshot ();
 
+  if (snap)
+    return snapshot_lvs (snap);
+
+  has_S = test_lvs_has_S_opt ();
   if (has_S < 0)
     return NULL;
 
@@ -292,23 +782,57 @@ do_lvs (void)
 
 /* These were so complex to implement that I ended up auto-generating
  * the code.  That code is in stubs.c, and it is generated as usual
- * by generator.ml.
+ * by generator.ml.  When the snapshot is available, the generated
+ * tokenizers are used to parse its fields instead.
  */
 guestfs_int_lvm_pv_list *
 do_pvs_full (void)
 {
+  struct lvm_snapshot *snap = get_snapshot ();
+  guestfs_int_lvm_pv_list *ret;
+
+  if (snap) {
+    int r = snapshot_pvs_full (snap, &ret);
+    if (r == -1)
+      return NULL;
+    if (r == 0)
+      return ret;
+  }
+
   return parse_command_line_pvs ();
 }
 
 guestfs_int_lvm_vg_list *
 do_vgs_full (void)
 {
+  struct lvm_snapshot *snap = get_snapshot ();
+  guestfs_int_lvm_vg_list *ret;
+
+  if (snap) {
+    int r = snapshot_vgs_full (snap, &ret);
+    if (r == -1)
+      return NULL;
+    if (r == 0)
+      return ret;
+  }
+
   return parse_command_line_vgs ();
 }
 
 guestfs_int_lvm_lv_list *
 do_lvs_full (void)
 {
+  struct lvm_snapshot *snap = get_snapshot ();
+  guestfs_int_lvm_lv_list *ret;
+
+  if (snap) {
+    int r = snapshot_lvs_full (snap, &ret);
+    if (r == -1)
+      return NULL;
+    if (r == 0)
+      return ret;
+  }
+
   return parse_command_line_lvs ();
 }
 
@@ -318,6 +842,8 @@ do_pvcreate (const char *device)
   CLEANUP_FREE char *err = NULL;
   int r;
 
+  invalidate_device_caches ();
+
   r = command (NULL, &err,
                str_lvm, "pvcreate", "--force", device, NULL);
   if (r == -1) {
@@ -349,6 +875,8 @@ do_vgcreate (const char *volgroup, char *const *physvols)
   for (i = 3; i < argc+1; ++i)
     argv[i] = physvols[i-3];
 
+  invalidate_device_caches ();
+
   r = commandv (NULL, &err, (const char * const*) argv);
   if (r == -1) {
     reply_with_error ("%s", err);
@@ -369,6 +897,8 @@ do_lvcreate (const char *logvol, const char *volgroup, int mbytes)
 
   snprintf (size, sizeof size, "%d", mbytes);
 
+  invalidate_device_caches ();
+
   r = command (NULL, &err,
                str_lvm, "lvcreate",
                "-L", size, "-n", logvol, volgroup, NULL);
@@ -396,6 +926,8 @@ do_lvcreate_free (const char *logvol, const char *volgroup, int percent)
   char size[64];
   snprintf (size, sizeof size, "%d%%FREE", percent);
 
+  invalidate_device_caches ();
+
   r = command (NULL, &err,
                str_lvm, "lvcreate",
                "-l", size, "-n", logvol, volgroup, NULL);
@@ -429,6 +961,8 @@ do_lvresize (const char *logvol, int mbytes)
 
   snprintf (size, sizeof size, "%d", mbytes);
 
+  invalidate_device_caches ();
+
   r = command (NULL, &err,
                str_lvm, "lvresize",
                "--force", "-L", size, logvol, NULL);
@@ -456,6 +990,8 @@ do_lvresize_free (const char *logvol, int percent)
   char size[64];
   snprintf (size, sizeof size, "+%d%%FREE", percent);
 
+  invalidate_device_caches ();
+
   r = command (NULL, &err,
                str_lvm, "lvresize", "-l", size, logvol, NULL);
   if (r == -1) {
@@ -477,6 +1013,8 @@ do_lvm_remove_all (void)
   size_t i;
   int r;
 
+  invalidate_device_caches ();
+
   {
     /* Remove LVs. */
     CLEANUP_FREE_STRING_LIST char **xs = do_lvs ();
@@ -500,6 +1038,8 @@ do_lvm_remove_all (void)
     }
   }
 
+  invalidate_device_caches ();
+
   {
     /* Remove VGs. */
     CLEANUP_FREE_STRING_LIST char **xs = do_vgs ();
@@ -521,6 +1061,8 @@ do_lvm_remove_all (void)
     }
   }
 
+  invalidate_device_caches ();
+
   {
     /* Remove PVs. */
     CLEANUP_FREE_STRING_LIST char **xs = do_pvs ();
@@ -538,6 +1080,7 @@ do_lvm_remove_all (void)
     }
   }
 
+  invalidate_device_caches ();
   udev_settle ();
 
   /* There, that was easy, sorry about your data. */
@@ -550,6 +1093,8 @@ do_lvremove (const char *device)
   CLEANUP_FREE char *err = NULL;
   int r;
 
+  invalidate_device_caches ();
+
   r = command (NULL, &err,
                str_lvm, "lvremove", "-f", device, NULL);
   if (r == -1) {
@@ -568,6 +1113,8 @@ do_vgremove (const char *device)
   CLEANUP_FREE char *err = NULL;
   int r;
 
+  invalidate_device_caches ();
+
   r = command (NULL, &err,
                str_lvm, "vgremove", "-f", device, NULL);
   if (r == -1) {
@@ -586,6 +1133,8 @@ do_pvremove (const char *device)
   CLEANUP_FREE char *err = NULL;
   int r;
 
+  invalidate_device_caches ();
+
   r = command (NULL, &err,
                str_lvm, "pvremove", "-ff", device, NULL);
   if (r == -1) {
@@ -604,6 +1153,8 @@ do_pvresize (const char *device)
   CLEANUP_FREE char *err = NULL;
   int r;
 
+  invalidate_device_caches ();
+
   r = command (NULL, &err,
                str_lvm, "pvresize", device, NULL);
   if (r == -1) {
@@ -623,6 +1174,8 @@ do_pvresize_size (const char *device, int64_t size)
   char buf[32];
   snprintf (buf, sizeof buf, "%" PRIi64 "b", size);
 
+  invalidate_device_caches ();
+
   r = command (NULL, &err,
                str_lvm, "pvresize",
                "--setphysicalvolumesize", buf,
@@ -656,6 +1209,8 @@ do_vg_activate (int activate, char *const *volgroups)
   for (i = 4; i < argc+1; ++i)
     argv[i] = volgroups[i-4];
 
+  invalidate_device_caches ();
+
   r = commandv (NULL, &err, (const char * const*) argv);
   if (r == -1) {
     reply_with_error ("vgchange: %s", err);
@@ -680,6 +1235,8 @@ do_lvrename (const char *logvol, const char *newlogvol)
   CLEANUP_FREE char *err = NULL;
   int r;
 
+  invalidate_device_caches ();
+
   r = command (NULL, &err,
                str_lvm, "lvrename",
                logvol, newlogvol, NULL);
@@ -699,6 +1256,8 @@ do_vgrename (const char *volgroup, const char *newvolgroup)
   CLEANUP_FREE char *err = NULL;
   int r;
 
+  invalidate_device_caches ();
+
   r = command (NULL, &err,
                str_lvm, "vgrename",
                volgroup, newvolgroup, NULL);
@@ -731,22 +1290,70 @@ get_lvm_field (const char *cmd, const char *field, const char *device)
   return out;                   /* Caller frees. */
 }
 
+/* Look up a field of a PV, VG or LV in the snapshot.  Returns NULL
+ * without calling reply_with_* if it is not found, so the caller can
+ * fall back to get_lvm_field.
+ */
+static const char *
+snapshot_field (int type, const char *name, const char *field)
+{
+  struct lvm_snapshot *snap = get_snapshot ();
+  yajl_val obj;
+
+  if (snap == NULL)
+    return NULL;
+
+  switch (type) {
+  case 'p':
+    obj = snapshot_find_device (snap->pvs, snap->nr_pvs, 0, name);
+    break;
+  case 'v':
+    obj = snapshot_find_vg (snap, name);
+    break;
+  case 'l':
+    obj = snapshot_find_device (snap->lvs, snap->nr_lvs, 1, name);
+    break;
+  default:
+    abort ();
+  }
+
+  if (obj == NULL)
+    return NULL;
+  return get_field (obj, "", field);
+}
+
+static char *
+get_lvm_field_cached (int type, const char *cmd, const char *field,
+                      const char *name)
+{
+  const char *value = snapshot_field (type, name, field);
+  char *ret;
+
+  if (value == NULL)
+    return get_lvm_field (cmd, field, name);
+
+  ret = strdup (value);
+  if (ret == NULL)
+    reply_with_perror ("strdup");
+  return ret;                   /* Caller frees. */
+}
+
 char *
 do_pvuuid (const char *device)
 {
-  return get_lvm_field ("pvs", "pv_uuid", device);
+  return get_lvm_field_cached ('p', "pvs", "pv_uuid", device);
 }
 
 char *
 do_vguuid (const char *vgname)
 {
-  return get_lvm_field ("vgs", "vg_uuid", vgname);
+  return get_lvm_field_cached ('v', "vgs", "vg_uuid", vgname);
 }
 
 char *
 do_lvuuid (const char *device)
 {
-  return get_lvm_field ("lvs", "lv_uuid", device);
+  return get_lvm_field_cached ('l', "lvs", "lv_uuid", device);
 }
 
 static char **
@@ -778,12 +1385,22 @@ get_lvm_fields (const char *cmd, const char *field, const char *device)
 char **
 do_vgpvuuids (const char *vgname)
 {
+  struct lvm_snapshot *snap = get_snapshot ();
+
+  if (snap && snapshot_find_vg (snap, vgname))
+    return snapshot_vg_uuids (snap->pvs, snap->nr_pvs, "pv_uuid", vgname);
+
   return get_lvm_fields ("vgs", "pv_uuid", vgname);
 }
 
 char **
 do_vglvuuids (const char *vgname)
 {
+  struct lvm_snapshot *snap = get_snapshot ();
+
+  if (snap && snapshot_find_vg (snap, vgname))
+    return snapshot_vg_uuids (snap->lvs, snap->nr_lvs, "lv_uuid", vgname);
+
   return get_lvm_fields ("vgs", "lv_uuid", vgname);
 }
 
@@ -793,6 +1410,8 @@ do_vgscan (void)
   CLEANUP_FREE char *err = NULL;
   int r;
 
+  invalidate_device_caches ();
+
   r = command (NULL, &err,
                str_lvm, "vgscan", NULL);
   if (r == -1) {
@@ -1056,6 +1675,8 @@ do_pvchange_uuid (const char *device)
   CLEANUP_FREE char *err = NULL;
   int r;
 
+  invalidate_device_caches ();
+
   r = command (NULL, &err,
                str_lvm, "pvchange", "-u", device, NULL);
   if (r == -1) {
@@ -1074,6 +1695,8 @@ do_pvchange_uuid_all (void)
   CLEANUP_FREE char *err = NULL;
   int r;
 
+  invalidate_device_caches ();
+
   r = command (NULL, &err,
                str_lvm, "pvchange", "-u", "-a", NULL);
   if (r == -1) {
@@ -1092,6 +1715,8 @@ do_vgchange_uuid (const char *vg)
   CLEANUP_FREE char *err = NULL;
   int r;
 
+  invalidate_device_caches ();
+
   r = command (NULL, &err,
                str_lvm, "vgchange", "-u", vg, NULL);
   if (r == -1) {
@@ -1110,6 +1735,8 @@ do_vgchange_uuid_all (void)
   CLEANUP_FREE char *err = NULL;
   int r;
 
+  invalidate_device_caches ();
+
   r = command (NULL, &err,
                str_lvm, "vgchange", "-u", NULL);
   if (r == -1) {
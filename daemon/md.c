@@ -77,6 +77,8 @@ do_md_create (const char *name, char *const *devices,
   CLEANUP_FREE char *err = NULL;
   uint64_t umissingbitmap = (uint64_t) missingbitmap;
 
+  invalidate_device_caches ();
+
   /* Check the optional parameters and set defaults where appropriate. */
   if (!(optargs_bitmask & GUESTFS_MD_CREATE_MISSINGBITMAP_BITMASK))
     umissingbitmap = 0;
@@ -359,6 +361,8 @@ do_md_stop (const char *md)
   int r;
   CLEANUP_FREE char *err = NULL;
 
+  invalidate_device_caches ();
+
   const char *mdadm[] = { str_mdadm, "--stop", md, NULL};
   r = commandv (NULL, &err, mdadm);
   if (r == -1) {
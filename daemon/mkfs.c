@@ -240,6 +240,8 @@ do_mkfs (const char *fstype, const char *device, int blocksize,
 
   wipe_device_before_mkfs (device);
 
+  invalidate_device_caches ();
+
   r = commandv (NULL, &err, argv);
   if (r == -1) {
     reply_with_error ("%s: %s: %s", fstype, device, err);
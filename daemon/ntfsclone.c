@@ -73,6 +73,8 @@ do_ntfsclone_in (const char *device)
   char error_file[] = "/tmp/ntfscloneXXXXXX";
   int fd;
 
+  invalidate_device_caches ();
+
   fd = mkstemp (error_file);
   if (fd == -1) {
     reply_with_perror ("mkstemp");
@@ -79,6 +79,8 @@ do_part_init (const char *device, const char *parttype)
   int r;
   CLEANUP_FREE char *err = NULL;
 
+  invalidate_device_caches ();
+
   parttype = check_parttype (parttype);
   if (!parttype) {
     reply_with_error ("unknown partition type: common choices are \"gpt\" and \"msdos\"");
@@ -108,6 +110,8 @@ do_part_add (const char *device, const char *prlogex,
   char startstr[32];
   char endstr[32];
 
+  invalidate_device_caches ();
+
   /* Check and translate prlogex. */
   if (STREQ (prlogex, "primary") ||
       STREQ (prlogex, "logical") ||
@@ -159,6 +163,8 @@ do_part_del (const char *device, int partnum)
   int r;
   CLEANUP_FREE char *err = NULL;
 
+  invalidate_device_caches ();
+
   if (partnum <= 0) {
     reply_with_error ("partition number must be >= 1");
     return -1;
@@ -187,6 +193,8 @@ do_part_disk (const char *device, const char *parttype)
   int r;
   CLEANUP_FREE char *err = NULL;
 
+  invalidate_device_caches ();
+
   parttype = check_parttype (parttype);
   if (!parttype) {
     reply_with_error ("unknown partition type: common choices are \"gpt\" and \"msdos\"");
@@ -561,6 +569,8 @@ do_part_get_mbr_id (const char *device, int partnum)
 int
 do_part_set_mbr_id (const char *device, int partnum, int idbyte)
 {
+  invalidate_device_caches ();
+
   if (partnum <= 0) {
     reply_with_error ("partition number must be >= 1");
     return -1;
@@ -601,6 +611,8 @@ optgroup_gdisk_available (void)
 int
 do_part_set_gpt_type (const char *device, int partnum, const char *guid)
 {
+  invalidate_device_caches ();
+
   if (partnum <= 0) {
     reply_with_error ("partition number must be >= 1");
     return -1;
@@ -627,6 +639,8 @@ do_part_set_gpt_type (const char *device, int partnum, const char *guid)
 int
 do_part_set_gpt_guid (const char *device, int partnum, const char *guid)
 {
+  invalidate_device_caches ();
+
   if (partnum <= 0) {
     reply_with_error ("partition number must be >= 1");
     return -1;
@@ -981,6 +995,8 @@ do_part_set_disk_guid (const char *device, const char *guid)
   int r = commandf (NULL, &err, COMMAND_FLAG_FOLD_STDOUT_ON_STDERR,
                     str_sgdisk, device, "-U", guid, NULL);
 
+  invalidate_device_caches ();
+
   if (r == -1) {
     reply_with_error ("%s %s -U %s: %s", str_sgdisk, device, guid, err);
     return -1;
@@ -996,6 +1012,8 @@ do_part_set_disk_guid_random (const char *device)
   int r = commandf (NULL, &err, COMMAND_FLAG_FOLD_STDOUT_ON_STDERR,
                     str_sgdisk, device, "-U", "R", NULL);
 
+  invalidate_device_caches ();
+
   if (r == -1) {
     reply_with_error ("%s %s -U R: %s", str_sgdisk, device, err);
     return -1;
@@ -1009,6 +1027,8 @@ do_part_expand_gpt(const char *device)
 {
   CLEANUP_FREE char *err = NULL;
 
+  invalidate_device_caches ();
+
   /* If something is broken, sgdisk may try to correct it.
    * (e.g. recreate partition table and so on).
    * We do not want such behavior, so dry-run at first.*/
@@ -76,6 +76,9 @@ static size_t count_progress;
 /* The daemon communications socket. */
 static int sock;
 
+/* Set when the library cancels the current call, see is_cancelled. */
+static int cancelled;
+
 void
 main_loop (int _sock)
 {
@@ -145,6 +148,7 @@ main_loop (int _sock)
     gettimeofday (&start_t, NULL);
     last_progress_t = start_t;
     count_progress = 0;
+    cancelled = 0;
 
     /* Decode the message header. */
     xdrmem_create (&xdr, buf, len, XDR_DECODE);
@@ -553,6 +557,14 @@ check_for_library_cancellation (void)
   return 1;
 }
 
+int
+is_cancelled (void)
+{
+  if (!cancelled && check_for_library_cancellation ())
+    cancelled = 1;
+  return cancelled;
+}
+
 int
 send_file_end (int cancel)
 {
@@ -564,6 +576,63 @@ send_file_end (int cancel)
   return send_chunk (&chunk);
 }
 
+/* Append data to a send_buffer, sending full chunks as they fill. */
+int
+send_buffer_write (struct send_buffer *sb, const void *data, size_t len)
+{
+  const char *p = data;
+  size_t n;
+  int r;
+
+  if (sb->buf == NULL) {
+    sb->buf = malloc (GUESTFS_MAX_CHUNK_SIZE);
+    if (sb->buf == NULL) {
+      perror ("malloc");
+      return -1;
+    }
+    sb->len = 0;
+  }
+
+  while (len > 0) {
+    n = MIN (len, GUESTFS_MAX_CHUNK_SIZE - sb->len);
+    memcpy (&sb->buf[sb->len], p, n);
+    sb->len += n;
+    p += n;
+    len -= n;
+
+    if (sb->len == GUESTFS_MAX_CHUNK_SIZE) {
+      r = send_file_write (sb->buf, sb->len);
+      sb->len = 0;
+      if (r < 0)
+        return r;
+    }
+  }
+
+  return 0;
+}
+
+/* Send whatever is left in a send_buffer. */
+int
+send_buffer_flush (struct send_buffer *sb)
+{
+  int r;
+
+  if (sb->len == 0)
+    return 0;
+
+  r = send_file_write (sb->buf, sb->len);
+  sb->len = 0;
+  return r;
+}
+
+void
+free_send_buffer (struct send_buffer *sb)
+{
+  free (sb->buf);
+  sb->buf = NULL;
+  sb->len = 0;
+}
+
 static int
 send_chunk (const guestfs_chunk *chunk)
 {
@@ -43,6 +43,7 @@ do_scrub_device (const char *device)
   int r;
 
   r = command (NULL, &err, str_scrub, device, NULL);
+  invalidate_device_caches ();
   if (r == -1) {
     reply_with_error ("%s: %s", device, err);
     return -1;
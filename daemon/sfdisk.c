@@ -114,6 +114,8 @@ int
 do_sfdisk (const char *device, int cyls, int heads, int sectors,
            char *const *lines)
 {
+  invalidate_device_caches ();
+
   return sfdisk (device, 0, cyls, heads, sectors, NULL, lines);
 }
 
@@ -123,12 +125,16 @@ do_sfdisk_N (const char *device, int n, int cyls, int heads, int sectors,
 {
   char const *const lines[2] = { line, NULL };
 
+  invalidate_device_caches ();
+
   return sfdisk (device, n, cyls, heads, sectors, NULL, (void *) lines);
 }
 
 int
 do_sfdiskM (const char *device, char *const *lines)
 {
+  invalidate_device_caches ();
+
   return sfdisk (device, 0, 0, 0, 0, "-uM", lines);
 }
 
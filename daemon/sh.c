@@ -273,6 +273,11 @@ do_command (char *const *argv)
 
   r = commandvf (&out, &err, flags, (const char * const *) argv);
 
+  /* The command could have changed partitions, filesystems or LVM
+   * metadata.
+   */
+  invalidate_device_caches ();
+
   free_bind_state (&bind_state);
   free_resolver_state (&resolver_state);
 
@@ -20,9 +20,16 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <inttypes.h>
 #include <string.h>
 #include <unistd.h>
+#include <time.h>
+#include <sys/param.h>
+
+#ifdef HAVE_LIBTSK
+#include <tsk/libtsk.h>
+#endif
 
 #include "guestfs_protocol.h"
 #include "daemon.h"
@@ -112,3 +119,280 @@ file_out (const char *cmd)
 
   return 0;
 }
+
+#ifdef HAVE_LIBTSK
+
+int
+optgroup_libtsk_available (void)
+{
+  return 1;
+}
+
+/* Size of the buffer used to read each file. */
+#define INODE_BUFFER_SIZE (256 * 1024)
+
+/* Archive formats supported by download_inodes. */
+enum archive_format { FORMAT_TAR, FORMAT_CPIO };
+
+/* Write an unsigned number into a tar header field of 'len' bytes.
+ * Numbers which don't fit in octal use the GNU base-256 encoding.
+ */
+static void
+tar_number (char *field, size_t len, uint64_t n)
+{
+  size_t i;
+
+  if (len < 12 || n < (UINT64_C(1) << (3 * (len - 1)))) {
+    snprintf (field, len, "%0*" PRIo64, (int) len - 1, n);
+    return;
+  }
+
+  memset (field, 0, len);
+  field[0] = (char) 0x80;
+  for (i = len - 1; i > 0 && n > 0; --i) {
+    field[i] = n & 0xff;
+    n >>= 8;
+  }
+}
+
+static int
+write_tar_header (struct send_buffer *sb, const char *name,
+                  uint64_t size, time_t mtime)
+{
+  char header[512];
+  unsigned sum = 0;
+  size_t i;
+
+  memset (header, 0, sizeof header);
+  snprintf (&header[0], 100, "%s", name);  /* name */
+  tar_number (&header[100], 8, 0644);      /* mode */
+  tar_number (&header[108], 8, 0);         /* uid */
+  tar_number (&header[116], 8, 0);         /* gid */
+  tar_number (&header[124], 12, size);     /* size */
+  tar_number (&header[136], 12, mtime > 0 ? (uint64_t) mtime : 0);
+  memset (&header[148], ' ', 8);           /* checksum, see below */
+  header[156] = '0';                       /* regular file */
+  memcpy (&header[257], "ustar", 6);       /* magic */
+  memcpy (&header[263], "00", 2);          /* version */
+
+  for (i = 0; i < sizeof header; ++i)
+    sum += (unsigned char) header[i];
+  snprintf (&header[148], 8, "%06o", sum);
+  header[155] = ' ';
+
+  return send_buffer_write (sb, header, sizeof header);
+}
+
+static int
+write_cpio_header (struct send_buffer *sb, const char *name, uint64_t ino,
+                   uint32_t mode, uint64_t size, time_t mtime)
+{
+  char header[111];
+  size_t namelen = strlen (name) + 1;
+  static const char zeroes[4];
+  int r;
+
+  snprintf (header, sizeof header,
+            "070701"
+            "%08X%08X%08X%08X%08X%08X%08X%08X%08X%08X%08X%08X%08X",
+            (unsigned) (ino & 0xffffffff), mode,
+            0, 0,                       /* uid, gid */
+            1,                          /* nlink */
+            (unsigned) (mtime > 0 ? mtime : 0),
+            (unsigned) size,
+            0, 0, 0, 0,                 /* dev, rdev */
+            (unsigned) namelen,
+            0);                         /* check */
+
+  r = send_buffer_write (sb, header, 110);
+  if (r == 0)
+    r = send_buffer_write (sb, name, namelen);
+  /* The header and name are padded to a multiple of 4 bytes. */
+  if (r == 0 && (110 + namelen) % 4 != 0)
+    r = send_buffer_write (sb, zeroes, 4 - (110 + namelen) % 4);
+  return r;
+}
+
+/* Write padding after the data of one member. */
+static int
+write_padding (struct send_buffer *sb, enum archive_format format,
+               uint64_t size)
+{
+  static const char zeroes[512];
+  size_t align = format == FORMAT_TAR ? 512 : 4;
+
+  if (size % align == 0)
+    return 0;
+  return send_buffer_write (sb, zeroes, align - size % align);
+}
+
+static int
+write_trailer (struct send_buffer *sb, enum archive_format format)
+{
+  static const char zeroes[1024];
+
+  if (format == FORMAT_TAR)
+    return send_buffer_write (sb, zeroes, sizeof zeroes);
+  return write_cpio_header (sb, "TRAILER!!!", 0, 0, 0, 0);
+}
+
+/* Write one inode to the archive.  The size is written in the
+ * header before the data is read, so if the data cannot be read
+ * (which is common for deleted files) the rest is filled with
+ * zeroes.  Returns -1 on send errors only.
+ */
+static int
+write_inode (struct send_buffer *sb, enum archive_format format,
+             TSK_FS_INFO *fs, TSK_INUM_T inode, char *buf)
+{
+  TSK_FS_FILE *file;
+  uint64_t size = 0, offset = 0;
+  time_t mtime = 0;
+  char name[32];
+  int r;
+
+  snprintf (name, sizeof name, "%" PRIuINUM, inode);
+
+  file = tsk_fs_file_open_meta (fs, NULL, inode);
+  if (file == NULL || file->meta == NULL)
+    fprintf (stderr, "download_inodes: %s: %s\n", name, tsk_error_get ());
+  else {
+    size = file->meta->size > 0 ? (uint64_t) file->meta->size : 0;
+    mtime = file->meta->mtime;
+  }
+  tsk_error_reset ();
+
+  if (format == FORMAT_CPIO && size > UINT32_MAX) {
+    fprintf (stderr, "download_inodes: %s: file is too large for cpio, "
+             "use the tar format\n", name);
+    size = 0;
+  }
+
+  if (format == FORMAT_TAR)
+    r = write_tar_header (sb, name, size, mtime);
+  else
+    r = write_cpio_header (sb, name, inode, 0100644, size, mtime);
+  if (r < 0)
+    goto out;
+
+  while (offset < size) {
+    size_t n = MIN (size - offset, INODE_BUFFER_SIZE);
+    ssize_t rn = -1;
+
+    if (file != NULL)
+      rn = tsk_fs_file_read (file, offset, buf, n,
+                             TSK_FS_FILE_READ_FLAG_NONE);
+    if (rn <= 0) {
+      fprintf (stderr, "download_inodes: %s: short read at offset %"
+               PRIu64 ", filling with zeroes\n", name, offset);
+      tsk_error_reset ();
+      memset (buf, 0, n);
+      rn = n;
+    }
+
+    r = send_buffer_write (sb, buf, rn);
+    if (r < 0)
+      goto out;
+    offset += rn;
+  }
+
+  r = write_padding (sb, format, size);
+
+ out:
+  if (file != NULL)
+    tsk_fs_file_close (file);
+  return r;
+}
+
+/* Has one FileOut parameter. */
+/* Takes optional arguments, consult optargs_bitmask. */
+int
+do_download_inodes (const mountable_t *mountable, char *const *inodes,
+                    const char *filename, const char *format_str)
+{
+  enum archive_format format = FORMAT_TAR;
+  CLEANUP_FREE TSK_INUM_T *inums = NULL;
+  CLEANUP_FREE char *buf = NULL;
+  DECLARE_SEND_BUFFER (sb);
+  TSK_IMG_INFO *img = NULL;
+  TSK_FS_INFO *fs = NULL;
+  size_t i, n = count_strings (inodes);
+  int r = 0;
+
+  if ((optargs_bitmask & GUESTFS_DOWNLOAD_INODES_FORMAT_BITMASK)) {
+    if (STREQ (format_str, "tar"))
+      format = FORMAT_TAR;
+    else if (STREQ (format_str, "cpio"))
+      format = FORMAT_CPIO;
+    else {
+      reply_with_error ("unknown archive format: %s", format_str);
+      return -1;
+    }
+  }
+
+  inums = malloc ((n > 0 ? n : 1) * sizeof (TSK_INUM_T));
+  buf = malloc (INODE_BUFFER_SIZE);
+  if (inums == NULL || buf == NULL) {
+    reply_with_perror ("malloc");
+    return -1;
+  }
+  for (i = 0; i < n; ++i) {
+    uint64_t inode;
+    int end = -1;
+
+    if (sscanf (inodes[i], "%" SCNu64 "%n", &inode, &end) != 1 ||
+        end == -1 || inodes[i][end] != '\0') {
+      reply_with_error ("invalid inode number: %s", inodes[i]);
+      return -1;
+    }
+    inums[i] = inode;
+  }
+
+  /* Open the filesystem once for all the inodes. */
+  img = tsk_img_open_utf8_sing (mountable->device, TSK_IMG_TYPE_DETECT, 0);
+  if (img == NULL) {
+    reply_with_error ("%s: %s", mountable->device, tsk_error_get ());
+    tsk_error_reset ();
+    return -1;
+  }
+  fs = tsk_fs_open_img (img, 0, TSK_FS_TYPE_DETECT);
+  if (fs == NULL) {
+    reply_with_error ("%s: %s", mountable->device, tsk_error_get ());
+    tsk_error_reset ();
+    tsk_img_close (img);
+    return -1;
+  }
+
+  /* Now we must send the reply message, before the file contents.  After
+   * this there is no opportunity in the protocol to send any error
+   * message back.  Instead we can only cancel the transfer.
+   */
+  reply (NULL, NULL);
+
+  for (i = 0; i < n && r == 0; ++i) {
+    r = write_inode (&sb, format, fs, inums[i], buf);
+    notify_progress (i + 1, n);
+  }
+  if (r == 0)
+    r = write_trailer (&sb, format);
+  if (r == 0)
+    r = send_buffer_flush (&sb);
+  free_send_buffer (&sb);
+
+  tsk_fs_close (fs);
+  tsk_img_close (img);
+
+  if (r < 0)
+    return -1;
+
+  if (send_file_end (0))        /* Normal end of file. */
+    return -1;
+
+  return 0;
+}
+
+#else /* !HAVE_LIBTSK */
+
+OPTGROUP_LIBTSK_NOT_AVAILABLE
+
+#endif /* !HAVE_LIBTSK */
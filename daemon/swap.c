@@ -54,6 +54,8 @@ do_mkswap (const char *device, const char *label, const char *uuid)
   int r;
   CLEANUP_FREE char *err = NULL;
 
+  invalidate_device_caches ();
+
   ADD_ARG (argv, i, str_mkswap);
   ADD_ARG (argv, i, "-f");
 
@@ -136,34 +136,32 @@ write_cb (void *fd_ptr, const void *buf, size_t len)
 int
 do_tar_in (const char *dir, const char *compress, int xattrs, int selinux, int acls)
 {
-  const char *filter;
+  char env[32], filter[64];
   int err, r;
   FILE *fp;
   CLEANUP_FREE char *cmd = NULL;
   char error_file[] = "/tmp/tarXXXXXX";
   int fd, chown_supported;
+  int parallel = 0;
+  struct decompress *dc = NULL;
 
   chown_supported = is_chown_supported (dir);
   if (chown_supported == -1)
     return -1;
 
   if ((optargs_bitmask & GUESTFS_TAR_IN_COMPRESS_BITMASK)) {
-    if (STREQ (compress, "compress"))
-      filter = " --compress";
-    else if (STREQ (compress, "gzip"))
-      filter = " --gzip";
-    else if (STREQ (compress, "bzip2"))
-      filter = " --bzip2";
-    else if (STREQ (compress, "xz"))
-      filter = " --xz";
-    else if (STREQ (compress, "lzop"))
-      filter = " --lzop";
-    else {
-      reply_with_error ("unknown compression type: %s", compress);
+    /* If the appliance has more than one vCPU and enough memory,
+     * decompress xz and zstd in the daemon using several threads, and
+     * give tar the uncompressed stream.
+     */
+    parallel = decompress_supported (compress) && decompress_threads () > 1;
+    if (parallel)
+      env[0] = filter[0] = '\0';
+    else if (get_tar_filter (compress, env, sizeof env,
+                             filter, sizeof filter) == -1)
       return -1;
-    }
   } else
-    filter = "";
+    env[0] = filter[0] = '\0';
 
   if (!(optargs_bitmask & GUESTFS_TAR_IN_XATTRS_BITMASK))
     xattrs = 0;
@@ -186,8 +184,8 @@ do_tar_in (const char *dir, const char *compress, int xattrs, int selinux, int a
   close (fd);
 
   /* "tar -C /sysroot%s -xf -" but we have to quote the dir. */
-  if (asprintf_nowarn (&cmd, "%s -C %R%s -xf - %s%s%s%s2> %s",
-                       str_tar,
+  if (asprintf_nowarn (&cmd, "%s%s -C %R%s -xf - %s%s%s%s2> %s",
+                       env, str_tar,
                        dir, filter,
                        chown_supported ? "" : "--no-same-owner ",
                        xattrs ? "--xattrs " : "",
@@ -220,15 +218,51 @@ do_tar_in (const char *dir, const char *compress, int xattrs, int selinux, int a
    */
   fd = fileno (fp);
 
-  r = receive_file (write_cb, &fd);
+  if (parallel) {
+    dc = decompress_new (compress, fd, decompress_threads ());
+    if (dc == NULL) {
+      err = errno;
+      r = cancel_receive ();
+      errno = err;
+      reply_with_perror ("decompress: %s", compress);
+      pclose (fp);
+      unlink (error_file);
+      return -1;
+    }
+    r = receive_file (decompress_write, dc);
+    if (r == 0 && decompress_finish (dc) == -1) {
+      /* The whole upload has been received, so there is nothing to
+       * cancel.
+       */
+      if (decompress_error (dc))
+        reply_with_error ("%s: %s", compress, decompress_error (dc));
+      else {
+        CLEANUP_FREE char *errstr = read_error_file (error_file);
+        reply_with_error ("write error on directory: %s: %s", dir, errstr);
+      }
+      decompress_free (dc);
+      unlink (error_file);
+      pclose (fp);
+      return -1;
+    }
+  }
+  else
+    r = receive_file (write_cb, &fd);
+
   if (r == -1) {		/* write error */
     cancel_receive ();
-    CLEANUP_FREE char *errstr = read_error_file (error_file);
-    reply_with_error ("write error on directory: %s: %s", dir, errstr);
+    if (dc && decompress_error (dc))
+      reply_with_error ("%s: %s", compress, decompress_error (dc));
+    else {
+      CLEANUP_FREE char *errstr = read_error_file (error_file);
+      reply_with_error ("write error on directory: %s: %s", dir, errstr);
+    }
+    decompress_free (dc);
     unlink (error_file);
     pclose (fp);
     return -1;
   }
+  decompress_free (dc);
   if (r == -2) {		/* cancellation from library */
     /* This error is ignored by the library since it initiated the
      * cancel.  Nevertheless we must send an error reply here.
@@ -332,7 +366,7 @@ do_tar_out (const char *dir, const char *compress, int numericowner,
 {
   CLEANUP_FREE char *buf = NULL;
   struct stat statbuf;
-  const char *filter;
+  char env[32], filter[64];
   int r;
   FILE *fp;
   CLEANUP_UNLINK_FREE char *exclude_from_file = NULL;
@@ -346,22 +380,11 @@ do_tar_out (const char *dir, const char *compress, int numericowner,
   }
 
   if ((optargs_bitmask & GUESTFS_TAR_OUT_COMPRESS_BITMASK)) {
-    if (STREQ (compress, "compress"))
-      filter = " --compress";
-    else if (STREQ (compress, "gzip"))
-      filter = " --gzip";
-    else if (STREQ (compress, "bzip2"))
-      filter = " --bzip2";
-    else if (STREQ (compress, "xz"))
-      filter = " --xz";
-    else if (STREQ (compress, "lzop"))
-      filter = " --lzop";
-    else {
-      reply_with_error ("unknown compression type: %s", compress);
+    if (get_tar_filter (compress, env, sizeof env,
+                        filter, sizeof filter) == -1)
       return -1;
-    }
   } else
-    filter = "";
+    env[0] = filter[0] = '\0';
 
   if (!(optargs_bitmask & GUESTFS_TAR_OUT_NUMERICOWNER_BITMASK))
     numericowner = 0;
@@ -399,8 +422,8 @@ do_tar_out (const char *dir, const char *compress, int numericowner,
   }
 
   /* "tar -C /sysroot%s -cf - ." but we have to quote the dir. */
-  if (asprintf_nowarn (&cmd, "%s -C %Q%s%s%s%s%s%s%s -cf - .",
-                       str_tar,
+  if (asprintf_nowarn (&cmd, "%s%s -C %Q%s%s%s%s%s%s%s -cf - .",
+                       env, str_tar,
                        buf, filter,
                        numericowner ? " --numeric-owner" : "",
                        exclude_from_file ? " -X " : "",
@@ -21,11 +21,13 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <inttypes.h>
 #include <string.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/param.h>
 
 #include "guestfs_protocol.h"
 #include "daemon.h"
@@ -62,6 +64,8 @@ upload (const char *filename, int flags, int64_t offset)
   int err, r, is_dev;
 
   is_dev = STRPREFIX (filename, "/dev/");
+  if (is_dev)
+    invalidate_device_caches ();
 
   if (!is_dev) CHROOT_IN;
   data.fd = open (filename, flags, 0666);
@@ -322,3 +326,294 @@ do_download_offset (const char *filename, int64_t offset, int64_t size)
 
   return 0;
 }
+
+/* Parse the list of "OFFSET:SIZE" strings passed to pread_ranges,
+ * pwrite_ranges and extents_to_files.  This does not call
+ * reply_with_*, because pwrite_ranges must cancel the upload first.  On error it returns
+ * NULL, and either sets *bad_range to the invalid string or sets
+ * errno.
+ */
+struct range *
+parse_ranges (char *const *ranges, size_t *nr_ranges_r,
+              const char **bad_range)
+{
+  size_t i, n = count_strings (ranges);
+  struct range *ret;
+
+  *bad_range = NULL;
+  ret = malloc ((n > 0 ? n : 1) * sizeof (struct range));
+  if (ret == NULL)
+    return NULL;
+
+  for (i = 0; i < n; ++i) {
+    int64_t offset, size;
+    int end = -1;
+
+    if (sscanf (ranges[i], "%" SCNd64 ":%" SCNd64 "%n",
+                &offset, &size, &end) != 2 ||
+        end == -1 || ranges[i][end] != '\0' ||
+        offset < 0 || size < 0 || offset > INT64_MAX - size) {
+      *bad_range = ranges[i];
+      free (ret);
+      return NULL;
+    }
+    ret[i].offset = offset;
+    ret[i].size = size;
+  }
+
+  *nr_ranges_r = n;
+  return ret;
+}
+
+/* Size of the buffer used to read each range.  The data is sent in
+ * GUESTFS_MAX_CHUNK_SIZE pieces through a send_buffer.
+ */
+#define RANGES_BUFFER_SIZE (256 * 1024)
+
+/* Has one FileOut parameter. */
+int
+do_pread_ranges (const char *filename, char *const *ranges)
+{
+  CLEANUP_FREE struct range *rs = NULL;
+  CLEANUP_FREE char *buf = NULL;
+  struct send_buffer sb = { .buf = NULL };
+  size_t nr_ranges, i;
+  const char *bad_range;
+  int fd, is_dev;
+  off_t size;
+  uint64_t total = 0, sent = 0;
+
+  rs = parse_ranges (ranges, &nr_ranges, &bad_range);
+  if (rs == NULL) {
+    if (bad_range)
+      reply_with_error ("invalid range: %s", bad_range);
+    else
+      reply_with_perror ("malloc");
+    return -1;
+  }
+
+  buf = malloc (RANGES_BUFFER_SIZE);
+  if (buf == NULL) {
+    reply_with_perror ("malloc");
+    return -1;
+  }
+
+  is_dev = STRPREFIX (filename, "/dev/");
+
+  if (!is_dev) CHROOT_IN;
+  fd = open (filename, O_RDONLY|O_CLOEXEC);
+  if (!is_dev) CHROOT_OUT;
+  if (fd == -1) {
+    reply_with_perror ("%s", filename);
+    return -1;
+  }
+
+  if (check_not_directory (filename, fd) == -1) {
+    close (fd);
+    return -1;
+  }
+
+  /* This works for block devices as well as files. */
+  size = lseek (fd, 0, SEEK_END);
+  if (size == -1) {
+    reply_with_perror ("lseek: %s", filename);
+    close (fd);
+    return -1;
+  }
+
+  for (i = 0; i < nr_ranges; ++i) {
+    if (rs[i].offset + rs[i].size > (uint64_t) size) {
+      reply_with_error ("%s: range %s is beyond the end of the file",
+                        filename, ranges[i]);
+      close (fd);
+      return -1;
+    }
+    total += rs[i].size;
+  }
+
+  /* Now we must send the reply message, before the file contents.  After
+   * this there is no opportunity in the protocol to send any error
+   * message back.  Instead we can only cancel the transfer.
+   */
+  reply (NULL, NULL);
+
+  for (i = 0; i < nr_ranges; ++i) {
+    uint64_t offset = rs[i].offset, remaining = rs[i].size;
+
+    while (remaining > 0) {
+      ssize_t r;
+
+      r = pread (fd, buf, MIN (remaining, RANGES_BUFFER_SIZE), offset);
+      if (r == -1) {
+        fprintf (stderr, "pread: %s: %m\n", filename);
+        goto cancel;
+      }
+      if (r == 0) {
+        fprintf (stderr, "pread: %s: file was truncated\n", filename);
+        goto cancel;
+      }
+
+      if (send_buffer_write (&sb, buf, r) < 0)
+        goto error;
+
+      offset += r;
+      remaining -= r;
+      sent += r;
+      notify_progress (sent, total);
+    }
+  }
+
+  if (send_buffer_flush (&sb) < 0)
+    goto error;
+  free_send_buffer (&sb);
+
+  if (close (fd) == -1) {
+    fprintf (stderr, "close: %s: %m\n", filename);
+    send_file_end (1);		/* Cancel. */
+    return -1;
+  }
+
+  if (send_file_end (0))	/* Normal end of file. */
+    return -1;
+
+  return 0;
+
+ cancel:
+  send_file_end (1);		/* Cancel. */
+ error:
+  free_send_buffer (&sb);
+  close (fd);
+  return -1;
+}
+
+struct pwrite_ranges_data {
+  const char *filename;
+  int fd;
+  const struct range *ranges;
+  size_t nr_ranges;
+  size_t i;                     /* current range */
+  uint64_t done;                /* bytes written in current range */
+  uint64_t written, total;      /* for progress */
+  int too_much_data;
+};
+
+static int
+pwrite_ranges_cb (void *data_vp, const void *buf_vp, size_t len)
+{
+  struct pwrite_ranges_data *data = data_vp;
+  const char *buf = buf_vp;
+
+  while (len > 0) {
+    const struct range *range;
+    size_t n;
+    ssize_t r;
+
+    /* Skip finished (including empty) ranges. */
+    while (data->i < data->nr_ranges &&
+           data->done == data->ranges[data->i].size) {
+      data->i++;
+      data->done = 0;
+    }
+    if (data->i == data->nr_ranges) {
+      data->too_much_data = 1;
+      return -1;
+    }
+
+    range = &data->ranges[data->i];
+    n = MIN (len, range->size - data->done);
+    r = pwrite (data->fd, buf, n, range->offset + data->done);
+    if (r == -1) {
+      perror (data->filename);
+      return -1;
+    }
+
+    data->done += r;
+    data->written += r;
+    buf += r;
+    len -= r;
+  }
+
+  notify_progress (data->written, data->total);
+  return 0;
+}
+
+/* Has one FileIn parameter. */
+int
+do_pwrite_ranges (const char *filename, char *const *ranges)
+{
+  CLEANUP_FREE struct range *rs = NULL;
+  struct pwrite_ranges_data data = { .filename = filename };
+  size_t i;
+  const char *bad_range;
+  int err, r, is_dev;
+
+  rs = parse_ranges (ranges, &data.nr_ranges, &bad_range);
+  if (rs == NULL) {
+    err = errno;
+    r = cancel_receive ();
+    errno = err;
+    if (bad_range)
+      reply_with_error ("invalid range: %s", bad_range);
+    else
+      reply_with_perror ("malloc");
+    return -1;
+  }
+  data.ranges = rs;
+  for (i = 0; i < data.nr_ranges; ++i)
+    data.total += rs[i].size;
+
+  is_dev = STRPREFIX (filename, "/dev/");
+  if (is_dev)
+    invalidate_device_caches ();
+
+  if (!is_dev) CHROOT_IN;
+  data.fd = open (filename, O_WRONLY|O_NOCTTY|O_CLOEXEC);
+  if (!is_dev) CHROOT_OUT;
+  if (data.fd == -1) {
+    err = errno;
+    r = cancel_receive ();
+    errno = err;
+    reply_with_perror ("%s", filename);
+    return -1;
+  }
+
+  r = receive_file (pwrite_ranges_cb, &data);
+  if (r == -1) {		/* write error */
+    err = errno;
+    r = cancel_receive ();
+    errno = err;
+    if (data.too_much_data)
+      reply_with_error ("%s: more data was sent than the size of the ranges",
+                        filename);
+    else
+      reply_with_perror ("write error: %s", filename);
+    close (data.fd);
+    return -1;
+  }
+  if (r == -2) {		/* cancellation from library */
+    /* This error is ignored by the library since it initiated the
+     * cancel.  Nevertheless we must send an error reply here.
+     */
+    reply_with_error ("file upload cancelled");
+    close (data.fd);
+    return -1;
+  }
+
+  if (data.written != data.total) {
+    reply_with_error ("%s: less data was sent than the size of the ranges",
+                      filename);
+    close (data.fd);
+    return -1;
+  }
+
+  if (close (data.fd) == -1) {
+    reply_with_perror ("close: %s", filename);
+    return -1;
+  }
+
+  /* See the comment in pwrite_fd in file.c. */
+  if (is_dev)
+    udev_settle ();
+
+  return 0;
+}
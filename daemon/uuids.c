@@ -60,6 +60,8 @@ do_set_uuid (const char *device, const char *uuid)
 {
   int r;
 
+  invalidate_device_caches ();
+
   /* How we set the UUID depends on the filesystem type. */
   CLEANUP_FREE char *vfs_type = get_blkid_tag (device, "TYPE");
   if (vfs_type == NULL)
@@ -89,6 +91,8 @@ do_set_uuid_random (const char *device)
 {
   int r;
 
+  invalidate_device_caches ();
+
   /* How we set the UUID depends on the filesystem type. */
   CLEANUP_FREE char *vfs_type = get_blkid_tag (device, "TYPE");
   if (vfs_type == NULL)
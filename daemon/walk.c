@@ -0,0 +1,810 @@
+/* libguestfs - the guestfsd daemon
+ * Copyright (C) 2016 Red Hat Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/**
+ * This file implements a directory tree walker which is used by
+ * C<find0>, C<du>, C<checksums_out> and other calls that have to
+ * visit a whole subtree.  It replaces running L<find(1)> and parsing
+ * its output.
+ *
+ * Each directory is read once with L<readdir(3)> (ie. L<getdents64(2)>)
+ * and closed before its subdirectories are visited, so the walker
+ * never holds more than one directory file descriptor per thread
+ * open, however deep the tree is.  The C<d_type> field is used to
+ * tell directories from other entries so most entries never need to
+ * be L<lstat(2)>ed.
+ *
+ * Pending directories are kept on a shared stack.  When more than
+ * one thread is requested, worker threads pop directories from the
+ * stack concurrently, which hides the latency of reading directories
+ * and inodes from the underlying disk image.
+ *
+ * This file also implements C<guestfs_walk_out>, which streams the
+ * metadata of a whole tree back to the library in one call.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <errno.h>
+#include <limits.h>
+#include <signal.h>
+#include <pthread.h>
+#include <inttypes.h>
+#include <sys/stat.h>
+
+#if defined(HAVE_LLISTXATTR) && defined(HAVE_LGETXATTR)
+# ifdef HAVE_ATTR_XATTR_H
+#  include <attr/xattr.h>
+# else
+#  ifdef HAVE_SYS_XATTR_H
+#   include <sys/xattr.h>
+#  endif
+# endif
+# define WALK_XATTRS 1
+#endif
+
+#include "guestfs_protocol.h"
+#include "daemon.h"
+#include "actions.h"
+
+/* Upper limit on the number of threads, whatever the caller asks for. */
+#define MAX_WALK_THREADS 16
+
+struct walk_dir {
+  char *path;                   /* Relative to the top directory. */
+  size_t depth;                 /* Depth of the entries in this dir. */
+};
+
+struct walk_state {
+  int rootfd;                   /* Top directory. */
+  unsigned flags;
+  walk_cb cb;
+  void *opaque;
+
+  pthread_mutex_t lock;         /* Protects the fields below. */
+  pthread_cond_t cond;
+  struct walk_dir *stack;       /* Directories waiting to be read. */
+  size_t nr_stack, alloc_stack;
+  size_t active;                /* Number of threads reading a dir. */
+  int failed;                   /* Set when any thread fails. */
+  int saved_errno;
+};
+
+/**
+ * Return a sensible number of threads for walking a tree, which is
+ * the number of online CPUs in the appliance.
+ */
+size_t
+walk_default_threads (void)
+{
+  long n = sysconf (_SC_NPROCESSORS_ONLN);
+
+  if (n < 1)
+    return 1;
+  if (n > MAX_WALK_THREADS)
+    return MAX_WALK_THREADS;
+  return (size_t) n;
+}
+
+static int
+walk_failed (struct walk_state *state)
+{
+  int r;
+
+  pthread_mutex_lock (&state->lock);
+  r = state->failed;
+  pthread_mutex_unlock (&state->lock);
+  return r;
+}
+
+static void
+set_failed (struct walk_state *state, int err)
+{
+  pthread_mutex_lock (&state->lock);
+  if (!state->failed) {
+    state->failed = 1;
+    state->saved_errno = err;
+  }
+  pthread_cond_broadcast (&state->cond);
+  pthread_mutex_unlock (&state->lock);
+}
+
+/* Push the subdirectories found in one directory onto the shared
+ * stack.  They are pushed in reverse order so that the first
+ * subdirectory is read next.  The single-threaded walk is therefore
+ * depth-first, but all the entries of a directory are seen before
+ * any of its subdirectories are read, so the order is not the same
+ * as L<find(1)>.  Takes ownership of the paths in C<dirs>.
+ */
+static int
+push_dirs (struct walk_state *state, struct walk_dir *dirs, size_t n)
+{
+  size_t i;
+
+  if (n == 0)
+    return 0;
+
+  pthread_mutex_lock (&state->lock);
+
+  if (state->nr_stack + n > state->alloc_stack) {
+    size_t new_alloc = state->alloc_stack * 2;
+    struct walk_dir *new_stack;
+
+    if (new_alloc < state->nr_stack + n)
+      new_alloc = state->nr_stack + n + 64;
+    new_stack = realloc (state->stack, new_alloc * sizeof (struct walk_dir));
+    if (new_stack == NULL) {
+      pthread_mutex_unlock (&state->lock);
+      return -1;
+    }
+    state->stack = new_stack;
+    state->alloc_stack = new_alloc;
+  }
+
+  for (i = n; i > 0; --i)
+    state->stack[state->nr_stack++] = dirs[i-1];
+
+  if (n > 1)
+    pthread_cond_broadcast (&state->cond);
+  else
+    pthread_cond_signal (&state->cond);
+  pthread_mutex_unlock (&state->lock);
+
+  return 0;
+}
+
+/* Convert st_mode to one of the DT_* constants. */
+static unsigned char
+mode_to_dtype (mode_t mode)
+{
+  if (S_ISREG (mode)) return DT_REG;
+  if (S_ISDIR (mode)) return DT_DIR;
+  if (S_ISLNK (mode)) return DT_LNK;
+  if (S_ISCHR (mode)) return DT_CHR;
+  if (S_ISBLK (mode)) return DT_BLK;
+  if (S_ISFIFO (mode)) return DT_FIFO;
+  if (S_ISSOCK (mode)) return DT_SOCK;
+  return DT_UNKNOWN;
+}
+
+/* Read a single directory, calling the callback for each entry. */
+static int
+walk_one_dir (struct walk_state *state, const struct walk_dir *dir)
+{
+  int fd;
+  DIR *dp;
+  struct dirent *d;
+  size_t dirlen = strlen (dir->path);
+  CLEANUP_FREE char *path = NULL;
+  size_t path_alloc = 0;
+  struct walk_dir *subdirs = NULL;
+  size_t nr_subdirs = 0, alloc_subdirs = 0;
+  size_t i;
+  int r;
+
+  if (dirlen == 0)
+    fd = dup (state->rootfd);
+  else
+    fd = openat (state->rootfd, dir->path,
+                 O_RDONLY|O_DIRECTORY|O_NOFOLLOW|O_CLOEXEC);
+  if (fd == -1) {
+    /* The directory vanished between being listed and being read. */
+    if (errno == ENOENT)
+      return 0;
+    fprintf (stderr, "walk: open: %s: %m\n", dir->path);
+    return -1;
+  }
+
+  dp = fdopendir (fd);
+  if (dp == NULL) {
+    fprintf (stderr, "walk: fdopendir: %s: %m\n", dir->path);
+    close (fd);
+    return -1;
+  }
+
+  for (;;) {
+    struct walk_entry entry;
+    struct stat statbuf;
+    size_t namelen, len;
+
+    errno = 0;
+    d = readdir (dp);
+    if (d == NULL) {
+      if (errno != 0) {
+        fprintf (stderr, "walk: readdir: %s: %m\n", dir->path);
+        goto error;
+      }
+      break;
+    }
+
+    if (STREQ (d->d_name, ".") || STREQ (d->d_name, ".."))
+      continue;
+
+    /* Once another thread has failed there is no point going on. */
+    if (walk_failed (state))
+      goto error;
+
+    /* Build the relative path of this entry, reusing the buffer. */
+    namelen = strlen (d->d_name);
+    len = dirlen + (dirlen > 0 ? 1 : 0) + namelen;
+    if (len + 1 > path_alloc) {
+      char *p;
+
+      path_alloc = len + 1 + 256;
+      p = realloc (path, path_alloc);
+      if (p == NULL) {
+        perror ("realloc");
+        goto error;
+      }
+      path = p;
+    }
+    if (dirlen > 0) {
+      memcpy (path, dir->path, dirlen);
+      path[dirlen] = '/';
+      memcpy (&path[dirlen+1], d->d_name, namelen + 1);
+    }
+    else
+      memcpy (path, d->d_name, namelen + 1);
+
+    entry.path = path;
+    entry.pathlen = len;
+    entry.name = d->d_name;
+    entry.dirfd = dirfd (dp);
+    entry.type = d->d_type;
+    entry.depth = dir->depth;
+    entry.statbuf = NULL;
+
+    /* Only stat when the caller wants it or the filesystem
+     * doesn't fill in d_type.
+     */
+    if ((state->flags & WALK_FLAG_STAT) || entry.type == DT_UNKNOWN) {
+      if (fstatat (entry.dirfd, d->d_name, &statbuf,
+                   AT_SYMLINK_NOFOLLOW) == -1) {
+        if (errno == ENOENT)
+          continue;
+        fprintf (stderr, "walk: lstat: %s: %m\n", path);
+        goto error;
+      }
+      entry.statbuf = &statbuf;
+      entry.type = mode_to_dtype (statbuf.st_mode);
+    }
+
+    r = state->cb (&entry, state->opaque);
+    if (r == -1)
+      goto error;
+
+    if (entry.type == DT_DIR && r != WALK_PRUNE) {
+      if (nr_subdirs >= alloc_subdirs) {
+        struct walk_dir *p;
+
+        alloc_subdirs = alloc_subdirs == 0 ? 16 : alloc_subdirs * 2;
+        p = realloc (subdirs, alloc_subdirs * sizeof (struct walk_dir));
+        if (p == NULL) {
+          perror ("realloc");
+          goto error;
+        }
+        subdirs = p;
+      }
+      subdirs[nr_subdirs].path = strdup (path);
+      if (subdirs[nr_subdirs].path == NULL) {
+        perror ("strdup");
+        goto error;
+      }
+      subdirs[nr_subdirs].depth = dir->depth + 1;
+      nr_subdirs++;
+    }
+  }
+
+  if (closedir (dp) == -1) {
+    fprintf (stderr, "walk: closedir: %s: %m\n", dir->path);
+    dp = NULL;
+    goto error;
+  }
+  dp = NULL;
+
+  if (push_dirs (state, subdirs, nr_subdirs) == -1) {
+    perror ("realloc");
+    goto error;
+  }
+  free (subdirs);
+  return 0;
+
+ error:
+  r = errno;
+  if (dp)
+    closedir (dp);
+  for (i = 0; i < nr_subdirs; ++i)
+    free (subdirs[i].path);
+  free (subdirs);
+  errno = r;
+  return -1;
+}
+
+static void *
+walk_worker (void *statev)
+{
+  struct walk_state *state = statev;
+  struct walk_dir dir;
+
+  pthread_mutex_lock (&state->lock);
+  for (;;) {
+    while (state->nr_stack == 0 && state->active > 0 && !state->failed)
+      pthread_cond_wait (&state->cond, &state->lock);
+    if (state->failed || state->nr_stack == 0)
+      break;
+
+    dir = state->stack[--state->nr_stack];
+    state->active++;
+    pthread_mutex_unlock (&state->lock);
+
+    if (walk_one_dir (state, &dir) == -1)
+      set_failed (state, errno);
+    free (dir.path);
+
+    pthread_mutex_lock (&state->lock);
+    state->active--;
+    if (state->active == 0 && state->nr_stack == 0)
+      pthread_cond_broadcast (&state->cond);
+  }
+  pthread_mutex_unlock (&state->lock);
+
+  return NULL;
+}
+
+/**
+ * Walk the directory tree rooted at C<dir> (a path in the
+ * appliance, so usually the result of C<sysroot_path>), calling
+ * C<cb> once for every entry below C<dir>.  The top directory itself
+ * is not passed to the callback.  Symbolic links are never followed,
+ * except that C<dir> itself may be a link to a directory.
+ *
+ * C<flags> may contain C<WALK_FLAG_STAT> to make the walker
+ * L<lstat(2)> every entry and fill in C<entry-E<gt>statbuf>.  Without
+ * it, C<statbuf> is only set for entries where the filesystem did not
+ * supply C<d_type>.
+ *
+ * The callback returns C<0> to continue, C<WALK_PRUNE> to avoid
+ * descending into a directory, or C<-1> to stop the walk.
+ *
+ * If C<nr_threads> is greater than 1, directories are read by that
+ * many threads in parallel and C<cb> may be called concurrently, so
+ * it must do its own locking around any shared state (including
+ * C<send_file_write>).  The order of entries is unspecified in that
+ * case.  C<nr_threads == 0> means use C<walk_default_threads ()>.
+ *
+ * Returns C<0> on success, or C<-1> if the walk was stopped by the
+ * callback or failed.  This function does not call C<reply_with_*>
+ * because callers often use it after sending the reply, however
+ * C<errno> is set.
+ */
+int
+walk_tree (const char *dir, unsigned flags, size_t nr_threads,
+           walk_cb cb, void *opaque)
+{
+  struct walk_state state = {
+    .flags = flags, .cb = cb, .opaque = opaque,
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .cond = PTHREAD_COND_INITIALIZER,
+  };
+  pthread_t threads[MAX_WALK_THREADS];
+  size_t i, nr_started = 0;
+  sigset_t mask, oldmask;
+  struct walk_dir top;
+  int err;
+
+  if (nr_threads == 0)
+    nr_threads = walk_default_threads ();
+  if (nr_threads > MAX_WALK_THREADS)
+    nr_threads = MAX_WALK_THREADS;
+
+  state.rootfd = open (dir, O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+  if (state.rootfd == -1)
+    return -1;
+
+  top.path = strdup ("");
+  top.depth = 1;
+  if (top.path == NULL || push_dirs (&state, &top, 1) == -1) {
+    err = errno;
+    free (top.path);
+    close (state.rootfd);
+    errno = err;
+    return -1;
+  }
+
+  /* Extra threads must not receive signals meant for the main
+   * thread, such as the SIGALRM used by pulse mode.
+   */
+  sigfillset (&mask);
+  pthread_sigmask (SIG_SETMASK, &mask, &oldmask);
+  for (i = 1; i < nr_threads; ++i) {
+    err = pthread_create (&threads[nr_started], NULL, walk_worker, &state);
+    if (err != 0) {
+      fprintf (stderr, "walk: pthread_create: %s\n", strerror (err));
+      break;
+    }
+    nr_started++;
+  }
+  pthread_sigmask (SIG_SETMASK, &oldmask, NULL);
+
+  /* The calling thread also does work. */
+  walk_worker (&state);
+
+  for (i = 0; i < nr_started; ++i)
+    pthread_join (threads[i], NULL);
+
+  for (i = 0; i < state.nr_stack; ++i)
+    free (state.stack[i].path);
+  free (state.stack);
+  close (state.rootfd);
+  pthread_mutex_destroy (&state.lock);
+  pthread_cond_destroy (&state.cond);
+
+  if (state.failed) {
+    errno = state.saved_errno;
+    return -1;
+  }
+  return 0;
+}
+
+/* Growable buffer used to build a single walk_out record. */
+struct record {
+  char *buf;
+  size_t len, alloc;
+};
+
+static int
+record_add (struct record *rec, const void *data, size_t len)
+{
+  if (rec->len + len > rec->alloc) {
+    size_t new_alloc = rec->alloc * 2 + len + 256;
+    char *p = realloc (rec->buf, new_alloc);
+
+    if (p == NULL)
+      return -1;
+    rec->buf = p;
+    rec->alloc = new_alloc;
+  }
+  memcpy (&rec->buf[rec->len], data, len);
+  rec->len += len;
+  return 0;
+}
+
+/* Add a \0-terminated string field. */
+static int
+record_add_string (struct record *rec, const char *str)
+{
+  return record_add (rec, str, strlen (str) + 1);
+}
+
+static int
+record_add_stat (struct record *rec, const struct stat *statbuf)
+{
+  char str[22 * 16];
+  int64_t blksize, blocks, atime_nsec, mtime_nsec, ctime_nsec;
+
+#ifdef HAVE_STRUCT_STAT_ST_BLKSIZE
+  blksize = statbuf->st_blksize;
+#else
+  blksize = -1;
+#endif
+#ifdef HAVE_STRUCT_STAT_ST_BLOCKS
+  blocks = statbuf->st_blocks;
+#else
+  blocks = -1;
+#endif
+#ifdef HAVE_STRUCT_STAT_ST_ATIM_TV_NSEC
+  atime_nsec = statbuf->st_atim.tv_nsec;
+#else
+  atime_nsec = 0;
+#endif
+#ifdef HAVE_STRUCT_STAT_ST_MTIM_TV_NSEC
+  mtime_nsec = statbuf->st_mtim.tv_nsec;
+#else
+  mtime_nsec = 0;
+#endif
+#ifdef HAVE_STRUCT_STAT_ST_CTIM_TV_NSEC
+  ctime_nsec = statbuf->st_ctim.tv_nsec;
+#else
+  ctime_nsec = 0;
+#endif
+
+  snprintf (str, sizeof str,
+            "%" PRIi64 " %" PRIi64 " %" PRIi64 " %" PRIi64
+            " %" PRIi64 " %" PRIi64 " %" PRIi64 " %" PRIi64
+            " %" PRIi64 " %" PRIi64 " %" PRIi64 " %" PRIi64
+            " %" PRIi64 " %" PRIi64 " %" PRIi64 " %" PRIi64,
+            (int64_t) statbuf->st_dev, (int64_t) statbuf->st_ino,
+            (int64_t) statbuf->st_mode, (int64_t) statbuf->st_nlink,
+            (int64_t) statbuf->st_uid, (int64_t) statbuf->st_gid,
+            (int64_t) statbuf->st_rdev, (int64_t) statbuf->st_size,
+            blksize, blocks,
+            (int64_t) statbuf->st_atime, atime_nsec,
+            (int64_t) statbuf->st_mtime, mtime_nsec,
+            (int64_t) statbuf->st_ctime, ctime_nsec);
+  return record_add_string (rec, str);
+}
+
+/* Add the symlink target field. */
+static int
+record_add_link (struct record *rec, int dirfd, const char *name,
+                 const struct stat *statbuf)
+{
+  CLEANUP_FREE char *link = NULL;
+  size_t size;
+  ssize_t r;
+
+  if (!S_ISLNK (statbuf->st_mode))
+    return record_add_string (rec, "");
+
+  size = statbuf->st_size > 0 ? statbuf->st_size + 1 : PATH_MAX;
+  link = malloc (size);
+  if (link == NULL)
+    return -1;
+  r = readlinkat (dirfd, name, link, size - 1);
+  if (r == -1)
+    return -1;
+  link[r] = '\0';
+  return record_add_string (rec, link);
+}
+
+/* Add the xattrs fields. */
+static int
+record_add_xattrs (struct record *rec, const char *path)
+{
+  char str[32];
+#ifdef WALK_XATTRS
+  CLEANUP_FREE char *names = NULL;
+  CLEANUP_FREE char *val = NULL;
+  ssize_t len, vlen;
+  size_t i, count = 0;
+
+  len = llistxattr (path, NULL, 0);
+  if (len == -1) {
+    if (errno == ENOTSUP)
+      len = 0;
+    else
+      return -1;
+  }
+  if (len > 0) {
+    names = malloc (len);
+    if (names == NULL)
+      return -1;
+    len = llistxattr (path, names, len);
+    if (len == -1)
+      return -1;
+  }
+
+  for (i = 0; i < (size_t) len; i += strlen (&names[i]) + 1)
+    count++;
+  snprintf (str, sizeof str, "%zu", count);
+  if (record_add_string (rec, str) == -1)
+    return -1;
+
+  for (i = 0; i < (size_t) len; i += strlen (&names[i]) + 1) {
+    vlen = lgetxattr (path, &names[i], NULL, 0);
+    if (vlen == -1)
+      return -1;
+    free (val);
+    val = malloc (vlen + 1);
+    if (val == NULL)
+      return -1;
+    vlen = lgetxattr (path, &names[i], val, vlen);
+    if (vlen == -1)
+      return -1;
+
+    snprintf (str, sizeof str, "%zd", vlen);
+    if (record_add_string (rec, &names[i]) == -1 ||
+        record_add_string (rec, str) == -1 ||
+        record_add (rec, val, vlen) == -1)
+      return -1;
+  }
+
+  return 0;
+#else
+  snprintf (str, sizeof str, "%d", 0);
+  return record_add_string (rec, str);
+#endif
+}
+
+struct walk_out_data {
+  const char *sysrootdir;       /* Directory in the appliance. */
+  const char *dir;              /* Directory as passed by the caller. */
+  int maxdepth;                 /* -1 = unlimited */
+  const char *types;            /* NULL = all types */
+  int64_t minsize, maxsize, newer;
+  pthread_mutex_t lock;         /* Protects the fields below. */
+  struct send_buffer sb;
+  int send_error;
+};
+
+static int
+walk_out_match (const struct walk_out_data *data, const struct stat *statbuf)
+{
+  if (data->types) {
+    int c;
+
+    switch (statbuf->st_mode & S_IFMT) {
+    case S_IFBLK: c = 'b'; break;
+    case S_IFCHR: c = 'c'; break;
+    case S_IFDIR: c = 'd'; break;
+    case S_IFREG: c = 'f'; break;
+    case S_IFLNK: c = 'l'; break;
+    case S_IFIFO: c = 'p'; break;
+    case S_IFSOCK: c = 's'; break;
+    default: return 0;
+    }
+    if (strchr (data->types, c) == NULL)
+      return 0;
+  }
+  if (statbuf->st_size < data->minsize)
+    return 0;
+  if (data->maxsize >= 0 && statbuf->st_size > data->maxsize)
+    return 0;
+  if (statbuf->st_mtime <= data->newer)
+    return 0;
+  return 1;
+}
+
+/* Build and send the record for one file.  'relpath' is relative to
+ * the top directory, or "" for the top directory itself.
+ */
+static int
+walk_out_send (struct walk_out_data *data, const char *relpath,
+               int dirfd, const char *name, const struct stat *statbuf)
+{
+  struct record rec = { .buf = NULL, .len = 0, .alloc = 0 };
+  CLEANUP_FREE char *path = NULL, *fullpath = NULL;
+  size_t dirlen = strlen (data->dir);
+  const char *sep;
+  int r;
+
+  if (!walk_out_match (data, statbuf))
+    return 0;
+
+  sep = relpath[0] == '\0' || data->dir[dirlen-1] == '/' ? "" : "/";
+  if (asprintf (&path, "%s%s%s", data->dir, sep, relpath) == -1 ||
+      asprintf (&fullpath, "%s%s%s", data->sysrootdir, sep, relpath) == -1) {
+    perror ("asprintf");
+    return -1;
+  }
+
+  if (record_add_string (&rec, path) == -1 ||
+      record_add_stat (&rec, statbuf) == -1 ||
+      record_add_link (&rec, dirfd, name, statbuf) == -1 ||
+      record_add_xattrs (&rec, fullpath) == -1) {
+    fprintf (stderr, "walk_out: %s: %m\n", path);
+    free (rec.buf);
+    return -1;
+  }
+
+  pthread_mutex_lock (&data->lock);
+  r = send_buffer_write (&data->sb, rec.buf, rec.len);
+  if (r < 0)
+    data->send_error = 1;
+  pthread_mutex_unlock (&data->lock);
+  free (rec.buf);
+
+  return r < 0 ? -1 : 0;
+}
+
+static int
+walk_out_entry (const struct walk_entry *entry, void *datav)
+{
+  struct walk_out_data *data = datav;
+
+  if (data->maxdepth >= 0 && entry->depth > (size_t) data->maxdepth)
+    return WALK_PRUNE;
+
+  if (walk_out_send (data, entry->path, entry->dirfd, entry->name,
+                     entry->statbuf) == -1)
+    return -1;
+
+  if (data->maxdepth >= 0 && entry->depth == (size_t) data->maxdepth)
+    return WALK_PRUNE;
+  return 0;
+}
+
+/* Has one FileOut parameter. */
+int
+do_walk_out (const char *dir, int maxdepth, const char *types,
+             int64_t minsize, int64_t maxsize, int64_t newer)
+{
+  struct stat statbuf;
+  int r;
+  CLEANUP_FREE char *sysrootdir = NULL;
+  struct walk_out_data data = {
+    .dir = dir,
+    .maxdepth = -1, .types = NULL, .minsize = 0, .maxsize = -1,
+    .newer = INT64_MIN,
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .sb = { .buf = NULL, .len = 0 },
+  };
+
+  if (optargs_bitmask & GUESTFS_WALK_OUT_MAXDEPTH_BITMASK) {
+    if (maxdepth < 0) {
+      reply_with_error ("maxdepth cannot be negative");
+      return -1;
+    }
+    data.maxdepth = maxdepth;
+  }
+  if (optargs_bitmask & GUESTFS_WALK_OUT_TYPES_BITMASK) {
+    if (types[strspn (types, "bcdflps")] != '\0') {
+      reply_with_error ("types: unknown type in '%s', expecting one or more of 'bcdflps'",
+                        types);
+      return -1;
+    }
+    data.types = types;
+  }
+  if (optargs_bitmask & GUESTFS_WALK_OUT_MINSIZE_BITMASK)
+    data.minsize = minsize;
+  if (optargs_bitmask & GUESTFS_WALK_OUT_MAXSIZE_BITMASK)
+    data.maxsize = maxsize;
+  if (optargs_bitmask & GUESTFS_WALK_OUT_NEWER_BITMASK)
+    data.newer = newer;
+
+  sysrootdir = sysroot_path (dir);
+  if (!sysrootdir) {
+    reply_with_perror ("malloc");
+    return -1;
+  }
+  data.sysrootdir = sysrootdir;
+
+  r = lstat (sysrootdir, &statbuf);
+  if (r == -1) {
+    reply_with_perror ("%s", dir);
+    return -1;
+  }
+  if (!S_ISDIR (statbuf.st_mode)) {
+    reply_with_error ("%s: not a directory", dir);
+    return -1;
+  }
+
+  /* Now we must send the reply message, before the file contents.  After
+   * this there is no opportunity in the protocol to send any error
+   * message back.  Instead we can only cancel the transfer.
+   */
+  reply (NULL, NULL);
+
+  /* The top directory itself.  readlinkat is never called for it. */
+  r = walk_out_send (&data, "", AT_FDCWD, sysrootdir, &statbuf);
+  if (r == 0 && data.maxdepth != 0)
+    r = walk_tree (sysrootdir, WALK_FLAG_STAT, 0, walk_out_entry, &data);
+  if (r == 0)
+    r = send_buffer_flush (&data.sb);
+  free_send_buffer (&data.sb);
+  pthread_mutex_destroy (&data.lock);
+
+  if (r < 0) {
+    if (!data.send_error) {
+      fprintf (stderr, "walk_out: %s: %m\n", dir);
+      send_file_end (1);              /* Cancel. */
+    }
+    return -1;
+  }
+
+  if (send_file_end (0))        /* Normal end of file. */
+    return -1;
+
+  return 0;
+}
@@ -487,6 +487,8 @@ do_xfs_admin (const char *device,
   const char *argv[MAX_ARGS];
   size_t i = 0;
 
+  invalidate_device_caches ();
+
   ADD_ARG (argv, i, str_xfs_admin);
 
   /* Optional arguments */
@@ -43,6 +43,8 @@ do_zero (const char *device)
   int fd;
   size_t i, offset;
 
+  invalidate_device_caches ();
+
   fd = open (device, O_RDWR|O_CLOEXEC);
   if (fd == -1) {
     reply_with_perror ("%s", device);
@@ -125,6 +127,8 @@ do_wipefs (const char *device)
   ADD_ARG (argv, i, device);
   ADD_ARG (argv, i, NULL);
 
+  invalidate_device_caches ();
+
   r = commandv (NULL, &err, argv);
   if (r == -1) {
     reply_with_error ("%s", err);
@@ -142,6 +146,8 @@ do_zero_device (const char *device)
     return -1;
   uint64_t size = (uint64_t) ssize;
 
+  invalidate_device_caches ();
+
   int fd = open (device, O_RDWR|O_CLOEXEC);
   if (fd == -1) {
     reply_with_perror ("%s", device);
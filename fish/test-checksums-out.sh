@@ -0,0 +1,50 @@
+#!/bin/bash -
+# libguestfs
+# Copyright (C) 2016 Red Hat Inc.
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+# Test checksums-out call, comparing the output against the
+# coreutils programs run on the host.
+
+set -e
+
+rm -f test-checksums-out-*.out
+
+$VG guestfish <<'EOF'
+add-ro ../test-data/test.iso
+run
+mount-ro /dev/sda /
+checksums-out crc / test-checksums-out-crc.out
+checksums-out md5 / test-checksums-out-md5.out
+checksums-out sha256 / test-checksums-out-sha256.out
+EOF
+
+for f in known-1 known-2 known-3 known-4 known-5; do
+    for t in crc md5 sha256; do
+        case $t in
+            crc) prog=cksum ;;
+            *) prog=${t}sum ;;
+        esac
+        expected="$(cd ../test-data/files && $prog ./$f)"
+        grep -Fqx "$expected" test-checksums-out-$t.out || {
+            echo "checksums-out $t: expected line '$expected' not found"
+            cat test-checksums-out-$t.out
+            exit 1
+        }
+    done
+done
+
+rm -f test-checksums-out-*.out
@@ -35,6 +35,7 @@ let defaults = { name = "";
                  progress = false; camel_name = "";
                  cancellable = false; config_only = false;
                  once_had_no_optargs = false; blocking = true; wrapper = true;
+                 read_only = false;
                  c_name = ""; c_function = ""; c_optarg_prefix = "";
                  non_c_aliases = [] }
 
@@ -3126,7 +3127,11 @@ child processes don't receive the C<^C> signal).
 
 In a graphical program, when the main thread is displaying a progress
 bar with a cancel button, wire up the cancel button to call this
-function." };
+function.
+
+A few long-running calls which don't transfer a file, such as
+C<guestfs_trim_filesystems>, can also be cancelled.  The cancellation
+is passed to the daemon when the next progress message arrives." };
 
   { defaults with
     name = "set_program"; added = (1, 21, 29);
@@ -3551,6 +3556,84 @@ The environment variable C<XDG_RUNTIME_DIR> controls the default
 value: If C<XDG_RUNTIME_DIR> is set, then that is the default.
 Else F</tmp> is the default." };
 
+  { defaults with
+    name = "set_inspect_cache"; added = (1, 33, 33);
+    style = RErr, [Bool "inspectcache"], [];
+    blocking = false;
+    shortdesc = "enable or disable the persistent inspection cache";
+    longdesc = "\
+If C<inspectcache> is true, C<guestfs_inspect_os> saves its results
+in the cache directory (see C<guestfs_set_cachedir>), and a later
+C<guestfs_inspect_os> on the same disk images loads them from there
+instead of mounting and examining each filesystem again.
+
+Disk images are identified by their path, inode number, size and
+modification time, and the same for each file in their qcow2
+backing chain.  The cache is only used if every drive is a local
+file which was added read-only, and the drive is not a qcow2 file
+with the dirty bit set.  Any other changes to the disks, or to the
+way the drives are added, mean that the disks are inspected again.
+
+Only the results of C<guestfs_inspect_os> itself are cached.
+Calls such as C<guestfs_inspect_list_applications2> and
+C<guestfs_inspect_get_icon> still read the disks.
+
+The default is false.  It can also be enabled by setting the
+environment variable C<LIBGUESTFS_INSPECT_CACHE=1>.
+
+See also L<guestfs(3)/INSPECTION>." };
+
+  { defaults with
+    name = "get_inspect_cache"; added = (1, 33, 33);
+    style = RBool "inspectcache", [], [];
+    blocking = false;
+    shortdesc = "get the persistent inspection cache flag";
+    longdesc = "\
+This returns the flag set by C<guestfs_set_inspect_cache>." };
+
+  { defaults with
+    name = "set_inspect_workers"; added = (1, 33, 33);
+    style = RErr, [Int "workers"], [];
+    blocking = false;
+    shortdesc = "set the number of appliances used for inspection";
+    longdesc = "\
+Set the maximum number of appliances that C<guestfs_inspect_os>
+may use to examine filesystems at the same time.
+
+When this is greater than 1, C<guestfs_inspect_os> starts up to
+C<workers - 1> extra appliances (in separate threads) on the same
+disks, and shares the filesystems out between them and the main
+appliance.  This speeds up inspection of guests with many
+filesystems, at the cost of the memory used by the extra
+appliances.  The extra appliances are shut down again before
+C<guestfs_inspect_os> returns.  The results are the same as
+inspecting the filesystems one at a time.
+
+The extra appliances are only used if every drive is a local file
+which was added read-only.  An extra appliance is also not used if
+it does not see the same filesystems as this handle, for example
+because encrypted devices were opened with C<guestfs_luks_open>
+before inspection.  Otherwise, or if the extra appliances cannot be
+started, the filesystems are inspected using this handle alone.  No
+more than 16 appliances are used.
+
+The default is 1.  It can also be set using the environment
+variable C<LIBGUESTFS_INSPECT_WORKERS>.
+
+See also L<guestfs(3)/INSPECTION>." };
+
+  { defaults with
+    name = "get_inspect_workers"; added = (1, 33, 33);
+    style = RInt "workers", [], [];
+    blocking = false;
+    tests = [
+      InitNone, Always, TestResult (
+        [["get_inspect_workers"]], "ret == 1"), []
+    ];
+    shortdesc = "get the number of appliances used for inspection";
+    longdesc = "\
+This returns the number set by C<guestfs_set_inspect_workers>." };
+
 ]
 
 (* daemon_functions are any functions which cause some action
@@ -3561,7 +3644,7 @@ let daemon_functions = [
   { defaults with
     name = "mount"; added = (0, 0, 3);
     style = RErr, [Mountable "mountable"; String "mountpoint"], [];
-    proc_nr = Some 1;
+    proc_nr = Some 1; read_only = true;
     tests = [
       InitEmpty, Always, TestResultString (
         [["part_disk"; "/dev/sda"; "mbr"];
@@ -3643,7 +3726,7 @@ is I<not> intended that you try to parse the output string." };
   { defaults with
     name = "list_devices"; added = (0, 0, 4);
     style = RStringList "devices", [], [];
-    proc_nr = Some 7;
+    proc_nr = Some 7; read_only = true;
     tests = [
       InitEmpty, Always, TestResult (
         [["list_devices"]],
@@ -3660,7 +3743,7 @@ See also C<guestfs_list_filesystems>." };
   { defaults with
     name = "list_partitions"; added = (0, 0, 4);
     style = RStringList "partitions", [], [];
-    proc_nr = Some 8;
+    proc_nr = Some 8; read_only = true;
     tests = [
       InitBasicFS, Always, TestResult (
         [["list_partitions"]],
@@ -3687,7 +3770,7 @@ See also C<guestfs_list_filesystems>." };
   { defaults with
     name = "pvs"; added = (0, 0, 4);
     style = RStringList "physvols", [], [];
-    proc_nr = Some 9;
+    proc_nr = Some 9; read_only = true;
     optional = Some "lvm2";
     tests = [
       InitBasicFSonLVM, Always, TestResult (
@@ -3716,7 +3799,7 @@ See also C<guestfs_pvs_full>." };
   { defaults with
     name = "vgs"; added = (0, 0, 4);
     style = RStringList "volgroups", [], [];
-    proc_nr = Some 10;
+    proc_nr = Some 10; read_only = true;
     optional = Some "lvm2";
     tests = [
       InitBasicFSonLVM, Always, TestResult (
@@ -3747,7 +3830,7 @@ See also C<guestfs_vgs_full>." };
   { defaults with
     name = "lvs"; added = (0, 0, 4);
     style = RStringList "logvols", [], [];
-    proc_nr = Some 11;
+    proc_nr = Some 11; read_only = true;
     optional = Some "lvm2";
     tests = [
       InitBasicFSonLVM, Always, TestResult (
@@ -3812,7 +3895,7 @@ of the L<lvs(8)> command.  The \"full\" version includes all fields." };
   { defaults with
     name = "aug_init"; added = (0, 0, 7);
     style = RErr, [Pathname "root"; Int "flags"], [];
-    proc_nr = Some 16;
+    proc_nr = Some 16; read_only = true;
     tests = [
       InitBasicFS, Always, TestResultString (
         [["mkdir"; "/etc"];
@@ -3877,7 +3960,7 @@ To find out more about Augeas, see L<http://augeas.net/>." };
   { defaults with
     name = "aug_close"; added = (0, 0, 7);
     style = RErr, [], [];
-    proc_nr = Some 26;
+    proc_nr = Some 26; read_only = true;
     shortdesc = "close the current Augeas handle";
     longdesc = "\
 Close the current Augeas handle and free up any resources
@@ -3918,7 +4001,7 @@ if a node was created." };
   { defaults with
     name = "aug_get"; added = (0, 0, 7);
     style = RString "val", [String "augpath"], [];
-    proc_nr = Some 19;
+    proc_nr = Some 19; read_only = true;
     shortdesc = "look up the value of an Augeas path";
     longdesc = "\
 Look up the value associated with C<path>.  If C<path>
@@ -3975,7 +4058,7 @@ with a bracketed index C<[N]>." };
   { defaults with
     name = "aug_rm"; added = (0, 0, 7);
     style = RInt "nrnodes", [String "augpath"], [];
-    proc_nr = Some 22;
+    proc_nr = Some 22; read_only = true;
     shortdesc = "remove an Augeas path";
     longdesc = "\
 Remove C<path> and all of its children.
@@ -3994,7 +4077,7 @@ one node.  C<dest> is overwritten if it exists." };
   { defaults with
     name = "aug_match"; added = (0, 0, 7);
     style = RStringList "matches", [String "augpath"], [];
-    proc_nr = Some 24;
+    proc_nr = Some 24; read_only = true;
     shortdesc = "return Augeas nodes which match augpath";
     longdesc = "\
 Returns a list of paths which match the path expression C<path>.
@@ -4015,11 +4098,16 @@ how files are saved." };
   { defaults with
     name = "aug_load"; added = (0, 0, 7);
     style = RErr, [], [];
-    proc_nr = Some 27;
+    proc_nr = Some 27; read_only = true;
     shortdesc = "load files into the tree";
     longdesc = "\
 Load files into the tree.
 
+Files which have already been loaded are only parsed again if they
+have changed since they were loaded (or last saved).
+
+See also C<guestfs_aug_init_files>.
+
 See C<aug_load> in the Augeas documentation for the full gory
 details." };
 
@@ -4168,7 +4256,7 @@ yourself (Augeas support makes this relatively easy)." };
   { defaults with
     name = "exists"; added = (0, 0, 8);
     style = RBool "existsflag", [Pathname "path"], [];
-    proc_nr = Some 36;
+    proc_nr = Some 36; read_only = true;
     tests = [
       InitISOFS, Always, TestResultTrue (
         [["exists"; "/empty"]]), [];
@@ -4185,7 +4273,7 @@ See also C<guestfs_is_file>, C<guestfs_is_dir>, C<guestfs_stat>." };
   { defaults with
     name = "is_file"; added = (0, 0, 8);
     style = RBool "fileflag", [Pathname "path"], [OBool "followsymlinks"];
-    proc_nr = Some 37;
+    proc_nr = Some 37; read_only = true;
     once_had_no_optargs = true;
     tests = [
       InitISOFS, Always, TestResultTrue (
@@ -4210,7 +4298,7 @@ See also C<guestfs_stat>." };
   { defaults with
     name = "is_dir"; added = (0, 0, 8);
     style = RBool "dirflag", [Pathname "path"], [OBool "followsymlinks"];
-    proc_nr = Some 38;
+    proc_nr = Some 38; read_only = true;
     once_had_no_optargs = true;
     tests = [
       InitISOFS, Always, TestResultFalse (
@@ -4373,7 +4461,7 @@ characters does I<not> work, even if the length is specified." };
   { defaults with
     name = "umount"; added = (0, 0, 8);
     style = RErr, [Dev_or_Path "pathordevice"], [OBool "force"; OBool "lazyunmount"];
-    proc_nr = Some 45;
+    proc_nr = Some 45; read_only = true;
     fish_alias = ["unmount"];
     once_had_no_optargs = true;
     tests = [
@@ -4398,7 +4486,7 @@ contains the filesystem." };
   { defaults with
     name = "mounts"; added = (0, 0, 8);
     style = RStringList "devices", [], [];
-    proc_nr = Some 46;
+    proc_nr = Some 46; read_only = true;
     tests = [
       InitScratchFS, Always, TestResult (
         [["mounts"]], "is_device_list (ret, 1, \"/dev/sdb1\")"), []
@@ -4415,7 +4503,7 @@ See also: C<guestfs_mountpoints>" };
   { defaults with
     name = "umount_all"; added = (0, 0, 8);
     style = RErr, [], [];
-    proc_nr = Some 47;
+    proc_nr = Some 47; read_only = true;
     fish_alias = ["unmount-all"];
     tests = [
       InitScratchFS, Always, TestResult (
@@ -4458,7 +4546,7 @@ and physical volumes." };
   { defaults with
     name = "file"; added = (1, 9, 1);
     style = RString "description", [Dev_or_Path "path"], [];
-    proc_nr = Some 49;
+    proc_nr = Some 49; read_only = true;
     tests = [
       InitISOFS, Always, TestResultString (
         [["file"; "/empty"]], "empty"), [];
@@ -4895,7 +4983,7 @@ See also C<guestfs_download>." };
   { defaults with
     name = "download"; added = (1, 0, 2);
     style = RErr, [Dev_or_Path "remotefilename"; FileOut "filename"], [];
-    proc_nr = Some 67;
+    proc_nr = Some 67; read_only = true;
     progress = true; cancellable = true;
     tests = [
       InitScratchFS, Always, TestResultString (
@@ -4919,7 +5007,7 @@ See also C<guestfs_upload>, C<guestfs_cat>." };
   { defaults with
     name = "checksum"; added = (1, 0, 2);
     style = RString "checksum", [String "csumtype"; Pathname "path"], [];
-    proc_nr = Some 68;
+    proc_nr = Some 68; read_only = true;
     tests = [
       InitISOFS, Always, TestResultString (
         [["checksum"; "crc"; "/known-3"]], "2891671662"), [];
@@ -5006,7 +5094,28 @@ To get the checksums for many files, use C<guestfs_checksums_out>." };
       InitScratchFS, IfAvailable "xz", TestResultString (
         [["mkdir"; "/tar_in_xz"];
          ["tar_in"; "$srcdir/../../test-data/files/helloworld.tar.xz"; "/tar_in_xz"; "xz"; ""; ""; ""];
-         ["cat"; "/tar_in_xz/hello"]], "hello\n"), []
+         ["cat"; "/tar_in_xz/hello"]], "hello\n"), [];
+      InitScratchFS, Always, TestResultString (
+        [["mkdir"; "/tar_in_zstd"];
+         ["tar_in"; "$srcdir/../../test-data/files/helloworld.tar.zst"; "/tar_in_zstd"; "zstd"; ""; ""; ""];
+         ["cat"; "/tar_in_zstd/hello"]], "hello\n"), [];
+      (* Input from parallel compressors: several xz blocks which
+       * record their sizes, and several zstd frames.
+       *)
+      InitScratchFS, IfAvailable "xz", TestResultString (
+        [["mkdir"; "/tar_in_xz_blocks"];
+         ["tar_in"; "$srcdir/../../test-data/files/helloworld-blocks.tar.xz"; "/tar_in_xz_blocks"; "xz"; ""; ""; ""];
+         ["cat"; "/tar_in_xz_blocks/world"]], "world\n"), [];
+      InitScratchFS, Always, TestResultString (
+        [["mkdir"; "/tar_in_zstd_frames"];
+         ["tar_in"; "$srcdir/../../test-data/files/helloworld-frames.tar.zst"; "/tar_in_zstd_frames"; "zstd"; ""; ""; ""];
+         ["cat"; "/tar_in_zstd_frames/world"]], "world\n"), [];
+      InitScratchFS, IfAvailable "xz", TestLastFail (
+        [["mkdir"; "/tar_in_xz_corrupt"];
+         ["tar_in"; "$srcdir/../../test-data/files/helloworld-corrupt.tar.xz"; "/tar_in_xz_corrupt"; "xz"; ""; ""; ""]]), [];
+      InitScratchFS, Always, TestLastFail (
+        [["mkdir"; "/tar_in_zstd_truncated"];
+         ["tar_in"; "$srcdir/../../test-data/files/helloworld-truncated.tar.zst"; "/tar_in_zstd_truncated"; "zstd"; ""; ""; ""]]), []
     ];
     shortdesc = "unpack tarfile to directory";
     longdesc = "\
@@ -5015,10 +5124,16 @@ This command uploads and unpacks local file C<tarfile> into F<directory>.
 The optional C<compress> flag controls compression.  If not given,
 then the input should be an uncompressed tar file.  Otherwise one
 of the following strings may be given to select the compression
-type of the input file: C<compress>, C<gzip>, C<bzip2>, C<xz>, C<lzop>.
+type of the input file: C<compress>, C<gzip>, C<bzip2>, C<xz>, C<lzop>,
+C<zstd>.
 (Note that not all builds of libguestfs will support all of these
 compression types).
 
+If the appliance has more than one vCPU (see C<guestfs_set_smp>)
+then C<xz> and C<zstd> input is decompressed using one thread per
+vCPU.  This only helps if the input was compressed in independent
+blocks, as done by C<xz -T> or C<pzstd>.
+
 The other optional arguments are:
 
 =over 4
@@ -5043,6 +5158,16 @@ If set to true, POSIX ACLs are restored from the tar file.
     proc_nr = Some 70;
     once_had_no_optargs = true;
     cancellable = true;
+    tests = [
+      InitScratchFS, Always, TestResultString (
+        [["mkdir"; "/tar_out_zstd"];
+         ["mkdir"; "/tar_out_zstd/in"];
+         ["mkdir"; "/tar_out_zstd/out"];
+         ["write"; "/tar_out_zstd/in/hello"; "hello\n"];
+         ["tar_out"; "/tar_out_zstd/in"; "testdownload.tmp"; "zstd"; ""; "NOARG"; ""; ""; ""];
+         ["tar_in"; "testdownload.tmp"; "/tar_out_zstd/out"; "zstd"; ""; ""; ""];
+         ["cat"; "/tar_out_zstd/out/hello"]], "hello\n"), []
+    ];
     shortdesc = "pack directory into tarfile";
     longdesc = "\
 This command packs the contents of F<directory> and downloads
@@ -5051,10 +5176,17 @@ it to local file C<tarfile>.
 The optional C<compress> flag controls compression.  If not given,
 then the output will be an uncompressed tar file.  Otherwise one
 of the following strings may be given to select the compression
-type of the output file: C<compress>, C<gzip>, C<bzip2>, C<xz>, C<lzop>.
+type of the output file: C<compress>, C<gzip>, C<bzip2>, C<xz>, C<lzop>,
+C<zstd>.
 (Note that not all builds of libguestfs will support all of these
 compression types).
 
+If the appliance has more than one vCPU (see C<guestfs_set_smp>)
+then C<gzip>, C<bzip2>, C<xz> and C<zstd> compression runs in
+parallel using one thread per vCPU, where the appliance has a
+suitable compression program.  The output can be read by the
+ordinary single-threaded decompressor.
+
 The other optional arguments are:
 
 =over 4
@@ -5114,7 +5246,7 @@ it to local file C<tarball>." };
   { defaults with
     name = "mount_ro"; added = (1, 0, 10);
     style = RErr, [Mountable "mountable"; String "mountpoint"], [];
-    proc_nr = Some 73;
+    proc_nr = Some 73; read_only = true;
     tests = [
       InitBasicFS, Always, TestLastFail (
         [["umount"; "/"; "false"; "false"];
@@ -5134,7 +5266,7 @@ mounts the filesystem with the read-only (I<-o ro>) flag." };
   { defaults with
     name = "mount_options"; added = (1, 0, 10);
     style = RErr, [String "options"; Mountable "mountable"; String "mountpoint"], [];
-    proc_nr = Some 74;
+    proc_nr = Some 74; read_only = true;
     shortdesc = "mount a guest disk with mount options";
     longdesc = "\
 This is the same as the C<guestfs_mount> command, but it
@@ -5148,7 +5280,7 @@ the filesystem uses)." };
   { defaults with
     name = "mount_vfs"; added = (1, 0, 10);
     style = RErr, [String "options"; String "vfstype"; Mountable "mountable"; String "mountpoint"], [];
-    proc_nr = Some 75;
+    proc_nr = Some 75; read_only = true;
     shortdesc = "mount a guest disk with mount options and vfstype";
     longdesc = "\
 This is the same as the C<guestfs_mount> command, but it
@@ -6000,7 +6132,7 @@ See also: C<guestfs_command_lines>" };
      * hence no "."-relative names.
      *)
     style = RStringList "paths", [Pathname "pattern"], [OBool "directoryslash"];
-    proc_nr = Some 113;
+    proc_nr = Some 113; read_only = true;
     once_had_no_optargs = true;
     tests = [
       InitScratchFS, Always, TestResult (
@@ -6189,7 +6321,7 @@ C<wc -c> external command." };
   { defaults with
     name = "head"; added = (1, 0, 54);
     style = RStringList "lines", [Pathname "path"], [];
-    proc_nr = Some 121;
+    proc_nr = Some 121; read_only = true;
     protocol_limit_warning = true;
     tests = [
       InitISOFS, Always, TestResult (
@@ -6208,7 +6340,7 @@ a list of strings." };
   { defaults with
     name = "head_n"; added = (1, 0, 54);
     style = RStringList "lines", [Int "nrlines"; Pathname "path"], [];
-    proc_nr = Some 122;
+    proc_nr = Some 122; read_only = true;
     protocol_limit_warning = true;
     tests = [
       InitISOFS, Always, TestResult (
@@ -6310,8 +6442,8 @@ Use C<guestfs_statvfs> from programs." };
     ];
     shortdesc = "estimate file space usage";
     longdesc = "\
-This command runs the C<du -s> command to estimate file space
-usage for C<path>.
+This command estimates file space usage for C<path>, in the
+same way as the C<du -s> command.
 
 C<path> can be a file or a directory.  If C<path> is a directory
 then the estimate includes the contents of the directory and all
@@ -6327,7 +6459,13 @@ The result is the estimated size in I<kilobytes>
     tests = [
       InitISOFS, Always, TestResult (
         [["initrd_list"; "/initrd"]],
-        "is_string_list (ret, 6, \"empty\", \"known-1\", \"known-2\", \"known-3\", \"known-4\", \"known-5\")"), []
+        "is_string_list (ret, 6, \"empty\", \"known-1\", \"known-2\", \"known-3\", \"known-4\", \"known-5\")"), [];
+      InitISOFS, Always, TestResult (
+        [["initrd_list"; "/initrd-early"]],
+        "is_string_list (ret, 2, \"known-1\", \"known-4\")"), [];
+      InitISOFS, Always, TestResult (
+        [["initrd_list"; "/initrd-bzip2"]],
+        "is_string_list (ret, 2, \"known-1\", \"known-4\")"), []
     ];
     shortdesc = "list files in an initrd";
     longdesc = "\
@@ -6339,7 +6477,13 @@ alphabetical).  Directory names are listed as separate items.
 
 Old Linux kernels (2.4 and earlier) used a compressed ext2
 filesystem as initrd.  We I<only> support the newer initramfs
-format (compressed cpio files)." };
+format (compressed cpio files).
+
+Initrds made of several concatenated, separately compressed
+cpio archives, such as those containing early microcode updates,
+are supported, and the files in all of the archives are listed.
+The archives may be uncompressed or compressed with gzip, xz,
+lzma, zstd, bzip2 or lz4." };
 
   { defaults with
     name = "mount_loop"; added = (1, 0, 54);
@@ -6552,7 +6696,7 @@ This call returns the previous umask." };
   { defaults with
     name = "readdir"; added = (1, 0, 55);
     style = RStructList ("entries", "dirent"), [Pathname "dir"], [];
-    proc_nr = Some 138;
+    proc_nr = Some 138; read_only = true;
     protocol_limit_warning = true;
     shortdesc = "read directories entries";
     longdesc = "\
@@ -6721,7 +6865,7 @@ of the link itself." };
   { defaults with
     name = "mountpoints"; added = (1, 0, 62);
     style = RHashtable "mps", [], [];
-    proc_nr = Some 147;
+    proc_nr = Some 147; read_only = true;
     shortdesc = "show mountpoints";
     longdesc = "\
 This call is similar to C<guestfs_mounts>.  That call returns
@@ -6791,7 +6935,7 @@ for full details." };
   { defaults with
     name = "grep"; added = (1, 0, 66);
     style = RStringList "lines", [String "regex"; Pathname "path"], [OBool "extended"; OBool "fixed"; OBool "insensitive"; OBool "compressed"];
-    proc_nr = Some 151;
+    proc_nr = Some 151; read_only = true;
     protocol_limit_warning = true; once_had_no_optargs = true;
     tests = [
       InitISOFS, Always, TestResult (
@@ -7047,7 +7191,7 @@ matching lines." };
   { defaults with
     name = "realpath"; added = (1, 0, 66);
     style = RString "rpath", [Pathname "path"], [];
-    proc_nr = Some 163;
+    proc_nr = Some 163; read_only = true;
     tests = [
       InitISOFS, Always, TestResultString (
         [["realpath"; "/../directory"]], "/directory"), []
@@ -7124,7 +7268,7 @@ The I<-f> option removes the link (C<linkname>) if it exists already." };
   { defaults with
     name = "readlink"; added = (1, 0, 66);
     style = RString "link", [Pathname "path"], [];
-    proc_nr = Some 168;
+    proc_nr = Some 168; read_only = true;
     shortdesc = "read the target of a symbolic link";
     longdesc = "\
 This command reads the target of a symbolic link." };
@@ -7602,7 +7746,7 @@ See also C<guestfs_ping_daemon>." };
   { defaults with
     name = "find0"; added = (1, 0, 74);
     style = RErr, [Pathname "directory"; FileOut "files"], [];
-    proc_nr = Some 196;
+    proc_nr = Some 196; read_only = true;
     cancellable = true;
     test_excuse = "there is a regression test for this";
     shortdesc = "find all files and directories, returning NUL-separated list";
@@ -7634,7 +7778,7 @@ The result list is not sorted.
   { defaults with
     name = "case_sensitive_path"; added = (1, 0, 75);
     style = RString "rpath", [Pathname "path"], [];
-    proc_nr = Some 197;
+    proc_nr = Some 197; read_only = true;
     tests = [
       InitISOFS, Always, TestResultString (
         [["case_sensitive_path"; "/DIRECTORY"]], "/directory"), [];
@@ -7719,7 +7863,7 @@ See also C<guestfs_realpath>." };
   { defaults with
     name = "vfs_type"; added = (1, 0, 75);
     style = RString "fstype", [Mountable "mountable"], [];
-    proc_nr = Some 198;
+    proc_nr = Some 198; read_only = true;
     tests = [
       InitScratchFS, Always, TestResultString (
         [["vfs_type"; "/dev/sdb1"]], "ext2"), []
@@ -7858,7 +8002,7 @@ yourself (Augeas support makes this relatively easy)." };
   { defaults with
     name = "internal_lxattrlist"; added = (1, 19, 32);
     style = RStructList ("xattrs", "xattr"), [Pathname "path"; FilenameList "names"], [];
-    proc_nr = Some 205;
+    proc_nr = Some 205; read_only = true;
     visibility = VInternal;
     optional = Some "linuxxattrs";
     shortdesc = "lgetxattr on multiple files";
@@ -7888,7 +8032,7 @@ into smaller groups of names." };
   { defaults with
     name = "internal_readlinklist"; added = (1, 19, 32);
     style = RStringList "links", [Pathname "path"; FilenameList "names"], [];
-    proc_nr = Some 206;
+    proc_nr = Some 206; read_only = true;
     visibility = VInternal;
     shortdesc = "readlink on multiple files";
     longdesc = "\
@@ -7917,7 +8061,7 @@ into smaller groups of names." };
   { defaults with
     name = "pread"; added = (1, 0, 77);
     style = RBufferOut "content", [Pathname "path"; Int "count"; Int64 "offset"], [];
-    proc_nr = Some 207;
+    proc_nr = Some 207; read_only = true;
     protocol_limit_warning = true;
     tests = [
       InitISOFS, Always, TestResult (
@@ -8113,7 +8257,7 @@ table.  This works on C<gpt> but not on C<mbr> partitions." };
   { defaults with
     name = "part_list"; added = (1, 0, 78);
     style = RStructList ("partitions", "partition"), [Device "device"], [];
-    proc_nr = Some 213;
+    proc_nr = Some 213; read_only = true;
     tests = [] (* XXX Add a regression test for this. *);
     shortdesc = "list partitions on a device";
     longdesc = "\
@@ -8146,7 +8290,7 @@ Size of the partition in bytes.
   { defaults with
     name = "part_get_parttype"; added = (1, 0, 78);
     style = RString "parttype", [Device "device"], [];
-    proc_nr = Some 214;
+    proc_nr = Some 214; read_only = true;
     tests = [
       InitEmpty, Always, TestResultString (
         [["part_disk"; "/dev/sda"; "gpt"];
@@ -8212,7 +8356,7 @@ This command cannot do partial copies
   { defaults with
     name = "filesize"; added = (1, 0, 82);
     style = RInt64 "size", [Pathname "file"], [];
-    proc_nr = Some 218;
+    proc_nr = Some 218; read_only = true;
     tests = [
       InitScratchFS, Always, TestResult (
         [["write"; "/filesize"; "hello, world"];
@@ -8266,6 +8410,12 @@ Rename a volume group C<volgroup> with the new name C<newvolgroup>." };
     tests = [
       InitISOFS, Always, TestResult (
         [["initrd_cat"; "/initrd"; "known-4"]],
+        "compare_buffers (ret, size, \"abc\\ndef\\nghi\", 11) == 0"), [];
+      InitISOFS, Always, TestResult (
+        [["initrd_cat"; "/initrd-early"; "known-4"]],
+        "compare_buffers (ret, size, \"abc\\ndef\\nghi\", 11) == 0"), [];
+      InitISOFS, Always, TestResult (
+        [["initrd_cat"; "/initrd-bzip2"; "known-4"]],
         "compare_buffers (ret, size, \"abc\\ndef\\nghi\", 11) == 0"), []
     ];
     shortdesc = "list the contents of a single file in an initrd";
@@ -8454,7 +8604,7 @@ See also C<guestfs_part_set_bootable>." };
   { defaults with
     name = "part_get_mbr_id"; added = (1, 3, 2);
     style = RInt "idbyte", [Device "device"; Int "partnum"], [];
-    proc_nr = Some 235;
+    proc_nr = Some 235; read_only = true;
     fish_output = Some FishOutputHexadecimal;
     tests = [
       InitEmpty, Always, TestResult (
@@ -8600,11 +8750,13 @@ the local output file C<sumsfile>.
 
 This can be used for verifying the integrity of a virtual
 machine.  However to be properly secure you should pay
-attention to the output of the checksum command (it uses
-the ones from GNU coreutils).  In particular when the
-filename is not printable, coreutils uses a special
-backslash syntax.  For more information, see the GNU
-coreutils info file." };
+attention to the output format, which is the same as the
+checksum commands from GNU coreutils.  In particular when the
+filename contains a backslash or newline character, a special
+backslash syntax is used.  For more information, see the GNU
+coreutils info file.
+
+The files are not listed in any particular order." };
 
   { defaults with
     name = "fill_pattern"; added = (1, 3, 12);
@@ -8768,7 +8920,7 @@ a file in the host and attach it as a device." };
   { defaults with
     name = "vfs_label"; added = (1, 3, 18);
     style = RString "label", [Mountable "mountable"], [];
-    proc_nr = Some 253;
+    proc_nr = Some 253; read_only = true;
     tests = [
       InitBasicFS, Always, TestResultString (
         [["set_label"; "/dev/sda1"; "LTEST"];
@@ -8795,7 +8947,7 @@ To find a filesystem from the label, use C<guestfs_findfs_label>." };
     name = "vfs_uuid"; added = (1, 3, 18);
     style = RString "uuid", [Mountable "mountable"], [];
     fish_alias = ["get-uuid"];
-    proc_nr = Some 254;
+    proc_nr = Some 254; read_only = true;
     tests =
       (let uuid = uuidgen () in [
         InitBasicFS, Always, TestResultString (
@@ -8955,7 +9107,7 @@ I<other> keys." };
   { defaults with
     name = "is_lv"; added = (1, 5, 3);
     style = RBool "lvflag", [Device "device"], [];
-    proc_nr = Some 264;
+    proc_nr = Some 264; read_only = true;
     tests = [
       InitBasicFSonLVM, Always, TestResultTrue (
         [["is_lv"; "/dev/VG/LV"]]), [];
@@ -8970,7 +9122,7 @@ returns true iff this is the case." };
   { defaults with
     name = "findfs_uuid"; added = (1, 5, 3);
     style = RString "device", [String "uuid"], [];
-    proc_nr = Some 265;
+    proc_nr = Some 265; read_only = true;
     shortdesc = "find a filesystem by UUID";
     longdesc = "\
 This command searches the filesystems and returns the one
@@ -8982,7 +9134,7 @@ To find the UUID of a filesystem, use C<guestfs_vfs_uuid>." };
   { defaults with
     name = "findfs_label"; added = (1, 5, 3);
     style = RString "device", [String "label"], [];
-    proc_nr = Some 266;
+    proc_nr = Some 266; read_only = true;
     shortdesc = "find a filesystem by label";
     longdesc = "\
 This command searches the filesystems and returns the one
@@ -8994,7 +9146,7 @@ To find the label of a filesystem, use C<guestfs_vfs_label>." };
   { defaults with
     name = "is_chardev"; added = (1, 5, 10);
     style = RBool "flag", [Pathname "path"], [OBool "followsymlinks"];
-    proc_nr = Some 267;
+    proc_nr = Some 267; read_only = true;
     once_had_no_optargs = true;
     tests = [
       InitISOFS, Always, TestResultFalse (
@@ -9017,7 +9169,7 @@ See also C<guestfs_stat>." };
   { defaults with
     name = "is_blockdev"; added = (1, 5, 10);
     style = RBool "flag", [Pathname "path"], [OBool "followsymlinks"];
-    proc_nr = Some 268;
+    proc_nr = Some 268; read_only = true;
     once_had_no_optargs = true;
     tests = [
       InitISOFS, Always, TestResultFalse (
@@ -9044,7 +9196,7 @@ See also C<guestfs_stat>." };
   { defaults with
     name = "is_fifo"; added = (1, 5, 10);
     style = RBool "flag", [Pathname "path"], [OBool "followsymlinks"];
-    proc_nr = Some 269;
+    proc_nr = Some 269; read_only = true;
     once_had_no_optargs = true;
     tests = [
       InitISOFS, Always, TestResultFalse (
@@ -9067,7 +9219,7 @@ See also C<guestfs_stat>." };
   { defaults with
     name = "is_symlink"; added = (1, 5, 10);
     style = RBool "flag", [Pathname "path"], [];
-    proc_nr = Some 270;
+    proc_nr = Some 270; read_only = true;
     tests = [
       InitISOFS, Always, TestResultFalse (
         [["is_symlink"; "/directory"]]), [];
@@ -9084,7 +9236,7 @@ See also C<guestfs_stat>." };
   { defaults with
     name = "is_socket"; added = (1, 5, 10);
     style = RBool "flag", [Pathname "path"], [OBool "followsymlinks"];
-    proc_nr = Some 271;
+    proc_nr = Some 271; read_only = true;
     once_had_no_optargs = true;
     (* XXX Need a positive test for sockets. *)
     tests = [
@@ -9105,7 +9257,7 @@ See also C<guestfs_stat>." };
   { defaults with
     name = "part_to_dev"; added = (1, 5, 15);
     style = RString "device", [Device "partition"], [];
-    proc_nr = Some 272;
+    proc_nr = Some 272; read_only = true;
     tests = [
       InitPartition, Always, TestResultDevice (
         [["part_to_dev"; "/dev/sda1"]], "/dev/sda"), [];
@@ -9213,7 +9365,7 @@ See also C<guestfs_pwrite>." };
   { defaults with
     name = "pread_device"; added = (1, 5, 21);
     style = RBufferOut "content", [Device "device"; Int "count"; Int64 "offset"], [];
-    proc_nr = Some 276;
+    proc_nr = Some 276; read_only = true;
     protocol_limit_warning = true;
     tests = [
       InitEmpty, Always, TestResult (
@@ -9233,7 +9385,7 @@ See also C<guestfs_pread>." };
   { defaults with
     name = "lvm_canonical_lv_name"; added = (1, 5, 24);
     style = RString "lv", [Device "lvname"], [];
-    proc_nr = Some 277;
+    proc_nr = Some 277; read_only = true;
     tests = [
       InitBasicFSonLVM, IfAvailable "lvm2", TestResultString (
         [["lvm_canonical_lv_name"; "/dev/mapper/VG-LV"]], "/dev/VG/LV"), [];
@@ -9548,14 +9700,21 @@ This command compresses F<file> and writes it out to the local
 file F<zfile>.
 
 The compression program used is controlled by the C<ctype> parameter.
-Currently this includes: C<compress>, C<gzip>, C<bzip2>, C<xz> or C<lzop>.
+Currently this includes: C<compress>, C<gzip>, C<bzip2>, C<xz>, C<lzop>
+or C<zstd>.
 Some compression types may not be supported by particular builds of
 libguestfs, in which case you will get an error containing the
 substring \"not supported\".
 
 The optional C<level> parameter controls compression level.  The
 meaning and default for this parameter depends on the compression
-program being used." };
+program being used.
+
+If the appliance has more than one vCPU (see C<guestfs_set_smp>)
+then C<gzip>, C<bzip2>, C<xz> and C<zstd> compression runs in
+parallel using one thread per vCPU, where the appliance has a
+suitable compression program.  The output can be read by the
+ordinary single-threaded decompressor." };
 
   { defaults with
     name = "compress_device_out"; added = (1, 13, 15);
@@ -9573,7 +9732,7 @@ as in C<guestfs_compress_out>." };
   { defaults with
     name = "part_to_partnum"; added = (1, 13, 25);
     style = RInt "partnum", [Device "partition"], [];
-    proc_nr = Some 293;
+    proc_nr = Some 293; read_only = true;
     tests = [
       InitPartition, Always, TestResult (
         [["part_to_partnum"; "/dev/sda1"]], "ret == 1"), [];
@@ -9852,7 +10011,7 @@ If not set, this defaults to C<raid1>.
   { defaults with
     name = "list_md_devices"; added = (1, 15, 4);
     style = RStringList "devices", [], [];
-    proc_nr = Some 300;
+    proc_nr = Some 300; read_only = true;
     shortdesc = "list Linux md (RAID) devices";
     longdesc = "\
 List all Linux md devices." };
@@ -9860,7 +10019,7 @@ List all Linux md devices." };
   { defaults with
     name = "md_detail"; added = (1, 15, 6);
     style = RHashtable "info", [Device "md"], [];
-    proc_nr = Some 301;
+    proc_nr = Some 301; read_only = true;
     optional = Some "mdadm";
     shortdesc = "obtain metadata for an MD device";
     longdesc = "\
@@ -9905,7 +10064,7 @@ device is stopped, but it is not destroyed or zeroed." };
   { defaults with
     name = "blkid"; added = (1, 15, 9);
     style = RHashtable "info", [Device "device"], [];
-    proc_nr = Some 303;
+    proc_nr = Some 303; read_only = true;
     tests = [
       InitScratchFS, Always, TestResult (
         [["blkid"; "/dev/sdb1"]],
@@ -10167,7 +10326,7 @@ this will create the largest possible LV." };
   { defaults with
     name = "isoinfo_device"; added = (1, 17, 19);
     style = RStruct ("isodata", "isoinfo"), [Device "device"], [];
-    proc_nr = Some 313;
+    proc_nr = Some 313; read_only = true;
     tests = [
       InitNone, Always, TestResult (
         [["isoinfo_device"; "/dev/sdd"]],
@@ -10554,7 +10713,7 @@ created subvolume will be added to." };
   { defaults with
     name = "btrfs_subvolume_list"; added = (1, 17, 35);
     style = RStructList ("subvolumes", "btrfssubvolume"), [Mountable_or_Path "fs"], [];
-    proc_nr = Some 325;
+    proc_nr = Some 325; read_only = true;
     optional = Some "btrfs"; camel_name = "BTRFSSubvolumeList";
     test_excuse = "tested in tests/btrfs";
     shortdesc = "list btrfs snapshots and subvolumes";
@@ -10705,7 +10864,7 @@ instead of, or after calling C<guestfs_zero_free_space>." };
   { defaults with
     name = "device_index"; added = (1, 19, 7);
     style = RInt "index", [Device "device"], [];
-    proc_nr = Some 335;
+    proc_nr = Some 335; read_only = true;
     tests = [
       InitEmpty, Always, TestResult (
         [["device_index"; "/dev/sda"]], "ret == 0"), []
@@ -10723,7 +10882,7 @@ See also C<guestfs_list_devices>, C<guestfs_part_to_dev>." };
   { defaults with
     name = "nr_devices"; added = (1, 19, 15);
     style = RInt "nrdisks", [], [];
-    proc_nr = Some 336;
+    proc_nr = Some 336; read_only = true;
     tests = [
       InitEmpty, Always, TestResult (
         [["nr_devices"]], "ret == 4"), []
@@ -10952,7 +11111,7 @@ command (see L<guestfish(1)/glob>), for example:
   { defaults with
     name = "ls0"; added = (1, 19, 32);
     style = RErr, [Pathname "dir"; FileOut "filenames"], [];
-    proc_nr = Some 347;
+    proc_nr = Some 347; read_only = true;
     shortdesc = "get list of files in a directory";
     longdesc = "\
 This specialized command is used to get a listing of
@@ -11013,7 +11172,7 @@ C<guestfs_xfs_growfs> calls." };
   { defaults with
     name = "hivex_open"; added = (1, 19, 35);
     style = RErr, [Pathname "filename"], [OBool "verbose"; OBool "debug"; OBool "write"];
-    proc_nr = Some 350;
+    proc_nr = Some 350; read_only = true;
     optional = Some "hivex";
     tests = [
       InitScratchFS, Always, TestRun (
@@ -11035,7 +11194,7 @@ This is a wrapper around the L<hivex(3)> call of the same name." };
   { defaults with
     name = "hivex_close"; added = (1, 19, 35);
     style = RErr, [], [];
-    proc_nr = Some 351;
+    proc_nr = Some 351; read_only = true;
     optional = Some "hivex";
     shortdesc = "close the current hivex handle";
     longdesc = "\
@@ -11046,7 +11205,7 @@ This is a wrapper around the L<hivex(3)> call of the same name." };
   { defaults with
     name = "hivex_root"; added = (1, 19, 35);
     style = RInt64 "nodeh", [], [];
-    proc_nr = Some 352;
+    proc_nr = Some 352; read_only = true;
     optional = Some "hivex";
     shortdesc = "return the root node of the hive";
     longdesc = "\
@@ -11057,7 +11216,7 @@ This is a wrapper around the L<hivex(3)> call of the same name." };
   { defaults with
     name = "hivex_node_name"; added = (1, 19, 35);
     style = RString "name", [Int64 "nodeh"], [];
-    proc_nr = Some 353;
+    proc_nr = Some 353; read_only = true;
     optional = Some "hivex";
     shortdesc = "return the name of the node";
     longdesc = "\
@@ -11068,7 +11227,7 @@ This is a wrapper around the L<hivex(3)> call of the same name." };
   { defaults with
     name = "hivex_node_children"; added = (1, 19, 35);
     style = RStructList ("nodehs", "hivex_node"), [Int64 "nodeh"], [];
-    proc_nr = Some 354;
+    proc_nr = Some 354; read_only = true;
     optional = Some "hivex";
     shortdesc = "return list of nodes which are subkeys of node";
     longdesc = "\
@@ -11079,7 +11238,7 @@ This is a wrapper around the L<hivex(3)> call of the same name." };
   { defaults with
     name = "hivex_node_get_child"; added = (1, 19, 35);
     style = RInt64 "child", [Int64 "nodeh"; String "name"], [];
-    proc_nr = Some 355;
+    proc_nr = Some 355; read_only = true;
     optional = Some "hivex";
     shortdesc = "return the named child of node";
     longdesc = "\
@@ -11102,7 +11261,7 @@ This is a wrapper around the L<hivex(3)> call of the same name." };
   { defaults with
     name = "hivex_node_values"; added = (1, 19, 35);
     style = RStructList ("valuehs", "hivex_value"), [Int64 "nodeh"], [];
-    proc_nr = Some 357;
+    proc_nr = Some 357; read_only = true;
     optional = Some "hivex";
     shortdesc = "return list of values attached to node";
     longdesc = "\
@@ -11113,7 +11272,7 @@ This is a wrapper around the L<hivex(3)> call of the same name." };
   { defaults with
     name = "hivex_node_get_value"; added = (1, 19, 35);
     style = RInt64 "valueh", [Int64 "nodeh"; String "key"], [];
-    proc_nr = Some 358;
+    proc_nr = Some 358; read_only = true;
     optional = Some "hivex";
     shortdesc = "return the named value";
     longdesc = "\
@@ -11126,7 +11285,7 @@ This is a wrapper around the L<hivex(3)> call of the same name." };
   { defaults with
     name = "hivex_value_key"; added = (1, 19, 35);
     style = RString "key", [Int64 "valueh"], [];
-    proc_nr = Some 359;
+    proc_nr = Some 359; read_only = true;
     optional = Some "hivex";
     shortdesc = "return the key field from the (key, datatype, data) tuple";
     longdesc = "\
@@ -11137,7 +11296,7 @@ This is a wrapper around the L<hivex(3)> call of the same name." };
   { defaults with
     name = "hivex_value_type"; added = (1, 19, 35);
     style = RInt64 "datatype", [Int64 "valueh"], [];
-    proc_nr = Some 360;
+    proc_nr = Some 360; read_only = true;
     optional = Some "hivex";
     shortdesc = "return the data type from the (key, datatype, data) tuple";
     longdesc = "\
@@ -11148,7 +11307,7 @@ This is a wrapper around the L<hivex(3)> call of the same name." };
   { defaults with
     name = "hivex_value_value"; added = (1, 19, 35);
     style = RBufferOut "databuf", [Int64 "valueh"], [];
-    proc_nr = Some 361;
+    proc_nr = Some 361; read_only = true;
     optional = Some "hivex";
     shortdesc = "return the data field from the (key, datatype, data) tuple";
     longdesc = "\
@@ -11613,7 +11772,7 @@ The capabilities set C<cap> should be passed in text form
   { defaults with
     name = "list_ldm_volumes"; added = (1, 20, 0);
     style = RStringList "devices", [], [];
-    proc_nr = Some 380;
+    proc_nr = Some 380; read_only = true;
     optional = Some "ldm";
     shortdesc = "list all Windows dynamic disk volumes";
     longdesc = "\
@@ -11624,7 +11783,7 @@ device names." };
   { defaults with
     name = "list_ldm_partitions"; added = (1, 20, 0);
     style = RStringList "devices", [], [];
-    proc_nr = Some 381;
+    proc_nr = Some 381; read_only = true;
     optional = Some "ldm";
     shortdesc = "list all Windows dynamic disk partitions";
     longdesc = "\
@@ -11820,7 +11979,7 @@ you are better to use C<guestfs_mv> instead." };
   { defaults with
     name = "is_whole_device"; added = (1, 21, 9);
     style = RBool "flag", [Device "device"], [];
-    proc_nr = Some 395;
+    proc_nr = Some 395; read_only = true;
     tests = [
       InitEmpty, Always, TestResultTrue (
         [["is_whole_device"; "/dev/sda"]]), [];
@@ -11838,7 +11997,7 @@ device. That is, not a partition or a logical device." };
     name = "internal_parse_mountable"; added = (1, 21, 11);
     style = RStruct ("mountable", "internal_mountable"), [Mountable "mountable"], [];
     visibility = VInternal;
-    proc_nr = Some 396;
+    proc_nr = Some 396; read_only = true;
     shortdesc = "parse a mountable string";
     longdesc = "\
 Parse a mountable string." };
@@ -12267,7 +12426,7 @@ Get the realtime (wallclock) timestamp of the current journal entry." };
   { defaults with
     name = "statns"; added = (1, 27, 53);
     style = RStruct ("statbuf", "statns"), [Pathname "path"], [];
-    proc_nr = Some 421;
+    proc_nr = Some 421; read_only = true;
     tests = [
       InitISOFS, Always, TestResult (
         [["statns"; "/empty"]], "ret->st_size == 0"), []
@@ -12281,7 +12440,7 @@ This is the same as the L<stat(2)> system call." };
   { defaults with
     name = "lstatns"; added = (1, 27, 53);
     style = RStruct ("statbuf", "statns"), [Pathname "path"], [];
-    proc_nr = Some 422;
+    proc_nr = Some 422; read_only = true;
     tests = [
       InitISOFS, Always, TestResult (
         [["lstatns"; "/empty"]], "ret->st_size == 0"), []
@@ -12299,7 +12458,7 @@ This is the same as the L<lstat(2)> system call." };
   { defaults with
     name = "internal_lstatnslist"; added = (1, 27, 53);
     style = RStructList ("statbufs", "statns"), [Pathname "path"; FilenameList "names"], [];
-    proc_nr = Some 423;
+    proc_nr = Some 423; read_only = true;
     visibility = VInternal;
     shortdesc = "lstat on multiple files";
     longdesc = "\
@@ -12322,7 +12481,7 @@ This uses the L<blockdev(8)> command." };
   { defaults with
     name = "btrfs_subvolume_get_default"; added = (1, 29, 17);
     style = RInt64 "id", [Mountable_or_Path "fs"], [];
-    proc_nr = Some 425;
+    proc_nr = Some 425; read_only = true;
     optional = Some "btrfs"; camel_name = "BTRFSSubvolumeGetDefault";
     tests = [
       InitPartition, Always, TestResult (
@@ -12660,7 +12819,7 @@ valid GUID." };
   { defaults with
     name = "part_get_gpt_guid"; added = (1, 29, 25);
     style = RString "guid", [Device "device"; Int "partnum"], [];
-    proc_nr = Some 447;
+    proc_nr = Some 447; read_only = true;
     optional = Some "gdisk";
     tests = [
       InitGPT, Always, TestResultString (
@@ -12989,6 +13148,914 @@ Show all the devices where the filesystems in C<device> is spanned over.
 If not all the devices for the filesystems are present, then this function
 fails and the C<errno> is set to C<ENODEV>." };
 
+  { defaults with
+    name = "walk_out"; added = (1, 33, 33);
+    style = RErr, [Pathname "directory"; FileOut "filename"], [OInt "maxdepth"; OString "types"; OInt64 "minsize"; OInt64 "maxsize"; OInt64 "newer"];
+    proc_nr = Some 466;
+    cancellable = true;
+    tests =
+      (* Each test builds the same small tree, downloads the records
+       * and checks which paths were listed.  A path field is always
+       * followed by a NUL byte and no other field starts with '/'.
+       *)
+      (let tree d = [
+         ["mkdir"; d];
+         ["touch"; d ^ "/small"];
+         ["write"; d ^ "/big"; "hello, world"];
+         ["mkdir"; d ^ "/sub"];
+         ["touch"; d ^ "/sub/deep"];
+         ["ln_s"; "small"; d ^ "/link"];
+         ["utimens"; d ^ "/small"; "0"; "0"; "1000000000"; "0"];
+         ["utimens"; d ^ "/big"; "0"; "0"; "1000000000"; "0"]
+       ] in
+       let walk d args = [
+         "walk_out" :: d :: "testdownload.tmp" :: args;
+         ["upload"; "testdownload.tmp"; d ^ ".out"];
+         ["read_file"; d ^ ".out"]
+       ] in
+       let listed p =
+         "memmem (ret, size, \"" ^ p ^ "\", sizeof \"" ^ p ^ "\") != NULL" in
+       let not_listed p =
+         "memmem (ret, size, \"" ^ p ^ "\", sizeof \"" ^ p ^ "\") == NULL" in
+       [
+         InitScratchFS, Always, TestResult (
+           tree "/walk_out1" @ walk "/walk_out1" [""; "NOARG"; ""; ""; ""],
+           String.concat " && "
+             (List.map listed ["/walk_out1"; "/walk_out1/small";
+                               "/walk_out1/big"; "/walk_out1/sub";
+                               "/walk_out1/sub/deep"; "/walk_out1/link"])), [];
+         InitScratchFS, Always, TestResult (
+           tree "/walk_out2" @ walk "/walk_out2" ["1"; "NOARG"; ""; ""; ""],
+           listed "/walk_out2/sub" ^ " && " ^
+           listed "/walk_out2/small" ^ " && " ^
+           not_listed "/walk_out2/sub/deep"), [];
+         InitScratchFS, Always, TestResult (
+           tree "/walk_out3" @ walk "/walk_out3" ["0"; "NOARG"; ""; ""; ""],
+           listed "/walk_out3" ^ " && " ^
+           not_listed "/walk_out3/sub" ^ " && " ^
+           not_listed "/walk_out3/small"), [];
+         InitScratchFS, Always, TestResult (
+           tree "/walk_out4" @ walk "/walk_out4" [""; "l"; ""; ""; ""],
+           listed "/walk_out4/link" ^ " && " ^
+           not_listed "/walk_out4" ^ " && " ^
+           not_listed "/walk_out4/small" ^ " && " ^
+           not_listed "/walk_out4/sub"), [];
+         InitScratchFS, Always, TestResult (
+           tree "/walk_out5" @ walk "/walk_out5" [""; "f"; "1"; "100"; ""],
+           listed "/walk_out5/big" ^ " && " ^
+           not_listed "/walk_out5/small" ^ " && " ^
+           not_listed "/walk_out5/sub/deep"), [];
+         InitScratchFS, Always, TestResult (
+           tree "/walk_out6" @ walk "/walk_out6" [""; "f"; ""; "5"; ""],
+           listed "/walk_out6/small" ^ " && " ^
+           listed "/walk_out6/sub/deep" ^ " && " ^
+           not_listed "/walk_out6/big"), [];
+         InitScratchFS, Always, TestResult (
+           tree "/walk_out7" @ walk "/walk_out7" [""; "f"; ""; ""; "1500000000"],
+           listed "/walk_out7/sub/deep" ^ " && " ^
+           not_listed "/walk_out7/small" ^ " && " ^
+           not_listed "/walk_out7/big"), [];
+         InitScratchFS, Always, TestLastFail (
+           [["mkdir"; "/walk_out8"];
+            ["walk_out"; "/walk_out8"; "testdownload.tmp"; ""; "x"; ""; ""; ""]]), []
+       ]);
+    shortdesc = "list a directory tree with stat, xattrs and link targets";
+    longdesc = "\
+This command walks the directory tree starting at F<directory>
+(which is included) and writes one record for every file and
+directory found to the local file F<filename>.  Symbolic links
+are not followed.
+
+It is intended for programs which want to copy the metadata of a
+whole tree, and replaces calling C<guestfs_ls>,
+C<guestfs_lstatnslist>, C<guestfs_lxattrlist> and
+C<guestfs_readlinklist> for every directory.
+
+Each record consists of the following fields, each terminated by a
+C<\\0> character:
+
+=over 4
+
+=item *
+
+The full path of the file, starting with F<directory>.
+
+=item *
+
+The fields of the C<guestfs_statns> structure C<st_dev> through
+C<st_ctime_nsec>, as 16 decimal numbers separated by single spaces.
+
+=item *
+
+The target of the symbolic link, or an empty string if the file
+is not a symbolic link.
+
+=item *
+
+The number of extended attributes as a decimal number, followed by
+two fields for each attribute: the attribute name, and the length of
+the value as a decimal number.  The value itself follows the length
+field, I<without> any terminating C<\\0> character.  Extended
+attributes are only listed if the C<linuxxattrs> feature is
+available (see C<guestfs_feature_available>).
+
+=back
+
+The records are not written in any particular order.
+
+The optional arguments restrict which files are listed.  Directories
+which are not listed are still descended into, unless C<maxdepth>
+prevents it.
+
+=over 4
+
+=item C<maxdepth>
+
+Do not descend more than C<maxdepth> levels below F<directory>.
+C<0> means only list F<directory> itself.
+
+=item C<types>
+
+A string of one or more of the letters C<b c d f l p s>, with the
+same meanings as the L<find(1)> I<-type> option.  Only files of the
+listed types are written.
+
+=item C<minsize>
+
+=item C<maxsize>
+
+Only list files whose size in bytes is at least C<minsize> and at
+most C<maxsize>.
+
+=item C<newer>
+
+Only list files whose modification time (in seconds since the epoch)
+is more recent than C<newer>.
+
+=back" };
+
+  { defaults with
+    name = "probe_block_devices"; added = (1, 33, 33);
+    style = RStructList ("probes", "blkprobe"), [], [];
+    proc_nr = Some 467; read_only = true;
+    tests =
+      (let uuid = uuidgen () in
+       (* Check the entry for /dev/sda1, wherever it is in the list. *)
+       let probe_is label =
+         "({ size_t i; int found = 0; "^
+         "for (i = 0; i < ret->len; ++i) "^
+         "if (STREQ (ret->val[i].blkprobe_device, \"/dev/sda1\")) "^
+         "found = STREQ (ret->val[i].blkprobe_type, \"ext2\") && "^
+         "STREQ (ret->val[i].blkprobe_label, \"" ^ label ^ "\") && "^
+         "STREQ (ret->val[i].blkprobe_uuid, \"" ^ uuid ^ "\") && "^
+         "STREQ (ret->val[i].blkprobe_usage, \"filesystem\"); "^
+         "found; })" in
+       [
+         InitBasicFS, Always, TestRun (
+           [["probe_block_devices"]]), [];
+         InitPartition, Always, TestResult (
+           [["mkfs"; "ext2"; "/dev/sda1"; ""; "NOARG"; ""; ""; "probelabel"];
+            ["set_uuid"; "/dev/sda1"; uuid];
+            ["probe_block_devices"]], probe_is "probelabel"), [];
+         (* The cached result must be dropped when the label changes. *)
+         InitPartition, Always, TestResult (
+           [["mkfs"; "ext2"; "/dev/sda1"; ""; "NOARG"; ""; ""; "probelabel"];
+            ["set_uuid"; "/dev/sda1"; uuid];
+            ["probe_block_devices"];
+            ["set_label"; "/dev/sda1"; "newlabel"];
+            ["probe_block_devices"]], probe_is "newlabel"), []
+       ]);
+    shortdesc = "probe all block devices for filesystems";
+    longdesc = "\
+This probes every device, partition, MD device and logical volume
+(and Windows dynamic disk volume, if C<ldm> support is available)
+for a filesystem or other signature, and returns one entry for each.
+
+For each device the following fields are returned.  Fields which
+could not be determined are empty strings.
+
+=over 4
+
+=item C<blkprobe_device>
+
+The device name, in the same form as returned by
+C<guestfs_list_devices>, C<guestfs_list_partitions> etc.
+
+=item C<blkprobe_type>
+
+The filesystem type, the same as C<guestfs_vfs_type>.
+
+=item C<blkprobe_label>
+
+=item C<blkprobe_uuid>
+
+The filesystem label and UUID.
+
+=item C<blkprobe_partuuid>
+
+For partitions, the partition UUID (GPT) or identifier (MBR).
+
+=item C<blkprobe_usage>
+
+What the signature is used for, eg. C<filesystem>, C<raid>,
+C<crypto> or C<other>.
+
+=back
+
+This is equivalent to calling C<guestfs_vfs_type>,
+C<guestfs_vfs_label> and C<guestfs_vfs_uuid> on every device
+(except for the labels of btrfs and NTFS filesystems, see below), but
+uses a single call into the appliance.  The results are cached in
+the appliance until the next call which changes partitions,
+filesystems, labels, UUIDs or LVM metadata, and the cache is also
+used to answer C<guestfs_vfs_type> and C<guestfs_vfs_uuid>.
+
+All the labels returned here are the ones read by libblkid.
+C<guestfs_vfs_label> also uses the cache, except for btrfs and NTFS
+filesystems where it runs the btrfs or NTFS tools instead, so for
+those filesystems the label it returns may differ." };
+
+  { defaults with
+    name = "pread_ranges"; added = (1, 33, 33);
+    style = RErr, [Dev_or_Path "path"; StringList "ranges"; FileOut "filename"], [];
+    proc_nr = Some 468; read_only = true;
+    progress = true; cancellable = true;
+    tests =
+      (let md5 = Digest.to_hex (Digest.file "COPYING.LIB") in
+       let size = (Unix.stat "COPYING.LIB").Unix.st_size in
+       let ranges = [ "300:" ^ string_of_int (size - 300); "0:100"; "100:200" ] in
+       [
+         InitScratchFS, Always, TestResultString (
+           [["mkdir"; "/pread_ranges"];
+            ["upload"; "$srcdir/../../COPYING.LIB"; "/pread_ranges/COPYING.LIB"];
+            ["pread_ranges"; "/pread_ranges/COPYING.LIB"; String.concat " " ranges; "testdownload.tmp"];
+            ["touch"; "/pread_ranges/copy"];
+            ["truncate_size"; "/pread_ranges/copy"; string_of_int size];
+            ["pwrite_ranges"; "/pread_ranges/copy"; String.concat " " ranges; "testdownload.tmp"];
+            ["checksum"; "md5"; "/pread_ranges/copy"]], md5), []
+       ]);
+    shortdesc = "read several ranges of a file or device";
+    longdesc = "\
+This command reads several ranges of the file or device F<path>
+in a single call, and saves them, one after another, in the local
+file F<filename>.
+
+Each element of C<ranges> is a string C<OFFSET:SIZE> giving the
+offset and size in bytes of one range.  The ranges may be in any
+order and may overlap.  Every range must be within the file or
+device.
+
+Unlike C<guestfs_pread>, there is no limit on the amount of data
+which can be read with this call, and it always reads the full
+amount unless an error occurs.
+
+See also C<guestfs_pwrite_ranges>, C<guestfs_download_offset>." };
+
+  { defaults with
+    name = "pwrite_ranges"; added = (1, 33, 33);
+    style = RErr, [Dev_or_Path "path"; StringList "ranges"; FileIn "filename"], [];
+    proc_nr = Some 469;
+    progress = true; cancellable = true;
+    (* Tested by pread_ranges. *)
+    shortdesc = "write several ranges of a file or device";
+    longdesc = "\
+This command writes several ranges of the file or device F<path>
+in a single call.  The data is read from the local file F<filename>,
+which must contain the data for each range one after another,
+in the same format as written by C<guestfs_pread_ranges>.
+
+Each element of C<ranges> is a string C<OFFSET:SIZE> giving the
+offset and size in bytes of one range.  The ranges are written
+in order.  Writing past the end of a file extends it.
+
+F<path> must already exist.
+
+See also C<guestfs_pread_ranges>, C<guestfs_upload_offset>." };
+
+  { defaults with
+    name = "hivex_dump"; added = (1, 33, 33);
+    style = RErr, [Int64 "nodeh"; FileOut "filename"], [OString "path"; OInt "maxdepth"; OStringList "keys"];
+    proc_nr = Some 470; read_only = true;
+    optional = Some "hivex";
+    cancellable = true;
+    tests = [
+      InitScratchFS, Always, TestRun (
+        [["upload"; "$srcdir/../../test-data/files/minimal"; "/hivex_dump"];
+         ["hivex_open"; "/hivex_dump"; ""; ""; "false"];
+         ["hivex_dump"; "0"; "testdownload.tmp"; "NOARG"; ""; "NOARG"]]), [["hivex_close"]];
+      InitScratchFS, Always, TestResult (
+        [["upload"; "$srcdir/../../test-data/files/minimal"; "/hivex_dump2"];
+         ["hivex_open"; "/hivex_dump2"; ""; ""; "true"];
+         ["hivex_apply"; "0"; "$srcdir/../../test-data/files/hivex-edits"];
+         ["hivex_dump"; "0"; "testdownload.tmp"; "Test"; "0"; "value"];
+         ["upload"; "testdownload.tmp"; "/hivex_dump2_out"];
+         ["read_file"; "/hivex_dump2_out"]],
+        (* Only the "Test" node is dumped, so the record ends with
+         * its single value: key "Value", type 3, length 5, "hello".
+         *)
+        "size > 17 && compare_buffers (ret + size - 17, 17, \"1\\0Value\\0003\\0005\\0hello\", 17) == 0"), [["hivex_close"]]
+    ];
+    shortdesc = "dump a registry subtree";
+    longdesc = "\
+This command writes the node C<nodeh> and all of the nodes below it,
+with all of their values, to the local file F<filename>.  Node C<0>
+means the root node.
+
+It replaces calling C<guestfs_hivex_node_children>,
+C<guestfs_hivex_node_name>, C<guestfs_hivex_node_values>,
+C<guestfs_hivex_value_key> and C<guestfs_hivex_value_value>
+for every node.
+
+One record is written for each node, parents before their children.
+Each record consists of the following fields, each terminated by a
+C<\\0> character:
+
+=over 4
+
+=item *
+
+The path of the node relative to the starting node, as a list of
+key names separated by backslash characters.  The starting node
+itself has an empty path.
+
+=item *
+
+The node handle, as a decimal number.
+
+=item *
+
+The number of values, as a decimal number, followed by three fields
+for each value: the key, the type and the length of the data as
+decimal numbers.  The data itself follows the length field,
+I<without> any terminating C<\\0> character.
+
+=back
+
+The optional arguments are:
+
+=over 4
+
+=item C<path>
+
+Start at the node found by following this backslash-separated
+list of key names down from C<nodeh>, instead of at C<nodeh>.
+Key names are matched case insensitively.  If a key is missing
+the call fails with C<errno> set to C<ENOENT>.
+
+=item C<maxdepth>
+
+Do not descend more than C<maxdepth> levels below the starting node.
+C<0> means only dump the starting node itself.
+
+=item C<keys>
+
+Only write the values whose keys are in this list (matched case
+insensitively).  Nodes are still written even if none of their
+values match.
+
+=back
+
+See also C<guestfs_hivex_apply>." };
+
+  { defaults with
+    name = "hivex_apply"; added = (1, 33, 33);
+    style = RErr, [Int64 "nodeh"; FileIn "filename"], [];
+    proc_nr = Some 471;
+    optional = Some "hivex";
+    cancellable = true;
+    tests = [
+      InitScratchFS, Always, TestRun (
+        [["upload"; "$srcdir/../../test-data/files/minimal"; "/hivex_apply"];
+         ["hivex_open"; "/hivex_apply"; ""; ""; "true"];
+         ["hivex_apply"; "0"; "$srcdir/../../test-data/files/empty"];
+         ["hivex_commit"; "NULL"]]), [["hivex_close"]];
+      InitScratchFS, Always, TestResult (
+        [["upload"; "$srcdir/../../test-data/files/minimal"; "/hivex_apply2"];
+         ["hivex_open"; "/hivex_apply2"; ""; ""; "true"];
+         ["hivex_apply"; "0"; "$srcdir/../../test-data/files/hivex-edits"];
+         ["hivex_commit"; "NULL"];
+         ["internal_hivex_query"; "/hivex_apply2"; "test Value test\\sub Name"]],
+        "ret->len == 2 && "^
+          "STREQ (ret->val[0].hv_path, \"Test\") && "^
+          "STREQ (ret->val[0].hv_key, \"Value\") && "^
+          "ret->val[0].hv_type == 3 && "^
+          "compare_buffers (ret->val[0].hv_value, ret->val[0].hv_value_len, \"hello\", 5) == 0 && "^
+          "STREQ (ret->val[1].hv_path, \"Test\\\\Sub\") && "^
+          "STREQ (ret->val[1].hv_key, \"Name\") && "^
+          "ret->val[1].hv_type == 1 && "^
+          "compare_buffers (ret->val[1].hv_value, ret->val[1].hv_value_len, \"s\\0u\\0b\\0\\0\", 8) == 0"), [["hivex_close"]];
+      InitScratchFS, Always, TestResult (
+        [["upload"; "$srcdir/../../test-data/files/minimal"; "/hivex_apply3"];
+         ["hivex_open"; "/hivex_apply3"; ""; ""; "true"];
+         ["hivex_apply"; "0"; "$srcdir/../../test-data/files/hivex-edits"];
+         (* In this hive the root node is 0x1020, see hivex_open. *)
+         ["hivex_node_get_child"; "0x1020"; "Gone"]], "ret == 0"), [["hivex_close"]]
+    ];
+    shortdesc = "apply a list of edits to the registry";
+    longdesc = "\
+This command reads a list of edits from the local file F<filename>
+and applies them, in order, to the hive opened with
+C<guestfs_hivex_open>.  The hive must have been opened for writing,
+and the changes are not saved until C<guestfs_hivex_commit> is called.
+
+Each edit is made of several fields, each terminated by a C<\\0>
+character.  The first field is the operation, and the second is the
+path of a node relative to C<nodeh> (or the root node if C<nodeh>
+is C<0>), written as a list of key names separated by backslash
+characters.  The operations are:
+
+=over 4
+
+=item C<add>
+
+Create the node if it does not exist, together with any missing
+parent nodes.
+
+=item C<set>
+
+Set or replace one value in the node, creating the node as for
+C<add>.  This is followed by three fields: the key, and the type
+and the length of the data as decimal numbers.  The data follows
+the length field, I<without> any terminating C<\\0> character.
+
+=item C<delete>
+
+Delete the node and everything below it.  Existing node and value
+handles for the deleted nodes become invalid.
+
+=back
+
+The edits are read completely before any of them is applied.  If an
+edit fails, the edits before it will have been applied.
+
+See also C<guestfs_hivex_dump>." };
+
+  { defaults with
+    name = "aug_init_files"; added = (1, 33, 33);
+    style = RErr, [Pathname "root"; Int "flags"; StringList "transforms"], [];
+    proc_nr = Some 472; read_only = true;
+    tests = [
+      InitBasicFS, Always, TestResultString (
+        [["mkdir"; "/etc"];
+         ["write"; "/etc/hostname"; "test.example.org"];
+         ["write"; "/etc/hosts"; "127.0.0.1 localhost"];
+         ["aug_init_files"; "/"; "0"; "Hostname.lns:/etc/hostname"];
+         ["aug_get"; "/files/etc/hostname/hostname"]], "test.example.org"), [["aug_close"]];
+      InitBasicFS, Always, TestResult (
+        [["mkdir"; "/etc"];
+         ["write"; "/etc/hostname"; "test.example.org"];
+         ["write"; "/etc/hosts"; "127.0.0.1 localhost"];
+         ["aug_init_files"; "/"; "0"; "Hostname.lns:/etc/hostname"];
+         ["aug_match"; "/files/etc/hosts"]], "is_string_list (ret, 0)"), [["aug_close"]];
+      InitBasicFS, Always, TestResultString (
+        [["mkdir"; "/etc"];
+         ["write"; "/etc/hostname"; "test.example.org"];
+         ["aug_init_files"; "/"; "0"; "Hostname.lns:/etc/hostname"];
+         ["write"; "/etc/hostname"; "other.example.org"];
+         ["aug_load"];
+         ["aug_get"; "/files/etc/hostname/hostname"]], "other.example.org"), [["aug_close"]]
+    ];
+    shortdesc = "create a new Augeas handle for some files only";
+    longdesc = "\
+This is the same as C<guestfs_aug_init>, except that instead of
+loading every Augeas lens and every configuration file which they
+match, only the lenses and files listed in C<transforms> are loaded.
+This is much faster when only a few files are needed.
+
+Each element of C<transforms> is a string C<LENS:FILE>, where
+C<LENS> is the name of an Augeas lens such as C<Hosts.lns>,
+and C<FILE> is the absolute path of a file, or a glob matching
+several files, which will be parsed with that lens.  For example:
+
+ \"Fstab.lns:/etc/fstab\"
+ \"Shellvars.lns:/etc/sysconfig/network-scripts/ifcfg-*\"
+
+C<root> and C<flags> are the same as for C<guestfs_aug_init>.
+
+To close the handle, you can call C<guestfs_aug_close>." };
+
+  { defaults with
+    name = "journal_export"; added = (1, 33, 33);
+    style = RErr, [FileOut "filename"], [OString "cursor"; OInt64 "since"; OStringList "fields"; OStringList "matches"; OInt64 "maxentries"];
+    proc_nr = Some 473;
+    optional = Some "journal";
+    cancellable = true;
+    test_excuse = "tests in tests/journal subdirectory";
+    shortdesc = "export journal entries";
+    longdesc = "\
+Write journal entries from the journal opened by
+C<guestfs_journal_open> to the local file F<filename>, in the
+systemd journal export format (see
+L<http://www.freedesktop.org/wiki/Software/systemd/export/>).
+This is the same format as written by C<journalctl -o export>.
+
+This is much faster than calling C<guestfs_journal_next> and
+C<guestfs_journal_get> for each entry.
+
+Each entry begins with the C<__CURSOR>, C<__REALTIME_TIMESTAMP>,
+C<__MONOTONIC_TIMESTAMP> and C<_BOOT_ID> fields.  Fields longer than
+the data threshold (see C<guestfs_journal_set_data_threshold>) are
+truncated.
+
+By default entries are exported starting with the one after the
+current position of the journal handle, which after
+C<guestfs_journal_open> is the first entry.  Afterwards the handle
+is positioned at the last entry exported.  The optional arguments
+are:
+
+=over 4
+
+=item C<cursor>
+
+Start with the entry after the one with this cursor (the value of
+the C<__CURSOR> field).  This can be used to continue an export
+which was stopped by C<maxentries>.
+
+=item C<since>
+
+Start with the first entry at or after this time, in microseconds
+since the epoch.  This cannot be used together with C<cursor>.
+
+=item C<fields>
+
+Only write these fields (and the four fields above) of each entry.
+
+=item C<matches>
+
+Only export entries which match.  Each element is C<FIELD=VALUE>.
+As with L<journalctl(1)>, matches of different fields must all be
+true, matches of the same field are alternatives, and an element
+C<+> separates groups of matches of which any may be true.
+
+=item C<maxentries>
+
+Stop after writing this many entries.
+
+=back" };
+
+  { defaults with
+    name = "file_extents"; added = (1, 33, 33);
+    style = RStructList ("extents", "extent"), [Pathname "path"], [];
+    proc_nr = Some 474;
+    tests = [
+      InitScratchFS, Always, TestResult (
+        [["fill"; "0x63"; "1000000"; "/file_extents"];
+         ["file_extents"; "/file_extents"]],
+         "ret->len >= 1 && STREQ (ret->val[0].ext_device, \"/dev/sdb\") && ret->val[0].ext_device_offset > 0"), [];
+      (* Read each extent from the disk and check that it contains
+       * the same bytes as the file at that offset.
+       *)
+      InitScratchFS, Always, TestResult (
+        [["upload"; "$srcdir/../../COPYING.LIB"; "/file_extents_data"];
+         ["sync"];
+         ["drop_caches"; "3"];
+         ["file_extents"; "/file_extents_data"]],
+         "({ size_t i; int ok = ret->len >= 1; "^
+         "for (i = 0; ok && i < ret->len; ++i) { "^
+         "  char *fbuf, *dbuf; size_t fsize, dsize; "^
+         "  int64_t n = ret->val[i].ext_size; "^
+         "  if (n > 65536) n = 65536; "^
+         "  fbuf = guestfs_pread (g, \"/file_extents_data\", n, ret->val[i].ext_file_offset, &fsize); "^
+         "  dbuf = guestfs_pread_device (g, ret->val[i].ext_device, n, ret->val[i].ext_device_offset, &dsize); "^
+         "  ok = fbuf != NULL && dbuf != NULL && fsize > 0 && dsize >= fsize && "^
+         "       memcmp (fbuf, dbuf, fsize) == 0; "^
+         "  free (fbuf); free (dbuf); "^
+         "} "^
+         "ok; })"), [];
+      InitScratchFS, Always, TestLastFail (
+        [["file_extents"; "/file_extents_nosuchfile"]]), []
+    ];
+    shortdesc = "map a file to the extents it occupies on disk";
+    longdesc = "\
+Return the list of extents which make up the file C<path>, and
+where each one is located on the underlying whole disk (eg.
+F</dev/sda>).
+
+The extents are read from the filesystem using the
+C<FS_IOC_FIEMAP> ioctl, and then translated through any partition,
+LVM logical volume or md RAID 1 device between the filesystem and
+the disk.  Other kinds of device-mapper and md devices (such as
+striped volumes, RAID 5 or encrypted devices) and filesystems which
+don't sit on a single block device (such as btrfs) are not
+supported, and this returns an error.
+
+The fields in the returned structure are:
+
+=over 4
+
+=item B<ext_path>
+
+The file, which is always C<path>.
+
+=item B<ext_file_offset>
+
+The offset of the extent in the file in bytes.
+
+=item B<ext_device>
+
+The whole disk containing the extent.  This is the empty string if
+the extent does not have a location on disk (see C<ext_flags>).
+
+=item B<ext_device_offset>
+
+The offset of the extent on C<ext_device> in bytes, or C<-1>.
+
+=item B<ext_size>
+
+The size of the extent in bytes.  The last extent is usually
+rounded up to the filesystem block size.
+
+=item B<ext_flags>
+
+The C<FIEMAP_EXTENT_*> flags from F<linux/fiemap.h>.  Extents which
+are not aligned to disk blocks (C<FIEMAP_EXTENT_DATA_INLINE>,
+C<FIEMAP_EXTENT_DATA_TAIL>), compressed (C<FIEMAP_EXTENT_ENCODED>) or
+not yet allocated (C<FIEMAP_EXTENT_DELALLOC>,
+C<FIEMAP_EXTENT_UNKNOWN>) are not translated.
+
+=back
+
+Holes in sparse files are not returned.  One extent may be
+returned as several pieces if it crosses a boundary between
+the segments of a logical volume.
+
+See also C<guestfs_extents_to_files>." };
+
+  { defaults with
+    name = "extents_to_files"; added = (1, 33, 33);
+    style = RStructList ("extents", "extent"), [Pathname "directory"; Device "device"; StringList "ranges"], [];
+    proc_nr = Some 475;
+    tests = [
+      InitScratchFS, Always, TestResult (
+        [["mkdir"; "/extents_to_files"];
+         ["fill"; "0x63"; "100000"; "/extents_to_files/file"];
+         ["extents_to_files"; "/extents_to_files"; "/dev/sdb"; "0:4294967296"]],
+         "ret->len >= 1 && STREQ (ret->val[0].ext_path, \"/extents_to_files/file\")"), [];
+      InitScratchFS, Always, TestResult (
+        [["mkdir"; "/extents_to_files2"];
+         ["fill"; "0x63"; "100000"; "/extents_to_files2/file"];
+         ["extents_to_files"; "/extents_to_files2"; "/dev/sdb1"; "0:4294967296"]],
+         "ret->len >= 1 && STREQ (ret->val[0].ext_device, \"/dev/sdb1\")"), [];
+      InitScratchFS, Always, TestResult (
+        [["mkdir"; "/extents_to_files3"];
+         ["fill"; "0x63"; "100000"; "/extents_to_files3/file"];
+         ["extents_to_files"; "/extents_to_files3"; "/dev/sdb"; "0:512"]],
+         "ret->len == 0"), []
+    ];
+    shortdesc = "map disk extents back to files";
+    longdesc = "\
+Find which files under C<directory> occupy any part of the
+C<ranges> of C<device>.  Each element of C<ranges> is a string
+C<OFFSET:SIZE>, both in bytes.
+
+C<device> may be a whole disk, or any partition, logical volume or
+md device in the stack of block devices below the filesystem(s)
+containing C<directory>, and the offsets are relative to it.
+
+This returns the same structures as C<guestfs_file_extents>, except
+that each extent is clipped to the part which overlaps one of the
+ranges, and C<ext_device> and C<ext_device_offset> refer to
+C<device>.  A file is returned once for each overlapping piece.
+The list is sorted by C<ext_device_offset>.
+
+Only regular files are checked, not directories, symbolic links or
+filesystem metadata.  Any filesystems mounted below C<directory>
+are searched too, except that filesystems which don't support
+C<FS_IOC_FIEMAP> or don't sit on a block device (such as F</proc>
+or tmpfs) are skipped.  Otherwise the same limitations as
+C<guestfs_file_extents> apply." };
+
+  { defaults with
+    name = "trim_filesystems"; added = (1, 33, 33);
+    style = RHashtable "status", [StringList "mountables"], [OBool "zero"];
+    proc_nr = Some 476;
+    progress = true; cancellable = true;
+    tests = [
+      (* Whether trimming succeeds depends on discard support in the
+       * appliance.  It either works, or fails because neither FITRIM
+       * nor hole punching with -o discard is available.  Any other
+       * error (eg. from mounting) is a failure.
+       *)
+      InitBasicFS, Always, TestResult (
+        [["umount"; "/"; "false"; "false"];
+         ["trim_filesystems"; "/dev/sda1"; ""]],
+         "STREQ (ret[0], \"/dev/sda1\") && ret[2] == NULL && "^
+         "(STREQ (ret[1], \"\") || STRPREFIX (ret[1], \"FITRIM\") || "^
+         "STRPREFIX (ret[1], \"fallocate\"))"), [];
+      InitBasicFS, Always, TestResult (
+        [["umount"; "/"; "false"; "false"];
+         ["trim_filesystems"; "/dev/sda1"; "true"]],
+         "STREQ (ret[0], \"/dev/sda1\") && STREQ (ret[1], \"\") && ret[2] == NULL"), [];
+      InitBasicFS, Always, TestResult (
+        [["umount"; "/"; "false"; "false"];
+         ["trim_filesystems"; "/dev/sda1 /dev/nosuchdevice"; "true"]],
+         "STREQ (ret[1], \"\") && STREQ (ret[2], \"/dev/nosuchdevice\") && STRNEQ (ret[3], \"\")"), []
+    ];
+    shortdesc = "trim or zero the free space of several filesystems";
+    longdesc = "\
+Discard the free space of each filesystem in the list C<mountables>,
+working on several filesystems at the same time.
+
+Each filesystem is mounted on a temporary mountpoint (outside the
+tree used by C<guestfs_mount>), so they should not be mounted
+already.  By default the free space is discarded using the
+C<FITRIM> ioctl, like C<guestfs_fstrim>.  Filesystems are mounted
+with C<-o discard> if possible, and for those which don't support
+C<FITRIM> the free space is allocated to a temporary file using
+L<fallocate(2)> and then punched out.  If neither method works (or
+the filesystem could not be mounted with C<-o discard>) the
+filesystem is not trimmed, and an error is returned for it.
+
+If the optional argument C<zero> is true, the free space is
+instead overwritten with zeroes, like C<guestfs_zero_free_space>.
+
+This returns a hash table mapping each element of C<mountables> to
+the empty string if it was successful, or an error message (for
+example if it could not be mounted).  Errors with individual
+filesystems are not an error for the call as a whole.
+
+Progress messages cover all the filesystems together.  This call
+can be cancelled with C<guestfs_user_cancel>, once the first
+progress message has been received." };
+
+  { defaults with
+    name = "download_inodes"; added = (1, 33, 33);
+    style = RErr, [Mountable "device"; StringList "inodes"; FileOut "filename"], [OString "format"];
+    proc_nr = Some 477;
+    optional = Some "libtsk";
+    progress = true; cancellable = true;
+    test_excuse = "tests in tests/tsk subdirectory";
+    shortdesc = "download several files given their inodes";
+    longdesc = "\
+Download the files with the given C<inodes> (a list of inode numbers
+as strings) from the disk partition (eg. F</dev/sda1>), and save them
+as a single archive in F<filename> on the local machine.  Each
+member of the archive is named by its inode number.
+
+This is the same as calling C<guestfs_download_inode> for each
+inode, but the filesystem is opened only once, using The Sleuth Kit
+library in the daemon, and all the files are sent in one transfer.
+
+The optional argument C<format> is the archive format, either
+C<tar> (the default, ustar with GNU extensions for very large files)
+or C<cpio> (the C<newc> format, which cannot store files over 4GB).
+
+If part of a file cannot be read, which is common for deleted
+files, that part is filled with zeroes.
+
+The filesystem from which to extract the files must be unmounted,
+otherwise the call will fail." };
+
+  { defaults with
+    name = "internal_initrd_head"; added = (1, 33, 33);
+    style = RBufferOut "content", [Pathname "initrdpath"; StringList "filenames"; Int "size"], [];
+    proc_nr = Some 478; read_only = true;
+    visibility = VInternal;
+    tests = [
+      InitISOFS, Always, TestResult (
+        [["internal_initrd_head"; "/initrd-x86_64.img"; "bin/ls bin/nash"; "4"]],
+        "compare_buffers (ret, size, \"bin/nash\\0004\\000\\177ELF\", 15) == 0"), []
+    ];
+    shortdesc = "read the start of matching files in an initrd";
+    longdesc = "\
+This returns the first C<size> bytes (or fewer if the file is
+smaller) of every regular file in the initrd F<initrdpath> whose
+name is one of C<filenames>.  The initrd is only decompressed until
+all of these files have been found.
+
+The result is a list of records in the order the files appear in
+the archive.  Each record is the name of the file, the length of
+the data as a decimal number, each followed by a C<\\0> character,
+and then the data.  It is an error if none of the files is found.
+
+This is used by C<guestfs_file_architecture> to read the ELF header
+of the binaries in an initrd." };
+
+  { defaults with
+    name = "internal_inspect_probe"; added = (1, 33, 33);
+    style = RStructList ("facts", "internal_probe_fact"), [StringList "paths"; Int "maxsize"], [];
+    proc_nr = Some 479; read_only = true;
+    visibility = VInternal;
+    tests = [
+      InitISOFS, Always, TestResult (
+        [["internal_inspect_probe"; "/known-1 /directory /abssymlink /DIRECTORY/nosuchfile"; "4096"]],
+        "ret->len == 4 && "^
+        "ret->val[0].pf_type == 'r' && ret->val[0].pf_content_len > 0 && "^
+        "ret->val[1].pf_type == 'd' && "^
+        "ret->val[2].pf_ltype == 'l' && "^
+        "ret->val[3].pf_ltype == '-' && ret->val[3].pf_nocase_type == '-'"), []
+    ];
+    shortdesc = "probe a list of paths in the mounted filesystem";
+    longdesc = "\
+For each path in C<paths>, return whether it exists and its type
+(both without and with following symbolic links), its size, the
+target of the symbolic link, and the path and type of the first
+file which matches ignoring case (as in C<guestfs_case_sensitive_path>).
+Symbolic links are resolved relative to the filesystem mounted on
+F</>.  The content of regular files no larger than C<maxsize>
+bytes is returned too.
+
+A missing file has type C<->.  Other types are the same as the
+C<ftyp> field returned by C<guestfs_readdir>.
+
+This is used by inspection to avoid making many round trips per
+filesystem." };
+
+  { defaults with
+    name = "internal_hivex_query"; added = (1, 33, 33);
+    style = RStructList ("values", "internal_hivex_value"), [Pathname "hivefile"; StringList "queries"], [];
+    proc_nr = Some 480; read_only = true;
+    visibility = VInternal;
+    optional = Some "hivex";
+    tests = [
+      InitScratchFS, Always, TestResult (
+        [["upload"; "$srcdir/../../test-data/files/minimal"; "/internal_hivex_query"];
+         ["internal_hivex_query"; "/internal_hivex_query"; "nosuchkey Hostname"]],
+        "ret->len == 0"), [];
+      (* hivex-system-edits makes a SYSTEM-like hive with two control
+       * sets and Select\Current = 2 stored as REG_BINARY.
+       *)
+      InitScratchFS, Always, TestResult (
+        [["upload"; "$srcdir/../../test-data/files/minimal"; "/internal_hivex_query2"];
+         ["hivex_open"; "/internal_hivex_query2"; ""; ""; "true"];
+         ["hivex_apply"; "0"; "$srcdir/../../test-data/files/hivex-system-edits"];
+         ["hivex_commit"; "NULL"];
+         ["internal_hivex_query"; "/internal_hivex_query2"; "select current"]],
+        "ret->len == 1 && "^
+          "STREQ (ret->val[0].hv_path, \"Select\") && "^
+          "STREQ (ret->val[0].hv_key, \"Current\") && "^
+          "ret->val[0].hv_type == 3 && "^
+          "compare_buffers (ret->val[0].hv_value, ret->val[0].hv_value_len, \"\\2\\0\\0\\0\", 4) == 0"), [["hivex_close"]];
+      InitScratchFS, Always, TestResult (
+        [["upload"; "$srcdir/../../test-data/files/minimal"; "/internal_hivex_query3"];
+         ["hivex_open"; "/internal_hivex_query3"; ""; ""; "true"];
+         ["hivex_apply"; "0"; "$srcdir/../../test-data/files/hivex-system-edits"];
+         ["hivex_commit"; "NULL"];
+         ["internal_hivex_query"; "/internal_hivex_query3"; "*\\Services\\Tcpip\\Parameters Hostname"]],
+        "ret->len == 2 && "^
+          "STREQ (ret->val[0].hv_path, \"ControlSet001\\\\Services\\\\Tcpip\\\\Parameters\") && "^
+          "STREQ (ret->val[1].hv_path, \"ControlSet002\\\\Services\\\\Tcpip\\\\Parameters\")"), [["hivex_close"]];
+      InitScratchFS, Always, TestResult (
+        [["upload"; "$srcdir/../../test-data/files/minimal"; "/internal_hivex_query4"];
+         ["hivex_open"; "/internal_hivex_query4"; ""; ""; "true"];
+         ["hivex_apply"; "0"; "$srcdir/../../test-data/files/hivex-system-edits"];
+         ["hivex_commit"; "NULL"];
+         ["internal_hivex_query"; "/internal_hivex_query4"; "CurrentControlSet\\Services\\Tcpip\\Parameters Hostname"]],
+        "ret->len == 1 && "^
+          "STREQ (ret->val[0].hv_path, \"ControlSet002\\\\Services\\\\Tcpip\\\\Parameters\") && "^
+          "STREQ (ret->val[0].hv_key, \"Hostname\") && "^
+          "compare_buffers (ret->val[0].hv_value, ret->val[0].hv_value_len, \"t\\0w\\0o\\0\\0\", 8) == 0"), [["hivex_close"]]
+    ];
+    shortdesc = "query values from a registry hive";
+    longdesc = "\
+Open the Windows Registry hive file F<hivefile> read-only and return
+the values selected by C<queries>, then close it again.  This does
+not use or change the handle opened by C<guestfs_hivex_open>.
+
+C<queries> is a flat list of pairs of strings.  The first string of
+each pair is a path of key names separated by backslash characters,
+relative to the root key.  Key names are compared ignoring case.
+A key name of C<*> matches every child key.  If the first key name
+is C<CurrentControlSet> and the hive has no such key, the control
+set named by C<Select\\Current> is used instead, as Windows does
+when it loads the C<SYSTEM> hive.
+
+The second string of each pair is the name of a value to return from
+each matching key, or an empty string to return all of its values.
+Pairs with the same path are merged, so that each matching key is
+visited once and its values are returned together, in the order they
+are stored in the hive.  Keys and values which do not exist are
+ignored.
+
+Each returned value has the real path of its key, its name, its
+type and its data.
+
+This is used by inspection to read the few registry values it needs
+without making many round trips per key." };
+
+  { defaults with
+    name = "internal_file_architecture"; added = (1, 33, 33);
+    style = RString "arch", [Pathname "filename"], [];
+    proc_nr = Some 481; read_only = true;
+    visibility = VInternal;
+    tests = [
+      InitISOFS, Always, TestResultString (
+        [["internal_file_architecture"; "/bin-ppc64le-dynamic"]], "ppc64le"), [];
+      InitISOFS, Always, TestResultString (
+        [["internal_file_architecture"; "/lib-win64.dll"]], "x86_64"), [];
+      InitISOFS, Always, TestResultString (
+        [["internal_file_architecture"; "/initrd-x86_64.img"]], ""), []
+    ];
+    shortdesc = "detect the architecture of an ELF or PE binary";
+    longdesc = "\
+This reads the header of F<filename> and, if it is an ELF or PE
+binary for one of the architectures documented in
+C<guestfs_file_architecture>, returns the architecture.  For any
+other file it returns an empty string.
+
+This is used by C<guestfs_file_architecture> to avoid running
+L<file(1)> on the common types of binary." };
+
 ]
 
 (* Non-API meta-commands available only in guestfish.
@@ -1789,6 +1789,7 @@ and generate_client_actions hash () =
 
   (* Client-side stubs for each function. *)
   let generate_daemon_stub { name = name; c_name = c_name;
+                             read_only = read_only;
                              style = ret, args, optargs as style } =
     let errcode =
       match errcode_of_ret ret with
@@ -1883,6 +1884,12 @@ and generate_client_actions hash () =
     pr "  }\n";
     pr "\n";
 
+    (* Calls which may change the guest invalidate cached file content. *)
+    if not read_only then (
+      pr "  guestfs_int_free_file_cache (g);\n";
+      pr "\n"
+    );
+
     (* Send the main header and arguments. *)
     if args_passed_to_daemon = [] && optargs = [] then (
       pr "  serial = guestfs_int_send (g, GUESTFS_PROC_%s, progress_hint, 0,\n"
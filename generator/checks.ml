@@ -263,6 +263,15 @@ let () =
     | { wrapper = true } -> ()
   ) daemon_functions;
 
+  (* Check read_only flag is only set on daemon functions. *)
+  List.iter (
+    function
+    | { name = name; read_only = true } ->
+      failwithf "%s: read_only flag should only be set on daemon functions"
+        name
+    | { read_only = false } -> ()
+  ) non_daemon_functions;
+
   (* Non-fish functions must have correct camel_name. *)
   List.iter (
     fun { name = name; camel_name = camel_name } ->
@@ -535,11 +535,12 @@ cleanup_free_mountable (mountable_t *mountable)
   List.iter (
     function
     | typ, cols ->
-        pr "static const char *lvm_%s_cols = \"%s\";\n"
+        pr "const char *lvm_%s_cols = \"%s\";\n"
           typ (String.concat "," (List.map fst cols));
         pr "\n";
 
-        pr "static int lvm_tokenize_%s (char *str, guestfs_int_lvm_%s *r)\n" typ typ;
+        pr "int\n";
+        pr "lvm_tokenize_%s (char *str, guestfs_int_lvm_%s *r)\n" typ typ;
         pr "{\n";
         pr "  char *tok, *p, *next;\n";
         pr "  size_t i, j;\n";
@@ -417,6 +417,19 @@ let structs = [
     ];
     s_camel_name = "UTSName" };
 
+  (* Result of probing a block device with libblkid. *)
+  { defaults with
+    s_name = "blkprobe";
+    s_cols = [
+    "blkprobe_device", FString;
+    "blkprobe_type", FString;
+    "blkprobe_label", FString;
+    "blkprobe_uuid", FString;
+    "blkprobe_partuuid", FString;
+    "blkprobe_usage", FString;
+    ];
+    s_camel_name = "BlkProbe" };
+
   (* Used by hivex_* APIs to return a list of int64 handles (node
    * handles and value handles).  Note that we can't add a putative
    * 'RInt64List' type to the generator because we need to return
@@ -434,6 +447,19 @@ let structs = [
     "hivex_value_h", FInt64;
     ];
     s_camel_name = "HivexValue" };
+  (* File extent returned by file_extents and extents_to_files. *)
+  { defaults with
+    s_name = "extent";
+    s_cols = [
+    "ext_path", FString;
+    "ext_file_offset", FBytes;
+    "ext_device", FString;
+    "ext_device_offset", FInt64;
+    "ext_size", FBytes;
+    "ext_flags", FUInt32;
+    ];
+    s_camel_name = "Extent" };
+
   { defaults with
     s_name = "internal_mountable";
     s_internal = true;
@@ -444,6 +470,36 @@ let structs = [
     ];
     s_camel_name = "InternalMountable";
   };
+
+  (* Facts about a path, returned by internal_inspect_probe. *)
+  { defaults with
+    s_name = "internal_probe_fact";
+    s_internal = true;
+    s_cols = [
+    "pf_path", FString;
+    "pf_ltype", FChar;
+    "pf_type", FChar;
+    "pf_size", FInt64;
+    "pf_link", FString;
+    "pf_nocase_path", FString;
+    "pf_nocase_type", FChar;
+    "pf_content", FBuffer;
+    ];
+    s_camel_name = "InternalProbeFact";
+  };
+
+  (* A registry value, returned by internal_hivex_query. *)
+  { defaults with
+    s_name = "internal_hivex_value";
+    s_internal = true;
+    s_cols = [
+    "hv_path", FString;
+    "hv_key", FString;
+    "hv_type", FInt64;
+    "hv_value", FBuffer;
+    ];
+    s_camel_name = "InternalHivexValue";
+  };
 ] (* end of structs *)
 
 let lookup_struct name =
@@ -385,6 +385,14 @@ type action = {
                                      checks arguments and deals with trace
                                      messages.  Set this to false for functions
                                      that have to be thread-safe. *)
+  read_only : bool;               (* Daemon function which cannot change the
+                                     content of guest files, so the cache of
+                                     small guest files (src/file-cache.c) is
+                                     kept across the call.  Mounting and
+                                     unmounting count as read-only because
+                                     cache entries record the device.  Any
+                                     other daemon function empties the
+                                     cache. *)
 
   (* "Internal" data attached by the generator at various stages.  This
    * doesn't need to (and shouldn't) be set when defining actions.
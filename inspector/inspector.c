@@ -23,12 +23,18 @@
 #include <string.h>
 #include <inttypes.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <errno.h>
 #include <error.h>
 #include <getopt.h>
 #include <locale.h>
+#include <stdbool.h>
 #include <assert.h>
 #include <libintl.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <signal.h>
 
 #include <libxml/xmlIO.h>
 #include <libxml/xmlwriter.h>
@@ -37,8 +43,12 @@
 #include <libxml/tree.h>
 #include <libxml/xmlsave.h>
 
+#include "c-ctype.h"
+#include "full-write.h"
+
 #include "guestfs.h"
 #include "options.h"
+#include "estimate-max-threads.h"
 
 /* Currently open libguestfs handle. */
 guestfs_h *g;
@@ -53,8 +63,24 @@ int inspector = 1;
 static const char *xpath = NULL;
 static int inspect_apps = 1;
 static int inspect_icon = 1;
+static int json = 0;
 
-static void output (char **roots);
+/* Maximum number of appliances to run at the same time in batch
+ * mode, unless the user asks for more with the -P option.
+ */
+#define MAX_WORKERS 12
+
+/* Times taken by each stage of inspecting a guest in batch mode. */
+struct timings {
+  struct timeval start_t;
+  int64_t launch_ms;
+  int64_t inspect_ms;
+};
+
+static int do_batch (const char *filename, const char *format, size_t max_workers);
+static void inspect_guest (struct drv *drvs, const char *source);
+static void output (const char *source, char **roots, const struct timings *timings);
+static void output_json (const char *xml, size_t len);
 static void output_roots (xmlTextWriterPtr xo, char **roots);
 static void output_root (xmlTextWriterPtr xo, char *root);
 static void output_mountpoints (xmlTextWriterPtr xo, char *root);
@@ -77,14 +103,17 @@ usage (int status)
               "  %s [--options] -a disk.img [-a disk.img ...] file [file ...]\n"
               "Options:\n"
               "  -a|--add image       Add image\n"
+              "  --batch file         Inspect each guest listed in file\n"
               "  -c|--connect uri     Specify libvirt URI for -d option\n"
               "  -d|--domain guest    Add disks from libvirt guest\n"
               "  --echo-keys          Don't turn off echo for passphrases\n"
               "  --format[=raw|..]    Force disk format for -a option\n"
               "  --help               Display brief help\n"
+              "  --json               Output JSON instead of XML\n"
               "  --keys-from-stdin    Read passphrases from stdin\n"
               "  --no-applications    Do not output the installed applications\n"
               "  --no-icon            Do not output the guest icon\n"
+              "  -P nr_workers        Use at most nr_workers appliances with --batch\n"
               "  -v|--verbose         Verbose messages\n"
               "  -V|--version         Display version and exit\n"
               "  -x                   Trace libguestfs API calls\n"
@@ -105,14 +134,16 @@ main (int argc, char *argv[])
 
   enum { HELP_OPTION = CHAR_MAX + 1 };
 
-  static const char *options = "a:c:d:vVx";
+  static const char *options = "a:c:d:P:vVx";
   static const struct option long_options[] = {
     { "add", 1, 0, 'a' },
+    { "batch", 1, 0, 0 },
     { "connect", 1, 0, 'c' },
     { "domain", 1, 0, 'd' },
     { "echo-keys", 0, 0, 0 },
     { "format", 2, 0, 0 },
     { "help", 0, 0, HELP_OPTION },
+    { "json", 0, 0, 0 },
     { "keys-from-stdin", 0, 0, 0 },
     { "long-options", 0, 0, 0 },
     { "no-applications", 0, 0, 0 },
@@ -127,6 +158,9 @@ main (int argc, char *argv[])
   struct drv *drv;
   const char *format = NULL;
   bool format_consumed = true;
+  const char *batch = NULL;
+  const char *batch_format = NULL;
+  size_t max_workers = 0;
   int c;
   int option_index;
 
@@ -152,6 +186,12 @@ main (int argc, char *argv[])
         OPTION_format;
       } else if (STREQ (long_options[option_index].name, "xpath")) {
         xpath = optarg;
+      } else if (STREQ (long_options[option_index].name, "batch")) {
+        batch = optarg;
+        batch_format = format;
+        format_consumed = true;
+      } else if (STREQ (long_options[option_index].name, "json")) {
+        json = 1;
       } else if (STREQ (long_options[option_index].name, "no-applications")) {
         inspect_apps = 0;
       } else if (STREQ (long_options[option_index].name, "no-icon")) {
@@ -174,6 +214,17 @@ main (int argc, char *argv[])
       OPTION_d;
       break;
 
+    case 'P': {
+      int n;
+
+      if (sscanf (optarg, "%d", &n) != 1)
+        error (EXIT_FAILURE, 0, _("-P option is not numeric"));
+      if (n < 0)
+        error (EXIT_FAILURE, 0, _("-P option must not be negative"));
+      max_workers = n;
+      break;
+    }
+
     case 'v':
       OPTION_v;
       break;
@@ -247,7 +298,7 @@ main (int argc, char *argv[])
    * one extra parameter on the command line.
    */
   if (xpath) {
-    if (drvs != NULL)
+    if (drvs != NULL || batch != NULL || json)
       error (EXIT_FAILURE, 0,
              _("cannot use --xpath together with other options."));
 
@@ -256,6 +307,18 @@ main (int argc, char *argv[])
     exit (EXIT_SUCCESS);
   }
 
+  /* Batch mode is also modal: the guests come from the file. */
+  if (batch) {
+    if (drvs != NULL)
+      error (EXIT_FAILURE, 0,
+             _("cannot use --batch together with -a or -d options."));
+    if (keys_from_stdin && STREQ (batch, "-"))
+      error (EXIT_FAILURE, 0,
+             _("cannot use --batch - together with --keys-from-stdin."));
+
+    exit (do_batch (batch, batch_format, max_workers));
+  }
+
   /* User must have specified some drives. */
   if (drvs == NULL) {
     fprintf (stderr, _("%s: error: you must specify at least one -a or -d option.\n"),
@@ -263,6 +326,37 @@ main (int argc, char *argv[])
     usage (EXIT_FAILURE);
   }
 
+  inspect_guest (drvs, NULL);
+
+  guestfs_close (g);
+
+  exit (EXIT_SUCCESS);
+}
+
+static int64_t
+elapsed_ms (const struct timeval *start_t)
+{
+  struct timeval end_t;
+  int64_t start_us, end_us;
+
+  gettimeofday (&end_t, NULL);
+
+  start_us = (int64_t) start_t->tv_sec * 1000000 + start_t->tv_usec;
+  end_us = (int64_t) end_t.tv_sec * 1000000 + end_t.tv_usec;
+  return (end_us - start_us) / 1000;
+}
+
+/* Add the drives, launch the appliance, inspect the guest and print
+ * the XML document on stdout.  'source' is the line of the batch file
+ * which names the guest, or NULL if not in batch mode.
+ */
+static void
+inspect_guest (struct drv *drvs, const char *source)
+{
+  struct timings timings;
+
+  gettimeofday (&timings.start_t, NULL);
+
   /* Add drives, inspect and mount.  Note that inspector is always true,
    * and there is no -m option.
    */
@@ -274,6 +368,8 @@ main (int argc, char *argv[])
   /* Free up data structures, no longer needed after this point. */
   free_drives (drvs);
 
+  timings.launch_ms = elapsed_ms (&timings.start_t);
+
   /* NB. Can't call inspect_mount () here (ie. normal processing of
    * the -i option) because it can only handle a single root.  So we
    * use low-level APIs.
@@ -286,12 +382,10 @@ main (int argc, char *argv[])
       error (EXIT_FAILURE, 0,
              _("no operating system could be detected inside this disk image.\n\nThis may be because the file is not a disk image, or is not a virtual machine\nimage, or because the OS type is not understood by libguestfs.\n\nNOTE for Red Hat Enterprise Linux 6 users: for Windows guest support you must\ninstall the separate libguestfs-winsupport package.\n\nIf you feel this is an error, please file a bug report including as much\ninformation about the disk image as possible.\n"));
 
-    output (roots);
-  }
+    timings.inspect_ms = elapsed_ms (&timings.start_t) - timings.launch_ms;
 
-  guestfs_close (g);
-
-  exit (EXIT_SUCCESS);
+    output (source, roots, source ? &timings : NULL);
+  }
 }
 
 #define XMLERROR(code,e) do {                                           \
@@ -299,27 +393,97 @@ main (int argc, char *argv[])
       error (EXIT_FAILURE, errno, _("XML write error at \"%s\""), #e);	\
   } while (0)
 
-static void
-output (char **roots)
+/* Create the writer for an output document.  The XML is written
+ * straight to stdout, or with --json into '*buf_r' so that
+ * finish_document can convert it.
+ */
+static xmlTextWriterPtr
+start_document (xmlBufferPtr *buf_r)
 {
-  xmlOutputBufferPtr ob = xmlOutputBufferCreateFd (1, NULL);
-  if (ob == NULL)
-    error (EXIT_FAILURE, 0,
-           _("xmlOutputBufferCreateFd: failed to open stdout"));
+  xmlTextWriterPtr xo;
+
+  *buf_r = NULL;
+  if (json) {
+    *buf_r = xmlBufferCreate ();
+    if (*buf_r == NULL)
+      error (EXIT_FAILURE, 0, _("xmlBufferCreate: failed to create buffer"));
+    xo = xmlNewTextWriterMemory (*buf_r, 0);
+  }
+  else {
+    xmlOutputBufferPtr ob = xmlOutputBufferCreateFd (1, NULL);
+    if (ob == NULL)
+      error (EXIT_FAILURE, 0,
+             _("xmlOutputBufferCreateFd: failed to open stdout"));
 
-  /* 'ob' is freed when 'xo' is freed.. */
-  CLEANUP_XMLFREETEXTWRITER xmlTextWriterPtr xo = xmlNewTextWriter (ob);
+    /* 'ob' is freed when 'xo' is freed.. */
+    xo = xmlNewTextWriter (ob);
+  }
   if (xo == NULL)
     error (EXIT_FAILURE, 0,
            _("xmlNewTextWriter: failed to create libxml2 writer"));
 
-  /* Pretty-print the output. */
-  XMLERROR (-1, xmlTextWriterSetIndent (xo, 1));
-  XMLERROR (-1, xmlTextWriterSetIndentString (xo, BAD_CAST "  "));
+  /* Pretty-print the XML output. */
+  if (!json) {
+    XMLERROR (-1, xmlTextWriterSetIndent (xo, 1));
+    XMLERROR (-1, xmlTextWriterSetIndentString (xo, BAD_CAST "  "));
+  }
 
   XMLERROR (-1, xmlTextWriterStartDocument (xo, NULL, NULL, NULL));
-  output_roots (xo, roots);
+  return xo;
+}
+
+static void
+finish_document (xmlTextWriterPtr xo, xmlBufferPtr buf)
+{
   XMLERROR (-1, xmlTextWriterEndDocument (xo));
+  xmlFreeTextWriter (xo);
+
+  if (buf) {
+    output_json ((const char *) xmlBufferContent (buf),
+                 xmlBufferLength (buf));
+    xmlBufferFree (buf);
+  }
+}
+
+static void
+output (const char *source, char **roots, const struct timings *timings)
+{
+  xmlBufferPtr buf;
+  xmlTextWriterPtr xo = start_document (&buf);
+
+  if (source) {
+    XMLERROR (-1, xmlTextWriterStartElement (xo, BAD_CAST "guest"));
+    XMLERROR (-1,
+              xmlTextWriterWriteElement (xo, BAD_CAST "source",
+                                         BAD_CAST source));
+  }
+  output_roots (xo, roots);
+  if (source) {
+    char numbuf[32];
+    int64_t total_ms = elapsed_ms (&timings->start_t);
+
+    XMLERROR (-1, xmlTextWriterStartElement (xo, BAD_CAST "timings"));
+    snprintf (numbuf, sizeof numbuf, "%" PRIi64, timings->launch_ms);
+    XMLERROR (-1,
+              xmlTextWriterWriteElement (xo, BAD_CAST "launch",
+                                         BAD_CAST numbuf));
+    snprintf (numbuf, sizeof numbuf, "%" PRIi64, timings->inspect_ms);
+    XMLERROR (-1,
+              xmlTextWriterWriteElement (xo, BAD_CAST "inspect",
+                                         BAD_CAST numbuf));
+    snprintf (numbuf, sizeof numbuf, "%" PRIi64,
+              total_ms - timings->launch_ms - timings->inspect_ms);
+    XMLERROR (-1,
+              xmlTextWriterWriteElement (xo, BAD_CAST "output",
+                                         BAD_CAST numbuf));
+    snprintf (numbuf, sizeof numbuf, "%" PRIi64, total_ms);
+    XMLERROR (-1,
+              xmlTextWriterWriteElement (xo, BAD_CAST "total",
+                                         BAD_CAST numbuf));
+    XMLERROR (-1, xmlTextWriterEndElement (xo));
+    XMLERROR (-1, xmlTextWriterEndElement (xo));
+  }
+  finish_document (xo, buf);
 }
 
 static void
@@ -833,3 +997,554 @@ do_xpath (const char *query)
     free (r);
   }
 }
+
+/* JSON output (--json).
+ *
+ * The XML document is converted to a JSON object on a single line.
+ * Each element becomes a member of its parent's object, elements
+ * which contain a list become arrays, attributes become members
+ * next to the element's own text, and the empty flag elements become
+ * 'true'.  All other values are strings.
+ */
+
+static const char *json_arrays[] = {
+  "operatingsystems", "mountpoints", "filesystems", "drive_mappings",
+  "applications", NULL
+};
+
+static const char *json_flags[] = {
+  "live", "netinst", "multipart", NULL
+};
+
+static bool
+node_name_in (xmlNodePtr node, const char **names)
+{
+  size_t i;
+
+  for (i = 0; names[i] != NULL; ++i) {
+    if (STREQ ((const char *) node->name, names[i]))
+      return true;
+  }
+  return false;
+}
+
+static void
+json_string (const char *str)
+{
+  const unsigned char *p;
+
+  putchar ('"');
+  for (p = (const unsigned char *) str; *p; ++p) {
+    if (*p == '"' || *p == '\\')
+      printf ("\\%c", *p);
+    else if (*p < 0x20)
+      printf ("\\u%04x", *p);
+    else
+      putchar (*p);
+  }
+  putchar ('"');
+}
+
+static void
+json_member (const char *name, const char *value)
+{
+  json_string (name);
+  putchar (':');
+  json_string (value ? value : "");
+}
+
+static void
+json_value (xmlNodePtr node)
+{
+  xmlNodePtr child;
+  xmlAttrPtr attr;
+  bool elements = false, first = true;
+
+  for (child = node->children; child != NULL; child = child->next) {
+    if (child->type == XML_ELEMENT_NODE)
+      elements = true;
+  }
+
+  if (node_name_in (node, json_arrays)) {
+    putchar ('[');
+    for (child = node->children; child != NULL; child = child->next) {
+      if (child->type != XML_ELEMENT_NODE)
+        continue;
+      if (!first)
+        putchar (',');
+      first = false;
+      json_value (child);
+    }
+    putchar (']');
+    return;
+  }
+
+  if (node_name_in (node, json_flags)) {
+    printf ("true");
+    return;
+  }
+
+  if (!elements && node->properties == NULL) {
+    CLEANUP_FREE char *content = (char *) xmlNodeGetContent (node);
+    json_string (content ? content : "");
+    return;
+  }
+
+  putchar ('{');
+  for (attr = node->properties; attr != NULL; attr = attr->next) {
+    CLEANUP_FREE char *value = (char *) xmlNodeGetContent ((xmlNodePtr) attr);
+    if (!first)
+      putchar (',');
+    first = false;
+    json_member ((const char *) attr->name, value);
+  }
+  if (elements) {
+    for (child = node->children; child != NULL; child = child->next) {
+      if (child->type != XML_ELEMENT_NODE)
+        continue;
+      if (!first)
+        putchar (',');
+      first = false;
+      json_string ((const char *) child->name);
+      putchar (':');
+      json_value (child);
+    }
+  }
+  else {
+    /* Text of an element with attributes, eg. <mountpoint dev="..">. */
+    CLEANUP_FREE char *content = (char *) xmlNodeGetContent (node);
+    if (!first)
+      putchar (',');
+    json_member ((const char *) node->name, content);
+  }
+  putchar ('}');
+}
+
+/* Convert the XML document 'xml' and print it on stdout. */
+static void
+output_json (const char *xml, size_t len)
+{
+  CLEANUP_XMLFREEDOC xmlDocPtr doc = NULL;
+  xmlNodePtr root;
+
+  doc = xmlReadMemory (xml, len, NULL, "utf8", 0);
+  if (doc == NULL)
+    error (EXIT_FAILURE, 0, _("unable to parse the XML output"));
+  root = xmlDocGetRootElement (doc);
+  if (root == NULL)
+    error (EXIT_FAILURE, 0, _("the XML output is empty"));
+
+  /* <operatingsystems> is wrapped in an object like <guest>. */
+  if (node_name_in (root, json_arrays)) {
+    putchar ('{');
+    json_string ((const char *) root->name);
+    putchar (':');
+    json_value (root);
+    putchar ('}');
+  }
+  else
+    json_value (root);
+  putchar ('\n');
+
+  if (fflush (stdout) == EOF)
+    error (EXIT_FAILURE, errno, "fflush");
+}
+
+/* Batch mode.
+ *
+ * Each guest is inspected by a child process with its own
+ * appliance, and up to 'nr_workers' children run at the same time.
+ * The children write their XML document and any messages to
+ * temporary files, so that the parent can print the document for
+ * each guest as soon as it is finished, without the output of
+ * different guests getting mixed up.
+ */
+struct worker {
+  pid_t pid;                    /* 0 if the worker is not running */
+  const char *source;           /* Line of the batch file. */
+  int out_fd, err_fd;           /* Temporary files for stdout, stderr. */
+  struct timeval start_t;
+};
+
+/* Read the list of guests, one per line.  Blank lines and comments
+ * are ignored.
+ */
+static char **
+read_batch_file (const char *filename)
+{
+  FILE *fp;
+  char **ret = NULL;
+  size_t nr = 0;
+  CLEANUP_FREE char *line = NULL;
+  size_t allocsize = 0;
+  ssize_t len;
+
+  if (STREQ (filename, "-"))
+    fp = stdin;
+  else {
+    fp = fopen (filename, "r");
+    if (fp == NULL)
+      error (EXIT_FAILURE, errno, "fopen: %s", filename);
+  }
+
+  while ((len = getline (&line, &allocsize, fp)) != -1) {
+    const char *p = line;
+
+    while (len > 0 && c_isspace (line[len-1]))
+      line[--len] = '\0';
+    while (c_isspace (*p))
+      p++;
+    if (*p == '\0' || *p == '#')
+      continue;
+
+    ret = realloc (ret, (nr+2) * sizeof (char *));
+    if (ret == NULL)
+      error (EXIT_FAILURE, errno, "realloc");
+    ret[nr] = strdup (p);
+    if (ret[nr] == NULL)
+      error (EXIT_FAILURE, errno, "strdup");
+    nr++;
+  }
+  if (ferror (fp))
+    error (EXIT_FAILURE, errno, "getline: %s", filename);
+
+  if (fp != stdin)
+    fclose (fp);
+
+  if (ret == NULL) {
+    ret = malloc (sizeof (char *));
+    if (ret == NULL)
+      error (EXIT_FAILURE, errno, "malloc");
+  }
+  ret[nr] = NULL;
+  return ret;
+}
+
+/* Create an anonymous temporary file. */
+static int
+open_tmpfile (void)
+{
+  CLEANUP_FREE char *tmpdir = guestfs_get_tmpdir (g);
+  CLEANUP_FREE char *filename = NULL;
+  int fd;
+
+  if (tmpdir == NULL)
+    exit (EXIT_FAILURE);
+  if (asprintf (&filename, "%s/virt-inspectorXXXXXX", tmpdir) == -1)
+    error (EXIT_FAILURE, errno, "asprintf");
+
+  fd = mkstemp (filename);
+  if (fd == -1)
+    error (EXIT_FAILURE, errno, "mkstemp: %s", filename);
+  unlink (filename);
+
+  /* Don't pass the file to programs run by the child, such as qemu.
+   * This does not stop other children from inheriting it when they
+   * are forked, so start_worker closes it in those.
+   */
+  if (fcntl (fd, F_SETFD, FD_CLOEXEC) == -1)
+    error (EXIT_FAILURE, errno, "fcntl: %s", filename);
+
+  return fd;
+}
+
+/* Read the whole of a temporary file written by a child. */
+static char *
+read_tmpfile (int fd, size_t *len_r)
+{
+  char *ret = NULL;
+  size_t len = 0, allocsize = 0;
+  ssize_t r;
+
+  if (lseek (fd, 0, SEEK_SET) == -1)
+    error (EXIT_FAILURE, errno, "lseek");
+
+  for (;;) {
+    if (len + BUFSIZ + 1 > allocsize) {
+      allocsize = 2 * allocsize + BUFSIZ + 1;
+      ret = realloc (ret, allocsize);
+      if (ret == NULL)
+        error (EXIT_FAILURE, errno, "realloc");
+    }
+    r = read (fd, &ret[len], allocsize - len - 1);
+    if (r == -1) {
+      if (errno == EINTR)
+        continue;
+      error (EXIT_FAILURE, errno, "read");
+    }
+    if (r == 0)
+      break;
+    len += r;
+  }
+
+  ret[len] = '\0';
+  *len_r = len;
+  return ret;
+}
+
+static void
+start_worker (struct worker *workers, size_t nr_workers, struct worker *w,
+              const char *source, const char *format)
+{
+  pid_t pid;
+  size_t i;
+
+  w->source = source;
+  w->out_fd = open_tmpfile ();
+  w->err_fd = open_tmpfile ();
+  gettimeofday (&w->start_t, NULL);
+
+  fflush (stdout);
+  fflush (stderr);
+
+  pid = fork ();
+  if (pid == -1)
+    error (EXIT_FAILURE, errno, "fork");
+
+  if (pid == 0) {               /* Child. */
+    struct drv *drvs = NULL;
+    struct sigaction sa;
+    sigset_t mask;
+
+    /* Undo the SIGCHLD handling of the parent (see do_batch). */
+    memset (&sa, 0, sizeof sa);
+    sa.sa_handler = SIG_DFL;
+    sigaction (SIGCHLD, &sa, NULL);
+    sigemptyset (&mask);
+    sigaddset (&mask, SIGCHLD);
+    sigprocmask (SIG_UNBLOCK, &mask, NULL);
+
+    if (dup2 (w->out_fd, STDOUT_FILENO) == -1 ||
+        dup2 (w->err_fd, STDERR_FILENO) == -1)
+      _exit (EXIT_FAILURE);
+    close (w->out_fd);
+    close (w->err_fd);
+
+    /* Close the temporary files of the other running children. */
+    for (i = 0; i < nr_workers; ++i) {
+      if (workers[i].pid != 0) {
+        close (workers[i].out_fd);
+        close (workers[i].err_fd);
+      }
+    }
+
+    /* Disk images and guest names are told apart as for the
+     * old-style command line.
+     */
+    if (strchr (source, '/') || access (source, F_OK) == 0)
+      option_a (source, format, &drvs);
+    else
+      option_d (source, &drvs);
+
+    inspect_guest (drvs, source);
+
+    guestfs_close (g);
+    exit (EXIT_SUCCESS);
+  }
+
+  w->pid = pid;
+}
+
+/* Does the line 'p' start with "name: "? */
+static bool
+has_prefix (const char *p, const char *name)
+{
+  size_t len = strlen (name);
+
+  return STREQLEN (p, name, len) && STRPREFIX (&p[len], ": ");
+}
+
+/* Find the message explaining why a child failed in what it wrote
+ * to stderr, ie. the last error message from libguestfs or from
+ * virt-inspector itself.
+ */
+static char *
+find_error_message (const char *msgs, int status)
+{
+  const char *p, *msg = NULL;
+  char *ret;
+
+  p = msgs;
+  while (*p) {
+    if (STRPREFIX (p, "libguestfs: error: ") ||
+        has_prefix (p, guestfs_int_program_name) ||
+#if HAVE_DECL_PROGRAM_INVOCATION_SHORT_NAME == 1
+        /* error(3) in glibc prints the full name that the program was
+         * run with, which may be a path.
+         */
+        has_prefix (p, program_invocation_name) ||
+#endif
+        false)
+      msg = p;
+
+    p = strchrnul (p, '\n');
+    if (*p == '\n')
+      p++;
+  }
+
+  if (msg)
+    ret = strndup (msg, strchrnul (msg, '\n') - msg);
+  else if (WIFSIGNALED (status)) {
+    if (asprintf (&ret, _("killed by signal %d"), WTERMSIG (status)) == -1)
+      ret = NULL;
+  }
+  else {
+    if (asprintf (&ret, _("failed with exit status %d"),
+                  WEXITSTATUS (status)) == -1)
+      ret = NULL;
+  }
+  if (ret == NULL)
+    error (EXIT_FAILURE, errno, "strdup");
+
+  return ret;
+}
+
+/* Print the document for a guest which could not be inspected. */
+static void
+output_batch_error (const char *source, const char *msg, int64_t total_ms)
+{
+  xmlBufferPtr outbuf;
+  xmlTextWriterPtr xo = start_document (&outbuf);
+  char buf[32];
+
+  XMLERROR (-1, xmlTextWriterStartElement (xo, BAD_CAST "guest"));
+  XMLERROR (-1,
+            xmlTextWriterWriteElement (xo, BAD_CAST "source", BAD_CAST source));
+  XMLERROR (-1,
+            xmlTextWriterWriteElement (xo, BAD_CAST "error", BAD_CAST msg));
+  XMLERROR (-1, xmlTextWriterStartElement (xo, BAD_CAST "timings"));
+  snprintf (buf, sizeof buf, "%" PRIi64, total_ms);
+  XMLERROR (-1,
+            xmlTextWriterWriteElement (xo, BAD_CAST "total", BAD_CAST buf));
+  XMLERROR (-1, xmlTextWriterEndElement (xo));
+  XMLERROR (-1, xmlTextWriterEndElement (xo));
+  finish_document (xo, outbuf);
+}
+
+/* A child has exited.  Print its messages and its document, or a
+ * document describing the error.  Returns 0 if the guest was
+ * inspected, or -1 if not.
+ */
+static int
+retire_worker (struct worker *w, int status)
+{
+  CLEANUP_FREE char *msgs = NULL, *doc = NULL;
+  size_t len;
+  int ret = 0;
+
+  msgs = read_tmpfile (w->err_fd, &len);
+  if (full_write (STDERR_FILENO, msgs, len) != len)
+    error (EXIT_FAILURE, errno, "write");
+
+  if (WIFEXITED (status) && WEXITSTATUS (status) == 0) {
+    doc = read_tmpfile (w->out_fd, &len);
+    if (full_write (STDOUT_FILENO, doc, len) != len)
+      error (EXIT_FAILURE, errno, "write");
+  }
+  else {
+    CLEANUP_FREE char *msg = find_error_message (msgs, status);
+
+    output_batch_error (w->source, msg, elapsed_ms (&w->start_t));
+    ret = -1;
+  }
+
+  close (w->out_fd);
+  close (w->err_fd);
+  w->pid = 0;
+
+  return ret;
+}
+
+/* SIGCHLD only has to interrupt sigsuspend in do_batch. */
+static void
+batch_sigchld (int sig)
+{
+  /* nothing */
+}
+
+/* Inspect every guest listed in 'filename' (or stdin if "-").
+ * Returns the exit status of the program.
+ */
+static int
+do_batch (const char *filename, const char *format, size_t max_workers)
+{
+  CLEANUP_FREE_STRING_LIST char **sources = read_batch_file (filename);
+  const size_t nr_sources = guestfs_int_count_strings (sources);
+  size_t nr_workers, next = 0, running = 0, reaped, i;
+  CLEANUP_FREE struct worker *workers = NULL;
+  int status, errors = 0;
+  pid_t pid;
+  struct sigaction sa, old_sa;
+  sigset_t chld_mask, old_mask, wait_mask;
+
+  if (nr_sources == 0)          /* Nothing to do. */
+    return EXIT_SUCCESS;
+
+  /* If the user selected the -P option, then we use up to that many
+   * appliances.
+   */
+  if (max_workers > 0)
+    nr_workers = MIN (nr_sources, max_workers);
+  else
+    nr_workers = MIN (nr_sources, MIN (MAX_WORKERS, estimate_max_threads ()));
+
+  if (verbose)
+    fprintf (stderr, "batch: inspecting %zu guests with %zu workers\n",
+             nr_sources, nr_workers);
+
+  workers = calloc (nr_workers, sizeof (struct worker));
+  if (workers == NULL)
+    error (EXIT_FAILURE, errno, "calloc");
+
+  /* Workers are reaped by pid, so that we never collect a child
+   * which is not a worker.  SIGCHLD is blocked except in sigsuspend,
+   * so a worker which exits after the checks below still wakes us.
+   */
+  memset (&sa, 0, sizeof sa);
+  sa.sa_handler = batch_sigchld;
+  sigemptyset (&sa.sa_mask);
+  if (sigaction (SIGCHLD, &sa, &old_sa) == -1)
+    error (EXIT_FAILURE, errno, "sigaction");
+  sigemptyset (&chld_mask);
+  sigaddset (&chld_mask, SIGCHLD);
+  if (sigprocmask (SIG_BLOCK, &chld_mask, &old_mask) == -1)
+    error (EXIT_FAILURE, errno, "sigprocmask");
+  wait_mask = old_mask;
+  sigdelset (&wait_mask, SIGCHLD);
+
+  for (;;) {
+    for (i = 0; i < nr_workers && next < nr_sources; ++i) {
+      if (workers[i].pid == 0) {
+        start_worker (workers, nr_workers, &workers[i],
+                      sources[next++], format);
+        running++;
+      }
+    }
+
+    if (running == 0)           /* Work finished. */
+      break;
+
+    reaped = 0;
+    for (i = 0; i < nr_workers; ++i) {
+      if (workers[i].pid == 0)
+        continue;
+      pid = waitpid (workers[i].pid, &status, WNOHANG);
+      if (pid == -1)
+        error (EXIT_FAILURE, errno, "waitpid");
+      if (pid == 0)             /* Still running. */
+        continue;
+      if (retire_worker (&workers[i], status) == -1)
+        errors++;
+      running--;
+      reaped++;
+    }
+
+    if (reaped == 0)
+      sigsuspend (&wait_mask);
+  }
+
+  sigprocmask (SIG_SETMASK, &old_mask, NULL);
+  sigaction (SIGCHLD, &old_sa, NULL);
+
+  return errors == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,95 @@
+#!/bin/bash -
+# libguestfs virt-inspector test script
+# Copyright (C) 2016 Red Hat Inc.
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+# Test virt-inspector --batch.  Each guest should give the same
+# results as inspecting it on its own, and a guest which cannot be
+# inspected should give an <error> without stopping the batch.
+
+export LANG=C
+set -e
+set -x
+
+if [ -n "$SKIP_TEST_VIRT_INSPECTOR_BATCH_SH" ]; then
+    echo "$0: skipping test because SKIP_TEST_VIRT_INSPECTOR_BATCH_SH is set."
+    exit 77
+fi
+
+# ntfs-3g can't set UUIDs right now, so ignore just that <uuid>.
+diff_ignore="-I <uuid>[0-9A-F][0-9A-F][0-9A-F][0-9A-F][0-9A-F][0-9A-F][0-9A-F][0-9A-F][0-9A-F][0-9A-F][0-9A-F][0-9A-F][0-9A-F][0-9A-F][0-9A-F][0-9A-F]</uuid>"
+
+rm -f batch.list batch.xml batch.json batch-*.xml
+
+guests=
+for f in ../test-data/phony-guests/{fedora,windows}.img; do
+    # Ignore zero-sized windows.img if ntfs-3g is not installed.
+    if [ ! -s "$f" ]; then continue; fi
+    echo "$f" >> batch.list
+    guests="$guests $(basename $f .img)"
+done
+echo "# comment" >> batch.list
+echo "../test-data/phony-guests/does-not-exist.img" >> batch.list
+
+# The missing disk makes virt-inspector fail at the end.
+if virt-inspector --format=raw --batch batch.list -P 2 > batch.xml; then
+    echo "$0: virt-inspector --batch should have failed"
+    exit 1
+fi
+
+# Split the output into one file per guest.
+for b in $guests does-not-exist; do
+    awk -v src="<source>../test-data/phony-guests/$b.img</source>" '
+        /^<\?xml/ { doc = "" }
+        { doc = doc $0 "\n" }
+        index ($0, src) { found = 1 }
+        /^<\/guest>/ { if (found) printf "%s", doc; found = 0 }
+    ' batch.xml > batch-$b.xml
+done
+
+for b in $guests; do
+    grep "<total>" batch-$b.xml
+    {
+        echo '<?xml version="1.0"?>'
+        sed -n '/^  <operatingsystems>/,/^  <\/operatingsystems>/s/^  //p' \
+            batch-$b.xml
+    } > batch-$b-os.xml
+    diff -u $diff_ignore expected-$b.img.xml batch-$b-os.xml
+done
+
+grep "<error>.*does-not-exist.img" batch-does-not-exist.xml
+
+# With --json there is one line for each guest.
+if virt-inspector --format=raw --batch batch.list -P 2 --json > batch.json; then
+    echo "$0: virt-inspector --batch --json should have failed"
+    exit 1
+fi
+
+test "$(wc -l < batch.json)" -eq "$(echo $guests does-not-exist | wc -w)"
+for b in $guests; do
+    grep '^{"source":"../test-data/phony-guests/'$b'.img","operatingsystems":\[{"root":' batch.json
+done
+grep '^{"source":"../test-data/phony-guests/does-not-exist.img","error":"libguestfs: error: [^"]*does-not-exist.img' batch.json
+
+# --json also works outside batch mode.
+virt-inspector --format=raw -a ../test-data/phony-guests/fedora.img --json |
+    grep '^{"operatingsystems":\[{"root":"/dev/VG/Root",.*"hostname":"fedora.invalid"'
+
+# A negative number of workers is rejected.
+virt-inspector --format=raw --batch batch.list -P -1 2>&1 |
+    grep -- "-P option must not be negative"
+
+rm -f batch.list batch.xml batch.json batch-*.xml
@@ -0,0 +1,59 @@
+#!/bin/bash -
+# libguestfs virt-inspector test script
+# Copyright (C) 2016 Red Hat Inc.
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+# Test the persistent inspection cache (guestfs_set_inspect_cache).
+
+export LANG=C
+set -e
+set -x
+
+if [ -n "$SKIP_TEST_VIRT_INSPECTOR_CACHE_SH" ]; then
+    echo "$0: skipping test because SKIP_TEST_VIRT_INSPECTOR_CACHE_SH is set."
+    exit 77
+fi
+
+f=../test-data/phony-guests/fedora.img
+rm -f cache-fedora.img cache-1.xml cache-2.xml cache-3.xml cache.log
+
+# Use a copy of the image so that it has a new identity, and so
+# we can modify it.
+cp $f cache-fedora.img
+
+export LIBGUESTFS_INSPECT_CACHE=1
+
+# The first run inspects the disk and saves the results.
+virt-inspector --format=raw -a cache-fedora.img > cache-1.xml
+diff -u expected-fedora.img.xml cache-1.xml
+
+# The second run must use the cache.
+LIBGUESTFS_DEBUG=1 \
+  virt-inspector --format=raw -a cache-fedora.img > cache-2.xml 2> cache.log
+grep "inspect cache: loaded" cache.log
+diff -u cache-1.xml cache-2.xml
+
+# After the image is modified, it must be inspected again.
+touch cache-fedora.img
+LIBGUESTFS_DEBUG=1 \
+  virt-inspector --format=raw -a cache-fedora.img > cache-3.xml 2> cache.log
+if grep "inspect cache: loaded" cache.log; then
+    echo "$0: inspection cache was used for a modified disk image"
+    exit 1
+fi
+diff -u cache-1.xml cache-3.xml
+
+rm cache-fedora.img cache-1.xml cache-2.xml cache-3.xml cache.log
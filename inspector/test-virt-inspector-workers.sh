@@ -0,0 +1,48 @@
+#!/bin/bash -
+# libguestfs virt-inspector test script
+# Copyright (C) 2016 Red Hat Inc.
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+# Test that inspecting using several appliances
+# (guestfs_set_inspect_workers) gives the same results.
+
+export LANG=C
+set -e
+set -x
+
+if [ -n "$SKIP_TEST_VIRT_INSPECTOR_WORKERS_SH" ]; then
+    echo "$0: skipping test because SKIP_TEST_VIRT_INSPECTOR_WORKERS_SH is set."
+    exit 77
+fi
+
+# ntfs-3g can't set UUIDs right now, so ignore just that <uuid>.
+diff_ignore="-I <uuid>[0-9A-F][0-9A-F][0-9A-F][0-9A-F][0-9A-F][0-9A-F][0-9A-F][0-9A-F][0-9A-F][0-9A-F][0-9A-F][0-9A-F][0-9A-F][0-9A-F][0-9A-F][0-9A-F]</uuid>"
+
+rm -f workers-*.xml workers.log
+
+for f in ../test-data/phony-guests/{fedora,windows}.img; do
+    b=$(basename $f .img)
+
+    # Ignore zero-sized windows.img if ntfs-3g is not installed.
+    if [ ! -s "$f" ]; then continue; fi
+
+    LIBGUESTFS_INSPECT_WORKERS=3 LIBGUESTFS_DEBUG=1 \
+      virt-inspector --format=raw -a "$f" > workers-$b.xml 2> workers.log
+    grep "inspect workers: checking" workers.log
+    diff -u $diff_ignore expected-$b.img.xml workers-$b.xml
+done
+
+rm -f workers-*.xml workers.log
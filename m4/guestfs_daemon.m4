@@ -93,6 +93,14 @@ AC_CHECK_LIB([cap],[cap_from_text],[
     ], [])
 ],[AC_MSG_WARN([Linux capabilities library (libcap) not found])])
 
+dnl The Sleuth Kit library (optional)
+AC_CHECK_LIB([tsk],[tsk_version_print],[
+    AC_CHECK_HEADER([tsk/libtsk.h],[
+        AC_SUBST([LIBTSK_LIBS], [-ltsk])
+        AC_DEFINE([HAVE_LIBTSK], [1], [Define to 1 if The Sleuth Kit library (libtsk) is available.])
+    ], [])
+],[AC_MSG_WARN([The Sleuth Kit library (libtsk) not found])])
+
 dnl hivex library (highly recommended)
 dnl This used to be a part of libguestfs, but was spun off into its
 dnl own separate upstream project in libguestfs 1.0.85.
@@ -104,6 +112,30 @@ PKG_CHECK_MODULES([HIVEX], [hivex],[
     [AC_MSG_WARN([hivex not found, some core features will be disabled])])
 AM_CONDITIONAL([HAVE_HIVEX],[test "x$HIVEX_LIBS" != "x"])
 
+dnl libblkid library (optional)
+PKG_CHECK_MODULES([BLKID], [blkid],[
+    AC_SUBST([BLKID_CFLAGS])
+    AC_SUBST([BLKID_LIBS])
+    AC_DEFINE([HAVE_BLKID],[1],[libblkid library found at compile time.])
+],
+    [AC_MSG_WARN([libblkid not found, the daemon will run the blkid command instead])])
+
+dnl libzstd library (optional)
+PKG_CHECK_MODULES([LIBZSTD], [libzstd],[
+    AC_SUBST([LIBZSTD_CFLAGS])
+    AC_SUBST([LIBZSTD_LIBS])
+    AC_DEFINE([HAVE_LIBZSTD],[1],[libzstd library found at compile time.])
+],
+    [AC_MSG_WARN([libzstd not found, zstd uploads will be decompressed by the zstd command])])
+
+dnl zlib (optional)
+PKG_CHECK_MODULES([ZLIB], [zlib],[
+    AC_SUBST([ZLIB_CFLAGS])
+    AC_SUBST([ZLIB_LIBS])
+    AC_DEFINE([HAVE_ZLIB],[1],[zlib found at compile time.])
+],
+    [AC_MSG_WARN([zlib not found, gzip-compressed initrds will be read using the zcat command])])
+
 dnl systemd journal library (optional)
 PKG_CHECK_MODULES([SD_JOURNAL], [libsystemd],[
     AC_SUBST([SD_JOURNAL_CFLAGS])
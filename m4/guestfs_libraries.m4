@@ -44,6 +44,7 @@ AC_CHECK_HEADERS([\
     endian.h \
     sys/endian.h \
     errno.h \
+    linux/fiemap.h \
     linux/fs.h \
     linux/raid/md_u.h \
     printf.h \
@@ -58,19 +58,29 @@ let decode_utf16le str =
   done;
   copy
 
-let rec import_key (g : Guestfs.guestfs) root (path, values) =
-  (* Create the path starting at the root node. *)
-  let node =
-    let rec loop parent = function
-      | [] -> parent
-      | x :: xs ->
-        let node =
-          match g#hivex_node_get_child parent x with
-          | 0L -> g#hivex_node_add_child parent x (* not found, create *)
-          | node -> node in
-        loop node xs
-    in
-    loop root path in
+(* All the edits are sent to the appliance in a single call to
+ * hivex_apply.  See the description of that call for the format.
+ *)
+let rec reg_import (g : Guestfs.guestfs) root regedits =
+  let buf = Buffer.create 4096 in
+  List.iter (import_key buf) regedits;
+
+  let tmpfile = Filename.temp_file "regedit" ".edits" in
+  unlink_on_exit tmpfile;
+  let chan = open_out_bin tmpfile in
+  Buffer.output_buffer chan buf;
+  close_out chan;
+
+  g#hivex_apply root tmpfile
+
+and import_key buf (path, values) =
+  (* Create the path starting at the root node.  Backslash is the
+   * path separator, and cannot appear in key names.
+   *)
+  List.iter (fun x -> assert (not (String.contains x '\\'))) path;
+  let path = String.concat "\\" path in
+  add_field buf "add";
+  add_field buf path;
 
   (* Delete any existing values in this node. *)
   (* g#hivex_node_set_values ...
@@ -78,32 +88,37 @@ let rec import_key (g : Guestfs.guestfs) root (path, values) =
      binding for it in libguestfs.  I'm not sure how much this matters. *)
 
   (* Create the values. *)
-  import_values g node values
+  List.iter (import_value buf path) values
+
+and import_value buf path (key, value) =
+  let t, data = encode_value value in
+  add_field buf "set";
+  add_field buf path;
+  add_field buf key;
+  add_field buf (Int64.to_string t);
+  add_field buf (string_of_int (String.length data));
+  Buffer.add_string buf data
 
-and import_values g node = List.iter (import_value g node)
+and add_field buf str =
+  Buffer.add_string buf str;
+  Buffer.add_char buf '\000'
 
-and import_value g node = function
-  | key, REG_NONE -> g#hivex_node_set_value node key 0L ""
+and encode_value = function
+  | REG_NONE -> 0L, ""
   (* All string registry fields have a terminating NUL, which in
    * UTF-16LE means they have 3 zero bytes -- the first is the high
    * byte from the last character, and the second and third are the
    * UTF-16LE encoding of ASCII NUL.  So we have to add two zero
    * bytes at the end of string fields.
    *)
-  | key, REG_SZ s ->
-    g#hivex_node_set_value node key 1L (encode_utf16le s ^ "\000\000")
-  | key, REG_EXPAND_SZ s ->
-    g#hivex_node_set_value node key 2L (encode_utf16le s ^ "\000\000")
-  | key, REG_BINARY bin ->
-    g#hivex_node_set_value node key 3L bin
-  | key, REG_DWORD dw ->
-    g#hivex_node_set_value node key 4L (le32_of_int (Int64.of_int32 dw))
-  | key, REG_MULTI_SZ ss ->
+  | REG_SZ s -> 1L, encode_utf16le s ^ "\000\000"
+  | REG_EXPAND_SZ s -> 2L, encode_utf16le s ^ "\000\000"
+  | REG_BINARY bin -> 3L, bin
+  | REG_DWORD dw -> 4L, le32_of_int (Int64.of_int32 dw)
+  | REG_MULTI_SZ ss ->
     (* http://blogs.msdn.com/oldnewthing/archive/2009/10/08/9904646.aspx *)
     List.iter (fun s -> assert (s <> "")) ss;
     let ss = ss @ [""] in
     let ss = List.map (fun s -> encode_utf16le s ^ "\000\000") ss in
     let ss = String.concat "" ss in
-    g#hivex_node_set_value node key 7L ss
-
-let reg_import g root = List.iter (import_key g root)
+    7L, ss
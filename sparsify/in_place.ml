@@ -35,7 +35,7 @@ let rec run disk format ignores machine_readable zeroes =
 
   (* Capture ^C and clean up gracefully. *)
   let quit = ref false in
-  let set_quit _ = quit := true in
+  let set_quit _ = quit := true; g#user_cancel () in
   Sys.set_signal Sys.sigint (Sys.Signal_handle set_quit);
   Sys.set_signal Sys.sigquit (Sys.Signal_handle set_quit);
   g#set_pgroup true;
@@ -76,54 +76,65 @@ and perform g disk format ignores machine_readable zeroes quit =
 
   let is_read_only_lv = is_read_only_lv g in
 
+  let filesystems =
+    List.filter (
+      fun fs -> not (is_ignored fs) && not (is_read_only_lv fs)
+    ) filesystems in
+  let zero_fses, trim_fses =
+    List.partition (fun fs -> List.mem fs zeroes) filesystems in
+
   let tasks =
     List.map (
       fun fs () ->
-        if not (is_ignored fs) && not (is_read_only_lv fs) then (
-          if List.mem fs zeroes then (
-            message (f_"Zeroing %s") fs;
-
-            if not (g#blkdiscardzeroes fs) then
-              g#zero_device fs;
-            g#blkdiscard fs
-          ) else (
-            let mounted =
-              try g#mount_options "discard" fs "/"; true
+        message (f_"Zeroing %s") fs;
+
+        if not (g#blkdiscardzeroes fs) then
+          g#zero_device fs;
+        g#blkdiscard fs
+    ) zero_fses in
+
+  (* The daemon mounts and trims all the other filesystems in
+   * parallel.  Those which could not be mounted may be swap, and
+   * for any others we print the error returned by the daemon.
+   *)
+  let trim_task () =
+    if trim_fses <> [] then (
+      message (f_"Trimming %s") (String.concat " " trim_fses);
+
+      let status =
+        try g#trim_filesystems (Array.of_list trim_fses)
+        with G.Error _ when !quit -> [] in
+      List.iter (
+        fun (fs, msg) ->
+          if msg <> "" && not !quit then (
+            let is_linux_x86_swap =
+              (* Look for the signature for Linux swap on i386.
+               * Location depends on page size, so it definitely won't
+               * work on non-x86 architectures (eg. on PPC, page size is
+               * 64K).  Also this avoids hibernated swap space: in those,
+               * the signature is moved to a different location.
+               *)
+              try g#pread_device fs 10 4086L = "SWAPSPACE2"
               with _ -> false in
 
-            if mounted then (
-              message (f_"Trimming %s") fs;
-
-              g#fstrim "/"
-            ) else (
-              let is_linux_x86_swap =
-                (* Look for the signature for Linux swap on i386.
-                 * Location depends on page size, so it definitely won't
-                 * work on non-x86 architectures (eg. on PPC, page size is
-                 * 64K).  Also this avoids hibernated swap space: in those,
-                 * the signature is moved to a different location.
-                 *)
-                try g#pread_device fs 10 4086L = "SWAPSPACE2"
-                with _ -> false in
-
-              if is_linux_x86_swap then (
-                message (f_"Clearing Linux swap on %s") fs;
-
-                (* Don't use mkswap.  Just preserve the header containing
-                 * the label, UUID and swap format version (libguestfs
-                 * mkswap may differ from guest's own).
-                 *)
-                let header = g#pread_device fs 4096 0L in
-                g#blkdiscard fs;
-                if g#pwrite_device fs header 0L <> 4096 then
-                  error (f_"pwrite: short write restoring swap partition header")
-              )
+            if is_linux_x86_swap then (
+              message (f_"Clearing Linux swap on %s") fs;
+
+              (* Don't use mkswap.  Just preserve the header containing
+               * the label, UUID and swap format version (libguestfs
+               * mkswap may differ from guest's own).
+               *)
+              let header = g#pread_device fs 4096 0L in
+              g#blkdiscard fs;
+              if g#pwrite_device fs header 0L <> 4096 then
+                error (f_"pwrite: short write restoring swap partition header")
             )
-          );
-
-          g#umount_all ()
-        )
-    ) filesystems in
+            else
+              warning (f_"%s was not trimmed: %s") fs msg
+          )
+      ) status
+    ) in
+  let tasks = tasks @ [ trim_task ] in
 
   (* Discard unused space in volume groups. *)
   let vgs = g#vgs () in
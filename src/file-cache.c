@@ -0,0 +1,209 @@
+/* libguestfs
+ * Copyright (C) 2016 Red Hat Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/**
+ * A cache of the content of small guest files.
+ *
+ * Inspection reads the same small files (F</etc/os-release>,
+ * F</etc/fstab>, F</etc/hostname> and so on) several times: once
+ * per filesystem which is checked, and again when the
+ * C<guestfs_inspect_*> and C<guestfs_list_applications2> calls
+ * need them.
+ *
+ * Each entry records the device, inode, size and times of the file
+ * when it was read.  The device number identifies the filesystem,
+ * so an entry is not used after a different filesystem is mounted
+ * at the same place.  An entry is only used if C<guestfs_statns>
+ * still returns the same values.
+ *
+ * Since the inspection code is not the only caller which may change
+ * the guest, the whole cache is also emptied before any call to the
+ * daemon which is not marked C<read_only> in F<generator/actions.ml>
+ * (the generated client stubs call C<guestfs_int_free_file_cache>),
+ * and when the appliance is shut down.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <string.h>
+#include <libintl.h>
+
+#include "hash.h"
+#include "hash-pjw.h"
+
+#include "guestfs.h"
+#include "guestfs-internal.h"
+
+/* Don't let the cache grow without bound. */
+#define FILE_CACHE_MAX_SIZE (16 * 1000 * 1000)
+
+struct file_cache_entry {
+  char *path;
+  int64_t dev, ino, size;
+  int64_t mtime_sec, mtime_nsec;
+  int64_t ctime_sec, ctime_nsec;
+  char *content;                /* 'size' bytes followed by '\0' */
+};
+
+static size_t
+file_cache_hash (void const *x, size_t table_size)
+{
+  struct file_cache_entry const *p = x;
+  return hash_pjw (p->path, table_size);
+}
+
+static bool
+file_cache_compare (void const *x, void const *y)
+{
+  struct file_cache_entry const *a = x;
+  struct file_cache_entry const *b = y;
+  return STREQ (a->path, b->path);
+}
+
+static void
+file_cache_free (void *x)
+{
+  if (x) {
+    struct file_cache_entry *p = x;
+
+    free (p->path);
+    free (p->content);
+    free (p);
+  }
+}
+
+void
+guestfs_int_free_file_cache (guestfs_h *g)
+{
+  if (g->file_cache)
+    hash_free (g->file_cache);
+  g->file_cache = NULL;
+  g->file_cache_size = 0;
+}
+
+static const struct file_cache_entry *
+file_cache_lookup (guestfs_h *g, const char *path,
+                   const struct guestfs_statns *st)
+{
+  struct file_cache_entry key = { .path = (char *) path }, *entry;
+
+  if (g->file_cache == NULL)
+    return NULL;
+
+  entry = hash_lookup (g->file_cache, &key);
+  if (entry == NULL ||
+      entry->dev != st->st_dev || entry->ino != st->st_ino ||
+      entry->size != st->st_size ||
+      entry->mtime_sec != st->st_mtime_sec ||
+      entry->mtime_nsec != st->st_mtime_nsec ||
+      entry->ctime_sec != st->st_ctime_sec ||
+      entry->ctime_nsec != st->st_ctime_nsec)
+    return NULL;
+
+  return entry;
+}
+
+static void
+file_cache_add (guestfs_h *g, const char *path,
+                const struct guestfs_statns *st, const char *content)
+{
+  struct file_cache_entry *entry, *old;
+
+  if (g->file_cache_size + st->st_size > FILE_CACHE_MAX_SIZE)
+    guestfs_int_free_file_cache (g);
+
+  if (g->file_cache == NULL) {
+    g->file_cache =
+      hash_initialize (16, NULL, file_cache_hash, file_cache_compare,
+                       file_cache_free);
+    if (g->file_cache == NULL)
+      return;
+  }
+
+  entry = safe_malloc (g, sizeof *entry);
+  entry->path = safe_strdup (g, path);
+  entry->dev = st->st_dev;
+  entry->ino = st->st_ino;
+  entry->size = st->st_size;
+  entry->mtime_sec = st->st_mtime_sec;
+  entry->mtime_nsec = st->st_mtime_nsec;
+  entry->ctime_sec = st->st_ctime_sec;
+  entry->ctime_nsec = st->st_ctime_nsec;
+  entry->content = safe_malloc (g, st->st_size + 1);
+  memcpy (entry->content, content, st->st_size + 1);
+
+  old = hash_delete (g->file_cache, entry);
+  if (old) {
+    g->file_cache_size -= old->size;
+    file_cache_free (old);
+  }
+  if (hash_insert (g->file_cache, entry) == NULL) {
+    file_cache_free (entry);
+    return;
+  }
+  g->file_cache_size += entry->size;
+}
+
+/**
+ * Read the whole of the small file C<path>, which must not be larger
+ * than C<maxsize> bytes, using the cache if possible.  A trailing
+ * C<\0> is added to the content, which is not counted in
+ * C<*size_r>.
+ */
+char *
+guestfs_int_file_cache_read (guestfs_h *g, const char *path,
+                             size_t maxsize, size_t *size_r)
+{
+  CLEANUP_FREE_STATNS struct guestfs_statns *st = NULL;
+  const struct file_cache_entry *entry;
+  char *content;
+  size_t len;
+
+  st = guestfs_statns (g, path);
+  if (st == NULL)
+    return NULL;
+  if (st->st_size < 0 || (uint64_t) st->st_size > maxsize) {
+    error (g, _("size of %s is unreasonably large (%" PRIi64 " bytes)"),
+           path, st->st_size);
+    return NULL;
+  }
+
+  entry = file_cache_lookup (g, path, st);
+  if (entry) {
+    content = safe_malloc (g, entry->size + 1);
+    memcpy (content, entry->content, entry->size + 1);
+    *size_r = entry->size;
+    return content;
+  }
+
+  content = guestfs_read_file (g, path, &len);
+  if (content == NULL)
+    return NULL;
+  content = safe_realloc (g, content, len + 1);
+  content[len] = '\0';
+
+  /* If the file changed while it was being read, don't cache it. */
+  if (len == (size_t) st->st_size)
+    file_cache_add (g, path, st, content);
+
+  *size_r = len;
+  return content;
+}
@@ -32,6 +32,8 @@
 #endif
 
 #include "ignore-value.h"
+#include "hash.h"
+#include "hash-pjw.h"
 
 #include "guestfs.h"
 #include "guestfs-internal.h"
@@ -105,17 +107,11 @@ canonical_elf_arch (guestfs_h *g, const char *endianness, const char *elf_arch)
   return ret;
 }
 
-static int
-is_regular_file (const char *filename)
-{
-  struct stat statbuf;
-
-  return lstat (filename, &statbuf) == 0 && S_ISREG (statbuf.st_mode);
-}
-
+/* Run libmagic on a file, or on a buffer if 'filename' is NULL. */
 static char *
-magic_for_file (guestfs_h *g, const char *filename, bool *loading_ok,
-                bool *matched)
+magic_for_file (guestfs_h *g, const char *filename,
+                const void *buf, size_t len,
+                bool *loading_ok, bool *matched)
 {
   int flags;
   CLEANUP_MAGIC_T_FREE magic_t m = NULL;
@@ -142,9 +138,12 @@ magic_for_file (guestfs_h *g, const char *filename, bool *loading_ok,
     return NULL;
   }
 
-  line = magic_file (m, filename);
+  if (filename)
+    line = magic_file (m, filename);
+  else
+    line = magic_buffer (m, buf, len);
   if (line == NULL) {
-    perrorf (g, "magic_file: %s", filename);
+    perrorf (g, "magic_file: %s", filename ? filename : "(buffer)");
     return NULL;
   }
 
@@ -162,7 +161,10 @@ magic_for_file (guestfs_h *g, const char *filename, bool *loading_ok,
   return canonical_elf_arch (g, endianness, elf_arch);
 }
 
-/* Download and uncompress the cpio file to find binaries within. */
+/* Binaries to look for in the initrd, in order of preference.  Only
+ * the start of each one is read, which is enough for libmagic to find
+ * the architecture in the ELF header.
+ */
 static const char *initrd_binaries[] = {
   "bin/ls",
   "bin/rm",
@@ -175,84 +177,73 @@ static const char *initrd_binaries[] = {
   NULL
 };
 
-static char *
-cpio_arch (guestfs_h *g, const char *file, const char *path)
-{
-  CLEANUP_FREE char *tmpdir = guestfs_get_tmpdir (g), *dir = NULL;
-  CLEANUP_FREE char *initrd = NULL;
-  CLEANUP_CMD_CLOSE struct command *cmd = guestfs_int_new_command (g);
-  char *ret = NULL;
-  const char *method;
-  int64_t size;
-  int r;
-  size_t i;
-
-  if (asprintf (&dir, "%s/libguestfsXXXXXX", tmpdir) == -1) {
-    perrorf (g, "asprintf");
-    return NULL;
-  }
+#define INITRD_HEAD_SIZE 4096
 
-  if (strstr (file, "gzip"))
-    method = "zcat";
-  else if (strstr (file, "bzip2"))
-    method = "bzcat";
-  else
-    method = "cat";
+/* Find the start of 'name' in the result of internal_initrd_head,
+ * which is a list of records each made of the file name, the length
+ * of the data as a decimal number (both followed by '\0') and the
+ * data.  Returns NULL if it is not there.
+ */
+static const char *
+find_initrd_head (const char *buf, size_t size, const char *name,
+                  size_t *len_r)
+{
+  const char *p = buf, *end = buf + size, *len_str, *q;
+  size_t len;
 
-  /* Security: Refuse to download initrd if it is huge. */
-  size = guestfs_filesize (g, path);
-  if (size == -1 || size > 100000000) {
-    error (g, _("size of %s unreasonable (%" PRIi64 " bytes)"),
-           path, size);
-    goto out;
+  while (p < end) {
+    q = memchr (p, '\0', end - p);
+    if (q == NULL)
+      return NULL;
+    len_str = q + 1;
+    q = memchr (len_str, '\0', end - len_str);
+    if (q == NULL || sscanf (len_str, "%zu", &len) != 1 ||
+        len > (size_t) (end - (q + 1)))
+      return NULL;
+    if (STREQ (p, name)) {
+      *len_r = len;
+      return q + 1;
+    }
+    p = q + 1 + len;
   }
+  return NULL;
+}
 
-  if (mkdtemp (dir) == NULL) {
-    perrorf (g, "mkdtemp");
-    goto out;
-  }
+static char *
+cpio_arch (guestfs_h *g, const char *path)
+{
+  CLEANUP_FREE char *buf = NULL;
+  size_t size, i;
 
-  initrd = safe_asprintf (g, "%s/initrd", dir);
-  if (guestfs_download (g, path, initrd) == -1)
-    goto out;
+  /* The daemon decompresses the initrd (however it is compressed,
+   * and including initrds with several segments) and returns the
+   * start of each of the binaries it finds.
+   */
+  buf = guestfs_internal_initrd_head (g, path, (char **) initrd_binaries,
+                                      INITRD_HEAD_SIZE, &size);
+  if (buf == NULL)
+    return NULL;
 
-  /* Construct a command to extract named binaries from the initrd file. */
-  guestfs_int_cmd_add_string_unquoted (cmd, "cd ");
-  guestfs_int_cmd_add_string_quoted   (cmd, dir);
-  guestfs_int_cmd_add_string_unquoted (cmd, " && ");
-  guestfs_int_cmd_add_string_unquoted (cmd, method);
-  guestfs_int_cmd_add_string_unquoted (cmd, " initrd | cpio --quiet -id");
+  /* Like the old code which extracted them all with cpio(1), try
+   * each binary until one of them is recognized.
+   */
   for (i = 0; initrd_binaries[i] != NULL; ++i) {
-    guestfs_int_cmd_add_string_unquoted (cmd, " ");
-    guestfs_int_cmd_add_string_quoted (cmd, initrd_binaries[i]);
-  }
-
-  r = guestfs_int_cmd_run (cmd);
-  if (r == -1)
-    goto out;
-  if (!WIFEXITED (r) || WEXITSTATUS (r) != 0) {
-    guestfs_int_external_command_failed (g, r, "cpio", path);
-    goto out;
+    const char *data;
+    size_t len;
+    bool loading_ok, matched;
+    char *ret;
+
+    data = find_initrd_head (buf, size, initrd_binaries[i], &len);
+    if (data == NULL)
+      continue;
+
+    ret = magic_for_file (g, NULL, data, len, &loading_ok, &matched);
+    if (!loading_ok || matched)
+      return ret;
   }
 
-  for (i = 0; initrd_binaries[i] != NULL; ++i) {
-    CLEANUP_FREE char *bin =
-      safe_asprintf (g, "%s/%s", dir, initrd_binaries[i]);
-
-    if (is_regular_file (bin)) {
-      bool loading_ok, matched;
-
-      ret = magic_for_file (g, bin, &loading_ok, &matched);
-      if (!loading_ok || matched)
-        goto out;
-    }
-  }
   error (g, "file_architecture: could not determine architecture of cpio archive");
-
- out:
-  guestfs_int_recursive_remove_dir (g, dir);
-
-  return ret;
+  return NULL;
 }
 
 static char *
@@ -305,7 +296,7 @@ compressed_file_arch (guestfs_h *g, const char *path, const char *method)
     goto out;
   }
 
-  ret = magic_for_file (g, tempfile_extracted, NULL, &matched);
+  ret = magic_for_file (g, tempfile_extracted, NULL, 0, NULL, &matched);
   if (!matched)
     error (g, "file_architecture: could not determine architecture of compressed file");
 
@@ -315,8 +306,11 @@ compressed_file_arch (guestfs_h *g, const char *path, const char *method)
   return ret;
 }
 
-char *
-guestfs_impl_file_architecture (guestfs_h *g, const char *path)
+/* Use libmagic for the types of file which the daemon does not
+ * recognize (see daemon/filearch.c).
+ */
+static char *
+magic_file_architecture (guestfs_h *g, const char *path)
 {
   CLEANUP_FREE char *file = NULL;
   CLEANUP_FREE char *elf_arch = NULL;
@@ -337,7 +331,7 @@ guestfs_impl_file_architecture (guestfs_h *g, const char *path)
   else if (strstr (file, "PE32+ executable"))
     ret = safe_strdup (g, "x86_64");
   else if (strstr (file, "cpio archive"))
-    ret = cpio_arch (g, file, path);
+    ret = cpio_arch (g, path);
   else if (strstr (file, "gzip compressed data"))
     ret = compressed_file_arch (g, path, "zcat");
   else if (strstr (file, "XZ compressed data"))
@@ -352,14 +346,137 @@ guestfs_impl_file_architecture (guestfs_h *g, const char *path)
 
 /* XXX Should be an optgroup. */
 
-#define NOT_IMPL(r)                                                     \
-  error (g, _("file-architecture API not available since this version of libguestfs was compiled without the libmagic library")); \
-  return r
+static char *
+magic_file_architecture (guestfs_h *g, const char *path)
+{
+  error (g, _("file-architecture API not available since this version of libguestfs was compiled without the libmagic library"));
+  return NULL;
+}
+
+#endif /* no libmagic at compile time */
+
+/* The architecture of each file is cached in the handle, since
+ * inspection asks for the same binaries repeatedly.  An entry is
+ * only used if the file has the same inode and modification time as
+ * when it was cached.  The cache is emptied when the appliance is
+ * shut down.
+ */
+struct filearch_entry {
+  char *path;
+  int64_t dev, ino;
+  int64_t mtime_sec, mtime_nsec;
+  char *arch;
+};
+
+static size_t
+filearch_hash (void const *x, size_t table_size)
+{
+  struct filearch_entry const *p = x;
+  return hash_pjw (p->path, table_size);
+}
+
+static bool
+filearch_compare (void const *x, void const *y)
+{
+  struct filearch_entry const *a = x;
+  struct filearch_entry const *b = y;
+  return STREQ (a->path, b->path);
+}
+
+static void
+filearch_free (void *x)
+{
+  if (x) {
+    struct filearch_entry *p = x;
+
+    free (p->path);
+    free (p->arch);
+    free (p);
+  }
+}
+
+static void
+filearch_cache_add (guestfs_h *g, const struct guestfs_statns *st,
+                    const char *path, const char *arch)
+{
+  struct filearch_entry *entry;
+
+  if (g->filearch_cache == NULL) {
+    g->filearch_cache =
+      hash_initialize (16, NULL, filearch_hash, filearch_compare,
+                       filearch_free);
+    if (g->filearch_cache == NULL)
+      return;
+  }
+
+  entry = safe_malloc (g, sizeof *entry);
+  entry->path = safe_strdup (g, path);
+  entry->dev = st->st_dev;
+  entry->ino = st->st_ino;
+  entry->mtime_sec = st->st_mtime_sec;
+  entry->mtime_nsec = st->st_mtime_nsec;
+  entry->arch = safe_strdup (g, arch);
+
+  filearch_free (hash_delete (g->filearch_cache, entry));
+  if (hash_insert (g->filearch_cache, entry) == NULL)
+    filearch_free (entry);
+}
+
+static const char *
+filearch_cache_lookup (guestfs_h *g, const struct guestfs_statns *st,
+                       const char *path)
+{
+  struct filearch_entry key = { .path = (char *) path }, *entry;
+
+  if (g->filearch_cache == NULL)
+    return NULL;
+
+  entry = hash_lookup (g->filearch_cache, &key);
+  if (entry == NULL ||
+      entry->dev != st->st_dev || entry->ino != st->st_ino ||
+      entry->mtime_sec != st->st_mtime_sec ||
+      entry->mtime_nsec != st->st_mtime_nsec)
+    return NULL;
+
+  return entry->arch;
+}
+
+void
+guestfs_int_free_filearch_cache (guestfs_h *g)
+{
+  if (g->filearch_cache)
+    hash_free (g->filearch_cache);
+  g->filearch_cache = NULL;
+}
 
 char *
 guestfs_impl_file_architecture (guestfs_h *g, const char *path)
 {
-  NOT_IMPL(NULL);
-}
+  CLEANUP_FREE_STATNS struct guestfs_statns *st = NULL;
+  const char *cached;
+  char *ret;
 
-#endif /* no libmagic at compile time */
+  st = guestfs_statns (g, path);
+  if (st == NULL)
+    return NULL;
+
+  cached = filearch_cache_lookup (g, st, path);
+  if (cached) {
+    debug (g, "file_architecture: %s: %s (cached)", path, cached);
+    return safe_strdup (g, cached);
+  }
+
+  /* The daemon reads the header of ELF and PE binaries itself. */
+  ret = guestfs_internal_file_architecture (g, path);
+  if (ret == NULL)
+    return NULL;
+  if (STREQ (ret, "")) {
+    free (ret);
+    ret = magic_file_architecture (g, path);
+    if (ret == NULL)
+      return NULL;
+  }
+
+  filearch_cache_add (g, st, path, ret);
+  return ret;                   /* caller frees */
+}
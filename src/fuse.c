@@ -20,8 +20,11 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
 #include <unistd.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <string.h>
@@ -62,6 +65,12 @@ static const struct stat *lsc_lookup (guestfs_h *, const char *pathname);
 static const struct guestfs_xattr_list *xac_lookup (guestfs_h *, const char *pathname);
 static const char *rlc_lookup (guestfs_h *, const char *pathname);
 
+/* Functions handling the read-ahead window. */
+static int init_readahead (guestfs_h *);
+static void free_readahead (guestfs_h *);
+static void readahead_invalidate (guestfs_h *, const char *path);
+static ssize_t readahead_read (guestfs_h *, const char *path, char *buf, size_t size, off_t offset);
+
 /* This lock protects access to g->localmountpoint. */
 gl_lock_define_initialized (static, mount_local_lock);
 
@@ -644,10 +653,18 @@ mount_local_read (const char *path, char *buf, size_t size, off_t offset,
 {
   char *r;
   size_t rsize;
+  ssize_t n;
   const size_t limit = 2 * 1024 * 1024;
   DECL_G ();
   DEBUG_CALL ("%s, %p, %zu, %ld", path, buf, size, (long) offset);
 
+  /* Sequential reads are served from the read-ahead window, which
+   * is filled using a single pread_ranges call.
+   */
+  n = readahead_read (g, path, buf, size, offset);
+  if (n >= 0)
+    return n;
+
   /* The guestfs protocol limits size to somewhere over 2MB.  We just
    * reduce the requested size here accordingly and push the problem
    * up to every user.  http://www.jwz.org/doc/worse-is-better.html
@@ -987,6 +1004,11 @@ guestfs_impl_mount_local (guestfs_h *g, const char *localmountpoint,
   if (init_dir_caches (g) == -1)
     return -1;
 
+  if (init_readahead (g) == -1) {
+    guestfs_int_free_fuse (g);
+    return -1;
+  }
+
   /* Create the FUSE 'args'. */
   /* XXX we don't have a program name */
   if (fuse_opt_add_arg (&args, "guestfs_mount_local") == -1) {
@@ -1098,6 +1120,7 @@ guestfs_int_free_fuse (guestfs_h *g)
     fuse_destroy (g->fuse);     /* also closes the channel */
   g->fuse = NULL;
   free_dir_caches (g);
+  free_readahead (g);
 }
 
 int
@@ -1494,6 +1517,215 @@ dir_cache_invalidate (guestfs_h *g, const char *path)
   gen_remove (g->lsc_ht, path, lsc_free);
   gen_remove (g->xac_ht, path, xac_free);
   gen_remove (g->rlc_ht, path, rlc_free);
+  readahead_invalidate (g, path);
+}
+
+/* Read-ahead.
+ *
+ * FUSE splits reads into requests of at most 128K, and each one
+ * costs a round trip to the daemon.  When a file is read
+ * sequentially we instead fetch a much larger window in one
+ * pread_ranges call, store it in an unlinked temporary file, and
+ * answer the following reads from there.
+ *
+ * The window is dropped whenever the file is modified through the
+ * mountpoint (see dir_cache_invalidate), and it expires after the
+ * same timeout as the directory cache, since the file could be
+ * changed by other means.
+ *
+ * Each fill asks for a single range, and there is no attempt to
+ * merge several reads into one pread_ranges call.  We run the
+ * single-threaded fuse_loop, so only one read is ever outstanding
+ * and there are no pending requests to merge with.  The adjacent
+ * reads of a sequential run are already merged, because the whole
+ * window is one range.  Reads of different files can't share a call,
+ * because pread_ranges only reads one file.
+ */
+#define READAHEAD_WINDOW (4 * 1024 * 1024)
+
+struct ml_readahead {
+  int fd;                       /* Unlinked temporary file. */
+  char *path;                   /* File covered by the window, or NULL. */
+  off_t offset;                 /* Start of the window in the file. */
+  size_t size;                  /* Size of the window. */
+  time_t timeout;               /* Window is invalid after this time. */
+  char *last_path;              /* Used to detect sequential reads. */
+  off_t last_end;
+};
+
+static int
+init_readahead (guestfs_h *g)
+{
+  struct ml_readahead *ra;
+  CLEANUP_FREE char *tmpfile = NULL;
+
+  if (guestfs_int_lazy_make_tmpdir (g) == -1)
+    return -1;
+
+  ra = safe_calloc (g, 1, sizeof *ra);
+  tmpfile = safe_asprintf (g, "%s/readahead", g->tmpdir);
+  ra->fd = open (tmpfile, O_RDWR|O_CREAT|O_TRUNC|O_NOCTTY|O_CLOEXEC, 0600);
+  if (ra->fd == -1) {
+    perrorf (g, "open: %s", tmpfile);
+    free (ra);
+    return -1;
+  }
+  unlink (tmpfile);
+
+  g->ml_ra = ra;
+  return 0;
+}
+
+static void
+free_readahead (guestfs_h *g)
+{
+  struct ml_readahead *ra = g->ml_ra;
+
+  if (ra == NULL)
+    return;
+
+  close (ra->fd);
+  free (ra->path);
+  free (ra->last_path);
+  free (ra);
+  g->ml_ra = NULL;
+}
+
+static void
+readahead_invalidate (guestfs_h *g, const char *path)
+{
+  struct ml_readahead *ra = g->ml_ra;
+
+  if (ra && ra->path && STREQ (ra->path, path)) {
+    free (ra->path);
+    ra->path = NULL;
+  }
+}
+
+/* Fill the window for 'path' starting at 'offset'.  Returns 0 if
+ * the window was filled, 1 if 'offset' is at or beyond the end of
+ * the file, or -1 if the window could not be filled, in which case
+ * the caller falls back to an ordinary pread.
+ */
+static int
+readahead_fill (guestfs_h *g, const char *path, off_t offset, time_t now)
+{
+  struct ml_readahead *ra = g->ml_ra;
+  const struct stat *st;
+  int64_t filesize;
+  size_t size;
+  char range[64];
+  char devfd[32];
+  const char *ranges[2] = { range, NULL };
+
+  readahead_invalidate (g, path);
+
+  st = lsc_lookup (g, path);
+  if (st)
+    filesize = st->st_size;
+  else {
+    CLEANUP_FREE_STATNS struct guestfs_statns *ss = guestfs_statns (g, path);
+    if (ss == NULL)
+      return -1;
+    filesize = ss->st_size;
+  }
+  if (offset >= filesize)
+    return 1;
+
+  size = READAHEAD_WINDOW;
+  if ((int64_t) size > filesize - offset)
+    size = filesize - offset;
+
+  snprintf (range, sizeof range, "%" PRIi64 ":%zu", (int64_t) offset, size);
+  snprintf (devfd, sizeof devfd, "/dev/fd/%d", ra->fd);
+
+  if (guestfs_pread_ranges (g, path, (char **) ranges, devfd) == -1)
+    return -1;
+
+  ra->path = safe_strdup (g, path);
+  ra->offset = offset;
+  ra->size = size;
+  ra->timeout = now + g->ml_dir_cache_timeout;
+  return 0;
+}
+
+static int
+readahead_covers (struct ml_readahead *ra, const char *path, off_t offset)
+{
+  return ra->path && STREQ (ra->path, path) &&
+    offset >= ra->offset && offset < ra->offset + (off_t) ra->size;
+}
+
+/* Try to satisfy a read from the read-ahead window, filling it if
+ * this read continues the previous one.  Returns the number of bytes
+ * read, or -1 if the caller should use guestfs_pread instead.
+ *
+ * FUSE (without direct_io) treats a short read as end of file, so a
+ * read which runs off the end of the window must refill it and carry
+ * on, and may only return fewer than 'size' bytes at end of file.
+ */
+static ssize_t
+readahead_read (guestfs_h *g, const char *path, char *buf, size_t size,
+                off_t offset)
+{
+  struct ml_readahead *ra = g->ml_ra;
+  time_t now;
+  int sequential;
+  size_t done, n;
+  off_t pos;
+  ssize_t r;
+
+  if (ra == NULL || size == 0)
+    return -1;
+
+  time (&now);
+
+  sequential =
+    ra->last_path && STREQ (ra->last_path, path) && ra->last_end == offset;
+  if (!sequential) {
+    free (ra->last_path);
+    ra->last_path = safe_strdup (g, path);
+  }
+  ra->last_end = offset + size;
+
+  if (ra->path && ra->timeout < now) {
+    free (ra->path);
+    ra->path = NULL;
+  }
+
+  /* Only start a new window when the file is being read
+   * sequentially, otherwise random access would fetch far more
+   * data than it uses.
+   */
+  if (!sequential && !readahead_covers (ra, path, offset))
+    return -1;
+
+  for (done = 0; done < size; done += r) {
+    pos = offset + done;
+
+    if (!readahead_covers (ra, path, pos)) {
+      r = readahead_fill (g, path, pos, now);
+      if (r == 1)               /* End of file. */
+        break;
+      if (r == -1)
+        goto fallback;
+    }
+
+    n = ra->offset + ra->size - pos;
+    if (n > size - done)
+      n = size - done;
+
+    r = pread (ra->fd, buf + done, n, pos - ra->offset);
+    if (r <= 0)
+      goto fallback;
+  }
+
+  return done;
+
+ fallback:
+  /* Let the caller redo the whole read with guestfs_pread. */
+  readahead_invalidate (g, path);
+  return -1;
 }
 
 #else /* !HAVE_FUSE */
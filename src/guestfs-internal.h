@@ -380,10 +380,12 @@ struct guestfs_h
   bool enable_network;          /* Enable the network. */
   bool selinux;                 /* selinux enabled? */
   bool pgroup;                  /* Create process group for children? */
+  bool inspect_cache;           /* Use the persistent inspection cache? */
   bool close_on_exit;           /* Is this handle on the atexit list? */
 
   int smp;                      /* If > 1, -smp flag passed to hv. */
   int memsize;			/* Size of RAM (megabytes). */
+  int inspect_workers;          /* Max appliances used by inspect_os. */
 
   char *path;			/* Path to the appliance. */
   char *hv;			/* Hypervisor (HV) binary. */
@@ -459,6 +461,12 @@ struct guestfs_h
   struct inspect_fs *fses;
   size_t nr_fses;
 
+  /* While inspection is checking a filesystem, the facts returned by
+   * guestfs_internal_inspect_probe for the filesystem mounted on /.
+   * NULL at all other times.
+   */
+  struct guestfs_internal_probe_fact_list *probe_facts;
+
   /* Private data area. */
   struct hash_table *pda;
   struct pda_entry *pda_next;
@@ -467,6 +475,7 @@ struct guestfs_h
    * matter for this case because we only care if it is != 0.
    */
   int user_cancel;
+  int cancel_sent;              /* Cancellation was passed to the daemon. */
 
   struct timeval launch_t;      /* The time that we called guestfs_launch. */
 
@@ -483,6 +492,13 @@ struct guestfs_h
   struct connection *conn;              /* Connection to appliance. */
   int msg_next_serial;
 
+  /* Cache of guestfs_file_architecture results, see src/filearch.c. */
+  Hash_table *filearch_cache;
+
+  /* Cache of the content of small files, see src/file-cache.c. */
+  Hash_table *file_cache;
+  size_t file_cache_size;
+
 #if HAVE_FUSE
   /**** Used by the mount-local APIs. ****/
   const char *localmountpoint;
@@ -491,6 +507,7 @@ struct guestfs_h
   Hash_table *lsc_ht, *xac_ht, *rlc_ht; /* Directory cache. */
   int ml_read_only;                     /* If mounted read-only. */
   int ml_debug_calls;        /* Extra debug info on each FUSE call. */
+  struct ml_readahead *ml_ra;           /* Sequential read-ahead window. */
 #endif
 
 #ifdef HAVE_LIBVIRT_BACKEND
@@ -627,6 +644,14 @@ struct inspect_fstab_entry {
   char *mountpoint;
 };
 
+/* An entry of /etc/fstab, see src/inspect-conf.c. */
+struct fstab_line {
+  char *spec;
+  char *file;
+  char *vfstype;
+  char *options;
+};
+
 struct guestfs_message_header;
 struct guestfs_message_error;
 struct guestfs_progress;
@@ -801,15 +826,36 @@ extern char *guestfs_int_download_to_tmp (guestfs_h *g, struct inspect_fs *fs, c
 extern struct inspect_fs *guestfs_int_search_for_root (guestfs_h *g, const char *root);
 extern int guestfs_int_is_partition (guestfs_h *g, const char *partition);
 
+/* inspect-cache.c */
+extern char *guestfs_int_inspect_cache_file (guestfs_h *g, char **key_r);
+extern int guestfs_int_inspect_cache_load (guestfs_h *g, const char *filename, const char *key);
+extern void guestfs_int_inspect_cache_save (guestfs_h *g, const char *filename, const char *key);
+extern void guestfs_int_inspect_cache_prune (guestfs_h *g, const char *filename);
+
+/* inspect-conf.c */
+extern int guestfs_int_parse_fstab (guestfs_h *g, char *const *lines, struct fstab_line **entries_r, size_t *nr_entries_r);
+extern void guestfs_int_free_fstab_lines (struct fstab_line *entries, size_t nr_entries);
+extern char *guestfs_int_fstab_option (guestfs_h *g, const char *options, const char *name);
+extern char **guestfs_int_parse_mdadm_conf (guestfs_h *g, char *const *lines);
+extern int guestfs_int_parse_shellvar (guestfs_h *g, char *const *lines, const char *name, char **value_r);
+
+/* inspect-parallel.c */
+extern int guestfs_int_check_filesystems_parallel (guestfs_h *g, char **fses);
+
 /* inspect-fs.c */
+extern int guestfs_int_inspect_is_file (guestfs_h *g, const char *path, int followsymlinks);
+extern int guestfs_int_inspect_is_dir (guestfs_h *g, const char *path);
 extern int guestfs_int_is_file_nocase (guestfs_h *g, const char *);
 extern int guestfs_int_is_dir_nocase (guestfs_h *g, const char *);
+extern int guestfs_int_probe_case_sensitive_path (guestfs_h *g, const char *path, char **ret);
 extern int guestfs_int_check_for_filesystem_on (guestfs_h *g,
                                               const char *mountable);
 extern int guestfs_int_parse_unsigned_int (guestfs_h *g, const char *str);
 extern int guestfs_int_parse_unsigned_int_ignore_trailing (guestfs_h *g, const char *str);
 extern int guestfs_int_parse_major_minor (guestfs_h *g, struct inspect_fs *fs);
 extern char *guestfs_int_first_line_of_file (guestfs_h *g, const char *filename);
+extern char *guestfs_int_inspect_read_small_file (guestfs_h *g, const char *filename, size_t maxsize, size_t *size_r);
+extern char **guestfs_int_inspect_read_lines (guestfs_h *g, const char *filename, size_t maxsize);
 extern int guestfs_int_first_egrep_of_file (guestfs_h *g, const char *filename, const char *eregex, int iflag, char **ret);
 extern void guestfs_int_check_package_format (guestfs_h *g, struct inspect_fs *fs);
 extern void guestfs_int_check_package_management (guestfs_h *g, struct inspect_fs *fs);
@@ -829,14 +875,22 @@ extern int guestfs_int_check_coreos_usr (guestfs_h *g, struct inspect_fs *fs);
 extern char *guestfs_int_case_sensitive_path_silently (guestfs_h *g, const char *);
 extern char * guestfs_int_get_windows_systemroot (guestfs_h *g);
 extern int guestfs_int_check_windows_root (guestfs_h *g, struct inspect_fs *fs, char *windows_systemroot);
+extern char *guestfs_int_utf16_to_utf8 (/* const */ char *input, size_t len);
 
 /* inspect-fs-cd.c */
 extern int guestfs_int_check_installer_root (guestfs_h *g, struct inspect_fs *fs);
 extern int guestfs_int_check_installer_iso (guestfs_h *g, struct inspect_fs *fs, const char *device);
 
-/* dbdump.c */
-typedef int (*guestfs_int_db_dump_callback) (guestfs_h *g, const unsigned char *key, size_t keylen, const unsigned char *value, size_t valuelen, void *opaque);
-extern int guestfs_int_read_db_dump (guestfs_h *g, const char *dumpfile, void *opaque, guestfs_int_db_dump_callback callback);
+/* rpmdb.c */
+typedef int (*guestfs_int_rpmdb_callback) (guestfs_h *g, const unsigned char *header, size_t len, void *opaque);
+extern int guestfs_int_read_rpmdb (guestfs_h *g, const char *dbfile, void *opaque, guestfs_int_rpmdb_callback callback);
+
+/* filearch.c */
+extern void guestfs_int_free_filearch_cache (guestfs_h *g);
+
+/* file-cache.c */
+extern void guestfs_int_free_file_cache (guestfs_h *g);
+extern char *guestfs_int_file_cache_read (guestfs_h *g, const char *path, size_t maxsize, size_t *size_r);
 
 /* lpj.c */
 extern int guestfs_int_get_lpj (guestfs_h *g);
@@ -869,13 +923,21 @@ struct osinfo {
   int is_multipart_disk;
 #endif
 
-  /* The regular expressions used to match ISOs. */
+  /* The regular expressions used to match ISOs, and their compiled
+   * forms.  These are compiled on first use (see src/osinfo.c).
+   */
+  char *system_id;
+  char *volume_id;
+  char *publisher_id;
+  char *application_id;
+  int compiled;
   pcre *re_system_id;
   pcre *re_volume_id;
   pcre *re_publisher_id;
   pcre *re_application_id;
 };
 extern int guestfs_int_osinfo_map (guestfs_h *g, const struct guestfs_isoinfo *isoinfo, const struct osinfo **osinfo_ret);
+extern int guestfs_int_read_osinfo_db (guestfs_h *g, const char *dir, const char *index_file, struct osinfo **db_r, size_t *nr_r);
 
 /* command.c */
 struct command;
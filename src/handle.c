@@ -105,6 +105,9 @@ guestfs_create_flags (unsigned flags, ...)
   /* Default is uniprocessor appliance. */
   g->smp = 1;
 
+  /* Default is to inspect filesystems using only this handle. */
+  g->inspect_workers = 1;
+
   g->path = strdup (GUESTFS_DEFAULT_PATH);
   if (!g->path) goto error;
 
@@ -181,7 +184,7 @@ parse_environment (guestfs_h *g,
                    char *(*do_getenv) (const void *data, const char *),
                    const void *data)
 {
-  int memsize, b;
+  int memsize, workers, b;
   char *str;
 
   /* Don't bother checking the return values of functions
@@ -220,6 +223,26 @@ parse_environment (guestfs_h *g,
       return -1;
   }
 
+  str = do_getenv (data, "LIBGUESTFS_INSPECT_CACHE");
+  if (str && STRNEQ (str, "")) {
+    b = guestfs_int_is_true (str);
+    if (b == -1) {
+      error (g, _("%s=%s: non-boolean value"), "LIBGUESTFS_INSPECT_CACHE", str);
+      return -1;
+    }
+    guestfs_set_inspect_cache (g, b);
+  }
+
+  str = do_getenv (data, "LIBGUESTFS_INSPECT_WORKERS");
+  if (str && STRNEQ (str, "")) {
+    if (sscanf (str, "%d", &workers) != 1) {
+      error (g, _("non-numeric value for LIBGUESTFS_INSPECT_WORKERS"));
+      return -1;
+    }
+    if (guestfs_set_inspect_workers (g, workers) == -1)
+      return -1;
+  }
+
   str = do_getenv (data, "TMPDIR");
   if (guestfs_int_set_env_tmpdir (g, str) == -1)
     return -1;
@@ -373,6 +396,8 @@ guestfs_close (guestfs_h *g)
 #endif
 
   guestfs_int_free_inspect_info (g);
+  guestfs_int_free_filearch_cache (g);
+  guestfs_int_free_file_cache (g);
   guestfs_int_free_drives (g);
 
   for (hp = g->hv_params; hp; hp = hp_next) {
@@ -458,6 +483,8 @@ shutdown_backend (guestfs_h *g, int check_for_errors)
   }
 
   guestfs_int_free_drives (g);
+  guestfs_int_free_filearch_cache (g);
+  guestfs_int_free_file_cache (g);
 
   for (i = 0; i < g->nr_features; ++i)
     free (g->features[i].group);
@@ -21,7 +21,9 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <string.h>
+#include <errno.h>
 
 #ifdef HAVE_ENDIAN_H
 #include <endian.h>
@@ -44,9 +46,7 @@
 #include "guestfs-internal.h"
 #include "guestfs-internal-actions.h"
 
-#ifdef DB_DUMP
 static struct guestfs_application2_list *list_applications_rpm (guestfs_h *g, struct inspect_fs *fs);
-#endif
 static struct guestfs_application2_list *list_applications_deb (guestfs_h *g, struct inspect_fs *fs);
 static struct guestfs_application2_list *list_applications_pacman (guestfs_h *g, struct inspect_fs *fs);
 static struct guestfs_application2_list *list_applications_apk (guestfs_h *g, struct inspect_fs *fs);
@@ -121,11 +121,9 @@ guestfs_impl_inspect_list_applications2 (guestfs_h *g, const char *root)
     case OS_TYPE_HURD:
       switch (fs->package_format) {
       case OS_PACKAGE_FORMAT_RPM:
-#ifdef DB_DUMP
         ret = list_applications_rpm (g, fs);
         if (ret == NULL)
           return NULL;
-#endif
         break;
 
       case OS_PACKAGE_FORMAT_DEB:
@@ -185,74 +183,11 @@ guestfs_impl_inspect_list_applications2 (guestfs_h *g, const char *root)
   return ret;
 }
 
-#ifdef DB_DUMP
-
-/* This data comes from the Name database, and contains the application
- * names and the first 4 bytes of each link field.
- */
-struct rpm_names_list {
-  struct rpm_name *names;
-  size_t len;
-};
-struct rpm_name {
-  char *name;
-  char link[4];
-};
-
-static void
-free_rpm_names_list (struct rpm_names_list *list)
-{
-  size_t i;
-
-  for (i = 0; i < list->len; ++i)
-    free (list->names[i].name);
-  free (list->names);
-}
-
-static int
-compare_links (const void *av, const void *bv)
-{
-  const struct rpm_name *a = av;
-  const struct rpm_name *b = bv;
-  return memcmp (a->link, b->link, 4);
-}
-
-static int
-read_rpm_name (guestfs_h *g,
-               const unsigned char *key, size_t keylen,
-               const unsigned char *value, size_t valuelen,
-               void *listv)
-{
-  struct rpm_names_list *list = listv;
-  const unsigned char *link_p;
-  char *name;
-
-  /* Ignore bogus entries. */
-  if (keylen == 0 || valuelen < 4)
-    return 0;
-
-  /* A name entry will have as many links as installed instances of
-   * that package.  For example, if glibc.i686 and glibc.x86_64 are
-   * both installed, then there will be a link for each Packages
-   * entry.  Add an entry onto list for all installed instances.
-   */
-  for (link_p = value; link_p < value + valuelen; link_p += 8) {
-    name = safe_strndup (g, (const char *) key, keylen);
-
-    list->names = safe_realloc (g, list->names,
-                                (list->len + 1) * sizeof (struct rpm_name));
-    list->names[list->len].name = name;
-    memcpy (list->names[list->len].link, link_p, 4);
-    list->len++;
-  }
-
-  return 0;
-}
-
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wcast-align"
 
 /* tag constants, see rpmtag.h in RPM for complete list */
+#define RPMTAG_NAME 1000
 #define RPMTAG_VERSION 1001
 #define RPMTAG_RELEASE 1002
 #define RPMTAG_EPOCH 1003
@@ -268,8 +203,8 @@ get_rpm_header_tag (guestfs_h *g, const unsigned char *header_start,
   char iv[4];
 
   /* This function parses the RPM header structure to pull out various
-   * tag strings (version, release, arch, etc.).  For more detail on the
-   * header format, see:
+   * tag strings (name, version, release, arch, etc.).  For more detail
+   * on the header format, see:
    * http://www.rpm.org/max-rpm/s1-rpm-file-format-rpm-file-format.html#S2-RPM-FILE-FORMAT-HEADER
    */
 
@@ -281,17 +216,19 @@ get_rpm_header_tag (guestfs_h *g, const unsigned char *header_start,
     return NULL;
 
   num_fields = be32toh (*(uint32_t *) header_start);
+  if (num_fields > (header_len - 8) / 16)
+    return NULL;
   store = header_start + 8 + (16 * num_fields);
 
   /* The first byte *after* the buffer.  If you are here, you've gone
    * too far! */
   header_end = header_start + header_len;
 
-  while (cursor < store && cursor <= header_end - 16) {
+  while (cursor < store) {
     if (be32toh (*(uint32_t *) cursor) == tag) {
       offset = be32toh(*(uint32_t *) (cursor + 8));
 
-      if (store + offset >= header_end)
+      if (offset >= (size_t) (header_end - store))
         return NULL;
       max_len = header_end - (store + offset);
 
@@ -315,50 +252,26 @@ get_rpm_header_tag (guestfs_h *g, const unsigned char *header_start,
   return NULL;
 }
 
-struct read_package_data {
-  struct rpm_names_list *list;
-  struct guestfs_application2_list *apps;
-};
-
 static int
 read_package (guestfs_h *g,
-              const unsigned char *key, size_t keylen,
-              const unsigned char *value, size_t valuelen,
-              void *datav)
+              const unsigned char *header, size_t len,
+              void *appsv)
 {
-  struct read_package_data *data = datav;
-  struct rpm_name nkey, *entry;
-  CLEANUP_FREE char *version = NULL, *release = NULL,
+  struct guestfs_application2_list *apps = appsv;
+  CLEANUP_FREE char *name = NULL, *version = NULL, *release = NULL,
     *epoch_str = NULL, *arch = NULL;
   int32_t epoch;
 
-  /* This function reads one (key, value) pair from the Packages
-   * database.  The key is the link field (see struct rpm_name).  The
-   * value is a long binary string, but we can extract the header data
-   * from it as below.  First we have to look up the link field in the
-   * list of links (which is sorted by link field).
-   */
-
-  /* Ignore bogus entries. */
-  if (keylen < 4 || valuelen == 0)
-    return 0;
-
-  /* Look up the link (key) in the list. */
-  memcpy (nkey.link, key, 4);
-  entry = bsearch (&nkey, data->list->names, data->list->len,
-                   sizeof (struct rpm_name), compare_links);
-  if (!entry)
-    return 0;                   /* Not found - ignore it. */
-
-  /* We found a matching link entry, so that gives us the application
-   * name (entry->name).  Now we can get other data for this
-   * application out of the binary value string.
+  /* This function is called with one header from the Packages
+   * database.  Every header carries the package name as well as the
+   * other data we want, so there is no need to consult the Name
+   * index.
    */
-
-  version = get_rpm_header_tag (g, value, valuelen, RPMTAG_VERSION, 's');
-  release = get_rpm_header_tag (g, value, valuelen, RPMTAG_RELEASE, 's');
-  epoch_str = get_rpm_header_tag (g, value, valuelen, RPMTAG_EPOCH, 'i');
-  arch = get_rpm_header_tag (g, value, valuelen, RPMTAG_ARCH, 's');
+  name = get_rpm_header_tag (g, header, len, RPMTAG_NAME, 's');
+  version = get_rpm_header_tag (g, header, len, RPMTAG_VERSION, 's');
+  release = get_rpm_header_tag (g, header, len, RPMTAG_RELEASE, 's');
+  epoch_str = get_rpm_header_tag (g, header, len, RPMTAG_EPOCH, 'i');
+  arch = get_rpm_header_tag (g, header, len, RPMTAG_ARCH, 's');
 
   /* The epoch is stored as big-endian integer. */
   if (epoch_str)
@@ -366,9 +279,12 @@ read_package (guestfs_h *g,
   else
     epoch = 0;
 
-  /* Add the application and what we know. */
-  if (version && release)
-    add_application (g, data->apps, entry->name, "", epoch, version, release,
+  /* Add the application and what we know.  The header of the
+   * gpg-pubkey pseudo-packages has a name, version and release too,
+   * so they are listed in the same way as 'rpm -qa' does.
+   */
+  if (name && version && release)
+    add_application (g, apps, name, "", epoch, version, release,
                      arch ? arch : "", "", "", "", "");
 
   return 0;
@@ -376,57 +292,64 @@ read_package (guestfs_h *g,
 
 #pragma GCC diagnostic pop
 
+/* Where the RPM database may be found, in order of preference.
+ * rpmdb.sqlite is used by Fedora >= 33 and Packages.db (ndb) by
+ * SUSE; Packages is the older Berkeley DB database.  Newer
+ * distributions keep the database in /usr/lib/sysimage/rpm, with
+ * /var/lib/rpm being a symlink to it.
+ */
+static const char *rpmdb_paths[] = {
+  "/var/lib/rpm/rpmdb.sqlite",
+  "/var/lib/rpm/Packages.db",
+  "/var/lib/rpm/Packages",
+  "/usr/lib/sysimage/rpm/rpmdb.sqlite",
+  "/usr/lib/sysimage/rpm/Packages.db",
+  "/usr/lib/sysimage/rpm/Packages",
+  NULL
+};
+
 static struct guestfs_application2_list *
 list_applications_rpm (guestfs_h *g, struct inspect_fs *fs)
 {
-  CLEANUP_FREE char *Name = NULL, *Packages = NULL;
-  struct rpm_names_list list = { .names = NULL, .len = 0 };
+  CLEANUP_FREE char *Packages = NULL;
   struct guestfs_application2_list *apps = NULL;
-  struct read_package_data data;
+  size_t i;
+  int r;
 
-  Name = guestfs_int_download_to_tmp (g, fs,
-				      "/var/lib/rpm/Name", "rpm_Name",
-				      MAX_PKG_DB_SIZE);
-  if (Name == NULL)
-    goto error;
+  /* Allocate 'apps' list. */
+  apps = safe_malloc (g, sizeof *apps);
+  apps->len = 0;
+  apps->val = NULL;
+
+  for (i = 0; rpmdb_paths[i] != NULL; ++i) {
+    r = guestfs_is_file_opts (g, rpmdb_paths[i],
+                              GUESTFS_IS_FILE_OPTS_FOLLOWSYMLINKS, 1, -1);
+    if (r == -1)
+      goto error;
+    if (r > 0)
+      break;
+  }
+  if (rpmdb_paths[i] == NULL)   /* No RPM database, so no applications. */
+    return apps;
 
   Packages = guestfs_int_download_to_tmp (g, fs,
-					  "/var/lib/rpm/Packages", "rpm_Packages",
+					  rpmdb_paths[i], "rpm_Packages",
 					  MAX_PKG_DB_SIZE);
   if (Packages == NULL)
     goto error;
 
-  /* Read Name database. */
-  if (guestfs_int_read_db_dump (g, Name, &list, read_rpm_name) == -1)
-    goto error;
-
-  /* Sort the names by link field for fast searching. */
-  qsort (list.names, list.len, sizeof (struct rpm_name), compare_links);
-
-  /* Allocate 'apps' list. */
-  apps = safe_malloc (g, sizeof *apps);
-  apps->len = 0;
-  apps->val = NULL;
-
   /* Read Packages database. */
-  data.list = &list;
-  data.apps = apps;
-  if (guestfs_int_read_db_dump (g, Packages, &data, read_package) == -1)
+  if (guestfs_int_read_rpmdb (g, Packages, apps, read_package) == -1)
     goto error;
 
-  free_rpm_names_list (&list);
-
   return apps;
 
  error:
-  free_rpm_names_list (&list);
   guestfs_free_application2_list (apps);
 
   return NULL;
 }
 
-#endif /* defined DB_DUMP */
-
 static struct guestfs_application2_list *
 list_applications_deb (guestfs_h *g, struct inspect_fs *fs)
 {
@@ -777,7 +700,28 @@ list_applications_apk (guestfs_h *g, struct inspect_fs *fs)
   return ret;
 }
 
-static void list_applications_windows_from_path (guestfs_h *g, struct guestfs_application2_list *apps, const char **path, size_t path_len);
+static int list_applications_windows_from_query (guestfs_h *g, struct guestfs_application2_list *apps, const char *software_path);
+static void list_applications_windows_from_path (guestfs_h *g, struct guestfs_application2_list *apps, const char *path);
+
+/* Where applications are registered in the SOFTWARE hive. */
+static const char *const uninstall_paths[] = {
+  /* Ordinary native applications. */
+  "Microsoft\\Windows\\CurrentVersion\\Uninstall",
+
+  /* 32-bit emulated Windows apps running on the WOW64 emulator.
+   * http://support.microsoft.com/kb/896459 (RHBZ#692545).
+   */
+  "WOW6432node\\Microsoft\\Windows\\CurrentVersion\\Uninstall",
+  NULL
+};
+
+/* The values of each application's node which we use. */
+static const char *const uninstall_keys[] = {
+  "DisplayName", "DisplayVersion", "InstallLocation",
+  "Publisher", "URLInfoAbout", "Comments", NULL
+};
+#define NR_UNINSTALL_KEYS \
+  (sizeof uninstall_keys / sizeof uninstall_keys[0] - 1)
 
 static struct guestfs_application2_list *
 list_applications_windows (guestfs_h *g, struct inspect_fs *fs)
@@ -786,106 +730,238 @@ list_applications_windows (guestfs_h *g, struct inspect_fs *fs)
     safe_asprintf (g, "%s/system32/config/software", fs->windows_systemroot);
   CLEANUP_FREE char *software_path;
   struct guestfs_application2_list *ret = NULL;
+  size_t i;
+  int r;
 
   software_path = guestfs_case_sensitive_path (g, software);
   if (!software_path)
     return NULL;
 
-  if (guestfs_hivex_open (g, software_path,
-                          GUESTFS_HIVEX_OPEN_VERBOSE, g->verbose, -1) == -1)
-    return NULL;
-
   /* Allocate apps list. */
   ret = safe_malloc (g, sizeof *ret);
   ret->len = 0;
   ret->val = NULL;
 
-  /* Ordinary native applications. */
-  const char *hivepath[] =
-    { "Microsoft", "Windows", "CurrentVersion", "Uninstall" };
-  list_applications_windows_from_path (g, ret, hivepath,
-                                       sizeof hivepath / sizeof hivepath[0]);
+  r = list_applications_windows_from_query (g, ret, software_path);
+  if (r == 0)
+    return ret;
+  if (r == -1) {
+    guestfs_free_application2_list (ret);
+    return NULL;
+  }
 
-  /* 32-bit emulated Windows apps running on the WOW64 emulator.
-   * http://support.microsoft.com/kb/896459 (RHBZ#692545).
+  /* There are too many applications to return in one reply, so dump
+   * the Uninstall keys to a file instead.
    */
-  const char *hivepath2[] =
-    { "WOW6432node", "Microsoft", "Windows", "CurrentVersion", "Uninstall" };
-  list_applications_windows_from_path (g, ret, hivepath2,
-                                       sizeof hivepath2 / sizeof hivepath2[0]);
+  if (guestfs_hivex_open (g, software_path,
+                          GUESTFS_HIVEX_OPEN_VERBOSE, g->verbose, -1) == -1) {
+    guestfs_free_application2_list (ret);
+    return NULL;
+  }
+
+  for (i = 0; uninstall_paths[i] != NULL; ++i)
+    list_applications_windows_from_path (g, ret, uninstall_paths[i]);
 
   guestfs_hivex_close (g);
   return ret;
 }
 
+/* Add the application registered in the Uninstall node 'name'.
+ * 'values' are the values named in uninstall_keys, or NULL.
+ */
 static void
-list_applications_windows_from_path (guestfs_h *g,
-                                     struct guestfs_application2_list *apps,
-                                     const char **path, size_t path_len)
+add_windows_application (guestfs_h *g, struct guestfs_application2_list *apps,
+                         const char *name, char **values)
 {
-  CLEANUP_FREE_HIVEX_NODE_LIST struct guestfs_hivex_node_list *children = NULL;
-  int64_t node;
-  size_t i;
+  /* Consider any child node that has a DisplayName key.
+   * See also:
+   * http://nsis.sourceforge.net/Add_uninstall_information_to_Add/Remove_Programs#Optional_values
+   *
+   * Use the node name as a proxy for the package name in Linux.  The
+   * display name is not language-independent, so it cannot be used.
+   */
+  if (values[0] != NULL)
+    add_application (g, apps, name, values[0], 0,
+                     values[1] ? : "",
+                     "", "",
+                     values[2] ? : "",
+                     values[3] ? : "",
+                     values[4] ? : "",
+                     values[5] ? : "");
+}
 
-  node = guestfs_hivex_root (g);
+/* Registry value types which hold UTF-16LE strings: REG_SZ,
+ * REG_EXPAND_SZ and REG_MULTI_SZ.  Values of any other type are
+ * ignored.
+ */
+static int
+is_string_value (int64_t type)
+{
+  return type == 1 || type == 2 || type == 7;
+}
 
-  for (i = 0; node != 0 && i < path_len; ++i)
-    node = guestfs_hivex_node_get_child (g, node, path[i]);
+/* Fetch the values we need from the node of every application with
+ * a single call.  Returns 0 on success, -1 on error, or 1 if the
+ * values are too large to return in one reply.
+ */
+static int
+list_applications_windows_from_query (guestfs_h *g,
+                                      struct guestfs_application2_list *apps,
+                                      const char *software_path)
+{
+  CLEANUP_FREE_STRING_LIST char **queries = NULL;
+  CLEANUP_FREE_INTERNAL_HIVEX_VALUE_LIST
+    struct guestfs_internal_hivex_value_list *values = NULL;
+  char *app[NR_UNINSTALL_KEYS] = { NULL };
+  size_t i, j, n = 0;
+
+  queries = safe_calloc (g, 2 * 2 * NR_UNINSTALL_KEYS + 1, sizeof (char *));
+  for (i = 0; uninstall_paths[i] != NULL; ++i) {
+    for (j = 0; j < NR_UNINSTALL_KEYS; ++j) {
+      queries[n++] = safe_asprintf (g, "%s\\*", uninstall_paths[i]);
+      queries[n++] = safe_strdup (g, uninstall_keys[j]);
+    }
+  }
 
-  if (node == 0)
-    return;
+  guestfs_push_error_handler (g, NULL, NULL);
+  values = guestfs_internal_hivex_query (g, software_path, queries);
+  guestfs_pop_error_handler (g);
+  if (values == NULL) {
+    if (guestfs_last_errno (g) == E2BIG)
+      return 1;
+    error (g, "%s", guestfs_last_error (g));
+    return -1;
+  }
+
+  /* The values of each node are returned together. */
+  for (i = 0; i < values->len; ++i) {
+    const struct guestfs_internal_hivex_value *v = &values->val[i];
+    const char *name;
+
+    for (j = 0; j < NR_UNINSTALL_KEYS; ++j) {
+      if (app[j] == NULL && STRCASEEQ (v->hv_key, uninstall_keys[j])) {
+        if (is_string_value (v->hv_type))
+          app[j] = guestfs_int_utf16_to_utf8 (v->hv_value, v->hv_value_len);
+        break;
+      }
+    }
+
+    if (i + 1 < values->len && STREQ (v->hv_path, values->val[i+1].hv_path))
+      continue;
+
+    name = strrchr (v->hv_path, '\\');
+    add_windows_application (g, apps, name ? name+1 : v->hv_path, app);
+    for (j = 0; j < NR_UNINSTALL_KEYS; ++j) {
+      free (app[j]);
+      app[j] = NULL;
+    }
+  }
+
+  return 0;
+}
+
+/* Return the next '\0'-terminated field of the guestfs_hivex_dump
+ * output, or NULL if the output is truncated.
+ */
+static const char *
+next_dump_field (const char *data, size_t size, size_t *pos)
+{
+  const char *field = data + *pos;
+  const char *end;
+
+  if (*pos >= size)
+    return NULL;
+  end = memchr (field, '\0', size - *pos);
+  if (end == NULL)
+    return NULL;
+  *pos = end - data + 1;
+  return field;
+}
+
+static void
+list_applications_windows_from_path (guestfs_h *g,
+                                     struct guestfs_application2_list *apps,
+                                     const char *path)
+{
+  CLEANUP_FREE char *tmpfile = NULL, *data = NULL;
+  char devfd[32];
+  size_t size, pos, i, j, nr_values;
+  int fd, r;
 
-  children = guestfs_hivex_node_children (g, node);
-  if (children == NULL)
+  if (guestfs_int_lazy_make_tmpdir (g) == -1)
+    return;
+  tmpfile = safe_asprintf (g, "%s/uninstall%d", g->tmpdir, ++g->unique);
+  fd = open (tmpfile, O_WRONLY|O_CREAT|O_TRUNC|O_NOCTTY|O_CLOEXEC, 0600);
+  if (fd == -1) {
+    perrorf (g, "open: %s", tmpfile);
     return;
+  }
+  snprintf (devfd, sizeof devfd, "/dev/fd/%d", fd);
 
-  /* Consider any child node that has a DisplayName key.
-   * See also:
-   * http://nsis.sourceforge.net/Add_uninstall_information_to_Add/Remove_Programs#Optional_values
+  /* Fetch the values we need from every child node of 'path' in a
+   * single call.  It's not an error if the path doesn't exist.
    */
-  for (i = 0; i < children->len; ++i) {
-    int64_t child = children->val[i].hivex_node_h;
-    int64_t value;
-    CLEANUP_FREE char *name = NULL, *display_name = NULL, *version = NULL,
-      *install_path = NULL, *publisher = NULL, *url = NULL, *comments = NULL;
-
-    /* Use the node name as a proxy for the package name in Linux.  The
-     * display name is not language-independent, so it cannot be used.
-     */
-    name = guestfs_hivex_node_name (g, child);
-    if (name == NULL)
-      continue;
+  guestfs_push_error_handler (g, NULL, NULL);
+  r = guestfs_hivex_dump (g, 0, devfd,
+                          GUESTFS_HIVEX_DUMP_PATH, path,
+                          GUESTFS_HIVEX_DUMP_MAXDEPTH, 1,
+                          GUESTFS_HIVEX_DUMP_KEYS, uninstall_keys,
+                          -1);
+  guestfs_pop_error_handler (g);
+  close (fd);
+  if (r == -1 ||
+      guestfs_int_read_whole_file (g, tmpfile, &data, &size) == -1) {
+    unlink (tmpfile);
+    return;
+  }
+  unlink (tmpfile);
+
+  pos = 0;
+  while (pos < size) {
+    const char *name, *nodeh, *count;
+    char *values[NR_UNINSTALL_KEYS] = { NULL };
+
+    name = next_dump_field (data, size, &pos);
+    nodeh = name ? next_dump_field (data, size, &pos) : NULL;
+    count = nodeh ? next_dump_field (data, size, &pos) : NULL;
+    if (count == NULL || sscanf (count, "%zu", &nr_values) != 1)
+      goto truncated;
+
+    for (i = 0; i < nr_values; ++i) {
+      const char *key, *type, *len;
+      size_t vlen;
+
+      key = next_dump_field (data, size, &pos);
+      type = key ? next_dump_field (data, size, &pos) : NULL;
+      len = type ? next_dump_field (data, size, &pos) : NULL;
+      if (len == NULL || sscanf (len, "%zu", &vlen) != 1 ||
+          vlen > size - pos) {
+        for (j = 0; j < NR_UNINSTALL_KEYS; ++j)
+          free (values[j]);
+        goto truncated;
+      }
 
-    value = guestfs_hivex_node_get_value (g, child, "DisplayName");
-    if (value) {
-      display_name = guestfs_hivex_value_utf8 (g, value);
-      if (display_name) {
-        value = guestfs_hivex_node_get_value (g, child, "DisplayVersion");
-        if (value)
-          version = guestfs_hivex_value_utf8 (g, value);
-        value = guestfs_hivex_node_get_value (g, child, "InstallLocation");
-        if (value)
-          install_path = guestfs_hivex_value_utf8 (g, value);
-        value = guestfs_hivex_node_get_value (g, child, "Publisher");
-        if (value)
-          publisher = guestfs_hivex_value_utf8 (g, value);
-        value = guestfs_hivex_node_get_value (g, child, "URLInfoAbout");
-        if (value)
-          url = guestfs_hivex_value_utf8 (g, value);
-        value = guestfs_hivex_node_get_value (g, child, "Comments");
-        if (value)
-          comments = guestfs_hivex_value_utf8 (g, value);
-
-        add_application (g, apps, name, display_name, 0,
-                         version ? : "",
-                         "", "",
-                         install_path ? : "",
-                         publisher ? : "",
-                         url ? : "",
-                         comments ? : "");
+      for (j = 0; j < NR_UNINSTALL_KEYS; ++j) {
+        if (values[j] == NULL && STRCASEEQ (key, uninstall_keys[j])) {
+          if (is_string_value (strtoll (type, NULL, 10)))
+            values[j] = guestfs_int_utf16_to_utf8 (data + pos, vlen);
+          break;
+        }
       }
+      pos += vlen;
     }
+
+    /* Skip the Uninstall node itself, which has an empty path. */
+    if (name[0] != '\0')
+      add_windows_application (g, apps, name, values);
+
+    for (j = 0; j < NR_UNINSTALL_KEYS; ++j)
+      free (values[j]);
   }
+  return;
+
+ truncated:
+  debug (g, "%s: truncated output from guestfs_hivex_dump", path);
 }
 
 static void
@@ -0,0 +1,601 @@
+/* libguestfs
+ * Copyright (C) 2016 Red Hat Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/**
+ * Persistent cache of inspection results.
+ *
+ * If enabled with L<guestfs(3)/guestfs_set_inspect_cache>, the
+ * results of L<guestfs(3)/guestfs_inspect_os> (the array of
+ * C<struct inspect_fs> in the handle) are saved in a file under
+ * F<$cachedir/.guestfs-$UID/inspect.d/>.  A later inspection of the
+ * same disks loads this file instead of mounting and probing every
+ * filesystem.
+ *
+ * The cache key is a text description of the identity of every
+ * drive: its position, path, device, inode, size and modification
+ * time, and the same for every file in its qcow2 backing chain.
+ * The libguestfs version is also part of the key, since the results
+ * depend on the inspection code.  The file name is the SHA-256 of
+ * the key, and the key itself is stored in the file and compared
+ * when the file is loaded.
+ *
+ * The cache is only used if every drive is a read-only local file
+ * (so the guest cannot change it behind our back), and never for
+ * qcow2 files which have the dirty bit set.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <string.h>
+#include <errno.h>
+#include <dirent.h>
+#include <libgen.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "ignore-value.h"
+#include "sha256.h"
+
+#include "guestfs.h"
+#include "guestfs-internal.h"
+#include "guestfs-internal-actions.h"
+
+#define CACHE_MAGIC "libguestfs inspection cache 1\n"
+
+/* Maximum number of files kept in the cache directory.  When more
+ * files than this exist, the least recently used ones are deleted.
+ */
+#define MAX_CACHE_FILES 256
+
+/* Maximum depth of qcow2 backing chains that we follow. */
+#define MAX_BACKING_DEPTH 16
+
+int
+guestfs_impl_set_inspect_cache (guestfs_h *g, int v)
+{
+  g->inspect_cache = !!v;
+  return 0;
+}
+
+int
+guestfs_impl_get_inspect_cache (guestfs_h *g)
+{
+  return g->inspect_cache;
+}
+
+static uint32_t
+get_be32 (const unsigned char *p)
+{
+  return ((uint32_t) p[0] << 24) | ((uint32_t) p[1] << 16) |
+    ((uint32_t) p[2] << 8) | p[3];
+}
+
+static uint64_t
+get_be64 (const unsigned char *p)
+{
+  return ((uint64_t) get_be32 (p) << 32) | get_be32 (p + 4);
+}
+
+/* Add the identity of the local file 'path' to the key, following
+ * qcow2 backing files.  Returns -1 if the file cannot be cached.
+ */
+static int
+add_file_to_key (guestfs_h *g, struct stringsbuf *key, const char *path,
+                 const char *format, int depth)
+{
+  int fd;
+  struct stat statbuf;
+  unsigned char header[104];
+  ssize_t r;
+  uint64_t backing_offset;
+  uint32_t backing_size;
+  CLEANUP_FREE char *backing = NULL, *backing_path = NULL;
+  CLEANUP_FREE char *dir = NULL;
+
+  if (depth > MAX_BACKING_DEPTH) {
+    debug (g, "inspect cache: %s: backing chain is too long", path);
+    return -1;
+  }
+
+  fd = open (path, O_RDONLY|O_CLOEXEC);
+  if (fd == -1) {
+    debug (g, "inspect cache: open: %s: %m", path);
+    return -1;
+  }
+  if (fstat (fd, &statbuf) == -1 || !S_ISREG (statbuf.st_mode)) {
+    /* Block devices don't have a useful mtime. */
+    close (fd);
+    return -1;
+  }
+
+  guestfs_int_add_sprintf (g, key,
+                           "file %s dev %ju ino %ju size %jd mtime %jd.%09ld",
+                           path,
+                           (uintmax_t) statbuf.st_dev,
+                           (uintmax_t) statbuf.st_ino,
+                           (intmax_t) statbuf.st_size,
+                           (intmax_t) statbuf.st_mtim.tv_sec,
+                           (long) statbuf.st_mtim.tv_nsec);
+
+  memset (header, 0, sizeof header);
+  r = pread (fd, header, sizeof header, 0);
+  if (r == -1) {
+    debug (g, "inspect cache: read: %s: %m", path);
+    close (fd);
+    return -1;
+  }
+
+  if (memcmp (header, "QFI\xfb", 4) != 0) {
+    close (fd);
+    /* Other formats which refer to further files are not handled. */
+    if (format && STRNEQ (format, "raw") && STRNEQ (format, "qcow2"))
+      return -1;
+    if (memcmp (header, "KDMV", 4) == 0 ||
+        memcmp (header, "# Disk DescriptorFile", 21) == 0)
+      return -1;
+    return 0;
+  }
+
+  /* qcow2 version 3 has a dirty bit in the incompatible features. */
+  if (get_be32 (&header[4]) >= 3 && (get_be64 (&header[72]) & 1) != 0) {
+    debug (g, "inspect cache: %s: qcow2 dirty bit is set", path);
+    close (fd);
+    return -1;
+  }
+
+  backing_offset = get_be64 (&header[8]);
+  backing_size = get_be32 (&header[16]);
+  if (backing_offset == 0 || backing_size == 0) {
+    close (fd);
+    return 0;
+  }
+  if (backing_size > 1023) {
+    close (fd);
+    return -1;
+  }
+
+  backing = safe_malloc (g, backing_size + 1);
+  r = pread (fd, backing, backing_size, backing_offset);
+  close (fd);
+  if (r != (ssize_t) backing_size)
+    return -1;
+  backing[backing_size] = '\0';
+
+  /* Network backing files and json: pseudo-protocol. */
+  if (strstr (backing, "://") != NULL || STRPREFIX (backing, "json:")) {
+    debug (g, "inspect cache: %s: backing file %s is not local",
+           path, backing);
+    return -1;
+  }
+
+  /* Relative backing file names are relative to the overlay. */
+  if (backing[0] != '/') {
+    dir = safe_strdup (g, path);
+    backing_path = safe_asprintf (g, "%s/%s", dirname (dir), backing);
+  }
+  else
+    backing_path = safe_strdup (g, backing);
+
+  /* We don't know the format of the backing file. */
+  return add_file_to_key (g, key, backing_path, NULL, depth + 1);
+}
+
+/**
+ * Return the key describing the identity of the drives in the handle,
+ * or C<NULL> if the drives cannot be cached.
+ */
+static char *
+make_key (guestfs_h *g)
+{
+  DECLARE_STRINGSBUF (key);
+  struct drive *drv;
+  size_t i;
+  char *ret;
+
+  guestfs_int_add_sprintf (g, &key, "version %s", PACKAGE_VERSION_FULL);
+
+  ITER_DRIVES (g, i, drv) {
+    CLEANUP_FREE char *path = NULL;
+
+    if (drv->src.protocol != drive_protocol_file || !drv->readonly) {
+      debug (g, "inspect cache: drive %zu is not a read-only local file", i);
+      goto not_cacheable;
+    }
+
+    path = realpath (drv->src.u.path, NULL);
+    if (path == NULL) {
+      debug (g, "inspect cache: realpath: %s: %m", drv->src.u.path);
+      goto not_cacheable;
+    }
+
+    guestfs_int_add_sprintf (g, &key, "drive %zu format %s",
+                             i, drv->src.format ? drv->src.format : "-");
+    if (add_file_to_key (g, &key, path, drv->src.format, 0) == -1)
+      goto not_cacheable;
+  }
+  guestfs_int_end_stringsbuf (g, &key);
+
+  ret = guestfs_int_join_strings ("\n", key.argv);
+  guestfs_int_free_stringsbuf (&key);
+  return ret;
+
+ not_cacheable:
+  guestfs_int_free_stringsbuf (&key);
+  return NULL;
+}
+
+static char *
+cache_dir (guestfs_h *g)
+{
+  CLEANUP_FREE char *dir = guestfs_int_lazy_make_supermin_appliance_dir (g);
+  char *ret;
+
+  if (dir == NULL)
+    return NULL;
+
+  ret = safe_asprintf (g, "%s/inspect.d", dir);
+  if (mkdir (ret, 0700) == -1 && errno != EEXIST) {
+    perrorf (g, "mkdir: %s", ret);
+    free (ret);
+    return NULL;
+  }
+  return ret;
+}
+
+/**
+ * Return the name of the cache file for the drives in the handle,
+ * and the key (which is stored in the file).  Returns C<NULL> if the
+ * drives cannot be cached.
+ */
+char *
+guestfs_int_inspect_cache_file (guestfs_h *g, char **key_r)
+{
+  CLEANUP_FREE char *key = NULL, *dir = NULL;
+  unsigned char sum[32];
+  char hex[sizeof sum * 2 + 1];
+  size_t i;
+  char *ret;
+
+  key = make_key (g);
+  if (key == NULL)
+    return NULL;
+
+  guestfs_push_error_handler (g, NULL, NULL);
+  dir = cache_dir (g);
+  guestfs_pop_error_handler (g);
+  if (dir == NULL)
+    return NULL;
+
+  sha256_buffer (key, strlen (key), sum);
+  for (i = 0; i < sizeof sum; ++i)
+    snprintf (&hex[i*2], 3, "%02x", sum[i]);
+
+  ret = safe_asprintf (g, "%s/%s", dir, hex);
+  *key_r = key;
+  key = NULL;
+  return ret;
+}
+
+/* Strings are written as their length on a line, followed by the
+ * bytes and a newline.  NULL is written as "-".
+ */
+static void
+write_str (FILE *fp, const char *str)
+{
+  if (str == NULL)
+    fprintf (fp, "-\n");
+  else
+    fprintf (fp, "%zu\n%s\n", strlen (str), str);
+}
+
+static void
+write_int (FILE *fp, int i)
+{
+  fprintf (fp, "%d\n", i);
+}
+
+static int
+read_int (FILE *fp, int *ret)
+{
+  return fscanf (fp, "%d\n", ret) == 1 ? 0 : -1;
+}
+
+static int
+read_str (guestfs_h *g, FILE *fp, char **ret)
+{
+  size_t len;
+  char *str;
+  int c;
+
+  c = getc (fp);
+  if (c == '-') {
+    *ret = NULL;
+    return getc (fp) == '\n' ? 0 : -1;
+  }
+  ungetc (c, fp);
+
+  if (fscanf (fp, "%zu", &len) != 1 || getc (fp) != '\n' ||
+      len > 1024 * 1024)
+    return -1;
+
+  str = safe_malloc (g, len + 1);
+  if (fread (str, 1, len, fp) != len || getc (fp) != '\n') {
+    free (str);
+    return -1;
+  }
+  str[len] = '\0';
+  *ret = str;
+  return 0;
+}
+
+/**
+ * Save the inspection data in the handle to the cache file.  Errors
+ * are not fatal, since the cache is just an optimization.
+ */
+void
+guestfs_int_inspect_cache_save (guestfs_h *g, const char *filename,
+                                const char *key)
+{
+  CLEANUP_FREE char *tmpfile = NULL;
+  FILE *fp;
+  int fd;
+  size_t i, j;
+
+  tmpfile = safe_asprintf (g, "%s.XXXXXX", filename);
+  fd = mkstemp (tmpfile);
+  if (fd == -1) {
+    debug (g, "inspect cache: mkstemp: %s: %m", tmpfile);
+    return;
+  }
+  fp = fdopen (fd, "w");
+  if (fp == NULL) {
+    debug (g, "inspect cache: fdopen: %m");
+    close (fd);
+    unlink (tmpfile);
+    return;
+  }
+
+  fputs (CACHE_MAGIC, fp);
+  write_str (fp, key);
+  write_int (fp, g->nr_fses);
+  for (i = 0; i < g->nr_fses; ++i) {
+    const struct inspect_fs *fs = &g->fses[i];
+
+    write_int (fp, fs->is_root);
+    write_str (fp, fs->mountable);
+    write_int (fp, fs->type);
+    write_int (fp, fs->distro);
+    write_int (fp, fs->package_format);
+    write_int (fp, fs->package_management);
+    write_str (fp, fs->product_name);
+    write_str (fp, fs->product_variant);
+    write_int (fp, fs->version.v_major);
+    write_int (fp, fs->version.v_minor);
+    write_int (fp, fs->version.v_micro);
+    write_str (fp, fs->arch);
+    write_str (fp, fs->hostname);
+    write_str (fp, fs->windows_systemroot);
+    write_str (fp, fs->windows_current_control_set);
+    if (fs->drive_mappings == NULL)
+      write_int (fp, -1);
+    else {
+      write_int (fp, guestfs_int_count_strings (fs->drive_mappings));
+      for (j = 0; fs->drive_mappings[j] != NULL; ++j)
+        write_str (fp, fs->drive_mappings[j]);
+    }
+    write_int (fp, fs->format);
+    write_int (fp, fs->is_live_disk);
+    write_int (fp, fs->is_netinst_disk);
+    write_int (fp, fs->is_multipart_disk);
+    write_int (fp, fs->nr_fstab);
+    for (j = 0; j < fs->nr_fstab; ++j) {
+      write_str (fp, fs->fstab[j].mountable);
+      write_str (fp, fs->fstab[j].mountpoint);
+    }
+  }
+
+  if (ferror (fp) || fclose (fp) == EOF) {
+    debug (g, "inspect cache: write: %s: %m", tmpfile);
+    unlink (tmpfile);
+    return;
+  }
+
+  if (rename (tmpfile, filename) == -1) {
+    debug (g, "inspect cache: rename: %s: %m", filename);
+    unlink (tmpfile);
+    return;
+  }
+
+  debug (g, "inspect cache: saved %s", filename);
+}
+
+/**
+ * Load the inspection data from the cache file into the handle.
+ * Returns C<1> if the data was loaded, or C<0> if the file does not
+ * exist or cannot be used.
+ */
+int
+guestfs_int_inspect_cache_load (guestfs_h *g, const char *filename,
+                                const char *key)
+{
+  FILE *fp;
+  char magic[sizeof CACHE_MAGIC];
+  CLEANUP_FREE char *file_key = NULL;
+  int nr_fses, n, v;
+  size_t i, j;
+
+  fp = fopen (filename, "re");
+  if (fp == NULL) {
+    if (errno != ENOENT)
+      debug (g, "inspect cache: open: %s: %m", filename);
+    return 0;
+  }
+
+  if (fgets (magic, sizeof magic, fp) == NULL ||
+      STRNEQ (magic, CACHE_MAGIC) ||
+      read_str (g, fp, &file_key) == -1 || file_key == NULL ||
+      STRNEQ (file_key, key) ||
+      read_int (fp, &nr_fses) == -1 || nr_fses < 0 || nr_fses > 65536)
+    goto bad;
+
+  guestfs_int_free_inspect_info (g);
+  g->fses = safe_calloc (g, nr_fses, sizeof (struct inspect_fs));
+  g->nr_fses = nr_fses;
+
+  for (i = 0; i < g->nr_fses; ++i) {
+    struct inspect_fs *fs = &g->fses[i];
+
+#define READ_INT(field)                         \
+    do {                                        \
+      if (read_int (fp, &v) == -1) goto bad;    \
+      (field) = v;                              \
+    } while (0)
+#define READ_STR(field)                                         \
+    do {                                                        \
+      if (read_str (g, fp, &(field)) == -1) goto bad;           \
+    } while (0)
+
+    READ_INT (fs->is_root);
+    READ_STR (fs->mountable);
+    if (fs->mountable == NULL) goto bad;
+    READ_INT (fs->type);
+    READ_INT (fs->distro);
+    READ_INT (fs->package_format);
+    READ_INT (fs->package_management);
+    READ_STR (fs->product_name);
+    READ_STR (fs->product_variant);
+    READ_INT (fs->version.v_major);
+    READ_INT (fs->version.v_minor);
+    READ_INT (fs->version.v_micro);
+    READ_STR (fs->arch);
+    READ_STR (fs->hostname);
+    READ_STR (fs->windows_systemroot);
+    READ_STR (fs->windows_current_control_set);
+    READ_INT (n);
+    if (n >= 0) {
+      if (n > 65536) goto bad;
+      fs->drive_mappings = safe_calloc (g, n + 1, sizeof (char *));
+      for (j = 0; j < (size_t) n; ++j) {
+        READ_STR (fs->drive_mappings[j]);
+        if (fs->drive_mappings[j] == NULL) goto bad;
+      }
+    }
+    READ_INT (fs->format);
+    READ_INT (fs->is_live_disk);
+    READ_INT (fs->is_netinst_disk);
+    READ_INT (fs->is_multipart_disk);
+    READ_INT (n);
+    if (n < 0 || n > 65536) goto bad;
+    fs->fstab = safe_calloc (g, n, sizeof (struct inspect_fstab_entry));
+    fs->nr_fstab = n;
+    for (j = 0; j < fs->nr_fstab; ++j) {
+      READ_STR (fs->fstab[j].mountable);
+      READ_STR (fs->fstab[j].mountpoint);
+      if (fs->fstab[j].mountable == NULL || fs->fstab[j].mountpoint == NULL)
+        goto bad;
+    }
+#undef READ_INT
+#undef READ_STR
+  }
+
+  fclose (fp);
+
+  /* Mark the file as recently used, for pruning. */
+  ignore_value (utimensat (AT_FDCWD, filename, NULL, 0));
+
+  debug (g, "inspect cache: loaded %s", filename);
+  return 1;
+
+ bad:
+  debug (g, "inspect cache: ignoring invalid or stale cache file %s",
+         filename);
+  fclose (fp);
+  guestfs_int_free_inspect_info (g);
+  return 0;
+}
+
+struct cache_file {
+  char *name;
+  struct timespec mtime;
+};
+
+static int
+compare_mtime (const void *vp1, const void *vp2)
+{
+  const struct cache_file *f1 = vp1, *f2 = vp2;
+
+  if (f1->mtime.tv_sec != f2->mtime.tv_sec)
+    return f1->mtime.tv_sec < f2->mtime.tv_sec ? -1 : 1;
+  if (f1->mtime.tv_nsec != f2->mtime.tv_nsec)
+    return f1->mtime.tv_nsec < f2->mtime.tv_nsec ? -1 : 1;
+  return 0;
+}
+
+/**
+ * If there are more than C<MAX_CACHE_FILES> files in the cache
+ * directory, delete the least recently used ones.
+ */
+void
+guestfs_int_inspect_cache_prune (guestfs_h *g, const char *filename)
+{
+  CLEANUP_FREE char *dirpath = safe_strdup (g, filename);
+  const char *dir = dirname (dirpath);
+  DIR *dp;
+  struct dirent *d;
+  struct cache_file *files = NULL;
+  size_t nr_files = 0, alloc = 0, i;
+  struct stat statbuf;
+
+  dp = opendir (dir);
+  if (dp == NULL)
+    return;
+
+  while ((d = readdir (dp)) != NULL) {
+    if (d->d_name[0] == '.')
+      continue;
+    if (fstatat (dirfd (dp), d->d_name, &statbuf, AT_SYMLINK_NOFOLLOW) == -1 ||
+        !S_ISREG (statbuf.st_mode))
+      continue;
+    if (nr_files >= alloc) {
+      alloc = alloc ? alloc * 2 : 64;
+      files = safe_realloc (g, files, alloc * sizeof (struct cache_file));
+    }
+    files[nr_files].name = safe_strdup (g, d->d_name);
+    files[nr_files].mtime = statbuf.st_mtim;
+    nr_files++;
+  }
+
+  if (nr_files > MAX_CACHE_FILES) {
+    qsort (files, nr_files, sizeof (struct cache_file), compare_mtime);
+    for (i = 0; i < nr_files - MAX_CACHE_FILES; ++i) {
+      debug (g, "inspect cache: removing %s/%s", dir, files[i].name);
+      ignore_value (unlinkat (dirfd (dp), files[i].name, 0));
+    }
+  }
+
+  closedir (dp);
+  for (i = 0; i < nr_files; ++i)
+    free (files[i].name);
+  free (files);
+}
@@ -0,0 +1,324 @@
+/* libguestfs
+ * Copyright (C) 2016 Red Hat Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/**
+ * Parsers for the few configuration files which inspection reads.
+ *
+ * Inspection used to load these files with Augeas, which costs
+ * several round trips to the daemon per file plus one for every
+ * field.  These parsers work on the lines of the file, which can be
+ * read in one call (or come for free with the probe, see
+ * F<src/inspect-fs.c>).
+ *
+ * They only understand the common, simple forms of each file.  If a
+ * parser finds something it does not understand it says so, and the
+ * caller falls back to Augeas, so unusual files are handled exactly
+ * as before.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "c-ctype.h"
+
+#include "guestfs.h"
+#include "guestfs-internal.h"
+
+#define WHITESPACE " \t"
+
+/* Split 'line' into whitespace-separated words, stopping at a word
+ * which starts with '#' (a comment).  Returns the number of words,
+ * or -1 if there are more than 'max'.  The words point into 'line',
+ * which is modified.
+ */
+static int
+split_words (char *line, char **words, size_t max)
+{
+  size_t n = 0;
+  char *p = line;
+
+  for (;;) {
+    p += strspn (p, WHITESPACE);
+    if (*p == '\0' || *p == '#')
+      return n;
+    if (n == max)
+      return -1;
+    words[n++] = p;
+    p += strcspn (p, WHITESPACE);
+    if (*p != '\0')
+      *p++ = '\0';
+  }
+}
+
+static int
+is_digits (const char *str)
+{
+  if (*str == '\0')
+    return 0;
+  for (; *str; ++str)
+    if (!c_isdigit (*str))
+      return 0;
+  return 1;
+}
+
+/**
+ * Parse the lines of F</etc/fstab>.
+ *
+ * Each entry has the fields C<spec>, C<file>, C<vfstype> and
+ * optionally C<options>, C<dump> and C<passno>, separated by
+ * whitespace.  Blank lines and comments are ignored.  Returns C<0>
+ * and the entries in C<*entries_r> and C<*nr_entries_r> (free them
+ * with C<guestfs_int_free_fstab_lines>), or C<-1> if the syntax was
+ * not understood, in which case no error is set.
+ */
+int
+guestfs_int_parse_fstab (guestfs_h *g, char *const *lines,
+                         struct fstab_line **entries_r, size_t *nr_entries_r)
+{
+  struct fstab_line *entries = NULL;
+  size_t nr_entries = 0, i;
+
+  for (i = 0; lines[i] != NULL; ++i) {
+    CLEANUP_FREE char *line = safe_strdup (g, lines[i]);
+    char *words[6];
+    int n;
+
+    n = split_words (line, words, 6);
+    if (n == 0)
+      continue;
+    if (n < 3 ||
+        (n >= 5 && !is_digits (words[4])) ||
+        (n == 6 && !is_digits (words[5]))) {
+      guestfs_int_free_fstab_lines (entries, nr_entries);
+      return -1;
+    }
+
+    entries = safe_realloc (g, entries, (nr_entries+1) * sizeof *entries);
+    entries[nr_entries].spec = safe_strdup (g, words[0]);
+    entries[nr_entries].file = safe_strdup (g, words[1]);
+    entries[nr_entries].vfstype = safe_strdup (g, words[2]);
+    entries[nr_entries].options = safe_strdup (g, n >= 4 ? words[3] : "");
+    nr_entries++;
+  }
+
+  *entries_r = entries;
+  *nr_entries_r = nr_entries;
+  return 0;
+}
+
+void
+guestfs_int_free_fstab_lines (struct fstab_line *entries, size_t nr_entries)
+{
+  size_t i;
+
+  for (i = 0; i < nr_entries; ++i) {
+    free (entries[i].spec);
+    free (entries[i].file);
+    free (entries[i].vfstype);
+    free (entries[i].options);
+  }
+  free (entries);
+}
+
+/**
+ * Return the value of the last C<name=value> option in the
+ * comma-separated list C<options>, or C<NULL> if there is none.
+ */
+char *
+guestfs_int_fstab_option (guestfs_h *g, const char *options, const char *name)
+{
+  const char *p = options;
+  const char *value = NULL;
+  size_t value_len = 0, namelen = strlen (name);
+
+  while (*p) {
+    size_t len = strcspn (p, ",");
+
+    if (len > namelen && STREQLEN (p, name, namelen) && p[namelen] == '=') {
+      value = &p[namelen+1];
+      value_len = len - namelen - 1;
+    }
+    p += len;
+    if (*p == ',')
+      p++;
+  }
+
+  return value ? safe_strndup (g, value, value_len) : NULL;
+}
+
+/* mdadm.conf keywords may be abbreviated to 3 or more characters. */
+static int
+is_mdadm_keyword (const char *word, const char *keyword)
+{
+  size_t len = strlen (word);
+
+  return len >= 3 && len <= strlen (keyword) &&
+    strncasecmp (word, keyword, len) == 0;
+}
+
+/**
+ * Parse the lines of F</etc/mdadm.conf>.
+ *
+ * Returns a list of pairs of strings: the device name and the UUID
+ * of each C<ARRAY> which has both.  Returns C<NULL> if the syntax was
+ * not understood (quoted words are not handled), in which case no
+ * error is set.
+ */
+char **
+guestfs_int_parse_mdadm_conf (guestfs_h *g, char *const *lines)
+{
+  DECLARE_STRINGSBUF (ret);
+  CLEANUP_FREE_STRING_LIST char **joined = NULL;
+  DECLARE_STRINGSBUF (keyword_lines);
+  size_t i, j;
+
+  /* Lines which start with whitespace continue the previous line. */
+  for (i = 0; lines[i] != NULL; ++i) {
+    if (strpbrk (lines[i], "\"'") != NULL) {
+      guestfs_int_free_stringsbuf (&keyword_lines);
+      return NULL;
+    }
+    if ((lines[i][0] == ' ' || lines[i][0] == '\t') &&
+        keyword_lines.size > 0) {
+      char **last = &keyword_lines.argv[keyword_lines.size-1];
+      char *line = safe_asprintf (g, "%s %s", *last, lines[i]);
+
+      free (*last);
+      *last = line;
+    }
+    else
+      guestfs_int_add_string (g, &keyword_lines, lines[i]);
+  }
+  guestfs_int_end_stringsbuf (g, &keyword_lines);
+  joined = keyword_lines.argv;
+
+  for (i = 0; joined[i] != NULL; ++i) {
+    size_t nr_words = strlen (joined[i]) / 2 + 1;
+    CLEANUP_FREE char **words = safe_malloc (g, nr_words * sizeof (char *));
+    const char *devname = NULL, *uuid = NULL;
+    int n;
+
+    n = split_words (joined[i], words, nr_words);
+    if (n < 1 || !is_mdadm_keyword (words[0], "array"))
+      continue;
+
+    for (j = 1; j < (size_t) n; ++j) {
+      if (strchr (words[j], '=') == NULL) {
+        if (devname == NULL)
+          devname = words[j];
+      }
+      else if (STRCASEPREFIX (words[j], "uuid="))
+        uuid = &words[j][5];
+    }
+
+    if (devname && uuid && STRNEQ (devname, "<ignore>")) {
+      guestfs_int_add_string (g, &ret, devname);
+      guestfs_int_add_string (g, &ret, uuid);
+    }
+  }
+
+  guestfs_int_end_stringsbuf (g, &ret);
+  return ret.argv;
+}
+
+static int
+is_shell_name (const char *p, size_t len)
+{
+  size_t i;
+
+  if (len == 0 || c_isdigit (p[0]))
+    return 0;
+  for (i = 0; i < len; ++i)
+    if (!c_isalnum (p[i]) && p[i] != '_')
+      return 0;
+  return 1;
+}
+
+/**
+ * Find the value of the variable C<name> in the lines of a shell
+ * script which only contains simple assignments, like
+ * F</etc/sysconfig/network>.  Quotes around the value are removed.
+ *
+ * Returns C<1> and the value of the last assignment in C<*value_r>,
+ * C<0> if the variable is not set, or C<-1> if the syntax was not
+ * understood (eg. the file uses expansions, escapes or commands), in
+ * which case no error is set.
+ */
+int
+guestfs_int_parse_shellvar (guestfs_h *g, char *const *lines,
+                            const char *name, char **value_r)
+{
+  char *value = NULL;
+  size_t i;
+
+  for (i = 0; lines[i] != NULL; ++i) {
+    const char *p = lines[i], *varname, *v, *end;
+    size_t len;
+
+    p += strspn (p, WHITESPACE);
+    if (*p == '\0' || *p == '#')
+      continue;
+    if (STRPREFIX (p, "export "))
+      p += 7;
+
+    varname = p;
+    len = strcspn (p, "=");
+    if (p[len] != '=' || !is_shell_name (p, len))
+      goto unknown;
+
+    v = &p[len+1];
+    if (*v == '"' || *v == '\'') {
+      end = strchr (v+1, *v);
+      if (end == NULL ||
+          (*v == '"' && strcspn (v+1, "\\$`") < (size_t) (end - (v+1))))
+        goto unknown;
+      v++;
+    }
+    else {
+      end = v + strcspn (v, WHITESPACE);
+      if (strcspn (v, "\"'\\$`;&|<>()") < (size_t) (end - v))
+        goto unknown;
+    }
+
+    /* Only a comment may follow the value. */
+    p = end;
+    if (*p == '"' || *p == '\'')
+      p++;
+    p += strspn (p, WHITESPACE);
+    if (*p != '\0' && *p != '#')
+      goto unknown;
+
+    if (len == strlen (name) && STREQLEN (varname, name, len)) {
+      free (value);
+      value = safe_strndup (g, v, end - v);
+    }
+  }
+
+  if (value == NULL)
+    return 0;
+  *value_r = value;
+  return 1;
+
+ unknown:
+  free (value);
+  return -1;
+}
@@ -80,8 +80,10 @@ COMPILE_REGEXP (re_frugalware, "Frugalware (\\d+)\\.(\\d+)", 0)
 static void check_architecture (guestfs_h *g, struct inspect_fs *fs);
 static int check_hostname_unix (guestfs_h *g, struct inspect_fs *fs);
 static int check_hostname_redhat (guestfs_h *g, struct inspect_fs *fs);
+static int check_hostname_redhat_augeas (guestfs_h *g, struct inspect_fs *fs);
 static int check_hostname_freebsd (guestfs_h *g, struct inspect_fs *fs);
-static int check_fstab (guestfs_h *g, struct inspect_fs *fs);
+static int check_fstab (guestfs_h *g, struct inspect_fs *fs, const char **configfiles);
+static int check_fstab_augeas (guestfs_h *g, struct inspect_fs *fs);
 static void add_fstab_entry (guestfs_h *g, struct inspect_fs *fs,
                              const char *mountable, const char *mp);
 static char *resolve_fstab_device (guestfs_h *g, const char *spec,
@@ -112,7 +114,7 @@ static bool mdadm_app_cmp(const void *x, const void *y);
 static void mdadm_app_free(void *x);
 
 static ssize_t map_app_md_devices (guestfs_h *g, Hash_table **map);
-static int map_md_devices(guestfs_h *g, Hash_table **map);
+static int map_md_devices(guestfs_h *g, char **arrays, Hash_table **map);
 
 /* Set fs->product_name to the first line of the release file. */
 static int
@@ -142,7 +144,6 @@ parse_release_file (guestfs_h *g, struct inspect_fs *fs,
 static int
 parse_os_release (guestfs_h *g, struct inspect_fs *fs, const char *filename)
 {
-  int64_t size;
   CLEANUP_FREE_STRING_LIST char **lines = NULL;
   size_t i;
   enum inspect_os_distro distro = OS_DISTRO_UNKNOWN;
@@ -150,20 +151,7 @@ parse_os_release (guestfs_h *g, struct inspect_fs *fs, const char *filename)
   struct version version;
   guestfs_int_version_from_values (&version, -1, -1, 0);
 
-  /* Don't trust guestfs_read_lines not to break with very large files.
-   * Check the file size is something reasonable first.
-   */
-  size = guestfs_filesize (g, filename);
-  if (size == -1)
-    /* guestfs_filesize failed and has already set error in handle */
-    return -1;
-  if (size > MAX_SMALL_FILE_SIZE) {
-    error (g, _("size of %s is unreasonably large (%" PRIi64 " bytes)"),
-           filename, size);
-    return -1;
-  }
-
-  lines = guestfs_read_lines (g, filename);
+  lines = guestfs_int_inspect_read_lines (g, filename, MAX_SMALL_FILE_SIZE);
   if (lines == NULL)
     return -1;
 
@@ -456,8 +444,7 @@ guestfs_int_check_linux_root (guestfs_h *g, struct inspect_fs *fs)
 
   fs->type = OS_TYPE_LINUX;
 
-  if (guestfs_is_file_opts (g, "/etc/os-release",
-                            GUESTFS_IS_FILE_OPTS_FOLLOWSYMLINKS, 1, -1) > 0) {
+  if (guestfs_int_inspect_is_file (g, "/etc/os-release", 1) > 0) {
     r = parse_os_release (g, fs, "/etc/os-release");
     if (r == -1)        /* error */
       return -1;
@@ -465,8 +452,7 @@ guestfs_int_check_linux_root (guestfs_h *g, struct inspect_fs *fs)
       goto skip_release_checks;
   }
 
-  if (guestfs_is_file_opts (g, "/etc/lsb-release",
-                            GUESTFS_IS_FILE_OPTS_FOLLOWSYMLINKS, 1, -1) > 0) {
+  if (guestfs_int_inspect_is_file (g, "/etc/lsb-release", 1) > 0) {
     r = parse_lsb_release (g, fs, "/etc/lsb-release");
     if (r == -1)        /* error */
       return -1;
@@ -477,8 +463,7 @@ guestfs_int_check_linux_root (guestfs_h *g, struct inspect_fs *fs)
   /* RHEL-based distros include a "/etc/redhat-release" file, hence their
    * checks need to be performed before the Red-Hat one.
    */
-  if (guestfs_is_file_opts (g, "/etc/oracle-release",
-                            GUESTFS_IS_FILE_OPTS_FOLLOWSYMLINKS, 1, -1) > 0) {
+  if (guestfs_int_inspect_is_file (g, "/etc/oracle-release", 1) > 0) {
 
     fs->distro = OS_DISTRO_ORACLE_LINUX;
 
@@ -505,8 +490,7 @@ guestfs_int_check_linux_root (guestfs_h *g, struct inspect_fs *fs)
       fs->version.v_minor = 0;
     }
   }
-  else if (guestfs_is_file_opts (g, "/etc/centos-release",
-                                 GUESTFS_IS_FILE_OPTS_FOLLOWSYMLINKS, 1, -1) > 0) {
+  else if (guestfs_int_inspect_is_file (g, "/etc/centos-release", 1) > 0) {
     fs->distro = OS_DISTRO_CENTOS;
 
     if (parse_release_file (g, fs, "/etc/centos-release") == -1)
@@ -533,8 +517,7 @@ guestfs_int_check_linux_root (guestfs_h *g, struct inspect_fs *fs)
       fs->version.v_minor = 0;
     }
   }
-  else if (guestfs_is_file_opts (g, "/etc/altlinux-release",
-                                 GUESTFS_IS_FILE_OPTS_FOLLOWSYMLINKS, 1, -1) > 0) {
+  else if (guestfs_int_inspect_is_file (g, "/etc/altlinux-release", 1) > 0) {
     fs->distro = OS_DISTRO_ALTLINUX;
 
     if (parse_release_file (g, fs, "/etc/altlinux-release") == -1)
@@ -544,8 +527,7 @@ guestfs_int_check_linux_root (guestfs_h *g, struct inspect_fs *fs)
                                          re_altlinux) == -1)
       return -1;
   }
-  else if (guestfs_is_file_opts (g, "/etc/redhat-release",
-                                 GUESTFS_IS_FILE_OPTS_FOLLOWSYMLINKS, 1, -1) > 0) {
+  else if (guestfs_int_inspect_is_file (g, "/etc/redhat-release", 1) > 0) {
     fs->distro = OS_DISTRO_REDHAT_BASED; /* Something generic Red Hat-like. */
 
     if (parse_release_file (g, fs, "/etc/redhat-release") == -1)
@@ -625,8 +607,7 @@ guestfs_int_check_linux_root (guestfs_h *g, struct inspect_fs *fs)
       fs->version.v_minor = 0;
     }
   }
-  else if (guestfs_is_file_opts (g, "/etc/debian_version",
-                                 GUESTFS_IS_FILE_OPTS_FOLLOWSYMLINKS, 1, -1) > 0) {
+  else if (guestfs_int_inspect_is_file (g, "/etc/debian_version", 1) > 0) {
     fs->distro = OS_DISTRO_DEBIAN;
 
     if (parse_release_file (g, fs, "/etc/debian_version") == -1)
@@ -635,8 +616,7 @@ guestfs_int_check_linux_root (guestfs_h *g, struct inspect_fs *fs)
     if (guestfs_int_parse_major_minor (g, fs) == -1)
       return -1;
   }
-  else if (guestfs_is_file_opts (g, "/etc/pardus-release",
-                                 GUESTFS_IS_FILE_OPTS_FOLLOWSYMLINKS, 1, -1) > 0) {
+  else if (guestfs_int_inspect_is_file (g, "/etc/pardus-release", 1) > 0) {
     fs->distro = OS_DISTRO_PARDUS;
 
     if (parse_release_file (g, fs, "/etc/pardus-release") == -1)
@@ -645,16 +625,14 @@ guestfs_int_check_linux_root (guestfs_h *g, struct inspect_fs *fs)
     if (guestfs_int_parse_major_minor (g, fs) == -1)
       return -1;
   }
-  else if (guestfs_is_file_opts (g, "/etc/arch-release",
-                                 GUESTFS_IS_FILE_OPTS_FOLLOWSYMLINKS, 1, -1) > 0) {
+  else if (guestfs_int_inspect_is_file (g, "/etc/arch-release", 1) > 0) {
     fs->distro = OS_DISTRO_ARCHLINUX;
 
     /* /etc/arch-release file is empty and I can't see a way to
      * determine the actual release or product string.
      */
   }
-  else if (guestfs_is_file_opts (g, "/etc/gentoo-release",
-                                 GUESTFS_IS_FILE_OPTS_FOLLOWSYMLINKS, 1, -1) > 0) {
+  else if (guestfs_int_inspect_is_file (g, "/etc/gentoo-release", 1) > 0) {
     fs->distro = OS_DISTRO_GENTOO;
 
     if (parse_release_file (g, fs, "/etc/gentoo-release") == -1)
@@ -663,8 +641,7 @@ guestfs_int_check_linux_root (guestfs_h *g, struct inspect_fs *fs)
     if (guestfs_int_parse_major_minor (g, fs) == -1)
       return -1;
   }
-  else if (guestfs_is_file_opts (g, "/etc/meego-release",
-                                 GUESTFS_IS_FILE_OPTS_FOLLOWSYMLINKS, 1, -1) > 0) {
+  else if (guestfs_int_inspect_is_file (g, "/etc/meego-release", 1) > 0) {
     fs->distro = OS_DISTRO_MEEGO;
 
     if (parse_release_file (g, fs, "/etc/meego-release") == -1)
@@ -673,8 +650,7 @@ guestfs_int_check_linux_root (guestfs_h *g, struct inspect_fs *fs)
     if (guestfs_int_parse_major_minor (g, fs) == -1)
       return -1;
   }
-  else if (guestfs_is_file_opts (g, "/etc/slackware-version",
-                                 GUESTFS_IS_FILE_OPTS_FOLLOWSYMLINKS, 1, -1) > 0) {
+  else if (guestfs_int_inspect_is_file (g, "/etc/slackware-version", 1) > 0) {
     fs->distro = OS_DISTRO_SLACKWARE;
 
     if (parse_release_file (g, fs, "/etc/slackware-version") == -1)
@@ -683,8 +659,7 @@ guestfs_int_check_linux_root (guestfs_h *g, struct inspect_fs *fs)
     if (guestfs_int_parse_major_minor (g, fs) == -1)
       return -1;
   }
-  else if (guestfs_is_file_opts (g, "/etc/ttylinux-target",
-                                 GUESTFS_IS_FILE_OPTS_FOLLOWSYMLINKS, 1, -1) > 0) {
+  else if (guestfs_int_inspect_is_file (g, "/etc/ttylinux-target", 1) > 0) {
     fs->distro = OS_DISTRO_TTYLINUX;
 
     if (parse_release_file (g, fs, "/etc/ttylinux-target") == -1)
@@ -693,8 +668,7 @@ guestfs_int_check_linux_root (guestfs_h *g, struct inspect_fs *fs)
     if (guestfs_int_parse_major_minor (g, fs) == -1)
       return -1;
   }
-  else if (guestfs_is_file_opts (g, "/etc/SuSE-release",
-                                 GUESTFS_IS_FILE_OPTS_FOLLOWSYMLINKS, 1, -1) > 0) {
+  else if (guestfs_int_inspect_is_file (g, "/etc/SuSE-release", 1) > 0) {
     fs->distro = OS_DISTRO_SUSE_BASED;
 
     if (parse_suse_release (g, fs, "/etc/SuSE-release") == -1)
@@ -703,8 +677,7 @@ guestfs_int_check_linux_root (guestfs_h *g, struct inspect_fs *fs)
   }
   /* CirrOS versions providing a own version file.
    */
-  else if (guestfs_is_file_opts (g, "/etc/cirros/version",
-                                 GUESTFS_IS_FILE_OPTS_FOLLOWSYMLINKS, 1, -1) > 0) {
+  else if (guestfs_int_inspect_is_file (g, "/etc/cirros/version", 1) > 0) {
     fs->distro = OS_DISTRO_CIRROS;
 
     if (parse_release_file (g, fs, "/etc/cirros/version") == -1)
@@ -716,10 +689,8 @@ guestfs_int_check_linux_root (guestfs_h *g, struct inspect_fs *fs)
   /* Buildroot (http://buildroot.net) is an embedded Linux distro
    * toolkit.  It is used by specific distros such as Cirros.
    */
-  else if (guestfs_is_file_opts (g, "/etc/br-version",
-                                 GUESTFS_IS_FILE_OPTS_FOLLOWSYMLINKS, 1, -1) > 0) {
-    if (guestfs_is_file_opts (g, "/usr/share/cirros/logo",
-                              GUESTFS_IS_FILE_OPTS_FOLLOWSYMLINKS, 1, -1) > 0)
+  else if (guestfs_int_inspect_is_file (g, "/etc/br-version", 1) > 0) {
+    if (guestfs_int_inspect_is_file (g, "/usr/share/cirros/logo", 1) > 0)
       fs->distro = OS_DISTRO_CIRROS;
     else
       fs->distro = OS_DISTRO_BUILDROOT;
@@ -731,8 +702,7 @@ guestfs_int_check_linux_root (guestfs_h *g, struct inspect_fs *fs)
     if (guestfs_int_parse_major_minor (g, fs) == -1)
       return -1;
   }
-  else if (guestfs_is_file_opts (g, "/etc/alpine-release",
-                                 GUESTFS_IS_FILE_OPTS_FOLLOWSYMLINKS, 1, -1) > 0) {
+  else if (guestfs_int_inspect_is_file (g, "/etc/alpine-release", 1) > 0) {
     fs->distro = OS_DISTRO_ALPINE_LINUX;
 
     if (parse_release_file (g, fs, "/etc/alpine-release") == -1)
@@ -741,8 +711,7 @@ guestfs_int_check_linux_root (guestfs_h *g, struct inspect_fs *fs)
     if (guestfs_int_parse_major_minor (g, fs) == -1)
       return -1;
   }
-  else if (guestfs_is_file_opts (g, "/etc/frugalware-release",
-                                 GUESTFS_IS_FILE_OPTS_FOLLOWSYMLINKS, 1, -1) > 0) {
+  else if (guestfs_int_inspect_is_file (g, "/etc/frugalware-release", 1) > 0) {
     fs->distro = OS_DISTRO_FRUGALWARE;
 
     if (parse_release_file (g, fs, "/etc/frugalware-release") == -1)
@@ -764,7 +733,7 @@ guestfs_int_check_linux_root (guestfs_h *g, struct inspect_fs *fs)
    * are mounted.
    */
   const char *configfiles[] = { "/etc/fstab", "/etc/mdadm.conf", NULL };
-  if (inspect_with_augeas (g, fs, configfiles, check_fstab) == -1)
+  if (check_fstab (g, fs, configfiles) == -1)
     return -1;
 
   /* Determine hostname. */
@@ -786,8 +755,7 @@ guestfs_int_check_freebsd_root (guestfs_h *g, struct inspect_fs *fs)
    * we'll use that anyway.
    */
 
-  if (guestfs_is_file_opts (g, "/etc/motd",
-                            GUESTFS_IS_FILE_OPTS_FOLLOWSYMLINKS, 1, -1) > 0) {
+  if (guestfs_int_inspect_is_file (g, "/etc/motd", 1) > 0) {
     if (parse_release_file (g, fs, "/etc/motd") == -1)
       return -1;
 
@@ -800,7 +768,7 @@ guestfs_int_check_freebsd_root (guestfs_h *g, struct inspect_fs *fs)
 
   /* We already know /etc/fstab exists because it's part of the test above. */
   const char *configfiles[] = { "/etc/fstab", NULL };
-  if (inspect_with_augeas (g, fs, configfiles, check_fstab) == -1)
+  if (check_fstab (g, fs, configfiles) == -1)
     return -1;
 
   /* Determine hostname. */
@@ -815,8 +783,7 @@ int
 guestfs_int_check_netbsd_root (guestfs_h *g, struct inspect_fs *fs)
 {
 
-  if (guestfs_is_file_opts (g, "/etc/release",
-                            GUESTFS_IS_FILE_OPTS_FOLLOWSYMLINKS, 1, -1) > 0) {
+  if (guestfs_int_inspect_is_file (g, "/etc/release", 1) > 0) {
     int result;
     if (parse_release_file (g, fs, "/etc/release") == -1)
       return -1;
@@ -838,7 +805,7 @@ guestfs_int_check_netbsd_root (guestfs_h *g, struct inspect_fs *fs)
 
   /* We already know /etc/fstab exists because it's part of the test above. */
   const char *configfiles[] = { "/etc/fstab", NULL };
-  if (inspect_with_augeas (g, fs, configfiles, check_fstab) == -1)
+  if (check_fstab (g, fs, configfiles) == -1)
     return -1;
 
   /* Determine hostname. */
@@ -852,8 +819,7 @@ guestfs_int_check_netbsd_root (guestfs_h *g, struct inspect_fs *fs)
 int
 guestfs_int_check_openbsd_root (guestfs_h *g, struct inspect_fs *fs)
 {
-  if (guestfs_is_file_opts (g, "/etc/motd",
-                            GUESTFS_IS_FILE_OPTS_FOLLOWSYMLINKS, 1, -1) > 0) {
+  if (guestfs_int_inspect_is_file (g, "/etc/motd", 1) > 0) {
     CLEANUP_FREE char *major = NULL, *minor = NULL;
 
     /* The first line of this file gets automatically updated at boot. */
@@ -887,7 +853,7 @@ guestfs_int_check_openbsd_root (guestfs_h *g, struct inspect_fs *fs)
 
   /* We already know /etc/fstab exists because it's part of the test above. */
   const char *configfiles[] = { "/etc/fstab", NULL };
-  if (inspect_with_augeas (g, fs, configfiles, check_fstab) == -1)
+  if (check_fstab (g, fs, configfiles) == -1)
     return -1;
 
   /* Determine hostname. */
@@ -905,8 +871,7 @@ guestfs_int_check_hurd_root (guestfs_h *g, struct inspect_fs *fs)
 {
   fs->type = OS_TYPE_HURD;
 
-  if (guestfs_is_file_opts (g, "/etc/debian_version",
-                            GUESTFS_IS_FILE_OPTS_FOLLOWSYMLINKS, 1, -1) > 0) {
+  if (guestfs_int_inspect_is_file (g, "/etc/debian_version", 1) > 0) {
     fs->distro = OS_DISTRO_DEBIAN;
 
     if (parse_release_file (g, fs, "/etc/debian_version") == -1)
@@ -923,9 +888,9 @@ guestfs_int_check_hurd_root (guestfs_h *g, struct inspect_fs *fs)
   /* Determine the architecture. */
   check_architecture (g, fs);
 
-  if (guestfs_is_file (g, "/etc/fstab") > 0) {
+  if (guestfs_int_inspect_is_file (g, "/etc/fstab", 0) > 0) {
     const char *configfiles[] = { "/etc/fstab", NULL };
-    if (inspect_with_augeas (g, fs, configfiles, check_fstab) == -1)
+    if (check_fstab (g, fs, configfiles) == -1)
       return -1;
   }
 
@@ -942,8 +907,7 @@ guestfs_int_check_minix_root (guestfs_h *g, struct inspect_fs *fs)
 {
   fs->type = OS_TYPE_MINIX;
 
-  if (guestfs_is_file_opts (g, "/etc/version",
-                            GUESTFS_IS_FILE_OPTS_FOLLOWSYMLINKS, 1, -1) > 0) {
+  if (guestfs_int_inspect_is_file (g, "/etc/version", 1) > 0) {
     if (parse_release_file (g, fs, "/etc/version") == -1)
       return -1;
 
@@ -1002,8 +966,7 @@ guestfs_int_check_coreos_usr (guestfs_h *g, struct inspect_fs *fs)
   fs->type = OS_TYPE_LINUX;
   fs->distro = OS_DISTRO_COREOS;
 
-  if (guestfs_is_file_opts (g, "/lib/os-release",
-                            GUESTFS_IS_FILE_OPTS_FOLLOWSYMLINKS, 1, -1) > 0) {
+  if (guestfs_int_inspect_is_file (g, "/lib/os-release", 1) > 0) {
     r = parse_os_release (g, fs, "/lib/os-release");
     if (r == -1)        /* error */
       return -1;
@@ -1011,8 +974,7 @@ guestfs_int_check_coreos_usr (guestfs_h *g, struct inspect_fs *fs)
       goto skip_release_checks;
   }
 
-  if (guestfs_is_file_opts (g, "/share/coreos/lsb-release",
-                            GUESTFS_IS_FILE_OPTS_FOLLOWSYMLINKS, 1, -1) > 0) {
+  if (guestfs_int_inspect_is_file (g, "/share/coreos/lsb-release", 1) > 0) {
     r = parse_lsb_release (g, fs, "/share/coreos/lsb-release");
     if (r == -1)        /* error */
       return -1;
@@ -1044,8 +1006,7 @@ check_architecture (guestfs_h *g, struct inspect_fs *fs)
      * relative ones (which can be resolved within the same partition),
      * then we can check the architecture of their target.
      */
-    if (guestfs_is_file_opts (g, binaries[i],
-                              GUESTFS_IS_FILE_OPTS_FOLLOWSYMLINKS, 1, -1) > 0) {
+    if (guestfs_int_inspect_is_file (g, binaries[i], 1) > 0) {
       CLEANUP_FREE char *resolved = NULL;
 
       /* Ignore errors from realpath and file_architecture calls. */
@@ -1085,7 +1046,7 @@ check_hostname_unix (guestfs_h *g, struct inspect_fs *fs)
      * It's best to just look for each of these files in turn, rather
      * than try anything clever based on distro.
      */
-    if (guestfs_is_file (g, "/etc/HOSTNAME")) {
+    if (guestfs_int_inspect_is_file (g, "/etc/HOSTNAME", 0)) {
       fs->hostname = guestfs_int_first_line_of_file (g, "/etc/HOSTNAME");
       if (fs->hostname == NULL)
         return -1;
@@ -1095,7 +1056,7 @@ check_hostname_unix (guestfs_h *g, struct inspect_fs *fs)
       }
     }
 
-    if (!fs->hostname && guestfs_is_file (g, "/etc/hostname")) {
+    if (!fs->hostname && guestfs_int_inspect_is_file (g, "/etc/hostname", 0)) {
       fs->hostname = guestfs_int_first_line_of_file (g, "/etc/hostname");
       if (fs->hostname == NULL)
         return -1;
@@ -1105,10 +1066,8 @@ check_hostname_unix (guestfs_h *g, struct inspect_fs *fs)
       }
     }
 
-    if (!fs->hostname && guestfs_is_file (g, "/etc/sysconfig/network")) {
-      const char *configfiles[] = { "/etc/sysconfig/network", NULL };
-      if (inspect_with_augeas (g, fs, configfiles,
-                               check_hostname_redhat) == -1)
+    if (!fs->hostname && guestfs_int_inspect_is_file (g, "/etc/sysconfig/network", 0)) {
+      if (check_hostname_redhat (g, fs) == -1)
         return -1;
     }
     break;
@@ -1118,14 +1077,14 @@ check_hostname_unix (guestfs_h *g, struct inspect_fs *fs)
     /* /etc/rc.conf contains the hostname, but there is no Augeas lens
      * for this file.
      */
-    if (guestfs_is_file (g, "/etc/rc.conf")) {
+    if (guestfs_int_inspect_is_file (g, "/etc/rc.conf", 0)) {
       if (check_hostname_freebsd (g, fs) == -1)
         return -1;
     }
     break;
 
   case OS_TYPE_OPENBSD:
-    if (guestfs_is_file (g, "/etc/myname")) {
+    if (guestfs_int_inspect_is_file (g, "/etc/myname", 0)) {
       fs->hostname = guestfs_int_first_line_of_file (g, "/etc/myname");
       if (fs->hostname == NULL)
         return -1;
@@ -1137,7 +1096,7 @@ check_hostname_unix (guestfs_h *g, struct inspect_fs *fs)
     break;
 
   case OS_TYPE_MINIX:
-    if (guestfs_is_file (g, "/etc/hostname.file")) {
+    if (guestfs_int_inspect_is_file (g, "/etc/hostname.file", 0)) {
       fs->hostname = guestfs_int_first_line_of_file (g, "/etc/hostname.file");
       if (fs->hostname == NULL)
         return -1;
@@ -1157,26 +1116,67 @@ check_hostname_unix (guestfs_h *g, struct inspect_fs *fs)
   return 0;
 }
 
-/* Parse the hostname from /etc/sysconfig/network.  This must be
- * called from the inspect_with_augeas wrapper.  Note that F18+ and
- * RHEL7+ use /etc/hostname just like Debian.
+/* Parse the hostname from /etc/sysconfig/network.  Note that F18+
+ * and RHEL7+ use /etc/hostname just like Debian.
  */
 static int
 check_hostname_redhat (guestfs_h *g, struct inspect_fs *fs)
 {
+  const char *configfiles[] = { "/etc/sysconfig/network", NULL };
+  CLEANUP_FREE_STRING_LIST char **lines = NULL;
+  char *hostname;
+
+  lines = guestfs_int_inspect_read_lines (g, configfiles[0],
+                                          MAX_AUGEAS_FILE_SIZE);
+  if (lines == NULL)
+    return -1;
+
+  switch (guestfs_int_parse_shellvar (g, lines, "HOSTNAME", &hostname)) {
+  case 1:
+    if (STREQ (hostname, ""))
+      free (hostname);
+    else
+      fs->hostname = hostname; /* freed by guestfs_int_free_inspect_info */
+    return 0;
+
+  case 0:
+    return 0;
+
+  default:
+    /* Leave anything more complicated to Augeas. */
+    return inspect_with_augeas (g, fs, configfiles,
+                                check_hostname_redhat_augeas);
+  }
+}
+
+/* This must be called from the inspect_with_augeas wrapper. */
+static int
+check_hostname_redhat_augeas (guestfs_h *g, struct inspect_fs *fs)
+{
+  CLEANUP_FREE char *value = NULL;
   char *hostname;
 
   /* Errors here are not fatal (RHBZ#726739), since it could be
    * just missing HOSTNAME field in the file.
    */
   guestfs_push_error_handler (g, NULL, NULL);
-  hostname = guestfs_aug_get (g, "/files/etc/sysconfig/network/HOSTNAME");
+  value = guestfs_aug_get (g, "/files/etc/sysconfig/network/HOSTNAME");
   guestfs_pop_error_handler (g);
+  if (value == NULL)
+    return 0;
 
-  /* This is freed by guestfs_int_free_inspect_info.  Note that hostname
-   * could be NULL because we ignored errors above.
+  /* Augeas returns the value with any quotes still around it.  Remove
+   * them so the result is the same as guestfs_int_parse_shellvar.
    */
-  fs->hostname = hostname;
+  hostname = guestfs_int_shell_unquote (value);
+  if (hostname == NULL) {
+    perrorf (g, "guestfs_int_shell_unquote");
+    return -1;
+  }
+  if (STREQ (hostname, ""))
+    free (hostname);
+  else
+    fs->hostname = hostname; /* freed by guestfs_int_free_inspect_info */
   return 0;
 }
 
@@ -1190,25 +1190,11 @@ check_hostname_redhat (guestfs_h *g, struct inspect_fs *fs)
 static int
 check_hostname_freebsd (guestfs_h *g, struct inspect_fs *fs)
 {
-  const char *filename = "/etc/rc.conf";
-  int64_t size;
   CLEANUP_FREE_STRING_LIST char **lines = NULL;
   size_t i;
 
-  /* Don't trust guestfs_read_lines not to break with very large files.
-   * Check the file size is something reasonable first.
-   */
-  size = guestfs_filesize (g, filename);
-  if (size == -1)
-    /* guestfs_filesize failed and has already set error in handle */
-    return -1;
-  if (size > MAX_SMALL_FILE_SIZE) {
-    error (g, _("size of %s is unreasonably large (%" PRIi64 " bytes)"),
-           filename, size);
-    return -1;
-  }
-
-  lines = guestfs_read_lines (g, filename);
+  lines = guestfs_int_inspect_read_lines (g, "/etc/rc.conf",
+                                          MAX_SMALL_FILE_SIZE);
   if (lines == NULL)
     return -1;
 
@@ -1228,141 +1214,259 @@ check_hostname_freebsd (guestfs_h *g, struct inspect_fs *fs)
   return 0;
 }
 
+static int check_fstab_entries (guestfs_h *g, struct inspect_fs *fs, const struct fstab_line *entries, size_t nr_entries, char **md_arrays);
+
+/* Parse /etc/fstab, and /etc/mdadm.conf if it is in 'configfiles', to
+ * find the filesystems used by the guest.  If either file uses syntax
+ * which the parsers in src/inspect-conf.c don't understand, they are
+ * read with Augeas instead.
+ */
 static int
-check_fstab (guestfs_h *g, struct inspect_fs *fs)
+check_fstab (guestfs_h *g, struct inspect_fs *fs, const char **configfiles)
 {
-  CLEANUP_FREE_STRING_LIST char **entries = NULL;
-  char **entry;
-  char augpath[256];
-  CLEANUP_HASH_FREE Hash_table *md_map = NULL;
-  bool is_bsd = (fs->type == OS_TYPE_FREEBSD ||
-                 fs->type == OS_TYPE_NETBSD ||
-                 fs->type == OS_TYPE_OPENBSD);
-
-  /* Generate a map of MD device paths listed in /etc/mdadm.conf to MD device
-   * paths in the guestfs appliance */
-  if (map_md_devices (g, &md_map) == -1) return -1;
+  CLEANUP_FREE_STRING_LIST char **lines = NULL;
+  CLEANUP_FREE_STRING_LIST char **md_arrays = NULL;
+  struct fstab_line *entries;
+  size_t nr_entries, i;
+  int r;
 
-  entries = guestfs_aug_match (g, "/files/etc/fstab/*[label() != '#comment']");
-  if (entries == NULL)
+  lines = guestfs_int_inspect_read_lines (g, "/etc/fstab",
+                                          MAX_AUGEAS_FILE_SIZE);
+  if (lines == NULL)
     return -1;
 
-  for (entry = entries; *entry != NULL; entry++) {
-    CLEANUP_FREE char *spec = NULL;
-    CLEANUP_FREE char *mp = NULL;
-    CLEANUP_FREE char *mountable = NULL;
-    CLEANUP_FREE char *vfstype = NULL;
-
-    snprintf (augpath, sizeof augpath, "%s/spec", *entry);
-    spec = guestfs_aug_get (g, augpath);
-    if (spec == NULL)
-      return -1;
+  for (i = 0; configfiles[i] != NULL; ++i) {
+    CLEANUP_FREE_STRING_LIST char **md_lines = NULL;
 
-    /* Ignore /dev/fd (floppy disks) (RHBZ#642929) and CD-ROM drives.
-     *
-     * /dev/iso9660/FREEBSD_INSTALL can be found in FreeBSDs installation
-     * discs.
-     */
-    if ((STRPREFIX (spec, "/dev/fd") && c_isdigit (spec[7])) ||
-        STREQ (spec, "/dev/floppy") ||
-        STREQ (spec, "/dev/cdrom") ||
-        STRPREFIX (spec, "/dev/iso9660/"))
+    if (STRNEQ (configfiles[i], "/etc/mdadm.conf"))
       continue;
 
-    snprintf (augpath, sizeof augpath, "%s/file", *entry);
-    mp = guestfs_aug_get (g, augpath);
-    if (mp == NULL)
-      return -1;
+    if (guestfs_int_inspect_is_file (g, configfiles[i], 1) > 0) {
+      md_lines = guestfs_int_inspect_read_lines (g, configfiles[i],
+                                                 MAX_AUGEAS_FILE_SIZE);
+      if (md_lines == NULL)
+        return -1;
+      md_arrays = guestfs_int_parse_mdadm_conf (g, md_lines);
+      if (md_arrays == NULL)
+        goto augeas;
+    }
+  }
+  if (md_arrays == NULL)
+    md_arrays = safe_calloc (g, 1, sizeof (char *));
 
-    /* Ignore certain mountpoints. */
-    if (STRPREFIX (mp, "/dev/") ||
-        STREQ (mp, "/dev") ||
-        STRPREFIX (mp, "/media/") ||
-        STRPREFIX (mp, "/proc/") ||
-        STREQ (mp, "/proc") ||
-        STRPREFIX (mp, "/selinux/") ||
-        STREQ (mp, "/selinux") ||
-        STRPREFIX (mp, "/sys/") ||
-        STREQ (mp, "/sys"))
-      continue;
+  if (guestfs_int_parse_fstab (g, lines, &entries, &nr_entries) == -1)
+    goto augeas;
 
-    /* Resolve UUID= and LABEL= to the actual device. */
-    if (STRPREFIX (spec, "UUID=")) {
-      CLEANUP_FREE char *s = guestfs_int_shell_unquote (&spec[5]);
-      if (s == NULL) { perrorf (g, "guestfs_int_shell_unquote"); return -1; }
-      mountable = guestfs_findfs_uuid (g, s);
-    }
-    else if (STRPREFIX (spec, "LABEL=")) {
-      CLEANUP_FREE char *s = guestfs_int_shell_unquote (&spec[6]);
-      if (s == NULL) { perrorf (g, "guestfs_int_shell_unquote"); return -1; }
-      mountable = guestfs_findfs_label (g, s);
-    }
-    /* Ignore "/.swap" (Pardus) and pseudo-devices like "tmpfs". */
-    else if (STREQ (spec, "/dev/root") || (is_bsd && STREQ (mp, "/")))
-      /* Resolve /dev/root to the current device.
-       * Do the same for the / partition of the *BSD systems, since the
-       * BSD -> Linux device translation is not straight forward.
-       */
-      mountable = safe_strdup (g, fs->mountable);
-    else if (STRPREFIX (spec, "/dev/"))
-      /* Resolve guest block device names. */
-      mountable = resolve_fstab_device (g, spec, md_map, fs->type);
-    else if (match (g, spec, re_openbsd_duid)) {
-      /* In OpenBSD's fstab you can specify partitions on a disk by appending a
-       * period and a partition letter to a Disklable Unique Identifier. The
-       * DUID is a 16 hex digit field found in the OpenBSD's altered BSD
-       * disklabel. For more info see here:
-       * http://www.openbsd.org/faq/faq14.html#intro
-       */
-      char device[10]; /* /dev/sd[0-9][a-z] */
-      char part = spec[17];
+  r = check_fstab_entries (g, fs, entries, nr_entries, md_arrays);
+  guestfs_int_free_fstab_lines (entries, nr_entries);
+  return r;
 
-      /* We cannot peep into disklables, we can only assume that this is the
-       * first disk.
-       */
-      snprintf(device, 10, "%s%c", "/dev/sd0", part);
-      mountable = resolve_fstab_device (g, device, md_map, fs->type);
-    }
+ augeas:
+  debug (g, "inspect-os: using Augeas to parse /etc/fstab");
+  return inspect_with_augeas (g, fs, configfiles, check_fstab_augeas);
+}
 
-    /* If we haven't resolved the device successfully by this point,
-     * we don't care, just ignore it.
-     */
-    if (mountable == NULL)
-      continue;
+/* Read /etc/fstab using Augeas.  This must be called from the
+ * inspect_with_augeas wrapper.
+ */
+static int
+check_fstab_augeas (guestfs_h *g, struct inspect_fs *fs)
+{
+  CLEANUP_FREE_STRING_LIST char **matches = NULL;
+  struct fstab_line *entries;
+  size_t nr_entries, i;
+  char augpath[256];
+  int r = -1;
+
+  matches = guestfs_aug_match (g, "/files/etc/fstab/*[label() != '#comment']");
+  if (matches == NULL)
+    return -1;
+
+  nr_entries = guestfs_int_count_strings (matches);
+  entries = safe_calloc (g, nr_entries + 1, sizeof *entries);
+
+  for (i = 0; i < nr_entries; ++i) {
+    struct fstab_line *e = &entries[i];
+
+    snprintf (augpath, sizeof augpath, "%s/spec", matches[i]);
+    e->spec = guestfs_aug_get (g, augpath);
+    if (e->spec == NULL)
+      goto out;
+
+    snprintf (augpath, sizeof augpath, "%s/file", matches[i]);
+    e->file = guestfs_aug_get (g, augpath);
+    if (e->file == NULL)
+      goto out;
 
-    snprintf (augpath, sizeof augpath, "%s/vfstype", *entry);
-    vfstype = guestfs_aug_get (g, augpath);
-    if (vfstype == NULL) return -1;
+    snprintf (augpath, sizeof augpath, "%s/vfstype", matches[i]);
+    e->vfstype = guestfs_aug_get (g, augpath);
+    if (e->vfstype == NULL)
+      goto out;
 
-    if (STREQ (vfstype, "btrfs")) {
+    /* Only the btrfs subvol option is used. */
+    if (STREQ (e->vfstype, "btrfs")) {
+      CLEANUP_FREE_STRING_LIST char **opts = NULL;
+      DECLARE_STRINGSBUF (options);
       char **opt;
 
-      snprintf (augpath, sizeof augpath, "%s/opt", *entry);
-      CLEANUP_FREE_STRING_LIST char **opts = guestfs_aug_match (g, augpath);
-      if (opts == NULL) return -1;
+      snprintf (augpath, sizeof augpath, "%s/opt", matches[i]);
+      opts = guestfs_aug_match (g, augpath);
+      if (opts == NULL)
+        goto out;
 
       for (opt = opts; *opt; opt++) {
-        CLEANUP_FREE char *optname = guestfs_aug_get (g, augpath);
-        if (optname == NULL) return -1;
+        CLEANUP_FREE char *optname = guestfs_aug_get (g, *opt);
+        if (optname == NULL) {
+          guestfs_int_free_stringsbuf (&options);
+          goto out;
+        }
 
         if (STREQ (optname, "subvol")) {
           CLEANUP_FREE char *subvol = NULL;
-          char *new;
 
           snprintf (augpath, sizeof augpath, "%s/value", *opt);
           subvol = guestfs_aug_get (g, augpath);
-          if (subvol == NULL) return -1;
+          if (subvol == NULL) {
+            guestfs_int_free_stringsbuf (&options);
+            goto out;
+          }
 
-          new = safe_asprintf (g, "btrfsvol:%s/%s", mountable, subvol);
-          free (mountable);
-          mountable = new;
+          guestfs_int_add_sprintf (g, &options, "subvol=%s", subvol);
         }
       }
+      guestfs_int_end_stringsbuf (g, &options);
+      e->options = guestfs_int_join_strings (",", options.argv);
+      guestfs_int_free_stringsbuf (&options);
+      if (e->options == NULL)
+        g->abort_cb ();
     }
+    else
+      e->options = safe_strdup (g, "");
+  }
+
+  r = check_fstab_entries (g, fs, entries, nr_entries, NULL);
 
-    add_fstab_entry (g, fs, mountable, mp);
+ out:
+  guestfs_int_free_fstab_lines (entries, nr_entries);
+  return r;
+}
+
+static int check_fstab_entry (guestfs_h *g, struct inspect_fs *fs, Hash_table *md_map, const struct fstab_line *entry);
+
+/* 'md_arrays' are the arrays in /etc/mdadm.conf as returned by
+ * guestfs_int_parse_mdadm_conf, or NULL to read them with Augeas.
+ */
+static int
+check_fstab_entries (guestfs_h *g, struct inspect_fs *fs,
+                     const struct fstab_line *entries, size_t nr_entries,
+                     char **md_arrays)
+{
+  CLEANUP_HASH_FREE Hash_table *md_map = NULL;
+  size_t i;
+
+  /* Generate a map of MD device paths listed in /etc/mdadm.conf to MD device
+   * paths in the guestfs appliance */
+  if (map_md_devices (g, md_arrays, &md_map) == -1) return -1;
+
+  for (i = 0; i < nr_entries; ++i) {
+    if (check_fstab_entry (g, fs, md_map, &entries[i]) == -1)
+      return -1;
+  }
+
+  return 0;
+}
+
+static int
+check_fstab_entry (guestfs_h *g, struct inspect_fs *fs, Hash_table *md_map,
+                   const struct fstab_line *entry)
+{
+  const char *spec = entry->spec;
+  const char *mp = entry->file;
+  CLEANUP_FREE char *mountable = NULL;
+  bool is_bsd = (fs->type == OS_TYPE_FREEBSD ||
+                 fs->type == OS_TYPE_NETBSD ||
+                 fs->type == OS_TYPE_OPENBSD);
+
+  /* Ignore /dev/fd (floppy disks) (RHBZ#642929) and CD-ROM drives.
+   *
+   * /dev/iso9660/FREEBSD_INSTALL can be found in FreeBSDs installation
+   * discs.
+   */
+  if ((STRPREFIX (spec, "/dev/fd") && c_isdigit (spec[7])) ||
+      STREQ (spec, "/dev/floppy") ||
+      STREQ (spec, "/dev/cdrom") ||
+      STRPREFIX (spec, "/dev/iso9660/"))
+    return 0;
+
+  /* Ignore certain mountpoints. */
+  if (STRPREFIX (mp, "/dev/") ||
+      STREQ (mp, "/dev") ||
+      STRPREFIX (mp, "/media/") ||
+      STRPREFIX (mp, "/proc/") ||
+      STREQ (mp, "/proc") ||
+      STRPREFIX (mp, "/selinux/") ||
+      STREQ (mp, "/selinux") ||
+      STRPREFIX (mp, "/sys/") ||
+      STREQ (mp, "/sys"))
+    return 0;
+
+  /* Resolve UUID= and LABEL= to the actual device. */
+  if (STRPREFIX (spec, "UUID=")) {
+    CLEANUP_FREE char *s = guestfs_int_shell_unquote (&spec[5]);
+    if (s == NULL) { perrorf (g, "guestfs_int_shell_unquote"); return -1; }
+    mountable = guestfs_findfs_uuid (g, s);
+  }
+  else if (STRPREFIX (spec, "LABEL=")) {
+    CLEANUP_FREE char *s = guestfs_int_shell_unquote (&spec[6]);
+    if (s == NULL) { perrorf (g, "guestfs_int_shell_unquote"); return -1; }
+    mountable = guestfs_findfs_label (g, s);
+  }
+  /* Ignore "/.swap" (Pardus) and pseudo-devices like "tmpfs". */
+  else if (STREQ (spec, "/dev/root") || (is_bsd && STREQ (mp, "/")))
+    /* Resolve /dev/root to the current device.
+     * Do the same for the / partition of the *BSD systems, since the
+     * BSD -> Linux device translation is not straight forward.
+     */
+    mountable = safe_strdup (g, fs->mountable);
+  else if (STRPREFIX (spec, "/dev/"))
+    /* Resolve guest block device names. */
+    mountable = resolve_fstab_device (g, spec, md_map, fs->type);
+  else if (match (g, spec, re_openbsd_duid)) {
+    /* In OpenBSD's fstab you can specify partitions on a disk by appending a
+     * period and a partition letter to a Disklable Unique Identifier. The
+     * DUID is a 16 hex digit field found in the OpenBSD's altered BSD
+     * disklabel. For more info see here:
+     * http://www.openbsd.org/faq/faq14.html#intro
+     */
+    char device[10]; /* /dev/sd[0-9][a-z] */
+    char part = spec[17];
+
+    /* We cannot peep into disklables, we can only assume that this is the
+     * first disk.
+     */
+    snprintf(device, 10, "%s%c", "/dev/sd0", part);
+    mountable = resolve_fstab_device (g, device, md_map, fs->type);
+  }
+
+  /* If we haven't resolved the device successfully by this point,
+   * we don't care, just ignore it.
+   */
+  if (mountable == NULL)
+    return 0;
+
+  if (STREQ (entry->vfstype, "btrfs")) {
+    CLEANUP_FREE char *subvol =
+      guestfs_int_fstab_option (g, entry->options, "subvol");
+
+    if (subvol) {
+      char *new = safe_asprintf (g, "btrfsvol:%s/%s", mountable, subvol);
+      free (mountable);
+      mountable = new;
+    }
   }
 
+  add_fstab_entry (g, fs, mountable, mp);
+
   return 0;
 }
 
@@ -1563,13 +1667,50 @@ mdadm_app_free(void *x)
   free(a);
 }
 
+/* Get the arrays listed in /etc/mdadm.conf using Augeas, in the same
+ * form as guestfs_int_parse_mdadm_conf.
+ */
+static char **
+get_mdadm_arrays_augeas (guestfs_h *g)
+{
+  CLEANUP_FREE_STRING_LIST char **matches = NULL;
+  DECLARE_STRINGSBUF (ret);
+
+  matches = guestfs_aug_match(g, "/files/etc/mdadm.conf/array");
+  if (!matches) return NULL;
+
+  for (char **m = matches; *m != NULL; m++) {
+    /* Get device name and uuid for each array */
+    CLEANUP_FREE char *dev_path = safe_asprintf (g, "%s/devicename", *m);
+    char *dev = guestfs_aug_get (g, dev_path);
+    if (!dev) {
+      guestfs_int_free_stringsbuf (&ret);
+      return NULL;
+    }
+
+    CLEANUP_FREE char *uuid_path = safe_asprintf (g, "%s/uuid", *m);
+    char *uuid = guestfs_aug_get (g, uuid_path);
+    if (!uuid) {
+      free (dev);
+      continue;
+    }
+
+    guestfs_int_add_string_nodup (g, &ret, dev);
+    guestfs_int_add_string_nodup (g, &ret, uuid);
+  }
+
+  guestfs_int_end_stringsbuf (g, &ret);
+  return ret.argv;
+}
+
 /* Get a map of md device names in mdadm.conf to their device names in the
- * appliance */
+ * appliance.  'arrays' is the list of device names and uuids of the
+ * arrays in mdadm.conf, or NULL to read them with Augeas. */
 static int
-map_md_devices(guestfs_h *g, Hash_table **map)
+map_md_devices(guestfs_h *g, char **arrays, Hash_table **map)
 {
   CLEANUP_HASH_FREE Hash_table *app_map = NULL;
-  CLEANUP_FREE_STRING_LIST char **matches = NULL;
+  CLEANUP_FREE_STRING_LIST char **aug_arrays = NULL;
   ssize_t n_app_md_devices;
 
   *map = NULL;
@@ -1583,13 +1724,15 @@ map_md_devices(guestfs_h *g, Hash_table **map)
     return 0;
 
   /* Get all arrays listed in mdadm.conf */
-  matches = guestfs_aug_match(g, "/files/etc/mdadm.conf/array");
-  if (!matches) goto error;
+  if (arrays == NULL) {
+    aug_arrays = get_mdadm_arrays_augeas (g);
+    if (!aug_arrays) goto error;
+    arrays = aug_arrays;
+  }
 
   /* Log a debug message if we've got md devices, but nothing in mdadm.conf */
-  if (matches[0] == NULL) {
-    debug(g, "Appliance has MD devices, but augeas returned no array matches "
-	  "in mdadm.conf");
+  if (arrays[0] == NULL) {
+    debug(g, "Appliance has MD devices, but mdadm.conf lists no arrays");
     return 0;
   }
 
@@ -1597,28 +1740,18 @@ map_md_devices(guestfs_h *g, Hash_table **map)
 			 mdadm_app_free);
   if (!*map) g->abort_cb();
 
-  for (char **m = matches; *m != NULL; m++) {
-    /* Get device name and uuid for each array */
-    CLEANUP_FREE char *dev_path = safe_asprintf (g, "%s/devicename", *m);
-    char *dev = guestfs_aug_get (g, dev_path);
-    if (!dev) goto error;
-
-    CLEANUP_FREE char *uuid_path = safe_asprintf (g, "%s/uuid", *m);
-    CLEANUP_FREE char *uuid = guestfs_aug_get (g, uuid_path);
-    if (!uuid) {
-      free (dev);
-      continue;
-    }
+  for (char **a = arrays; a[0] != NULL && a[1] != NULL; a += 2) {
+    const char *dev = a[0];
+    const char *uuid = a[1];
 
     /* Parse the uuid into an md_uuid structure so we can look it up in the
      * uuid->appliance device map */
     md_uuid mdadm;
-    mdadm.path = dev;
+    mdadm.path = (char *) dev;
     if (parse_uuid(uuid, mdadm.uuid) == -1) {
       /* Invalid uuid. Weird, but not fatal. */
       debug(g, "inspect-os: mdadm.conf contains invalid uuid for %s: %s",
             dev, uuid);
-      free (dev);
       continue;
     }
 
@@ -1627,7 +1760,7 @@ map_md_devices(guestfs_h *g, Hash_table **map)
     md_uuid *app = hash_lookup(app_map, &mdadm);
     if (app) {
       mdadm_app *entry = safe_malloc(g, sizeof(mdadm_app));
-      entry->mdadm = dev;
+      entry->mdadm = safe_strdup(g, dev);
       entry->app = safe_strdup(g, app->path);
 
       switch (hash_insert_if_absent(*map, entry, NULL)) {
@@ -1641,8 +1774,7 @@ map_md_devices(guestfs_h *g, Hash_table **map)
 	mdadm_app_free(entry);
 	continue;
       }
-    } else
-      free (dev);
+    }
   }
 
   return 0;
@@ -1947,6 +2079,44 @@ resolve_fstab_device (guestfs_h *g, const char *spec, Hash_table *md_map,
 
 static char *make_augeas_path_expression (guestfs_h *g, const char **configfiles);
 
+/* The Augeas lens used for each file passed to inspect_with_augeas.
+ * Loading only these lenses is much faster than loading all of them.
+ */
+static const struct {
+  const char *file;
+  const char *lens;
+} augeas_lenses[] = {
+  { "/etc/fstab", "Fstab.lns" },
+  { "/etc/mdadm.conf", "Mdadm_conf.lns" },
+  { "/etc/sysconfig/network", "Shellvars.lns" },
+  { NULL, NULL }
+};
+
+/* Return the list of "LENS:FILE" transforms for guestfs_aug_init_files,
+ * or NULL if the lens for some file is not known.
+ */
+static char **
+make_augeas_transforms (guestfs_h *g, const char **configfiles)
+{
+  DECLARE_STRINGSBUF (ret);
+  size_t i, j;
+
+  for (i = 0; configfiles[i] != NULL; ++i) {
+    for (j = 0; augeas_lenses[j].file != NULL; ++j)
+      if (STREQ (configfiles[i], augeas_lenses[j].file))
+        break;
+    if (augeas_lenses[j].file == NULL) {
+      guestfs_int_free_stringsbuf (&ret);
+      return NULL;
+    }
+    guestfs_int_add_sprintf (g, &ret, "%s:%s",
+                             augeas_lenses[j].lens, configfiles[i]);
+  }
+  guestfs_int_end_stringsbuf (g, &ret);
+
+  return ret.argv;
+}
+
 /* Call 'f' with Augeas opened and having parsed 'configfiles' (these
  * files must exist).  As a security measure, this bails if any file
  * is too large for a reasonable configuration file.  After the call
@@ -1961,13 +2131,13 @@ inspect_with_augeas (guestfs_h *g, struct inspect_fs *fs,
   int64_t size;
   int r;
   CLEANUP_FREE char *pathexpr = NULL;
+  CLEANUP_FREE_STRING_LIST char **transforms = NULL;
   CLEANUP_FREE_STRING_LIST char **matches = NULL;
   char **match;
 
   /* Security: Refuse to do this if a config file is too large. */
   for (i = 0; configfiles[i] != NULL; ++i) {
-    if (guestfs_is_file_opts (g, configfiles[i],
-                              GUESTFS_IS_FILE_OPTS_FOLLOWSYMLINKS, 1, -1) == 0)
+    if (guestfs_int_inspect_is_file (g, configfiles[i], 1) == 0)
       continue;
 
     size = guestfs_filesize (g, configfiles[i]);
@@ -1981,23 +2151,36 @@ inspect_with_augeas (guestfs_h *g, struct inspect_fs *fs,
     }
   }
 
-  if (guestfs_aug_init (g, "/", 16|32 /* AUG_SAVE_NOOP|AUG_NO_LOAD */) == -1)
-    return -1;
-
   r = -1;
 
   /* Tell Augeas to only load configfiles and no other files.  This
    * prevents a rogue guest from performing a denial of service attack
    * by having large, over-complicated configuration files which are
    * unrelated to the task at hand.  (Thanks Dominic Cleal).
-   * Note this requires Augeas >= 1.0.0 because of RHBZ#975412.
+   *
+   * If we know the lens for every file, only those lenses are loaded
+   * too.  Otherwise load all the lenses and remove the unwanted
+   * transforms.  Note this requires Augeas >= 1.0.0 because of
+   * RHBZ#975412.
    */
-  pathexpr = make_augeas_path_expression (g, configfiles);
-  if (guestfs_aug_rm (g, pathexpr) == -1)
-    goto out;
+  transforms = make_augeas_transforms (g, configfiles);
+  if (transforms) {
+    if (guestfs_aug_init_files (g, "/", 16 /* AUG_SAVE_NOOP */,
+                                transforms) == -1)
+      return -1;
+  }
+  else {
+    if (guestfs_aug_init (g, "/",
+                          16|32 /* AUG_SAVE_NOOP|AUG_NO_LOAD */) == -1)
+      return -1;
 
-  if (guestfs_aug_load (g) == -1)
-    goto out;
+    pathexpr = make_augeas_path_expression (g, configfiles);
+    if (guestfs_aug_rm (g, pathexpr) == -1)
+      goto out;
+
+    if (guestfs_aug_load (g) == -1)
+      goto out;
+  }
 
   /* Check that augeas did not get a parse error for any of the configfiles,
    * otherwise we are silently missing information.
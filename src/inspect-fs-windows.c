@@ -126,7 +126,7 @@ guestfs_int_get_windows_systemroot (guestfs_h *g)
    * systemroot locations */
   CLEANUP_FREE char *boot_ini_path =
     guestfs_int_case_sensitive_path_silently (g, "/boot.ini");
-  if (boot_ini_path && guestfs_is_file (g, boot_ini_path) > 0) {
+  if (boot_ini_path && guestfs_int_inspect_is_file (g, boot_ini_path, 0) > 0) {
     CLEANUP_FREE_STRING_LIST char **boot_ini =
       guestfs_read_lines (g, boot_ini_path);
     if (!boot_ini) {
@@ -249,6 +249,25 @@ check_windows_arch (guestfs_h *g, struct inspect_fs *fs)
   return 0;
 }
 
+/* Read a DWORD registry value.  If 'check_type' is false, any 4 byte
+ * value is accepted whatever its registry type.
+ */
+static int
+get_dword (guestfs_h *g, const struct guestfs_internal_hivex_value *v,
+           bool check_type, int32_t *dword_r)
+{
+  uint32_t dword;
+
+  if ((check_type && v->hv_type != 4) || v->hv_value_len != 4) {
+    error (g, "hivex: expected %s\\%s to be a DWORD field",
+           v->hv_path, v->hv_key);
+    return -1;
+  }
+  memcpy (&dword, v->hv_value, 4);
+  *dword_r = le32toh (dword);
+  return 0;
+}
+
 /* At the moment, pull just the ProductName and version numbers from
  * the registry.  In future there is a case for making many more
  * registry fields available to callers.
@@ -256,7 +275,6 @@ check_windows_arch (guestfs_h *g, struct inspect_fs *fs)
 static int
 check_windows_software_registry (guestfs_h *g, struct inspect_fs *fs)
 {
-  int ret = -1;
   int r;
 
   CLEANUP_FREE char *software =
@@ -275,99 +293,81 @@ check_windows_software_registry (guestfs_h *g, struct inspect_fs *fs)
   if (r == 0)
     return 0;
 
-  int64_t node;
-  const char *hivepath[] =
-    { "Microsoft", "Windows NT", "CurrentVersion" };
-  size_t i;
-  CLEANUP_FREE_HIVEX_VALUE_LIST struct guestfs_hivex_value_list *values = NULL;
+#define CURRENTVERSION "Microsoft\\Windows NT\\CurrentVersion"
+  const char *queries[] = {
+    CURRENTVERSION, "ProductName",
+    CURRENTVERSION, "CurrentMajorVersionNumber",
+    CURRENTVERSION, "CurrentMinorVersionNumber",
+    CURRENTVERSION, "CurrentVersion",
+    CURRENTVERSION, "InstallationType",
+    NULL
+  };
+  CLEANUP_FREE_INTERNAL_HIVEX_VALUE_LIST
+    struct guestfs_internal_hivex_value_list *values = NULL;
   bool ignore_currentversion = false;
+  size_t i;
 
-  if (guestfs_hivex_open (g, software_path,
-                          GUESTFS_HIVEX_OPEN_VERBOSE, g->verbose, -1) == -1)
+  /* Fetch all of the values in a single call.  They are returned in
+   * the order they are stored in the hive.
+   */
+  values = guestfs_internal_hivex_query (g, software_path, (char **) queries);
+  if (values == NULL)
     return -1;
 
-  node = guestfs_hivex_root (g);
-  for (i = 0; node > 0 && i < sizeof hivepath / sizeof hivepath[0]; ++i)
-    node = guestfs_hivex_node_get_child (g, node, hivepath[i]);
-
-  if (node == -1)
-    goto out;
-
-  if (node == 0) {
-    perrorf (g, "hivex: cannot locate HKLM\\SOFTWARE\\Microsoft\\Windows NT\\CurrentVersion");
-    goto out;
+  if (values->len == 0) {
+    error (g, "hivex: cannot locate HKLM\\SOFTWARE\\" CURRENTVERSION);
+    return -1;
   }
-
-  values = guestfs_hivex_node_values (g, node);
+#undef CURRENTVERSION
 
   for (i = 0; i < values->len; ++i) {
-    int64_t value = values->val[i].hivex_value_h;
-    CLEANUP_FREE char *key = guestfs_hivex_value_key (g, value);
-    if (key == NULL)
-      goto out;
+    const struct guestfs_internal_hivex_value *v = &values->val[i];
+    const char *key = v->hv_key;
 
     if (STRCASEEQ (key, "ProductName")) {
-      fs->product_name = guestfs_hivex_value_utf8 (g, value);
-      if (!fs->product_name)
-        goto out;
+      fs->product_name = guestfs_int_utf16_to_utf8 (v->hv_value,
+                                                    v->hv_value_len);
+      if (!fs->product_name) {
+        perrorf (g, "hivex: conversion of registry value to UTF8 failed");
+        return -1;
+      }
     }
     else if (STRCASEEQ (key, "CurrentMajorVersionNumber")) {
-      size_t vsize;
-      int64_t vtype = guestfs_hivex_value_type (g, value);
-      CLEANUP_FREE char *vbuf = guestfs_hivex_value_value (g, value, &vsize);
-
-      if (vbuf == NULL)
-        goto out;
-      if (vtype != 4 || vsize != 4) {
-        error (g, "hivex: expected CurrentVersion\\%s to be a DWORD field",
-               "CurrentMajorVersionNumber");
-        goto out;
-      }
-
-      fs->version.v_major = le32toh (*(int32_t *)vbuf);
+      if (get_dword (g, v, true, &fs->version.v_major) == -1)
+        return -1;
 
       /* Ignore CurrentVersion if we see it after this key. */
       ignore_currentversion = true;
     }
     else if (STRCASEEQ (key, "CurrentMinorVersionNumber")) {
-      size_t vsize;
-      int64_t vtype = guestfs_hivex_value_type (g, value);
-      CLEANUP_FREE char *vbuf = guestfs_hivex_value_value (g, value, &vsize);
-
-      if (vbuf == NULL)
-        goto out;
-      if (vtype != 4 || vsize != 4) {
-        error (g, "hivex: expected CurrentVersion\\%s to be a DWORD field",
-               "CurrentMinorVersionNumber");
-        goto out;
-      }
-
-      fs->version.v_minor = le32toh (*(int32_t *)vbuf);
+      if (get_dword (g, v, true, &fs->version.v_minor) == -1)
+        return -1;
 
       /* Ignore CurrentVersion if we see it after this key. */
       ignore_currentversion = true;
     }
     else if (!ignore_currentversion && STRCASEEQ (key, "CurrentVersion")) {
-      CLEANUP_FREE char *version = guestfs_hivex_value_utf8 (g, value);
-      if (!version)
-        goto out;
+      CLEANUP_FREE char *version =
+        guestfs_int_utf16_to_utf8 (v->hv_value, v->hv_value_len);
+      if (!version) {
+        perrorf (g, "hivex: conversion of registry value to UTF8 failed");
+        return -1;
+      }
       if (guestfs_int_version_from_x_y_re (g, &fs->version, version,
                                            re_windows_version) == -1)
-        goto out;
+        return -1;
     }
     else if (STRCASEEQ (key, "InstallationType")) {
-      fs->product_variant = guestfs_hivex_value_utf8 (g, value);
-      if (!fs->product_variant)
-        goto out;
+      fs->product_variant = guestfs_int_utf16_to_utf8 (v->hv_value,
+                                                       v->hv_value_len);
+      if (!fs->product_variant) {
+        perrorf (g, "hivex: conversion of registry value to UTF8 failed");
+        return -1;
+      }
     }
   }
 
-  ret = 0;
-
- out:
-  guestfs_hivex_close (g);
-
-  return ret;
+  return 0;
 }
 
 static int
@@ -393,106 +393,87 @@ check_windows_system_registry (guestfs_h *g, struct inspect_fs *fs)
   if (r == 0)
     return 0;
 
-  int ret = -1;
-  int64_t root, node, value;
-  CLEANUP_FREE_HIVEX_VALUE_LIST struct guestfs_hivex_value_list *values = NULL;
-  CLEANUP_FREE_HIVEX_VALUE_LIST struct guestfs_hivex_value_list *values2 = NULL;
-  int32_t dword;
+  /* The daemon resolves CurrentControlSet using Select\Current, the
+   * same value we use to set windows_current_control_set below.
+   *
+   * This page explains the contents of HKLM\System\MountedDevices:
+   * http://www.goodells.net/multiboot/partsigs.shtml
+   */
+  const char *queries[] = {
+    "Select", "Current",
+    "MountedDevices", "",
+    "CurrentControlSet\\Services\\Tcpip\\Parameters", "Hostname",
+    NULL
+  };
+  CLEANUP_FREE_INTERNAL_HIVEX_VALUE_LIST
+    struct guestfs_internal_hivex_value_list *values = NULL;
+  int32_t dword = 0;
   size_t i, count;
-  CLEANUP_FREE void *buf = NULL;
-  size_t buflen;
-  const char *hivepath[] =
-    { NULL /* current control set */, "Services", "Tcpip", "Parameters" };
+  bool have_current = false, have_mounted_devices = false;
+  CLEANUP_FREE char *tcpip = NULL;
 
-  if (guestfs_hivex_open (g, system_path,
-                          GUESTFS_HIVEX_OPEN_VERBOSE, g->verbose, -1) == -1)
-    goto out;
-
-  root = guestfs_hivex_root (g);
-  if (root == 0)
-    goto out;
+  values = guestfs_internal_hivex_query (g, system_path, (char **) queries);
+  if (values == NULL)
+    return -1;
 
   /* Get the CurrentControlSet. */
-  node = guestfs_hivex_node_get_child (g, root, "Select");
-  if (node == -1)
-    goto out;
-
-  if (node == 0) {
-    error (g, "hivex: could not locate HKLM\\SYSTEM\\Select");
-    goto out;
-  }
-
-  value = guestfs_hivex_node_get_value (g, node, "Current");
-  if (value == -1)
-    goto out;
-
-  if (value == 0) {
-    error (g, "hivex: HKLM\\System\\Select Default entry not found");
-    goto out;
+  for (i = 0; i < values->len; ++i) {
+    const struct guestfs_internal_hivex_value *v = &values->val[i];
+
+    if (STRCASEEQ (v->hv_path, "Select") && STRCASEEQ (v->hv_key, "Current")) {
+      /* Not always a REG_DWORD, so only check the size. */
+      if (get_dword (g, v, false, &dword) == -1)
+        return -1;
+      have_current = true;
+      break;
+    }
   }
-
-  /* XXX Should check the type. */
-  buf = guestfs_hivex_value_value (g, value, &buflen);
-  if (buflen != 4) {
-    error (g, "hivex: HKLM\\System\\Select\\Current expected to be DWORD");
-    goto out;
+  if (!have_current) {
+    error (g, "hivex: could not locate HKLM\\SYSTEM\\Select\\Current");
+    return -1;
   }
-  dword = le32toh (*(int32_t *)buf);
   fs->windows_current_control_set = safe_asprintf (g, "ControlSet%03d", dword);
 
-  /* Get the drive mappings.
-   * This page explains the contents of HKLM\System\MountedDevices:
-   * http://www.goodells.net/multiboot/partsigs.shtml
-   */
-  node = guestfs_hivex_node_get_child (g, root, "MountedDevices");
-  if (node == -1)
-    goto out;
-
-  if (node == 0)
-    /* Not found: skip getting drive letter mappings (RHBZ#803664). */
-    goto skip_drive_letter_mappings;
-
-  values = guestfs_hivex_node_values (g, node);
-
   /* Count how many DOS drive letter mappings there are.  This doesn't
    * ignore removable devices, so it overestimates, but that doesn't
    * matter because it just means we'll allocate a few bytes extra.
+   * If there is no MountedDevices key then there are no drive letter
+   * mappings (RHBZ#803664).
    */
   for (i = count = 0; i < values->len; ++i) {
-    CLEANUP_FREE char *key =
-      guestfs_hivex_value_key (g, values->val[i].hivex_value_h);
-    if (key == NULL)
-      goto out;
-    if (STRCASEEQLEN (key, "\\DosDevices\\", 12) &&
-        c_isalpha (key[12]) && key[13] == ':')
-      count++;
+    const struct guestfs_internal_hivex_value *v = &values->val[i];
+
+    if (STRCASEEQ (v->hv_path, "MountedDevices")) {
+      have_mounted_devices = true;
+      if (STRCASEEQLEN (v->hv_key, "\\DosDevices\\", 12) &&
+          c_isalpha (v->hv_key[12]) && v->hv_key[13] == ':')
+        count++;
+    }
   }
 
-  fs->drive_mappings = safe_calloc (g, 2*count + 1, sizeof (char *));
+  if (have_mounted_devices) {
+    fs->drive_mappings = safe_calloc (g, 2*count + 1, sizeof (char *));
 
-  for (i = count = 0; i < values->len; ++i) {
-    int64_t v = values->val[i].hivex_value_h;
-    CLEANUP_FREE char *key = guestfs_hivex_value_key (g, v);
-    if (key == NULL)
-      goto out;
-    if (STRCASEEQLEN (key, "\\DosDevices\\", 12) &&
-        c_isalpha (key[12]) && key[13] == ':') {
-      /* Get the binary value.  Is it a fixed disk? */
-      CLEANUP_FREE char *blob = NULL;
+    for (i = count = 0; i < values->len; ++i) {
+      const struct guestfs_internal_hivex_value *v = &values->val[i];
+      const char *key = v->hv_key;
       char *device;
-      int64_t type;
       bool is_gpt;
-      size_t len;
 
-      type = guestfs_hivex_value_type (g, v);
-      blob = guestfs_hivex_value_value (g, v, &len);
-      is_gpt = memcmp (blob, gpt_prefix, 8) == 0;
-      if (blob != NULL && type == 3 && (len == 12 || is_gpt)) {
+      if (STRCASENEQ (v->hv_path, "MountedDevices") ||
+          !STRCASEEQLEN (key, "\\DosDevices\\", 12) ||
+          !c_isalpha (key[12]) || key[13] != ':')
+        continue;
+
+      /* Get the binary value.  Is it a fixed disk? */
+      is_gpt = v->hv_value_len >= 24 &&
+        memcmp (v->hv_value, gpt_prefix, 8) == 0;
+      if (v->hv_type == 3 && (v->hv_value_len == 12 || is_gpt)) {
         /* Try to map the blob to a known disk and partition. */
         if (is_gpt)
-          device = map_registry_disk_blob_gpt (g, blob);
+          device = map_registry_disk_blob_gpt (g, v->hv_value);
         else
-          device = map_registry_disk_blob (g, blob);
+          device = map_registry_disk_blob (g, v->hv_value);
 
         if (device != NULL) {
           fs->drive_mappings[count++] = safe_strndup (g, &key[12], 1);
@@ -502,48 +483,24 @@ check_windows_system_registry (guestfs_h *g, struct inspect_fs *fs)
     }
   }
 
- skip_drive_letter_mappings:;
   /* Get the hostname. */
-  hivepath[0] = fs->windows_current_control_set;
-  for (node = root, i = 0;
-       node > 0 && i < sizeof hivepath / sizeof hivepath[0];
-       ++i) {
-    node = guestfs_hivex_node_get_child (g, node, hivepath[i]);
-  }
-
-  if (node == -1)
-    goto out;
-
-  if (node == 0) {
-    perrorf (g, "hivex: cannot locate HKLM\\SYSTEM\\%s\\Services\\Tcpip\\Parameters",
-             fs->windows_current_control_set);
-    goto out;
-  }
-
-  values2 = guestfs_hivex_node_values (g, node);
-  if (values2 == NULL)
-    goto out;
-
-  for (i = 0; i < values2->len; ++i) {
-    int64_t v = values2->val[i].hivex_value_h;
-    CLEANUP_FREE char *key = guestfs_hivex_value_key (g, v);
-    if (key == NULL)
-      goto out;
+  tcpip = safe_asprintf (g, "%s\\Services\\Tcpip\\Parameters",
+                         fs->windows_current_control_set);
+  for (i = 0; i < values->len; ++i) {
+    const struct guestfs_internal_hivex_value *v = &values->val[i];
 
-    if (STRCASEEQ (key, "Hostname")) {
-      fs->hostname = guestfs_hivex_value_utf8 (g, v);
-      if (!fs->hostname)
-        goto out;
+    if (STRCASEEQ (v->hv_path, tcpip) && STRCASEEQ (v->hv_key, "Hostname")) {
+      fs->hostname = guestfs_int_utf16_to_utf8 (v->hv_value, v->hv_value_len);
+      if (!fs->hostname) {
+        perrorf (g, "hivex: conversion of registry value to UTF8 failed");
+        return -1;
+      }
+      /* many other interesting fields here ... */
+      break;
     }
-    /* many other interesting fields here ... */
   }
 
-  ret = 0;
-
- out:
-  guestfs_hivex_close (g);
-
-  return ret;
+  return 0;
 }
 
 /* Windows Registry HKLM\SYSTEM\MountedDevices uses a blob of data
@@ -694,6 +651,9 @@ guestfs_int_case_sensitive_path_silently (guestfs_h *g, const char *path)
 {
   char *ret;
 
+  if (guestfs_int_probe_case_sensitive_path (g, path, &ret))
+    return ret;
+
   guestfs_push_error_handler (g, NULL, NULL);
   ret = guestfs_case_sensitive_path (g, path);
   guestfs_pop_error_handler (g);
@@ -706,8 +666,6 @@ guestfs_int_case_sensitive_path_silently (guestfs_h *g, const char *path)
  * the appliance because it uses iconv_open which doesn't work because
  * we delete all the i18n databases.
  */
-static char *utf16_to_utf8 (/* const */ char *input, size_t len);
-
 char *
 guestfs_impl_hivex_value_utf8 (guestfs_h *g, int64_t valueh)
 {
@@ -718,7 +676,7 @@ guestfs_impl_hivex_value_utf8 (guestfs_h *g, int64_t valueh)
   if (buf == NULL)
     return NULL;
 
-  ret = utf16_to_utf8 (buf, buflen);
+  ret = guestfs_int_utf16_to_utf8 (buf, buflen);
   if (ret == NULL) {
     perrorf (g, "hivex: conversion of registry value to UTF8 failed");
     return NULL;
@@ -727,8 +685,11 @@ guestfs_impl_hivex_value_utf8 (guestfs_h *g, int64_t valueh)
   return ret;
 }
 
-static char *
-utf16_to_utf8 (/* const */ char *input, size_t len)
+/* Convert a UTF16LE registry string to UTF8.  On error this returns
+ * NULL and sets errno.
+ */
+char *
+guestfs_int_utf16_to_utf8 (/* const */ char *input, size_t len)
 {
   iconv_t ic = iconv_open ("UTF-8", "UTF-16LE");
   if (ic == (iconv_t) -1)
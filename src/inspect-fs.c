@@ -23,6 +23,7 @@
 #include <unistd.h>
 #include <string.h>
 #include <libintl.h>
+#include <regex.h>
 
 #ifdef HAVE_ENDIAN_H
 #include <endian.h>
@@ -42,6 +43,63 @@ static int check_filesystem (guestfs_h *g, const char *mountable,
 static void extend_fses (guestfs_h *g);
 static int get_partition_context (guestfs_h *g, const char *partition, int *partnum_ret, int *nr_partitions_ret);
 static int is_symlink_to (guestfs_h *g, const char *file, const char *wanted_target);
+static void probe_filesystem (guestfs_h *g);
+static void free_probe_facts (guestfs_h *g);
+
+/* Paths which inspection looks at in every filesystem.  These are
+ * all checked by a single guestfs_internal_inspect_probe call after
+ * the filesystem is mounted, and the wrappers below
+ * (guestfs_int_inspect_is_file etc.) answer from the result instead
+ * of making one round trip to the daemon per test.  Anything not
+ * listed here still works, it is just slower.
+ */
+static const char *probe_paths[] = {
+  /* check_filesystem */
+  "/etc", "/bin", "/share", "/root", "/home", "/usr", "/local",
+  "/log", "/run", "/spool",
+  "/grub/menu.lst", "/grub/grub.conf", "/grub2/grub.cfg",
+  "/etc/freebsd-update.conf", "/etc/fstab", "/etc/hosts",
+  "/etc/release", "/etc/motd", "/etc/version",
+  "/netbsd", "/bsd", "/service/vm",
+  "/hurd/console", "/hurd/hello", "/hurd/null",
+  "/etc/coreos/update.conf", "/share/coreos",
+  "/System Volume Information", "/Program Files",
+  "/FDOS", "/FDOS/FREEDOS.BSS",
+  "/isolinux/isolinux.cfg", "/EFI/BOOT", "/images/install.img",
+  "/.disk", "/.discinfo", "/i386/txtsetup.sif", "/amd64/txtsetup.sif",
+  "/freedos/freedos.ico", "/boot/loader.rc",
+
+  /* inspect-fs-unix.c */
+  "/etc/os-release", "/etc/lsb-release", "/etc/oracle-release",
+  "/etc/centos-release", "/etc/altlinux-release", "/etc/redhat-release",
+  "/etc/debian_version", "/etc/pardus-release", "/etc/arch-release",
+  "/etc/gentoo-release", "/etc/meego-release", "/etc/slackware-version",
+  "/etc/ttylinux-target", "/etc/SuSE-release", "/etc/cirros/version",
+  "/etc/br-version", "/usr/share/cirros/logo", "/etc/alpine-release",
+  "/etc/frugalware-release", "/lib/os-release", "/share/coreos/lsb-release",
+  "/etc/HOSTNAME", "/etc/hostname", "/etc/sysconfig/network",
+  "/etc/mdadm.conf",
+  "/etc/rc.conf", "/etc/myname", "/etc/hostname.file",
+  "/bin/bash", "/bin/ls", "/bin/echo", "/bin/rm", "/bin/sh",
+  "/usr/bin/dnf",
+
+  /* inspect-fs-windows.c */
+  "/boot.ini",
+#define SYSTEMROOT(dir) \
+  dir, dir "/system32", dir "/system32/config", dir "/system32/cmd.exe"
+  SYSTEMROOT ("/windows"), SYSTEMROOT ("/winnt"), SYSTEMROOT ("/win32"),
+  SYSTEMROOT ("/win"), SYSTEMROOT ("/reactos"),
+#undef SYSTEMROOT
+
+  /* inspect-fs-cd.c */
+  "/.disk/info", "/.disk/cd_type", "/.treeinfo",
+  "/casper/filesystem.squashfs", "/live/filesystem.squashfs",
+  "/mfsroot.gz", "/setup.bat",
+  NULL
+};
+
+/* Files up to this size are returned in full by the probe. */
+#define PROBE_CONTENT_SIZE 4096
 
 /* Find out if 'device' contains a filesystem.  If it does, add
  * another entry in g->fses.
@@ -118,7 +176,9 @@ guestfs_int_check_for_filesystem_on (guestfs_h *g, const char *mountable)
     return 0;
 
   /* Do the rest of the checks. */
+  probe_filesystem (g);
   r = check_filesystem (g, mountable, m, whole_device);
+  free_probe_facts (g);
 
   /* Unmount the filesystem. */
   if (guestfs_umount_all (g) == -1)
@@ -150,20 +210,20 @@ check_filesystem (guestfs_h *g, const char *mountable,
   fs->mountable = safe_strdup (g, mountable);
 
   /* Optimize some of the tests by avoiding multiple tests of the same thing. */
-  int is_dir_etc = guestfs_is_dir (g, "/etc") > 0;
-  int is_dir_bin = guestfs_is_dir (g, "/bin") > 0;
-  int is_dir_share = guestfs_is_dir (g, "/share") > 0;
+  int is_dir_etc = guestfs_int_inspect_is_dir (g, "/etc") > 0;
+  int is_dir_bin = guestfs_int_inspect_is_dir (g, "/bin") > 0;
+  int is_dir_share = guestfs_int_inspect_is_dir (g, "/share") > 0;
 
   /* Grub /boot? */
-  if (guestfs_is_file (g, "/grub/menu.lst") > 0 ||
-      guestfs_is_file (g, "/grub/grub.conf") > 0 ||
-      guestfs_is_file (g, "/grub2/grub.cfg") > 0)
+  if (guestfs_int_inspect_is_file (g, "/grub/menu.lst", 0) > 0 ||
+      guestfs_int_inspect_is_file (g, "/grub/grub.conf", 0) > 0 ||
+      guestfs_int_inspect_is_file (g, "/grub2/grub.cfg", 0) > 0)
     ;
   /* FreeBSD root? */
   else if (is_dir_etc &&
            is_dir_bin &&
-           guestfs_is_file (g, "/etc/freebsd-update.conf") > 0 &&
-           guestfs_is_file (g, "/etc/fstab") > 0) {
+           guestfs_int_inspect_is_file (g, "/etc/freebsd-update.conf", 0) > 0 &&
+           guestfs_int_inspect_is_file (g, "/etc/fstab", 0) > 0) {
     fs->is_root = 1;
     fs->format = OS_FORMAT_INSTALLED;
     if (guestfs_int_check_freebsd_root (g, fs) == -1)
@@ -172,9 +232,9 @@ check_filesystem (guestfs_h *g, const char *mountable,
   /* NetBSD root? */
   else if (is_dir_etc &&
            is_dir_bin &&
-           guestfs_is_file (g, "/netbsd") > 0 &&
-           guestfs_is_file (g, "/etc/fstab") > 0 &&
-           guestfs_is_file (g, "/etc/release") > 0) {
+           guestfs_int_inspect_is_file (g, "/netbsd", 0) > 0 &&
+           guestfs_int_inspect_is_file (g, "/etc/fstab", 0) > 0 &&
+           guestfs_int_inspect_is_file (g, "/etc/release", 0) > 0) {
     fs->is_root = 1;
     fs->format = OS_FORMAT_INSTALLED;
     if (guestfs_int_check_netbsd_root (g, fs) == -1)
@@ -183,18 +243,18 @@ check_filesystem (guestfs_h *g, const char *mountable,
   /* OpenBSD root? */
   else if (is_dir_etc &&
            is_dir_bin &&
-           guestfs_is_file (g, "/bsd") > 0 &&
-           guestfs_is_file (g, "/etc/fstab") > 0 &&
-           guestfs_is_file (g, "/etc/motd") > 0) {
+           guestfs_int_inspect_is_file (g, "/bsd", 0) > 0 &&
+           guestfs_int_inspect_is_file (g, "/etc/fstab", 0) > 0 &&
+           guestfs_int_inspect_is_file (g, "/etc/motd", 0) > 0) {
     fs->is_root = 1;
     fs->format = OS_FORMAT_INSTALLED;
     if (guestfs_int_check_openbsd_root (g, fs) == -1)
       return -1;
   }
   /* Hurd root? */
-  else if (guestfs_is_file (g, "/hurd/console") > 0 &&
-           guestfs_is_file (g, "/hurd/hello") > 0 &&
-           guestfs_is_file (g, "/hurd/null") > 0) {
+  else if (guestfs_int_inspect_is_file (g, "/hurd/console", 0) > 0 &&
+           guestfs_int_inspect_is_file (g, "/hurd/hello", 0) > 0 &&
+           guestfs_int_inspect_is_file (g, "/hurd/null", 0) > 0) {
     fs->is_root = 1;
     fs->format = OS_FORMAT_INSTALLED; /* XXX could be more specific */
     if (guestfs_int_check_hurd_root (g, fs) == -1)
@@ -203,9 +263,9 @@ check_filesystem (guestfs_h *g, const char *mountable,
   /* Minix root? */
   else if (is_dir_etc &&
            is_dir_bin &&
-           guestfs_is_file (g, "/service/vm") > 0 &&
-           guestfs_is_file (g, "/etc/fstab") > 0 &&
-           guestfs_is_file (g, "/etc/version") > 0) {
+           guestfs_int_inspect_is_file (g, "/service/vm", 0) > 0 &&
+           guestfs_int_inspect_is_file (g, "/etc/fstab", 0) > 0 &&
+           guestfs_int_inspect_is_file (g, "/etc/version", 0) > 0) {
     fs->is_root = 1;
     fs->format = OS_FORMAT_INSTALLED;
     if (guestfs_int_check_minix_root (g, fs) == -1)
@@ -215,8 +275,8 @@ check_filesystem (guestfs_h *g, const char *mountable,
   else if (is_dir_etc &&
            (is_dir_bin ||
             is_symlink_to (g, "/bin", "usr/bin") > 0) &&
-           (guestfs_is_file (g, "/etc/fstab") > 0 ||
-            guestfs_is_file (g, "/etc/hosts") > 0)) {
+           (guestfs_int_inspect_is_file (g, "/etc/fstab", 0) > 0 ||
+            guestfs_int_inspect_is_file (g, "/etc/hosts", 0) > 0)) {
     fs->is_root = 1;
     fs->format = OS_FORMAT_INSTALLED;
     if (guestfs_int_check_linux_root (g, fs) == -1)
@@ -224,10 +284,10 @@ check_filesystem (guestfs_h *g, const char *mountable,
   }
   /* CoreOS root? */
   else if (is_dir_etc &&
-           guestfs_is_dir (g, "/root") > 0 &&
-           guestfs_is_dir (g, "/home") > 0 &&
-           guestfs_is_dir (g, "/usr") > 0 &&
-           guestfs_is_file (g, "/etc/coreos/update.conf") > 0) {
+           guestfs_int_inspect_is_dir (g, "/root") > 0 &&
+           guestfs_int_inspect_is_dir (g, "/home") > 0 &&
+           guestfs_int_inspect_is_dir (g, "/usr") > 0 &&
+           guestfs_int_inspect_is_file (g, "/etc/coreos/update.conf", 0) > 0) {
     fs->is_root = 1;
     fs->format = OS_FORMAT_INSTALLED;
     if (guestfs_int_check_coreos_root (g, fs) == -1)
@@ -237,28 +297,28 @@ check_filesystem (guestfs_h *g, const char *mountable,
   else if (is_dir_etc &&
            is_dir_bin &&
            is_dir_share &&
-           guestfs_is_dir (g, "/local") == 0 &&
-           guestfs_is_file (g, "/etc/fstab") == 0)
+           guestfs_int_inspect_is_dir (g, "/local") == 0 &&
+           guestfs_int_inspect_is_file (g, "/etc/fstab", 0) == 0)
     ;
   /* Linux /usr? */
   else if (is_dir_etc &&
            is_dir_bin &&
            is_dir_share &&
-           guestfs_is_dir (g, "/local") > 0 &&
-           guestfs_is_file (g, "/etc/fstab") == 0)
+           guestfs_int_inspect_is_dir (g, "/local") > 0 &&
+           guestfs_int_inspect_is_file (g, "/etc/fstab", 0) == 0)
     ;
   /* CoreOS /usr? */
   else if (is_dir_bin &&
            is_dir_share &&
-           guestfs_is_dir (g, "/local") > 0 &&
-           guestfs_is_dir (g, "/share/coreos") > 0) {
+           guestfs_int_inspect_is_dir (g, "/local") > 0 &&
+           guestfs_int_inspect_is_dir (g, "/share/coreos") > 0) {
     if (guestfs_int_check_coreos_usr (g, fs) == -1)
       return -1;
   }
   /* Linux /var? */
-  else if (guestfs_is_dir (g, "/log") > 0 &&
-           guestfs_is_dir (g, "/run") > 0 &&
-           guestfs_is_dir (g, "/spool") > 0)
+  else if (guestfs_int_inspect_is_dir (g, "/log") > 0 &&
+           guestfs_int_inspect_is_dir (g, "/run") > 0 &&
+           guestfs_int_inspect_is_dir (g, "/spool") > 0)
     ;
   /* Windows root? */
   else if ((windows_systemroot = guestfs_int_get_windows_systemroot (g)) != NULL)
@@ -297,15 +357,15 @@ check_filesystem (guestfs_h *g, const char *mountable,
    * first partition (eg. bootable USB key).
    */
   else if ((whole_device || (partnum == 1 && nr_partitions == 1)) &&
-           (guestfs_is_file (g, "/isolinux/isolinux.cfg") > 0 ||
-            guestfs_is_dir (g, "/EFI/BOOT") > 0 ||
-            guestfs_is_file (g, "/images/install.img") > 0 ||
-            guestfs_is_dir (g, "/.disk") > 0 ||
-            guestfs_is_file (g, "/.discinfo") > 0 ||
-            guestfs_is_file (g, "/i386/txtsetup.sif") > 0 ||
-            guestfs_is_file (g, "/amd64/txtsetup.sif") > 0 ||
-            guestfs_is_file (g, "/freedos/freedos.ico") > 0 ||
-            guestfs_is_file (g, "/boot/loader.rc") > 0)) {
+           (guestfs_int_inspect_is_file (g, "/isolinux/isolinux.cfg", 0) > 0 ||
+            guestfs_int_inspect_is_dir (g, "/EFI/BOOT") > 0 ||
+            guestfs_int_inspect_is_file (g, "/images/install.img", 0) > 0 ||
+            guestfs_int_inspect_is_dir (g, "/.disk") > 0 ||
+            guestfs_int_inspect_is_file (g, "/.discinfo", 0) > 0 ||
+            guestfs_int_inspect_is_file (g, "/i386/txtsetup.sif", 0) > 0 ||
+            guestfs_int_inspect_is_file (g, "/amd64/txtsetup.sif", 0) > 0 ||
+            guestfs_int_inspect_is_file (g, "/freedos/freedos.ico", 0) > 0 ||
+            guestfs_int_inspect_is_file (g, "/boot/loader.rc", 0) > 0)) {
     fs->is_root = 1;
     fs->format = OS_FORMAT_INSTALLER;
     if (guestfs_int_check_installer_root (g, fs) == -1)
@@ -365,11 +425,102 @@ get_partition_context (guestfs_h *g, const char *partition,
   return 0;
 }
 
+/* Call guestfs_internal_inspect_probe on the filesystem which has
+ * just been mounted on /.  Errors are ignored: the wrappers below
+ * fall back to the ordinary calls if there are no facts.
+ */
+static void
+probe_filesystem (guestfs_h *g)
+{
+  free_probe_facts (g);
+
+  guestfs_push_error_handler (g, NULL, NULL);
+  g->probe_facts =
+    guestfs_internal_inspect_probe (g, (char **) probe_paths,
+                                    PROBE_CONTENT_SIZE);
+  guestfs_pop_error_handler (g);
+}
+
+static void
+free_probe_facts (guestfs_h *g)
+{
+  guestfs_free_internal_probe_fact_list (g->probe_facts);
+  g->probe_facts = NULL;
+}
+
+/* Look up 'path' in the probe results, returning NULL if it was
+ * not probed.  If 'nocase' is true the case of 'path' is ignored,
+ * which is fine for the pf_nocase_* fields.
+ */
+static const struct guestfs_internal_probe_fact *
+lookup_fact (guestfs_h *g, const char *path, int nocase)
+{
+  size_t i;
+
+  if (g->probe_facts == NULL)
+    return NULL;
+
+  for (i = 0; i < g->probe_facts->len; ++i) {
+    const char *p = g->probe_facts->val[i].pf_path;
+
+    if (nocase ? STRCASEEQ (p, path) : STREQ (p, path))
+      return &g->probe_facts->val[i];
+  }
+
+  return NULL;
+}
+
+/* Small files were returned in full by the probe.  Return the fact
+ * for 'path' if its content is there.
+ */
+static const struct guestfs_internal_probe_fact *
+lookup_content (guestfs_h *g, const char *path)
+{
+  const struct guestfs_internal_probe_fact *f = lookup_fact (g, path, 0);
+
+  if (f && f->pf_type == 'r' && f->pf_size >= 0 &&
+      f->pf_size <= PROBE_CONTENT_SIZE &&
+      f->pf_content_len == (size_t) f->pf_size)
+    return f;
+  return NULL;
+}
+
+/* Like guestfs_is_file_opts, but use the probe results if possible. */
+int
+guestfs_int_inspect_is_file (guestfs_h *g, const char *path,
+                             int followsymlinks)
+{
+  const struct guestfs_internal_probe_fact *f = lookup_fact (g, path, 0);
+
+  if (f)
+    return (followsymlinks ? f->pf_type : f->pf_ltype) == 'r';
+
+  return guestfs_is_file_opts (g, path,
+                               GUESTFS_IS_FILE_OPTS_FOLLOWSYMLINKS,
+                               followsymlinks, -1);
+}
+
+/* Like guestfs_is_dir, but use the probe results if possible. */
+int
+guestfs_int_inspect_is_dir (guestfs_h *g, const char *path)
+{
+  const struct guestfs_internal_probe_fact *f = lookup_fact (g, path, 0);
+
+  if (f)
+    return f->pf_ltype == 'd';
+
+  return guestfs_is_dir (g, path);
+}
+
 static int
 is_symlink_to (guestfs_h *g, const char *file, const char *wanted_target)
 {
+  const struct guestfs_internal_probe_fact *f = lookup_fact (g, file, 0);
   CLEANUP_FREE char *target = NULL;
 
+  if (f)
+    return f->pf_ltype == 'l' && STREQ (f->pf_link, wanted_target);
+
   if (guestfs_is_symlink (g, file) == 0)
     return 0;
 
@@ -384,9 +535,13 @@ is_symlink_to (guestfs_h *g, const char *file, const char *wanted_target)
 int
 guestfs_int_is_file_nocase (guestfs_h *g, const char *path)
 {
+  const struct guestfs_internal_probe_fact *f = lookup_fact (g, path, 1);
   CLEANUP_FREE char *p = NULL;
   int r;
 
+  if (f)
+    return f->pf_nocase_type == 'r';
+
   p = guestfs_int_case_sensitive_path_silently (g, path);
   if (!p)
     return 0;
@@ -397,9 +552,13 @@ guestfs_int_is_file_nocase (guestfs_h *g, const char *path)
 int
 guestfs_int_is_dir_nocase (guestfs_h *g, const char *path)
 {
+  const struct guestfs_internal_probe_fact *f = lookup_fact (g, path, 1);
   CLEANUP_FREE char *p = NULL;
   int r;
 
+  if (f)
+    return f->pf_nocase_type == 'd';
+
   p = guestfs_int_case_sensitive_path_silently (g, path);
   if (!p)
     return 0;
@@ -407,6 +566,23 @@ guestfs_int_is_dir_nocase (guestfs_h *g, const char *path)
   return r > 0;
 }
 
+/* If 'path' was probed, return the case-sensitive path (or NULL in
+ * '*ret' if guestfs_case_sensitive_path would fail) and return true.
+ */
+int
+guestfs_int_probe_case_sensitive_path (guestfs_h *g, const char *path,
+                                       char **ret)
+{
+  const struct guestfs_internal_probe_fact *f = lookup_fact (g, path, 1);
+
+  if (f == NULL)
+    return 0;
+
+  *ret = STRNEQ (f->pf_nocase_path, "") ?
+    safe_strdup (g, f->pf_nocase_path) : NULL;
+  return 1;
+}
+
 /* Parse small, unsigned ints, as used in version numbers. */
 int
 guestfs_int_parse_unsigned_int (guestfs_h *g, const char *str)
@@ -520,8 +696,7 @@ guestfs_int_check_package_management (guestfs_h *g, struct inspect_fs *fs)
   case OS_DISTRO_FEDORA:
     /* If Fedora >= 22 and dnf is installed, say "dnf". */
     if (guestfs_int_version_ge (&fs->version, 22, 0, 0) &&
-        guestfs_is_file_opts (g, "/usr/bin/dnf",
-                              GUESTFS_IS_FILE_OPTS_FOLLOWSYMLINKS, 1, -1) > 0)
+        guestfs_int_inspect_is_file (g, "/usr/bin/dnf", 1) > 0)
       fs->package_management = OS_PACKAGE_MANAGEMENT_DNF;
     else if (guestfs_int_version_ge (&fs->version, 1, 0, 0))
       fs->package_management = OS_PACKAGE_MANAGEMENT_YUM;
@@ -607,38 +782,73 @@ guestfs_int_check_package_management (guestfs_h *g, struct inspect_fs *fs)
 char *
 guestfs_int_first_line_of_file (guestfs_h *g, const char *filename)
 {
-  char **lines = NULL; /* sic: not CLEANUP_FREE_STRING_LIST */
-  int64_t size;
-  char *ret;
+  CLEANUP_FREE char *content = NULL;
+  size_t size;
+  const char *nl;
 
-  /* Don't trust guestfs_head_n not to break with very large files.
-   * Check the file size is something reasonable first.
-   */
-  size = guestfs_filesize (g, filename);
-  if (size == -1)
-    /* guestfs_filesize failed and has already set error in handle */
-    return NULL;
-  if (size > MAX_SMALL_FILE_SIZE) {
-    error (g, _("size of %s is unreasonably large (%" PRIi64 " bytes)"),
-           filename, size);
+  content = guestfs_int_inspect_read_small_file (g, filename,
+                                                 MAX_SMALL_FILE_SIZE, &size);
+  if (content == NULL)
     return NULL;
-  }
 
-  lines = guestfs_head_n (g, 1, filename);
-  if (lines == NULL)
+  nl = memchr (content, '\n', size);
+  return safe_strndup (g, content, nl ? (size_t) (nl - content) : size);
+}
+
+/* Read the whole of a small file, which must not be larger than
+ * 'maxsize' bytes.  A trailing '\0' is added to the content, which
+ * is not counted in '*size_r'.
+ */
+char *
+guestfs_int_inspect_read_small_file (guestfs_h *g, const char *filename,
+                                     size_t maxsize, size_t *size_r)
+{
+  char *content;
+  size_t len;
+  const struct guestfs_internal_probe_fact *f = lookup_content (g, filename);
+
+  if (f && f->pf_content_len <= maxsize) {
+    content = safe_malloc (g, f->pf_content_len + 1);
+    memcpy (content, f->pf_content, f->pf_content_len);
+    len = f->pf_content_len;
+  }
+  else
+    /* See src/file-cache.c */
+    return guestfs_int_file_cache_read (g, filename, maxsize, size_r);
+
+  content[len] = '\0';
+  *size_r = len;
+  return content;
+}
+
+/* Read a small file as lines, like guestfs_read_lines. */
+char **
+guestfs_int_inspect_read_lines (guestfs_h *g, const char *filename,
+                                size_t maxsize)
+{
+  CLEANUP_FREE char *content = NULL;
+  DECLARE_STRINGSBUF (ret);
+  size_t size, len;
+  const char *p, *end;
+
+  content = guestfs_int_inspect_read_small_file (g, filename, maxsize, &size);
+  if (content == NULL)
     return NULL;
-  if (lines[0] == NULL) {
-    guestfs_int_free_string_list (lines);
-    /* Empty file: Return an empty string as explained above. */
-    return safe_strdup (g, "");
-  }
-  /* lines[1] should be NULL because of '1' argument above ... */
 
-  ret = lines[0];               /* caller frees */
+  p = content;
+  end = content + size;
+  while (p < end) {
+    const char *nl = memchr (p, '\n', end - p);
 
-  free (lines);
+    len = nl ? (size_t) (nl - p) : (size_t) (end - p);
+    if (len > 0 && p[len-1] == '\r')
+      len--;
+    guestfs_int_add_string_nodup (g, &ret, safe_strndup (g, p, len));
+    p = nl ? nl + 1 : end;
+  }
+  guestfs_int_end_stringsbuf (g, &ret);
 
-  return ret;
+  return ret.argv;
 }
 
 /* Get the first matching line (using egrep [-i]) of a small file,
@@ -652,46 +862,49 @@ int
 guestfs_int_first_egrep_of_file (guestfs_h *g, const char *filename,
 				 const char *eregex, int iflag, char **ret)
 {
-  char **lines;
-  int64_t size;
-  size_t i;
-  struct guestfs_grep_opts_argv optargs;
-
-  /* Don't trust guestfs_grep not to break with very large files.
-   * Check the file size is something reasonable first.
+  CLEANUP_FREE char *content = NULL;
+  size_t size;
+  regex_t re;
+  int r, cflags = REG_EXTENDED | REG_NOSUB;
+  char *p, *end;
+
+  /* The file is matched here rather than with guestfs_grep so that
+   * the content can come from the probe or the file cache.
    */
-  size = guestfs_filesize (g, filename);
-  if (size == -1)
-    /* guestfs_filesize failed and has already set error in handle */
+  content = guestfs_int_inspect_read_small_file (g, filename,
+                                                 MAX_SMALL_FILE_SIZE, &size);
+  if (content == NULL)
     return -1;
-  if (size > MAX_SMALL_FILE_SIZE) {
-    error (g, _("size of %s is unreasonably large (%" PRIi64 " bytes)"),
-           filename, size);
-    return -1;
-  }
 
-  optargs.bitmask = GUESTFS_GREP_OPTS_EXTENDED_BITMASK;
-  optargs.extended = 1;
-  if (iflag) {
-    optargs.bitmask |= GUESTFS_GREP_OPTS_INSENSITIVE_BITMASK;
-    optargs.insensitive = 1;
-  }
-  lines = guestfs_grep_opts_argv (g, eregex, filename, &optargs);
-  if (lines == NULL)
+  if (iflag)
+    cflags |= REG_ICASE;
+  r = regcomp (&re, eregex, cflags);
+  if (r != 0) {
+    char errbuf[256];
+
+    regerror (r, &re, errbuf, sizeof errbuf);
+    error (g, _("invalid regular expression: %s: %s"), eregex, errbuf);
     return -1;
-  if (lines[0] == NULL) {
-    guestfs_int_free_string_list (lines);
-    return 0;
   }
 
-  *ret = lines[0];              /* caller frees */
+  r = 0;
+  p = content;
+  end = content + size;
+  while (p < end) {
+    char *nl = memchr (p, '\n', end - p);
 
-  /* free up any other matches and the array itself */
-  for (i = 1; lines[i] != NULL; ++i)
-    free (lines[i]);
-  free (lines);
+    if (nl)
+      *nl = '\0';
+    if (regexec (&re, p, 0, NULL, 0) == 0) {
+      *ret = safe_strdup (g, p);  /* caller frees */
+      r = 1;
+      break;
+    }
+    p = nl ? nl + 1 : end;
+  }
 
-  return 1;
+  regfree (&re);
+  return r;
 }
 
 /* Merge the missing OS inspection information found on the src inspect_fs into
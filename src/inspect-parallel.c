@@ -0,0 +1,443 @@
+/* libguestfs
+ * Copyright (C) 2016 Red Hat Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/**
+ * Inspect filesystems using several appliances at the same time.
+ *
+ * If L<guestfs(3)/guestfs_set_inspect_workers> is greater than 1,
+ * then C<guestfs_inspect_os> starts extra appliances on the same
+ * (read-only) drives, one per worker thread.  The filesystems are
+ * shared out between the main handle and the workers: each one takes
+ * the next unchecked filesystem until none are left.
+ *
+ * The results for each filesystem are moved back into the main
+ * handle in the same order that C<guestfs_list_filesystems> returned
+ * the filesystems, so the result is the same as checking them one at
+ * a time.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <libintl.h>
+
+#include <pthread.h>
+
+#include "ignore-value.h"
+
+#include "guestfs.h"
+#include "guestfs-internal.h"
+#include "guestfs-internal-actions.h"
+
+/* Upper limit on the number of appliances used by one inspection. */
+#define MAX_INSPECT_WORKERS 16
+
+/* The results of checking one filesystem. */
+struct fs_result {
+  struct inspect_fs *fses;
+  size_t nr_fses;
+};
+
+/* State shared between the main thread and the worker threads.
+ * 'next', 'failed' and 'error' are protected by 'lock'.  Each
+ * element of 'results' is written only by the thread which took
+ * that filesystem, and read after all threads have been joined.
+ */
+struct inspect_work {
+  char **fses;                  /* From guestfs_list_filesystems. */
+  size_t nr_mountables;
+  struct fs_result *results;    /* One entry per mountable. */
+
+  pthread_mutex_t lock;
+  size_t next;                  /* Next mountable to take. */
+  bool failed;                  /* Stop taking work. */
+  char *error;                  /* Error message from the first failure. */
+};
+
+struct worker {
+  struct inspect_work *work;
+  size_t num;
+  guestfs_h *g;                 /* Worker handle. */
+  pthread_t thread;
+  bool running;
+  char *unused_reason;          /* If the worker did not take any work. */
+};
+
+int
+guestfs_impl_set_inspect_workers (guestfs_h *g, int workers)
+{
+  if (workers < 1) {
+    error (g, _("invalid number of inspection workers: %d"), workers);
+    return -1;
+  }
+
+  g->inspect_workers = workers;
+  return 0;
+}
+
+int
+guestfs_impl_get_inspect_workers (guestfs_h *g)
+{
+  return g->inspect_workers;
+}
+
+/* Each worker opens the drives again in a separate appliance.  This
+ * is only safe if all the drives are local read-only files (so
+ * nothing can change underneath us, and each appliance has its own
+ * overlay), and there are no hot-removed slots (which would change
+ * the device names).
+ *
+ * A new appliance still does not have any state set up by the caller
+ * in the main appliance, such as LUKS devices opened by
+ * C<guestfs_luks_open> (or by C<inspect_do_decrypt> in the
+ * tools), LVs activated after launch, or changes written to the
+ * overlay.  That is checked by C<same_filesystems> once each worker
+ * has been launched.
+ */
+static bool
+drives_can_be_shared (guestfs_h *g)
+{
+  size_t i;
+  struct drive *drv;
+
+  if (g->nr_drives == 0)
+    return false;
+
+  for (i = 0; i < g->nr_drives; ++i) {
+    drv = g->drives[i];
+    if (drv == NULL) {
+      debug (g, "inspect workers: drive %zu was hot-removed", i);
+      return false;
+    }
+    if (drv->src.protocol != drive_protocol_file || !drv->readonly) {
+      debug (g, "inspect workers: drive %zu is not a read-only local file",
+             i);
+      return false;
+    }
+  }
+
+  return true;
+}
+
+/* Create a handle with the same settings and drives as 'g'. */
+static guestfs_h *
+create_worker_handle (guestfs_h *g, size_t num)
+{
+  guestfs_h *wg;
+  struct hv_param *hp;
+  struct drive *drv;
+  size_t i;
+  char id[64];
+
+  wg = guestfs_create ();
+  if (wg == NULL)
+    return NULL;
+
+  /* Errors are reported by the main handle. */
+  guestfs_set_error_handler (wg, NULL, NULL);
+
+  snprintf (id, sizeof id, "inspect_%zu", num);
+  if (guestfs_set_identifier (wg, id) == -1 ||
+      guestfs_set_verbose (wg, g->verbose) == -1 ||
+      guestfs_set_trace (wg, g->trace) == -1 ||
+      guestfs_set_path (wg, g->path) == -1 ||
+      guestfs_set_hv (wg, g->hv) == -1 ||
+      guestfs_set_append (wg, g->append) == -1 ||
+      guestfs_set_memsize (wg, g->memsize) == -1 ||
+      guestfs_set_smp (wg, g->smp) == -1 ||
+      guestfs_set_backend (wg, g->backend) == -1 ||
+      guestfs_set_tmpdir (wg, g->int_tmpdir) == -1 ||
+      guestfs_set_cachedir (wg, g->int_cachedir) == -1)
+    goto error;
+  if (g->backend_settings &&
+      guestfs_set_backend_settings (wg, g->backend_settings) == -1)
+    goto error;
+
+  for (hp = g->hv_params; hp; hp = hp->next) {
+    if (guestfs_config (wg, hp->hv_param, hp->hv_value) == -1)
+      goto error;
+  }
+
+  ITER_DRIVES (g, i, drv) {
+    struct guestfs_add_drive_opts_argv optargs = {
+      .bitmask = GUESTFS_ADD_DRIVE_OPTS_READONLY_BITMASK,
+      .readonly = 1,
+    };
+
+    if (drv->src.format) {
+      optargs.bitmask |= GUESTFS_ADD_DRIVE_OPTS_FORMAT_BITMASK;
+      optargs.format = drv->src.format;
+    }
+    if (drv->iface) {
+      optargs.bitmask |= GUESTFS_ADD_DRIVE_OPTS_IFACE_BITMASK;
+      optargs.iface = drv->iface;
+    }
+    if (drv->name) {
+      optargs.bitmask |= GUESTFS_ADD_DRIVE_OPTS_NAME_BITMASK;
+      optargs.name = drv->name;
+    }
+    if (drv->disk_label) {
+      optargs.bitmask |= GUESTFS_ADD_DRIVE_OPTS_LABEL_BITMASK;
+      optargs.label = drv->disk_label;
+    }
+    if (drv->cachemode) {
+      optargs.bitmask |= GUESTFS_ADD_DRIVE_OPTS_CACHEMODE_BITMASK;
+      optargs.cachemode = drv->cachemode;
+    }
+    if (drv->copyonread) {
+      optargs.bitmask |= GUESTFS_ADD_DRIVE_OPTS_COPYONREAD_BITMASK;
+      optargs.copyonread = 1;
+    }
+
+    if (guestfs_add_drive_opts_argv (wg, drv->src.u.path, &optargs) == -1)
+      goto error;
+  }
+
+  return wg;
+
+ error:
+  debug (g, "inspect workers: could not create worker %zu: %s",
+         num, guestfs_last_error (wg));
+  guestfs_close (wg);
+  return NULL;
+}
+
+/* Take the next mountable to check, returning false if there is no
+ * more work (or if another thread failed).
+ */
+static bool
+take_work (struct inspect_work *work, size_t *i)
+{
+  bool ret;
+
+  ignore_value (pthread_mutex_lock (&work->lock));
+  ret = !work->failed && work->next < work->nr_mountables;
+  if (ret)
+    *i = work->next++;
+  ignore_value (pthread_mutex_unlock (&work->lock));
+
+  return ret;
+}
+
+static void
+set_failed (struct inspect_work *work, const char *msg)
+{
+  ignore_value (pthread_mutex_lock (&work->lock));
+  if (!work->failed) {
+    work->failed = true;
+    work->error = strdup (msg ? msg : "");
+  }
+  ignore_value (pthread_mutex_unlock (&work->lock));
+}
+
+/* Check filesystems using handle 'h' until there are none left.
+ * Called both from the worker threads and (with the main handle)
+ * from the main thread.
+ */
+static void
+check_filesystems (guestfs_h *h, struct inspect_work *work)
+{
+  size_t i;
+
+  while (take_work (work, &i)) {
+    if (guestfs_int_check_for_filesystem_on (h, work->fses[2*i]) == -1) {
+      set_failed (work, guestfs_last_error (h));
+      guestfs_int_free_inspect_info (h);
+      return;
+    }
+
+    /* Move the results out of the handle. */
+    work->results[i].fses = h->fses;
+    work->results[i].nr_fses = h->nr_fses;
+    h->fses = NULL;
+    h->nr_fses = 0;
+  }
+}
+
+/* Check that the worker appliance sees exactly the same
+ * filesystems as the main appliance.  If not (for example because
+ * the caller opened encrypted devices in the main appliance), the
+ * worker cannot be used, since some filesystems would be missing
+ * and checking them would fail or return different results.
+ */
+static bool
+same_filesystems (guestfs_h *wg, char **fses)
+{
+  CLEANUP_FREE_STRING_LIST char **wfses = NULL;
+  size_t i;
+
+  wfses = guestfs_list_filesystems (wg);
+  if (wfses == NULL)
+    return false;
+
+  for (i = 0; fses[i] != NULL && wfses[i] != NULL; ++i) {
+    if (STRNEQ (fses[i], wfses[i]))
+      return false;
+  }
+
+  return fses[i] == NULL && wfses[i] == NULL;
+}
+
+static void *
+worker_thread (void *wvp)
+{
+  struct worker *w = wvp;
+  const char *msg;
+
+  /* If the worker cannot be used it is not fatal: the other
+   * appliances will do the work instead.
+   */
+  if (guestfs_launch (w->g) == -1) {
+    msg = guestfs_last_error (w->g);
+    w->unused_reason = strdup (msg ? msg : "");
+    return NULL;
+  }
+
+  if (!same_filesystems (w->g, w->work->fses)) {
+    w->unused_reason =
+      strdup ("the appliance does not see the same filesystems "
+              "as the main handle");
+    ignore_value (guestfs_shutdown (w->g));
+    return NULL;
+  }
+
+  check_filesystems (w->g, w->work);
+
+  ignore_value (guestfs_shutdown (w->g));
+  return NULL;
+}
+
+/* Move the result of checking one filesystem into the main handle. */
+static void
+add_fs_result (guestfs_h *g, struct inspect_fs *src)
+{
+  struct inspect_fs *dst;
+
+  g->fses = safe_realloc (g, g->fses,
+                          (g->nr_fses + 1) * sizeof (struct inspect_fs));
+  dst = &g->fses[g->nr_fses++];
+  memset (dst, 0, sizeof *dst);
+
+  dst->is_root = src->is_root;
+  dst->mountable = src->mountable;
+  dst->format = src->format;
+  dst->is_live_disk = src->is_live_disk;
+  dst->is_netinst_disk = src->is_netinst_disk;
+  dst->is_multipart_disk = src->is_multipart_disk;
+
+  /* This moves all of the remaining allocated fields. */
+  guestfs_int_merge_fs_inspections (g, dst, src);
+}
+
+/**
+ * Check each filesystem in C<fses> (the list returned by
+ * C<guestfs_list_filesystems>) using up to
+ * C<g-E<gt>inspect_workers> appliances, adding the results to
+ * C<g-E<gt>fses>.
+ *
+ * Returns C<0> on success or C<-1> on error (the caller must free
+ * C<g-E<gt>fses>).  Returns C<1> if the filesystems cannot be
+ * checked in parallel, in which case the caller should check them
+ * one at a time instead.
+ */
+int
+guestfs_int_check_filesystems_parallel (guestfs_h *g, char **fses)
+{
+  struct inspect_work work = {
+    .fses = fses,
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+  };
+  CLEANUP_FREE struct worker *workers = NULL;
+  size_t nr_workers, i, j;
+  int err;
+
+  work.nr_mountables = guestfs_int_count_strings (fses) / 2;
+  nr_workers = MIN (work.nr_mountables, (size_t) g->inspect_workers);
+  nr_workers = MIN (nr_workers, MAX_INSPECT_WORKERS);
+  if (nr_workers <= 1 || !drives_can_be_shared (g))
+    return 1;
+
+  debug (g, "inspect workers: checking %zu filesystems using %zu appliances",
+         work.nr_mountables, nr_workers);
+
+  work.results = safe_calloc (g, work.nr_mountables, sizeof (struct fs_result));
+
+  /* The main handle is one of the workers, so only nr_workers-1
+   * extra appliances are started.
+   */
+  workers = safe_calloc (g, nr_workers - 1, sizeof (struct worker));
+  for (i = 0; i < nr_workers - 1; ++i) {
+    workers[i].work = &work;
+    workers[i].num = i + 1;
+    workers[i].g = create_worker_handle (g, i + 1);
+    if (workers[i].g == NULL)
+      continue;
+
+    err = pthread_create (&workers[i].thread, NULL,
+                          worker_thread, &workers[i]);
+    if (err != 0) {
+      debug (g, "inspect workers: pthread_create: %s", strerror (err));
+      guestfs_close (workers[i].g);
+      workers[i].g = NULL;
+      continue;
+    }
+    workers[i].running = true;
+  }
+
+  /* While the other appliances are starting up, the main handle
+   * begins checking filesystems.
+   */
+  check_filesystems (g, &work);
+
+  for (i = 0; i < nr_workers - 1; ++i) {
+    if (workers[i].running) {
+      err = pthread_join (workers[i].thread, NULL);
+      if (err != 0)
+        debug (g, "inspect workers: pthread_join: %s", strerror (err));
+    }
+    if (workers[i].unused_reason) {
+      debug (g, "inspect workers: worker %zu was not used: %s",
+             workers[i].num, workers[i].unused_reason);
+      free (workers[i].unused_reason);
+    }
+    if (workers[i].g)
+      guestfs_close (workers[i].g);
+  }
+
+  /* Reassemble the results in the original order.  This is done
+   * even if there was an error, so that the caller frees everything.
+   */
+  for (i = 0; i < work.nr_mountables; ++i) {
+    for (j = 0; j < work.results[i].nr_fses; ++j)
+      add_fs_result (g, &work.results[i].fses[j]);
+    free (work.results[i].fses);
+  }
+  free (work.results);
+  pthread_mutex_destroy (&work.lock);
+
+  if (work.failed) {
+    error (g, "%s", work.error ? work.error : _("inspection failed"));
+    free (work.error);
+    return -1;
+  }
+
+  return 0;
+}
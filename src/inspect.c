@@ -54,7 +54,9 @@ char **
 guestfs_impl_inspect_os (guestfs_h *g)
 {
   CLEANUP_FREE_STRING_LIST char **fses = NULL;
+  CLEANUP_FREE char *cachefile = NULL, *cachekey = NULL;
   char **fs, **ret;
+  int r = 1;
 
   /* Remove any information previously stored in the handle. */
   guestfs_int_free_inspect_info (g);
@@ -62,20 +64,42 @@ guestfs_impl_inspect_os (guestfs_h *g)
   if (guestfs_umount_all (g) == -1)
     return NULL;
 
+  /* If the drives were inspected before, load the saved results
+   * instead of probing the filesystems again.
+   */
+  if (g->inspect_cache) {
+    cachefile = guestfs_int_inspect_cache_file (g, &cachekey);
+    if (cachefile &&
+        guestfs_int_inspect_cache_load (g, cachefile, cachekey) == 1)
+      goto get_roots;
+  }
+
   /* Iterate over all detected filesystems.  Inspect each one in turn
-   * and add that information to the handle.
+   * and add that information to the handle.  If more than one
+   * appliance may be used, the filesystems are shared out between
+   * them instead.
    */
 
   fses = guestfs_list_filesystems (g);
   if (fses == NULL) return NULL;
 
-  for (fs = fses; *fs; fs += 2) {
-    if (guestfs_int_check_for_filesystem_on (g, *fs)) {
+  if (g->inspect_workers > 1) {
+    r = guestfs_int_check_filesystems_parallel (g, fses);
+    if (r == -1) {
       guestfs_int_free_inspect_info (g);
       return NULL;
     }
   }
 
+  if (r == 1) {
+    for (fs = fses; *fs; fs += 2) {
+      if (guestfs_int_check_for_filesystem_on (g, *fs)) {
+        guestfs_int_free_inspect_info (g);
+        return NULL;
+      }
+    }
+  }
+
   /* The OS inspection information for CoreOS are gathered by inspecting
    * multiple filesystems. Gather all the inspected information in the
    * inspect_fs struct of the root filesystem.
@@ -88,6 +112,12 @@ guestfs_impl_inspect_os (guestfs_h *g)
    */
   check_for_duplicated_bsd_root (g);
 
+  if (cachefile) {
+    guestfs_int_inspect_cache_save (g, cachefile, cachekey);
+    guestfs_int_inspect_cache_prune (g, cachefile);
+  }
+
+ get_roots:
   /* At this point we have, in the handle, a list of all filesystems
    * found and data about each one.  Now we assemble the list of
    * filesystems which are root devices and return that to the user.
@@ -34,7 +34,7 @@
  */
 
 static void remove_from_list (char **list, const char *item);
-static int check_with_vfs_type (guestfs_h *g, const char *dev, struct stringsbuf *sb);
+static int check_with_vfs_type (guestfs_h *g, const char *dev, struct stringsbuf *sb, const struct guestfs_blkprobe_list *probes);
 static int is_mbr_partition_type_42 (guestfs_h *g, const char *partition);
 
 char **
@@ -54,6 +54,15 @@ guestfs_impl_list_filesystems (guestfs_h *g)
   CLEANUP_FREE_STRING_LIST char **lvs = NULL;
   CLEANUP_FREE_STRING_LIST char **ldmvols = NULL;
   CLEANUP_FREE_STRING_LIST char **ldmparts = NULL;
+  CLEANUP_FREE_BLKPROBE_LIST struct guestfs_blkprobe_list *probes = NULL;
+
+  /* Probe all the devices in the appliance in a single call.  This
+   * fails with an older appliance, in which case check_with_vfs_type
+   * calls vfs-type for each device instead.
+   */
+  guestfs_push_error_handler (g, NULL, NULL);
+  probes = guestfs_probe_block_devices (g);
+  guestfs_pop_error_handler (g);
 
   /* Look to see if any devices directly contain filesystems
    * (RHBZ#590167).  However vfs-type will fail to tell us anything
@@ -76,20 +85,20 @@ guestfs_impl_list_filesystems (guestfs_h *g)
 
   /* Use vfs-type to check for filesystems on devices. */
   for (i = 0; devices[i] != NULL; ++i)
-    if (check_with_vfs_type (g, devices[i], &ret) == -1)
+    if (check_with_vfs_type (g, devices[i], &ret, probes) == -1)
       goto error;
 
   /* Use vfs-type to check for filesystems on partitions. */
   for (i = 0; partitions[i] != NULL; ++i) {
     if (has_ldm == 0 || ! is_mbr_partition_type_42 (g, partitions[i])) {
-      if (check_with_vfs_type (g, partitions[i], &ret) == -1)
+      if (check_with_vfs_type (g, partitions[i], &ret, probes) == -1)
         goto error;
     }
   }
 
   /* Use vfs-type to check for filesystems on md devices. */
   for (i = 0; mds[i] != NULL; ++i)
-    if (check_with_vfs_type (g, mds[i], &ret) == -1)
+    if (check_with_vfs_type (g, mds[i], &ret, probes) == -1)
       goto error;
 
   if (has_lvm2 > 0) {
@@ -98,7 +107,7 @@ guestfs_impl_list_filesystems (guestfs_h *g)
     if (lvs == NULL) goto error;
 
     for (i = 0; lvs[i] != NULL; ++i)
-      if (check_with_vfs_type (g, lvs[i], &ret) == -1)
+      if (check_with_vfs_type (g, lvs[i], &ret, probes) == -1)
         goto error;
   }
 
@@ -108,14 +117,14 @@ guestfs_impl_list_filesystems (guestfs_h *g)
     if (ldmvols == NULL) goto error;
 
     for (i = 0; ldmvols[i] != NULL; ++i)
-      if (check_with_vfs_type (g, ldmvols[i], &ret) == -1)
+      if (check_with_vfs_type (g, ldmvols[i], &ret, probes) == -1)
         goto error;
 
     ldmparts = guestfs_list_ldm_partitions (g);
     if (ldmparts == NULL) goto error;
 
     for (i = 0; ldmparts[i] != NULL; ++i)
-      if (check_with_vfs_type (g, ldmparts[i], &ret) == -1)
+      if (check_with_vfs_type (g, ldmparts[i], &ret, probes) == -1)
         goto error;
   }
 
@@ -147,16 +156,32 @@ remove_from_list (char **list, const char *item)
 /* Use vfs-type to look for a filesystem of some sort on 'dev'.
  * Apart from some types which we ignore, add the result to the
  * 'ret' string list.
+ *
+ * If 'probes' is not NULL and contains 'dev', the type is taken from
+ * there instead of calling vfs-type.
  */
 static int
-check_with_vfs_type (guestfs_h *g, const char *device, struct stringsbuf *sb)
+check_with_vfs_type (guestfs_h *g, const char *device, struct stringsbuf *sb,
+                     const struct guestfs_blkprobe_list *probes)
 {
   const char *v;
   CLEANUP_FREE char *vfs_type = NULL;
+  size_t i;
 
-  guestfs_push_error_handler (g, NULL, NULL);
-  vfs_type = guestfs_vfs_type (g, device);
-  guestfs_pop_error_handler (g);
+  if (probes) {
+    for (i = 0; i < probes->len; ++i) {
+      if (STREQ (probes->val[i].blkprobe_device, device)) {
+        vfs_type = safe_strdup (g, probes->val[i].blkprobe_type);
+        break;
+      }
+    }
+  }
+
+  if (vfs_type == NULL) {
+    guestfs_push_error_handler (g, NULL, NULL);
+    vfs_type = guestfs_vfs_type (g, device);
+    guestfs_pop_error_handler (g);
+  }
 
   if (!vfs_type)
     v = "unknown";
@@ -37,9 +37,17 @@
  * (4) Media detection is only part of the story.  We may still need
  * to inspect inside the image.
  *
- * (5) We only read the XML database files (at most) once per process,
- * and keep them cached.  They are only read at all if someone tries
- * to inspect a CD/DVD/ISO.
+ * (5) We only read the database (at most) once per process, and keep
+ * it cached.  It is only read at all if someone tries to inspect a
+ * CD/DVD/ISO.
+ *
+ * (6) Parsing the XML files is slow, so the fields we need are saved
+ * in a compact binary index, F<$cachedir/.guestfs-$UID/osinfo.idx>.
+ * Other processes mmap the index instead of reading the XML files.
+ * The index is rebuilt when the modification time of the database
+ * directory changes (which happens whenever files are added, removed
+ * or replaced), or when libguestfs is upgraded.  The regular
+ * expressions are only compiled when an entry is first tested.
  *
  * XXX Currently the database is not freed when the program exits /
  * library is unloaded, although we should probably do that.
@@ -49,11 +57,17 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
 #include <string.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
 #include <dirent.h>
 #include <assert.h>
 #include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
 #include <libintl.h>
 
 #include <libxml/parser.h>
@@ -71,6 +85,7 @@ static struct osinfo *osinfo_db = NULL;
 
 static int read_osinfo_db (guestfs_h *g);
 static void free_osinfo_db_entry (struct osinfo *);
+static void compile_osinfo_db_entry (guestfs_h *g, struct osinfo *osinfo);
 
 /* Given one or more fields from the header of a CD/DVD/ISO, look up
  * the media in the libosinfo database and return our best guess for
@@ -86,8 +101,11 @@ guestfs_int_osinfo_map (guestfs_h *g, const struct guestfs_isoinfo *isoinfo,
 			const struct osinfo **osinfo_ret)
 {
   size_t i;
+  int ret = 0;
 
-  /* We only need to lock the database when reading it for the first time. */
+  /* The regular expressions are compiled on first use, so the lock
+   * is held for the whole lookup.
+   */
   gl_lock_lock (osinfo_db_lock);
   if (osinfo_db_size == 0) {
     if (read_osinfo_db (g) == -1) {
@@ -95,13 +113,11 @@ guestfs_int_osinfo_map (guestfs_h *g, const struct guestfs_isoinfo *isoinfo,
       return -1;
     }
   }
-  gl_lock_unlock (osinfo_db_lock);
-
-  if (osinfo_db_size <= 0)
-    return 0;
 
   /* Look in the database to see if we can find a match. */
-  for (i = 0; i < (size_t) osinfo_db_size; ++i) {
+  for (i = 0; osinfo_db_size > 0 && i < (size_t) osinfo_db_size; ++i) {
+    compile_osinfo_db_entry (g, &osinfo_db[i]);
+
     if (osinfo_db[i].re_system_id) {
       if (!isoinfo->iso_system_id ||
           !match (g, isoinfo->iso_system_id, osinfo_db[i].re_system_id))
@@ -130,54 +146,424 @@ guestfs_int_osinfo_map (guestfs_h *g, const struct guestfs_isoinfo *isoinfo,
 
     if (osinfo_ret)
       *osinfo_ret = &osinfo_db[i];
-    return 1;
+    ret = 1;
+    break;
   }
+  gl_lock_unlock (osinfo_db_lock);
 
-  debug (g, "osinfo: no mapping found");
+  if (ret == 0)
+    debug (g, "osinfo: no mapping found");
 
-  return 0;
+  return ret;
+}
+
+static pcre *
+compile_re (guestfs_h *g, const char *source)
+{
+  const char *err;
+  int offset;
+  pcre *re;
+
+  if (source == NULL)
+    return NULL;
+
+  re = pcre_compile (source, 0, &err, &offset, NULL);
+  if (re == NULL)
+    debug (g, "osinfo: could not parse regular expression '%s': %s (ignored)",
+           source, err);
+  return re;
+}
+
+/* Compile the regular expressions of a database entry, if this has
+ * not been done already.  An expression which does not compile is
+ * ignored, ie. it matches everything.  The lock is held while this
+ * is called.
+ */
+static void
+compile_osinfo_db_entry (guestfs_h *g, struct osinfo *osinfo)
+{
+  if (osinfo->compiled)
+    return;
+
+  osinfo->re_system_id = compile_re (g, osinfo->system_id);
+  osinfo->re_volume_id = compile_re (g, osinfo->volume_id);
+  osinfo->re_publisher_id = compile_re (g, osinfo->publisher_id);
+  osinfo->re_application_id = compile_re (g, osinfo->application_id);
+  osinfo->compiled = 1;
 }
 
-/* Read the libosinfo XML database files.  The lock is held while
- * this is called.
+/* Read the libosinfo database into the global 'osinfo_db'.  The
+ * lock is held while this is called.
  *
  * Returns:
  *   -1 => a fatal error ('error' has been called)
  *    0 => OK
+ */
+#define LIBOSINFO_DB_OS_PATH LIBOSINFO_DB_PATH "/oses"
+
+static char *osinfo_index_file (guestfs_h *g);
+static int read_osinfo_index (guestfs_h *g, const char *filename, const struct stat *statbuf, struct osinfo **db_r, size_t *nr_r);
+static void write_osinfo_index (guestfs_h *g, const char *filename, const struct stat *statbuf, const struct osinfo *db, size_t nr);
+static int read_osinfo_db_dir (guestfs_h *g, const char *dir, struct osinfo **db_r, size_t *nr_r);
+static int read_osinfo_db_xml (guestfs_h *g, const char *dir, const char *filename, struct osinfo **db_r, size_t *nr_r);
+
+static int
+read_osinfo_db (guestfs_h *g)
+{
+  CLEANUP_FREE char *index_file = NULL;
+  struct osinfo *db;
+  size_t nr;
+
+  assert (osinfo_db_size == 0);
+
+  index_file = osinfo_index_file (g);
+  if (guestfs_int_read_osinfo_db (g, LIBOSINFO_DB_OS_PATH, index_file,
+                                  &db, &nr) == -1) {
+    /* Mark the database as having a permanent error. */
+    osinfo_db_size = -1;
+    return -1;
+  }
+
+  osinfo_db = db;
+  osinfo_db_size = nr;
+  return 0;
+}
+
+/* Read the database files in 'dir', using (and if necessary
+ * rebuilding) the binary index 'index_file', which may be NULL.
+ * This is separate from read_osinfo_db so it can be tested.
+ *
+ * Returns:
+ *   -1 => a fatal error ('error' has been called)
+ *    0 => OK, '*db_r' and '*nr_r' are set (possibly to 0 entries)
  *
  * Note that failure to find or parse the XML files is *not* a fatal
  * error, since we should fall back silently if these are not
  * available.  Although we'll emit some debug if this happens.
  */
-#define LIBOSINFO_DB_OS_PATH LIBOSINFO_DB_PATH "/oses"
+int
+guestfs_int_read_osinfo_db (guestfs_h *g, const char *dir,
+                            const char *index_file,
+                            struct osinfo **db_r, size_t *nr_r)
+{
+  struct stat statbuf;
+
+  *db_r = NULL;
+  *nr_r = 0;
+
+  if (stat (dir, &statbuf) == -1) {
+    debug (g, "osinfo: %s: %s", dir, strerror (errno));
+    return 0; /* This is not an error: RHBZ#948324. */
+  }
+
+  if (index_file &&
+      read_osinfo_index (g, index_file, &statbuf, db_r, nr_r) == 0)
+    return 0;
+
+  if (read_osinfo_db_dir (g, dir, db_r, nr_r) == -1)
+    return -1;
+
+  if (index_file && *nr_r > 0)
+    write_osinfo_index (g, index_file, &statbuf, *db_r, *nr_r);
+
+  return 0;
+}
+
+/* The binary index.  All integers are in host byte order (an index
+ * written by a host of the other endianness fails the 'byte_order'
+ * check and is rebuilt).  The header is followed by 'nr_entries'
+ * entries, then by 'strings_size' bytes of '\0'-terminated strings.
+ * Strings are stored as offsets into the string table.
+ */
+#define OSINFO_INDEX_MAGIC "libguestfs osinfo index " PACKAGE_VERSION_FULL "\n"
+#define OSINFO_INDEX_BYTE_ORDER UINT32_C(0x01020304)
+#define OSINFO_INDEX_NO_STRING UINT32_MAX
+
+struct osinfo_index_header {
+  char magic[64];
+  uint32_t byte_order;
+  uint32_t nr_entries;
+  uint32_t strings_size;
+  uint32_t padding;
+  /* The database directory, used to detect changes to the database. */
+  uint64_t db_dev;
+  uint64_t db_ino;
+  int64_t db_mtime_sec;
+  int64_t db_mtime_nsec;
+};
+
+struct osinfo_index_entry {
+  int32_t type;
+  int32_t distro;
+  int32_t major_version;
+  int32_t minor_version;
+  int32_t is_live_disk;
+  uint32_t product_name;
+  uint32_t arch;
+  uint32_t system_id;
+  uint32_t volume_id;
+  uint32_t publisher_id;
+  uint32_t application_id;
+};
+
+static void
+make_osinfo_index_header (struct osinfo_index_header *h,
+                          const struct stat *statbuf)
+{
+  memset (h, 0, sizeof *h);
+  snprintf (h->magic, sizeof h->magic, "%s", OSINFO_INDEX_MAGIC);
+  h->byte_order = OSINFO_INDEX_BYTE_ORDER;
+  h->db_dev = statbuf->st_dev;
+  h->db_ino = statbuf->st_ino;
+  h->db_mtime_sec = statbuf->st_mtim.tv_sec;
+  h->db_mtime_nsec = statbuf->st_mtim.tv_nsec;
+}
+
+/* Return the name of the index file, or NULL if there is no usable
+ * cache directory.
+ */
+static char *
+osinfo_index_file (guestfs_h *g)
+{
+  CLEANUP_FREE char *dir = NULL;
 
-static int read_osinfo_db_xml (guestfs_h *g, const char *filename);
+  guestfs_push_error_handler (g, NULL, NULL);
+  dir = guestfs_int_lazy_make_supermin_appliance_dir (g);
+  guestfs_pop_error_handler (g);
+  if (dir == NULL)
+    return NULL;
 
+  return safe_asprintf (g, "%s/osinfo.idx", dir);
+}
+
+/* Map the index file into memory and point the database entries
+ * into it.  The mapping is kept for the lifetime of the process, like
+ * the database itself.
+ *
+ * Returns 0 if the index was loaded, or -1 if it is missing, stale
+ * or corrupt (a debug message is emitted), in which case the caller
+ * should read the XML files instead.
+ */
 static int
-read_osinfo_db (guestfs_h *g)
+read_osinfo_index (guestfs_h *g, const char *filename,
+                   const struct stat *dbstat,
+                   struct osinfo **db_r, size_t *nr_r)
+{
+  struct osinfo_index_header expected;
+  const struct osinfo_index_header *h;
+  const struct osinfo_index_entry *e;
+  const char *strings;
+  struct stat statbuf;
+  struct osinfo *db;
+  void *map;
+  size_t i, size;
+  int fd;
+
+  fd = open (filename, O_RDONLY|O_CLOEXEC);
+  if (fd == -1) {
+    debug (g, "osinfo: %s: %s", filename, strerror (errno));
+    return -1;
+  }
+  if (fstat (fd, &statbuf) == -1 ||
+      (size_t) statbuf.st_size < sizeof *h) {
+    close (fd);
+    goto invalid;
+  }
+  size = statbuf.st_size;
+  map = mmap (NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close (fd);
+  if (map == MAP_FAILED) {
+    debug (g, "osinfo: mmap: %s: %s", filename, strerror (errno));
+    return -1;
+  }
+
+  h = map;
+  make_osinfo_index_header (&expected, dbstat);
+  if (memcmp (h->magic, expected.magic, sizeof h->magic) != 0 ||
+      h->byte_order != expected.byte_order ||
+      h->db_dev != expected.db_dev ||
+      h->db_ino != expected.db_ino ||
+      h->db_mtime_sec != expected.db_mtime_sec ||
+      h->db_mtime_nsec != expected.db_mtime_nsec) {
+    debug (g, "osinfo: %s is out of date", filename);
+    munmap (map, size);
+    return -1;
+  }
+  if (h->nr_entries == 0 ||
+      h->nr_entries > (size - sizeof *h) / sizeof *e ||
+      size != sizeof *h + h->nr_entries * sizeof *e + h->strings_size ||
+      h->strings_size == 0)
+    goto invalid_unmap;
+
+  e = (const struct osinfo_index_entry *) (h + 1);
+  strings = (const char *) (e + h->nr_entries);
+  if (strings[h->strings_size-1] != '\0')
+    goto invalid_unmap;
+
+  db = safe_calloc (g, h->nr_entries, sizeof *db);
+  for (i = 0; i < h->nr_entries; ++i) {
+#define GET_STRING(field)                                               \
+    if (e[i].field == OSINFO_INDEX_NO_STRING)                           \
+      db[i].field = NULL;                                               \
+    else if (e[i].field < h->strings_size)                              \
+      db[i].field = (char *) &strings[e[i].field];                      \
+    else {                                                              \
+      free (db);                                                        \
+      goto invalid_unmap;                                               \
+    }
+    GET_STRING (product_name);
+    GET_STRING (arch);
+    GET_STRING (system_id);
+    GET_STRING (volume_id);
+    GET_STRING (publisher_id);
+    GET_STRING (application_id);
+#undef GET_STRING
+    db[i].type = e[i].type;
+    db[i].distro = e[i].distro;
+    db[i].major_version = e[i].major_version;
+    db[i].minor_version = e[i].minor_version;
+    db[i].is_live_disk = e[i].is_live_disk;
+  }
+
+  debug (g, "osinfo: loaded %" PRIu32 " entries from %s",
+         h->nr_entries, filename);
+  *db_r = db;
+  *nr_r = h->nr_entries;
+  return 0;
+
+ invalid_unmap:
+  munmap (map, size);
+ invalid:
+  debug (g, "osinfo: %s is corrupt (ignored)", filename);
+  return -1;
+}
+
+/* Append 'str' to the string table, returning its offset. */
+static uint32_t
+add_index_string (guestfs_h *g, char **strings, size_t *size, const char *str)
+{
+  size_t len, offset = *size;
+
+  if (str == NULL)
+    return OSINFO_INDEX_NO_STRING;
+
+  len = strlen (str) + 1;
+  *strings = safe_realloc (g, *strings, offset + len);
+  memcpy (*strings + offset, str, len);
+  *size += len;
+  return offset;
+}
+
+/* Save the database which has just been read from the XML files.
+ * Any failure here is not an error: the index is only an
+ * optimization.  The file is renamed into place, so concurrent
+ * readers never see a partial index.
+ */
+static void
+write_osinfo_index (guestfs_h *g, const char *filename,
+                    const struct stat *dbstat,
+                    const struct osinfo *db, size_t nr)
 {
-  DIR *dir = NULL;
+  CLEANUP_FREE char *tmpfile = NULL;
+  CLEANUP_FREE char *strings = NULL;
+  CLEANUP_FREE struct osinfo_index_entry *entries = NULL;
+  struct osinfo_index_header h;
+  size_t i, strings_size = 0;
+  FILE *fp;
+  int fd;
+
+  entries = safe_calloc (g, nr, sizeof *entries);
+  for (i = 0; i < nr; ++i) {
+    const struct osinfo *o = &db[i];
+
+    entries[i].type = o->type;
+    entries[i].distro = o->distro;
+    entries[i].major_version = o->major_version;
+    entries[i].minor_version = o->minor_version;
+    entries[i].is_live_disk = o->is_live_disk;
+    entries[i].product_name =
+      add_index_string (g, &strings, &strings_size, o->product_name);
+    entries[i].arch = add_index_string (g, &strings, &strings_size, o->arch);
+    entries[i].system_id =
+      add_index_string (g, &strings, &strings_size, o->system_id);
+    entries[i].volume_id =
+      add_index_string (g, &strings, &strings_size, o->volume_id);
+    entries[i].publisher_id =
+      add_index_string (g, &strings, &strings_size, o->publisher_id);
+    entries[i].application_id =
+      add_index_string (g, &strings, &strings_size, o->application_id);
+  }
+  /* The string table is never empty, which the reader relies on. */
+  add_index_string (g, &strings, &strings_size, "");
+  if (strings_size >= OSINFO_INDEX_NO_STRING)
+    return;
+
+  make_osinfo_index_header (&h, dbstat);
+  h.nr_entries = nr;
+  h.strings_size = strings_size;
+
+  tmpfile = safe_asprintf (g, "%s.XXXXXX", filename);
+  fd = mkstemp (tmpfile);
+  if (fd == -1) {
+    debug (g, "osinfo: mkstemp: %s: %s", tmpfile, strerror (errno));
+    return;
+  }
+  fp = fdopen (fd, "w");
+  if (fp == NULL) {
+    debug (g, "osinfo: fdopen: %s: %s", tmpfile, strerror (errno));
+    close (fd);
+    unlink (tmpfile);
+    return;
+  }
+
+  if (fwrite (&h, sizeof h, 1, fp) != 1 ||
+      fwrite (entries, sizeof *entries, nr, fp) != nr ||
+      fwrite (strings, 1, strings_size, fp) != strings_size) {
+    debug (g, "osinfo: write: %s: %s", tmpfile, strerror (errno));
+    fclose (fp);
+    unlink (tmpfile);
+    return;
+  }
+  if (fclose (fp) == EOF) {
+    debug (g, "osinfo: close: %s: %s", tmpfile, strerror (errno));
+    unlink (tmpfile);
+    return;
+  }
+
+  if (rename (tmpfile, filename) == -1) {
+    debug (g, "osinfo: rename: %s: %s", filename, strerror (errno));
+    unlink (tmpfile);
+    return;
+  }
+
+  debug (g, "osinfo: saved %zu entries to %s", nr, filename);
+}
+
+/* Read the libosinfo XML database files in 'dir'. */
+static int
+read_osinfo_db_dir (guestfs_h *g, const char *dir,
+                    struct osinfo **db_r, size_t *nr_r)
+{
+  DIR *dh = NULL;
   struct dirent *d;
   int r;
   size_t i;
 
-  assert (osinfo_db_size == 0);
-
-  dir = opendir (LIBOSINFO_DB_OS_PATH);
-  if (!dir) {
-    debug (g, "osinfo: %s: %s", LIBOSINFO_DB_OS_PATH, strerror (errno));
+  dh = opendir (dir);
+  if (!dh) {
+    debug (g, "osinfo: %s: %s", dir, strerror (errno));
     return 0; /* This is not an error: RHBZ#948324. */
   }
 
-  debug (g, "osinfo: loading database from %s", LIBOSINFO_DB_OS_PATH);
+  debug (g, "osinfo: loading database from %s", dir);
 
   for (;;) {
     errno = 0;
-    d = readdir (dir);
+    d = readdir (dh);
     if (!d) break;
 
     if (STRSUFFIX (d->d_name, ".xml")) {
-      r = read_osinfo_db_xml (g, d->d_name);
+      r = read_osinfo_db_xml (g, dir, d->d_name, db_r, nr_r);
       if (r == -1)
         goto error;
     }
@@ -185,34 +571,30 @@ read_osinfo_db (guestfs_h *g)
 
   /* Check for failure in readdir. */
   if (errno != 0) {
-    perrorf (g, "readdir: %s", LIBOSINFO_DB_OS_PATH);
+    perrorf (g, "readdir: %s", dir);
     goto error;
   }
 
   /* Close the directory handle. */
-  r = closedir (dir);
-  dir = NULL;
+  r = closedir (dh);
+  dh = NULL;
   if (r == -1) {
-    perrorf (g, "closedir: %s", LIBOSINFO_DB_OS_PATH);
+    perrorf (g, "closedir: %s", dir);
     goto error;
   }
 
   return 0;
 
  error:
-  if (dir)
-    closedir (dir);
+  if (dh)
+    closedir (dh);
 
-  /* Fatal error: free any database entries which have been read, and
-   * mark the database as having a permanent error.
-   */
-  if (osinfo_db_size > 0) {
-    for (i = 0; i < (size_t) osinfo_db_size; ++i)
-      free_osinfo_db_entry (&osinfo_db[i]);
-  }
-  free (osinfo_db);
-  osinfo_db = NULL;
-  osinfo_db_size = -1;
+  /* Fatal error: free any database entries which have been read. */
+  for (i = 0; i < *nr_r; ++i)
+    free_osinfo_db_entry (&(*db_r)[i]);
+  free (*db_r);
+  *db_r = NULL;
+  *nr_r = 0;
 
   return -1;
 }
@@ -221,11 +603,12 @@ static int read_iso_node (guestfs_h *g, xmlNodePtr iso_node, struct osinfo *osin
 static int read_media_node (guestfs_h *g, xmlXPathContextPtr xpathCtx, xmlNodePtr media_node, struct osinfo *osinfo);
 static int read_os_node (guestfs_h *g, xmlXPathContextPtr xpathCtx, xmlNodePtr os_node, struct osinfo *osinfo);
 
-/* Read a single XML file from LIBOSINFO_DB_OS_PATH/filename.  Only
- * memory allocation failures are fatal errors here.
+/* Read a single XML file from dir/filename, appending its entries
+ * to '*db_r'.  Only memory allocation failures are fatal errors here.
  */
 static int
-read_osinfo_db_xml (guestfs_h *g, const char *filename)
+read_osinfo_db_xml (guestfs_h *g, const char *dir, const char *filename,
+                    struct osinfo **db_r, size_t *nr_r)
 {
   CLEANUP_FREE char *pathname = NULL;
   CLEANUP_XMLFREEDOC xmlDocPtr doc = NULL;
@@ -236,7 +619,7 @@ read_osinfo_db_xml (guestfs_h *g, const char *filename)
   struct osinfo *osinfo;
   size_t i;
 
-  pathname = safe_asprintf (g, "%s/%s", LIBOSINFO_DB_OS_PATH, filename);
+  pathname = safe_asprintf (g, "%s/%s", dir, filename);
 
   doc = xmlReadFile (pathname, NULL, XML_PARSE_NONET);
   if (doc == NULL) {
@@ -281,10 +664,9 @@ read_osinfo_db_xml (guestfs_h *g, const char *filename)
       assert (os_node->type == XML_ELEMENT_NODE);
 
       /* Allocate an osinfo record. */
-      osinfo_db_size++;
-      osinfo_db = safe_realloc (g, osinfo_db,
-                                sizeof (struct osinfo) * osinfo_db_size);
-      osinfo = &osinfo_db[osinfo_db_size-1];
+      (*nr_r)++;
+      *db_r = safe_realloc (g, *db_r, sizeof (struct osinfo) * *nr_r);
+      osinfo = &(*db_r)[*nr_r-1];
       memset (osinfo, 0, sizeof *osinfo);
 
       /* Read XML fields into the new osinfo record. */
@@ -292,17 +674,17 @@ read_osinfo_db_xml (guestfs_h *g, const char *filename)
           read_media_node (g, xpathCtx, media_node, osinfo) == -1 ||
           read_os_node (g, xpathCtx, os_node, osinfo) == -1) {
         free_osinfo_db_entry (osinfo);
-        osinfo_db_size--;
+        (*nr_r)--;
         return -1;
       }
 
 #if 0
       debug (g, "osinfo: %s: %s%s%s%s=> arch %s live %s product %s type %d distro %d version %d.%d",
              filename,
-             osinfo->re_system_id ? "<system-id/> " : "",
-             osinfo->re_volume_id ? "<volume-id/> " : "",
-             osinfo->re_publisher_id ? "<publisher-id/> " : "",
-             osinfo->re_application_id ? "<application-id/> " : "",
+             osinfo->system_id ? "<system-id/> " : "",
+             osinfo->volume_id ? "<volume-id/> " : "",
+             osinfo->publisher_id ? "<publisher-id/> " : "",
+             osinfo->application_id ? "<application-id/> " : "",
              osinfo->arch ? osinfo->arch : "(none)",
              osinfo->is_live_disk ? "true" : "false",
              osinfo->product_name ? osinfo->product_name : "(none)",
@@ -315,11 +697,11 @@ read_osinfo_db_xml (guestfs_h *g, const char *filename)
   return 0;
 }
 
-static int compile_re (guestfs_h *g, xmlNodePtr child, pcre **re);
-
 /* Read the regular expressions under the <iso> node.  libosinfo
  * itself uses the glib function 'g_regex_match_simple'.  That appears
  * to implement PCRE, however I have not checked in detail.
+ *
+ * The expressions are not compiled here (see compile_osinfo_db_entry).
  */
 static int
 read_iso_node (guestfs_h *g, xmlNodePtr iso_node, struct osinfo *osinfo)
@@ -328,43 +710,26 @@ read_iso_node (guestfs_h *g, xmlNodePtr iso_node, struct osinfo *osinfo)
 
   for (child = iso_node->children; child; child = child->next) {
     if (STREQ ((const char *) child->name, "system-id")) {
-      if (compile_re (g, child, &osinfo->re_system_id) == -1)
-        return -1;
+      free (osinfo->system_id);
+      osinfo->system_id = (char *) xmlNodeGetContent (child);
     }
     else if (STREQ ((const char *) child->name, "volume-id")) {
-      if (compile_re (g, child, &osinfo->re_volume_id) == -1)
-        return -1;
+      free (osinfo->volume_id);
+      osinfo->volume_id = (char *) xmlNodeGetContent (child);
     }
     else if (STREQ ((const char *) child->name, "publisher-id")) {
-      if (compile_re (g, child, &osinfo->re_publisher_id) == -1)
-        return -1;
+      free (osinfo->publisher_id);
+      osinfo->publisher_id = (char *) xmlNodeGetContent (child);
     }
     else if (STREQ ((const char *) child->name, "application-id")) {
-      if (compile_re (g, child, &osinfo->re_application_id) == -1)
-        return -1;
+      free (osinfo->application_id);
+      osinfo->application_id = (char *) xmlNodeGetContent (child);
     }
   }
 
   return 0;
 }
 
-static int
-compile_re (guestfs_h *g, xmlNodePtr node, pcre **re)
-{
-  const char *err;
-  int offset;
-  CLEANUP_FREE char *content = (char *) xmlNodeGetContent (node);
-
-  if (content) {
-    *re = pcre_compile (content, 0, &err, &offset, NULL);
-    if (*re == NULL)
-      debug (g, "osinfo: could not parse regular expression '%s': %s (ignored)",
-             content, err);
-  }
-
-  return 0;
-}
-
 /* Read the attributes of the <media/> node. */
 static int
 read_media_node (guestfs_h *g, xmlXPathContextPtr xpathCtx,
@@ -527,6 +892,10 @@ free_osinfo_db_entry (struct osinfo *osinfo)
 {
   free (osinfo->product_name);
   free (osinfo->arch);
+  free (osinfo->system_id);
+  free (osinfo->volume_id);
+  free (osinfo->publisher_id);
+  free (osinfo->application_id);
 
   if (osinfo->re_system_id)
     pcre_free (osinfo->re_system_id);
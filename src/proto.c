@@ -261,6 +261,10 @@ guestfs_int_send (guestfs_h *g, int proc_nr,
     return -1;
   }
 
+  /* Any cancellation applies to this call from now on. */
+  g->user_cancel = 0;
+  g->cancel_sent = 0;
+
   /* We have to allocate this message buffer on the heap because
    * it is quite large (although will be mostly unused).  We
    * can't allocate it on the stack because in some environments
@@ -655,6 +659,29 @@ guestfs_int_recv_from_daemon (guestfs_h *g, uint32_t *size_rtn, void **buf_rtn)
     free (*buf_rtn);
     *buf_rtn = NULL;
 
+    /* Calls which don't transfer a file can still be cancelled
+     * while the daemon is sending progress messages.  Pass the
+     * cancellation on (once).  The daemon ignores it if the call
+     * doesn't check for it.
+     */
+    if (g->user_cancel && !g->cancel_sent) {
+      XDR cxdr;
+      char fbuf[4];
+      uint32_t flag = GUESTFS_CANCEL_FLAG;
+
+      debug (g, "%s: sending cancellation to daemon", __func__);
+
+      xdrmem_create (&cxdr, fbuf, sizeof fbuf, XDR_ENCODE);
+      xdr_uint32_t (&cxdr, &flag);
+      xdr_destroy (&cxdr);
+
+      if (g->conn->ops->write_data (g, g->conn, fbuf, sizeof fbuf) == -1) {
+        perrorf (g, _("write to daemon socket"));
+        return -1;
+      }
+      g->cancel_sent = 1;
+    }
+
     /* Process next message. */
     goto again;
   }
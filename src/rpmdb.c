@@ -0,0 +1,818 @@
+/* libguestfs
+ * Copyright (C) 2016 Red Hat Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/**
+ * Read the package headers out of an RPM database.
+ *
+ * The database file (which has already been downloaded from the
+ * guest) is mapped into memory and decoded directly, so no external
+ * program is needed.  Three formats are understood:
+ *
+ * =over 4
+ *
+ * =item Berkeley DB
+ *
+ * F</var/lib/rpm/Packages>, either the hash or the btree access
+ * method, in either byte order.
+ *
+ * =item SQLite
+ *
+ * F</var/lib/rpm/rpmdb.sqlite> (Fedora E<ge> 33).  Only the main
+ * database file is read, so changes still sitting in an
+ * un-checkpointed write-ahead log are not seen.
+ *
+ * =item ndb
+ *
+ * F</var/lib/rpm/Packages.db> (SUSE).
+ *
+ * =back
+ *
+ * Only the parts of each format needed to find the header blobs are
+ * implemented.  The callback is called once for each header, in the
+ * order they are stored in the file.  Anything which looks corrupt is
+ * skipped.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <libintl.h>
+
+#include "guestfs.h"
+#include "guestfs-internal.h"
+
+struct rpmdb {
+  guestfs_h *g;
+  const char *filename;
+  const unsigned char *data;
+  size_t size;
+  guestfs_int_rpmdb_callback callback;
+  void *opaque;
+  int bigendian;                /* Berkeley DB byte order. */
+};
+
+static int read_bdb (struct rpmdb *db);
+static int read_sqlite (struct rpmdb *db);
+static int read_ndb (struct rpmdb *db);
+
+static inline uint16_t
+get_le16 (const unsigned char *p)
+{
+  return p[0] | (p[1] << 8);
+}
+
+static inline uint32_t
+get_le32 (const unsigned char *p)
+{
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+static inline uint16_t
+get_be16 (const unsigned char *p)
+{
+  return (p[0] << 8) | p[1];
+}
+
+static inline uint32_t
+get_be32 (const unsigned char *p)
+{
+  return ((uint32_t) p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+/* Pass one header to the caller.  Anything too short to contain
+ * the header intro (index length and data length) is ignored.
+ */
+static int
+emit_header (struct rpmdb *db, const unsigned char *header, size_t len)
+{
+  if (len < 8)
+    return 0;
+  return db->callback (db->g, header, len, db->opaque);
+}
+
+/**
+ * Read every package header in the RPM database C<dbfile> (a local
+ * file), calling C<callback> on each one.
+ *
+ * Returns C<0> on success or C<-1> on error.  The callback can
+ * return C<-1> to stop reading, which is passed back as an error.
+ */
+int
+guestfs_int_read_rpmdb (guestfs_h *g, const char *dbfile, void *opaque,
+                        guestfs_int_rpmdb_callback callback)
+{
+  struct rpmdb db;
+  struct stat statbuf;
+  void *data;
+  int fd, r;
+
+  fd = open (dbfile, O_RDONLY|O_CLOEXEC);
+  if (fd == -1) {
+    perrorf (g, "open: %s", dbfile);
+    return -1;
+  }
+  if (fstat (fd, &statbuf) == -1) {
+    perrorf (g, "fstat: %s", dbfile);
+    close (fd);
+    return -1;
+  }
+  if (statbuf.st_size < 32) {
+    error (g, _("%s: RPM database is too short"), dbfile);
+    close (fd);
+    return -1;
+  }
+  data = mmap (NULL, statbuf.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (data == MAP_FAILED) {
+    perrorf (g, "mmap: %s", dbfile);
+    close (fd);
+    return -1;
+  }
+  close (fd);
+
+  memset (&db, 0, sizeof db);
+  db.g = g;
+  db.filename = dbfile;
+  db.data = data;
+  db.size = statbuf.st_size;
+  db.callback = callback;
+  db.opaque = opaque;
+
+  if (db.size >= 100 && memcmp (db.data, "SQLite format 3", 16) == 0)
+    r = read_sqlite (&db);
+  else if (memcmp (db.data, "RpmP", 4) == 0)
+    r = read_ndb (&db);
+  else
+    r = read_bdb (&db);
+
+  munmap (data, statbuf.st_size);
+  return r;
+}
+
+/*----------------------------------------------------------------------
+ * Berkeley DB.
+ *
+ * See db_page.h and dbmeta.h in the Berkeley DB sources.  Rather
+ * than following the hash buckets or the btree, every page is
+ * visited in turn and the key/data pairs on the leaf pages are
+ * reported.  Free pages are marked P_INVALID, so they are skipped.
+ */
+
+#define DB_HASHMAGIC    0x061561
+#define DB_BTREEMAGIC   0x053162
+
+#define DBMETA_CHKSUM   0x01
+
+#define P_HASH_UNSORTED 2
+#define P_LBTREE        5
+#define P_OVERFLOW      7
+#define P_HASH          13
+
+#define H_KEYDATA       1
+#define H_OFFPAGE       3
+
+#define B_KEYDATA       1
+#define B_OVERFLOW      3
+#define B_DELETE        0x80
+
+#define SIZEOF_PAGE     26
+
+struct bdb {
+  struct rpmdb *db;
+  uint32_t pagesize;
+  uint32_t npages;
+  size_t overhead;              /* Page header size, including checksum. */
+};
+
+static uint16_t
+bdb_get16 (struct rpmdb *db, const unsigned char *p)
+{
+  return db->bigendian ? get_be16 (p) : get_le16 (p);
+}
+
+static uint32_t
+bdb_get32 (struct rpmdb *db, const unsigned char *p)
+{
+  return db->bigendian ? get_be32 (p) : get_le32 (p);
+}
+
+/* Reassemble an item stored on a chain of overflow pages.  The
+ * caller must free the returned buffer.
+ */
+static unsigned char *
+bdb_read_overflow (struct bdb *b, uint32_t pgno, uint32_t tlen)
+{
+  struct rpmdb *db = b->db;
+  unsigned char *buf;
+  size_t n = 0;
+
+  if (tlen > db->size)
+    return NULL;
+  buf = safe_malloc (db->g, tlen > 0 ? tlen : 1);
+
+  while (n < tlen) {
+    const unsigned char *page;
+    size_t len;
+
+    if (pgno == 0 || pgno >= b->npages)
+      goto corrupt;
+    page = db->data + (size_t) pgno * b->pagesize;
+    if (page[25] != P_OVERFLOW)
+      goto corrupt;
+    len = bdb_get16 (db, page + 22);
+    /* A zero length page would loop forever. */
+    if (len == 0 || len > b->pagesize - b->overhead || len > tlen - n)
+      goto corrupt;
+    memcpy (buf + n, page + b->overhead, len);
+    n += len;
+    pgno = bdb_get32 (db, page + 16);
+  }
+
+  return buf;
+
+ corrupt:
+  free (buf);
+  return NULL;
+}
+
+/* Find item 'i' on a hash page, returning its offset in the page.
+ * The length of the item is implied by the offset of the previous
+ * one, and this is returned in *len_r.
+ */
+static int
+bdb_item (struct bdb *b, const unsigned char *page, size_t i,
+          size_t *offset_r, size_t *len_r)
+{
+  struct rpmdb *db = b->db;
+  const unsigned char *inp = page + b->overhead;
+  size_t entries = bdb_get16 (db, page + 20);
+  size_t start = b->overhead + 2 * entries;
+  size_t offset, end;
+
+  offset = bdb_get16 (db, inp + 2 * i);
+  end = i == 0 ? b->pagesize : bdb_get16 (db, inp + 2 * (i-1));
+  if (offset < start || offset >= end || end > b->pagesize)
+    return -1;
+
+  *offset_r = offset;
+  *len_r = end - offset;
+  return 0;
+}
+
+static int
+bdb_read_hash_page (struct bdb *b, const unsigned char *page)
+{
+  struct rpmdb *db = b->db;
+  size_t entries = bdb_get16 (db, page + 20);
+  size_t i, offset, len;
+
+  for (i = 0; i + 1 < entries; i += 2) {
+    const unsigned char *item;
+
+    /* The key is the package number, which is not needed. */
+    if (bdb_item (b, page, i+1, &offset, &len) == -1)
+      continue;
+    item = page + offset;
+
+    if (item[0] == H_KEYDATA) {
+      if (emit_header (db, item + 1, len - 1) == -1)
+        return -1;
+    }
+    else if (item[0] == H_OFFPAGE && len >= 12) {
+      uint32_t tlen = bdb_get32 (db, item + 8);
+      CLEANUP_FREE unsigned char *buf =
+        bdb_read_overflow (b, bdb_get32 (db, item + 4), tlen);
+
+      if (buf == NULL) {
+        debug (db->g, "%s: corrupt overflow item on page %" PRIu32,
+               db->filename, bdb_get32 (db, page + 8));
+        continue;
+      }
+      if (emit_header (db, buf, tlen) == -1)
+        return -1;
+    }
+  }
+
+  return 0;
+}
+
+static int
+bdb_read_btree_page (struct bdb *b, const unsigned char *page)
+{
+  struct rpmdb *db = b->db;
+  size_t entries = bdb_get16 (db, page + 20);
+  size_t i, offset, len;
+
+  for (i = 0; i + 1 < entries; i += 2) {
+    const unsigned char *item;
+    size_t start = b->overhead + 2 * entries;
+
+    /* Unlike hash pages, btree items carry their own length. */
+    offset = bdb_get16 (db, page + b->overhead + 2 * (i+1));
+    if (offset < start || offset + 3 > b->pagesize)
+      continue;
+    item = page + offset;
+    if (item[2] & B_DELETE)
+      continue;
+
+    if (item[2] == B_KEYDATA) {
+      len = bdb_get16 (db, item);
+      if (offset + 3 + len > b->pagesize)
+        continue;
+      if (emit_header (db, item + 3, len) == -1)
+        return -1;
+    }
+    else if (item[2] == B_OVERFLOW && offset + 12 <= b->pagesize) {
+      uint32_t tlen = bdb_get32 (db, item + 8);
+      CLEANUP_FREE unsigned char *buf =
+        bdb_read_overflow (b, bdb_get32 (db, item + 4), tlen);
+
+      if (buf == NULL) {
+        debug (db->g, "%s: corrupt overflow item on page %" PRIu32,
+               db->filename, bdb_get32 (db, page + 8));
+        continue;
+      }
+      if (emit_header (db, buf, tlen) == -1)
+        return -1;
+    }
+  }
+
+  return 0;
+}
+
+static int
+read_bdb (struct rpmdb *db)
+{
+  struct bdb b;
+  uint32_t pgno;
+
+  if (get_le32 (db->data + 12) == DB_HASHMAGIC ||
+      get_le32 (db->data + 12) == DB_BTREEMAGIC)
+    db->bigendian = 0;
+  else if (get_be32 (db->data + 12) == DB_HASHMAGIC ||
+           get_be32 (db->data + 12) == DB_BTREEMAGIC)
+    db->bigendian = 1;
+  else {
+    error (db->g, _("%s: unknown RPM database format"), db->filename);
+    return -1;
+  }
+
+  b.db = db;
+  b.pagesize = bdb_get32 (db, db->data + 20);
+  if (b.pagesize < 512 || b.pagesize > 65536 ||
+      (b.pagesize & (b.pagesize - 1)) != 0) {
+    error (db->g, _("%s: invalid Berkeley DB page size %" PRIu32),
+           db->filename, b.pagesize);
+    return -1;
+  }
+  if (db->data[24] != 0) {
+    error (db->g, _("%s: encrypted Berkeley DB databases are not supported"),
+           db->filename);
+    return -1;
+  }
+  b.overhead = SIZEOF_PAGE;
+  if (db->data[26] & DBMETA_CHKSUM)
+    b.overhead += 6;
+  b.npages = db->size / b.pagesize;
+
+  debug (db->g, "%s: Berkeley DB, %s-endian, page size %" PRIu32
+         ", %" PRIu32 " pages",
+         db->filename, db->bigendian ? "big" : "little",
+         b.pagesize, b.npages);
+
+  for (pgno = 1; pgno < b.npages; ++pgno) {
+    const unsigned char *page = db->data + (size_t) pgno * b.pagesize;
+    size_t entries;
+
+    if (bdb_get32 (db, page + 8) != pgno)
+      continue;
+    entries = bdb_get16 (db, page + 20);
+    if (b.overhead + 2 * entries > b.pagesize)
+      continue;
+
+    switch (page[25]) {
+    case P_HASH:
+    case P_HASH_UNSORTED:
+      if (bdb_read_hash_page (&b, page) == -1)
+        return -1;
+      break;
+
+    case P_LBTREE:
+      if (bdb_read_btree_page (&b, page) == -1)
+        return -1;
+      break;
+
+    default: ; /* internal, overflow, metadata or free page */
+    }
+  }
+
+  return 0;
+}
+
+/*----------------------------------------------------------------------
+ * SQLite.
+ *
+ * See https://www.sqlite.org/fileformat.html.  rpm stores the
+ * headers in the 'blob' column of the 'Packages' table.
+ */
+
+/* Guards against loops in a corrupt b-tree. */
+#define SQLITE_MAX_DEPTH 20
+
+struct sqlite {
+  struct rpmdb *db;
+  uint32_t pagesize;
+  uint32_t usable;              /* Page size less reserved space. */
+  uint32_t npages;
+  size_t visits;                /* B-tree pages visited so far. */
+};
+
+/* Called with the payload (the record) of each row of a table. */
+typedef int (*sqlite_row_fn) (struct sqlite *s, const unsigned char *rec, size_t len, void *data);
+
+static int
+get_varint (const unsigned char *p, const unsigned char *end,
+            uint64_t *v_r)
+{
+  uint64_t v = 0;
+  int i;
+
+  for (i = 0; i < 9 && p + i < end; ++i) {
+    if (i == 8) {
+      *v_r = (v << 8) | p[i];
+      return 9;
+    }
+    v = (v << 7) | (p[i] & 0x7f);
+    if ((p[i] & 0x80) == 0) {
+      *v_r = v;
+      return i + 1;
+    }
+  }
+  return -1;
+}
+
+static size_t
+serial_type_len (uint64_t type)
+{
+  static const size_t lens[] = { 0, 1, 2, 3, 4, 6, 8, 8, 0, 0, 0, 0 };
+
+  if (type < 12)
+    return lens[type];
+  return (type - 12) / 2;
+}
+
+/* Find column 'col' in a record.  Returns the serial type, or -1 if
+ * the record is too short or corrupt.
+ */
+static int64_t
+record_column (const unsigned char *rec, size_t len, size_t col,
+               const unsigned char **val_r, size_t *len_r)
+{
+  const unsigned char *end = rec + len;
+  const unsigned char *p, *hdr_end, *val;
+  uint64_t hdr_len, type;
+  size_t i;
+  int n;
+
+  n = get_varint (rec, end, &hdr_len);
+  if (n == -1 || hdr_len > len)
+    return -1;
+  p = rec + n;
+  hdr_end = rec + hdr_len;
+  val = hdr_end;
+
+  for (i = 0; p < hdr_end; ++i) {
+    n = get_varint (p, hdr_end, &type);
+    if (n == -1)
+      return -1;
+    p += n;
+    if (serial_type_len (type) > (size_t) (end - val))
+      return -1;
+    if (i == col) {
+      *val_r = val;
+      *len_r = serial_type_len (type);
+      return type;
+    }
+    val += serial_type_len (type);
+  }
+
+  return -1;
+}
+
+static int64_t
+record_int (int64_t type, const unsigned char *val, size_t len)
+{
+  int64_t v;
+  size_t i;
+
+  if (type == 8)
+    return 0;
+  if (type == 9)
+    return 1;
+  if (type < 1 || type > 6)
+    return -1;
+
+  v = (val[0] & 0x80) ? -1 : 0;
+  for (i = 0; i < len; ++i)
+    v = (v << 8) | val[i];
+  return v;
+}
+
+/* Reassemble a payload which spilled onto overflow pages.  'local'
+ * bytes are on the b-tree page, followed by the first overflow page
+ * number.  The caller must free the returned buffer.
+ */
+static unsigned char *
+sqlite_read_overflow (struct sqlite *s, const unsigned char *cell,
+                      size_t local, uint64_t total)
+{
+  struct rpmdb *db = s->db;
+  unsigned char *buf;
+  uint32_t pgno;
+  size_t n;
+
+  if (total > db->size)
+    return NULL;
+  buf = safe_malloc (db->g, total);
+  memcpy (buf, cell, local);
+  n = local;
+  pgno = get_be32 (cell + local);
+
+  while (n < total) {
+    const unsigned char *page;
+    size_t len;
+
+    if (pgno == 0 || pgno > s->npages) {
+      free (buf);
+      return NULL;
+    }
+    page = db->data + (size_t) (pgno - 1) * s->pagesize;
+    len = s->usable - 4;
+    if (len > total - n)
+      len = total - n;
+    memcpy (buf + n, page + 4, len);
+    n += len;
+    pgno = get_be32 (page);
+  }
+
+  return buf;
+}
+
+static int
+sqlite_leaf_cell (struct sqlite *s, const unsigned char *page,
+                  const unsigned char *cell, sqlite_row_fn f, void *data)
+{
+  const unsigned char *page_end = page + s->pagesize;
+  uint64_t payload, rowid;
+  size_t x, m, k, local;
+  CLEANUP_FREE unsigned char *buf = NULL;
+  int n;
+
+  n = get_varint (cell, page_end, &payload);
+  if (n == -1)
+    return 0;
+  cell += n;
+  n = get_varint (cell, page_end, &rowid);
+  if (n == -1)
+    return 0;
+  cell += n;
+
+  /* How much of the payload is stored on the page itself. */
+  x = s->usable - 35;
+  if (payload <= x)
+    local = payload;
+  else {
+    m = ((s->usable - 12) * 32 / 255) - 23;
+    k = m + ((payload - m) % (s->usable - 4));
+    local = k <= x ? k : m;
+  }
+  if (local + (local < payload ? 4 : 0) > (size_t) (page_end - cell))
+    return 0;
+
+  if (local == payload)
+    return f (s, cell, payload, data);
+
+  buf = sqlite_read_overflow (s, cell, local, payload);
+  if (buf == NULL) {
+    debug (s->db->g, "%s: corrupt overflow chain for row %" PRIu64,
+           s->db->filename, rowid);
+    return 0;
+  }
+  return f (s, buf, payload, data);
+}
+
+static int
+sqlite_walk_table (struct sqlite *s, uint32_t pgno, int depth,
+                   sqlite_row_fn f, void *data)
+{
+  const unsigned char *page, *hdr;
+  size_t i, ncells, hdr_len;
+
+  if (pgno == 0 || pgno > s->npages || depth > SQLITE_MAX_DEPTH ||
+      ++s->visits > s->npages)
+    return 0;
+
+  page = s->db->data + (size_t) (pgno - 1) * s->pagesize;
+  /* Page 1 starts with the database header. */
+  hdr = pgno == 1 ? page + 100 : page;
+  ncells = get_be16 (hdr + 3);
+
+  switch (hdr[0]) {
+  case 0x0d:                    /* table leaf */
+    hdr_len = 8;
+    break;
+  case 0x05:                    /* table interior */
+    hdr_len = 12;
+    break;
+  default:
+    debug (s->db->g, "%s: unexpected b-tree page type %d on page %" PRIu32,
+           s->db->filename, hdr[0], pgno);
+    return 0;
+  }
+  if ((size_t) (hdr - page) + hdr_len + 2 * ncells > s->pagesize)
+    return 0;
+
+  for (i = 0; i < ncells; ++i) {
+    size_t offset = get_be16 (hdr + hdr_len + 2 * i);
+
+    if (offset < (size_t) (hdr - page) + hdr_len ||
+        offset + 4 > s->pagesize)
+      continue;
+    if (hdr[0] == 0x05) {
+      if (sqlite_walk_table (s, get_be32 (page + offset), depth + 1,
+                             f, data) == -1)
+        return -1;
+    }
+    else {
+      if (sqlite_leaf_cell (s, page, page + offset, f, data) == -1)
+        return -1;
+    }
+  }
+
+  if (hdr[0] == 0x05)
+    return sqlite_walk_table (s, get_be32 (hdr + 8), depth + 1, f, data);
+  return 0;
+}
+
+/* Look for the 'Packages' table in the schema. */
+static int
+sqlite_find_packages (struct sqlite *s, const unsigned char *rec, size_t len,
+                      void *datav)
+{
+  uint32_t *root = datav;
+  const unsigned char *val;
+  size_t vlen;
+  int64_t type;
+
+  type = record_column (rec, len, 0, &val, &vlen);
+  if (type < 13 || (type & 1) == 0 || vlen != 5 || memcmp (val, "table", 5))
+    return 0;
+  type = record_column (rec, len, 1, &val, &vlen);
+  if (type < 13 || (type & 1) == 0 || vlen != 8 || memcmp (val, "Packages", 8))
+    return 0;
+  type = record_column (rec, len, 3, &val, &vlen);
+  if (type == -1)
+    return 0;
+  *root = record_int (type, val, vlen);
+  return 0;
+}
+
+static int
+sqlite_read_package (struct sqlite *s, const unsigned char *rec, size_t len,
+                     void *data)
+{
+  const unsigned char *val;
+  size_t vlen;
+  int64_t type;
+
+  /* Column 0 is 'hnum', an alias for the rowid; column 1 is 'blob'. */
+  type = record_column (rec, len, 1, &val, &vlen);
+  if (type < 12 || (type & 1) != 0)
+    return 0;
+  return emit_header (s->db, val, vlen);
+}
+
+static int
+read_sqlite (struct rpmdb *db)
+{
+  struct sqlite s;
+  uint32_t root = 0;
+
+  s.db = db;
+  s.pagesize = get_be16 (db->data + 16);
+  if (s.pagesize == 1)
+    s.pagesize = 65536;
+  if (s.pagesize < 512 || (s.pagesize & (s.pagesize - 1)) != 0) {
+    error (db->g, _("%s: invalid SQLite page size %" PRIu32),
+           db->filename, s.pagesize);
+    return -1;
+  }
+  s.usable = s.pagesize - db->data[20];
+  if (s.usable < 480) {
+    error (db->g, _("%s: invalid SQLite reserved space"), db->filename);
+    return -1;
+  }
+  s.npages = db->size / s.pagesize;
+
+  debug (db->g, "%s: SQLite, page size %" PRIu32 ", %" PRIu32 " pages",
+         db->filename, s.pagesize, s.npages);
+
+  /* The schema table is always rooted at page 1. */
+  s.visits = 0;
+  sqlite_walk_table (&s, 1, 0, sqlite_find_packages, &root);
+  if (root == 0) {
+    error (db->g, _("%s: no Packages table in SQLite database"),
+           db->filename);
+    return -1;
+  }
+
+  s.visits = 0;
+  return sqlite_walk_table (&s, root, 0, sqlite_read_package, NULL);
+}
+
+/*----------------------------------------------------------------------
+ * ndb.
+ *
+ * See lib/backend/ndb/rpmpkg.c in the RPM sources.  The file starts
+ * with an array of 16 byte slots (the first two of which hold the
+ * file header) giving the location of each header blob.  All fields
+ * are little-endian.
+ */
+
+#define NDB_PAGE_SIZE    4096
+#define NDB_BLK_SIZE     16
+#define NDB_SLOT_SIZE    16
+#define NDB_HEADER_SIZE  32
+#define NDB_BLOBHEAD_SIZE 16
+#define NDB_BLOBTAIL_SIZE 12
+
+static int
+read_ndb (struct rpmdb *db)
+{
+  uint32_t slotnpages;
+  size_t offset, end;
+
+  slotnpages = get_le32 (db->data + 12);
+  end = (size_t) slotnpages * NDB_PAGE_SIZE;
+  if (end > db->size)
+    end = db->size;
+
+  debug (db->g, "%s: ndb, %" PRIu32 " slot pages", db->filename, slotnpages);
+
+  for (offset = NDB_HEADER_SIZE; offset + NDB_SLOT_SIZE <= end;
+       offset += NDB_SLOT_SIZE) {
+    const unsigned char *slot = db->data + offset;
+    const unsigned char *blob;
+    uint32_t pkgidx, blkoff, blkcnt, bloblen;
+
+    if (memcmp (slot, "Slot", 4) != 0)
+      continue;
+    pkgidx = get_le32 (slot + 4);
+    blkoff = get_le32 (slot + 8);
+    blkcnt = get_le32 (slot + 12);
+    if (pkgidx == 0)            /* empty slot */
+      continue;
+    if ((uint64_t) blkoff * NDB_BLK_SIZE + (uint64_t) blkcnt * NDB_BLK_SIZE >
+        db->size)
+      continue;
+
+    blob = db->data + (size_t) blkoff * NDB_BLK_SIZE;
+    if ((uint64_t) blkcnt * NDB_BLK_SIZE <
+        NDB_BLOBHEAD_SIZE + NDB_BLOBTAIL_SIZE ||
+        memcmp (blob, "BlbS", 4) != 0 ||
+        get_le32 (blob + 4) != pkgidx)
+      continue;
+    bloblen = get_le32 (blob + 12);
+    if ((uint64_t) bloblen + NDB_BLOBHEAD_SIZE + NDB_BLOBTAIL_SIZE >
+        (uint64_t) blkcnt * NDB_BLK_SIZE)
+      continue;
+
+    if (emit_header (db, blob + NDB_BLOBHEAD_SIZE, bloblen) == -1)
+      return -1;
+  }
+
+  return 0;
+}
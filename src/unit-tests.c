@@ -28,8 +28,10 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
 #include <assert.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/time.h>
@@ -433,6 +435,595 @@ test_stringsbuf (void)
   guestfs_close (g);
 }
 
+/**
+ * Test C<guestfs_int_parse_fstab> and C<guestfs_int_fstab_option>.
+ */
+static void
+test_parse_fstab (void)
+{
+  guestfs_h *g;
+  struct fstab_line *entries;
+  size_t nr_entries;
+  char *opt;
+  const char *fstab[] = {
+    "# /etc/fstab",
+    "",
+    "LABEL=ROOT /     btrfs subvol=root,compress=lzo 0 0",
+    "\t/dev/sda1\t/boot ext4 defaults 1 2 # boot",
+    "tmpfs /tmp tmpfs",
+    NULL
+  };
+  const char *bad_fields[] = { "/dev/sda1 /", NULL };
+  const char *bad_dump[] = { "/dev/sda1 / ext4 defaults x 0", NULL };
+
+  g = guestfs_create ();
+  assert (g);
+
+  assert (guestfs_int_parse_fstab (g, (char **) fstab,
+                                   &entries, &nr_entries) == 0);
+  assert (nr_entries == 3);
+  assert (STREQ (entries[0].spec, "LABEL=ROOT"));
+  assert (STREQ (entries[0].file, "/"));
+  assert (STREQ (entries[0].vfstype, "btrfs"));
+  assert (STREQ (entries[0].options, "subvol=root,compress=lzo"));
+  assert (STREQ (entries[1].spec, "/dev/sda1"));
+  assert (STREQ (entries[1].file, "/boot"));
+  assert (STREQ (entries[1].options, "defaults"));
+  assert (STREQ (entries[2].vfstype, "tmpfs"));
+  assert (STREQ (entries[2].options, ""));
+
+  opt = guestfs_int_fstab_option (g, entries[0].options, "subvol");
+  assert (STREQ (opt, "root"));
+  free (opt);
+  assert (guestfs_int_fstab_option (g, entries[0].options, "sub") == NULL);
+  assert (guestfs_int_fstab_option (g, entries[1].options, "subvol") == NULL);
+  opt = guestfs_int_fstab_option (g, "subvol=a,subvol=b", "subvol");
+  assert (STREQ (opt, "b"));
+  free (opt);
+  guestfs_int_free_fstab_lines (entries, nr_entries);
+
+  assert (guestfs_int_parse_fstab (g, (char **) bad_fields,
+                                   &entries, &nr_entries) == -1);
+  assert (guestfs_int_parse_fstab (g, (char **) bad_dump,
+                                   &entries, &nr_entries) == -1);
+
+  guestfs_close (g);
+}
+
+/**
+ * Test C<guestfs_int_parse_mdadm_conf>.
+ */
+static void
+test_parse_mdadm_conf (void)
+{
+  guestfs_h *g;
+  char **ret;
+  const char *conf[] = {
+    "MAILADDR root",
+    "AUTO +imsm +1.x -all",
+    "ARRAY /dev/md0 level=raid1 num-devices=2 UUID=a:b:c:d",
+    "arr /dev/md1 metadata=1.2",
+    "   uuid=e:f:0:1 # comment",
+    "ARRAY metadata=imsm UUID=2:3:4:5",
+    "ARRAY /dev/md2 level=raid1",
+    "ARRAY <ignore> UUID=6:7:8:9",
+    "# ARRAY /dev/md3 UUID=a:a:a:a",
+    NULL
+  };
+  const char *quoted[] = { "ARRAY \"/dev/md 0\" UUID=a:b:c:d", NULL };
+
+  g = guestfs_create ();
+  assert (g);
+
+  ret = guestfs_int_parse_mdadm_conf (g, (char **) conf);
+  assert (ret);
+  assert (guestfs_int_count_strings (ret) == 4);
+  assert (STREQ (ret[0], "/dev/md0"));
+  assert (STREQ (ret[1], "a:b:c:d"));
+  assert (STREQ (ret[2], "/dev/md1"));
+  assert (STREQ (ret[3], "e:f:0:1"));
+  guestfs_int_free_string_list (ret);
+
+  assert (guestfs_int_parse_mdadm_conf (g, (char **) quoted) == NULL);
+
+  guestfs_close (g);
+}
+
+/**
+ * Test C<guestfs_int_parse_shellvar>.
+ */
+static void
+test_parse_shellvar (void)
+{
+  guestfs_h *g;
+  char *value;
+  const char *network[] = {
+    "# Created by anaconda",
+    "NETWORKING=yes",
+    "HOSTNAME=old.example.com",
+    "  export HOSTNAME=\"new.example.com\"  # comment",
+    "GATEWAY='10.0.0.1'",
+    NULL
+  };
+  const char *expansion[] = { "HOSTNAME=$(hostname)", NULL };
+  const char *command[] = { "[ -f /etc/foo ] && . /etc/foo", NULL };
+  const char *escape[] = { "HOSTNAME=\"a\\\"b\"", NULL };
+
+  g = guestfs_create ();
+  assert (g);
+
+  assert (guestfs_int_parse_shellvar (g, (char **) network, "HOSTNAME",
+                                      &value) == 1);
+  assert (STREQ (value, "new.example.com"));
+  free (value);
+  assert (guestfs_int_parse_shellvar (g, (char **) network, "GATEWAY",
+                                      &value) == 1);
+  assert (STREQ (value, "10.0.0.1"));
+  free (value);
+  assert (guestfs_int_parse_shellvar (g, (char **) network, "HOST",
+                                      &value) == 0);
+
+  assert (guestfs_int_parse_shellvar (g, (char **) expansion, "HOSTNAME",
+                                      &value) == -1);
+  assert (guestfs_int_parse_shellvar (g, (char **) command, "HOSTNAME",
+                                      &value) == -1);
+  assert (guestfs_int_parse_shellvar (g, (char **) escape, "HOSTNAME",
+                                      &value) == -1);
+
+  guestfs_close (g);
+}
+
+/* Helpers used to construct small RPM databases for
+ * C<test_read_rpmdb>.
+ */
+static void
+put_be16 (unsigned char *p, uint16_t v)
+{
+  p[0] = v >> 8;
+  p[1] = v;
+}
+
+static void
+put_be32 (unsigned char *p, uint32_t v)
+{
+  p[0] = v >> 24;
+  p[1] = v >> 16;
+  p[2] = v >> 8;
+  p[3] = v;
+}
+
+static void
+put_le32 (unsigned char *p, uint32_t v)
+{
+  p[0] = v;
+  p[1] = v >> 8;
+  p[2] = v >> 16;
+  p[3] = v >> 24;
+}
+
+static size_t
+put_varint (unsigned char *p, uint64_t v)
+{
+  unsigned char tmp[8];
+  size_t n = 0, i;
+
+  do {
+    tmp[n++] = v & 0x7f;
+    v >>= 7;
+  } while (v > 0);
+  for (i = 0; i < n; ++i)
+    p[i] = tmp[n-1-i] | (i < n-1 ? 0x80 : 0);
+  return n;
+}
+
+static void
+write_test_file (const char *filename, const unsigned char *data, size_t len)
+{
+  int fd;
+
+  fd = open (filename, O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC, 0600);
+  assert (fd >= 0);
+  assert (write (fd, data, len) == (ssize_t) len);
+  assert (close (fd) == 0);
+}
+
+#define SQLITE_TEST_PAGESIZE 512
+
+struct sqlite_builder {
+  unsigned char data[SQLITE_TEST_PAGESIZE * 8];
+  size_t npages;
+};
+
+struct sqlite_column {
+  uint64_t serial_type;
+  const void *data;
+  size_t len;
+};
+
+/* Encode a record (row) from a list of columns. */
+static size_t
+sqlite_record (unsigned char *rec, const struct sqlite_column *cols, size_t n)
+{
+  size_t i, len = 1;
+
+  for (i = 0; i < n; ++i)
+    len += put_varint (rec + len, cols[i].serial_type);
+  assert (len < 128);
+  rec[0] = len;
+  for (i = 0; i < n; ++i) {
+    if (cols[i].len > 0)
+      memcpy (rec + len, cols[i].data, cols[i].len);
+    len += cols[i].len;
+  }
+  return len;
+}
+
+/* Add a row to the table leaf page 'pgno'.  Payloads which do not
+ * fit on the page are spilled onto new overflow pages, in the same
+ * way as SQLite does it.
+ */
+static void
+sqlite_add_row (struct sqlite_builder *b, size_t pgno, uint64_t rowid,
+                const unsigned char *rec, size_t len)
+{
+  const size_t usable = SQLITE_TEST_PAGESIZE;
+  unsigned char *page = b->data + (pgno-1) * SQLITE_TEST_PAGESIZE;
+  unsigned char *hdr = pgno == 1 ? page + 100 : page;
+  size_t ncells = (hdr[3] << 8) | hdr[4];
+  size_t content = (hdr[5] << 8) | hdr[6];
+  unsigned char cell[SQLITE_TEST_PAGESIZE];
+  size_t n = 0, local = len, m, k, offset;
+
+  if (content == 0)
+    content = SQLITE_TEST_PAGESIZE;
+  if (len > usable - 35) {
+    m = ((usable - 12) * 32 / 255) - 23;
+    k = m + ((len - m) % (usable - 4));
+    local = k <= usable - 35 ? k : m;
+  }
+
+  n += put_varint (cell + n, len);
+  n += put_varint (cell + n, rowid);
+  memcpy (cell + n, rec, local);
+  n += local;
+  if (local < len) {
+    put_be32 (cell + n, b->npages + 1);
+    n += 4;
+    for (offset = local; offset < len; offset += usable - 4) {
+      unsigned char *ovfl = b->data + b->npages++ * SQLITE_TEST_PAGESIZE;
+      size_t ovfl_len = MIN (len - offset, usable - 4);
+
+      assert (b->npages <= sizeof b->data / SQLITE_TEST_PAGESIZE);
+      put_be32 (ovfl, offset + ovfl_len < len ? b->npages + 1 : 0);
+      memcpy (ovfl + 4, rec + offset, ovfl_len);
+    }
+  }
+
+  content -= n;
+  assert (content >= (size_t) (hdr - page) + 8 + 2 * (ncells + 1));
+  memcpy (page + content, cell, n);
+  put_be16 (hdr + 8 + 2 * ncells, content);
+  put_be16 (hdr + 3, ncells + 1);
+  put_be16 (hdr + 5, content);
+}
+
+/* Build an rpmdb.sqlite file containing 'n' headers. */
+static void
+make_test_rpmdb_sqlite (const char *filename,
+                        const unsigned char **headers, const size_t *lens,
+                        size_t n)
+{
+  static const char sql[] =
+    "CREATE TABLE Packages (hnum INTEGER PRIMARY KEY, blob BLOB NOT NULL)";
+  const unsigned char rootpage = 2;
+  const struct sqlite_column schema[] = {
+    { 13 + 2*5, "table", 5 },
+    { 13 + 2*8, "Packages", 8 },
+    { 13 + 2*8, "Packages", 8 },
+    { 1, &rootpage, 1 },
+    { 13 + 2*(sizeof sql - 1), sql, sizeof sql - 1 },
+  };
+  struct sqlite_builder *b;
+  unsigned char rec[4096];
+  size_t i, len;
+
+  b = calloc (1, sizeof *b);
+  assert (b);
+  b->npages = 2;
+
+  memcpy (b->data, "SQLite format 3", 16);
+  put_be16 (b->data + 16, SQLITE_TEST_PAGESIZE);
+  b->data[18] = b->data[19] = 1; /* file format versions */
+  b->data[21] = 64;             /* payload fractions */
+  b->data[22] = 32;
+  b->data[23] = 32;
+  put_be32 (b->data + 24, 1);   /* change counter */
+  put_be32 (b->data + 40, 1);   /* schema cookie */
+  put_be32 (b->data + 44, 4);   /* schema format */
+  put_be32 (b->data + 56, 1);   /* UTF-8 */
+  put_be32 (b->data + 92, 1);
+  put_be32 (b->data + 96, 3008000);
+  b->data[100] = 0x0d;          /* page 1: table leaf (the schema) */
+  b->data[SQLITE_TEST_PAGESIZE] = 0x0d; /* page 2: table leaf */
+
+  len = sqlite_record (rec, schema, sizeof schema / sizeof schema[0]);
+  sqlite_add_row (b, 1, 1, rec, len);
+
+  for (i = 0; i < n; ++i) {
+    const struct sqlite_column row[] = {
+      { 0, NULL, 0 },           /* hnum is an alias for the rowid */
+      { 12 + 2*lens[i], headers[i], lens[i] },
+    };
+
+    assert (lens[i] + 8 <= sizeof rec);
+    len = sqlite_record (rec, row, 2);
+    sqlite_add_row (b, 2, i + 1, rec, len);
+  }
+
+  put_be32 (b->data + 28, b->npages);
+  write_test_file (filename, b->data, b->npages * SQLITE_TEST_PAGESIZE);
+  free (b);
+}
+
+/* Build a Packages.db (ndb) file containing 'n' headers.  An empty
+ * slot is left between each used slot.
+ */
+static void
+make_test_rpmdb_ndb (const char *filename,
+                     const unsigned char **headers, const size_t *lens,
+                     size_t n)
+{
+  unsigned char *data;
+  size_t i, size = 4096, blkoff = 4096 / 16, blkcnt;
+
+  for (i = 0; i < n; ++i)
+    size += (16 + lens[i] + 12 + 15) & ~15;
+  data = calloc (1, size);
+  assert (data);
+
+  memcpy (data, "RpmP", 4);
+  put_le32 (data + 8, 1);       /* generation */
+  put_le32 (data + 12, 1);      /* slot pages */
+  put_le32 (data + 16, n + 1);  /* next package index */
+
+  for (i = 0; i < n; ++i) {
+    unsigned char *slot = data + 32 + 2 * i * 16;
+    unsigned char *blob = data + blkoff * 16;
+
+    blkcnt = (16 + lens[i] + 12 + 15) / 16;
+    memcpy (slot, "Slot", 4);
+    put_le32 (slot + 4, i + 1);
+    put_le32 (slot + 8, blkoff);
+    put_le32 (slot + 12, blkcnt);
+    memcpy (slot + 16, "Slot", 4);
+
+    memcpy (blob, "BlbS", 4);
+    put_le32 (blob + 4, i + 1);
+    put_le32 (blob + 8, 1);
+    put_le32 (blob + 12, lens[i]);
+    memcpy (blob + 16, headers[i], lens[i]);
+    put_le32 (blob + blkcnt * 16 - 8, lens[i]);
+    memcpy (blob + blkcnt * 16 - 4, "BlbE", 4);
+
+    blkoff += blkcnt;
+  }
+
+  write_test_file (filename, data, size);
+  free (data);
+}
+
+struct rpmdb_test {
+  const unsigned char **headers;
+  const size_t *lens;
+  size_t n;
+  size_t seen;
+};
+
+static int
+rpmdb_test_callback (guestfs_h *g, const unsigned char *header, size_t len,
+                     void *opaque)
+{
+  struct rpmdb_test *t = opaque;
+
+  /* The 4 byte header is too short, so it must have been skipped. */
+  if (t->seen < t->n && t->lens[t->seen] < 8)
+    t->seen++;
+  assert (t->seen < t->n);
+  assert (len == t->lens[t->seen]);
+  assert (memcmp (header, t->headers[t->seen], len) == 0);
+  t->seen++;
+  return 0;
+}
+
+/**
+ * Test C<guestfs_int_read_rpmdb> with the SQLite and ndb formats.
+ * (Berkeley DB is covered by the phony Fedora guest.)
+ */
+static void
+test_read_rpmdb (void)
+{
+  guestfs_h *g;
+  unsigned char small[40], tiny[4], big[1200];
+  const unsigned char *headers[] = { small, tiny, big };
+  const size_t lens[] = { sizeof small, sizeof tiny, sizeof big };
+  const size_t n = sizeof headers / sizeof headers[0];
+  struct rpmdb_test t = { headers, lens, n, 0 };
+  char tmpdir[] = "/tmp/rpmdbXXXXXX";
+  CLEANUP_FREE char *filename = NULL;
+  size_t i;
+
+  /* The big header spans two SQLite overflow pages. */
+  for (i = 0; i < sizeof small; ++i)
+    small[i] = i;
+  memcpy (tiny, "tiny", 4);
+  for (i = 0; i < sizeof big; ++i)
+    big[i] = i * 7 + 3;
+
+  assert (mkdtemp (tmpdir) != NULL);
+  assert (asprintf (&filename, "%s/rpmdb", tmpdir) != -1);
+
+  g = guestfs_create ();
+  assert (g);
+
+  make_test_rpmdb_sqlite (filename, headers, lens, n);
+  assert (guestfs_int_read_rpmdb (g, filename, &t,
+                                  rpmdb_test_callback) == 0);
+  assert (t.seen == n);
+
+  t.seen = 0;
+  make_test_rpmdb_ndb (filename, headers, lens, n);
+  assert (guestfs_int_read_rpmdb (g, filename, &t,
+                                  rpmdb_test_callback) == 0);
+  assert (t.seen == n);
+
+  /* Neither format, so it is taken to be Berkeley DB. */
+  memset (big, 0, sizeof big);
+  write_test_file (filename, big, sizeof big);
+  guestfs_push_error_handler (g, NULL, NULL);
+  assert (guestfs_int_read_rpmdb (g, filename, &t,
+                                  rpmdb_test_callback) == -1);
+  guestfs_pop_error_handler (g);
+
+  guestfs_close (g);
+  unlink (filename);
+  rmdir (tmpdir);
+}
+
+static void
+write_osinfo_test_xml (const char *filename, const char *volume_id)
+{
+  CLEANUP_FREE char *xml = NULL;
+
+  assert (asprintf (&xml,
+                    "<libosinfo version=\"0.0.1\">\n"
+                    "  <os id=\"http://example.com/test/7.1\">\n"
+                    "    <name>Test Linux 7.1</name>\n"
+                    "    <version>7.1</version>\n"
+                    "    <family>linux</family>\n"
+                    "    <distro>fedora</distro>\n"
+                    "    <media arch=\"x86_64\" live=\"true\">\n"
+                    "      <iso><volume-id>%s</volume-id></iso>\n"
+                    "    </media>\n"
+                    "  </os>\n"
+                    "</libosinfo>\n", volume_id) != -1);
+  write_test_file (filename, (const unsigned char *) xml, strlen (xml));
+}
+
+/* Check the single entry in the test database and free it.  Entries
+ * read from the XML files own their strings, entries loaded from the
+ * index point into the mapped file.
+ */
+static void
+check_osinfo_test_db (struct osinfo *db, size_t nr,
+                      const char *volume_id, int from_xml)
+{
+  assert (nr == 1);
+  assert (db[0].type == OS_TYPE_LINUX);
+  assert (db[0].distro == OS_DISTRO_FEDORA);
+  assert (db[0].major_version == 7);
+  assert (db[0].minor_version == 1);
+  assert (db[0].is_live_disk == 1);
+  assert (STREQ (db[0].product_name, "Test Linux 7.1"));
+  assert (STREQ (db[0].arch, "x86_64"));
+  assert (db[0].system_id == NULL);
+  assert (STREQ (db[0].volume_id, volume_id));
+  assert (db[0].publisher_id == NULL);
+  assert (db[0].application_id == NULL);
+  assert (!db[0].compiled);
+
+  if (from_xml) {
+    free (db[0].product_name);
+    free (db[0].arch);
+    free (db[0].volume_id);
+  }
+  free (db);
+}
+
+/**
+ * Test the binary index of the libosinfo database used by
+ * C<guestfs_int_read_osinfo_db>.
+ *
+ * The XML file is rewritten in place (which does not change the
+ * directory) between loads, so the volume ID shows whether the
+ * entries came from the index or from the XML file.
+ */
+static void
+test_osinfo_index (void)
+{
+  guestfs_h *g;
+  char tmpdir[] = "/tmp/osinfoXXXXXX";
+  CLEANUP_FREE char *dir = NULL, *xml = NULL, *index = NULL;
+  struct osinfo *db;
+  size_t nr;
+  struct stat statbuf, statbuf2;
+  struct timeval tv[2];
+  int fd;
+
+  assert (mkdtemp (tmpdir) != NULL);
+  assert (asprintf (&dir, "%s/oses", tmpdir) != -1);
+  assert (asprintf (&xml, "%s/test.xml", dir) != -1);
+  assert (asprintf (&index, "%s/osinfo.idx", tmpdir) != -1);
+  assert (mkdir (dir, 0700) == 0);
+
+  g = guestfs_create ();
+  assert (g);
+
+  /* The first load reads the XML file and builds the index. */
+  write_osinfo_test_xml (xml, "TEST-1");
+  assert (guestfs_int_read_osinfo_db (g, dir, index, &db, &nr) == 0);
+  check_osinfo_test_db (db, nr, "TEST-1", 1);
+  assert (stat (index, &statbuf) == 0);
+
+  /* The next load comes from the index. */
+  write_osinfo_test_xml (xml, "TEST-2");
+  assert (guestfs_int_read_osinfo_db (g, dir, index, &db, &nr) == 0);
+  check_osinfo_test_db (db, nr, "TEST-1", 0);
+
+  /* Changing the modification time of the database directory makes
+   * the index stale, so it is rebuilt.
+   */
+  tv[0].tv_sec = tv[1].tv_sec = 1000000000;
+  tv[0].tv_usec = tv[1].tv_usec = 0;
+  assert (utimes (dir, tv) == 0);
+  assert (guestfs_int_read_osinfo_db (g, dir, index, &db, &nr) == 0);
+  check_osinfo_test_db (db, nr, "TEST-2", 1);
+  assert (stat (index, &statbuf2) == 0);
+  assert (statbuf2.st_ino != statbuf.st_ino);
+
+  write_osinfo_test_xml (xml, "TEST-3");
+  assert (guestfs_int_read_osinfo_db (g, dir, index, &db, &nr) == 0);
+  check_osinfo_test_db (db, nr, "TEST-2", 0);
+
+  /* A truncated index is rejected and rebuilt. */
+  assert (truncate (index, statbuf2.st_size - 1) == 0);
+  assert (guestfs_int_read_osinfo_db (g, dir, index, &db, &nr) == 0);
+  check_osinfo_test_db (db, nr, "TEST-3", 1);
+
+  write_osinfo_test_xml (xml, "TEST-4");
+  assert (guestfs_int_read_osinfo_db (g, dir, index, &db, &nr) == 0);
+  check_osinfo_test_db (db, nr, "TEST-3", 0);
+
+  /* So is an index whose string table is not '\0'-terminated. */
+  assert (stat (index, &statbuf) == 0);
+  fd = open (index, O_WRONLY|O_CLOEXEC);
+  assert (fd >= 0);
+  assert (pwrite (fd, "x", 1, statbuf.st_size - 1) == 1);
+  assert (close (fd) == 0);
+  assert (guestfs_int_read_osinfo_db (g, dir, index, &db, &nr) == 0);
+  check_osinfo_test_db (db, nr, "TEST-4", 1);
+
+  /* A missing database directory is not an error. */
+  assert (unlink (xml) == 0);
+  assert (rmdir (dir) == 0);
+  assert (guestfs_int_read_osinfo_db (g, dir, index, &db, &nr) == 0);
+  assert (db == NULL);
+  assert (nr == 0);
+
+  guestfs_close (g);
+  unlink (index);
+  rmdir (tmpdir);
+}
+
 int
 main (int argc, char *argv[])
 {
@@ -448,6 +1039,11 @@ main (int argc, char *argv[])
   test_timeval_diff ();
   test_match ();
   test_stringsbuf ();
+  test_parse_fstab ();
+  test_parse_mdadm_conf ();
+  test_parse_shellvar ();
+  test_read_rpmdb ();
+  test_osinfo_index ();
 
   exit (EXIT_SUCCESS);
 }
@@ -217,7 +217,6 @@ if (-f "fedora.mdadm") {
   unlink ("fedora.mdadm") or die;
 }
 
-$g->upload ($ENV{SRCDIR}.'/fedora-name.db', '/var/lib/rpm/Name');
 $g->upload ($ENV{SRCDIR}.'/fedora-packages.db', '/var/lib/rpm/Packages');
 
 $g->upload ($ENV{SRCDIR}.'/../binaries/bin-x86_64-dynamic', '/bin/ls');
@@ -78,6 +78,36 @@ eval {
         die "unexpected data: got ", $fieldname, "=", $actual,
         ", expected ", $fieldname, "=", $expected unless $actual eq $expected;
     }
+
+    # Export the whole journal again in one call, in two parts to
+    # check that continuing from a cursor works, and count the entries.
+    my $tmpfile = "test-journal.tmp";
+    my $export_count = 0;
+    my $cursor;
+    foreach my $part (1, 2) {
+        my %optargs = (fields => ["MESSAGE"]);
+        if ($part == 1) {
+            # The handle is at the end of the journal, so start again
+            # at the beginning.
+            $optargs{since} = 0;
+            $optargs{maxentries} = 1000;
+        } else {
+            $optargs{cursor} = $cursor;
+        }
+        $g->journal_export ($tmpfile, %optargs);
+        open my $fh, "<", $tmpfile or die "$tmpfile: $!";
+        while (<$fh>) {
+            if (m/^__CURSOR=(.*)$/) {
+                $export_count++;
+                $cursor = $1;
+            }
+        }
+        close $fh;
+    }
+    unlink $tmpfile;
+
+    die "incorrect # exported journal entries (got $export_count, expecting 2459)"
+        unless $export_count == 2459;
 };
 my $error = $@;
 $g->journal_close ();
@@ -0,0 +1,124 @@
+#!/bin/bash -
+# libguestfs
+# Copyright (C) 2016 Red Hat Inc.
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+# Test the daemon's cache of 'lvm fullreport': that repeated queries
+# don't run lvm again, and that lvcreate, lvresize and vgremove drop
+# the cache so the next query sees the change.
+
+set -e
+
+if [ -n "$SKIP_TEST_LVM_CACHE_SH" ]; then
+    echo "$0: skipping test because environment variable is set."
+    exit 77
+fi
+
+# The cache is only used if lvm in the appliance has fullreport.
+if ! guestfish -a /dev/null run : \
+        debug sh "lvm fullreport --help 2>&1" | grep -sq -- --reportformat
+then
+    echo "$0: skipping test because lvm does not support fullreport"
+    exit 77
+fi
+
+rm -f test-lvm-cache.img test-lvm-cache.out
+
+guestfish > test-lvm-cache.out <<'EOF'
+sparse test-lvm-cache.img 256M
+run
+
+part-disk /dev/sda mbr
+pvcreate /dev/sda1
+vgcreate VG /dev/sda1
+lvcreate LV1 VG 32
+
+# Fill the cache.
+lvs
+echo ==stats1==
+debug command_stats ""
+
+# These should all be answered from the cache.
+echo ==queries==
+lvs
+vgs
+pvs
+echo ==stats2==
+debug command_stats ""
+
+lvcreate LV2 VG 32
+echo ==lvcreate==
+lvs
+
+lvresize /dev/VG/LV1 64
+echo ==lvresize==
+lvs-full | grep -c 'lv_size: 67108864'
+
+vgremove VG
+echo ==vgremove==
+vgs
+lvs
+echo ==end==
+EOF
+
+# Print the lines between two markers.
+section ()
+{
+    sed -n "/^==$1==\$/,/^==/p" test-lvm-cache.out | sed '1d;$d'
+}
+
+# Print the number of times lvm was run, from a command_stats table.
+lvm_count ()
+{
+    section "$1" | awk '$1 == "lvm" { print $2 }'
+}
+
+fail ()
+{
+    echo "$0: $1.  Output was:"
+    cat test-lvm-cache.out
+    exit 1
+}
+
+c1="$(lvm_count stats1)"
+c2="$(lvm_count stats2)"
+if [ -z "$c1" ] || [ -z "$c2" ]; then
+    fail "lvm is missing from command_stats"
+fi
+if [ "$c2" -ne "$c1" ]; then
+    fail "lvs, vgs and pvs ran lvm $((c2 - c1)) times instead of using the cache"
+fi
+
+if [ "$(section queries)" != "/dev/VG/LV1
+VG
+/dev/sda1" ]; then
+    fail "unexpected output from lvs, vgs and pvs"
+fi
+
+if [ "$(section lvcreate | sort)" != "/dev/VG/LV1
+/dev/VG/LV2" ]; then
+    fail "lvs did not see the new LV after lvcreate"
+fi
+
+if [ "$(section lvresize)" != "1" ]; then
+    fail "lvs-full did not see the new size after lvresize"
+fi
+
+if [ -n "$(section vgremove)" ]; then
+    fail "vgs or lvs still see the VG after vgremove"
+fi
+
+rm test-lvm-cache.img test-lvm-cache.out
@@ -0,0 +1,166 @@
+#!/bin/bash -
+# libguestfs
+# Copyright (C) 2016 Red Hat Inc.
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+# Test that the cache of small guest files kept by inspection
+# (src/file-cache.c) never returns stale or foreign content.  The
+# files are made bigger than the probe returns in full, so that they
+# are read through the cache.
+
+set -e
+export LANG=C
+
+canonical="sed -r s,/dev/[abce-ln-z]+d,/dev/sd,g"
+
+if [ "$(guestfish get-backend)" = "uml" ]; then
+    echo "$0: skipping test because uml backend does not support qcow2"
+    exit 77
+fi
+
+rm -f inspect-file-cache-1.qcow2 inspect-file-cache-2.img
+rm -f inspect-file-cache.{1,2} inspect-file-cache.output
+rm -f inspect-file-cache.trace
+
+# Write a config file to $1 whose first line is $2, padded out to
+# more than 4096 bytes.
+make_file ()
+{
+    {
+        echo "$2"
+        for i in $(seq 1 100); do
+            echo "# padding line $i ......................................"
+        done
+    } > "$1"
+}
+
+# Change the hostname of the fedora image between two inspections
+# using the same handle.  The second inspection must see the new
+# hostname.
+guestfish -- \
+  disk-create inspect-file-cache-1.qcow2 qcow2 -1 \
+    backingfile:../../test-data/phony-guests/fedora.img backingformat:raw
+
+make_file inspect-file-cache.1 "HOSTNAME=first.invalid"
+make_file inspect-file-cache.2 "HOSTNAME=other.invalid"
+
+guestfish --format=qcow2 -a inspect-file-cache-1.qcow2 <<'EOF' > inspect-file-cache.output
+  run
+  mount /dev/VG/Root /
+  upload inspect-file-cache.1 /etc/sysconfig/network
+  umount-all
+  inspect-os
+  inspect-get-hostname /dev/VG/Root
+  mount /dev/VG/Root /
+  upload inspect-file-cache.2 /etc/sysconfig/network
+  umount-all
+  inspect-os
+  inspect-get-hostname /dev/VG/Root
+EOF
+
+if [ "$(cat inspect-file-cache.output)" != "/dev/VG/Root
+first.invalid
+/dev/VG/Root
+other.invalid" ]; then
+    echo "$0: error #1: unexpected hostname after changing /etc/sysconfig/network"
+    cat inspect-file-cache.output
+    exit 1
+fi
+
+# Two root filesystems with the same file at the same path, and the
+# same size and mtime.  Inspection mounts each of them in turn on /,
+# so the second must not be given the cached copy from the first.
+make_file inspect-file-cache.1 "one.invalid"
+make_file inspect-file-cache.2 "two.invalid"
+
+guestfish -- disk-create inspect-file-cache-2.img raw 64M
+
+guestfish --format=raw -a inspect-file-cache-2.img <<'EOF'
+  run
+  part-init /dev/sda mbr
+  part-add /dev/sda p 64 65535
+  part-add /dev/sda p 65536 -64
+
+  mkfs ext2 /dev/sda1
+  mount /dev/sda1 /
+  mkdir /bin
+  mkdir /etc
+  touch /etc/fstab
+  write /etc/debian_version "8.0"
+  upload inspect-file-cache.1 /etc/hostname
+  utimens /etc/hostname 1000000000 0 1000000000 0
+  umount-all
+
+  mkfs ext2 /dev/sda2
+  mount /dev/sda2 /
+  mkdir /bin
+  mkdir /etc
+  touch /etc/fstab
+  write /etc/debian_version "8.0"
+  upload inspect-file-cache.2 /etc/hostname
+  utimens /etc/hostname 1000000000 0 1000000000 0
+  umount-all
+EOF
+
+guestfish --ro --format=raw -a inspect-file-cache-2.img <<'EOF' | $canonical > inspect-file-cache.output
+  run
+  inspect-os
+  inspect-get-hostname /dev/sda1
+  inspect-get-hostname /dev/sda2
+  inspect-os
+  inspect-get-hostname /dev/sda1
+  inspect-get-hostname /dev/sda2
+EOF
+
+if [ "$(cat inspect-file-cache.output)" != "/dev/sda1
+/dev/sda2
+one.invalid
+two.invalid
+/dev/sda1
+/dev/sda2
+one.invalid
+two.invalid" ]; then
+    echo "$0: error #2: filesystems with the same /etc/hostname were confused"
+    cat inspect-file-cache.output
+    exit 1
+fi
+
+# Inspecting again with the same handle must take /etc/hostname from
+# the cache.  Inspection only makes read-only calls to the daemon, so
+# nothing empties the cache between the two inspections, and the
+# trace shows no read_file calls after the marker (get-program).
+guestfish -x --ro --format=raw -a inspect-file-cache-2.img \
+  2> inspect-file-cache.trace >/dev/null <<'EOF'
+  run
+  inspect-os
+  get-program
+  inspect-os
+EOF
+
+reads='trace: read_file "/etc/hostname"$'
+first="$(sed '/trace: get_program$/,$d' inspect-file-cache.trace |
+         grep -c "$reads" ||:)"
+second="$(sed -n '/trace: get_program$/,$p' inspect-file-cache.trace |
+          grep -c "$reads" ||:)"
+
+if [ "$first" -eq 0 ] || [ "$second" -ne 0 ]; then
+    echo "$0: error #3: /etc/hostname was not read from the cache"
+    echo "read_file calls: first inspection $first, second inspection $second"
+    exit 1
+fi
+
+rm inspect-file-cache-1.qcow2 inspect-file-cache-2.img
+rm inspect-file-cache.{1,2} inspect-file-cache.output inspect-file-cache.trace
@@ -0,0 +1,277 @@
+/* libguestfs
+ * Copyright (C) 2016 Red Hat Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/* Test that mount-local returns the whole of a file which is larger
+ * than the read-ahead window, when it is read sequentially at
+ * unaligned offsets and sizes.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <errno.h>
+#include <error.h>
+
+#include "guestfs.h"
+#include "guestfs-internal-frontend.h"
+
+#define PATTERN "abcdefghijklmnopqrstuvwxyz0123456789!"
+#define PATTERN_LEN (sizeof PATTERN - 1)
+
+/* Several times the 4 MB read-ahead window, and not a multiple of
+ * the page size.
+ */
+#define FILE_SIZE (13 * 1024 * 1024 + 4321)
+
+static const char mp[] = "mp-readahead";
+
+static void test_mountpoint (void);
+static int check_read (int fd, off_t offset, size_t step);
+static int guestunmount (void);
+
+int
+main (int argc, char *argv[])
+{
+  guestfs_h *g;
+  char *skip;
+  pid_t pid;
+  int status, r;
+
+  /* If the --test flag is given, then this is the test subprocess. */
+  if (argc == 2 && STREQ (argv[1], "--test")) {
+    test_mountpoint ();
+    exit (EXIT_SUCCESS);
+  }
+
+  /* Allow the test to be skipped by setting an environment variable. */
+  skip = getenv ("SKIP_TEST_MOUNT_LOCAL_READAHEAD");
+  if (skip && guestfs_int_is_true (skip) > 0) {
+    fprintf (stderr, "%s: test skipped because environment variable set.\n",
+             guestfs_int_program_name);
+    exit (77);
+  }
+
+  if (access ("/dev/fuse", W_OK) == -1) {
+    fprintf (stderr, "%s: test skipped because /dev/fuse is not writable.\n",
+             guestfs_int_program_name);
+    exit (77);
+  }
+
+  g = guestfs_create ();
+  if (g == NULL)
+    error (EXIT_FAILURE, errno, "guestfs_create");
+
+  if (guestfs_add_drive_scratch (g, 64*1024*1024, -1) == -1)
+    exit (EXIT_FAILURE);
+  if (guestfs_launch (g) == -1)
+    exit (EXIT_FAILURE);
+
+  if (guestfs_part_disk (g, "/dev/sda", "mbr") == -1)
+    exit (EXIT_FAILURE);
+  if (guestfs_mkfs (g, "ext2", "/dev/sda1") == -1)
+    exit (EXIT_FAILURE);
+  if (guestfs_mount (g, "/dev/sda1", "/") == -1)
+    exit (EXIT_FAILURE);
+
+  if (guestfs_fill_pattern (g, PATTERN, FILE_SIZE, "/file") == -1)
+    exit (EXIT_FAILURE);
+
+  rmdir (mp);
+  if (mkdir (mp, 0700) == -1)
+    error (EXIT_FAILURE, errno, "mkdir: %s", mp);
+
+  if (guestfs_mount_local (g, mp, GUESTFS_MOUNT_LOCAL_READONLY, 1, -1) == -1) {
+    rmdir (mp);
+    exit (EXIT_FAILURE);
+  }
+
+  /* Run the test in an exec'd subprocess, as in
+   * test-parallel-mount-local.c.
+   */
+  pid = fork ();
+  if (pid == -1)
+    error (EXIT_FAILURE, errno, "fork");
+
+  if (pid == 0) { /* child */
+    setpgid (0, 0);
+    execlp ("./test-mount-local-readahead",
+            "test-mount-local-readahead", "--test", NULL);
+    perror ("execlp");
+    _exit (EXIT_FAILURE);
+  }
+
+  r = guestfs_mount_local_run (g);
+
+ again:
+  if (waitpid (pid, &status, 0) == -1) {
+    if (errno == EINTR)
+      goto again;
+    error (EXIT_FAILURE, errno, "waitpid");
+  }
+
+  rmdir (mp);
+
+  if (!WIFEXITED (status) || WEXITSTATUS (status) != 0) {
+    char status_string[80];
+
+    fprintf (stderr, "%s: %s\n", guestfs_int_program_name,
+             guestfs_int_exit_status_to_string (status, "test",
+                                                status_string,
+                                                sizeof status_string));
+    exit (EXIT_FAILURE);
+  }
+  if (r == -1)
+    exit (EXIT_FAILURE);
+
+  if (guestfs_shutdown (g) == -1)
+    exit (EXIT_FAILURE);
+  guestfs_close (g);
+
+  exit (EXIT_SUCCESS);
+}
+
+/* This runs as a subprocess and reads the file through the mountpoint. */
+static void
+test_mountpoint (void)
+{
+  /* Pairs of (starting offset, read size).  Each pass reads from
+   * the starting offset to the end of the file, so every pass
+   * crosses the boundaries of several read-ahead windows.
+   */
+  static const struct { off_t offset; size_t step; } passes[] = {
+    { 0, 65536 },
+    { 1, 4099 },
+    { 4*1024*1024 - 3, 131071 },
+    { 12345, 1000000 },
+    { 8*1024*1024 + 1, 7 * 4096 + 11 },
+  };
+  size_t i;
+  int fd, ret = EXIT_FAILURE;
+  CLEANUP_FREE char *file = NULL;
+
+  if (asprintf (&file, "%s/file", mp) == -1)
+    error (EXIT_FAILURE, errno, "asprintf");
+
+  for (i = 0; i < sizeof passes / sizeof passes[0]; ++i) {
+    /* Use a fresh file descriptor and drop the page cache for the
+     * file each time, so that every pass goes through FUSE again.
+     */
+    fd = open (file, O_RDONLY);
+    if (fd == -1) {
+      perror (file);
+      goto error;
+    }
+    posix_fadvise (fd, 0, 0, POSIX_FADV_DONTNEED);
+
+    if (check_read (fd, passes[i].offset, passes[i].step) == -1) {
+      close (fd);
+      goto error;
+    }
+    if (close (fd) == -1) {
+      perror (file);
+      goto error;
+    }
+  }
+
+  ret = EXIT_SUCCESS;
+ error:
+  if (guestunmount () == -1)
+    error (EXIT_FAILURE, 0, "guestunmount %s: failed, see earlier errors", mp);
+
+  exit (ret);
+}
+
+/* Read from 'offset' to the end of the file in chunks of 'step'
+ * bytes, checking that no read comes back short before the end of
+ * the file and that the data matches the pattern.
+ */
+static int
+check_read (int fd, off_t offset, size_t step)
+{
+  CLEANUP_FREE char *buf = NULL;
+  off_t pos = offset;
+  ssize_t r;
+  size_t want, i;
+
+  buf = malloc (step);
+  if (buf == NULL) {
+    perror ("malloc");
+    return -1;
+  }
+
+  if (lseek (fd, offset, SEEK_SET) == -1) {
+    perror ("lseek");
+    return -1;
+  }
+
+  for (;;) {
+    want = step;
+    if (pos + (off_t) want > FILE_SIZE)
+      want = FILE_SIZE - pos;
+
+    r = read (fd, buf, step);
+    if (r == -1) {
+      perror ("read");
+      return -1;
+    }
+    if ((size_t) r != want) {
+      fprintf (stderr, "%s: read at offset %ld returned %zd bytes, "
+               "expected %zu\n",
+               guestfs_int_program_name, (long) pos, r, want);
+      return -1;
+    }
+    if (r == 0)
+      break;
+
+    for (i = 0; i < (size_t) r; ++i) {
+      if (buf[i] != PATTERN[(pos + i) % PATTERN_LEN]) {
+        fprintf (stderr, "%s: data mismatch at offset %ld\n",
+                 guestfs_int_program_name, (long) (pos + i));
+        return -1;
+      }
+    }
+
+    pos += r;
+  }
+
+  return 0;
+}
+
+static int
+guestunmount (void)
+{
+  char cmd[256];
+  int status;
+
+  snprintf (cmd, sizeof cmd, "../../fuse/guestunmount %s", mp);
+
+  status = system (cmd);
+  if (!WIFEXITED (status) || WEXITSTATUS (status) != 0) {
+    fprintf (stderr, "guestunmount exited with bad status (%d)\n", status);
+    return -1;
+  }
+
+  return 0;
+}
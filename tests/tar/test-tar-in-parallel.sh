@@ -0,0 +1,87 @@
+#!/bin/bash -
+# libguestfs
+# Copyright (C) 2016 Red Hat Inc.
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+# Test tar-in with xz and zstd input decompressed in the daemon.
+# This only happens when the appliance has more than one vCPU and
+# enough memory, so the tests in tests/c-api don't cover it.
+
+set -e
+export LANG=C
+
+if [ -n "$SKIP_TEST_TAR_IN_PARALLEL_SH" ]; then
+    echo "$0: test skipped because environment variable is set."
+    exit 77
+fi
+
+files=$srcdir/../../test-data/files
+
+rm -f test-tar-in-parallel.out test-tar-in-parallel.err
+
+guestfish > test-tar-in-parallel.out 2> test-tar-in-parallel.err <<EOF
+set-smp 2
+set-memsize 1280
+scratch 100M
+run
+mkfs ext2 /dev/sda
+mount /dev/sda /
+
+mkdir /xz
+tar-in $files/helloworld.tar.xz /xz compress:xz
+cat /xz/hello
+mkdir /xz-blocks
+tar-in $files/helloworld-blocks.tar.xz /xz-blocks compress:xz
+cat /xz-blocks/world
+mkdir /zstd
+tar-in $files/helloworld.tar.zst /zstd compress:zstd
+cat /zstd/hello
+mkdir /zstd-frames
+tar-in $files/helloworld-frames.tar.zst /zstd-frames compress:zstd
+cat /zstd-frames/world
+
+# These must fail, and leave the daemon working.
+mkdir /xz-corrupt
+-tar-in $files/helloworld-corrupt.tar.xz /xz-corrupt compress:xz
+mkdir /zstd-truncated
+-tar-in $files/helloworld-truncated.tar.zst /zstd-truncated compress:zstd
+ping-daemon
+echo done
+EOF
+
+fail ()
+{
+    echo "$0: $1"
+    echo "stdout:"
+    cat test-tar-in-parallel.out
+    echo "stderr:"
+    cat test-tar-in-parallel.err
+    exit 1
+}
+
+if [ "$(cat test-tar-in-parallel.out)" != "hello
+world
+hello
+world
+done" ]; then
+    fail "unexpected output"
+fi
+
+if [ "$(grep -c 'error: tar_in' test-tar-in-parallel.err)" -ne 2 ]; then
+    fail "corrupt or truncated input did not fail"
+fi
+
+rm test-tar-in-parallel.out test-tar-in-parallel.err
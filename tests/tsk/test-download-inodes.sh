@@ -0,0 +1,68 @@
+#!/bin/bash -
+# libguestfs
+# Copyright (C) 2016 Red Hat Inc.
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+# Test the download_inodes command.
+
+set -e
+
+if [ -n "$SKIP_TEST_DOWNLOAD_INODES_SH" ]; then
+    echo "$0: test skipped because environment variable is set."
+    exit 77
+fi
+
+rm -f test-inodes.tar test-inodes.cpio
+rm -rf test-inodes.d
+
+# Skip if libtsk is not supported by the appliance.
+if ! guestfish add /dev/null : run : available "libtsk"; then
+    echo "$0: skipped because libtsk is not available in the appliance"
+    exit 77
+fi
+
+if [ ! -s ../../test-data/phony-guests/windows.img ]; then
+    echo "$0: skipped because windows.img is zero-sized"
+    exit 77
+fi
+
+# download the Master File Table ($MFT) and the $MFTMirr (inode 1).
+guestfish --ro --format=raw -a ../../test-data/phony-guests/windows.img <<EOF2
+run
+download-inodes /dev/sda2 "0 1" test-inodes.tar
+download-inodes /dev/sda2 "0 1" test-inodes.cpio format:cpio
+EOF2
+
+mkdir test-inodes.d
+tar -xf test-inodes.tar -C test-inodes.d
+
+if [ "$(head -c 5 test-inodes.d/0)" != "FILE0" ] ||
+   [ "$(head -c 5 test-inodes.d/1)" != "FILE0" ]; then
+    echo "$0: wrong files extracted from the tar archive."
+    exit 1
+fi
+
+rm -r test-inodes.d
+mkdir test-inodes.d
+(cd test-inodes.d && cpio --quiet -id < ../test-inodes.cpio)
+
+if [ "$(head -c 5 test-inodes.d/0)" != "FILE0" ]; then
+    echo "$0: wrong file extracted from the cpio archive."
+    exit 1
+fi
+
+rm -r test-inodes.d
+rm -f test-inodes.tar test-inodes.cpio
@@ -0,0 +1,374 @@
+/* libguestfs
+ * Copyright (C) 2016 Red Hat Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/* See instructions in inspect-benchmark.1 */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <limits.h>
+#include <time.h>
+#include <errno.h>
+#include <error.h>
+#include <assert.h>
+#include <math.h>
+
+#include "guestfs.h"
+#include "guestfs-internal-frontend.h"
+
+#include "boot-analysis-utils.h"
+
+#define NR_WARMUP_PASSES 1
+#define NR_TEST_PASSES   5
+
+/* Size of each partition and logical volume, in MB. */
+#define FS_SIZE_MB 32
+
+static int nr_partitions = 16;
+static int nr_lvs = 16;
+static int memsize = 0;
+static int smp = 1;
+
+static char disk[] = "/tmp/inspect-benchmarkXXXXXX";
+static int disk_created = 0;
+
+static void create_disk (void);
+static void run_test (void);
+static int64_t run_one_pass (int print_stats);
+static guestfs_h *create_handle (void);
+static void cleanup_disk (void);
+
+static void
+usage (int exitcode)
+{
+  guestfs_h *g;
+  int default_memsize = -1;
+
+  g = guestfs_create ();
+  if (g) {
+    default_memsize = guestfs_get_memsize (g);
+    guestfs_close (g);
+  }
+
+  fprintf (stderr,
+           "inspect-benchmark: Benchmark filesystem listing and inspection.\n"
+           "Usage:\n"
+           "  inspect-benchmark [--options]\n"
+           "Options:\n"
+           "  --help         Display this usage text and exit.\n"
+           "  --lvs N        Create N logical volumes (default: %d).\n"
+           "  -m MB\n"
+           "  --memsize MB   Set memory size in MB (default: %d).\n"
+           "  --partitions N Create N partitions (default: %d).\n"
+           "  --smp N        Enable N virtual CPUs (default: 1).\n",
+           nr_lvs, default_memsize, nr_partitions);
+  exit (exitcode);
+}
+
+static int
+parse_int_arg (const char *name, const char *arg)
+{
+  int r;
+
+  if (sscanf (arg, "%d", &r) != 1 || r < 0) {
+    fprintf (stderr, "%s: could not parse %s parameter: %s\n",
+             guestfs_int_program_name, name, arg);
+    exit (EXIT_FAILURE);
+  }
+  return r;
+}
+
+int
+main (int argc, char *argv[])
+{
+  enum { HELP_OPTION = CHAR_MAX + 1 };
+  static const char *options = "m:";
+  static const struct option long_options[] = {
+    { "help", 0, 0, HELP_OPTION },
+    { "lvs", 1, 0, 0 },
+    { "memsize", 1, 0, 'm' },
+    { "partitions", 1, 0, 0 },
+    { "smp", 1, 0, 0 },
+    { 0, 0, 0, 0 }
+  };
+  int c, option_index;
+
+  for (;;) {
+    c = getopt_long (argc, argv, options, long_options, &option_index);
+    if (c == -1) break;
+
+    switch (c) {
+    case 0:                     /* Options which are long only. */
+      if (STREQ (long_options[option_index].name, "lvs")) {
+        nr_lvs = parse_int_arg ("lvs", optarg);
+        break;
+      }
+      else if (STREQ (long_options[option_index].name, "partitions")) {
+        nr_partitions = parse_int_arg ("partitions", optarg);
+        break;
+      }
+      else if (STREQ (long_options[option_index].name, "smp")) {
+        smp = parse_int_arg ("smp", optarg);
+        break;
+      }
+      fprintf (stderr, "%s: unknown long option: %s (%d)\n",
+               guestfs_int_program_name, long_options[option_index].name, option_index);
+      exit (EXIT_FAILURE);
+
+    case 'm':
+      memsize = parse_int_arg ("memsize", optarg);
+      break;
+
+    case HELP_OPTION:
+      usage (EXIT_SUCCESS);
+
+    default:
+      usage (EXIT_FAILURE);
+    }
+  }
+
+  /* GPT allows 128 partitions, and we need one for the PV. */
+  if (nr_partitions > 120) {
+    fprintf (stderr, "%s: too many partitions (max 120)\n",
+             guestfs_int_program_name);
+    exit (EXIT_FAILURE);
+  }
+
+  atexit (cleanup_disk);
+  create_disk ();
+  run_test ();
+  exit (EXIT_SUCCESS);
+}
+
+/* Create the scratch disk.  This contains 'nr_partitions' partitions
+ * each with an ext4 filesystem, followed by one partition used as an
+ * LVM PV containing 'nr_lvs' logical volumes, also each with an ext4
+ * filesystem.
+ */
+static void
+create_disk (void)
+{
+  guestfs_h *g;
+  int fd;
+  int i;
+  int64_t start, sectors;
+  const int64_t fs_sectors = FS_SIZE_MB * 1024 * 1024 / 512;
+  int64_t size;
+  char name[64];
+
+  fd = mkstemp (disk);
+  if (fd == -1)
+    error (EXIT_FAILURE, errno, "mkstemp: %s", disk);
+  close (fd);
+  disk_created = 1;
+
+  /* Leave room for the GPT and the LVM metadata. */
+  size = (int64_t) (nr_partitions + nr_lvs + 4) * FS_SIZE_MB * 1024 * 1024;
+
+  printf ("Creating test disk with %d partitions and %d logical volumes ...\n",
+          nr_partitions, nr_lvs);
+
+  g = create_handle ();
+  if (guestfs_disk_create (g, disk, "raw", size, -1) == -1)
+    exit (EXIT_FAILURE);
+  if (guestfs_add_drive_opts (g, disk,
+                              GUESTFS_ADD_DRIVE_OPTS_FORMAT, "raw",
+                              -1) == -1)
+    exit (EXIT_FAILURE);
+  if (guestfs_launch (g) == -1)
+    exit (EXIT_FAILURE);
+
+  if (guestfs_part_init (g, "/dev/sda", "gpt") == -1)
+    exit (EXIT_FAILURE);
+
+  start = 2048;
+  for (i = 0; i < nr_partitions; ++i) {
+    if (guestfs_part_add (g, "/dev/sda", "p",
+                          start, start + fs_sectors - 1) == -1)
+      exit (EXIT_FAILURE);
+    start += fs_sectors;
+  }
+
+  if (nr_lvs > 0) {
+    const char *pvs[2];
+
+    sectors = (int64_t) (nr_lvs + 1) * fs_sectors;
+    if (guestfs_part_add (g, "/dev/sda", "p",
+                          start, start + sectors - 1) == -1)
+      exit (EXIT_FAILURE);
+
+    snprintf (name, sizeof name, "/dev/sda%d", nr_partitions + 1);
+    if (guestfs_pvcreate (g, name) == -1)
+      exit (EXIT_FAILURE);
+    pvs[0] = name;
+    pvs[1] = NULL;
+    if (guestfs_vgcreate (g, "VG", (char **) pvs) == -1)
+      exit (EXIT_FAILURE);
+
+    for (i = 0; i < nr_lvs; ++i) {
+      snprintf (name, sizeof name, "LV%d", i + 1);
+      if (guestfs_lvcreate (g, name, "VG", FS_SIZE_MB) == -1)
+        exit (EXIT_FAILURE);
+      snprintf (name, sizeof name, "/dev/VG/LV%d", i + 1);
+      if (guestfs_mkfs (g, "ext4", name) == -1)
+        exit (EXIT_FAILURE);
+    }
+  }
+
+  for (i = 0; i < nr_partitions; ++i) {
+    snprintf (name, sizeof name, "/dev/sda%d", i + 1);
+    if (guestfs_mkfs (g, "ext4", name) == -1)
+      exit (EXIT_FAILURE);
+  }
+
+  if (guestfs_shutdown (g) == -1)
+    exit (EXIT_FAILURE);
+  guestfs_close (g);
+}
+
+static void
+run_test (void)
+{
+  guestfs_h *g;
+  size_t i;
+  int64_t ns[NR_TEST_PASSES];
+  double mean;
+  double variance;
+  double sd;
+
+  printf ("Warming up the libguestfs cache ...\n");
+  for (i = 0; i < NR_WARMUP_PASSES; ++i)
+    run_one_pass (0);
+
+  printf ("Running the tests ...\n");
+  for (i = 0; i < NR_TEST_PASSES; ++i)
+    ns[i] = run_one_pass (i == NR_TEST_PASSES-1);
+
+  /* Calculate the mean. */
+  mean = 0;
+  for (i = 0; i < NR_TEST_PASSES; ++i)
+    mean += ns[i];
+  mean /= NR_TEST_PASSES;
+
+  /* Calculate the variance and standard deviation. */
+  variance = 0;
+  for (i = 0; i < NR_TEST_PASSES; ++i)
+    variance += pow (ns[i] - mean, 2);
+  variance /= NR_TEST_PASSES;
+  sd = sqrt (variance);
+
+  /* Print the test parameters. */
+  printf ("\n");
+  g = create_handle ();
+  test_info (g, NR_TEST_PASSES);
+  guestfs_close (g);
+  printf ("partitions                %d\n", nr_partitions);
+  printf ("logical volumes           %d\n", nr_lvs);
+
+  /* Print the result. */
+  printf ("\n");
+  printf ("Result: %.1fms ±%.1fms\n", mean / 1000000, sd / 1000000);
+}
+
+/* Launch the appliance, then list the filesystems and inspect the
+ * disk.  Returns the time taken in nanoseconds.  If 'print_stats'
+ * is true, also print the daemon's per-program command counters,
+ * which show where the time inside the appliance went.
+ */
+static int64_t
+run_one_pass (int print_stats)
+{
+  guestfs_h *g;
+  struct timespec start_t, end_t;
+  char **filesystems, **roots;
+  size_t i;
+
+  g = create_handle ();
+  if (guestfs_add_drive_opts (g, disk,
+                              GUESTFS_ADD_DRIVE_OPTS_FORMAT, "raw",
+                              GUESTFS_ADD_DRIVE_OPTS_READONLY, 1,
+                              -1) == -1)
+    exit (EXIT_FAILURE);
+
+  get_time (&start_t);
+  if (guestfs_launch (g) == -1)
+    exit (EXIT_FAILURE);
+  filesystems = guestfs_list_filesystems (g);
+  if (filesystems == NULL)
+    exit (EXIT_FAILURE);
+  roots = guestfs_inspect_os (g);
+  if (roots == NULL)
+    exit (EXIT_FAILURE);
+  get_time (&end_t);
+
+  for (i = 0; filesystems[i] != NULL; ++i)
+    free (filesystems[i]);
+  free (filesystems);
+  for (i = 0; roots[i] != NULL; ++i)
+    free (roots[i]);
+  free (roots);
+
+  if (print_stats) {
+    const char *args[] = { NULL };
+    CLEANUP_FREE char *stats =
+      guestfs_debug (g, "command_stats", (char **) args);
+
+    if (stats) {
+      printf ("\n");
+      printf ("External commands run by the daemon (last pass):\n");
+      printf ("%s", stats);
+    }
+  }
+
+  guestfs_close (g);
+
+  return timespec_diff (&start_t, &end_t);
+}
+
+/* Common function to create the handle and set various defaults. */
+static guestfs_h *
+create_handle (void)
+{
+  guestfs_h *g;
+
+  g = guestfs_create ();
+  if (!g) error (EXIT_FAILURE, errno, "guestfs_create");
+
+  if (memsize != 0)
+    if (guestfs_set_memsize (g, memsize) == -1)
+      exit (EXIT_FAILURE);
+
+  if (smp >= 2)
+    if (guestfs_set_smp (g, smp) == -1)
+      exit (EXIT_FAILURE);
+
+  return g;
+}
+
+static void
+cleanup_disk (void)
+{
+  if (disk_created)
+    unlink (disk);
+}
@@ -372,21 +372,19 @@ and do_fstrim g inspect =
     function (_, ("unknown"|"swap")) -> None | (dev, _) -> Some dev
   ) fses in
 
-  (* Trim the filesystems. *)
+  (* Trim the filesystems.  The daemon mounts and trims them in
+   * parallel.
+   *)
+  g#umount_all ();
+  let status = g#trim_filesystems (Array.of_list fses) in
   List.iter (
-    fun dev ->
-      g#umount_all ();
-      let mounted = try g#mount dev "/"; true with G.Error _ -> false in
-      if mounted then (
-        try g#fstrim "/"
-        with G.Error msg ->
-          (* Only emit this warning when debugging, because otherwise
-           * it causes distress (RHBZ#1168144).
-           *)
-          if verbose () then
-            warning (f_"%s (ignored)") msg
-      )
-  ) fses
+    fun (dev, msg) ->
+      (* Only emit this warning when debugging, because otherwise
+       * it causes distress (RHBZ#1168144).
+       *)
+      if msg <> "" && verbose () then
+        warning (f_"%s: %s (ignored)") dev msg
+  ) status
 
 (* Estimate the space required on the target for each disk.  It is the
  * maximum space that might be required, but in reasonable cases much